@@ -0,0 +1,253 @@
+//--------------------------------------------------------------------------------------
+// Animation clips - keyframed translation, rotation and scale for the nodes of a mesh
+//--------------------------------------------------------------------------------------
+
+#include "AnimationClip.h"
+#include "MeshData.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+
+//--------------------------------------------------------------------------------------
+// Sampling
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    // Find the last key at or before the given time in a track's sorted key times (the first key if the time is
+    // before all of them). When playback is moving forwards the search starts from the cursor's key, otherwise it
+    // is a binary search. The cursor is updated to the key found
+    inline uint32_t FindKey(const float* times, uint32_t numKeys, float time, bool forwards, uint32_t& cursorKey)
+    {
+        uint32_t key = cursorKey;
+        if (forwards && key < numKeys)
+        {
+            while (key + 1 < numKeys && times[key + 1] <= time)  ++key;
+        }
+        else
+        {
+            key = static_cast<uint32_t>(std::upper_bound(times, times + numKeys, time) - times);
+            key = (key > 0) ? key - 1 : 0;
+        }
+        cursorKey = key;
+        return key;
+    }
+
+    // Fraction of the way from the given key to the next one at the given time. 0 if it is the last key
+    inline float KeyFraction(const float* times, uint32_t numKeys, uint32_t key, float time)
+    {
+        if (key + 1 >= numKeys)  return 0;
+        float t = (time - times[key]) / (times[key + 1] - times[key]);
+        return std::min(std::max(t, 0.0f), 1.0f);
+    }
+}
+
+
+// Calculate the matrices of the animated nodes at the given time (in seconds) and write them into the given array
+// of node matrices (relative to parent, the same as Model's matrices). Nodes without tracks are left unchanged.
+// Times outside the clip are clamped to the first / last keys. The cursor is updated to the new time
+void AnimationClip::Sample(float time, AnimationCursor& cursor, CMatrix4x4* nodeMatrices) const
+{
+    bool forwards = (time >= cursor.time);
+    if (cursor.keys.size() != tracks.size() * 3)
+    {
+        cursor.keys.assign(tracks.size() * 3, 0);
+        forwards = false;
+    }
+    cursor.time = time;
+
+    uint32_t* cursorKeys = cursor.keys.data();
+    for (auto& track : tracks)
+    {
+        // Translation and scale are interpolated linearly
+        const float* times = translations.times.data() + track.firstTranslation;
+        uint32_t key = FindKey(times, track.numTranslations, time, forwards, cursorKeys[0]);
+        float t = KeyFraction(times, track.numTranslations, key, time);
+        key += track.firstTranslation;
+        uint32_t next = (t > 0) ? key + 1 : key;
+        float tx = translations.values[0][key] + (translations.values[0][next] - translations.values[0][key]) * t;
+        float ty = translations.values[1][key] + (translations.values[1][next] - translations.values[1][key]) * t;
+        float tz = translations.values[2][key] + (translations.values[2][next] - translations.values[2][key]) * t;
+
+        times = scales.times.data() + track.firstScale;
+        key = FindKey(times, track.numScales, time, forwards, cursorKeys[2]);
+        t = KeyFraction(times, track.numScales, key, time);
+        key += track.firstScale;
+        next = (t > 0) ? key + 1 : key;
+        float sx = scales.values[0][key] + (scales.values[0][next] - scales.values[0][key]) * t;
+        float sy = scales.values[1][key] + (scales.values[1][next] - scales.values[1][key]) * t;
+        float sz = scales.values[2][key] + (scales.values[2][next] - scales.values[2][key]) * t;
+
+        // Rotations use a normalised linear interpolation (nlerp) of the quaternions. Keys are close together so
+        // this is very close to a slerp, and much cheaper. The second quaternion is negated if needed so the
+        // interpolation takes the shortest path
+        times = rotations.times.data() + track.firstRotation;
+        key = FindKey(times, track.numRotations, time, forwards, cursorKeys[1]);
+        t = KeyFraction(times, track.numRotations, key, time);
+        key += track.firstRotation;
+        next = (t > 0) ? key + 1 : key;
+        float q0[4], q1[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            q0[c] = rotations.values[c][key];
+            q1[c] = rotations.values[c][next];
+        }
+        float dot = q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] + q0[3] * q1[3];
+        float t1 = (dot < 0) ? -t : t;
+        float qx = q0[0] * (1 - t) + q1[0] * t1;
+        float qy = q0[1] * (1 - t) + q1[1] * t1;
+        float qz = q0[2] * (1 - t) + q1[2] * t1;
+        float qw = q0[3] * (1 - t) + q1[3] * t1;
+        float length = std::sqrt(qx * qx + qy * qy + qz * qz + qw * qw);
+        if (length > 0)
+        {
+            float invLength = 1.0f / length;
+            qx *= invLength;  qy *= invLength;  qz *= invLength;  qw *= invLength;
+        }
+
+        // Build the matrix: scale * rotation * translation. With row vectors the rotation matrix is the transpose of
+        // the usual quaternion to matrix formula, and each scale multiplies a row
+        CMatrix4x4& m = nodeMatrices[track.node];
+        float xx = qx * qx, yy = qy * qy, zz = qz * qz;
+        float xy = qx * qy, xz = qx * qz, yz = qy * qz;
+        float wx = qw * qx, wy = qw * qy, wz = qw * qz;
+        m.e00 = sx * (1 - 2 * (yy + zz));  m.e01 = sx * 2 * (xy + wz);        m.e02 = sx * 2 * (xz - wy);        m.e03 = 0;
+        m.e10 = sy * 2 * (xy - wz);        m.e11 = sy * (1 - 2 * (xx + zz));  m.e12 = sy * 2 * (yz + wx);        m.e13 = 0;
+        m.e20 = sz * 2 * (xz + wy);        m.e21 = sz * 2 * (yz - wx);        m.e22 = sz * (1 - 2 * (xx + yy));  m.e23 = 0;
+        m.e30 = tx;                        m.e31 = ty;                        m.e32 = tz;                        m.e33 = 1;
+
+        cursorKeys += 3;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Benchmark
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    // Create a clip with a key every 1/30th second for every node, used when a mesh file has no animations. The
+    // values are arbitrary small movements - only the sampling cost is of interest
+    AnimationClip CreateBenchmarkClip(const std::vector<MeshNode>& nodes)
+    {
+        const float        duration = 2.0f;
+        const unsigned int numKeys  = 61;
+
+        AnimationClip clip;
+        clip.name = "Generated";
+        clip.duration = duration;
+
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> wobble(-0.1f, 0.1f);
+
+        for (unsigned int node = 0; node < nodes.size(); ++node)
+        {
+            AnimationTrack track;
+            track.node = node;
+            track.firstTranslation = track.firstRotation = track.firstScale = static_cast<uint32_t>(clip.translations.times.size());
+            track.numTranslations  = track.numRotations  = track.numScales  = numKeys;
+            clip.tracks.push_back(track);
+
+            CVector3 position = nodes[node].defaultMatrix.GetRow(3);
+            for (unsigned int key = 0; key < numKeys; ++key)
+            {
+                float time = duration * key / (numKeys - 1);
+                clip.translations.times.push_back(time);
+                clip.translations.values[0].push_back(position.x + wobble(random));
+                clip.translations.values[1].push_back(position.y + wobble(random));
+                clip.translations.values[2].push_back(position.z + wobble(random));
+
+                float qx = wobble(random), qy = wobble(random), qz = wobble(random);
+                float qw = std::sqrt(1 - qx * qx - qy * qy - qz * qz);
+                clip.rotations.times.push_back(time);
+                clip.rotations.values[0].push_back(qx);
+                clip.rotations.values[1].push_back(qy);
+                clip.rotations.values[2].push_back(qz);
+                clip.rotations.values[3].push_back(qw);
+
+                clip.scales.times.push_back(time);
+                for (int c = 0; c < 3; ++c)  clip.scales.values[c].push_back(1.0f);
+            }
+        }
+        return clip;
+    }
+}
+
+
+// Measure the cost of sampling animation for many characters playing a clip at once. Uses the first clip in the
+// given mesh file, or a generated clip with a key every 1/30th second for every node if the file has no animations.
+// Each character samples the clip at a different time for the given number of frames at 60fps. If a thread pool is
+// given the characters are also split across the pool. Returns the results as a text table
+std::string BenchmarkAnimation(const std::string& fileName, unsigned int numCharacters, unsigned int numFrames,
+                               ThreadPool* threadPool)
+{
+    MeshData mesh;
+    try
+    {
+        mesh.Load(fileName);
+    }
+    catch (const std::runtime_error& e)
+    {
+        return std::string("Animation benchmark: ") + e.what() + "\n";
+    }
+    if (mesh.nodes.empty() || numCharacters == 0 || numFrames == 0)  return "Animation benchmark: nothing to sample\n";
+
+    AnimationClip generatedClip;
+    const AnimationClip* clip;
+    if (!mesh.animations.empty() && !mesh.animations[0].tracks.empty())
+    {
+        clip = &mesh.animations[0];
+    }
+    else
+    {
+        generatedClip = CreateBenchmarkClip(mesh.nodes);
+        clip = &generatedClip;
+    }
+
+    // Each character has its own cursor and node matrices, and starts at a different point in the clip
+    unsigned int numNodes = static_cast<unsigned int>(mesh.nodes.size());
+    std::vector<AnimationCursor> cursors(numCharacters);
+    std::vector<CMatrix4x4>      matrices(static_cast<std::size_t>(numCharacters) * numNodes);
+    std::vector<float>           startTimes(numCharacters);
+    for (unsigned int i = 0; i < numCharacters; ++i)  startTimes[i] = (clip->duration > 0) ? std::fmod(i * 0.137f, clip->duration) : 0;
+
+    std::string report = "Animation benchmark: " + fileName + " clip \"" + clip->name + "\"\n";
+    report += "  Threads  Characters   Bones  ms/frame  ns/bone/frame\n";
+    char line[512];
+
+    unsigned int frame = 0;
+    auto sampleCharacters = [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; ++i)
+        {
+            float time = startTimes[i] + frame / 60.0f;
+            if (clip->duration > 0)  time = std::fmod(time, clip->duration); // Looping, so occasionally goes backwards
+            clip->Sample(time, cursors[i], &matrices[static_cast<std::size_t>(i) * numNodes]);
+        }
+    };
+
+    for (int threaded = 0; threaded < (threadPool != nullptr ? 2 : 1); ++threaded)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (frame = 0; frame < numFrames; ++frame)
+        {
+            if (threaded)  threadPool->ParallelFor(numCharacters, 64, sampleCharacters);
+            else           sampleCharacters(0, numCharacters);
+        }
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+        double samples = static_cast<double>(numFrames) * numCharacters * clip->tracks.size();
+        std::snprintf(line, sizeof(line), "  %7u  %10u  %7u  %8.3f  %13.2f\n", threaded ? threadPool->NumThreads() + 1 : 1,
+                      numCharacters, static_cast<unsigned int>(clip->tracks.size()), time.count() * 1000.0 / numFrames,
+                      samples > 0 ? time.count() * 1e9 / samples : 0.0);
+        report += line;
+    }
+    return report;
+}
@@ -0,0 +1,83 @@
+//--------------------------------------------------------------------------------------
+// Animation clips - keyframed translation, rotation and scale for the nodes of a mesh
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Clips are imported along with the mesh (see MeshData.h) from the animation channels in the
+// model file. Each animated node has a track with its own translation, rotation and scale keys.
+// The keys of all the tracks in a clip are stored together in a few large arrays laid out for
+// sampling: the key times of each track are sorted and contiguous, and each value component
+// (x, y, z, w) has its own array, so the keys either side of a time are found by scanning one
+// small array of floats.
+// Sampling is done with an AnimationCursor that remembers the current key of every track. When
+// the playback time only moves forwards (the usual case) finding the keys costs a comparison or
+// two per track rather than a search.
+
+#ifndef _ANIMATION_CLIP_H_INCLUDED_
+#define _ANIMATION_CLIP_H_INCLUDED_
+
+#include "CMatrix4x4.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class ThreadPool;
+
+
+// Keys of one kind (translation, rotation or scale) for all the tracks in a clip
+struct AnimationKeys
+{
+    std::vector<float> times;     // Seconds from the start of the clip, sorted within each track
+    std::vector<float> values[4]; // x, y, z components of each key, and w for rotations (quaternions)
+};
+
+// The keys for one animated node. The keys are ranges in the clip's AnimationKeys arrays. Every track has at least
+// one key of each kind
+struct AnimationTrack
+{
+    uint32_t node;             // Index of the animated node in the mesh
+    uint32_t firstTranslation; // Index of the first translation key for this track
+    uint32_t numTranslations;
+    uint32_t firstRotation;
+    uint32_t numRotations;
+    uint32_t firstScale;
+    uint32_t numScales;
+};
+
+
+// Playback position in a clip. Each model playing a clip needs its own cursor
+struct AnimationCursor
+{
+    std::vector<uint32_t> keys; // Current key index for translation, rotation and scale of each track
+    float time = 0;             // Time of the last sample, used to spot when playback goes backwards
+};
+
+
+class AnimationClip
+{
+public:
+    // Calculate the matrices of the animated nodes at the given time (in seconds) and write them into the given array
+    // of node matrices (relative to parent, the same as Model's matrices). Nodes without tracks are left unchanged.
+    // Times outside the clip are clamped to the first / last keys. The cursor is updated to the new time
+    void Sample(float time, AnimationCursor& cursor, CMatrix4x4* nodeMatrices) const;
+
+
+    std::string name;
+    float       duration = 0; // Length of the clip in seconds
+
+    std::vector<AnimationTrack> tracks; // Sorted by node index
+    AnimationKeys translations;
+    AnimationKeys rotations;            // Unit quaternions
+    AnimationKeys scales;
+};
+
+
+// Measure the cost of sampling animation for many characters playing a clip at once. Uses the first clip in the
+// given mesh file, or a generated clip with a key every 1/30th second for every node if the file has no animations.
+// Each character samples the clip at a different time for the given number of frames at 60fps. If a thread pool is
+// given the characters are also split across the pool. Returns the results as a text table
+std::string BenchmarkAnimation(const std::string& fileName, unsigned int numCharacters, unsigned int numFrames,
+                               ThreadPool* threadPool);
+
+
+#endif //_ANIMATION_CLIP_H_INCLUDED_
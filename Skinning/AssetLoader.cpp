@@ -0,0 +1,225 @@
+//--------------------------------------------------------------------------------------
+// Asset loader - loads a batch of meshes and textures, optionally in parallel
+//--------------------------------------------------------------------------------------
+
+#include "AssetLoader.h"
+#include "Mesh.h"
+#include "CTexture.h"
+#include "ThreadPool.h"
+#include "ResourceManager.h"
+#include "Timer.h"
+
+#include <stdexcept>
+#include <exception>
+#include <utility>
+#include <cstdio>
+
+
+// Request a mesh to be loaded, the mesh handle is filled in by LoadAll
+void AssetLoader::AddMesh(std::shared_ptr<Mesh>* mesh, const std::string& fileName, bool requireTangents /*= false*/)
+{
+    Asset asset;
+    asset.fileName = fileName;
+    asset.requireTangents = requireTangents;
+    asset.mesh = mesh;
+    mAssets.push_back(std::move(asset));
+}
+
+// Request a texture to be loaded, the texture handle is filled in by LoadAll
+void AssetLoader::AddTexture(std::shared_ptr<CTexture>* texture, const std::string& fileName)
+{
+    Asset asset;
+    asset.fileName = fileName;
+    asset.texture = texture;
+    mAssets.push_back(std::move(asset));
+}
+
+
+// Load all the assets requested above. If a thread pool is given the CPU-side work runs on the pool, otherwise
+// everything is done serially on the calling thread. GPU resources are always created on the calling thread
+// Returns false on failure, GetError then gives the error for the first asset that failed
+bool AssetLoader::LoadAll(ThreadPool* threadPool)
+{
+    Timer timer;
+    mParallel = (threadPool != nullptr);
+    mError.clear();
+
+    FindExistingAssets();
+
+    // CPU-side loading. The asset vector must not change size until the tasks are finished
+    if (mParallel)
+    {
+        for (auto& asset : mAssets)
+        {
+            if (asset.resident || asset.duplicate >= 0)  continue;
+
+            Asset* assetToLoad = &asset;
+            threadPool->AddTask([assetToLoad] { LoadCPU(*assetToLoad); });
+        }
+        threadPool->WaitAll();
+    }
+    else
+    {
+        for (auto& asset : mAssets)
+        {
+            if (asset.resident || asset.duplicate >= 0)  continue;
+
+            LoadCPU(asset);
+            if (!asset.error.empty())  break; // Serial loading can stop at the first error
+        }
+    }
+
+    // Create GPU resources in the order the assets were added, stopping at the first asset with an error
+    for (auto& asset : mAssets)
+    {
+        if (asset.resident)  continue;
+
+        if (asset.duplicate >= 0)
+        {
+            // The earlier asset has been added to the resource manager by now, so this is a cache hit
+            if (asset.mesh != nullptr)  *asset.mesh    = mResources.FindMesh(asset.fileName, asset.requireTangents);
+            else                        *asset.texture = mResources.FindTexture(asset.fileName);
+            continue;
+        }
+
+        if (asset.error.empty())  CreateGPU(asset);
+        if (!asset.error.empty())
+        {
+            mError = asset.error;
+            break;
+        }
+    }
+
+    mTotalTime = timer.GetTime();
+    return mError.empty();
+}
+
+
+// Check the resource manager and the earlier assets in the batch for each asset, so only new assets are loaded
+void AssetLoader::FindExistingAssets()
+{
+    for (unsigned int i = 0; i < mAssets.size(); ++i)
+    {
+        auto& asset = mAssets[i];
+
+        // Look for an earlier asset in this batch that is being loaded and can be shared. A mesh with tangents can be
+        // shared with one that doesn't need them (see ResourceManager.h)
+        for (unsigned int j = 0; j < i && asset.duplicate < 0; ++j)
+        {
+            auto& earlier = mAssets[j];
+            if (earlier.resident || earlier.duplicate >= 0 || earlier.fileName != asset.fileName)  continue;
+
+            if (asset.mesh != nullptr && earlier.mesh != nullptr && (earlier.requireTangents || !asset.requireTangents))
+                asset.duplicate = j;
+            if (asset.texture != nullptr && earlier.texture != nullptr)
+                asset.duplicate = j;
+        }
+        if (asset.duplicate >= 0)  continue;
+
+        // Otherwise look for the asset in the resource manager
+        if (asset.mesh != nullptr)
+        {
+            *asset.mesh = mResources.FindMesh(asset.fileName, asset.requireTangents);
+            asset.resident = (*asset.mesh != nullptr);
+        }
+        else
+        {
+            *asset.texture = mResources.FindTexture(asset.fileName);
+            asset.resident = (*asset.texture != nullptr);
+        }
+    }
+}
+
+
+// CPU-side loading for one asset, may be run on any thread
+void AssetLoader::LoadCPU(Asset& asset)
+{
+    Timer timer;
+    const char* type = (asset.mesh != nullptr) ? "mesh" : "texture";
+    try
+    {
+        if (asset.mesh != nullptr)
+        {
+            asset.meshData.Load(asset.fileName, asset.requireTangents);
+        }
+        else
+        {
+            if (!asset.textureData.Load(asset.fileName))  asset.error = "Error loading texture " + asset.fileName;
+        }
+    }
+    catch (const std::runtime_error& e)
+    {
+        asset.error = e.what(); // Errors are passed to the calling thread rather than thrown
+    }
+    catch (const std::exception& e)
+    {
+        // Other errors (e.g. std::bad_alloc from a huge file) must not escape a pool task either
+        asset.error = std::string("Error loading ") + type + " " + asset.fileName + " (" + e.what() + ")";
+    }
+    asset.cpuTime = timer.GetTime();
+}
+
+
+// Create GPU resources for one asset and add it to the resource manager, must be run on the D3D context thread
+void AssetLoader::CreateGPU(Asset& asset)
+{
+    Timer timer;
+    if (asset.mesh != nullptr)
+    {
+        try
+        {
+            std::unique_ptr<Mesh> mesh(new Mesh(std::move(asset.meshData), asset.fileName));
+            std::size_t bytes = mesh->GetMemoryUsage();
+            *asset.mesh = mResources.AddMesh(asset.fileName, asset.requireTangents, std::move(mesh), bytes);
+        }
+        catch (const std::runtime_error& e)
+        {
+            asset.error = e.what();
+        }
+        catch (const std::exception& e)
+        {
+            asset.error = "Error creating mesh " + asset.fileName + " (" + e.what() + ")";
+        }
+    }
+    else
+    {
+        std::unique_ptr<CTexture> texture(new CTexture());
+        if (texture->CreateFromData(asset.textureData))
+        {
+            *asset.texture = mResources.AddTexture(asset.fileName, std::move(texture), asset.textureData.GPUSize());
+        }
+        else
+        {
+            asset.error = "Error creating texture " + asset.fileName;
+        }
+        asset.textureData = TextureData(); // CPU-side copy no longer needed
+    }
+    asset.gpuTime = timer.GetTime();
+}
+
+
+// Table of load times for each asset and the whole batch after LoadAll. Times are wall time in milliseconds.
+// Per-asset CPU times overlap when loading in parallel, so the total is less than their sum
+std::string AssetLoader::TimingReport()
+{
+    std::string report = mParallel ? "Asset loading (parallel)\n" : "Asset loading (serial)\n";
+    report += "      CPU ms    GPU ms  File\n";
+
+    char line[512];
+    float cpuSum = 0, gpuSum = 0;
+    for (auto& asset : mAssets)
+    {
+        const char* shared = asset.resident ? " (already loaded)" : (asset.duplicate >= 0 ? " (shared)" : "");
+        std::snprintf(line, sizeof(line), "  %10.2f%10.2f  %s%s%s\n", asset.cpuTime * 1000.0f, asset.gpuTime * 1000.0f,
+                      asset.fileName.c_str(), asset.requireTangents ? " (tangents)" : "", shared);
+        report += line;
+        cpuSum += asset.cpuTime;
+        gpuSum += asset.gpuTime;
+    }
+
+    std::snprintf(line, sizeof(line), "  %10.2f%10.2f  Sum of assets\n", cpuSum * 1000.0f, gpuSum * 1000.0f);
+    report += line;
+    std::snprintf(line, sizeof(line), "  %20.2f  Total wall time\n", mTotalTime * 1000.0f);
+    report += line;
+    return report;
+}
@@ -0,0 +1,96 @@
+//--------------------------------------------------------------------------------------
+// Asset loader - loads a batch of meshes and textures, optionally in parallel
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Usage: add all the meshes and textures required then call LoadAll. Loading is split in two:
+// - CPU work: mesh import (assimp or cooked file, see MeshData.h) and image file decoding (see
+//   TextureData.h). This is run as tasks on a thread pool if one is given
+// - GPU work: creating the vertex / index buffers and textures. This is done on the calling
+//   thread in the order the assets were added, as it needs the D3D context
+// Errors are reported for the first failing asset in the order added, so the message is the
+// same whichever thread happened to finish first.
+// Assets already resident in the resource manager (see ResourceManager.h), or requested twice
+// in the same batch, are shared rather than loaded again.
+
+#ifndef _ASSET_LOADER_H_INCLUDED_
+#define _ASSET_LOADER_H_INCLUDED_
+
+#include "MeshData.h"
+#include "TextureData.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+
+class Mesh;
+class CTexture;
+class ThreadPool;
+class ResourceManager;
+
+class AssetLoader
+{
+public:
+    // Loaded assets are added to the given resource manager, which must outlive the loader
+    explicit AssetLoader(ResourceManager& resources) : mResources(resources) {}
+
+    // Request a mesh to be loaded, the mesh handle is filled in by LoadAll
+    void AddMesh(std::shared_ptr<Mesh>* mesh, const std::string& fileName, bool requireTangents = false);
+
+    // Request a texture to be loaded, the texture handle is filled in by LoadAll
+    void AddTexture(std::shared_ptr<CTexture>* texture, const std::string& fileName);
+
+
+    // Load all the assets requested above. If a thread pool is given the CPU-side work runs on the pool, otherwise
+    // everything is done serially on the calling thread. GPU resources are always created on the calling thread
+    // Returns false on failure, GetError then gives the error for the first asset that failed
+    bool LoadAll(ThreadPool* threadPool);
+
+    // Error message after LoadAll fails
+    const std::string& GetError()  { return mError; }
+
+    // Table of load times for each asset and the whole batch after LoadAll. Times are wall time in milliseconds.
+    // Per-asset CPU times overlap when loading in parallel, so the total is less than their sum
+    std::string TimingReport();
+
+
+private:
+    // Loading of a single asset
+    struct Asset
+    {
+        std::string fileName;
+        bool        requireTangents = false;
+
+        std::shared_ptr<Mesh>*     mesh    = nullptr; // Only one of these is set
+        std::shared_ptr<CTexture>* texture = nullptr;
+
+        bool        resident  = false; // Found in the resource manager, no loading needed
+        int         duplicate = -1;    // Index of an earlier asset in this batch that can be shared, -1 if none
+
+        MeshData    meshData; // CPU-side data passed from the loading task to the GPU creation step
+        TextureData textureData;
+
+        std::string error;       // Set by the loading task on failure
+        float       cpuTime = 0; // Wall time in seconds for the CPU-side loading
+        float       gpuTime = 0; // --"-- for creating the GPU resources
+    };
+
+    // CPU-side loading for one asset, may be run on any thread
+    static void LoadCPU(Asset& asset);
+
+    // Create GPU resources for one asset and add it to the resource manager, must be run on the D3D context thread
+    void CreateGPU(Asset& asset);
+
+    // Check the resource manager and the earlier assets in the batch for each asset, so only new assets are loaded
+    void FindExistingAssets();
+
+
+    ResourceManager&   mResources;
+    std::vector<Asset> mAssets;
+
+    std::string mError;
+    bool        mParallel  = false;
+    float       mTotalTime = 0;
+};
+
+
+#endif //_ASSET_LOADER_H_INCLUDED_
@@ -0,0 +1,34 @@
+//--------------------------------------------------------------------------------------
+// Instanced Basic Transform Vertex Shader
+//--------------------------------------------------------------------------------------
+// Same as BasicTransform_vs but for instanced draws (see Mesh::RenderInstanced). The world matrix and colour come from
+// the instance being drawn rather than the per-model constant buffer
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+SimplePixelShaderInput main(BasicInstancedVertex modelVertex)
+{
+    SimplePixelShaderInput output; // This is the data the pixel shader requires from this vertex shader
+
+    // Rebuild the instance's world matrix from its rows. Matrices in constant buffers arrive transposed from the C++ so
+    // the vector goes on the right of mul, but this one is built row by row so it is the same as the C++ matrix and
+    // the vector goes on the left
+    float4x4 worldMatrix = float4x4(modelVertex.worldRow0, modelVertex.worldRow1, modelVertex.worldRow2, modelVertex.worldRow3);
+
+    // Transform from model space to world space with the instance's matrix, then on to 2D projection space as usual
+    float4 modelPosition     = float4(modelVertex.position, 1);
+    float4 worldPosition     = mul(modelPosition,     worldMatrix);
+    float4 viewPosition      = mul(gViewMatrix,       worldPosition);
+    output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+
+    // Pass texture coordinates and the instance's colour on to the pixel shader
+    output.uv     = modelVertex.uv;
+    output.colour = modelVertex.colour;
+
+    return output; // Ouput data sent down the pipeline (to the pixel shader)
+}
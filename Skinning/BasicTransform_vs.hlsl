@@ -29,5 +29,8 @@ SimplePixelShaderInput main(BasicVertex modelVertex)
     // Pass texture coordinates (UVs) on to the pixel shader, the vertex shader doesn't need them
     output.uv = modelVertex.uv;
 
+    // Pass the model's colour on too, light models are tinted with it
+    output.colour = gObjectColour;
+
     return output; // Ouput data sent down the pipeline (to the pixel shader)
 }
@@ -1,4 +1,5 @@
 #include "CLight.h"
+#include "StateCache.h"
 
 //Setup the light using the model class 
 CLight::CLight(Mesh* Mesh, float Strength, CVector3 Colour, CVector3 Position, float Scale)
@@ -31,13 +32,14 @@ CVector3 CLight::GetLightColour()
 //Set the lights states to be used when rendering 
 void CLight::SetLightStates(ID3D11BlendState* blendSate, ID3D11DepthStencilState* depthState, ID3D11RasterizerState* rasterizerState)
 {
-	gD3DContext->OMSetBlendState(blendSate, nullptr, 0xffffff);
-	gD3DContext->OMSetDepthStencilState(depthState, 0);
-	gD3DContext->RSSetState(rasterizerState);
+	gStateCache.SetBlendState(blendSate);
+	gStateCache.SetDepthStencilState(depthState);
+	gStateCache.SetRasterizerState(rasterizerState);
 }
 
-//Call the models render function
+//Call the models render function, tinting the model with the light's colour
 void CLight::RenderLight()
 {
+	LightModel->SetColour(LightColour);
 	LightModel->Render();
 }
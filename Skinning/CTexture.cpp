@@ -9,8 +9,19 @@ CTexture::CTexture()
 	SRVMap = nullptr;
 }
 
+CTexture::~CTexture()
+{
+	if (SRVMap)  SRVMap->Release();
+	if (Map)     Map->Release();
+}
+
 
 bool CTexture::LoadTextureFromHelper(std::string filename)
 {
 	return LoadTexture(filename, &Map, &SRVMap);
 }
+
+bool CTexture::CreateFromData(const TextureData& data)
+{
+	return CreateTextureFromData(data, &Map, &SRVMap);
+}
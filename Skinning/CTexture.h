@@ -1,5 +1,6 @@
 #include "Common.h"
 #include "../Shader.h"
+#include "TextureData.h"
 #include <cmath>
 #include <cctype>
 #include <atlbase.h>
@@ -9,7 +10,14 @@ class CTexture
 {
 public:
 	CTexture();
+	~CTexture(); // Releases the DirectX objects
+
+	// Textures own DirectX objects so cannot be copied. Share them with a handle from the ResourceManager instead
+	CTexture(const CTexture&) = delete;
+	CTexture& operator=(const CTexture&) = delete;
+
 	bool LoadTextureFromHelper(std::string filename);
+	bool CreateFromData(const TextureData& data); // For data already loaded on another thread, see AssetLoader.h
 
 	ID3D11Resource* Map;
 	ID3D11ShaderResourceView* SRVMap;
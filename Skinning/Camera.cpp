@@ -62,7 +62,7 @@ void Camera::UpdateMatrices()
     mWorldMatrix = MatrixRotationZ(mRotation.z) * MatrixRotationX(mRotation.x) * MatrixRotationY(mRotation.y) * MatrixTranslation(mPosition);
 
     // View matrix is the usual matrix used for the camera in shaders, it is the inverse of the world matrix (see lectures)
-    mViewMatrix = InverseAffine(mWorldMatrix);
+    InverseAffineBatch(&mWorldMatrix, &mViewMatrix, 1);
 
     // Projection matrix, how to flatten the 3D world onto the screen (needs field of view, near and far clip, aspect ratio)
     float tanFOVx = std::tan(mFOVx * 0.5f);
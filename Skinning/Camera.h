@@ -44,6 +44,7 @@ public:
 	void SetRotation(CVector3 rotation)  { mRotation = rotation; }
 
 	float FOV()       { return mFOVx;     }
+	float AspectRatio() { return mAspectRatio; }
 	float NearClip()  { return mNearClip; }
 	float FarClip()   { return mFarClip;  }
 
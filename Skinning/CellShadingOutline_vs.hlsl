@@ -14,7 +14,7 @@ SimplePixelShaderInput main(BasicVertex modelVertex)
     float4 viewPosition = mul(gViewMatrix, worldPosition);
 
 	// Transform model normal to world space. We will use the normal to expand the geometry, not for lighting
-    float4 modelNormal = float4(modelVertex.normal, 0.0f); // Set 4th element to 0.0 this time as normals are vectors
+    float4 modelNormal = float4(DecodeOctahedral(modelVertex.normal), 0.0f); // Set 4th element to 0.0 this time as normals are vectors
     float4 worldNormal = normalize(mul(gWorldMatrix, modelNormal)); // Normalise in case of world matrix scaling
 
 	// Now we return to the world position of this vertex and expand it along the world normal - that will expand the geometry outwards.
@@ -1,11 +1,10 @@
 #include "Common.hlsli"
+#include "ClusteredLighting.hlsli" // Point lights, spotlights and the shadow atlas
 
 Texture2D DiffuseMap : register(t0); // Diffuse map only
 Texture2D CellMap : register(t2); // CellMap is a 1D map that is used to limit the range of colours used in cell shading
 
-Texture2D ShadowMapLight1 : register(t1);
 SamplerState TexSampler : register(s0); // Sampler for use on textures
-SamplerState PointSampleClamp : register(s1); // No filtering of cell maps (otherwise the cell edges would be blurred)
 
 float4 main(LightingPixelShaderInput input) : SV_TARGET
 {
@@ -13,62 +12,35 @@ float4 main(LightingPixelShaderInput input) : SV_TARGET
     input.worldNormal = normalize(input.worldNormal); // Normal might have been scaled by model scaling or interpolation so renormalise
     float3 cameraDirection = normalize(gCameraPosition - input.worldPosition);
 
-    // Light 1
-    float3 light1Vector = Light1.Position - input.worldPosition;
-    float light1Distance = length(light1Vector);
-    float3 light1Direction = light1Vector / light1Distance; // Quicker than normalising as we have length for attenuation
-	
-    float diffuseLevel1 = max(dot(input.worldNormal, light1Direction), 0);
-    float cellDiffuseLevel1 = CellMap.Sample(PointSampleClamp, diffuseLevel1).r;
-    float3 diffuseLight1 = Light1.Colour * cellDiffuseLevel1 / light1Distance;
+    // Start with the ambient light, added once here rather than for each light (or we will get too much ambient)
+    float3 diffuseLight = gAmbientColour;
+    float3 specularLight = 0;
 
-    float3 halfway = normalize(light1Direction + cameraDirection);
-    float3 specularLight1 = diffuseLight1 * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower); // Multiplying by diffuseLight instead of light colour - my own personal preference
-
-    // Light 2
-    float3 light2Vector = Light2.Position - input.worldPosition;
-    float light2Distance = length(light2Vector);
-    float3 light2Direction = light2Vector / light2Distance;
-
-    float diffuseLevel2 = max(dot(input.worldNormal, light2Direction), 0);
-    float cellDiffuseLevel2 = CellMap.Sample(PointSampleClamp, diffuseLevel2).r;
-    float3 diffuseLight2 = Light2.Colour * cellDiffuseLevel2 / light2Distance;
-
-    halfway = normalize(light2Direction + cameraDirection);
-    float3 specularLight2 = diffuseLight2 * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower);
-    
-    //Light 3
-    float3 light3Direction = normalize(Light3.Position - input.worldPosition);
-    float3 diffuseLight3 = 0;
-    float3 specularLight3 = 0;
-    
-    if (dot(Light3.Direction, -light3Direction) > Light3.CosHalfAngle)
+    // Point lights and spotlights in this pixel's cluster. Each light's diffuse level is looked up in the cell map to
+    // limit it to a few bands of colour. Sampling in a loop, so the mip level must be given
+    uint2 lights = ClusterLightRange(input.projectedPosition);
+    for (uint i = 0; i < lights.y; ++i)
     {
-        float4 light3ViewPosition = mul(Light3.lightViewMatrix, float4(input.worldPosition, 1.0f));
-        float4 light3Projection = mul(Light3.lightProjectionMatrix, light3ViewPosition);
-        
-        float2 ShadowMapUV = 0.5f * light3Projection.xy / light3Projection.w + float2(0.5f, 0.5f);
-        ShadowMapUV.y = 1.0f - ShadowMapUV.y;
-        
-        float depthFromLight3 = light3Projection.z / light3Projection.w - DepthAdjust;
-        if (depthFromLight3 < ShadowMapLight1.Sample(PointSampleClamp, ShadowMapUV).r)
-        {
-            float3 light3Dist = length(Light3.Position - input.worldPosition);
-            diffuseLight3 = Light3.Colour * max(dot(input.worldNormal, light3Direction), 0) / light3Dist;
-            halfway = normalize(light3Direction + cameraDirection);
-            specularLight3 = diffuseLight3 * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower);
-        }
+        ClusterLight light = ClusterLights[ClusterLightIndices[lights.x + i]];
+        float3 lightDirection;
+        float attenuation = LightAttenuation(light, input.worldPosition, lightDirection);
+        if (attenuation <= 0)  continue;
+
+        float diffuseLevel = max(dot(input.worldNormal, lightDirection), 0);
+        float cellDiffuseLevel = CellMap.SampleLevel(PointClamp, diffuseLevel, 0).r;
+        float3 diffuse = light.colour * cellDiffuseLevel * attenuation;
+
+        float3 lightHalfway = normalize(lightDirection + cameraDirection);
+        diffuseLight  += diffuse;
+        specularLight += diffuse * pow(max(dot(input.worldNormal, lightHalfway), 0), gSpecularPower); // Multiplying by diffuseLight instead of light colour - my own personal preference
     }
-    
-    //light 4
-    float3 light4Vec = -(normalize(Light4.Direction));
-    float3 diffuseLight4 = Light4.Colour * max(dot(light4Vec, input.worldNormal), 0.0f);
-    halfway = normalize(light4Vec + cameraDirection);
-    float3 specularLight4 = diffuseLight4 * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower);
-    
-    //total lighting
-    float3 diffuseLight = gAmbientColour + diffuseLight1 + diffuseLight2 + diffuseLight3 + diffuseLight4;
-    float3 specularLight = specularLight1 + specularLight2 + specularLight3 + specularLight4;
+
+    // Directional light
+    float3 directionalLightVec = -(normalize(gDirectionalLight.Direction));
+    float3 diffuseDirectional = gDirectionalLight.Colour * max(dot(directionalLightVec, input.worldNormal), 0.0f) * ShadowFactor(gDirectionalLight.Shadow, input.worldPosition);
+    float3 halfway = normalize(directionalLightVec + cameraDirection);
+    diffuseLight  += diffuseDirectional;
+    specularLight += diffuseDirectional * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower);
    
     // Sample diffuse material colour for this pixel from a texture using a given sampler that you set up in the C++ code
     // Ignoring any alpha in the texture, just reading RGB
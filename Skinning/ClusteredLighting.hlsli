@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------
+// Clustered lighting, shared by the lighting pixel shaders
+//--------------------------------------------------------------------------------------
+// Point lights and spotlights are sorted on the CPU into a grid of clusters over the camera's view
+// (see LightClusters.h). Each pixel finds the cluster it is in and is only lit by that cluster's
+// lights, so the scene can have any number of lights. Include after Common.hlsli, the shadow atlas
+// lookup is included here
+
+#include "Shadows.hlsli"
+
+
+// One point light or spotlight. Must match ClusterLight in LightClusters.h
+struct ClusterLight
+{
+    float3 position;
+    float  range;        // No light beyond this distance
+    float3 colour;
+    float  cosHalfAngle; // Spotlight cone, less than -1 for point lights
+    float3 direction;
+    int    shadow;       // Index into gLightShadows, -1 for no shadows
+};
+
+StructuredBuffer<ClusterLight> ClusterLights       : register(t3); // All the lights
+StructuredBuffer<uint2>        ClusterRanges       : register(t4); // Offset and count in ClusterLightIndices for each cluster
+StructuredBuffer<uint>         ClusterLightIndices : register(t5); // Lights in each cluster, cluster by cluster
+
+
+// Offset and count of the lights in the cluster containing a pixel. Pass the pixel's SV_Position: xy is its position on
+// screen in pixels, w is its depth from the camera
+uint2 ClusterLightRange(float4 screenPosition)
+{
+    uint2 tile = min(uint2(screenPosition.xy * gClusterTileScale), gClusterCounts.xy - 1);
+    float slice = clamp(floor(log(screenPosition.w) * gClusterDepthScale + gClusterDepthBias), 0.0f, float(gClusterCounts.z - 1));
+    return ClusterRanges[(uint(slice) * gClusterCounts.y + tile.y) * gClusterCounts.x + tile.x];
+}
+
+
+// How much of a light's colour reaches a world position, also returns the direction to the light. Falls off with
+// 1 / distance like the original lights, then smoothly to 0 at the light's range so there is no edge where the light's
+// clusters end. 0 outside a spotlight's cone or in shadow
+float LightAttenuation(ClusterLight light, float3 worldPosition, out float3 lightDirection)
+{
+    float3 lightVector = light.position - worldPosition;
+    float lightDistance = length(lightVector);
+    lightDirection = lightVector / lightDistance;
+
+    if (dot(light.direction, -lightDirection) <= light.cosHalfAngle)  return 0;
+
+    float rangeFraction = lightDistance / light.range;
+    rangeFraction *= rangeFraction;
+    float window = saturate(1 - rangeFraction * rangeFraction);
+    float attenuation = window * window / lightDistance;
+
+    if (attenuation > 0)  attenuation *= ShadowFactor(light.shadow, worldPosition);
+    return attenuation;
+}
+
+
+// Add the diffuse and specular light from the point lights and spotlights in the pixel's cluster. Specular is
+// multiplied by the diffuse light rather than the light colour, as in the rest of these shaders
+void AddClusteredLights(float4 screenPosition, float3 worldPosition, float3 worldNormal, float3 cameraDirection,
+                        inout float3 diffuseLight, inout float3 specularLight)
+{
+    uint2 lights = ClusterLightRange(screenPosition);
+    for (uint i = 0; i < lights.y; ++i)
+    {
+        ClusterLight light = ClusterLights[ClusterLightIndices[lights.x + i]];
+        float3 lightDirection;
+        float attenuation = LightAttenuation(light, worldPosition, lightDirection);
+        if (attenuation <= 0)  continue;
+
+        float3 diffuse = light.colour * max(dot(worldNormal, lightDirection), 0) * attenuation;
+        float3 halfway = normalize(lightDirection + cameraDirection);
+        diffuseLight  += diffuse;
+        specularLight += diffuse * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
+    }
+}
@@ -45,10 +45,37 @@ extern const float MOVEMENT_SPEED;
 // when a serious error occurs
 extern std::string gLastError;
 
+// Worker threads shared across the app for loading and other parallel work (see Utility/ThreadPool.h)
+class ThreadPool;
+extern ThreadPool* gThreadPool;
+
+// Scratch memory for temporaries used during a frame, reset at the start of each frame (see Utility/FrameAllocator.h)
+class FrameAllocator;
+extern FrameAllocator gFrameAllocator;
+
+// Wraps gD3DContext, skipping state changes that would set what is already bound (see Utility/StateCache.h)
+class StateCache;
+extern StateCache gStateCache;
+
+// Vertex and index buffers shared by all meshes, each sub-mesh uses a range of them (see GeometryArena.h)
+class GeometryArena;
+extern GeometryArena gGeometryArena;
+
+// Where models choose their level of detail from (see Model::SelectLod). Set from the main camera at the start of each
+// frame's rendering, so shadow maps are drawn with the same levels as the camera view
+struct LodView
+{
+    CVector3     position;      // World position of the main camera
+    float        pixelsPerUnit; // Height in pixels of something one unit tall, one unit in front of the camera
+    float        maxPixelError; // Levels are chosen so their simplification error is no more than this on screen, 0 for full detail
+    unsigned int frame;         // Advances every frame, models choose their level once per frame
+};
+extern LodView gLodView;
+
 struct Light
 {
     CVector3 Position;
-    float padding1;
+    int Shadow; // Index of the light's shadows in PerShadowConstants, -1 for none
 
     CVector3 Colour;
     float Padding2;
@@ -61,9 +88,6 @@ struct Light
 
     CVector3 Ambient;
     float Padding4;
-
-    CMatrix4x4 lightViewMatrix;
-    CMatrix4x4 lightProjectionMatrix;
 };
 
 //--------------------------------------------------------------------------------------
@@ -81,10 +105,8 @@ struct PerFrameConstants
     CMatrix4x4 projectionMatrix;
     CMatrix4x4 viewProjectionMatrix; // The above two matrices multiplied together to combine their effects
 
-    Light light1;
-    Light light2;
-    Light light3;
-    Light light4;
+    // Point lights and spotlights are in the clustered light buffers (see LightClusters.h), only the directional light is here
+    Light directionalLight;
 
     CVector3 Intensity;
     float Wiggle;
@@ -98,8 +120,12 @@ struct PerFrameConstants
     CVector3 outlineColour;
     float outlineThickness;
 
-    float DepthAdjust;
-    CVector3 Padding1;
+    // Finding a pixel's cluster: tile = pixel position * clusterTileScale, slice = log(depth) * depthScale + depthBias
+    float        clusterTileScale[2];
+    float        clusterDepthScale;
+    float        clusterDepthBias;
+    unsigned int clusterCounts[3]; // Tiles across, tiles down and number of slices
+    float        padding5;
 };
 
 extern PerFrameConstants gPerFrameConstants;      // This variable holds the CPU-side constant buffer described above
@@ -107,19 +133,74 @@ extern ID3D11Buffer*     gPerFrameConstantBuffer; // This variable controls the
 
 
 
-static const int MAX_BONES = 64;
+static const int MAX_BONES = 64; // Size of the bone palette for one draw. Must match BONE_PALETTE_SIZE in MeshData.h
 
 // This is the matrix that positions the next thing to be rendered in the scene. Unlike the structure above this data can be
 // updated and sent to the GPU several times every frame (once per model). However, apart from that it works in the same way.
+// Kept small (80 bytes) as it is uploaded for every node of every rigid model drawn
 struct PerModelConstants
 {
     CMatrix4x4 worldMatrix;
     CVector3   objectColour; // Allows each light model to be tinted to match the light colour they cast
     float      padding6;
-    CMatrix4x4 boneMatrices[/*** MISSING - fill in this array size - easy. Relates to another MISSING*/ MAX_BONES];
 };
 extern PerModelConstants gPerModelConstants;      // This variable holds the CPU-side constant buffer described above
 extern ID3D11Buffer*     gPerModelConstantBuffer; // This variable controls the GPU-side constant buffer related to the above structure
 
+// Bone matrices for a skinned model, in a separate constant buffer so rigid models don't upload them. Skinned meshes are
+// drawn in batches that each use a palette of up to MAX_BONES bones, only the matrices for the bones of the batch being
+// drawn are uploaded (see Mesh::Render), so there is no CPU-side copy of the whole structure
+struct PerSkeletonConstants
+{
+    CMatrix4x4 boneMatrices[MAX_BONES];
+};
+extern ID3D11Buffer* gPerSkeletonConstantBuffer; // GPU-side constant buffer the size of the above structure
+
+// Instanced draws render many copies of a mesh in one call (see Mesh::RenderInstanced). Each copy's world matrix and
+// colour, which would otherwise be in the per-model constants, are read from this structure in a second vertex buffer.
+// Must match the instance inputs of BasicInstancedVertex in Common.hlsli
+struct InstanceData
+{
+    CMatrix4x4 worldMatrix;
+    CVector3   colour;
+    float      padding;
+};
+static const int MAX_INSTANCES = 256; // Copies in one instanced draw call, larger groups are split into several calls
+extern ID3D11Buffer* gInstanceBuffer; // Dynamic vertex buffer holding MAX_INSTANCES of the above structure
+
+
+static const int MAX_SHADOW_VIEWS  = 20; // Must match MAX_SHADOW_VIEWS in Common.hlsli
+static const int MAX_SHADOW_LIGHTS = 4;
+
+// One shadow map in the shadow atlas (see ShadowAtlas.h): the matrix it was rendered with and where its tile is in the
+// atlas as a UV offset (x, y) and scale (z, w). A scale of 0 means the view has no tile this frame (no shadows)
+struct ShadowView
+{
+    CMatrix4x4 viewProjectionMatrix;
+    float      atlasRect[4];
+};
+
+// The shadow views used by a light: none (no shadows), one (spotlight), six (point light, one per cube face in the order
+// +x, -x, +y, -y, +z, -z) or one per cascade (directional light, nearest first). The position is used to choose the
+// cube face, cascades are tried in order until one covers the point being lit
+struct LightShadow
+{
+    CVector3 position;
+    int      firstView;
+    int      numViews;
+    float    depthBias; // Subtracted from depths before comparing with the shadow map, avoids surfaces shadowing themselves
+    int      cascaded;  // Non-zero if the views are cascades rather than cube faces
+    float    padding7;
+};
+
+// Shadow information for all lights, updated once per frame after the atlas tiles have been assigned
+struct PerShadowConstants
+{
+    ShadowView  views[MAX_SHADOW_VIEWS];
+    LightShadow lights[MAX_SHADOW_LIGHTS];
+};
+extern PerShadowConstants gPerShadowConstants;
+extern ID3D11Buffer*      gPerShadowConstantBuffer;
+
 
 #endif //_COMMON_H_INCLUDED_
@@ -8,23 +8,41 @@
 //--------------------------------------------------------------------------------------
 
 // The structure below describes the vertex data to be sent into the vertex shader for non-skinned models
+// Normals and tangents arrive packed in octahedral form, use DecodeOctahedral below to get the vector (see VertexPacking.h)
 struct BasicVertex
 {
     float3 position : position;
-    float3 normal   : normal;
+    float2 normal   : normal;
     float2 uv       : uv;
-    float3 tangent : tangent;
+    float2 tangent : tangent;
 };
 
 struct TangentVertex
 {
     float3 position : position;
-    float3 normal : normal;
-    float3 tangent  : tangent;
+    float2 normal : normal;
+    float2 tangent  : tangent;
     float2 uv : uv;
 };
 
 
+// Vertex data for instanced draws of non-skinned models (see Mesh::RenderInstanced). The usual vertex data comes from
+// the mesh, the world matrix and colour come from the instance being drawn (InstanceData in Common.h). The matrix
+// arrives as its four rows
+struct BasicInstancedVertex
+{
+    float3 position : position;
+    float2 normal   : normal;
+    float2 uv       : uv;
+
+    float4 worldRow0 : instanceWorld0;
+    float4 worldRow1 : instanceWorld1;
+    float4 worldRow2 : instanceWorld2;
+    float4 worldRow3 : instanceWorld3;
+    float3 colour    : instanceColour;
+};
+
+
 //*******************
 
 // The structure below describes the vertex data to be sent into the vertex shader for skinned models
@@ -32,15 +50,27 @@ struct TangentVertex
 struct SkinningVertex
 {
     float3 position : position;
-    float3 normal   : normal;
+    float2 normal   : normal;
     float2 uv       : uv;
     uint4  bones    : bones;   // This is the first time we have used integers in a shader: these are indexes into the list of nodes for the skeleton
-	//*** MISSING - below the "xxxxxx" should be the correct type for the bone weights
-    uint4 weights  : weights;
+    float4 weights  : weights; // Amount each of the bones above influences the vertex, adds up to 1
 };
 
 //*******************
 
+// Unpack a normal or tangent stored in octahedral form: a point on a square that is an octahedron unfolded, with its
+// lower half folded out over the corners. Points outside the central diamond are folded back, then the point on the
+// octahedron is normalised. Must match ReadOctahedral in VertexPacking.h
+float3 DecodeOctahedral(float2 packed)
+{
+    float3 v = float3(packed, 1.0f - abs(packed.x) - abs(packed.y));
+    float fold = saturate(-v.z);
+    v.xy += (v.xy >= 0.0f) ? -fold : fold;
+    return normalize(v);
+}
+
+//*******************
+
 
 // This structure describes what data the lighting pixel shader receives from the vertex shader.
 // The projected position is a required output from all vertex shaders - where the vertex is on the screen
@@ -78,13 +108,14 @@ struct SimplePixelShaderInput
 {
     float4 projectedPosition : SV_Position;
     float2 uv : uv;
+    float3 colour : colour; // Tint for the light models, the object colour or the instance's colour
 };
 
 
 struct Light
 {
     float3 Position : Position;
-    float padding1;    
+    int Shadow; // Index into gLightShadows, -1 for no shadows
     float3 Colour : Colour;
     float Padding2;
     float3 Direction : Direction;
@@ -95,9 +126,6 @@ struct Light
     
     float3 Ambient;
     float Padding4;
-    
-    float4x4 lightViewMatrix;
-    float4x4 lightProjectionMatrix;
 };
 
 //--------------------------------------------------------------------------------------
@@ -114,13 +142,7 @@ cbuffer PerFrameConstants : register(b0) // The b0 gives this constant buffer th
     float4x4 gProjectionMatrix;
     float4x4 gViewProjectionMatrix; // The above two matrices multiplied together to combine their effects
 
-    Light Light1;
-    
-    Light Light2;
-    
-    Light Light3;
-    
-    Light Light4;
+    Light gDirectionalLight; // Point lights and spotlights are in the clustered light buffers (see ClusteredLighting.hlsli)
     
     float3   Intensity;
     float    Wiggle;
@@ -133,15 +155,18 @@ cbuffer PerFrameConstants : register(b0) // The b0 gives this constant buffer th
     
     float3   gOutlineColour;
     float    gOutlineThickness;
-    
-    float   DepthAdjust;
-    float3  Padding1;
+
+    float2   gClusterTileScale; // Finding a pixel's cluster, see ClusteredLighting.hlsli
+    float    gClusterDepthScale;
+    float    gClusterDepthBias;
+    uint3    gClusterCounts;
+    float    padding5;
 }
 // Note constant buffers are not structs: we don't use the name of the constant buffer, these are really just a collection of global variables (hence the 'g')
 
 
 
-static const int MAX_BONES = 64;//*** MISSING - what is the maximum number of bones expected? Relates to a MISSING elsewhere
+static const int MAX_BONES = 64; // Must match MAX_BONES in Common.h and BONE_PALETTE_SIZE in MeshData.h
 
 // If we have multiple models then we need to update the world matrix from C++ to GPU multiple times per frame because we
 // only have one world matrix here. Because this data is updated more frequently it is kept in a different buffer for better performance.
@@ -153,6 +178,43 @@ cbuffer PerModelConstants : register(b1) // The b1 gives this constant buffer th
 
     float3   gObjectColour;
     float    padding6;  // See notes on padding in structure above
+}
 
+// Bone matrices for skinned models are kept in their own buffer so rigid models don't have to upload them. Vertex bone
+// indices refer to the palette of the batch being drawn. Only the bones in that palette are updated, the remaining
+// entries hold undefined values
+// These variables must match exactly the PerSkeletonConstants structure in Common.h
+cbuffer PerSkeletonConstants : register(b2)
+{
     float4x4 gBoneMatrices[MAX_BONES];
 }
+
+
+static const int MAX_SHADOW_VIEWS = 20; // Must match MAX_SHADOW_VIEWS in Common.h
+
+// One shadow map in the shadow atlas: the matrix it was rendered with and where its tile is in the atlas as a UV offset
+// (xy) and scale (zw). A scale of 0 means the view has no tile this frame
+struct ShadowView
+{
+    float4x4 viewProjectionMatrix;
+    float4   atlasRect;
+};
+
+// The shadow views used by a light: none, one (spotlight), six (point light cube faces) or one per cascade (directional light)
+struct LightShadow
+{
+    float3 position;
+    int    firstView;
+    int    numViews;
+    float  depthBias;
+    int    cascaded;
+    float  padding7;
+};
+
+// Shadow information for all lights, see Shadows.hlsli for its use
+// These variables must match exactly the PerShadowConstants structure in Common.h
+cbuffer PerShadowConstants : register(b3)
+{
+    ShadowView  gShadowViews[MAX_SHADOW_VIEWS];
+    LightShadow gLightShadows[4];
+}
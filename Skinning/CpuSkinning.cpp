@@ -0,0 +1,346 @@
+//--------------------------------------------------------------------------------------
+// CPU skinning - blends vertex positions and normals by their bone influences on the CPU
+//--------------------------------------------------------------------------------------
+
+#include "CpuSkinning.h"
+#include "VertexPacking.h"
+#include "SimdSupport.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+
+/*-----------------------------------------------------------------------------------------
+    Skinning kernels
+-----------------------------------------------------------------------------------------*/
+// Skinning a vertex means transforming it by each of its four bone matrices and taking the weighted sum of the
+// results. Matrix transforms are linear, so it is quicker to blend the four matrices first (weighted sum of their
+// rows) and transform the position and normal once by the blended matrix. With row vectors (v * M) the transformed
+// position is x * row0 + y * row1 + z * row2 + row3, and a normal is the same without row3.
+// Positions are read and written as three separate floats, they are not aligned in the vertex. Normals and weights
+// are unpacked first (see VertexPacking.h), normals are written as floats.
+
+// Data for one call to a kernel
+struct SkinningJob
+{
+    const SubMeshData*         subMesh;
+    const CMatrix4x4*          bones;
+    const SkinnedVertexStream* output;
+    bool                       skinNormals;
+};
+
+// Output pointer for a given vertex in an output stream
+static inline float* OutputVertex(float* stream, unsigned int stride, unsigned int vertex)
+{
+    return reinterpret_cast<float*>(reinterpret_cast<unsigned char*>(stream) + static_cast<std::size_t>(vertex) * stride);
+}
+
+
+// Plain C++ skinning - reference version used when no SIMD is available. Only the first three columns of the
+// blended matrix are needed
+static void SkinScalar(const SkinningJob& job, unsigned int begin, unsigned int end)
+{
+    const SubMeshData& subMesh = *job.subMesh;
+    for (unsigned int v = begin; v < end; ++v)
+    {
+        const unsigned char* vertex  = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+        const unsigned char* indices = vertex + subMesh.bonesOffset;
+        const unsigned char* weights = indices + 4; // 8-bit normalised, see ReadWeight
+
+        float m[4][3] = {};
+        for (int i = 0; i < 4; ++i)
+        {
+            const CMatrix4x4& bone = job.bones[indices[i]];
+            float w = ReadWeight(weights[i]);
+            m[0][0] += w * bone.e00;  m[0][1] += w * bone.e01;  m[0][2] += w * bone.e02;
+            m[1][0] += w * bone.e10;  m[1][1] += w * bone.e11;  m[1][2] += w * bone.e12;
+            m[2][0] += w * bone.e20;  m[2][1] += w * bone.e21;  m[2][2] += w * bone.e22;
+            m[3][0] += w * bone.e30;  m[3][1] += w * bone.e31;  m[3][2] += w * bone.e32;
+        }
+
+        const float* p = reinterpret_cast<const float*>(vertex + subMesh.positionOffset);
+        float* outP = OutputVertex(job.output->positions, job.output->positionStride, v);
+        for (int c = 0; c < 3; ++c)  outP[c] = p[0] * m[0][c] + p[1] * m[1][c] + p[2] * m[2][c] + m[3][c];
+
+        if (job.skinNormals)
+        {
+            CVector3 n = ReadOctahedral(vertex + subMesh.normalOffset);
+            float* outN = OutputVertex(job.output->normals, job.output->normalStride, v);
+            for (int c = 0; c < 3; ++c)  outN[c] = n.x * m[0][c] + n.y * m[1][c] + n.z * m[2][c];
+        }
+    }
+}
+
+
+#if MATH_SIMD_SSE
+
+// Write x, y, z from an SSE register to three unaligned floats
+static inline void StoreFloat3SSE(float* out, __m128 v)
+{
+    _mm_storel_pi(reinterpret_cast<__m64*>(out), v);
+    _mm_store_ss(out + 2, _mm_movehl_ps(v, v));
+}
+
+// SSE skinning - one row of the blended matrix per register
+static void SkinSSE(const SkinningJob& job, unsigned int begin, unsigned int end)
+{
+    const SubMeshData& subMesh = *job.subMesh;
+    for (unsigned int v = begin; v < end; ++v)
+    {
+        const unsigned char* vertex  = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+        const unsigned char* indices = vertex + subMesh.bonesOffset;
+        const unsigned char* weights = indices + 4; // 8-bit normalised, see ReadWeight
+
+        __m128 r0 = _mm_setzero_ps(), r1 = _mm_setzero_ps(), r2 = _mm_setzero_ps(), r3 = _mm_setzero_ps();
+        for (int i = 0; i < 4; ++i)
+        {
+            const float* bone = &job.bones[indices[i]].e00;
+            __m128 w = _mm_set1_ps(ReadWeight(weights[i]));
+            r0 = _mm_add_ps(r0, _mm_mul_ps(w, _mm_loadu_ps(bone)));
+            r1 = _mm_add_ps(r1, _mm_mul_ps(w, _mm_loadu_ps(bone + 4)));
+            r2 = _mm_add_ps(r2, _mm_mul_ps(w, _mm_loadu_ps(bone + 8)));
+            r3 = _mm_add_ps(r3, _mm_mul_ps(w, _mm_loadu_ps(bone + 12)));
+        }
+
+        const float* p = reinterpret_cast<const float*>(vertex + subMesh.positionOffset);
+        __m128 position = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[0]), r0), _mm_mul_ps(_mm_set1_ps(p[1]), r1)),
+                                     _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[2]), r2), r3));
+        StoreFloat3SSE(OutputVertex(job.output->positions, job.output->positionStride, v), position);
+
+        if (job.skinNormals)
+        {
+            CVector3 n = ReadOctahedral(vertex + subMesh.normalOffset);
+            __m128 normal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(n.x), r0), _mm_mul_ps(_mm_set1_ps(n.y), r1)),
+                                       _mm_mul_ps(_mm_set1_ps(n.z), r2));
+            StoreFloat3SSE(OutputVertex(job.output->normals, job.output->normalStride, v), normal);
+        }
+    }
+}
+
+
+// Put one float in the low half of an AVX register and another in the high half: (a, a, a, a, b, b, b, b)
+SIMD_TARGET_AVX2 static inline __m256 Splat2AVX2(float a, float b)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(a)), _mm_set1_ps(b), 1);
+}
+
+// AVX2 skinning - two rows of the blended matrix per register, accumulated with fused multiply-adds. The transform
+// then works on both halves at once (x * row0 + z * row2 in the low half, y * row1 + row3 in the high half) and
+// adds the halves together at the end
+SIMD_TARGET_AVX2 static void SkinAVX2(const SkinningJob& job, unsigned int begin, unsigned int end)
+{
+    const SubMeshData& subMesh = *job.subMesh;
+    for (unsigned int v = begin; v < end; ++v)
+    {
+        const unsigned char* vertex  = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+        const unsigned char* indices = vertex + subMesh.bonesOffset;
+        const unsigned char* weights = indices + 4; // 8-bit normalised, see ReadWeight
+
+        const float* bone = &job.bones[indices[0]].e00;
+        __m256 w = _mm256_set1_ps(ReadWeight(weights[0]));
+        __m256 r01 = _mm256_mul_ps(w, _mm256_loadu_ps(bone));
+        __m256 r23 = _mm256_mul_ps(w, _mm256_loadu_ps(bone + 8));
+        for (int i = 1; i < 4; ++i)
+        {
+            bone = &job.bones[indices[i]].e00;
+            w = _mm256_set1_ps(ReadWeight(weights[i]));
+            r01 = _mm256_fmadd_ps(w, _mm256_loadu_ps(bone),     r01);
+            r23 = _mm256_fmadd_ps(w, _mm256_loadu_ps(bone + 8), r23);
+        }
+
+        const float* p = reinterpret_cast<const float*>(vertex + subMesh.positionOffset);
+        __m256 position = _mm256_fmadd_ps(Splat2AVX2(p[0], p[1]), r01, _mm256_mul_ps(Splat2AVX2(p[2], 1.0f), r23));
+        StoreFloat3SSE(OutputVertex(job.output->positions, job.output->positionStride, v),
+                       _mm_add_ps(_mm256_castps256_ps128(position), _mm256_extractf128_ps(position, 1)));
+
+        if (job.skinNormals)
+        {
+            CVector3 n = ReadOctahedral(vertex + subMesh.normalOffset);
+            __m256 normal = _mm256_fmadd_ps(Splat2AVX2(n.x, n.y), r01, _mm256_mul_ps(Splat2AVX2(n.z, 0.0f), r23));
+            StoreFloat3SSE(OutputVertex(job.output->normals, job.output->normalStride, v),
+                           _mm_add_ps(_mm256_castps256_ps128(normal), _mm256_extractf128_ps(normal, 1)));
+        }
+    }
+}
+
+#endif // MATH_SIMD_SSE
+
+
+/*-----------------------------------------------------------------------------------------
+    Skinning functions
+-----------------------------------------------------------------------------------------*/
+
+// Run the current kernel on vertices [begin, end), which must all be in one bone batch
+static void SkinRange(const SkinningJob& job, unsigned int begin, unsigned int end)
+{
+    switch (GetMatrixKernel())
+    {
+#if MATH_SIMD_SSE
+    case MatrixKernel::AVX2:
+        SkinAVX2(job, begin, end);
+        break;
+    case MatrixKernel::SSE:
+        SkinSSE(job, begin, end);
+        break;
+#endif
+    default:
+        SkinScalar(job, begin, end);
+        break;
+    }
+}
+
+
+// Skin vertices [begin, end) of a sub-mesh with the given bone matrices - one matrix per node that includes the
+// node's offset matrix, i.e. the same matrices Mesh::Render calculates. Vertex bone indices refer to the palette of
+// their bone batch (see BoneBatch in MeshData.h), so each batch's matrices are gathered from this array first.
+// Normals are not normalised (the same as the shader)
+// Returns false (and writes nothing) if the sub-mesh has no positions or bone data
+bool SkinVertices(const SubMeshData& subMesh, const CMatrix4x4* bones, unsigned int begin, unsigned int end,
+                  const SkinnedVertexStream& output)
+{
+    if (subMesh.positionOffset == SubMeshData::NO_ELEMENT || subMesh.bonesOffset == SubMeshData::NO_ELEMENT ||
+        (subMesh.boneBatches.empty() && subMesh.numVertices > 0))  return false;
+
+    CMatrix4x4 palette[BONE_PALETTE_SIZE];
+
+    SkinningJob job;
+    job.subMesh     = &subMesh;
+    job.bones       = palette;
+    job.output      = &output;
+    job.skinNormals = (output.normals != nullptr && subMesh.normalOffset != SubMeshData::NO_ELEMENT);
+
+    end = std::min(end, subMesh.numVertices);
+    for (auto& batch : subMesh.boneBatches)
+    {
+        unsigned int batchBegin = std::max(begin, batch.firstVertex);
+        unsigned int batchEnd   = std::min(end, batch.firstVertex + batch.numVertices);
+        if (batchBegin >= batchEnd)  continue;
+
+        const uint32_t* nodes = subMesh.bonePalette.data() + batch.firstBone;
+        for (unsigned int bone = 0; bone < batch.numBones; ++bone)  palette[bone] = bones[nodes[bone]];
+        SkinRange(job, batchBegin, batchEnd);
+    }
+    return true;
+}
+
+
+// Skin all the vertices of a sub-mesh as above. If a thread pool is given, sub-meshes larger than SKINNING_BATCH_SIZE
+// vertices are split across its threads
+bool SkinSubMesh(const SubMeshData& subMesh, const CMatrix4x4* bones, const SkinnedVertexStream& output,
+                 ThreadPool* threadPool /*= nullptr*/)
+{
+    if (subMesh.positionOffset == SubMeshData::NO_ELEMENT || subMesh.bonesOffset == SubMeshData::NO_ELEMENT ||
+        (subMesh.boneBatches.empty() && subMesh.numVertices > 0))  return false;
+
+    if (threadPool == nullptr || subMesh.numVertices <= SKINNING_BATCH_SIZE)
+    {
+        return SkinVertices(subMesh, bones, 0, subMesh.numVertices, output);
+    }
+
+    auto skinBatch = [&](unsigned int begin, unsigned int end) { SkinVertices(subMesh, bones, begin, end, output); };
+    threadPool->ParallelFor(subMesh.numVertices, SKINNING_BATCH_SIZE, skinBatch);
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Benchmark
+-----------------------------------------------------------------------------------------*/
+
+// Measure skinning throughput on the given mesh files in their default pose, for each supported kernel with and
+// without the thread pool (pass nullptr to only test a single thread). Each test is run the given number of times.
+// Also reports the largest difference of the SIMD results from the scalar ones. Returns the results as a text table
+std::string BenchmarkSkinning(const std::vector<std::string>& fileNames, ThreadPool* threadPool, unsigned int iterations /*= 100*/)
+{
+    static const char* kernelNames[] = { "Scalar", "SSE", "AVX2" };
+
+    std::string report = "CPU skinning benchmark\n";
+    report += "  Kernel  Threads  Mverts/s   Max error  File\n";
+    char line[512];
+
+    MatrixKernel originalKernel = GetMatrixKernel();
+    for (auto& fileName : fileNames)
+    {
+        MeshData mesh;
+        try
+        {
+            mesh.Load(fileName);
+        }
+        catch (const std::runtime_error& e)
+        {
+            report += std::string("  ") + e.what() + "\n";
+            continue;
+        }
+        if (!mesh.hasBones || mesh.nodes.empty())
+        {
+            report += "  " + fileName + " has no bones\n";
+            continue;
+        }
+
+        // Bone palette for the default pose, calculated the same way as Mesh::Render
+        unsigned int numNodes = static_cast<unsigned int>(mesh.nodes.size());
+        std::vector<CMatrix4x4>   local(numNodes), offsets(numNodes), bones(numNodes);
+        std::vector<unsigned int> parents(numNodes);
+        for (unsigned int i = 0; i < numNodes; ++i)
+        {
+            local[i]   = mesh.nodes[i].defaultMatrix;
+            offsets[i] = mesh.nodes[i].offsetMatrix;
+            parents[i] = mesh.nodes[i].parentIndex;
+        }
+        MatrixMultiplyHierarchy(local.data(), parents.data(), bones.data(), numNodes);
+        MatrixMultiplyBatch(offsets.data(), bones.data(), bones.data(), numNodes);
+
+        // Separate position and normal arrays for each sub-mesh, plus a scalar result to compare against
+        std::size_t numVertices = 0;
+        for (auto& subMesh : mesh.subMeshes)  numVertices += subMesh.numVertices;
+        std::vector<float> positions(numVertices * 3), normals(numVertices * 3), reference(numVertices * 3);
+
+        auto skinAll = [&](ThreadPool* pool, float* positionOut)
+        {
+            std::size_t first = 0;
+            for (auto& subMesh : mesh.subMeshes)
+            {
+                SkinnedVertexStream output;
+                output.positions = positionOut + first * 3;
+                output.normals   = normals.data() + first * 3;
+                SkinSubMesh(subMesh, bones.data(), output, pool);
+                first += subMesh.numVertices;
+            }
+        };
+
+        SetMatrixKernel(MatrixKernel::Scalar);
+        skinAll(nullptr, reference.data());
+
+        for (int kernel = 0; kernel < 3; ++kernel)
+        {
+            SetMatrixKernel(static_cast<MatrixKernel>(kernel));
+            if (GetMatrixKernel() != static_cast<MatrixKernel>(kernel))  continue; // Not supported on this CPU
+
+            for (int threaded = 0; threaded < (threadPool != nullptr ? 2 : 1); ++threaded)
+            {
+                ThreadPool* pool = threaded ? threadPool : nullptr;
+                skinAll(pool, positions.data()); // Warm up caches
+
+                auto start = std::chrono::steady_clock::now();
+                for (unsigned int i = 0; i < iterations; ++i)  skinAll(pool, positions.data());
+                std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+                float maxError = 0;
+                for (std::size_t i = 0; i < positions.size(); ++i)  maxError = std::max(maxError, std::abs(positions[i] - reference[i]));
+
+                double verticesPerSecond = (time.count() > 0) ? numVertices * static_cast<double>(iterations) / time.count() : 0;
+                std::snprintf(line, sizeof(line), "  %-6s  %7u  %8.2f  %10.2e  %s (%u vertices)\n", kernelNames[kernel],
+                              pool != nullptr ? pool->NumThreads() + 1 : 1, verticesPerSecond / 1000000.0, maxError,
+                              fileName.c_str(), static_cast<unsigned int>(numVertices));
+                report += line;
+            }
+        }
+    }
+    SetMatrixKernel(originalKernel);
+
+    return report;
+}
@@ -0,0 +1,62 @@
+//--------------------------------------------------------------------------------------
+// CPU skinning - blends vertex positions and normals by their bone influences on the CPU
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Does the same job as Skinning_vs.hlsl but without the GPU, so skinning can be checked and
+// profiled by command-line tools or on machines without DirectX. Reads the packed interleaved
+// vertex data built by MeshData (see MeshData.h and VertexPacking.h): a float3 position, an
+// octahedral normal, then four 8-bit bone indices at bonesOffset immediately followed by four
+// 8-bit normalised weights. Bone indices refer to the palette of the vertex's bone batch, which
+// maps them to nodes. Skinned normals are written as float3.
+// Each vertex is transformed by the weighted sum of its four bone matrices. The kernel (SSE,
+// AVX2 or scalar) is the same one the matrix batch functions use (see CMatrix4x4.h), so
+// SetMatrixKernel can be used to compare them. Large sub-meshes can be split across a thread
+// pool (see ThreadPool.h).
+
+#ifndef _CPU_SKINNING_H_INCLUDED_
+#define _CPU_SKINNING_H_INCLUDED_
+
+#include "MeshData.h"
+#include "CMatrix4x4.h"
+
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+
+// Where skinned vertices are written. Output i is the skinned version of vertex i in the sub-mesh. Strides allow
+// the output to be separate arrays or interleaved into a larger vertex
+struct SkinnedVertexStream
+{
+    float*       positions      = nullptr; // x, y, z of each skinned position
+    unsigned int positionStride = 12;      // Bytes from one output position to the next
+    float*       normals        = nullptr; // x, y, z of each skinned normal. Set to nullptr to skip normals
+    unsigned int normalStride   = 12;      // Bytes from one output normal to the next
+};
+
+// Number of vertices given to each thread at a time when a sub-mesh is split across a thread pool
+const unsigned int SKINNING_BATCH_SIZE = 2048;
+
+
+// Skin vertices [begin, end) of a sub-mesh with the given bone matrices - one matrix per node that includes the
+// node's offset matrix, i.e. the same matrices Mesh::Render calculates. Vertex bone indices refer to the palette of
+// their bone batch (see BoneBatch in MeshData.h), so each batch's matrices are gathered from this array first.
+// Normals are not normalised (the same as the shader)
+// Returns false (and writes nothing) if the sub-mesh has no positions or bone data
+bool SkinVertices(const SubMeshData& subMesh, const CMatrix4x4* bones, unsigned int begin, unsigned int end,
+                  const SkinnedVertexStream& output);
+
+// Skin all the vertices of a sub-mesh as above. If a thread pool is given, sub-meshes larger than SKINNING_BATCH_SIZE
+// vertices are split across its threads
+bool SkinSubMesh(const SubMeshData& subMesh, const CMatrix4x4* bones, const SkinnedVertexStream& output,
+                 ThreadPool* threadPool = nullptr);
+
+
+// Measure skinning throughput on the given mesh files in their default pose, for each supported kernel with and
+// without the thread pool (pass nullptr to only test a single thread). Each test is run the given number of times.
+// Also reports the largest difference of the SIMD results from the scalar ones. Returns the results as a text table
+std::string BenchmarkSkinning(const std::vector<std::string>& fileNames, ThreadPool* threadPool, unsigned int iterations = 100);
+
+
+#endif //_CPU_SKINNING_H_INCLUDED_
@@ -0,0 +1,417 @@
+//--------------------------------------------------------------------------------------
+// Frustum culling - skip models that are outside the view of a camera or light
+//--------------------------------------------------------------------------------------
+
+#include "Culling.h"
+#include "Model.h"
+#include "Mesh.h"
+#include "Camera.h"
+#include "SimdSupport.h"
+#include "Meshlets.h"
+
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+
+//--------------------------------------------------------------------------------------
+// Box test kernels
+//--------------------------------------------------------------------------------------
+// A box is outside a plane if its centre is further behind the plane than the box reaches towards it. The reach is
+// the extents weighted by the absolute plane normal: |a|*ex + |b|*ey + |c|*ez. Each kernel tests a range of boxes and
+// returns the number visible
+
+namespace
+{
+    // Plane values and absolute normals, one array per component so the SIMD kernels can broadcast them
+    struct PlaneSet
+    {
+        float a[6], b[6], c[6], d[6];
+        float absA[6], absB[6], absC[6];
+    };
+
+    PlaneSet MakePlaneSet(const Frustum& frustum)
+    {
+        PlaneSet planes;
+        for (int p = 0; p < 6; ++p)
+        {
+            planes.a[p] = frustum.planes[p][0];
+            planes.b[p] = frustum.planes[p][1];
+            planes.c[p] = frustum.planes[p][2];
+            planes.d[p] = frustum.planes[p][3];
+            planes.absA[p] = std::abs(planes.a[p]);
+            planes.absB[p] = std::abs(planes.b[p]);
+            planes.absC[p] = std::abs(planes.c[p]);
+        }
+        return planes;
+    }
+
+
+    unsigned int CullBoxesScalar(const PlaneSet& planes, const float* cx, const float* cy, const float* cz,
+                                 const float* ex, const float* ey, const float* ez, unsigned int first, unsigned int count, uint8_t* visible)
+    {
+        unsigned int numVisible = 0;
+        for (unsigned int i = first; i < count; ++i)
+        {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; ++p)
+            {
+                float distance = planes.a[p] * cx[i] + planes.b[p] * cy[i] + planes.c[p] * cz[i] + planes.d[p];
+                float reach    = planes.absA[p] * ex[i] + planes.absB[p] * ey[i] + planes.absC[p] * ez[i];
+                inside = (distance + reach >= 0);
+            }
+            visible[i] = inside ? 1 : 0;
+            numVisible += visible[i];
+        }
+        return numVisible;
+    }
+
+
+#if MATH_SIMD_SSE
+    // Write one visible byte per bit of a movemask result
+    inline unsigned int WriteVisible(int mask, unsigned int numBoxes, uint8_t* visible)
+    {
+        unsigned int numVisible = 0;
+        for (unsigned int k = 0; k < numBoxes; ++k)
+        {
+            visible[k] = static_cast<uint8_t>((mask >> k) & 1);
+            numVisible += visible[k];
+        }
+        return numVisible;
+    }
+
+    // Four boxes at a time. Returns the number of boxes processed as well as counting the visible ones
+    unsigned int CullBoxesSSE(const PlaneSet& planes, const float* cx, const float* cy, const float* cz,
+                              const float* ex, const float* ey, const float* ez, unsigned int count, uint8_t* visible, unsigned int& numVisible)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        unsigned int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 centreX = _mm_loadu_ps(cx + i), centreY = _mm_loadu_ps(cy + i), centreZ = _mm_loadu_ps(cz + i);
+            __m128 extentX = _mm_loadu_ps(ex + i), extentY = _mm_loadu_ps(ey + i), extentZ = _mm_loadu_ps(ez + i);
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; ++p)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.a[p]), centreX),
+                                                        _mm_mul_ps(_mm_set1_ps(planes.b[p]), centreY)),
+                                             _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.c[p]), centreZ), _mm_set1_ps(planes.d[p])));
+                __m128 reach    = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.absA[p]), extentX),
+                                                        _mm_mul_ps(_mm_set1_ps(planes.absB[p]), extentY)),
+                                             _mm_mul_ps(_mm_set1_ps(planes.absC[p]), extentZ));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+            }
+            numVisible += WriteVisible(~_mm_movemask_ps(outside), 4, visible + i);
+        }
+        return i;
+    }
+
+    // Eight boxes at a time
+    SIMD_TARGET_AVX2 unsigned int CullBoxesAVX2(const PlaneSet& planes, const float* cx, const float* cy, const float* cz,
+                                                const float* ex, const float* ey, const float* ez, unsigned int count, uint8_t* visible, unsigned int& numVisible)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        unsigned int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 centreX = _mm256_loadu_ps(cx + i), centreY = _mm256_loadu_ps(cy + i), centreZ = _mm256_loadu_ps(cz + i);
+            __m256 extentX = _mm256_loadu_ps(ex + i), extentY = _mm256_loadu_ps(ey + i), extentZ = _mm256_loadu_ps(ez + i);
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; ++p)
+            {
+                __m256 distance = _mm256_fmadd_ps(_mm256_set1_ps(planes.a[p]), centreX,
+                                  _mm256_fmadd_ps(_mm256_set1_ps(planes.b[p]), centreY,
+                                  _mm256_fmadd_ps(_mm256_set1_ps(planes.c[p]), centreZ, _mm256_set1_ps(planes.d[p]))));
+                __m256 reach    = _mm256_fmadd_ps(_mm256_set1_ps(planes.absA[p]), extentX,
+                                  _mm256_fmadd_ps(_mm256_set1_ps(planes.absB[p]), extentY,
+                                  _mm256_mul_ps(_mm256_set1_ps(planes.absC[p]), extentZ)));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_LT_OQ));
+            }
+            numVisible += WriteVisible(~_mm256_movemask_ps(outside), 8, visible + i);
+        }
+        return i;
+    }
+#endif
+}
+
+
+// Test boxes, given as arrays of centre and extent (half size) components, against a frustum. Sets visible[i] to 1 if
+// box i may be inside, 0 if it is outside. Returns the number visible
+// The SIMD kernels handle whole groups of boxes, any left over at the end use the scalar code
+unsigned int CullBoxes(const Frustum& frustum, const float* centreX, const float* centreY, const float* centreZ,
+                       const float* extentX, const float* extentY, const float* extentZ, unsigned int count, uint8_t* visible)
+{
+    PlaneSet planes = MakePlaneSet(frustum);
+    unsigned int numVisible = 0;
+    unsigned int done = 0;
+
+    switch (GetMatrixKernel())
+    {
+#if MATH_SIMD_SSE
+    case MatrixKernel::AVX2:
+        done = CullBoxesAVX2(planes, centreX, centreY, centreZ, extentX, extentY, extentZ, count, visible, numVisible);
+        break;
+    case MatrixKernel::SSE:
+        done = CullBoxesSSE(planes, centreX, centreY, centreZ, extentX, extentY, extentZ, count, visible, numVisible);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    return numVisible + CullBoxesScalar(planes, centreX, centreY, centreZ, extentX, extentY, extentZ, done, count, visible);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Frustum culler
+//--------------------------------------------------------------------------------------
+
+// Reserve space for the given number of objects, so the culler doesn't use the heap each frame
+FrustumCuller::FrustumCuller(unsigned int maxObjects /*= 256*/)
+{
+    for (auto array : { &mCentreX, &mCentreY, &mCentreZ, &mExtentX, &mExtentY, &mExtentZ })  array->reserve(maxObjects);
+    mVisible.reserve(maxObjects);
+}
+
+
+// Remove all objects
+void FrustumCuller::Clear()
+{
+    for (auto array : { &mCentreX, &mCentreY, &mCentreZ, &mExtentX, &mExtentY, &mExtentZ })  array->clear();
+    mVisible.clear();
+}
+
+
+// Add an object's world space bounds, returns its index for IsVisible. Empty boxes are always culled
+unsigned int FrustumCuller::Add(const AABB& bounds)
+{
+    // An empty box is given hugely negative extents, so it reaches away from every plane and fails the test
+    CVector3 centre  = bounds.IsEmpty() ? CVector3{ 0, 0, 0 } : bounds.Centre();
+    CVector3 extents = bounds.IsEmpty() ? CVector3{ -FLT_MAX, -FLT_MAX, -FLT_MAX } : bounds.Extents();
+    mCentreX.push_back(centre.x);   mCentreY.push_back(centre.y);   mCentreZ.push_back(centre.z);
+    mExtentX.push_back(extents.x);  mExtentY.push_back(extents.y);  mExtentZ.push_back(extents.z);
+    mVisible.push_back(0);
+    return static_cast<unsigned int>(mVisible.size() - 1);
+}
+
+
+// Test all the objects against the frustum of the given view-projection matrix. Returns the number visible
+unsigned int FrustumCuller::Cull(const CMatrix4x4& viewProjection)
+{
+    unsigned int count = NumObjects();
+    unsigned int numVisible = CullBoxes(FrustumFromMatrix(viewProjection), mCentreX.data(), mCentreY.data(), mCentreZ.data(),
+                                        mExtentX.data(), mExtentY.data(), mExtentZ.data(), count, mVisible.data());
+    mStats.tested += count;
+    mStats.culled += count - numVisible;
+    return numVisible;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Benchmark
+//--------------------------------------------------------------------------------------
+
+// Measure culling speed for a crowd of models using the given mesh scattered around a camera: the cost of keeping
+// their world bounds up to date and of the culling test with each kernel. Returns a report for the debug output
+// Meshes with more than one node use the frame allocator for each bounds update, so a single node mesh is best here
+std::string BenchmarkCulling(Mesh* mesh, unsigned int numModels, unsigned int iterations /*= 100*/)
+{
+    static const char* kernelNames[] = { "Scalar", "SSE", "AVX2" };
+
+    // Models scattered through a cube around the camera so roughly a sixth are in view, with random rotations
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2 * PI);
+    std::vector<std::unique_ptr<Model>> models;
+    models.reserve(numModels);
+    for (unsigned int i = 0; i < numModels; ++i)
+    {
+        CVector3 rotation = { angle(random), angle(random), angle(random) };
+        models.push_back(std::make_unique<Model>(mesh, CVector3{ position(random), position(random), position(random) }, rotation));
+    }
+    Camera camera({ 0, 0, 0 }, { 0, 0, 0 });
+    CMatrix4x4 viewProjection = camera.ViewProjectionMatrix();
+
+    std::string report = "Frustum culling benchmark\n";
+    char line[256];
+
+    // Bounds update: models are marked as moved each iteration so their bounds are recalculated
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i)
+    {
+        for (auto& model : models)
+        {
+            model->SetPosition(model->Position());
+            model->WorldBounds();
+        }
+    }
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    std::snprintf(line, sizeof(line), "  Bounds update: %.1f ns/model (%u models)\n", time.count() * 1e9 / (static_cast<double>(numModels) * iterations), numModels);
+    report += line;
+
+    // Culling test with each kernel, results must match the scalar version
+    FrustumCuller culler(numModels);
+    for (auto& model : models)  culler.Add(model->WorldBounds());
+
+    report += "  Kernel  Mmodels/s  Visible  Mismatches\n";
+    MatrixKernel originalKernel = GetMatrixKernel();
+    std::vector<uint8_t> reference;
+    for (int kernel = 0; kernel < 3; ++kernel)
+    {
+        SetMatrixKernel(static_cast<MatrixKernel>(kernel));
+        if (GetMatrixKernel() != static_cast<MatrixKernel>(kernel))  continue; // Not supported on this CPU
+
+        unsigned int numVisible = culler.Cull(viewProjection); // Warm up caches
+        start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)  culler.Cull(viewProjection);
+        time = std::chrono::steady_clock::now() - start;
+
+        unsigned int mismatches = 0;
+        if (reference.empty())
+        {
+            for (unsigned int i = 0; i < numModels; ++i)  reference.push_back(culler.IsVisible(i) ? 1 : 0);
+        }
+        for (unsigned int i = 0; i < numModels; ++i)  mismatches += (culler.IsVisible(i) != (reference[i] != 0));
+
+        double modelsPerSecond = (time.count() > 0) ? numModels * static_cast<double>(iterations) / time.count() : 0;
+        std::snprintf(line, sizeof(line), "  %-6s  %9.2f  %7u  %10u\n", kernelNames[kernel], modelsPerSecond / 1000000.0, numVisible, mismatches);
+        report += line;
+    }
+    SetMatrixKernel(originalKernel);
+
+    return report;
+}
+
+
+// Measure meshlet culling (see Meshlets.h) for a crowd of models of each of the given mesh files scattered around a
+// camera. For the models that pass the model culling: the meshlets outside the view and back-facing, the triangles and
+// draw calls left, and the time taken to cull the meshlets. The meshes are loaded without a GPU. Returns a report for
+// the debug output
+// Models are scattered through a cube twenty times the mesh's radius across, centred on the camera, so some are close
+// enough to be only partly in view. Every model is counted at full detail, the level it would need for its meshlets
+std::string BenchmarkMeshletCulling(const std::vector<std::string>& fileNames, unsigned int numModels, unsigned int iterations /*= 20*/)
+{
+    std::string report = "Meshlet culling benchmark (" + std::to_string(numModels) + " models of each mesh)\n";
+    report += "  Meshlets  Visible  Frustum  Back-facing  Triangles kept  Draw calls        ns/meshlet  ms/frame  File\n";
+    char line[512];
+
+    Camera camera({ 0, 0, 0 }, { 0, 0, 0 });
+    MeshletView view;
+    view.viewProjection = camera.ViewProjectionMatrix();
+    view.cameraPosition = camera.Position();
+
+    for (auto& fileName : fileNames)
+    {
+        MeshData mesh;
+        try
+        {
+            mesh.Load(fileName);
+        }
+        catch (const std::runtime_error& e)
+        {
+            report += std::string("  ") + e.what() + "\n";
+            continue;
+        }
+
+        // Meshlets in one model, counting each node's use of a sub-mesh
+        unsigned int numNodes = static_cast<unsigned int>(mesh.nodes.size());
+        unsigned int modelMeshlets = 0, maxMeshlets = 0;
+        for (auto& node : mesh.nodes)
+        {
+            for (auto subMesh : node.subMeshes)
+            {
+                unsigned int numMeshlets = static_cast<unsigned int>(mesh.subMeshes[subMesh].meshlets.size());
+                modelMeshlets += numMeshlets;
+                maxMeshlets = std::max(maxMeshlets, numMeshlets);
+            }
+        }
+        if (modelMeshlets == 0)
+        {
+            report += "  No meshlets (skinned or small sub-meshes) in " + fileName + "\n";
+            continue;
+        }
+
+        // Absolute node matrices of each model with a random position and rotation, and the models' bounds for culling
+        std::vector<unsigned int> parents(numNodes);
+        std::vector<CMatrix4x4>   local(numNodes);
+        for (unsigned int i = 0; i < numNodes; ++i)
+        {
+            parents[i] = mesh.nodes[i].parentIndex;
+            local[i]   = mesh.nodes[i].defaultMatrix;
+        }
+        float spread = 10 * std::max(mesh.boundingSphere.radius, 1.0f);
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> position(-spread, spread);
+        std::uniform_real_distribution<float> angle(0.0f, 2 * PI);
+        std::vector<CMatrix4x4> matrices(static_cast<std::size_t>(numModels) * numNodes);
+        FrustumCuller culler(numModels);
+        for (unsigned int m = 0; m < numModels; ++m)
+        {
+            CMatrix4x4 rotation = MatrixRotationZ(angle(random)) * MatrixRotationX(angle(random)) * MatrixRotationY(angle(random));
+            local[0] = mesh.nodes[0].defaultMatrix * rotation * MatrixTranslation({ position(random), position(random), position(random) });
+            CMatrix4x4* absolute = &matrices[static_cast<std::size_t>(m) * numNodes];
+            MatrixMultiplyHierarchy(local.data(), parents.data(), absolute, numNodes);
+
+            AABB bounds;
+            for (unsigned int i = 0; i < numNodes; ++i)  bounds.Add(TransformAABB(mesh.nodes[i].bounds, absolute[i]));
+            culler.Add(bounds);
+        }
+        unsigned int numVisible = culler.Cull(view.viewProjection);
+
+        // Cull the meshlets of every visible model, as Mesh::Render does
+        std::vector<uint32_t> ranges(maxMeshlets * 2);
+        unsigned int fullTriangles = 0;
+        auto cullMeshlets = [&](MeshletStats& stats)
+        {
+            for (unsigned int m = 0; m < numModels; ++m)
+            {
+                if (!culler.IsVisible(m))  continue;
+                for (unsigned int i = 0; i < numNodes; ++i)
+                {
+                    MeshletNodeView nodeView = MakeMeshletNodeView(view, matrices[static_cast<std::size_t>(m) * numNodes + i]);
+                    for (auto subMesh : mesh.nodes[i].subMeshes)
+                    {
+                        const auto& meshlets = mesh.subMeshes[subMesh].meshlets;
+                        if (meshlets.empty())  continue;
+                        CullMeshlets(meshlets.data(), static_cast<unsigned int>(meshlets.size()), nodeView, ranges.data(), stats);
+                        ++stats.subMeshDraws;
+                    }
+                }
+            }
+        };
+        MeshletStats stats;
+        cullMeshlets(stats);
+        for (unsigned int m = 0; m < numVisible; ++m)
+        {
+            for (auto& node : mesh.nodes)
+            {
+                for (auto subMesh : node.subMeshes)
+                {
+                    if (!mesh.subMeshes[subMesh].meshlets.empty())  fullTriangles += mesh.subMeshes[subMesh].numIndices / 3;
+                }
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            MeshletStats timedStats;
+            cullMeshlets(timedStats);
+        }
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+        auto percent = [](unsigned int part, unsigned int whole) { return (whole > 0) ? 100.0 * part / whole : 0.0; };
+        double nsPerMeshlet = (stats.tested > 0) ? time.count() * 1e9 / (static_cast<double>(stats.tested) * iterations) : 0;
+        std::snprintf(line, sizeof(line), "  %8u  %7u  %6.1f%%  %10.1f%%  %13.1f%%  %6u -> %-6u  %10.1f  %8.3f  %s\n",
+                      modelMeshlets, numVisible, percent(stats.frustumCulled, stats.tested), percent(stats.backFacing, stats.tested),
+                      percent(fullTriangles - stats.culledIndices / 3, fullTriangles), stats.subMeshDraws, stats.ranges,
+                      nsPerMeshlet, time.count() * 1000.0 / iterations, fileName.c_str());
+        report += line;
+    }
+    return report;
+}
@@ -0,0 +1,87 @@
+//--------------------------------------------------------------------------------------
+// Frustum culling - skip models that are outside the view of a camera or light
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// The six planes of the view frustum are taken from a view-projection matrix. Each object is
+// tested by its world space bounding box (see Model::WorldBounds): a box is culled if it is
+// entirely behind any one plane. The test can keep a few boxes that are near a corner of the
+// frustum but outside it, it never culls a box that is even partly inside.
+// Boxes are stored as separate arrays of centre and extent components (structure-of-arrays) so
+// the test runs on 4 (SSE) or 8 (AVX2) boxes at once. It uses the same kernel selection as the
+// matrix batch functions (see SetMatrixKernel in CMatrix4x4.h).
+
+#ifndef _CULLING_H_INCLUDED_
+#define _CULLING_H_INCLUDED_
+
+#include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class Mesh;
+
+
+// Test boxes, given as arrays of centre and extent (half size) components, against a frustum (see BoundingVolumes.h). Sets visible[i] to 1 if
+// box i may be inside, 0 if it is outside. Returns the number visible
+unsigned int CullBoxes(const Frustum& frustum, const float* centreX, const float* centreY, const float* centreZ,
+                       const float* extentX, const float* extentY, const float* extentZ, unsigned int count, uint8_t* visible);
+
+
+// Object counts since the last ResetStats
+struct CullingStats
+{
+    unsigned int tested = 0;
+    unsigned int culled = 0;
+};
+
+
+// Collects bounding boxes each frame, then culls them all in one call
+class FrustumCuller
+{
+public:
+    // Reserve space for the given number of objects, so the culler doesn't use the heap each frame
+    explicit FrustumCuller(unsigned int maxObjects = 256);
+
+    // Remove all objects
+    void Clear();
+
+    // Add an object's world space bounds, returns its index for IsVisible. Empty boxes are always culled
+    unsigned int Add(const AABB& bounds);
+
+    // Test all the objects against the frustum of the given view-projection matrix. Returns the number visible
+    unsigned int Cull(const CMatrix4x4& viewProjection);
+
+    // Result of the last Cull for an object
+    bool IsVisible(unsigned int index) const  { return mVisible[index] != 0; }
+
+    unsigned int NumObjects() const  { return static_cast<unsigned int>(mVisible.size()); }
+
+
+    // Object counts, accumulated over calls to Cull until reset
+    const CullingStats& Stats() const  { return mStats; }
+    void ResetStats()  { mStats = CullingStats(); }
+
+
+private:
+    std::vector<float>   mCentreX, mCentreY, mCentreZ;
+    std::vector<float>   mExtentX, mExtentY, mExtentZ;
+    std::vector<uint8_t> mVisible;
+
+    CullingStats mStats;
+};
+
+
+// Measure culling speed for a crowd of models using the given mesh scattered around a camera: the cost of keeping
+// their world bounds up to date and of the culling test with each kernel. Returns a report for the debug output
+std::string BenchmarkCulling(Mesh* mesh, unsigned int numModels, unsigned int iterations = 100);
+
+// Measure meshlet culling (see Meshlets.h) for a crowd of models of each of the given mesh files scattered around a
+// camera. For the models that pass the model culling: the meshlets outside the view and back-facing, the triangles and
+// draw calls left, and the time taken to cull the meshlets. The meshes are loaded without a GPU. Returns a report for
+// the debug output
+std::string BenchmarkMeshletCulling(const std::vector<std::string>& fileNames, unsigned int numModels, unsigned int iterations = 20);
+
+
+#endif //_CULLING_H_INCLUDED_
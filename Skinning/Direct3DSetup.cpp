@@ -5,6 +5,8 @@
 #include "Direct3DSetup.h"
 #include "Shader.h"
 #include "Common.h"
+#include "StateCache.h"
+#include "GeometryArena.h"
 #include <d3d11.h>
 #include <vector>
 
@@ -18,6 +20,12 @@
 ID3D11Device*        gD3DDevice  = nullptr; // D3D device for overall features
 ID3D11DeviceContext* gD3DContext = nullptr; // D3D context for specific rendering tasks
 
+// Pipeline state changes go through this so redundant ones are dropped. Given the context once it is created
+StateCache gStateCache;
+
+// Shared vertex and index buffers for all meshes, creates its buffers as meshes are loaded
+GeometryArena gGeometryArena;
+
 // Swap chain and back buffer
 IDXGISwapChain*         gSwapChain              = nullptr;
 ID3D11RenderTargetView* gBackBufferRenderTarget = nullptr;
@@ -62,6 +70,7 @@ bool InitDirect3D()
         gLastError = "Error creating Direct3D device";
         return false;
     }
+    gStateCache.SetContext(gD3DContext);
 
 
     // Get a "render target view" of back-buffer - standard behaviour
@@ -127,9 +136,11 @@ void ShutdownDirect3D()
     // Release each Direct3D object to return resources to the system. Leaving these out will cause memory
     // leaks. Check documentation to see which objects need to be released when adding new features in your
     // own projects.
+    gGeometryArena.Release(); // All meshes must have been freed by now
     if (gD3DContext)
     {
         gD3DContext->ClearState(); // This line is also needed to reset the GPU before shutting down DirectX
+        gStateCache.SetContext(nullptr);
         gD3DContext->Release();
     }
     if (gDepthStencil)           gDepthStencil->Release();
@@ -0,0 +1,228 @@
+//--------------------------------------------------------------------------------------
+// Geometry arena - shared vertex and index buffers that all meshes suballocate from
+//--------------------------------------------------------------------------------------
+
+#include "GeometryArena.h"
+#include "Common.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+
+// Sizes of standard pages in bytes, sub-meshes that don't fit get a page of their own size
+GeometryArena::GeometryArena(uint32_t vertexPageBytes /*= 4 * 1024 * 1024*/, uint32_t indexPageBytes /*= 4 * 1024 * 1024*/)
+    : mVertexPageBytes(vertexPageBytes), mIndexPageBytes(indexPageBytes)
+{
+}
+
+// Releases all pages
+GeometryArena::~GeometryArena()
+{
+    Release();
+}
+
+
+// Copy a sub-mesh's vertices and indices (2 or 4 bytes each) into the arena. Returns a handle to find the geometry
+// when drawing. Will throw a std::runtime_error exception if a page is needed and can't be created
+GeometryArena::Handle GeometryArena::Add(const void* vertices, uint32_t vertexSize, uint32_t numVertices,
+                                         const void* indices, uint32_t indexSize, uint32_t numIndices)
+{
+    Allocation allocation;
+    allocation.inUse = true;
+    if (numVertices > 0)
+    {
+        allocation.vertexPage = AllocateElements(vertexSize, D3D11_BIND_VERTEX_BUFFER, numVertices, allocation.range.baseVertex);
+        allocation.range.vertexBuffer = mPages[allocation.vertexPage].buffer;
+        Upload(mPages[allocation.vertexPage], allocation.range.baseVertex, numVertices, vertices);
+    }
+    if (numIndices > 0)
+    {
+        try
+        {
+            allocation.indexPage = AllocateElements(indexSize, D3D11_BIND_INDEX_BUFFER, numIndices, allocation.range.firstIndex);
+        }
+        catch (const std::runtime_error&)
+        {
+            if (allocation.vertexPage != NO_PAGE)  mPages[allocation.vertexPage].allocator.Free(allocation.range.baseVertex);
+            throw;
+        }
+        allocation.range.indexBuffer = mPages[allocation.indexPage].buffer;
+        Upload(mPages[allocation.indexPage], allocation.range.firstIndex, numIndices, indices);
+    }
+
+    if (!mFreeHandles.empty())
+    {
+        Handle handle = mFreeHandles.back();
+        mFreeHandles.pop_back();
+        mAllocations[handle] = allocation;
+        return handle;
+    }
+    mAllocations.push_back(allocation);
+    return static_cast<Handle>(mAllocations.size() - 1);
+}
+
+
+// Free a sub-mesh's geometry. Its space can be reused by later Adds, or given back by Compact
+void GeometryArena::Remove(Handle handle)
+{
+    Allocation& allocation = mAllocations[handle];
+    if (!allocation.inUse)  return;
+
+    if (allocation.vertexPage != NO_PAGE)  mPages[allocation.vertexPage].allocator.Free(allocation.range.baseVertex);
+    if (allocation.indexPage  != NO_PAGE)  mPages[allocation.indexPage] .allocator.Free(allocation.range.firstIndex);
+    allocation = Allocation();
+    mFreeHandles.push_back(handle);
+}
+
+
+// Allocate a range of elements in a page of the given element size and type, creating a new page if none has room.
+// Returns the page index and sets offset
+uint32_t GeometryArena::AllocateElements(uint32_t elementSize, UINT bindFlags, uint32_t count, uint32_t& offset)
+{
+    // Try the existing pages for this kind of element first
+    for (uint32_t p = 0; p < mPages.size(); ++p)
+    {
+        Page& page = mPages[p];
+        if (page.buffer == nullptr || page.elementSize != elementSize || page.bindFlags != bindFlags)  continue;
+        offset = page.allocator.Allocate(count);
+        if (offset != RangeAllocator::INVALID_OFFSET)  return p;
+    }
+
+    // New page, the standard size unless the geometry needs more. The buffer has no initial data, each allocation is
+    // uploaded separately
+    uint32_t pageBytes = (bindFlags == D3D11_BIND_VERTEX_BUFFER) ? mVertexPageBytes : mIndexPageBytes;
+    uint32_t capacity  = std::max(pageBytes / elementSize, count);
+
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.BindFlags      = bindFlags;
+    bufferDesc.Usage          = D3D11_USAGE_DEFAULT;
+    bufferDesc.ByteWidth      = capacity * elementSize;
+    bufferDesc.CPUAccessFlags = 0;
+    bufferDesc.MiscFlags      = 0;
+    ID3D11Buffer* buffer = nullptr;
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &buffer)))
+    {
+        throw std::runtime_error("Failure creating geometry arena buffer");
+    }
+
+    // Reuse the slot of a released page, so the page indices held by allocations stay the same
+    auto slot = std::find_if(mPages.begin(), mPages.end(), [](const Page& page) { return page.buffer == nullptr; });
+    if (slot == mPages.end())
+    {
+        mPages.emplace_back();
+        slot = mPages.end() - 1;
+    }
+    slot->buffer      = buffer;
+    slot->elementSize = elementSize;
+    slot->bindFlags   = bindFlags;
+    slot->allocator.Reset(capacity);
+    offset = slot->allocator.Allocate(count);
+    return static_cast<uint32_t>(slot - mPages.begin());
+}
+
+
+// Copy data to a range of a page's buffer
+void GeometryArena::Upload(const Page& page, uint32_t offset, uint32_t count, const void* data)
+{
+    D3D11_BOX box = { offset * page.elementSize, 0, 0, (offset + count) * page.elementSize, 1, 1 };
+    gD3DContext->UpdateSubresource(page.buffer, 0, &box, data, 0, 0);
+}
+
+
+// Pack the geometry in each page that has gaps, copying it on the GPU into a new buffer, and release pages left
+// empty. Returns the number of bytes copied.
+// Will throw a std::runtime_error exception if a new buffer can't be created (the page is left as it was)
+std::size_t GeometryArena::Compact()
+{
+    std::size_t bytesCopied = 0;
+    for (uint32_t p = 0; p < mPages.size(); ++p)
+    {
+        Page& page = mPages[p];
+        if (page.buffer == nullptr)  continue;
+
+        RangeAllocatorStats stats = page.allocator.Stats();
+        if (stats.allocations == 0)
+        {
+            page.buffer->Release();
+            page.buffer = nullptr;
+            continue;
+        }
+        if (page.allocator.IsCompact())  continue;
+
+        // Overlapping copies within one buffer aren't allowed, so the packed geometry goes into a new buffer of the
+        // same size. The allocator is only compacted once the buffer exists
+        D3D11_BUFFER_DESC bufferDesc;
+        page.buffer->GetDesc(&bufferDesc);
+        ID3D11Buffer* buffer = nullptr;
+        if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &buffer)))
+        {
+            throw std::runtime_error("Failure creating geometry arena buffer");
+        }
+
+        page.allocator.Compact(mMoves);
+        for (auto& move : mMoves)
+        {
+            D3D11_BOX box = { move.from * page.elementSize, 0, 0, (move.from + move.size) * page.elementSize, 1, 1 };
+            gD3DContext->CopySubresourceRegion(buffer, 0, move.to * page.elementSize, 0, 0, page.buffer, 0, &box);
+            bytesCopied += static_cast<std::size_t>(move.size) * page.elementSize;
+        }
+        page.buffer->Release();
+        page.buffer = buffer;
+
+        // Update the ranges of the geometry in this page. Moves are in order of their old offset
+        auto moved = [this](uint32_t from)
+        {
+            auto move = std::lower_bound(mMoves.begin(), mMoves.end(), from,
+                                         [](const RangeAllocator::Move& m, uint32_t f) { return m.from < f; });
+            return move->to;
+        };
+        for (auto& allocation : mAllocations)
+        {
+            if (!allocation.inUse)  continue;
+            if (allocation.vertexPage == p)
+            {
+                allocation.range.baseVertex   = moved(allocation.range.baseVertex);
+                allocation.range.vertexBuffer = buffer;
+            }
+            if (allocation.indexPage == p)
+            {
+                allocation.range.firstIndex  = moved(allocation.range.firstIndex);
+                allocation.range.indexBuffer = buffer;
+            }
+        }
+    }
+    return bytesCopied;
+}
+
+
+// Release every page. All geometry must have been removed first
+void GeometryArena::Release()
+{
+    for (auto& page : mPages)
+    {
+        if (page.buffer)  page.buffer->Release();
+    }
+    mPages.clear();
+    mAllocations.clear();
+    mFreeHandles.clear();
+}
+
+
+GeometryArenaStats GeometryArena::Stats() const
+{
+    GeometryArenaStats stats;
+    std::size_t freeBytes = 0, largestFreeBytes = 0;
+    for (auto& page : mPages)
+    {
+        if (page.buffer == nullptr)  continue;
+        RangeAllocatorStats pageStats = page.allocator.Stats();
+        ++stats.pages;
+        stats.allocations   += pageStats.allocations;
+        stats.capacityBytes += static_cast<std::size_t>(pageStats.capacity) * page.elementSize;
+        stats.usedBytes     += static_cast<std::size_t>(pageStats.used) * page.elementSize;
+        freeBytes           += static_cast<std::size_t>(pageStats.capacity - pageStats.used) * page.elementSize;
+        largestFreeBytes    += static_cast<std::size_t>(pageStats.largestFree) * page.elementSize;
+    }
+    stats.fragmentation = (freeBytes == 0) ? 0.0f : 1.0f - static_cast<float>(largestFreeBytes) / freeBytes;
+    return stats;
+}
@@ -0,0 +1,128 @@
+//--------------------------------------------------------------------------------------
+// Geometry arena - shared vertex and index buffers that all meshes suballocate from
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Instead of each sub-mesh creating its own vertex and index buffer, its geometry is copied into
+// a range of a few large buffers ("pages"). Vertices go in pages for their vertex size, as the
+// vertex buffer stride applies to the whole buffer, and likewise indices go in pages for 16-bit
+// or 32-bit indices. A sub-mesh is then drawn with its base vertex and first index as draw call
+// offsets, so consecutive draws of different meshes often keep the same buffers bound (skipped by
+// the state cache), and loading a mesh usually creates no new buffers at all.
+// Ranges in each page are handed out by a RangeAllocator (see Utility/RangeAllocator.h). A new
+// page is created when none of the existing ones has room, larger than usual for a sub-mesh that
+// doesn't fit in a standard page. Removing a sub-mesh leaves a gap, Compact copies each page's
+// geometry into a new packed buffer on the GPU and releases pages left empty. Geometry is found
+// through a handle, whose range is updated when it moves, so look it up each time it is drawn.
+// Only use from the thread that owns the D3D context.
+
+#ifndef _GEOMETRY_ARENA_H_INCLUDED_
+#define _GEOMETRY_ARENA_H_INCLUDED_
+
+#include "RangeAllocator.h"
+
+#include <d3d11.h>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+// Where a sub-mesh's geometry is: the buffers to bind and the offsets to pass to the draw call
+struct GeometryRange
+{
+    ID3D11Buffer* vertexBuffer = nullptr;
+    ID3D11Buffer* indexBuffer  = nullptr;
+    uint32_t      baseVertex   = 0; // Added to each index
+    uint32_t      firstIndex   = 0;
+};
+
+// Usage of the whole arena, calculated on request. Vertex and index pages are counted together
+struct GeometryArenaStats
+{
+    unsigned int pages         = 0; // Buffers created
+    unsigned int allocations   = 0; // Vertex and index ranges in use, two per sub-mesh
+    std::size_t  capacityBytes = 0;
+    std::size_t  usedBytes     = 0;
+    float        fragmentation = 0; // 1 - largest gaps / free space, summed over pages (see RangeAllocatorStats)
+};
+
+
+class GeometryArena
+{
+public:
+    typedef uint32_t Handle;
+    static const Handle INVALID_HANDLE = 0xffffffff;
+
+    // Sizes of standard pages in bytes, sub-meshes that don't fit get a page of their own size
+    explicit GeometryArena(uint32_t vertexPageBytes = 4 * 1024 * 1024, uint32_t indexPageBytes = 4 * 1024 * 1024);
+
+    // Releases all pages
+    ~GeometryArena();
+
+    // Arenas own GPU resources so cannot be copied
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+
+    // Copy a sub-mesh's vertices and indices (2 or 4 bytes each) into the arena. Returns a handle to find the geometry
+    // when drawing. Will throw a std::runtime_error exception if a page is needed and can't be created
+    Handle Add(const void* vertices, uint32_t vertexSize, uint32_t numVertices,
+               const void* indices, uint32_t indexSize, uint32_t numIndices);
+
+    // Free a sub-mesh's geometry. Its space can be reused by later Adds, or given back by Compact
+    void Remove(Handle handle);
+
+    // Where a sub-mesh's geometry is now. Valid until the next Add, Remove or Compact
+    const GeometryRange& Get(Handle handle) const  { return mAllocations[handle].range; }
+
+
+    // Pack the geometry in each page that has gaps, copying it on the GPU into a new buffer, and release pages left
+    // empty. Returns the number of bytes copied.
+    // Will throw a std::runtime_error exception if a new buffer can't be created (the page is left as it was)
+    std::size_t Compact();
+
+    // Release every page. All geometry must have been removed first
+    void Release();
+
+
+    GeometryArenaStats Stats() const;
+
+
+private:
+    // One buffer and the allocator for its elements (vertices or indices)
+    struct Page
+    {
+        ID3D11Buffer*  buffer = nullptr; // nullptr if the page has been released, its slot is reused for the next page
+        RangeAllocator allocator;
+        uint32_t       elementSize = 0;  // Bytes per element
+        UINT           bindFlags   = 0;
+    };
+
+    static const uint32_t NO_PAGE = 0xffffffff;
+
+    struct Allocation
+    {
+        GeometryRange range;
+        uint32_t      vertexPage = NO_PAGE; // Index into mPages, NO_PAGE if the sub-mesh has no vertices
+        uint32_t      indexPage  = NO_PAGE; // Same for indices
+        bool          inUse      = false;
+    };
+
+    // Allocate a range of elements in a page of the given element size and type, creating a new page if none has room.
+    // Returns the page index and sets offset
+    uint32_t AllocateElements(uint32_t elementSize, UINT bindFlags, uint32_t count, uint32_t& offset);
+
+    // Copy data to a range of a page's buffer
+    void Upload(const Page& page, uint32_t offset, uint32_t count, const void* data);
+
+
+    uint32_t mVertexPageBytes;
+    uint32_t mIndexPageBytes;
+
+    std::vector<Page>       mPages;
+    std::vector<Allocation> mAllocations;  // Indexed by handle
+    std::vector<Handle>     mFreeHandles;  // Entries in mAllocations not in use
+    std::vector<RangeAllocator::Move> mMoves; // Used by Compact
+};
+
+
+#endif //_GEOMETRY_ARENA_H_INCLUDED_
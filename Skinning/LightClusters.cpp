@@ -0,0 +1,332 @@
+//--------------------------------------------------------------------------------------
+// Clustered lighting - bins point and spot lights into a grid over the camera's view
+//--------------------------------------------------------------------------------------
+
+#include "LightClusters.h"
+#include "ThreadPool.h"
+#include "MathHelpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstdio>
+
+
+// Sphere enclosing the part of the world a light can reach (see header)
+BoundingSphere ClusterLightBounds(const ClusterLight& light)
+{
+    BoundingSphere bounds;
+    bounds.centre = light.position;
+    bounds.radius = light.range;
+
+    // A spotlight's cone is enclosed by its range sphere, but a narrow cone fits a much smaller sphere. Up to 45 degrees
+    // from the axis, the smallest sphere touches the tip and the rim of the cone's end, beyond that it is the sphere
+    // around the rim alone
+    if (light.cosHalfAngle >= -1)
+    {
+        float cosHalfAngle = std::min(light.cosHalfAngle, 1.0f);
+        if (cosHalfAngle > 0.70710678f)
+        {
+            bounds.radius = light.range * 0.5f / cosHalfAngle;
+            bounds.centre = light.position + light.direction * bounds.radius;
+        }
+        else if (cosHalfAngle > 0)
+        {
+            bounds.radius = light.range * std::sqrt(1 - cosHalfAngle * cosHalfAngle);
+            bounds.centre = light.position + light.direction * (light.range * cosHalfAngle);
+        }
+    }
+    return bounds;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cluster builder
+//--------------------------------------------------------------------------------------
+
+// All the memory used is reserved here, Build doesn't use the heap
+LightClusterBuilder::LightClusterBuilder(unsigned int tilesX /*= 16*/, unsigned int tilesY /*= 9*/, unsigned int numSlices /*= 24*/,
+                                         float sliceNear /*= 1.0f*/, float sliceFar /*= 1000.0f*/,
+                                         unsigned int maxLights /*= 4096*/, unsigned int maxLightIndices /*= 256 * 1024*/)
+    : mTilesX(std::min(tilesX, 256u)), mTilesY(std::min(tilesY, 256u)), mNumSlices(numSlices), mMaxLights(maxLights),
+      mSliceNear(sliceNear), mSliceFar(sliceFar)
+{
+    // slice = numSlices * log(z / sliceNear) / log(sliceFar / sliceNear), rearranged to a multiply and add of log(z)
+    mDepthScale = numSlices / std::log(sliceFar / sliceNear);
+    mDepthBias  = -std::log(sliceNear) * mDepthScale;
+
+    // A light can reach every slice, so the per-slice lists are sized for that
+    mViewLights.resize(maxLights);
+    mSliceDepths.resize(numSlices + 1);
+    mSliceStarts.resize(numSlices + 1);
+    mSliceLights.resize(static_cast<std::size_t>(maxLights) * numSlices);
+    mSliceRects.resize(mSliceLights.size());
+    mClusters.resize(NumClusters());
+    mClusterFill.resize(NumClusters());
+    mLightIndices.resize(maxLightIndices);
+}
+
+
+// Bin the given lights into the clusters of the camera's view (see header)
+void LightClusterBuilder::Build(const ClusterLight* lights, unsigned int numLights, const ClusterCamera& camera,
+                                ThreadPool* threadPool /*= nullptr*/)
+{
+    mStats = LightClusterStats();
+    mNumLights = std::min(numLights, mMaxLights);
+    mStats.droppedLights = numLights - mNumLights;
+    mStats.lights = mNumLights;
+
+    // Depths of the slice boundaries. The first slice reaches back to the camera's near clip and the last one out to
+    // its far clip, so every visible pixel is in a slice
+    mSliceDepths[0] = camera.nearClip;
+    for (unsigned int slice = 1; slice < mNumSlices; ++slice)
+    {
+        mSliceDepths[slice] = mSliceNear * std::pow(mSliceFar / mSliceNear, static_cast<float>(slice) / mNumSlices);
+    }
+    mSliceDepths[mNumSlices] = std::max(camera.farClip, mSliceDepths[mNumSlices - 1]);
+
+    // Each light's sphere in view space and the slices it reaches
+    auto prepare = [&](unsigned int begin, unsigned int end) { PrepareLights(lights, begin, end, camera); };
+    if (threadPool != nullptr)  threadPool->ParallelFor(mNumLights, 256, prepare);
+    else                        prepare(0, mNumLights);
+
+    // List the lights reaching each slice, so each slice only looks at its own lights
+    std::fill(mSliceStarts.begin(), mSliceStarts.end(), 0);
+    for (unsigned int light = 0; light < mNumLights; ++light)
+    {
+        for (int slice = mViewLights[light].firstSlice; slice <= mViewLights[light].lastSlice; ++slice)  ++mSliceStarts[slice + 1];
+    }
+    for (unsigned int slice = 0; slice < mNumSlices; ++slice)  mSliceStarts[slice + 1] += mSliceStarts[slice];
+    for (unsigned int light = 0; light < mNumLights; ++light)
+    {
+        for (int slice = mViewLights[light].firstSlice; slice <= mViewLights[light].lastSlice; ++slice)
+        {
+            mSliceLights[mSliceStarts[slice]++] = light;
+        }
+    }
+    for (unsigned int slice = mNumSlices; slice > 0; --slice)  mSliceStarts[slice] = mSliceStarts[slice - 1]; // Undo the increments above
+    mSliceStarts[0] = 0;
+
+    // Count the lights in each cluster, so each cluster's part of the index list can be placed. Slices are independent
+    // of each other, so are shared between threads
+    std::fill(mClusters.begin(), mClusters.end(), ClusterRange{ 0, 0 });
+    auto count = [&](unsigned int begin, unsigned int end) { CountSlices(begin, end, camera); };
+    if (threadPool != nullptr)  threadPool->ParallelFor(mNumSlices, 1, count);
+    else                        count(0, mNumSlices);
+
+    // Each cluster's lights follow on from the previous cluster's. Clusters that don't fit in the index list lose their
+    // last lights
+    unsigned int offset = 0;
+    unsigned int capacity = MaxLightIndices();
+    for (auto& cluster : mClusters)
+    {
+        unsigned int numFitted = std::min(cluster.count, capacity - offset);
+        mStats.droppedIndices += cluster.count - numFitted;
+        mStats.litClusters += (numFitted > 0);
+        cluster.offset = offset;
+        cluster.count = numFitted;
+        offset += numFitted;
+    }
+    mStats.lightIndices = offset;
+
+    // Then go through the lights again writing their indices
+    auto fill = [&](unsigned int begin, unsigned int end) { FillSlices(begin, end); };
+    if (threadPool != nullptr)  threadPool->ParallelFor(mNumSlices, 1, fill);
+    else                        fill(0, mNumSlices);
+}
+
+
+// Work out the view space sphere and slices of lights [begin, end)
+void LightClusterBuilder::PrepareLights(const ClusterLight* lights, unsigned int begin, unsigned int end, const ClusterCamera& camera)
+{
+    for (unsigned int i = begin; i < end; ++i)
+    {
+        BoundingSphere bounds = ClusterLightBounds(lights[i]);
+        ViewLight& viewLight = mViewLights[i];
+        viewLight.centre = TransformPoint(bounds.centre, camera.viewMatrix);
+        viewLight.radius = bounds.radius;
+
+        // Lights entirely behind the near clip or beyond the far clip are not in any slice
+        float nearZ = viewLight.centre.z - bounds.radius;
+        float farZ  = viewLight.centre.z + bounds.radius;
+        if (farZ < camera.nearClip || nearZ > camera.farClip || bounds.radius <= 0)
+        {
+            viewLight.firstSlice = 0;
+            viewLight.lastSlice = -1;
+            continue;
+        }
+
+        // The slice boundaries used in CountSlices may be a rounding error away from the ones given by the log, so an
+        // extra slice is included at each end. CountSlices skips slices the light doesn't actually reach
+        int lastSlice = static_cast<int>(mNumSlices) - 1;
+        viewLight.firstSlice = std::max(Slice(std::max(nearZ, camera.nearClip)) - 1, 0);
+        viewLight.lastSlice  = std::min(Slice(std::min(farZ, camera.farClip)) + 1, lastSlice);
+    }
+}
+
+
+// Find the tiles covered by each light in slices [begin, end) and count the lights in each cluster
+void LightClusterBuilder::CountSlices(unsigned int begin, unsigned int end, const ClusterCamera& camera)
+{
+    float tilesX = static_cast<float>(mTilesX);
+    float tilesY = static_cast<float>(mTilesY);
+    int maxTileX = static_cast<int>(mTilesX) - 1;
+    int maxTileY = static_cast<int>(mTilesY) - 1;
+
+    for (unsigned int slice = begin; slice < end; ++slice)
+    {
+        ClusterRange* clusters = &mClusters[slice * mTilesX * mTilesY];
+        for (unsigned int entry = mSliceStarts[slice]; entry < mSliceStarts[slice + 1]; ++entry)
+        {
+            const ViewLight& viewLight = mViewLights[mSliceLights[entry]];
+            TileRect& rect = mSliceRects[entry];
+            rect = { 1, 0, 1, 0 };
+
+            // The part of the light's sphere inside the slice
+            const CVector3& centre = viewLight.centre;
+            float z0 = std::max(mSliceDepths[slice],     centre.z - viewLight.radius);
+            float z1 = std::min(mSliceDepths[slice + 1], centre.z + viewLight.radius);
+            if (z0 > z1)  continue;
+
+            // It fits in a box of the slice's depth whose width is the largest cross section of the sphere in the slice
+            float toSlice = (centre.z < z0) ? z0 - centre.z : (centre.z > z1) ? centre.z - z1 : 0.0f;
+            float crossSection = viewLight.radius * viewLight.radius - toSlice * toSlice;
+            if (crossSection < 0)  continue;
+            crossSection = std::sqrt(crossSection);
+
+            // Project the box onto the screen. x / z is largest or smallest at the nearest or furthest depth of the box
+            float left   = centre.x - crossSection;
+            float right  = centre.x + crossSection;
+            float bottom = centre.y - crossSection;
+            float top    = centre.y + crossSection;
+            float minX = std::min(left   / z0, left   / z1) / camera.tanHalfFOVx;
+            float maxX = std::max(right  / z0, right  / z1) / camera.tanHalfFOVx;
+            float minY = std::min(bottom / z0, bottom / z1) / camera.tanHalfFOVy;
+            float maxY = std::max(top    / z0, top    / z1) / camera.tanHalfFOVy;
+            if (maxX < -1 || minX > 1 || maxY < -1 || minY > 1)  continue;
+
+            // Tiles covered, y is flipped as tile rows go down the screen
+            int tileX0 = std::max(static_cast<int>((minX + 1) * 0.5f * tilesX), 0);
+            int tileX1 = std::min(static_cast<int>((maxX + 1) * 0.5f * tilesX), maxTileX);
+            int tileY0 = std::max(static_cast<int>((1 - maxY) * 0.5f * tilesY), 0);
+            int tileY1 = std::min(static_cast<int>((1 - minY) * 0.5f * tilesY), maxTileY);
+            rect = { static_cast<uint8_t>(tileX0), static_cast<uint8_t>(tileX1), static_cast<uint8_t>(tileY0), static_cast<uint8_t>(tileY1) };
+
+            for (int y = tileY0; y <= tileY1; ++y)
+            {
+                for (int x = tileX0; x <= tileX1; ++x)  ++clusters[y * mTilesX + x].count;
+            }
+        }
+    }
+}
+
+
+// Write the light indices of each cluster in slices [begin, end), using the tiles found by CountSlices
+void LightClusterBuilder::FillSlices(unsigned int begin, unsigned int end)
+{
+    for (unsigned int slice = begin; slice < end; ++slice)
+    {
+        unsigned int sliceStart = slice * mTilesX * mTilesY;
+        const ClusterRange* clusters = &mClusters[sliceStart];
+        unsigned int* clusterFill = &mClusterFill[sliceStart];
+        std::fill(clusterFill, clusterFill + mTilesX * mTilesY, 0);
+
+        for (unsigned int entry = mSliceStarts[slice]; entry < mSliceStarts[slice + 1]; ++entry)
+        {
+            const TileRect& rect = mSliceRects[entry];
+            for (unsigned int y = rect.y0; y <= rect.y1; ++y)
+            {
+                for (unsigned int x = rect.x0; x <= rect.x1; ++x)
+                {
+                    // Clusters that didn't fit in the index list have had their count cut down
+                    unsigned int cluster = y * mTilesX + x;
+                    if (clusterFill[cluster] < clusters[cluster].count)
+                    {
+                        mLightIndices[clusters[cluster].offset + clusterFill[cluster]++] = mSliceLights[entry];
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Benchmark
+//--------------------------------------------------------------------------------------
+
+// Measure cluster building for the given number of lights scattered around a camera, on one thread and on the thread
+// pool (if given), and check the results match. Returns a report for the debug output
+std::string BenchmarkLightClusters(unsigned int numLights, ThreadPool* threadPool, unsigned int iterations /*= 100*/)
+{
+    // Lights scattered through a box in front of the camera, a quarter of them spotlights pointing in random directions
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> across(-300.0f, 300.0f);
+    std::uniform_real_distribution<float> depth(-50.0f, 600.0f);
+    std::uniform_real_distribution<float> range(5.0f, 40.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<ClusterLight> lights(numLights);
+    for (unsigned int i = 0; i < numLights; ++i)
+    {
+        ClusterLight& light = lights[i];
+        light.position = { across(random), across(random) * 0.25f, depth(random) };
+        light.range = range(random);
+        light.colour = { 1, 1, 1 };
+        light.cosHalfAngle = (i % 4 == 0) ? 0.8f : -2.0f;
+        light.direction = Normalise(CVector3{ unit(random), unit(random), unit(random) } + CVector3{ 0, 0, 0.01f });
+        light.shadow = -1;
+    }
+
+    // Camera at the origin looking down z, matching the default Camera
+    ClusterCamera camera;
+    camera.viewMatrix = MatrixIdentity();
+    camera.tanHalfFOVx = std::tan(PI / 6);
+    camera.tanHalfFOVy = camera.tanHalfFOVx * 9 / 16;
+    camera.nearClip = 0.1f;
+    camera.farClip = 10000.0f;
+
+    LightClusterBuilder builder(16, 9, 24, 1.0f, 1000.0f, numLights, 4 * 1024 * 1024);
+
+    std::string report;
+    char line[256];
+    std::snprintf(line, sizeof(line), "Light cluster benchmark: %u lights, %u clusters\n", numLights, builder.NumClusters());
+    report += line;
+    report += "  Threads  ms/build  Lit clusters  Indices  Mismatches\n";
+
+    std::vector<ClusterRange> referenceClusters;
+    std::vector<unsigned int> referenceIndices;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        ThreadPool* pool = (pass == 0) ? nullptr : threadPool;
+        if (pass == 1 && pool == nullptr)  break;
+
+        builder.Build(lights.data(), numLights, camera, pool); // Warm up caches
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)  builder.Build(lights.data(), numLights, camera, pool);
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+        // Every build must give exactly the same lists as the single threaded one
+        const LightClusterStats& stats = builder.Stats();
+        unsigned int mismatches = 0;
+        if (pass == 0)
+        {
+            referenceClusters.assign(builder.Clusters(), builder.Clusters() + builder.NumClusters());
+            referenceIndices.assign(builder.LightIndices(), builder.LightIndices() + stats.lightIndices);
+        }
+        for (unsigned int i = 0; i < builder.NumClusters(); ++i)
+        {
+            mismatches += (builder.Clusters()[i].offset != referenceClusters[i].offset || builder.Clusters()[i].count != referenceClusters[i].count);
+        }
+        for (unsigned int i = 0; i < stats.lightIndices && i < referenceIndices.size(); ++i)
+        {
+            mismatches += (builder.LightIndices()[i] != referenceIndices[i]);
+        }
+
+        unsigned int numThreads = (pool != nullptr) ? pool->NumThreads() + 1 : 1;
+        std::snprintf(line, sizeof(line), "  %7u  %8.3f  %12u  %7u  %10u\n", numThreads, time.count() * 1000 / iterations,
+                      stats.litClusters, stats.lightIndices, mismatches);
+        report += line;
+    }
+
+    return report;
+}
@@ -0,0 +1,172 @@
+//--------------------------------------------------------------------------------------
+// Clustered lighting - bins point and spot lights into a grid over the camera's view
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// The camera's view is cut into tiles across the screen and slices by distance, giving a grid
+// of small frustum-shaped cells (clusters, or "froxels"). Each frame the builder finds which
+// lights can reach each cluster and writes a compact list of light indices for it. A pixel
+// shader works out the cluster it is in from its screen position and depth, then only lights
+// the pixel with the lights in that cluster's list - so any number of lights can be used, with
+// each pixel paying only for the lights near it.
+// Slices are spaced exponentially between sliceNear and sliceFar so clusters are roughly cube
+// shaped at every distance. Nearer than sliceNear is in the first slice, further than sliceFar
+// in the last.
+// Building is split by slice across the thread pool. The grid can be at most 256 tiles across and
+// down. The lists have a fixed maximum size, set at construction, which matches the size of the
+// GPU buffers they are copied to. There is no Direct3D code here, the scene uploads the results
+// (see ClusteredLighting.hlsli).
+
+#ifndef _LIGHT_CLUSTERS_H_INCLUDED_
+#define _LIGHT_CLUSTERS_H_INCLUDED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+
+class ThreadPool;
+
+
+// A point light or spotlight. This is also the layout of the light buffer used by the shaders, it must match
+// ClusterLight in ClusteredLighting.hlsli
+struct ClusterLight
+{
+    CVector3 position;
+    float    range;        // The light has no effect beyond this distance
+    CVector3 colour;       // Colour multiplied by strength
+    float    cosHalfAngle; // Spotlights only: cosine of half the cone angle. Less than -1 for point lights
+    CVector3 direction;    // Spotlights only: direction of the cone
+    int      shadow;       // Index of the light's shadows in the shadow constants (see Common.h), -1 for none
+};
+
+// Sphere enclosing the part of the world a light can reach. For a spotlight this is the smallest sphere around its cone
+BoundingSphere ClusterLightBounds(const ClusterLight& light);
+
+
+// The camera that the clusters are built for
+struct ClusterCamera
+{
+    CMatrix4x4 viewMatrix;
+    float      tanHalfFOVx; // Tangents of half the camera's field of view
+    float      tanHalfFOVy;
+    float      nearClip;
+    float      farClip;
+};
+
+// Where a cluster's lights are in the light index list. This is also the layout of the cluster buffer in the shaders
+struct ClusterRange
+{
+    unsigned int offset;
+    unsigned int count;
+};
+
+// Results of the last Build
+struct LightClusterStats
+{
+    unsigned int lights         = 0; // Lights binned (after any dropped for lack of space)
+    unsigned int lightIndices   = 0; // Entries in the light index list
+    unsigned int litClusters    = 0; // Clusters with at least one light
+    unsigned int droppedLights  = 0; // Lights beyond maxLights, not binned
+    unsigned int droppedIndices = 0; // Light index entries that didn't fit in maxLightIndices
+};
+
+
+class LightClusterBuilder
+{
+public:
+    // A grid of tilesX x tilesY tiles across the screen and numSlices slices from sliceNear to sliceFar. At most
+    // maxLights lights are binned, with up to maxLightIndices index entries in total
+    LightClusterBuilder(unsigned int tilesX = 16, unsigned int tilesY = 9, unsigned int numSlices = 24,
+                        float sliceNear = 1.0f, float sliceFar = 1000.0f,
+                        unsigned int maxLights = 4096, unsigned int maxLightIndices = 256 * 1024);
+
+    // Bin the given lights into the clusters of the camera's view. Uses the thread pool if one is given. Doesn't use
+    // the heap after construction
+    void Build(const ClusterLight* lights, unsigned int numLights, const ClusterCamera& camera, ThreadPool* threadPool = nullptr);
+
+
+    // Grid size
+    unsigned int TilesX()      const  { return mTilesX; }
+    unsigned int TilesY()      const  { return mTilesY; }
+    unsigned int NumSlices()   const  { return mNumSlices; }
+    unsigned int NumClusters() const  { return mTilesX * mTilesY * mNumSlices; }
+    unsigned int MaxLights()   const  { return mMaxLights; }
+    unsigned int MaxLightIndices() const  { return static_cast<unsigned int>(mLightIndices.size()); }
+
+    // Index of the cluster at a tile (0,0 is top-left of the screen) and slice (0 is nearest)
+    unsigned int ClusterIndex(unsigned int x, unsigned int y, unsigned int slice) const  { return (slice * mTilesY + y) * mTilesX + x; }
+
+    // The slice for a view space depth z is floor(log(z) * DepthScale() + DepthBias()), clamped to the grid
+    float DepthScale() const  { return mDepthScale; }
+    float DepthBias()  const  { return mDepthBias; }
+
+    // Results of the last Build: the range of the light index list for each cluster, and the list itself. The
+    // indices are into the lights given to Build
+    const ClusterRange* Clusters()     const  { return mClusters.data(); }
+    const unsigned int* LightIndices() const  { return mLightIndices.data(); }
+
+    const LightClusterStats& Stats() const  { return mStats; }
+
+
+private:
+    // A light's sphere in view space and the slices it reaches (lastSlice < firstSlice if none)
+    struct ViewLight
+    {
+        CVector3 centre;
+        float    radius;
+        int      firstSlice;
+        int      lastSlice;
+    };
+
+    // Slice containing a view space depth, not clamped to the grid
+    int Slice(float z) const  { return static_cast<int>(std::floor(std::log(z) * mDepthScale + mDepthBias)); }
+
+    // Work out the view space sphere and slices of lights [begin, end)
+    void PrepareLights(const ClusterLight* lights, unsigned int begin, unsigned int end, const ClusterCamera& camera);
+
+    // Tiles covered by a light in one slice, x0 > x1 if none
+    struct TileRect
+    {
+        uint8_t x0, x1, y0, y1;
+    };
+
+    // Find the tiles covered by each light in slices [begin, end) and count the lights in each cluster
+    void CountSlices(unsigned int begin, unsigned int end, const ClusterCamera& camera);
+
+    // Write the light indices of each cluster in slices [begin, end), using the tiles found by CountSlices
+    void FillSlices(unsigned int begin, unsigned int end);
+
+
+    unsigned int mTilesX;
+    unsigned int mTilesY;
+    unsigned int mNumSlices;
+    unsigned int mMaxLights;
+    float        mSliceNear;
+    float        mSliceFar;
+    float        mDepthScale;
+    float        mDepthBias;
+
+    unsigned int              mNumLights = 0;
+    std::vector<ViewLight>    mViewLights;
+    std::vector<float>        mSliceDepths;  // Depth where each slice starts, then where the last one ends
+    std::vector<unsigned int> mSliceStarts;  // Where each slice's lights start in mSliceLights, then the total
+    std::vector<unsigned int> mSliceLights;  // Lights reaching each slice, slice by slice
+    std::vector<TileRect>     mSliceRects;   // Tiles covered by each entry of mSliceLights
+    std::vector<ClusterRange> mClusters;
+    std::vector<unsigned int> mClusterFill;  // Indices written to each cluster so far while filling
+    std::vector<unsigned int> mLightIndices;
+
+    LightClusterStats mStats;
+};
+
+
+// Measure cluster building for the given number of lights scattered around a camera, on one thread and on the thread
+// pool (if given), and check the results match. Returns a report for the debug output
+std::string BenchmarkLightClusters(unsigned int numLights, ThreadPool* threadPool, unsigned int iterations = 100);
+
+
+#endif //_LIGHT_CLUSTERS_H_INCLUDED_
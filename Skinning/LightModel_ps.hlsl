@@ -1,7 +1,7 @@
 //--------------------------------------------------------------------------------------
 // Light Model Pixel Shader
 //--------------------------------------------------------------------------------------
-// Pixel shader simply samples a diffuse texture map and tints with a fixed colour sent over from the CPU via a constant buffer
+// Pixel shader simply samples a diffuse texture map and tints with the model's colour, passed on by the vertex shader
 
 #include "Common.hlsli" // Shaders can also use include files - note the extension
 
@@ -30,8 +30,8 @@ float4 main(SimplePixelShaderInput input) : SV_Target
     // Ignoring any alpha in the texture, just reading RGB
     float3 diffuseMapColour = DiffuseMap.Sample(TexSampler, input.uv).rgb;
 
-    // Blend texture colour with fixed per-object colour
-    float3 finalColour = gObjectColour * diffuseMapColour;
+    // Blend texture colour with the per-object colour (from the per-model constants, or the instance data when instanced)
+    float3 finalColour = input.colour * diffuseMapColour;
 
     return float4(finalColour, 1.0f); // Always use 1.0f for alpha - no alpha blending in this lab
 }
\ No newline at end of file
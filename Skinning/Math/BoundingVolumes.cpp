@@ -0,0 +1,89 @@
+//--------------------------------------------------------------------------------------
+// Bounding volumes - axis-aligned boxes and spheres enclosing geometry, and view frustums
+//--------------------------------------------------------------------------------------
+
+#include "BoundingVolumes.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Grow the box to include a point or another box
+void AABB::Add(const CVector3& point)
+{
+    minimum.x = std::min(minimum.x, point.x);  maximum.x = std::max(maximum.x, point.x);
+    minimum.y = std::min(minimum.y, point.y);  maximum.y = std::max(maximum.y, point.y);
+    minimum.z = std::min(minimum.z, point.z);  maximum.z = std::max(maximum.z, point.z);
+}
+
+void AABB::Add(const AABB& box)
+{
+    if (box.IsEmpty())  return;
+    Add(box.minimum);
+    Add(box.maximum);
+}
+
+
+// Transform a point by a matrix (row vector, so p * m), including the translation
+CVector3 TransformPoint(const CVector3& p, const CMatrix4x4& m)
+{
+    return { p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30,
+             p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31,
+             p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32 };
+}
+
+
+// Box enclosing the given box after transforming it by a matrix. Exact for rotations and scaling, the result is not
+// any larger than needed to hold the transformed box
+// Transforms the centre as a point, then each axis of the new box extends by the absolute values of the matrix
+// rows weighted by the old extents (the furthest any corner can reach along that axis)
+AABB TransformAABB(const AABB& box, const CMatrix4x4& m)
+{
+    if (box.IsEmpty())  return box;
+
+    CVector3 centre  = TransformPoint(box.Centre(), m);
+    CVector3 extents = box.Extents();
+    CVector3 newExtents = { extents.x * std::abs(m.e00) + extents.y * std::abs(m.e10) + extents.z * std::abs(m.e20),
+                            extents.x * std::abs(m.e01) + extents.y * std::abs(m.e11) + extents.z * std::abs(m.e21),
+                            extents.x * std::abs(m.e02) + extents.y * std::abs(m.e12) + extents.z * std::abs(m.e22) };
+    AABB result;
+    result.minimum = centre - newExtents;
+    result.maximum = centre + newExtents;
+    return result;
+}
+
+
+// Sphere enclosing the given sphere after transforming it by a matrix. Non-uniform scaling uses the largest scale
+BoundingSphere TransformSphere(const BoundingSphere& sphere, const CMatrix4x4& m)
+{
+    if (sphere.IsEmpty())  return sphere;
+
+    float scale = std::max({ Length(m.GetRow(0)), Length(m.GetRow(1)), Length(m.GetRow(2)) });
+    BoundingSphere result;
+    result.centre = TransformPoint(sphere.centre, m);
+    result.radius = sphere.radius * scale;
+    return result;
+}
+
+
+// Get the frustum for a view-projection matrix (DirectX clip space: x, y in -1 to 1, z in 0 to 1)
+// With row vectors each clip space coordinate is a dot product with a column of the matrix. A point is inside when
+// -w <= x <= w, -w <= y <= w and 0 <= z <= w, which gives a plane from each inequality
+Frustum FrustumFromMatrix(const CMatrix4x4& m)
+{
+    const float column[4][4] = { { m.e00, m.e10, m.e20, m.e30 },
+                                 { m.e01, m.e11, m.e21, m.e31 },
+                                 { m.e02, m.e12, m.e22, m.e32 },
+                                 { m.e03, m.e13, m.e23, m.e33 } };
+    Frustum frustum;
+    for (int i = 0; i < 4; ++i)
+    {
+        frustum.planes[0][i] = column[3][i] + column[0][i]; // Left
+        frustum.planes[1][i] = column[3][i] - column[0][i]; // Right
+        frustum.planes[2][i] = column[3][i] + column[1][i]; // Bottom
+        frustum.planes[3][i] = column[3][i] - column[1][i]; // Top
+        frustum.planes[4][i] = column[2][i];                // Near
+        frustum.planes[5][i] = column[3][i] - column[2][i]; // Far
+    }
+    return frustum;
+}
@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// Bounding volumes - axis-aligned boxes and spheres enclosing geometry, and view frustums
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Used to cull models that are outside the view (see Culling.h). Boxes are stored as minimum and
+// maximum corners. A default-constructed box or sphere is empty: adding any point to it makes it
+// valid, and an empty volume transforms to an empty volume.
+
+#ifndef _BOUNDING_VOLUMES_H_DEFINED_
+#define _BOUNDING_VOLUMES_H_DEFINED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <cfloat>
+
+
+// Axis-aligned bounding box
+struct AABB
+{
+    CVector3 minimum = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+    CVector3 maximum = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    bool IsEmpty() const  { return minimum.x > maximum.x; }
+
+    // Grow the box to include a point or another box
+    void Add(const CVector3& point);
+    void Add(const AABB& box);
+
+    // Centre of the box and half its size on each axis. Only valid for non-empty boxes
+    CVector3 Centre()  const  { return (minimum + maximum) * 0.5f; }
+    CVector3 Extents() const  { return (maximum - minimum) * 0.5f; }
+};
+
+
+// Bounding sphere, radius is negative if empty
+struct BoundingSphere
+{
+    CVector3 centre = { 0, 0, 0 };
+    float    radius = -1;
+
+    bool IsEmpty() const  { return radius < 0; }
+};
+
+
+// Transform a point by a matrix (row vector, so p * m), including the translation
+CVector3 TransformPoint(const CVector3& p, const CMatrix4x4& m);
+
+// Box enclosing the given box after transforming it by a matrix. Exact for rotations and scaling, the result is not
+// any larger than needed to hold the transformed box
+AABB TransformAABB(const AABB& box, const CMatrix4x4& m);
+
+// Sphere enclosing the given sphere after transforming it by a matrix. Non-uniform scaling uses the largest scale
+BoundingSphere TransformSphere(const BoundingSphere& sphere, const CMatrix4x4& m);
+
+
+// Frustum planes as (a, b, c, d): a point is on the inside of a plane if a*x + b*y + c*z + d >= 0. Planes are not
+// normalised, the box test in Culling.h doesn't need them to be
+struct Frustum
+{
+    float planes[6][4];
+};
+
+// Get the frustum for a view-projection matrix (DirectX clip space: x, y in -1 to 1, z in 0 to 1)
+Frustum FrustumFromMatrix(const CMatrix4x4& viewProjection);
+
+
+#endif // _BOUNDING_VOLUMES_H_DEFINED_
@@ -3,8 +3,190 @@
 //--------------------------------------------------------------------------------------
 
 #include "CMatrix4x4.h"
+#include "SimdSupport.h"
 
 #include <algorithm>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cfloat>
+#include <cstdio>
+
+
+/*-----------------------------------------------------------------------------------------
+    Multiply / inverse kernels
+-----------------------------------------------------------------------------------------*/
+// Each kernel reads all of its inputs before writing any output, so output may alias an input.
+// Matrices are stored by rows and the engine uses row vectors (v * M), so each row of a product
+// is a weighted sum of the rows of the second matrix: out.row[i] = sum_k m1[i][k] * m2.row[k]
+
+// Plain C++ matrix multiply - reference version used when no SIMD is available
+static void MultiplyScalar(const CMatrix4x4& m1, const CMatrix4x4& m2, CMatrix4x4& out)
+{
+    CMatrix4x4 mOut;
+
+    mOut.e00 = m1.e00*m2.e00 + m1.e01*m2.e10 + m1.e02*m2.e20 + m1.e03*m2.e30;
+    mOut.e01 = m1.e00*m2.e01 + m1.e01*m2.e11 + m1.e02*m2.e21 + m1.e03*m2.e31;
+    mOut.e02 = m1.e00*m2.e02 + m1.e01*m2.e12 + m1.e02*m2.e22 + m1.e03*m2.e32;
+    mOut.e03 = m1.e00*m2.e03 + m1.e01*m2.e13 + m1.e02*m2.e23 + m1.e03*m2.e33;
+
+    mOut.e10 = m1.e10*m2.e00 + m1.e11*m2.e10 + m1.e12*m2.e20 + m1.e13*m2.e30;
+    mOut.e11 = m1.e10*m2.e01 + m1.e11*m2.e11 + m1.e12*m2.e21 + m1.e13*m2.e31;
+    mOut.e12 = m1.e10*m2.e02 + m1.e11*m2.e12 + m1.e12*m2.e22 + m1.e13*m2.e32;
+    mOut.e13 = m1.e10*m2.e03 + m1.e11*m2.e13 + m1.e12*m2.e23 + m1.e13*m2.e33;
+
+    mOut.e20 = m1.e20*m2.e00 + m1.e21*m2.e10 + m1.e22*m2.e20 + m1.e23*m2.e30;
+    mOut.e21 = m1.e20*m2.e01 + m1.e21*m2.e11 + m1.e22*m2.e21 + m1.e23*m2.e31;
+    mOut.e22 = m1.e20*m2.e02 + m1.e21*m2.e12 + m1.e22*m2.e22 + m1.e23*m2.e32;
+    mOut.e23 = m1.e20*m2.e03 + m1.e21*m2.e13 + m1.e22*m2.e23 + m1.e23*m2.e33;
+
+    mOut.e30 = m1.e30*m2.e00 + m1.e31*m2.e10 + m1.e32*m2.e20 + m1.e33*m2.e30;
+    mOut.e31 = m1.e30*m2.e01 + m1.e31*m2.e11 + m1.e32*m2.e21 + m1.e33*m2.e31;
+    mOut.e32 = m1.e30*m2.e02 + m1.e31*m2.e12 + m1.e32*m2.e22 + m1.e33*m2.e32;
+    mOut.e33 = m1.e30*m2.e03 + m1.e31*m2.e13 + m1.e32*m2.e23 + m1.e33*m2.e33;
+
+    out = mOut;
+}
+
+
+#if MATH_SIMD_SSE
+
+// SSE matrix multiply - one row of the result per register. Additions are done in the same order as the
+// scalar version so the results are identical
+static inline void MultiplySSE(const CMatrix4x4& m1, const CMatrix4x4& m2, CMatrix4x4& out)
+{
+    const float* a = &m1.e00;
+    const float* b = &m2.e00;
+
+    __m128 b0 = _mm_loadu_ps(b);
+    __m128 b1 = _mm_loadu_ps(b + 4);
+    __m128 b2 = _mm_loadu_ps(b + 8);
+    __m128 b3 = _mm_loadu_ps(b + 12);
+
+    __m128 a0 = _mm_loadu_ps(a);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+
+    #define MATRIX_ROW_SSE(r) _mm_add_ps(_mm_add_ps(_mm_add_ps(                    \
+                                _mm_mul_ps(_mm_shuffle_ps(r, r, 0x00), b0),        \
+                                _mm_mul_ps(_mm_shuffle_ps(r, r, 0x55), b1)),       \
+                                _mm_mul_ps(_mm_shuffle_ps(r, r, 0xaa), b2)),       \
+                                _mm_mul_ps(_mm_shuffle_ps(r, r, 0xff), b3))
+    __m128 r0 = MATRIX_ROW_SSE(a0);
+    __m128 r1 = MATRIX_ROW_SSE(a1);
+    __m128 r2 = MATRIX_ROW_SSE(a2);
+    __m128 r3 = MATRIX_ROW_SSE(a3);
+    #undef MATRIX_ROW_SSE
+
+    float* o = &out.e00;
+    _mm_storeu_ps(o,      r0);
+    _mm_storeu_ps(o + 4,  r1);
+    _mm_storeu_ps(o + 8,  r2);
+    _mm_storeu_ps(o + 12, r3);
+}
+
+
+// Cross product of the xyz parts of two registers (w of result is 0 if w of inputs are 0)
+static inline __m128 CrossSSE(__m128 u, __m128 v)
+{
+    __m128 uYZX = _mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 vYZX = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(u, vYZX), _mm_mul_ps(uYZX, v));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Sum of the xyz elements of a register, broadcast to all four elements
+static inline __m128 HorizontalAdd3SSE(__m128 v)
+{
+    __m128 x = _mm_shuffle_ps(v, v, 0x00);
+    __m128 y = _mm_shuffle_ps(v, v, 0x55);
+    __m128 z = _mm_shuffle_ps(v, v, 0xaa);
+    return _mm_add_ps(_mm_add_ps(x, y), z);
+}
+
+// SSE affine inverse. The columns of the inverse of the upper-left 3x3 are the cross products of pairs
+// of its rows divided by the determinant - same maths as the scalar InverseAffine
+static inline void InverseAffineSSE(const CMatrix4x4& m, CMatrix4x4& out)
+{
+    const float* p = &m.e00;
+    const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    __m128 row0 = _mm_and_ps(_mm_loadu_ps(p),      xyzMask);
+    __m128 row1 = _mm_and_ps(_mm_loadu_ps(p + 4),  xyzMask);
+    __m128 row2 = _mm_and_ps(_mm_loadu_ps(p + 8),  xyzMask);
+    __m128 pos  = _mm_and_ps(_mm_loadu_ps(p + 12), xyzMask);
+
+    __m128 col0 = CrossSSE(row1, row2);
+    __m128 col1 = CrossSSE(row2, row0);
+    __m128 col2 = CrossSSE(row0, row1);
+
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), HorizontalAdd3SSE(_mm_mul_ps(row0, col0)));
+    col0 = _mm_mul_ps(col0, invDet);
+    col1 = _mm_mul_ps(col1, invDet);
+    col2 = _mm_mul_ps(col2, invDet);
+
+    // Columns become rows of the output, 4th element of each is 0
+    __m128 col3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(col0, col1, col2, col3);
+
+    // Translation row is the negated position transformed by the inverted 3x3
+    __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(pos, pos, 0x00), col0),
+                                     _mm_mul_ps(_mm_shuffle_ps(pos, pos, 0x55), col1)),
+                                     _mm_mul_ps(_mm_shuffle_ps(pos, pos, 0xaa), col2));
+    t = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), t);
+
+    float* o = &out.e00;
+    _mm_storeu_ps(o,      col0);
+    _mm_storeu_ps(o + 4,  col1);
+    _mm_storeu_ps(o + 8,  col2);
+    _mm_storeu_ps(o + 12, t);
+}
+
+
+// AVX2 matrix multiply - two rows of the result per register. Rows of the second matrix are duplicated
+// into both halves of a register and fused multiply-adds accumulate the sum
+SIMD_TARGET_AVX2 static inline void MultiplyAVX2(const CMatrix4x4& m1, const CMatrix4x4& m2, CMatrix4x4& out)
+{
+    const float* a = &m1.e00;
+    const float* b = &m2.e00;
+
+    __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b));
+    __m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 4));
+    __m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 8));
+    __m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 12));
+
+    __m256 a01 = _mm256_loadu_ps(a);
+    __m256 a23 = _mm256_loadu_ps(a + 8);
+
+    __m256 r01 = _mm256_mul_ps(_mm256_permute_ps(a01, 0x00), b0);
+    r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0x55), b1, r01);
+    r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0xaa), b2, r01);
+    r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0xff), b3, r01);
+
+    __m256 r23 = _mm256_mul_ps(_mm256_permute_ps(a23, 0x00), b0);
+    r23 = _mm256_fmadd_ps(_mm256_permute_ps(a23, 0x55), b1, r23);
+    r23 = _mm256_fmadd_ps(_mm256_permute_ps(a23, 0xaa), b2, r23);
+    r23 = _mm256_fmadd_ps(_mm256_permute_ps(a23, 0xff), b3, r23);
+
+    float* o = &out.e00;
+    _mm256_storeu_ps(o,     r01);
+    _mm256_storeu_ps(o + 8, r23);
+}
+
+#endif // MATH_SIMD_SSE
+
+
+// Kernel selected for the batch functions. Starts with the best the CPU supports
+static MatrixKernel BestMatrixKernel()
+{
+#if MATH_SIMD_SSE
+    return CpuHasAVX2() ? MatrixKernel::AVX2 : MatrixKernel::SSE;
+#else
+    return MatrixKernel::Scalar;
+#endif
+}
+static MatrixKernel gMatrixKernel = BestMatrixKernel();
+
 
 /*-----------------------------------------------------------------------------------------
     Member functions
@@ -32,47 +214,12 @@ CVector3 CMatrix4x4::GetRow(int iRow) const
 // Post-multiply this matrix by the given one
 CMatrix4x4& CMatrix4x4::operator*=(const CMatrix4x4& m)
 {
-    if (this == &m)
-    {
-        // Special case of multiplying by self - no copy optimisations so use binary version
-        *this = m * m;
-    }
-    else
-    {
-        float t0, t1, t2;
-
-        t0 = e00 * m.e00 + e01 * m.e10 + e02 * m.e20 + e03 * m.e30;
-        t1 = e00 * m.e01 + e01 * m.e11 + e02 * m.e21 + e03 * m.e31;
-        t2 = e00 * m.e02 + e01 * m.e12 + e02 * m.e22 + e03 * m.e32;
-        e03 = e00 * m.e03 + e01 * m.e13 + e02 * m.e23 + e03 * m.e33;
-        e00 = t0;
-        e01 = t1;
-        e02 = t2;
-
-        t0 = e10 * m.e00 + e11 * m.e10 + e12 * m.e20 + e13 * m.e30;
-        t1 = e10 * m.e01 + e11 * m.e11 + e12 * m.e21 + e13 * m.e31;
-        t2 = e10 * m.e02 + e11 * m.e12 + e12 * m.e22 + e13 * m.e32;
-        e13 = e10 * m.e03 + e11 * m.e13 + e12 * m.e23 + e13 * m.e33;
-        e10 = t0;
-        e11 = t1;
-        e12 = t2;
-
-        t0 = e20 * m.e00 + e21 * m.e10 + e22 * m.e20 + e23 * m.e30;
-        t1 = e20 * m.e01 + e21 * m.e11 + e22 * m.e21 + e23 * m.e31;
-        t2 = e20 * m.e02 + e21 * m.e12 + e22 * m.e22 + e23 * m.e32;
-        e23 = e20 * m.e03 + e21 * m.e13 + e22 * m.e23 + e23 * m.e33;
-        e20 = t0;
-        e21 = t1;
-        e22 = t2;
-
-        t0 = e30 * m.e00 + e31 * m.e10 + e32 * m.e20 + e33 * m.e30;
-        t1 = e30 * m.e01 + e31 * m.e11 + e32 * m.e21 + e33 * m.e31;
-        t2 = e30 * m.e02 + e31 * m.e12 + e32 * m.e22 + e33 * m.e32;
-        e33 = e30 * m.e03 + e31 * m.e13 + e32 * m.e23 + e33 * m.e33;
-        e30 = t0;
-        e31 = t1;
-        e32 = t2;
-    }
+    // The kernels read both inputs fully before writing, so multiplying by self needs no special case
+#if MATH_SIMD_SSE
+    MultiplySSE(*this, m, *this);
+#else
+    MultiplyScalar(*this, m, *this);
+#endif
     return *this;
 }
 
@@ -85,27 +232,11 @@ CMatrix4x4& CMatrix4x4::operator*=(const CMatrix4x4& m)
 CMatrix4x4 operator*(const CMatrix4x4& m1, const CMatrix4x4& m2)
 {
     CMatrix4x4 mOut;
-
-    mOut.e00 = m1.e00*m2.e00 + m1.e01*m2.e10 + m1.e02*m2.e20 + m1.e03*m2.e30;
-    mOut.e01 = m1.e00*m2.e01 + m1.e01*m2.e11 + m1.e02*m2.e21 + m1.e03*m2.e31;
-    mOut.e02 = m1.e00*m2.e02 + m1.e01*m2.e12 + m1.e02*m2.e22 + m1.e03*m2.e32;
-    mOut.e03 = m1.e00*m2.e03 + m1.e01*m2.e13 + m1.e02*m2.e23 + m1.e03*m2.e33;
-
-    mOut.e10 = m1.e10*m2.e00 + m1.e11*m2.e10 + m1.e12*m2.e20 + m1.e13*m2.e30;
-    mOut.e11 = m1.e10*m2.e01 + m1.e11*m2.e11 + m1.e12*m2.e21 + m1.e13*m2.e31;
-    mOut.e12 = m1.e10*m2.e02 + m1.e11*m2.e12 + m1.e12*m2.e22 + m1.e13*m2.e32;
-    mOut.e13 = m1.e10*m2.e03 + m1.e11*m2.e13 + m1.e12*m2.e23 + m1.e13*m2.e33;
-
-    mOut.e20 = m1.e20*m2.e00 + m1.e21*m2.e10 + m1.e22*m2.e20 + m1.e23*m2.e30;
-    mOut.e21 = m1.e20*m2.e01 + m1.e21*m2.e11 + m1.e22*m2.e21 + m1.e23*m2.e31;
-    mOut.e22 = m1.e20*m2.e02 + m1.e21*m2.e12 + m1.e22*m2.e22 + m1.e23*m2.e32;
-    mOut.e23 = m1.e20*m2.e03 + m1.e21*m2.e13 + m1.e22*m2.e23 + m1.e23*m2.e33;
-
-    mOut.e30 = m1.e30*m2.e00 + m1.e31*m2.e10 + m1.e32*m2.e20 + m1.e33*m2.e30;
-    mOut.e31 = m1.e30*m2.e01 + m1.e31*m2.e11 + m1.e32*m2.e21 + m1.e33*m2.e31;
-    mOut.e32 = m1.e30*m2.e02 + m1.e31*m2.e12 + m1.e32*m2.e22 + m1.e33*m2.e32;
-    mOut.e33 = m1.e30*m2.e03 + m1.e31*m2.e13 + m1.e32*m2.e23 + m1.e33*m2.e33;
-
+#if MATH_SIMD_SSE
+    MultiplySSE(m1, m2, mOut);
+#else
+    MultiplyScalar(m1, m2, mOut);
+#endif
     return mOut;
 }
 
@@ -308,3 +439,251 @@ void CMatrix4x4::Transpose()
     std::swap(e13, e31);
     std::swap(e23, e32);
 }
+
+
+
+/*-----------------------------------------------------------------------------------------
+  Batch functions
+-----------------------------------------------------------------------------------------*/
+
+// Get the kernel currently used by the batch functions
+MatrixKernel GetMatrixKernel()
+{
+    return gMatrixKernel;
+}
+
+// Force the batch functions to use a particular kernel (e.g. scalar, to compare results or timings)
+// If the CPU does not support the requested kernel then the best supported one is used instead
+void SetMatrixKernel(MatrixKernel kernel)
+{
+    MatrixKernel best = BestMatrixKernel();
+    gMatrixKernel = (kernel > best) ? best : kernel;
+}
+
+
+#if MATH_SIMD_SSE
+// The AVX2 loops are kept in their own functions so the compiler can inline the AVX2 kernel into them
+SIMD_TARGET_AVX2 static void MatrixMultiplyBatchAVX2(const CMatrix4x4* m1, const CMatrix4x4* m2, CMatrix4x4* out, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)  MultiplyAVX2(m1[i], m2[i], out[i]);
+}
+
+SIMD_TARGET_AVX2 static void MatrixMultiplyHierarchyAVX2(const CMatrix4x4* local, const unsigned int* parents, CMatrix4x4* absolute, unsigned int count)
+{
+    for (unsigned int i = 1; i < count; ++i)  MultiplyAVX2(local[i], absolute[parents[i]], absolute[i]);
+}
+#endif
+
+
+// Multiply arrays of matrices: out[i] = m1[i] * m2[i]. The output array can be the same as either input
+void MatrixMultiplyBatch(const CMatrix4x4* m1, const CMatrix4x4* m2, CMatrix4x4* out, unsigned int count)
+{
+    switch (gMatrixKernel)
+    {
+#if MATH_SIMD_SSE
+    case MatrixKernel::AVX2:
+        MatrixMultiplyBatchAVX2(m1, m2, out, count);
+        break;
+    case MatrixKernel::SSE:
+        for (unsigned int i = 0; i < count; ++i)  MultiplySSE(m1[i], m2[i], out[i]);
+        break;
+#endif
+    default:
+        for (unsigned int i = 0; i < count; ++i)  MultiplyScalar(m1[i], m2[i], out[i]);
+        break;
+    }
+}
+
+
+// Calculate absolute matrices for a hierarchy of nodes: absolute[i] = local[i] * absolute[parents[i]]
+// Entry 0 is the root and is copied unchanged. Nodes must be in depth-first order (each parent index is less than
+// the index of its child). local and absolute must be different arrays
+void MatrixMultiplyHierarchy(const CMatrix4x4* local, const unsigned int* parents, CMatrix4x4* absolute, unsigned int count)
+{
+    if (count == 0)  return;
+    absolute[0] = local[0];
+
+    switch (gMatrixKernel)
+    {
+#if MATH_SIMD_SSE
+    case MatrixKernel::AVX2:
+        MatrixMultiplyHierarchyAVX2(local, parents, absolute, count);
+        break;
+    case MatrixKernel::SSE:
+        for (unsigned int i = 1; i < count; ++i)  MultiplySSE(local[i], absolute[parents[i]], absolute[i]);
+        break;
+#endif
+    default:
+        for (unsigned int i = 1; i < count; ++i)  MultiplyScalar(local[i], absolute[parents[i]], absolute[i]);
+        break;
+    }
+}
+
+
+// Calculate the inverse of an array of affine matrices: out[i] = InverseAffine(m[i]). The output array can be the same as the input
+// The inverse is dominated by shuffles rather than arithmetic, so there is no gain from a separate AVX2 version
+void InverseAffineBatch(const CMatrix4x4* m, CMatrix4x4* out, unsigned int count)
+{
+#if MATH_SIMD_SSE
+    if (gMatrixKernel != MatrixKernel::Scalar)
+    {
+        for (unsigned int i = 0; i < count; ++i)  InverseAffineSSE(m[i], out[i]);
+        return;
+    }
+#endif
+    for (unsigned int i = 0; i < count; ++i)  out[i] = InverseAffine(m[i]);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+  Benchmark
+-----------------------------------------------------------------------------------------*/
+
+// A difference between two floats in units in the last place of the given magnitude
+static float Ulps(float difference, float magnitude)
+{
+    int exponent;
+    std::frexp(std::max(magnitude, FLT_MIN), &exponent);
+    return std::abs(difference) / std::ldexp(1.0f, exponent - 24); // Floats have 24 significant bits
+}
+
+// Largest difference between products result[i] = m1[i] * m2[i] and the reference results. Each element is the sum
+// of four terms, which may cancel to much less than the terms themselves, so rounding errors are measured against the
+// sum of the terms' sizes, as in the usual error bound for a dot product
+static float MaxProductUlps(const CMatrix4x4* result, const CMatrix4x4* reference, const CMatrix4x4* m1,
+                            const CMatrix4x4* m2, const unsigned int* m2Index, unsigned int count)
+{
+    float maxUlps = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const float* a = &m1[i].e00;
+        const float* b = &m2[m2Index != nullptr ? m2Index[i] : i].e00;
+        for (int element = 0; element < 16; ++element)
+        {
+            int row = element / 4, col = element % 4;
+            float magnitude = 0;
+            for (int k = 0; k < 4; ++k)  magnitude += std::abs(a[row * 4 + k] * b[k * 4 + col]);
+            maxUlps = std::max(maxUlps, Ulps((&result[i].e00)[element] - (&reference[i].e00)[element], magnitude));
+        }
+    }
+    return maxUlps;
+}
+
+// Largest difference between matrices and the reference ones, in ULPs of the largest element in each row
+static float MaxUlps(const CMatrix4x4* result, const CMatrix4x4* reference, unsigned int count)
+{
+    float maxUlps = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const float* r = &result[i].e00;
+        const float* e = &reference[i].e00;
+        for (int row = 0; row < 4; ++row, r += 4, e += 4)
+        {
+            float magnitude = 0;
+            for (int col = 0; col < 4; ++col)  magnitude = std::max(magnitude, std::abs(e[col]));
+            for (int col = 0; col < 4; ++col)  maxUlps = std::max(maxUlps, Ulps(r[col] - e[col], magnitude));
+        }
+    }
+    return maxUlps;
+}
+
+
+// Time the batch functions with each kernel the CPU supports on arrays of random affine matrices, and check the SIMD
+// results against the scalar kernel. Differences are measured in units in the last place (ULPs) of the size of the
+// terms summed for each element, so elements that cancel to near zero don't exaggerate them. Hierarchy nodes are
+// compared with the scalar product of their local matrix and the kernel's own result for their parent. Returns a report
+// for the debug output
+std::string BenchmarkMatrices(unsigned int count /*= 4096*/, unsigned int iterations /*= 100*/)
+{
+    typedef std::chrono::duration<double, std::nano> Nanoseconds;
+    if (count < 2)  count = 2;
+    if (iterations == 0)  iterations = 1;
+
+    // Random affine matrices like those of a scene's nodes: rotation, scaling near 1 and translation
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f), scale(0.8f, 1.25f), position(-100.0f, 100.0f);
+    std::vector<CMatrix4x4> m1(count), m2(count);
+    for (auto* matrices : { &m1, &m2 })
+    {
+        for (auto& m : *matrices)
+        {
+            m = MatrixScaling(CVector3{ scale(random), scale(random), scale(random) }) *
+                MatrixRotationZ(angle(random)) * MatrixRotationX(angle(random)) * MatrixRotationY(angle(random)) *
+                MatrixTranslation(CVector3{ position(random), position(random), position(random) });
+        }
+    }
+
+    // Hierarchies of 64 nodes, like skeletons, each node's parent one of the few nodes before it
+    std::vector<unsigned int> parents(count);
+    for (unsigned int i = 1; i < count; ++i)
+    {
+        unsigned int indexInSkeleton = i % 64;
+        parents[i] = (indexInSkeleton == 0) ? 0 : i - 1 - random() % std::min(indexInSkeleton, 4u);
+    }
+
+    // Scalar results to compare against
+    MatrixKernel originalKernel = GetMatrixKernel();
+    SetMatrixKernel(MatrixKernel::Scalar);
+    std::vector<CMatrix4x4> expectedMultiply(count), expectedHierarchy(count), expectedInverse(count), output(count);
+    MatrixMultiplyBatch(m1.data(), m2.data(), expectedMultiply.data(), count);
+    InverseAffineBatch(m1.data(), expectedInverse.data(), count);
+
+    std::string report;
+    char line[256];
+    std::snprintf(line, sizeof(line), "Matrix batch functions: %u matrices, best of %u runs, ns per matrix\n", count, iterations);
+    report += line;
+    report += "  Kernel  Multiply  Hierarchy  Inverse  Multiply ULPs  Hierarchy ULPs  Inverse ULPs  Check\n";
+
+    const char* names[] = { "Scalar", "SSE", "AVX2" };
+    for (MatrixKernel kernel : { MatrixKernel::Scalar, MatrixKernel::SSE, MatrixKernel::AVX2 })
+    {
+        const char* name = names[static_cast<int>(kernel)];
+        SetMatrixKernel(kernel);
+        if (GetMatrixKernel() != kernel)
+        {
+            std::snprintf(line, sizeof(line), "  %-6s  not supported\n", name);
+            report += line;
+            continue;
+        }
+
+        // Best time of each function, then the difference of its last results from the scalar kernel's
+        double times[3] = {};
+        float ulps[3] = {};
+        for (int function = 0; function < 3; ++function)
+        {
+            for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if      (function == 0)  MatrixMultiplyBatch(m1.data(), m2.data(), output.data(), count);
+                else if (function == 1)  MatrixMultiplyHierarchy(m1.data(), parents.data(), output.data(), count);
+                else                     InverseAffineBatch(m1.data(), output.data(), count);
+                Nanoseconds time = std::chrono::steady_clock::now() - start;
+                times[function] = (iteration == 0) ? time.count() : std::min(times[function], time.count());
+            }
+            // Hierarchy differences build up level by level, as each node uses its parent from the same kernel, so each
+            // node is compared with the scalar product of its local matrix and the kernel's result for its parent
+            if (function == 0)
+            {
+                ulps[0] = MaxProductUlps(output.data(), expectedMultiply.data(), m1.data(), m2.data(), nullptr, count);
+            }
+            else if (function == 1)
+            {
+                for (unsigned int i = 1; i < count; ++i)  expectedHierarchy[i] = m1[i] * output[parents[i]];
+                ulps[1] = MaxProductUlps(output.data() + 1, expectedHierarchy.data() + 1, m1.data() + 1,
+                                         output.data(), parents.data() + 1, count - 1);
+            }
+            else
+            {
+                ulps[2] = MaxUlps(output.data(), expectedInverse.data(), count);
+            }
+        }
+
+        bool passed = (ulps[0] <= MAX_BATCH_ULPS && ulps[1] <= MAX_BATCH_ULPS && ulps[2] <= MAX_BATCH_ULPS);
+        std::snprintf(line, sizeof(line), "  %-6s  %8.2f  %9.2f  %7.2f  %13.2f  %14.2f  %12.2f  %s\n", name,
+                      times[0] / count, times[1] / count, times[2] / count, ulps[0], ulps[1], ulps[2], passed ? "OK" : "FAILED");
+        report += line;
+    }
+
+    SetMatrixKernel(originalKernel);
+    return report;
+}
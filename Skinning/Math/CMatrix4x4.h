@@ -8,6 +8,7 @@
 
 #include "CVector3.h"
 #include <cmath>
+#include <string>
 
 
 // Matrix class
@@ -108,4 +109,56 @@ CMatrix4x4 MatrixScaling(const float s);
 CMatrix4x4 InverseAffine(const CMatrix4x4& m);
 
 
+/*-----------------------------------------------------------------------------------------
+  Batch functions
+-----------------------------------------------------------------------------------------*/
+
+// These functions process whole arrays of matrices in one call. They use the widest SIMD instruction set
+// available on the CPU running the program (AVX2, SSE or plain scalar code), which is selected at runtime.
+// Results agree with the single-matrix functions above to within float rounding (the AVX2 path uses fused
+// multiply-add, so can differ in the last bit or two)
+
+// Which set of instructions the batch functions use
+enum class MatrixKernel
+{
+    Scalar,
+    SSE,
+    AVX2,
+};
+
+// Get the kernel currently used by the batch functions
+MatrixKernel GetMatrixKernel();
+
+// Force the batch functions to use a particular kernel (e.g. scalar, to compare results or timings)
+// If the CPU does not support the requested kernel then the best supported one is used instead
+void SetMatrixKernel(MatrixKernel kernel);
+
+// Largest difference allowed between a SIMD kernel and the scalar kernel, in units in the last place (ULPs) of the size
+// of the terms summed for each element (see BenchmarkMatrices). SSE adds the terms in the same order as the scalar
+// kernel so its products are identical, AVX2 fuses each multiply with its add so each element can be out by a few
+// roundings. The SIMD inverse uses a different calculation, so may also differ. In a hierarchy the limit applies to
+// each node given its parent, as differences build up from level to level
+const float MAX_BATCH_ULPS = 4.0f;
+
+
+// Multiply arrays of matrices: out[i] = m1[i] * m2[i]. The output array can be the same as either input
+void MatrixMultiplyBatch(const CMatrix4x4* m1, const CMatrix4x4* m2, CMatrix4x4* out, unsigned int count);
+
+// Calculate absolute matrices for a hierarchy of nodes: absolute[i] = local[i] * absolute[parents[i]]
+// Entry 0 is the root and is copied unchanged. Nodes must be in depth-first order (each parent index is less than
+// the index of its child). local and absolute must be different arrays
+void MatrixMultiplyHierarchy(const CMatrix4x4* local, const unsigned int* parents, CMatrix4x4* absolute, unsigned int count);
+
+// Calculate the inverse of an array of affine matrices: out[i] = InverseAffine(m[i]). The output array can be the same as the input
+void InverseAffineBatch(const CMatrix4x4* m, CMatrix4x4* out, unsigned int count);
+
+
+// Time the batch functions with each kernel the CPU supports on arrays of random affine matrices, and check the SIMD
+// results against the scalar kernel. Differences are measured in units in the last place (ULPs) of the size of the
+// terms summed for each element, so elements that cancel to near zero don't exaggerate them. Hierarchy nodes are
+// compared with the scalar product of their local matrix and the kernel's own result for their parent. Returns a report
+// for the debug output
+std::string BenchmarkMatrices(unsigned int count = 4096, unsigned int iterations = 100);
+
+
 #endif // _CMATRIX4X4_H_DEFINED_
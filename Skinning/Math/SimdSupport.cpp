@@ -0,0 +1,64 @@
+//--------------------------------------------------------------------------------------
+// SIMD support - compile-time and run-time detection of CPU vector instruction sets
+//--------------------------------------------------------------------------------------
+
+#include "SimdSupport.h"
+
+#if MATH_SIMD_SSE
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+
+// Ask the CPU which instruction sets it supports. The OS must also save the wider AVX registers on a
+// context switch (checked with xgetbv) or the instructions can't be used even if the CPU has them
+static bool DetectAVX2()
+{
+#if MATH_SIMD_SSE
+    unsigned int regs1[4] = {};
+    unsigned int regs7[4] = {};
+
+    #if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)  return false;
+        __cpuid(info, 1);
+        for (int i = 0; i < 4; ++i)  regs1[i] = static_cast<unsigned int>(info[i]);
+        __cpuidex(info, 7, 0);
+        for (int i = 0; i < 4; ++i)  regs7[i] = static_cast<unsigned int>(info[i]);
+    #else
+        if (__get_cpuid_max(0, nullptr) < 7)  return false;
+        __get_cpuid(1, &regs1[0], &regs1[1], &regs1[2], &regs1[3]);
+        __get_cpuid_count(7, 0, &regs7[0], &regs7[1], &regs7[2], &regs7[3]);
+    #endif
+
+    const bool osxsave = (regs1[2] & (1u << 27)) != 0;
+    const bool avx     = (regs1[2] & (1u << 28)) != 0;
+    const bool fma     = (regs1[2] & (1u << 12)) != 0;
+    const bool avx2    = (regs7[1] & (1u <<  5)) != 0;
+    if (!osxsave || !avx || !fma || !avx2)  return false;
+
+    // XCR0 bits 1 and 2: OS saves SSE and AVX register state
+    #if defined(_MSC_VER)
+        unsigned long long xcr0 = _xgetbv(0);
+    #else
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        unsigned long long xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+    #endif
+    return (xcr0 & 0x6) == 0x6;
+#else
+    return false;
+#endif
+}
+
+
+// Returns true if the CPU and operating system support AVX2 and FMA instructions. Result is cached after the first call
+bool CpuHasAVX2()
+{
+    static const bool hasAVX2 = DetectAVX2();
+    return hasAVX2;
+}
@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// SIMD support - compile-time and run-time detection of CPU vector instruction sets
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// The SSE code paths are chosen at compile time (all x86/x64 CPUs we target have SSE2). The AVX2 code paths
+// are compiled in alongside them, but only used if the CPU running the program reports that it supports AVX2.
+
+#ifndef _SIMD_SUPPORT_H_DEFINED_
+#define _SIMD_SUPPORT_H_DEFINED_
+
+// SSE is always available on x86/x64 builds, whatever compiler is used
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+    #define MATH_SIMD_SSE 1
+    #include <immintrin.h>
+#else
+    #define MATH_SIMD_SSE 0
+#endif
+
+// Functions using AVX2/FMA instructions must be marked up on GCC/Clang so the compiler will emit those instructions
+// without the whole program being compiled for AVX2. Visual Studio allows the intrinsics anywhere.
+#if MATH_SIMD_SSE && (defined(__GNUC__) || defined(__clang__))
+    #define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+    #define SIMD_TARGET_AVX2
+#endif
+
+
+// Returns true if the CPU and operating system support AVX2 and FMA instructions. Result is cached after the first call
+bool CpuHasAVX2();
+
+
+#endif // _SIMD_SUPPORT_H_DEFINED_
@@ -3,162 +3,141 @@
 //--------------------------------------------------------------------------------------
 // The mesh class splits the mesh into sub-meshes that only use one texture each.
 // The class also doesn't load textures, filters or shaders as the outer code is
-// expected to select these things. A later lab will introduce a more robust loader.
+// expected to select these things. Loading and importing is done by the MeshData class.
 
 #include "Mesh.h"
 #include "Shader.h" // Needed for helper function CreateSignatureForVertexLayout
-#include "CVector2.h" 
-#include "CVector3.h" 
 #include "GraphicsHelpers.h" // Helper functions to unclutter the code here
+#include "FrameAllocator.h"
+#include "StateCache.h"
+#include "GeometryArena.h"
+#include "Meshlets.h"
 
-#include <assimp/Importer.hpp>
-#include <assimp/DefaultLogger.hpp>
-#include <assimp/postprocess.h>
-#include <assimp/scene.h>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
 
-#include <memory>
+static_assert(MAX_BONES == BONE_PALETTE_SIZE, "Bone palette size in MeshData.h must match the shader constant buffer");
 
 
 // Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
+// A cooked copy of the imported data is written alongside the file and used instead on later runs (see MeshData.h)
 // Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
 // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
 Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
 {
-    Assimp::Importer importer;
-
-    // Flags for processing the mesh. Assimp provides a huge amount of control - right click any of these
-    // and "Peek Definition" to see documention above each constant
-    unsigned int assimpFlags = aiProcess_MakeLeftHanded |
-                               aiProcess_GenSmoothNormals |
-                               aiProcess_FixInfacingNormals |
-                               aiProcess_GenUVCoords | 
-                               aiProcess_TransformUVCoords |
-                               aiProcess_FlipUVs |
-                               aiProcess_FlipWindingOrder |
-                               aiProcess_Triangulate |
-                               aiProcess_JoinIdenticalVertices |
-                               aiProcess_ImproveCacheLocality |
-                               aiProcess_SortByPType |
-                               aiProcess_FindInvalidData | 
-                               aiProcess_OptimizeMeshes |
-                               aiProcess_FindInstances |
-                               aiProcess_FindDegenerates |
-                               aiProcess_RemoveRedundantMaterials |
-                               aiProcess_Debone |
-                               aiProcess_SplitByBoneCount | 
-                               aiProcess_LimitBoneWeights |
-                               aiProcess_RemoveComponent;
-
-    // Flags to specify what mesh data to ignore
-    int removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS | 
-                           aiComponent_ANIMATIONS | aiComponent_MATERIALS;
-
-    // Add / remove tangents as required by user
-    if (requireTangents)
-    {
-        assimpFlags |= aiProcess_CalcTangentSpace;
-    }
-    else
-    {
-        removeComponents |= aiComponent_TANGENTS_AND_BITANGENTS;
-    }
-
-    // Other miscellaneous settings
-    importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0f); // Smoothing angle for normals
-    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);  // Remove points and lines (keep triangles only)
-    importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);                 // Remove degenerate triangles
-    importer.SetPropertyBool(AI_CONFIG_PP_DB_ALL_OR_NONE, true);            // Default to removing bones/weights from meshes that don't need skinning
+    mData.Load(fileName, requireTangents);
+    PrepareRenderData();
+    CreateGPUResources(fileName);
+}
 
-	// Set maximum bones that can affect one vertex, and also maximum bones affecting a single mesh
-    unsigned int maxBonesPerVertex = 4; // The shaders support 4 bones per verted (null bones are added if necessary)
-    unsigned int maxBonesPerMesh = 256; // Bone indexes are stored in a byte, so no more than 256 
-    importer.SetPropertyInteger(AI_CONFIG_PP_LBW_MAX_WEIGHTS, maxBonesPerVertex);
-    importer.SetPropertyInteger(AI_CONFIG_PP_SBBC_MAX_BONES, maxBonesPerMesh);
-  
-    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removeComponents);
 
-    // Import mesh with assimp given above requirements - log output
-    Assimp::DefaultLogger::create("", Assimp::DefaultLogger::VERBOSE);
-    const aiScene* scene = importer.ReadFile(fileName, assimpFlags);
-    Assimp::DefaultLogger::kill();
-    if (scene == nullptr)  throw std::runtime_error("Error loading mesh (" + fileName + "). " + importer.GetErrorString());
-    if (scene->mNumMeshes == 0)  throw std::runtime_error("No usable geometry in mesh: " + fileName);
+// Create a mesh from data that has already been loaded, e.g. on another thread. Only creates the GPU resources
+// Will throw a std::runtime_error exception on failure
+Mesh::Mesh(MeshData&& data, const std::string& fileName)
+    : mData(std::move(data))
+{
+    PrepareRenderData();
+    CreateGPUResources(fileName);
+}
 
 
-    //-----------------------------------
+// Create a mesh from loaded data without any GPU resources, so no device is needed. Render and RenderInstanced make
+// the same uploads and state cache calls as for any other mesh but with no buffers or layouts, so only render it
+// while the state cache forwards to a sink rather than the context (see StateCache::SetSink). Used to measure what
+// rendering sends to the GPU
+Mesh::Mesh(MeshData&& data)
+    : mData(std::move(data))
+{
+    PrepareRenderData();
+}
 
-    //*********************************************************************//
-    // Read node hierachy - each node has a matrix and contains sub-meshes //
 
-    // Uses recursive helper functions to build node hierarchy    
-    mNodes.resize(CountNodes(scene->mRootNode));
-    ReadNodes(scene->mRootNode, 0, 0);
+// Fill in the sub-mesh sizes and the CPU-side data used by Render from the loaded mesh data
+void Mesh::PrepareRenderData()
+{
+    mSubMeshes.resize(mData.subMeshes.size());
+    for (unsigned int m = 0; m < mData.subMeshes.size(); ++m)
+    {
+        auto& subMeshData = mData.subMeshes[m];
+        auto& subMesh = mSubMeshes[m];
+        subMesh.vertexSize  = subMeshData.vertexSize;
+        subMesh.numVertices = subMeshData.numVertices;
+        subMesh.numIndices  = subMeshData.TotalIndices();
+        subMesh.indexSize   = subMeshData.indexSize;
+    }
 
+    // Each copy in an instanced draw has just one matrix, so only rigid meshes with a single node can be instanced
+    mCanRenderInstanced = !mData.hasBones && mData.nodes.size() == 1;
 
+    // Pack the parent indexes and offset matrices for the batch matrix functions used in Render
+    mParentIndices.resize(mData.nodes.size());
+    mOffsetMatrices.resize(mData.nodes.size());
+    for (unsigned int nodeIndex = 0; nodeIndex < mData.nodes.size(); ++nodeIndex)
+    {
+        mParentIndices[nodeIndex]  = mData.nodes[nodeIndex].parentIndex;
+        mOffsetMatrices[nodeIndex] = mData.nodes[nodeIndex].offsetMatrix;
+    }
 
-    //******************************************//
-    // Read geometry - multiple parts supported //
+    // Error and triangles drawn at each level of detail, counted as Render draws them
+    std::size_t numLods = 1;
+    for (auto& subMeshData : mData.subMeshes)  numLods = std::max(numLods, subMeshData.lods.size() + 1);
+    mLodErrors.assign(numLods, 0);
+    mLodTriangles.assign(numLods, 0);
+    for (unsigned int lod = 0; lod < numLods; ++lod)
+    {
+        for (unsigned int m = 0; m < mData.subMeshes.size(); ++m)
+        {
+            auto& subMeshData = mData.subMeshes[m];
+            unsigned int level = std::min(lod, static_cast<unsigned int>(subMeshData.lods.size()));
+            if (level > 0)  mLodErrors[lod] = std::max(mLodErrors[lod], subMeshData.lods[level - 1].error);
+
+            unsigned int firstIndex, numIndices;
+            LodRange(m, lod, firstIndex, numIndices);
+            unsigned int uses = 1;
+            if (!mData.hasBones)
+            {
+                uses = 0;
+                for (auto& node : mData.nodes)  uses += static_cast<unsigned int>(std::count(node.subMeshes.begin(), node.subMeshes.end(), m));
+            }
+            mLodTriangles[lod] += uses * numIndices / 3;
+        }
+    }
+}
 
-	mHasBones = false;
-	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
-        if (scene->mMeshes[m]->HasBones())  mHasBones = true;
 
+// Create the GPU vertex / index buffers and vertex layouts from the loaded mesh data
+void Mesh::CreateGPUResources(const std::string& fileName)
+{
+    static_assert(sizeof(InstanceData) == 80, "Instance data must match the instance layout below");
 
-    // A mesh is made of sub-meshes, each one can have a different material (texture)
-    // Import each sub-mesh in the file to seperate index / vertex buffer (could share buffers between sub-meshes but that would make things more complex)
-    mSubMeshes.resize(scene->mNumMeshes);
-    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    // Each sub-mesh has its own vertex layouts, its vertices and indices go in the buffers shared by all meshes
+    for (unsigned int m = 0; m < mData.subMeshes.size(); ++m)
     {
-        aiMesh* assimpMesh = scene->mMeshes[m];
-        std::string subMeshName = assimpMesh->mName.C_Str();
+        auto& subMeshData = mData.subMeshes[m];
         auto& subMesh = mSubMeshes[m]; // Short name for the submesh we're currently preparing - makes code below more readable
 
-    
-        //-----------------------------------
-
-        // Check for presence of position and normal data. Tangents and UVs are optional.
+        // Convert the vertex layout to a DirectX "vertex layout" to describe what is data in each vertex of this mesh
         std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
-        unsigned int offset = 0;
-    
-        if (!assimpMesh->HasPositions())  throw std::runtime_error("No position data for sub-mesh " + subMeshName + " in " + fileName);
-        unsigned int positionOffset = offset;
-        vertexElements.push_back( { "position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-        offset += 12;
-
-        if (!assimpMesh->HasNormals())  throw std::runtime_error("No normal data for sub-mesh " + subMeshName + " in " + fileName);
-        unsigned int normalOffset = offset;
-        vertexElements.push_back( { "normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-        offset += 12;
-
-        unsigned int tangentOffset = offset;
-        if (requireTangents)
-        {
-            if (!assimpMesh->HasTangentsAndBitangents())  throw std::runtime_error("No tangent data for sub-mesh " + subMeshName + " in " + fileName);
-            vertexElements.push_back( { "tangent", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, tangentOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-            offset += 12;
-        }
-    
-        unsigned int uvOffset = offset;
-        if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
+        for (auto& element : subMeshData.layout)
         {
-            if (assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
-            vertexElements.push_back( { "uv", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-            offset += 8;
-        }
-
-        unsigned int bonesOffset = offset;
-        if (mHasBones)
-        {
-            vertexElements.push_back( { "bones"  , 0, DXGI_FORMAT_R8G8B8A8_UINT,      0, bonesOffset,     D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-            offset += 4;
-            vertexElements.push_back( { "weights", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, bonesOffset + 4, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-            offset += 16;
+            DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+            switch (element.format)
+            {
+                case VertexElementFormat::Float2:  format = DXGI_FORMAT_R32G32_FLOAT;       break;
+                case VertexElementFormat::Float3:  format = DXGI_FORMAT_R32G32B32_FLOAT;    break;
+                case VertexElementFormat::Float4:  format = DXGI_FORMAT_R32G32B32A32_FLOAT; break;
+                case VertexElementFormat::UByte4:  format = DXGI_FORMAT_R8G8B8A8_UINT;      break;
+                case VertexElementFormat::Short2N: format = DXGI_FORMAT_R16G16_SNORM;       break;
+                case VertexElementFormat::Half2:   format = DXGI_FORMAT_R16G16_FLOAT;       break;
+                case VertexElementFormat::UByte4N: format = DXGI_FORMAT_R8G8B8A8_UNORM;     break;
+            }
+            if (format == DXGI_FORMAT_UNKNOWN)  throw std::runtime_error("Unsupported vertex format in " + fileName);
+            vertexElements.push_back( { element.semantic, 0, format, 0, element.offset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
         }
 
-        subMesh.vertexSize = offset;
-
-
-        // Create a "vertex layout" to describe to DirectX what is data in each vertex of this mesh
         auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
         HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
                                                    shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
@@ -166,253 +145,199 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
         if (shaderSignature)  shaderSignature->Release();
         if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + fileName);
 
+        // A mesh that can be instanced also gets a layout that reads the instance data (InstanceData in Common.h) from
+        // vertex buffer slot 1, advancing once per instance rather than once per vertex
+        if (mCanRenderInstanced)
+        {
+            const D3D11_INPUT_ELEMENT_DESC instanceElements[] =
+            {
+                { "instanceWorld",  0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1,  0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+                { "instanceWorld",  1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+                { "instanceWorld",  2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+                { "instanceWorld",  3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+                { "instanceColour", 0, DXGI_FORMAT_R32G32B32_FLOAT,    1, 64, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+            };
+            vertexElements.insert(vertexElements.end(), std::begin(instanceElements), std::end(instanceElements));
+
+            shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
+            hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
+                                               shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
+                                               &subMesh.instancedLayout);
+            if (shaderSignature)  shaderSignature->Release();
+            if (FAILED(hr))  throw std::runtime_error("Failure creating instanced input layout for " + fileName);
+        }
 
 
         //-----------------------------------
 
-        // Create CPU-side buffers to hold current mesh data - exact content is flexible so can't use a structure for a vertex - so just a block of bytes
-        // Note: for large arrays a unique_ptr is better than a vector because vectors default-initialise all the values which is a waste of time.
-        subMesh.numVertices = assimpMesh->mNumVertices;
-        subMesh.numIndices  = assimpMesh->mNumFaces * 3;
-        auto vertices = std::make_unique<unsigned char[]>(subMesh.numVertices * subMesh.vertexSize);
-        auto indices  = std::make_unique<unsigned char[]>(subMesh.numIndices * 4); // Using 32 bit indexes (4 bytes) for each indeex
-
-
-        //-----------------------------------
-
-        // Copy mesh data from assimp to our CPU-side vertex buffer
-
-        CVector3* assimpPosition = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
-        unsigned char* position = vertices.get() + positionOffset;
-        unsigned char* positionEnd = position + subMesh.numVertices * subMesh.vertexSize;
-        while (position != positionEnd)
+        // Copy the vertices and indices into the shared GPU-side buffers. The data is used directly from the loaded
+        // mesh data, which for a cooked file is the memory mapped file itself - no copying on the CPU
+        try
         {
-            *(CVector3*)position = *assimpPosition;
-            position += subMesh.vertexSize;
-            ++assimpPosition;
+            subMesh.geometry = gGeometryArena.Add(subMeshData.vertices, subMesh.vertexSize, subMesh.numVertices,
+                                                  subMeshData.indices, subMesh.indexSize, subMesh.numIndices);
         }
-
-        CVector3* assimpNormal = reinterpret_cast<CVector3*>(assimpMesh->mNormals);
-        unsigned char* normal = vertices.get() + normalOffset;
-        unsigned char* normalEnd = normal + subMesh.numVertices * subMesh.vertexSize;
-        while (normal != normalEnd)
+        catch (const std::runtime_error& e)
         {
-            *(CVector3*)normal = *assimpNormal;
-            normal += subMesh.vertexSize;
-            ++assimpNormal;
+            throw std::runtime_error(std::string(e.what()) + " for " + fileName);
         }
+    }
+}
 
-        if (requireTangents)
-        {
-            CVector3* assimpTangent = reinterpret_cast<CVector3*>(assimpMesh->mTangents);
-            unsigned char* tangent =  vertices.get() + tangentOffset;
-            unsigned char* tangentEnd = tangent + subMesh.numVertices * subMesh.vertexSize;
-            while (tangent != tangentEnd)
-            {
-                *(CVector3*)tangent = *assimpTangent;
-                tangent += subMesh.vertexSize;
-                ++assimpTangent;
-            }
-        }
 
-        if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
-        {
-            aiVector3D* assimpUV = assimpMesh->mTextureCoords[0];
-            unsigned char* uv = vertices.get() + uvOffset;
-            unsigned char* uvEnd = uv + subMesh.numVertices * subMesh.vertexSize;
-            while (uv != uvEnd)
-            {
-                *(CVector2*)uv = CVector2(assimpUV->x, assimpUV->y);
-                uv += subMesh.vertexSize;
-                ++assimpUV;
-            }
-        }
+Mesh::~Mesh()
+{
+    for (auto& subMesh : mSubMeshes)
+    {
+        if (subMesh.geometry != GeometryArena::INVALID_HANDLE)  gGeometryArena.Remove(subMesh.geometry);
+        if (subMesh.vertexLayout)  subMesh.vertexLayout->Release();
+        if (subMesh.instancedLayout)  subMesh.instancedLayout->Release();
+    }
+}
 
 
-		if (mHasBones)
-		{
-			if (assimpMesh->HasBones())
-			{
-				// Set all bones and weights to 0 to start with
-				unsigned char* bones = vertices.get() + bonesOffset;
-				unsigned char* bonesEnd = bones + subMesh.numVertices * subMesh.vertexSize;
-				while (bones != bonesEnd)
-				{
-					memset(bones, 0, 20);
-					bones += subMesh.vertexSize;
-				}
+// Approximate GPU memory used by the mesh's vertex and index buffers, in bytes
+std::size_t Mesh::GetMemoryUsage()
+{
+    std::size_t bytes = 0;
+    for (auto& subMesh : mSubMeshes)
+    {
+        bytes += subMesh.numVertices * subMesh.vertexSize + subMesh.numIndices * subMesh.indexSize;
+    }
+    return bytes;
+}
 
-				for (auto& node : mNodes)
-				{
-					node.offsetMatrix = MatrixIdentity();
-				}
 
-				// Go through each assimp bone
-				bones = vertices.get() + bonesOffset;
-				for (unsigned int i = 0; i < assimpMesh->mNumBones; ++i)
-				{
-					// Get offset matrix for the bone (transform from skinned mesh root to bone root
-					aiBone* assimpBone = assimpMesh->mBones[i];
-					std::string boneName = assimpBone->mName.C_Str();
-                    unsigned int nodeIndex;
-					for (nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-					{
-						if (mNodes[nodeIndex].name == boneName)
-						{
-							mNodes[nodeIndex].offsetMatrix.SetValues(&assimpBone->mOffsetMatrix.a1);
-							mNodes[nodeIndex].offsetMatrix.Transpose(); // Assimp stores matrices differently to this app
-							break;
-						}
-					}
-                    if (nodeIndex == mNodes.size())  throw std::runtime_error("Bone with no matching node in " + fileName);
+// Find an animation clip by name, returns nullptr if there isn't one
+const AnimationClip* Mesh::FindAnimation(const std::string& name)
+{
+    for (auto& clip : mData.animations)
+    {
+        if (clip.name == name)  return &clip;
+    }
+    return nullptr;
+}
 
-					// Go through each weight of the bone and update the vertex it influences
-					// Find the first 0 weight on that vertex and put the new influence / weight there.
-					// A vertex can only have up to 4 influences
-					for (unsigned int j = 0; j < assimpBone->mNumWeights; ++j)
-					{
-						unsigned int vertexIndex = assimpBone->mWeights[j].mVertexId;
-						unsigned char* bone = bones + vertexIndex * subMesh.vertexSize;
-						float* weight = (float*)(bone + 4);
-						float* lastWeight = weight + 3;
-						while (*weight != 0.0f && weight != lastWeight)
-						{
-							bone++; weight++;
-						}
-						if (*weight == 0.0f)
-						{
-							*bone = nodeIndex;
-							*weight = assimpBone->mWeights[j].mWeight;
-						}
-					}
-				}
-			}
-			else
-			{
-				// In a mesh that uses skinning any sub-meshes that don't contain bones are given bones so the whole mesh can use one shader
-				unsigned int subMeshNode = 0;
-				for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-				{
-					for (auto& subMeshIndex : mNodes[nodeIndex].subMeshes)
-					{
-						if (subMeshIndex == m)
-							subMeshNode = nodeIndex;
-					}
-				}
-				
-				unsigned char* bones = vertices.get() + bonesOffset;
-				unsigned char* bonesEnd = bones + subMesh.numVertices * subMesh.vertexSize;
-				while (bones != bonesEnd)
-				{
-					memset(bones, 0, 20);
-					bones[0] = subMeshNode;
-					*(float*)(bones + 4) = 1.0f;
-					bones += subMesh.vertexSize;
-				}
 
-			}
-		}
-            
+//--------------------------------------------------------------------------------------
 
+// The range of a sub-mesh's indices drawn at a level of detail. For skinned sub-meshes this covers all the level's
+// bone batches, which are drawn separately (see LodBatches)
+void Mesh::LodRange(unsigned int subMesh, unsigned int lod, unsigned int& firstIndex, unsigned int& numIndices)
+{
+    const auto& subMeshData = mData.subMeshes[subMesh];
+    unsigned int level = std::min(lod, static_cast<unsigned int>(subMeshData.lods.size()));
+    firstIndex = (level == 0) ? 0 : subMeshData.lods[level - 1].firstIndex;
+    numIndices = (level == 0) ? subMeshData.numIndices : subMeshData.lods[level - 1].numIndices;
+}
 
-        //-----------------------------------
+// The bone batches of a skinned sub-mesh at a level of detail: the full detail batches or a level's copy of them
+const BoneBatch* Mesh::LodBatches(unsigned int subMesh, unsigned int lod)
+{
+    const auto& subMeshData = mData.subMeshes[subMesh];
+    unsigned int level = std::min(lod, static_cast<unsigned int>(subMeshData.lods.size()));
+    return (level == 0) ? subMeshData.boneBatches.data() : subMeshData.lodBatches.data() + subMeshData.lods[level - 1].firstBatch;
+}
 
-        // Copy face data from assimp to our CPU-side index buffer
-        if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
 
-        DWORD* index = reinterpret_cast<DWORD*>(indices.get());
-        for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
-        {
-            *index++ = assimpMesh->mFaces[face].mIndices[0];
-            *index++ = assimpMesh->mFaces[face].mIndices[1];
-            *index++ = assimpMesh->mFaces[face].mIndices[2];
-        }
+// Where a sub-mesh's geometry is in the shared buffers. Meshes without GPU resources have none, so get an empty range
+const GeometryRange& Mesh::GetGeometry(const SubMesh& subMesh)
+{
+    static const GeometryRange noGeometry;
+    if (subMesh.geometry == GeometryArena::INVALID_HANDLE)  return noGeometry;
+    return gGeometryArena.Get(subMesh.geometry);
+}
 
+// Helper function for Render function - renders the given range of a sub-mesh's indices, e.g. one level of detail or
+// one bone batch. World matrices / textures / states etc. must already be set
+void Mesh::RenderSubMesh(const SubMesh& subMesh, unsigned int firstIndex, unsigned int numIndices)
+{
+    // The sub-mesh's place in the shared buffers
+    const GeometryRange& range = GetGeometry(subMesh);
 
-        //-----------------------------------
+    // Set vertex buffer as next data source for GPU. Goes through the state cache, so rendering the batches of one
+    // sub-mesh, or any meshes with the same vertex size one after another, only sets these once
+    gStateCache.SetVertexBuffer(0, range.vertexBuffer, subMesh.vertexSize);
 
-        D3D11_BUFFER_DESC bufferDesc;
-        D3D11_SUBRESOURCE_DATA initData;
-
-        // Create GPU-side vertex buffer and copy the vertices imported by assimp into it
-        bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
-        bufferDesc.Usage = D3D11_USAGE_DEFAULT;          // Default usage for this buffer - we'll see other usages later
-        bufferDesc.ByteWidth = subMesh.numVertices * subMesh.vertexSize; // Size of the buffer in bytes
-        bufferDesc.CPUAccessFlags = 0;
-        bufferDesc.MiscFlags = 0;
-        initData.pSysMem = vertices.get(); // Fill the new vertex buffer with data loaded by assimp
-    
-        hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &subMesh.vertexBuffer);
-        if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + fileName);
-
-
-        // Create GPU-side index buffer and copy the vertices imported by assimp into it
-        bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER; // Indicate it is an index buffer
-        bufferDesc.Usage = D3D11_USAGE_DEFAULT;         // Default usage for this buffer - we'll see other usages later
-        bufferDesc.ByteWidth = subMesh.numIndices * sizeof(DWORD); // Size of the buffer in bytes
-        bufferDesc.CPUAccessFlags = 0;
-        bufferDesc.MiscFlags = 0;
-        initData.pSysMem = indices.get(); // Fill the new index buffer with data loaded by assimp
-
-        hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &subMesh.indexBuffer);
-        if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + fileName);
-    }
-}
+    // Indicate the layout of vertex buffer
+    gStateCache.SetInputLayout(subMesh.vertexLayout);
 
+    // Set index buffer as next data source for GPU, indicate whether it uses 16 or 32-bit integers
+    gStateCache.SetIndexBuffer(range.indexBuffer, subMesh.IndexFormat());
 
-Mesh::~Mesh()
+    // Using triangle lists only in this class
+    gStateCache.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    // Render mesh, the offsets find the sub-mesh's indices and vertices in the shared buffers
+    gStateCache.DrawIndexed(numIndices, range.firstIndex + firstIndex, range.baseVertex);
+}
+
+// Render the given number of copies of a range of a sub-mesh's indices, the instance data must already be in gInstanceBuffer
+void Mesh::RenderSubMeshInstanced(const SubMesh& subMesh, unsigned int firstIndex, unsigned int numIndices, unsigned int numInstances)
 {
-    for (auto& subMesh : mSubMeshes)
-    {
-        if (subMesh.indexBuffer)   subMesh.indexBuffer ->Release();
-        if (subMesh.vertexBuffer)  subMesh.vertexBuffer->Release();
-        if (subMesh.vertexLayout)  subMesh.vertexLayout->Release();
-    }
+    // The mesh's vertices in slot 0 and the instance data in slot 1, the instanced layout reads from both
+    const GeometryRange& range = GetGeometry(subMesh);
+    gStateCache.SetVertexBuffer(0, range.vertexBuffer, subMesh.vertexSize);
+    gStateCache.SetVertexBuffer(1, gInstanceBuffer, sizeof(InstanceData));
+    gStateCache.SetInputLayout(subMesh.instancedLayout);
+    gStateCache.SetIndexBuffer(range.indexBuffer, subMesh.IndexFormat());
+    gStateCache.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    // Every index is drawn once for each instance
+    gStateCache.DrawIndexedInstanced(numIndices, numInstances, range.firstIndex + firstIndex, range.baseVertex, 0);
 }
 
 
-//--------------------------------------------------------------------------------------
 
-// Helper function for Render function - renders a given sub-mesh. World matrices / textures / states etc. must already be set
-void Mesh::RenderSubMesh(const SubMesh& subMesh)
+// World space bounds of a model using this mesh, given the model's matrices (as passed to Render). Uses the bounds
+// of each node so the result follows the model's current pose (rigid body or skinned animation)
+void Mesh::CalculateWorldBounds(const std::vector<CMatrix4x4>& modelMatrices, AABB& box, BoundingSphere& sphere)
 {
-    // Set vertex buffer as next data source for GPU
-    UINT stride = subMesh.vertexSize;
-    UINT offset = 0;
-    gD3DContext->IASetVertexBuffers(0, 1, &subMesh.vertexBuffer, &stride, &offset);
-
-    // Indicate the layout of vertex buffer
-    gD3DContext->IASetInputLayout(subMesh.vertexLayout);
+    box = AABB();
+    sphere = BoundingSphere();
 
-    // Set index buffer as next data source for GPU, indicate it uses 32-bit integers
-    gD3DContext->IASetIndexBuffer(subMesh.indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    // Absolute matrices for each node as in Render. Node bounds are in node (or bone) space so need no offset matrix
+    unsigned int numNodes = static_cast<unsigned int>(mData.nodes.size());
+    const CMatrix4x4* absoluteMatrices = modelMatrices.data();
+    if (numNodes > 1)
+    {
+        CMatrix4x4* matrices = gFrameAllocator.Allocate<CMatrix4x4>(numNodes);
+        MatrixMultiplyHierarchy(modelMatrices.data(), mParentIndices.data(), matrices, numNodes);
+        absoluteMatrices = matrices;
+    }
 
-    // Using triangle lists only in this class
-    gD3DContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    for (unsigned int i = 0; i < numNodes; ++i)  box.Add(TransformAABB(mData.nodes[i].bounds, absoluteMatrices[i]));
+    if (box.IsEmpty())  return;
 
-    // Render mesh
-    gD3DContext->DrawIndexed(subMesh.numIndices, 0, 0);
+    // Sphere centred on the box reaching the furthest node sphere, but no larger than the sphere through the box corners
+    sphere.centre = box.Centre();
+    sphere.radius = 0;
+    for (unsigned int i = 0; i < numNodes; ++i)
+    {
+        BoundingSphere nodeSphere = TransformSphere(mData.nodes[i].boundingSphere, absoluteMatrices[i]);
+        if (!nodeSphere.IsEmpty())  sphere.radius = std::max(sphere.radius, Length(nodeSphere.centre - sphere.centre) + nodeSphere.radius);
+    }
+    sphere.radius = std::min(sphere.radius, Length(box.Extents()));
 }
 
 
-
-// Render the mesh with the given matrices
+// Render the mesh with the given matrices, at the given level of detail (0 is full detail)
 // Handles rigid body meshes (including single part meshes) as well as skinned meshes
+// If a meshlet view is given, sub-meshes drawn at full detail that have meshlets only draw the meshlets that pass
+// the view's culling (see Meshlets.h), and the view's stats are updated
 // LIMITATION: The mesh must use a single texture throughout
-void Mesh::Render(std::vector<CMatrix4x4>& modelMatrices)
+void Mesh::Render(std::vector<CMatrix4x4>& modelMatrices, unsigned int lod /*= 0*/, MeshletView* meshletView /*= nullptr*/)
 {
 	// Skinning needs all matrices available in the shader at the same time, so first calculate all the absolute
 	// matrices before rendering anything
-    std::vector<CMatrix4x4> absoluteMatrices(modelMatrices.size());
-    absoluteMatrices[0] = modelMatrices[0]; // First matrix for a model is the root matrix, already in world space
-    for (unsigned int nodeIndex = 1; nodeIndex < mNodes.size(); ++nodeIndex)
-    {
-		// Multiply each model matrix by its parent's absolute world matrix (already calculated earlier in this loop)
-		// Same process as for rigid bodies, simply done prior to rendering now
-        absoluteMatrices[nodeIndex] = modelMatrices[nodeIndex] * absoluteMatrices[mNodes[nodeIndex].parentIndex];
-    }
-
-	if (mHasBones) // Render a mesh that uses skinning
+    // First matrix for a model is the root matrix, already in world space. Each other model matrix is multiplied by its
+    // parent's absolute world matrix (parents come earlier in the depth-first order so are always calculated first)
+    // Same process as for rigid bodies, simply done prior to rendering now
+    // The absolute matrices are only needed for this call so they use the frame allocator rather than the heap
+    CMatrix4x4* absoluteMatrices = gFrameAllocator.Allocate<CMatrix4x4>(modelMatrices.size());
+    MatrixMultiplyHierarchy(modelMatrices.data(), mParentIndices.data(), absoluteMatrices, static_cast<unsigned int>(mData.nodes.size()));
+
+	if (mData.hasBones) // Render a mesh that uses skinning
 	{
 		// Advanced point: the above loop will get the absolute world matrices **of the bones**. However, they are
 		// not actually rendered, they merely influence the skinned mesh, which has its origin at a particular node.
@@ -420,29 +345,42 @@ void Mesh::Render(std::vector<CMatrix4x4>& modelMatrices)
 		// skinned mesh is. We need to apply that offset to each of the bone matrices calculated in the last loop to make
 		// the bone influences work on the skinned mesh.
 		// These offset matrices are fixed for the model and have been calculated when the mesh was imported
-		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+		MatrixMultiplyBatch(mOffsetMatrices.data(), absoluteMatrices, absoluteMatrices, static_cast<unsigned int>(mData.nodes.size()));
+
+		// The per-model constants are still needed for the colour (pixel shader). The world matrix is set to the root
+		// for any shader that uses it, the skinning vertex shader uses the bones instead
+		gPerModelConstants.worldMatrix = absoluteMatrices[0];
+		UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
+
+		// Indicate that the constant buffers we just updated are for use in the vertex shader (VS) and pixel shader (PS)
+		gStateCache.SetVSConstantBuffer(1, gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
+		gStateCache.SetPSConstantBuffer(1, gPerModelConstantBuffer);
+		gStateCache.SetVSConstantBuffer(2, gPerSkeletonConstantBuffer);
+
+		// Each sub-mesh is split into batches that use no more bones than the shader supports (see BoneBatch in
+		// MeshData.h). Send the bone matrices over to the GPU for each batch via their own constant buffer - each
+		// matrix can represent a bone which influences nearby vertices. The batch's palette says which node each of
+		// its bones is, and only as many matrices as the batch uses are uploaded. Simplified levels of detail have
+		// their own copy of the batches, with the same palettes, and a batch can be simplified away entirely
+		CMatrix4x4 palette[MAX_BONES];
+		for (unsigned int m = 0; m < mSubMeshes.size(); ++m)
 		{
-			absoluteMatrices[nodeIndex] = mNodes[nodeIndex].offsetMatrix * absoluteMatrices[nodeIndex];
-		}
-
-		// Send all matrices over to the GPU for skinning via a constant buffer - each matrix can represent a bone which influences nearby vertices
-		// MISSING - code to fill the gPerModelConstants.boneMatrices array with the contents of the absoluteMatrices vector
-        //-->
-        for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-        {
-            gPerModelConstants.boneMatrices[nodeIndex] = absoluteMatrices[nodeIndex];
-        }
-        UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
+			const auto& subMeshData = mData.subMeshes[m];
+			const BoneBatch* batches = LodBatches(m, lod);
+			for (unsigned int b = 0; b < subMeshData.boneBatches.size(); ++b)
+			{
+				const BoneBatch& batch = batches[b];
+				if (batch.numIndices == 0)  continue;
 
-		// Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-		gD3DContext->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-		gD3DContext->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+				const uint32_t* nodes = subMeshData.bonePalette.data() + batch.firstBone;
+				for (unsigned int bone = 0; bone < batch.numBones; ++bone)
+				{
+					palette[bone] = absoluteMatrices[nodes[bone]];
+				}
+				UpdateConstantBuffer(gPerSkeletonConstantBuffer, palette, batch.numBones * sizeof(CMatrix4x4));
 
-		// Already sent over all the absolute matrices for the entire mesh so we can render sub-meshes directly
-		// rather than iterating through the nodes. 
-		for (auto& subMesh : mSubMeshes)
-		{ 
-			RenderSubMesh(subMesh);
+				RenderSubMesh(mSubMeshes[m], batch.firstIndex, batch.numIndices);
+			}
 		}
 	}
 	else
@@ -450,65 +388,131 @@ void Mesh::Render(std::vector<CMatrix4x4>& modelMatrices)
 		// Render a mesh without skinning. Although slightly reorganised to use the matrices calculated
 		// above, this is basically the same code as the rigid body animation lab
 		// Iterate through each node
-		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+		for (unsigned int nodeIndex = 0; nodeIndex < mData.nodes.size(); ++nodeIndex)
 		{
-			// Send this node's matrix to the GPU via a constant buffer
+			// Send this node's matrix to the GPU via a constant buffer. Only the small per-model structure is uploaded,
+			// rigid models don't use the bone matrices
 			gPerModelConstants.worldMatrix = absoluteMatrices[nodeIndex];
 			UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
 
 			// Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-			gD3DContext->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-			gD3DContext->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
-
-			// Render the sub-meshes attached to this node (no bones - rigid movement)
-			for (auto& subMeshIndex : mNodes[nodeIndex].subMeshes)
+			gStateCache.SetVSConstantBuffer(1, gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
+			gStateCache.SetPSConstantBuffer(1, gPerModelConstantBuffer);
+
+			// Render the sub-meshes attached to this node (no bones - rigid movement). At full detail, sub-meshes with
+			// meshlets can draw just the ranges of them that are visible. The view is moved into the node's space once
+			bool haveNodeView = false;
+			MeshletNodeView nodeView;
+			for (auto& subMeshIndex : mData.nodes[nodeIndex].subMeshes)
 			{ 
-				RenderSubMesh(mSubMeshes[subMeshIndex]);
+				const auto& subMeshData = mData.subMeshes[subMeshIndex];
+				if (meshletView != nullptr && !subMeshData.meshlets.empty() && std::min(lod, static_cast<unsigned int>(subMeshData.lods.size())) == 0)
+				{
+					if (!haveNodeView)  nodeView = MakeMeshletNodeView(*meshletView, absoluteMatrices[nodeIndex]);
+					haveNodeView = true;
+
+					unsigned int numMeshlets = static_cast<unsigned int>(subMeshData.meshlets.size());
+					uint32_t* ranges = gFrameAllocator.Allocate<uint32_t>(numMeshlets * 2);
+					unsigned int numRanges = CullMeshlets(subMeshData.meshlets.data(), numMeshlets, nodeView, ranges, meshletView->stats);
+					++meshletView->stats.subMeshDraws;
+					for (unsigned int r = 0; r < numRanges; ++r)
+					{
+						RenderSubMesh(mSubMeshes[subMeshIndex], ranges[r * 2], ranges[r * 2 + 1]);
+					}
+					continue;
+				}
+
+				unsigned int firstIndex, numIndices;
+				LodRange(subMeshIndex, lod, firstIndex, numIndices);
+				RenderSubMesh(mSubMeshes[subMeshIndex], firstIndex, numIndices);
 			}
 		}
 	}
 }
 
 
-//--------------------------------------------------------------------------------------
-// Helper functions
-//--------------------------------------------------------------------------------------
-
-// Count the number of nodes with given assimp node as root - recursive
-unsigned int Mesh::CountNodes(aiNode* assimpNode)
+// Render many copies of the mesh with one draw call per sub-mesh, each copy with its own world matrix and colour
+// (see InstanceData in Common.h). More than MAX_INSTANCES copies take several calls. Only rigid meshes with a single
+// node can be instanced. The vertex shader must read the instance data and the per-model constants are not updated.
+// All the copies use the same level of detail
+void Mesh::RenderInstanced(const InstanceData* instances, unsigned int numInstances, unsigned int lod /*= 0*/)
 {
-    unsigned int count = 1;
-    for (unsigned int child = 0; child < assimpNode->mNumChildren; ++child)
-        count += CountNodes(assimpNode->mChildren[child]);
-    return count;
-}
+    if (!mCanRenderInstanced)  return;
 
+    // The instance buffer holds MAX_INSTANCES copies, each batch of that many is uploaded then drawn. The single node's
+    // matrix is the model's world matrix, so the instance's matrix is used in its place
+    for (unsigned int first = 0; first < numInstances; first += MAX_INSTANCES)
+    {
+        unsigned int batchSize = std::min(numInstances - first, static_cast<unsigned int>(MAX_INSTANCES));
+        UpdateInstanceBuffer(gInstanceBuffer, instances + first, batchSize * sizeof(InstanceData));
 
-// Help build the arrays of submeshes and nodes from the assimp data - recursive
-unsigned int Mesh::ReadNodes(aiNode* assimpNode, unsigned int nodeIndex, unsigned int parentIndex)
-{
-    auto& node = mNodes[nodeIndex];
-    node.parentIndex = parentIndex;
-    unsigned int thisIndex = nodeIndex;
-    ++nodeIndex;
+        for (auto& subMeshIndex : mData.nodes[0].subMeshes)
+        {
+            unsigned int firstIndex, numIndices;
+            LodRange(subMeshIndex, lod, firstIndex, numIndices);
+            RenderSubMeshInstanced(mSubMeshes[subMeshIndex], firstIndex, numIndices, batchSize);
+        }
+    }
+}
 
-    node.name = assimpNode->mName.C_Str();
 
-    node.defaultMatrix.SetValues(&assimpNode->mTransformation.a1);
-    node.defaultMatrix.Transpose(); // Assimp stores matrices differently to this app
+//--------------------------------------------------------------------------------------
+// Measurement
+//--------------------------------------------------------------------------------------
 
-    node.subMeshes.resize(assimpNode->mNumMeshes);
-    for (unsigned int i = 0; i < assimpNode->mNumMeshes; ++i)
+namespace
+{
+    // Counts the draws and the uploads to each constant buffer forwarded by the state cache, drops everything else
+    class UploadCountingSink : public StateSink
     {
-        node.subMeshes[i] = assimpNode->mMeshes[i];
-    }
+    public:
+        unsigned int draws = 0;
+        unsigned int modelUploads = 0, skeletonUploads = 0, otherUploads = 0;
+        std::size_t  bytes = 0;
+
+        void UpdateBuffer(ID3D11Buffer* buffer, const void* /*data*/, std::size_t size) override
+        {
+            if      (buffer == gPerModelConstantBuffer)     ++modelUploads;
+            else if (buffer == gPerSkeletonConstantBuffer)  ++skeletonUploads;
+            else                                            ++otherUploads;
+            bytes += size;
+        }
+        void DrawIndexed(UINT, UINT, INT) override  { ++draws; }
+        void DrawIndexedInstanced(UINT, UINT, UINT, INT, UINT) override  { ++draws; }
+    };
+}
+
 
-    node.childNodes.resize(assimpNode->mNumChildren);
-    for (unsigned int i = 0; i < assimpNode->mNumChildren; ++i)
+// Report the constant and instance buffer uploads made by rendering each mesh once in its default pose, counted by
+// swapping the state cache's sink for one that drops everything else (the previous sink is restored). Also gives the
+// bytes the same draws would upload if the bone palette were part of the per-model constants, one combined structure
+// for each rigid node or bone batch. Meshes without GPU resources can be measured, so this runs without a device
+std::string ReportConstantUploads(Mesh* const* meshes, const char* const* names, unsigned int numMeshes)
+{
+    const std::size_t combinedSize = sizeof(PerModelConstants) + sizeof(PerSkeletonConstants);
+    std::string report = "Constant buffer uploads for one render of each mesh (combined per-model and bone constants "
+                         "would be " + std::to_string(combinedSize) + " bytes)\n";
+    report += "  Nodes  Draws  Uploads  Bytes  Per draw  Combined  Mesh\n";
+    char line[512];
+
+    StateSink* previousSink = gStateCache.Sink();
+    for (unsigned int i = 0; i < numMeshes; ++i)
     {
-        node.childNodes[i] = nodeIndex;
-        nodeIndex = ReadNodes(assimpNode->mChildren[i], nodeIndex, thisIndex);
+        Mesh* mesh = meshes[i];
+        std::vector<CMatrix4x4> matrices(mesh->NumberNodes());
+        for (unsigned int node = 0; node < matrices.size(); ++node)  matrices[node] = mesh->GetNodeDefaultMatrix(node);
+
+        UploadCountingSink sink;
+        gStateCache.SetSink(&sink);
+        mesh->Render(matrices);
+
+        unsigned int uploads = sink.modelUploads + sink.skeletonUploads + sink.otherUploads;
+        unsigned int combinedUploads = (sink.skeletonUploads > 0) ? sink.skeletonUploads : sink.modelUploads;
+        std::snprintf(line, sizeof(line), "  %5u  %5u  %7u  %5u  %8.0f  %8u  %s\n", mesh->NumberNodes(), sink.draws, uploads,
+                      static_cast<unsigned int>(sink.bytes), (sink.draws > 0) ? static_cast<double>(sink.bytes) / sink.draws : 0.0,
+                      static_cast<unsigned int>(combinedUploads * combinedSize), names[i]);
+        report += line;
     }
-
-    return nodeIndex;
+    gStateCache.SetSink(previousSink);
+    return report;
 }
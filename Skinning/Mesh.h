@@ -6,15 +6,18 @@
 // expected to select these things
 
 #include "common.h"
-
-#include <assimp/scene.h>
+#include "MeshData.h"
+#include "GeometryArena.h"
 
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #ifndef _MESH_H_INCLUDED_
 #define _MESH_H_INCLUDED_
 
+struct MeshletView;
+
 class Mesh
 {
 //--------------------------------------------------------------------------------------
@@ -23,24 +26,87 @@ class Mesh
 public:
 
     // Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
+    // A cooked copy of the imported data is written alongside the file and used instead on later runs (see MeshData.h)
     // Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
     // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
     Mesh(const std::string& fileName, bool requireTangents = false);
+
+    // Create a mesh from data that has already been loaded, e.g. on another thread. Only creates the GPU resources
+    // Will throw a std::runtime_error exception on failure
+    Mesh(MeshData&& data, const std::string& fileName);
+
+    // Create a mesh from loaded data without any GPU resources, so no device is needed. Only render it while the state
+    // cache forwards to a sink rather than the context (see StateCache::SetSink), e.g. to measure what rendering sends
+    explicit Mesh(MeshData&& data);
+
     ~Mesh();
 
+    // Meshes own GPU resources so cannot be copied
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+
 
     // How many nodes are in the hierarchy for this mesh. Nodes can control individual parts (rigid body animation),
 	// or bones (skinned animation), or they can be dummy nodes to create child parts in a more convenient way
-    unsigned int NumberNodes()  { return static_cast<unsigned int>(mNodes.size()); }
+    unsigned int NumberNodes()  { return static_cast<unsigned int>(mData.nodes.size()); }
 
     // The default matrix for a given node - used to set the initial position for a new model
-    CMatrix4x4 GetNodeDefaultMatrix(unsigned int node) { return mNodes[node].defaultMatrix; }
+    CMatrix4x4 GetNodeDefaultMatrix(unsigned int node) { return mData.nodes[node].defaultMatrix; }
+
+    // The CPU-side geometry and hierarchy, e.g. to merge static models into one buffer (see StaticBatch.h)
+    const MeshData& GetData()  { return mData; }
+
+    // Approximate GPU memory used by the mesh's vertex and index buffers, in bytes
+    std::size_t GetMemoryUsage();
+
+    // Bounds of the whole mesh in its default pose, relative to the root node
+    const AABB&           GetBounds()          { return mData.bounds; }
+    const BoundingSphere& GetBoundingSphere()  { return mData.boundingSphere; }
+
+    // World space bounds of a model using this mesh, given the model's matrices (as passed to Render). Uses the bounds
+    // of each node so the result follows the model's current pose (rigid body or skinned animation)
+    void CalculateWorldBounds(const std::vector<CMatrix4x4>& modelMatrices, AABB& box, BoundingSphere& sphere);
+
+
+    // Animation clips imported with the mesh. Play them on a model using this mesh with Model::PlayAnimation
+    unsigned int NumberAnimations()  { return static_cast<unsigned int>(mData.animations.size()); }
+    const AnimationClip* GetAnimation(unsigned int index)  { return &mData.animations[index]; }
+
+    // Find an animation clip by name, returns nullptr if there isn't one
+    const AnimationClip* FindAnimation(const std::string& name);
 
  
-	// Render the mesh with the given matrices
+	// Render the mesh with the given matrices, at the given level of detail (see below, 0 is full detail)
 	// Handles rigid body meshes (including single part meshes) as well as skinned meshes
+	// If a meshlet view is given, sub-meshes drawn at full detail that have meshlets only draw the meshlets that pass
+	// the view's culling (see Meshlets.h), and the view's stats are updated
 	// LIMITATION: The mesh must use a single texture throughout
-    void Render(std::vector<CMatrix4x4>& modelMatrices);
+    void Render(std::vector<CMatrix4x4>& modelMatrices, unsigned int lod = 0, MeshletView* meshletView = nullptr);
+
+    // Render many copies of the mesh with one draw call per sub-mesh, each copy with its own world matrix and colour
+    // (see InstanceData in Common.h). More than MAX_INSTANCES copies take several calls. Only rigid meshes with a single
+    // node can be instanced, as each copy has just the one matrix. The vertex shader must read the instance data
+    // (e.g. BasicTransformInstanced_vs) and the per-model constants are not updated
+    bool CanRenderInstanced()  { return mCanRenderInstanced; }
+    void RenderInstanced(const InstanceData* instances, unsigned int numInstances, unsigned int lod = 0);
+
+    // Levels of detail made at import (see MeshSimplifier.h). Level 0 is full detail and each level after it is coarser,
+    // sub-meshes with fewer levels than the mesh draw their coarsest one at the levels they don't have. Levels past the
+    // last are treated as the last
+    unsigned int NumLods()  { return static_cast<unsigned int>(mLodErrors.size()); }
+
+    // Largest simplification error of any sub-mesh at a level, in the mesh's own space. 0 for full detail
+    float LodError(unsigned int lod)  { return mLodErrors[std::min(lod, NumLods() - 1)]; }
+
+    // Triangles drawn by one Render, or for each copy in RenderInstanced, at a level
+    unsigned int NumTriangles(unsigned int lod)  { return mLodTriangles[std::min(lod, NumLods() - 1)]; }
+
+    // Render a range of one sub-mesh's indices without setting any constants, the world matrix etc. must already be
+    // set. Used to draw the visible models of a static batch (see StaticBatch.h)
+    void RenderIndexRange(unsigned int subMesh, unsigned int firstIndex, unsigned int numIndices)
+    {
+        RenderSubMesh(mSubMeshes[subMesh], firstIndex, numIndices);
+    }
 
 
 
@@ -50,38 +116,30 @@ public:
 private:
 
     // A mesh is made of multiple sub-meshes. Each one uses a single material (texture).
-    // Each sub-mesh has a vertex / index buffer on the GPU. Could share buffers for performance but that would be complex.
+    // The vertices and indices of each sub-mesh are in a range of the vertex / index buffers shared by all meshes (see
+    // GeometryArena.h), so drawing different meshes one after another often needs no new buffers bound
     struct SubMesh
     {
         unsigned int       vertexSize = 0;         // Size in bytes of a single vertex (depends on what it contains, uvs, tangents etc.)
         ID3D11InputLayout* vertexLayout = nullptr; // DirectX specification of data held in a single vertex
+        ID3D11InputLayout* instancedLayout = nullptr; // As above plus the instance data, only if the mesh can be instanced
 
-        // GPU-side vertex and index buffers
         unsigned int       numVertices = 0;
-        ID3D11Buffer*      vertexBuffer = nullptr;
+        unsigned int       numIndices = 0;         // All the indices, full detail followed by the simplified levels
+        unsigned int       indexSize = 4;          // 2 or 4 bytes, see VertexPacking.h
+
+        DXGI_FORMAT IndexFormat() const  { return (indexSize == 2) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT; }
 
-        unsigned int       numIndices = 0;
-        ID3D11Buffer*      indexBuffer  = nullptr;
+        // Where the GPU-side vertices and indices are in the geometry arena
+        GeometryArena::Handle geometry = GeometryArena::INVALID_HANDLE;
     };
 
 
-    // A mesh contains a hierarchy of nodes. A node represents a seperate animatable part of the mesh
-    // A node can contain several sub-meshes (because a single node might use multiple textures)
+    // The mesh hierarchy is held in the MeshData class. A mesh contains a hierarchy of nodes. A node represents a seperate
+    // animatable part of the mesh. A node can contain several sub-meshes (because a single node might use multiple textures)
     // A node can also have child nodes. The children will follow the motion of the parent node
     // Each node has a default matrix which is it's initial/ default position. Models using this mesh are
     // given these default matrices as a starting position.
-    struct Node
-    {
-        std::string  name;
-
-        CMatrix4x4   defaultMatrix; // Starting position/rotation/scale for this node. Relative to parent. Used when first creating a model from this mesh
-        CMatrix4x4   offsetMatrix;
-
-        unsigned int parentIndex;   // Index of the parent node (from the mNodes vector below). Root node refers to itself (0)
-
-        std::vector<unsigned int> childNodes; // Child nodes that are controlled by this node (indexes into the mNodes vector below)
-        std::vector<unsigned int> subMeshes;  // The geometry representing this node (indexes into the mSubMeshes vector below)
-    };
 
 
 //--------------------------------------------------------------------------------------
@@ -89,14 +147,27 @@ private:
 //--------------------------------------------------------------------------------------
 private:
 
-    // Count the number of nodes with given assimp node as root
-    unsigned int CountNodes(aiNode* assimpNode);
+    // Fill in the sub-mesh sizes and the CPU-side data used by Render from the loaded mesh data
+    void PrepareRenderData();
+
+    // Create the GPU vertex / index buffers and vertex layouts from the loaded mesh data
+    void CreateGPUResources(const std::string& fileName);
+
+	// The range of a sub-mesh's indices drawn at a level of detail, for sub-meshes without bone batches
+	void LodRange(unsigned int subMesh, unsigned int lod, unsigned int& firstIndex, unsigned int& numIndices);
 
-    // Help build the arrays of submeshes and nodes from the assimp data - recursive
-    unsigned int ReadNodes(aiNode* assimpNode,unsigned int nodeIndex, unsigned int parentIndex);
+	// The bone batches of a skinned sub-mesh at a level of detail: the full detail batches or a level's copy of them
+	const BoneBatch* LodBatches(unsigned int subMesh, unsigned int lod);
 
-	// Helper function for Render function - renders a given sub-mesh. World matrices / textures / states etc. must already be set
-	void RenderSubMesh(const SubMesh& subMesh);
+	// Where a sub-mesh's geometry is in the shared buffers. Meshes without GPU resources have none, so get an empty range
+	static const GeometryRange& GetGeometry(const SubMesh& subMesh);
+
+	// Helper function for Render function - renders the given range of a sub-mesh's indices, e.g. one level of detail or
+	// one bone batch. World matrices / textures / states etc. must already be set
+	void RenderSubMesh(const SubMesh& subMesh, unsigned int firstIndex, unsigned int numIndices);
+
+	// Render the given number of copies of a range of a sub-mesh's indices, the instance data must already be in gInstanceBuffer
+	void RenderSubMeshInstanced(const SubMesh& subMesh, unsigned int firstIndex, unsigned int numIndices, unsigned int numInstances);
 
 
 
@@ -105,12 +176,32 @@ private:
 //--------------------------------------------------------------------------------------
 private:
 
-    std::vector<SubMesh> mSubMeshes; // The mesh geometry. Nodes refer to sub-meshes in this vector
-    std::vector<Node>    mNodes;     // The mesh hierarchy. First entry is root. remainder aree stored in depth-first order
+    MeshData             mData;      // CPU-side geometry and the mesh hierarchy (mData.nodes). First node is root. Remainder are stored in depth-first order
+    std::vector<SubMesh> mSubMeshes; // The GPU-side mesh geometry, one for each sub-mesh in mData. Nodes refer to sub-meshes in this vector
+
+    // Copies of the node parent indexes and offset matrices packed into contiguous arrays so the whole hierarchy
+    // can be passed to the batch matrix functions in one call
+    std::vector<unsigned int> mParentIndices;
+    std::vector<CMatrix4x4>   mOffsetMatrices;
 
-	bool mHasBones; // If any submesh has bones, then all submeshes are given bones - makes rendering easier (one shader for the whole mesh)
+    bool mCanRenderInstanced = false;
+
+    // Largest error and triangles drawn at each level of detail, see NumLods
+    std::vector<float>        mLodErrors;
+    std::vector<unsigned int> mLodTriangles;
 };
 
 
+//--------------------------------------------------------------------------------------
+// Measurement
+//--------------------------------------------------------------------------------------
+
+// Report the constant and instance buffer uploads made by rendering each mesh once in its default pose, counted by
+// swapping the state cache's sink for one that drops everything else (the previous sink is restored). Also gives the
+// bytes the same draws would upload if the bone palette were part of the per-model constants, one combined structure
+// for each rigid node or bone batch. Meshes without GPU resources can be measured, so this runs without a device
+std::string ReportConstantUploads(Mesh* const* meshes, const char* const* names, unsigned int numMeshes);
+
+
 #endif //_MESH_H_INCLUDED_
 
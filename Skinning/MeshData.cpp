@@ -0,0 +1,1559 @@
+//--------------------------------------------------------------------------------------
+// CPU-side mesh data - geometry and node hierarchy ready to be copied to the GPU
+//--------------------------------------------------------------------------------------
+
+#include "MeshData.h"
+#include "VertexPacking.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Meshlets.h"
+#include "CVector2.h"
+#include "CVector3.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/DefaultLogger.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <sys/stat.h>
+
+
+//--------------------------------------------------------------------------------------
+// Cooked file format
+//--------------------------------------------------------------------------------------
+// A cooked file is laid out as follows, all values little-endian:
+//   CookedHeader
+//   CookedNode for each node, each followed by its child indexes, sub-mesh indexes and name (padded to 4 bytes)
+//   CookedSubMesh for each sub-mesh, each followed by its VertexElement layout array, BoneBatch array, bone palette,
+//   LodLevel array, level BoneBatch array and Meshlet array
+//   CookedAnimation for each animation clip, each followed by its tracks, key arrays and name (padded to 4 bytes)
+//   Vertex and index data for each sub-mesh, each block starting on a 16 byte boundary
+// Increase the version number whenever the layout or the content of the data changes (e.g. different import
+// settings), so that old cooked files are rebuilt.
+
+namespace
+{
+    const uint32_t COOKED_MAGIC   = 0x4853454d; // "MESH"
+    const uint32_t COOKED_VERSION = 9;
+
+    struct CookedHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t sourceSize;      // Size and modification time of the source file when cooked, used to detect stale files
+        uint64_t sourceTime;
+        uint32_t requireTangents;
+        uint32_t hasBones;
+        uint32_t numNodes;
+        uint32_t numSubMeshes;
+        uint32_t numAnimations;
+        uint32_t padding;
+        float    bounds[6];         // Whole mesh box (minimum then maximum) and sphere (centre then radius)
+        float    boundingSphere[4];
+    };
+
+    struct CookedNode
+    {
+        float    defaultMatrix[16];
+        float    offsetMatrix[16];
+        uint32_t parentIndex;
+        uint32_t numChildren;
+        uint32_t numSubMeshes;
+        uint32_t nameLength;
+        float    bounds[6];         // Node box (minimum then maximum) and sphere (centre then radius)
+        float    boundingSphere[4];
+    };
+
+    struct CookedSubMesh
+    {
+        uint32_t vertexSize;
+        uint32_t numVertices;
+        uint32_t numIndices;
+        uint32_t numLodIndices;
+        uint32_t numElements;
+        uint32_t positionOffset;
+        uint32_t normalOffset;
+        uint32_t tangentOffset;
+        uint32_t uvOffset;
+        uint32_t bonesOffset;
+        uint32_t numBoneBatches;
+        uint32_t numPaletteBones;
+        uint32_t numLods;
+        uint32_t numLodBatches;
+        uint32_t indexSize;
+        uint32_t numMeshlets;
+        uint64_t vertexDataOffset; // Offset from the start of the file
+        uint64_t indexDataOffset;
+    };
+
+    struct CookedAnimation
+    {
+        float    duration;
+        uint32_t numTracks;
+        uint32_t numTranslations; // Total number of keys of each kind for all the tracks
+        uint32_t numRotations;
+        uint32_t numScales;
+        uint32_t nameLength;
+    };
+
+
+    // Get the size and modification time of a file. Returns false if the file doesn't exist
+    bool GetFileInfo(const std::string& fileName, uint64_t& size, uint64_t& time)
+    {
+#ifdef _WIN32
+        struct _stat64 info;
+        if (_stat64(fileName.c_str(), &info) != 0)  return false;
+#else
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0)  return false;
+#endif
+        size = static_cast<uint64_t>(info.st_size);
+        time = static_cast<uint64_t>(info.st_mtime);
+        return true;
+    }
+
+
+    // Copy bounds to and from the cooked file's float arrays
+    void WriteBounds(const AABB& box, const BoundingSphere& sphere, float* boxOut, float* sphereOut)
+    {
+        std::memcpy(boxOut,     &box.minimum,  sizeof(float) * 3);
+        std::memcpy(boxOut + 3, &box.maximum,  sizeof(float) * 3);
+        std::memcpy(sphereOut,  &sphere.centre, sizeof(float) * 3);
+        sphereOut[3] = sphere.radius;
+    }
+
+    void ReadBounds(const float* boxIn, const float* sphereIn, AABB& box, BoundingSphere& sphere)
+    {
+        box.minimum = CVector3(boxIn);
+        box.maximum = CVector3(boxIn + 3);
+        sphere.centre = CVector3(sphereIn);
+        sphere.radius = sphereIn[3];
+    }
+
+
+    // Helper to write the cooked file into a memory buffer
+    class CookedWriter
+    {
+    public:
+        void Write(const void* data, size_t size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            mBuffer.insert(mBuffer.end(), bytes, bytes + size);
+        }
+
+        template <class T>
+        void Write(const T& value)  { Write(&value, sizeof(T)); }
+
+        void Align(size_t alignment)  { mBuffer.resize((mBuffer.size() + alignment - 1) / alignment * alignment, 0); }
+
+        size_t Position()  { return mBuffer.size(); }
+        unsigned char* At(size_t position)  { return mBuffer.data() + position; }
+
+        const std::vector<unsigned char>& Buffer()  { return mBuffer; }
+
+    private:
+        std::vector<unsigned char> mBuffer;
+    };
+
+
+    // Helper to read the cooked file with bounds checking - a truncated or corrupt file must not crash the app
+    class CookedReader
+    {
+    public:
+        CookedReader(const unsigned char* data, size_t size) : mData(data), mSize(size) {}
+
+        const unsigned char* ReadBytes(size_t size)
+        {
+            if (size > mSize - mPosition)  { mFailed = true;  return nullptr; }
+            const unsigned char* p = mData + mPosition;
+            mPosition += size;
+            return p;
+        }
+
+        template <class T>
+        bool Read(T& value)
+        {
+            const unsigned char* p = ReadBytes(sizeof(T));
+            if (p == nullptr)  return false;
+            std::memcpy(&value, p, sizeof(T));
+            return true;
+        }
+
+        void Align(size_t alignment)  { mPosition = std::min(mSize, (mPosition + alignment - 1) / alignment * alignment); }
+
+        // Check a block of data lies completely within the file
+        bool Contains(uint64_t offset, uint64_t size)  { return offset <= mSize && size <= mSize - offset; }
+
+        // Check the rest of the file could hold the given number of items of a given size. Used before sizing arrays
+        // from counts in the file, so a corrupt count can't ask for a huge allocation
+        bool CanHold(uint64_t count, size_t itemSize)  { return count <= (mSize - mPosition) / itemSize; }
+
+        // Mark the file as bad, e.g. if it has data that is the right size but invalid
+        void Fail()  { mFailed = true; }
+
+        bool Failed()  { return mFailed; }
+
+    private:
+        const unsigned char* mData;
+        size_t mSize;
+        size_t mPosition = 0;
+        bool   mFailed = false;
+    };
+
+
+    // Size in bytes of a vertex element, 0 for an unknown format
+    uint32_t ElementSize(VertexElementFormat format)
+    {
+        switch (format)
+        {
+            case VertexElementFormat::Float2:  return 8;
+            case VertexElementFormat::Float3:  return 12;
+            case VertexElementFormat::Float4:  return 16;
+            case VertexElementFormat::UByte4:  return 4;
+            case VertexElementFormat::Short2N: return 4;
+            case VertexElementFormat::Half2:   return 4;
+            case VertexElementFormat::UByte4N: return 4;
+        }
+        return 0;
+    }
+
+    // Check the layout and the standard element offsets of a cooked sub-mesh lie within its vertices. The standard
+    // offsets are read directly by CPU code (skinning, occlusion, static batching) with the sizes of the packed formats
+    bool ValidCookedLayout(const SubMeshData& subMesh)
+    {
+        const uint32_t vertexSize = subMesh.vertexSize;
+        auto fits = [vertexSize](uint32_t offset, uint32_t size)  { return offset <= vertexSize && size <= vertexSize - offset; };
+
+        for (auto& element : subMesh.layout)
+        {
+            uint32_t size = ElementSize(element.format);
+            if (size == 0 || !fits(element.offset, size))  return false;
+        }
+
+        const uint32_t NO_ELEMENT = SubMeshData::NO_ELEMENT;
+        return vertexSize > 0 && subMesh.positionOffset != NO_ELEMENT && fits(subMesh.positionOffset, 12) &&
+               (subMesh.normalOffset  == NO_ELEMENT || fits(subMesh.normalOffset,  4)) &&
+               (subMesh.tangentOffset == NO_ELEMENT || fits(subMesh.tangentOffset, 4)) &&
+               (subMesh.uvOffset      == NO_ELEMENT || fits(subMesh.uvOffset,      4)) &&
+               (subMesh.bonesOffset   == NO_ELEMENT || fits(subMesh.bonesOffset,   8)); // Bone indices then weights
+    }
+
+    // Check the indices of a cooked sub-mesh refer to its vertices. For skinned sub-meshes also check the batches cover
+    // the geometry in order, that each batch's indices (full detail and every level) only use the batch's own vertices,
+    // and that those vertices only use slots in the batch's palette. Reads all the index and bone data, so it is the
+    // most expensive check on a cooked file, but the renderer and CPU skinning use this data without further checks
+    bool ValidCookedIndices(const SubMeshData& subMesh)
+    {
+        const uint32_t totalIndices = subMesh.TotalIndices();
+        if (subMesh.boneBatches.empty())
+        {
+            for (uint32_t i = 0; i < totalIndices; ++i)
+            {
+                if (subMesh.Index(i) >= subMesh.numVertices)  return false;
+            }
+            return true;
+        }
+
+        auto validRange = [&subMesh](const BoneBatch& batch)
+        {
+            for (uint32_t i = batch.firstIndex; i < batch.firstIndex + batch.numIndices; ++i)
+            {
+                if (subMesh.Index(i) - batch.firstVertex >= batch.numVertices)  return false; // Wraps if below firstVertex
+            }
+            return true;
+        };
+
+        uint32_t nextIndex = 0, nextVertex = 0;
+        for (auto& batch : subMesh.boneBatches)
+        {
+            if (batch.firstIndex != nextIndex || batch.firstVertex != nextVertex || !validRange(batch))  return false;
+            nextIndex  += batch.numIndices;
+            nextVertex += batch.numVertices;
+
+            for (uint32_t v = batch.firstVertex; v < batch.firstVertex + batch.numVertices; ++v)
+            {
+                const unsigned char* bones = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize + subMesh.bonesOffset;
+                if (bones[0] >= batch.numBones || bones[1] >= batch.numBones || bones[2] >= batch.numBones || bones[3] >= batch.numBones)
+                    return false;
+            }
+        }
+        if (nextIndex != subMesh.numIndices || nextVertex != subMesh.numVertices)  return false;
+
+        for (auto& batch : subMesh.lodBatches)
+        {
+            if (!validRange(batch))  return false;
+        }
+        return true;
+    }
+
+
+    // Assimp's logger is a single global object, so when meshes are imported on several threads at once it must
+    // not be created or destroyed by one import while another is using it. This keeps it alive while any import runs
+    std::mutex   gImportLoggerMutex;
+    unsigned int gImportLoggerUsers = 0;
+
+    class ImportLogger
+    {
+    public:
+        ImportLogger()
+        {
+            std::lock_guard<std::mutex> lock(gImportLoggerMutex);
+            if (gImportLoggerUsers++ == 0)  Assimp::DefaultLogger::create("", Assimp::DefaultLogger::VERBOSE);
+        }
+
+        ~ImportLogger()
+        {
+            std::lock_guard<std::mutex> lock(gImportLoggerMutex);
+            if (--gImportLoggerUsers == 0)  Assimp::DefaultLogger::kill();
+        }
+    };
+}
+
+
+//--------------------------------------------------------------------------------------
+// Bone palettes
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    const uint32_t NO_SLOT = 0xffffffff;
+
+    // Split a skinned sub-mesh into batches that each use no more than BONE_PALETTE_SIZE bones (see BoneBatch). The
+    // vertex data must already hold the bone weights, and vertexNodes holds the node index of each of the four bone
+    // influences of each vertex. Triangles are taken in order (keeping the cache-friendly order from
+    // OptimizeTriangleOrder), and a new batch is started when the next triangle would need too many bones. Each batch
+    // copies the vertices it uses into its own range and writes bone indices local to its palette. Meshes with few
+    // bones end up as a single batch with vertices in the order they are first used
+    void SplitBonePalettes(SubMeshData& subMesh, const std::vector<uint32_t>& vertexNodes, unsigned int numNodes)
+    {
+        std::vector<uint32_t> nodeBatch(numNodes, NO_SLOT); // Batch each node was last added to...
+        std::vector<uint32_t> nodeSlot(numNodes);           // ...and its palette slot in that batch
+        std::vector<uint32_t> vertexBatch(subMesh.numVertices, NO_SLOT); // Same for vertices, with the index of the copy
+        std::vector<uint32_t> vertexCopy(subMesh.numVertices);
+
+        std::vector<unsigned char> vertices;
+        vertices.reserve(static_cast<std::size_t>(subMesh.numVertices) * subMesh.vertexSize);
+        std::vector<uint32_t> indices;
+        indices.reserve(subMesh.numIndices);
+
+        subMesh.boneBatches.clear();
+        subMesh.bonePalette.clear();
+        uint32_t batch = NO_SLOT;
+        for (unsigned int i = 0; i + 2 < subMesh.numIndices; i += 3)
+        {
+            // Find the bones this triangle uses (influences with zero weight are ignored), and how many of them are
+            // not in the current batch's palette yet
+            uint32_t triangleNodes[12];
+            unsigned int numTriangleNodes = 0, numNewNodes = 0;
+            for (unsigned int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t v = subMesh.Index(i + corner);
+                const unsigned char* vertex = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+                const float* weights = reinterpret_cast<const float*>(vertex + subMesh.bonesOffset + 4);
+                for (unsigned int b = 0; b < 4; ++b)
+                {
+                    uint32_t node = vertexNodes[v * 4 + b];
+                    if (weights[b] == 0.0f || std::find(triangleNodes, triangleNodes + numTriangleNodes, node) != triangleNodes + numTriangleNodes)  continue;
+                    triangleNodes[numTriangleNodes++] = node;
+                    if (batch == NO_SLOT || nodeBatch[node] != batch)  ++numNewNodes;
+                }
+            }
+
+            // Start a new batch if there isn't room for the new bones, all of this triangle's bones are new to it
+            if (batch == NO_SLOT || subMesh.boneBatches.back().numBones + numNewNodes > BONE_PALETTE_SIZE)
+            {
+                BoneBatch newBatch = {};
+                newBatch.firstIndex  = static_cast<uint32_t>(indices.size());
+                newBatch.firstVertex = static_cast<uint32_t>(vertices.size() / subMesh.vertexSize);
+                newBatch.firstBone   = static_cast<uint32_t>(subMesh.bonePalette.size());
+                subMesh.boneBatches.push_back(newBatch);
+                batch = static_cast<uint32_t>(subMesh.boneBatches.size() - 1);
+            }
+            BoneBatch& current = subMesh.boneBatches.back();
+
+            // Add the new bones to the palette
+            for (unsigned int n = 0; n < numTriangleNodes; ++n)
+            {
+                uint32_t node = triangleNodes[n];
+                if (nodeBatch[node] == batch)  continue;
+                nodeBatch[node] = batch;
+                nodeSlot[node]  = current.numBones++;
+                subMesh.bonePalette.push_back(node);
+            }
+
+            // Copy vertices the batch doesn't have yet, with bone indices changed to palette slots. Zero weight
+            // influences use slot 0, which always exists
+            for (unsigned int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t v = subMesh.Index(i + corner);
+                if (vertexBatch[v] != batch)
+                {
+                    vertexBatch[v] = batch;
+                    vertexCopy[v]  = current.firstVertex + current.numVertices++;
+
+                    const unsigned char* vertex = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+                    std::size_t copy = vertices.size();
+                    vertices.insert(vertices.end(), vertex, vertex + subMesh.vertexSize);
+
+                    unsigned char* bones = vertices.data() + copy + subMesh.bonesOffset;
+                    const float* weights = reinterpret_cast<const float*>(bones + 4);
+                    for (unsigned int b = 0; b < 4; ++b)
+                    {
+                        bones[b] = (weights[b] == 0.0f) ? 0 : static_cast<unsigned char>(nodeSlot[vertexNodes[v * 4 + b]]);
+                    }
+                }
+                indices.push_back(vertexCopy[v]);
+            }
+            current.numIndices += 3;
+        }
+
+        // A batch whose triangles only have zero weights would have an empty palette, give it one bone so slot 0 exists
+        for (auto& emptyBatch : subMesh.boneBatches)
+        {
+            if (emptyBatch.numBones > 0)  continue;
+            emptyBatch.firstBone = static_cast<uint32_t>(subMesh.bonePalette.size());
+            emptyBatch.numBones  = 1;
+            subMesh.bonePalette.push_back(0);
+        }
+
+        // Replace the geometry with the batched copy
+        subMesh.numVertices = static_cast<uint32_t>(vertices.size() / subMesh.vertexSize);
+        subMesh.numIndices  = static_cast<uint32_t>(indices.size());
+        subMesh.vertexStorage = std::make_unique<unsigned char[]>(vertices.size());
+        subMesh.indexStorage  = std::make_unique<unsigned char[]>(indices.size() * sizeof(uint32_t));
+        std::copy(vertices.begin(), vertices.end(), subMesh.vertexStorage.get());
+        std::memcpy(subMesh.indexStorage.get(), indices.data(), indices.size() * sizeof(uint32_t));
+        subMesh.vertices = subMesh.vertexStorage.get();
+        subMesh.indices  = subMesh.indexStorage.get();
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Loading
+//--------------------------------------------------------------------------------------
+
+// Load a mesh: uses the cooked version of the file if it exists and is up to date, otherwise imports the file
+// with assimp and writes a new cooked file for next time (if writeCooked is true).
+// Will throw a std::runtime_error exception on failure
+void MeshData::Load(const std::string& fileName, bool requireTangents /*= false*/, bool writeCooked /*= true*/)
+{
+    std::string cookedFileName = CookedFileName(fileName, requireTangents);
+    if (LoadCooked(cookedFileName, fileName, requireTangents))  return;
+
+    Import(fileName, requireTangents);
+    if (writeCooked)
+    {
+        SaveCooked(cookedFileName, fileName, requireTangents); // Not an error if this fails (e.g. read-only folder), will just import again next time
+    }
+}
+
+
+// The name of the cooked file used for the given source file and import options
+std::string MeshData::CookedFileName(const std::string& fileName, bool requireTangents)
+{
+    return fileName + (requireTangents ? ".tangents.cmesh" : ".cmesh");
+}
+
+
+// Remove all data
+void MeshData::Clear()
+{
+    subMeshes.clear();
+    nodes.clear();
+    animations.clear();
+    hasBones = false;
+    bounds = AABB();
+    boundingSphere = BoundingSphere();
+    mCookedFile.Close();
+}
+
+
+// Import a mesh file with assimp (http://www.assimp.org/), ignoring any cooked file
+// Will throw a std::runtime_error exception on failure
+void MeshData::Import(const std::string& fileName, bool requireTangents /*= false*/, VertexPackingStats* packingStats /*= nullptr*/,
+                      std::vector<SubMeshOptimizationStats>* optimizationStats /*= nullptr*/)
+{
+    Clear();
+
+    Assimp::Importer importer;
+
+    // Flags for processing the mesh. Assimp provides a huge amount of control - right click any of these
+    // and "Peek Definition" to see documention above each constant
+    unsigned int assimpFlags = aiProcess_MakeLeftHanded |
+                               aiProcess_GenSmoothNormals |
+                               aiProcess_FixInfacingNormals |
+                               aiProcess_GenUVCoords |
+                               aiProcess_TransformUVCoords |
+                               aiProcess_FlipUVs |
+                               aiProcess_FlipWindingOrder |
+                               aiProcess_Triangulate |
+                               aiProcess_JoinIdenticalVertices |
+                               aiProcess_SortByPType |
+                               aiProcess_FindInvalidData |
+                               aiProcess_OptimizeMeshes |
+                               aiProcess_FindInstances |
+                               aiProcess_FindDegenerates |
+                               aiProcess_RemoveRedundantMaterials |
+                               aiProcess_Debone |
+                               aiProcess_LimitBoneWeights |
+                               aiProcess_RemoveComponent;
+
+    // Flags to specify what mesh data to ignore
+    int removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS |
+                           aiComponent_MATERIALS;
+
+    // Add / remove tangents as required by user
+    if (requireTangents)
+    {
+        assimpFlags |= aiProcess_CalcTangentSpace;
+    }
+    else
+    {
+        removeComponents |= aiComponent_TANGENTS_AND_BITANGENTS;
+    }
+
+    // Other miscellaneous settings
+    importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0f); // Smoothing angle for normals
+    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);  // Remove points and lines (keep triangles only)
+    importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);                 // Remove degenerate triangles
+    importer.SetPropertyBool(AI_CONFIG_PP_DB_ALL_OR_NONE, true);            // Default to removing bones/weights from meshes that don't need skinning
+
+	// Set maximum bones that can affect one vertex. There is no limit on the bones affecting a single mesh, meshes
+    // with more than the shader supports are split into batches after import (see SplitBonePalettes)
+    unsigned int maxBonesPerVertex = 4; // The shaders support 4 bones per verted (null bones are added if necessary)
+    importer.SetPropertyInteger(AI_CONFIG_PP_LBW_MAX_WEIGHTS, maxBonesPerVertex);
+
+    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removeComponents);
+
+    // Import mesh with assimp given above requirements - log output
+    const aiScene* scene;
+    {
+        ImportLogger logger;
+        scene = importer.ReadFile(fileName, assimpFlags);
+    }
+    if (scene == nullptr)  throw std::runtime_error("Error loading mesh (" + fileName + "). " + importer.GetErrorString());
+    if (scene->mNumMeshes == 0)  throw std::runtime_error("No usable geometry in mesh: " + fileName);
+
+
+    //-----------------------------------
+
+    //*********************************************************************//
+    // Read node hierachy - each node has a matrix and contains sub-meshes //
+
+    // Uses recursive helper functions to build node hierarchy
+    nodes.resize(CountNodes(scene->mRootNode));
+    ReadNodes(scene->mRootNode, 0, 0);
+
+    // Animation clips refer to nodes by name, so are read once the nodes are known
+    ReadAnimations(scene);
+
+
+
+    //******************************************//
+    // Read geometry - multiple parts supported //
+
+	hasBones = false;
+	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+        if (scene->mMeshes[m]->HasBones())  hasBones = true;
+
+
+    // A mesh is made of sub-meshes, each one can have a different material (texture)
+    // Import each sub-mesh in the file to seperate index / vertex data
+    subMeshes.resize(scene->mNumMeshes);
+    if (optimizationStats != nullptr)  optimizationStats->assign(scene->mNumMeshes, SubMeshOptimizationStats());
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        aiMesh* assimpMesh = scene->mMeshes[m];
+        std::string subMeshName = assimpMesh->mName.C_Str();
+        auto& subMesh = subMeshes[m]; // Short name for the submesh we're currently preparing - makes code below more readable
+
+
+        //-----------------------------------
+
+        // Check for presence of position and normal data. Tangents and UVs are optional.
+        auto& vertexElements = subMesh.layout;
+        unsigned int offset = 0;
+
+        if (!assimpMesh->HasPositions())  throw std::runtime_error("No position data for sub-mesh " + subMeshName + " in " + fileName);
+        subMesh.positionOffset = offset;
+        vertexElements.push_back( { "position", VertexElementFormat::Float3, subMesh.positionOffset } );
+        offset += 12;
+
+        if (!assimpMesh->HasNormals())  throw std::runtime_error("No normal data for sub-mesh " + subMeshName + " in " + fileName);
+        subMesh.normalOffset = offset;
+        vertexElements.push_back( { "normal", VertexElementFormat::Float3, subMesh.normalOffset } );
+        offset += 12;
+
+        if (requireTangents)
+        {
+            if (!assimpMesh->HasTangentsAndBitangents())  throw std::runtime_error("No tangent data for sub-mesh " + subMeshName + " in " + fileName);
+            subMesh.tangentOffset = offset;
+            vertexElements.push_back( { "tangent", VertexElementFormat::Float3, subMesh.tangentOffset } );
+            offset += 12;
+        }
+
+        if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
+        {
+            if (assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
+            subMesh.uvOffset = offset;
+            vertexElements.push_back( { "uv", VertexElementFormat::Float2, subMesh.uvOffset } );
+            offset += 8;
+        }
+
+        if (hasBones)
+        {
+            subMesh.bonesOffset = offset;
+            vertexElements.push_back( { "bones"  , VertexElementFormat::UByte4, subMesh.bonesOffset     } );
+            offset += 4;
+            vertexElements.push_back( { "weights", VertexElementFormat::Float4, subMesh.bonesOffset + 4 } );
+            offset += 16;
+        }
+
+        subMesh.vertexSize = offset;
+
+
+        //-----------------------------------
+
+        // Create CPU-side buffers to hold current mesh data - exact content is flexible so can't use a structure for a vertex - so just a block of bytes
+        subMesh.numVertices = assimpMesh->mNumVertices;
+        subMesh.numIndices  = assimpMesh->mNumFaces * 3;
+        subMesh.vertexStorage = std::make_unique<unsigned char[]>(subMesh.numVertices * subMesh.vertexSize);
+        subMesh.indexStorage  = std::make_unique<unsigned char[]>(subMesh.numIndices * sizeof(uint32_t)); // Using 32 bit indexes (4 bytes) for each index until packed
+        unsigned char* vertices = subMesh.vertexStorage.get();
+
+
+        //-----------------------------------
+
+        // Copy mesh data from assimp to our CPU-side vertex buffer
+
+        CVector3* assimpPosition = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
+        unsigned char* position = vertices + subMesh.positionOffset;
+        unsigned char* positionEnd = position + subMesh.numVertices * subMesh.vertexSize;
+        while (position != positionEnd)
+        {
+            *(CVector3*)position = *assimpPosition;
+            position += subMesh.vertexSize;
+            ++assimpPosition;
+        }
+
+        CVector3* assimpNormal = reinterpret_cast<CVector3*>(assimpMesh->mNormals);
+        unsigned char* normal = vertices + subMesh.normalOffset;
+        unsigned char* normalEnd = normal + subMesh.numVertices * subMesh.vertexSize;
+        while (normal != normalEnd)
+        {
+            *(CVector3*)normal = *assimpNormal;
+            normal += subMesh.vertexSize;
+            ++assimpNormal;
+        }
+
+        if (requireTangents)
+        {
+            CVector3* assimpTangent = reinterpret_cast<CVector3*>(assimpMesh->mTangents);
+            unsigned char* tangent =  vertices + subMesh.tangentOffset;
+            unsigned char* tangentEnd = tangent + subMesh.numVertices * subMesh.vertexSize;
+            while (tangent != tangentEnd)
+            {
+                *(CVector3*)tangent = *assimpTangent;
+                tangent += subMesh.vertexSize;
+                ++assimpTangent;
+            }
+        }
+
+        if (subMesh.uvOffset != SubMeshData::NO_ELEMENT)
+        {
+            aiVector3D* assimpUV = assimpMesh->mTextureCoords[0];
+            unsigned char* uv = vertices + subMesh.uvOffset;
+            unsigned char* uvEnd = uv + subMesh.numVertices * subMesh.vertexSize;
+            while (uv != uvEnd)
+            {
+                *(CVector2*)uv = CVector2(assimpUV->x, assimpUV->y);
+                uv += subMesh.vertexSize;
+                ++assimpUV;
+            }
+        }
+
+
+		// Node index of each bone influence, four per vertex. The vertices get indexes into a bone palette when the
+		// sub-mesh is split into batches below
+		std::vector<uint32_t> vertexNodes;
+		if (hasBones)
+		{
+			vertexNodes.assign(subMesh.numVertices * 4, 0);
+			if (assimpMesh->HasBones())
+			{
+				// Set all bones and weights to 0 to start with
+				unsigned char* bones = vertices + subMesh.bonesOffset;
+				unsigned char* bonesEnd = bones + subMesh.numVertices * subMesh.vertexSize;
+				while (bones != bonesEnd)
+				{
+					memset(bones, 0, 20);
+					bones += subMesh.vertexSize;
+				}
+
+				// Go through each assimp bone
+				bones = vertices + subMesh.bonesOffset;
+				for (unsigned int i = 0; i < assimpMesh->mNumBones; ++i)
+				{
+					// Get offset matrix for the bone (transform from skinned mesh root to bone root
+					aiBone* assimpBone = assimpMesh->mBones[i];
+					std::string boneName = assimpBone->mName.C_Str();
+                    unsigned int nodeIndex;
+					for (nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+					{
+						if (nodes[nodeIndex].name == boneName)
+						{
+							nodes[nodeIndex].offsetMatrix.SetValues(&assimpBone->mOffsetMatrix.a1);
+							nodes[nodeIndex].offsetMatrix.Transpose(); // Assimp stores matrices differently to this app
+							break;
+						}
+					}
+                    if (nodeIndex == nodes.size())  throw std::runtime_error("Bone with no matching node in " + fileName);
+
+					// Go through each weight of the bone and update the vertex it influences
+					// Find the first 0 weight on that vertex and put the new influence / weight there.
+					// A vertex can only have up to 4 influences
+					for (unsigned int j = 0; j < assimpBone->mNumWeights; ++j)
+					{
+						unsigned int vertexIndex = assimpBone->mWeights[j].mVertexId;
+						float* weight = (float*)(bones + vertexIndex * subMesh.vertexSize + 4);
+						unsigned int influence = 0;
+						while (weight[influence] != 0.0f && influence != 3)
+						{
+							++influence;
+						}
+						if (weight[influence] == 0.0f)
+						{
+							vertexNodes[vertexIndex * 4 + influence] = nodeIndex;
+							weight[influence] = assimpBone->mWeights[j].mWeight;
+						}
+					}
+				}
+			}
+			else
+			{
+				// In a mesh that uses skinning any sub-meshes that don't contain bones are given bones so the whole mesh can use one shader
+				unsigned int subMeshNode = 0;
+				for (unsigned int nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+				{
+					for (auto& subMeshIndex : nodes[nodeIndex].subMeshes)
+					{
+						if (subMeshIndex == m)
+							subMeshNode = nodeIndex;
+					}
+				}
+
+				unsigned char* bones = vertices + subMesh.bonesOffset;
+				unsigned char* bonesEnd = bones + subMesh.numVertices * subMesh.vertexSize;
+				while (bones != bonesEnd)
+				{
+					memset(bones, 0, 20);
+					*(float*)(bones + 4) = 1.0f;
+					bones += subMesh.vertexSize;
+				}
+				for (unsigned int v = 0; v < subMesh.numVertices; ++v)  vertexNodes[v * 4] = subMeshNode;
+
+			}
+		}
+
+
+
+        //-----------------------------------
+
+        // Copy face data from assimp to our CPU-side index buffer
+        if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
+
+        uint32_t* index = reinterpret_cast<uint32_t*>(subMesh.indexStorage.get());
+        for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
+        {
+            *index++ = assimpMesh->mFaces[face].mIndices[0];
+            *index++ = assimpMesh->mFaces[face].mIndices[1];
+            *index++ = assimpMesh->mFaces[face].mIndices[2];
+        }
+
+        subMesh.vertices = subMesh.vertexStorage.get();
+        subMesh.indices  = subMesh.indexStorage.get();
+
+        // Reorder the triangles for the GPU's vertex cache and to reduce overdraw (see MeshOptimizer.h). Done before
+        // the bone palette split, which keeps the triangle order
+        if (optimizationStats != nullptr)  (*optimizationStats)[m].before = AnalyzeGeometry(subMesh);
+        unsigned int clusters = OptimizeTriangleOrder(subMesh);
+
+        // Split the triangles of rigid geometry into meshlets that can be culled separately (see Meshlets.h). The
+        // meshlets are ranges of the order above, which is kept for the passes that draw the sub-mesh whole
+        if (!hasBones)  BuildMeshlets(subMesh);
+
+        // Split skinned geometry into batches that fit in the shader's bone palette
+        if (hasBones)
+        {
+            SplitBonePalettes(subMesh, vertexNodes, static_cast<unsigned int>(nodes.size()));
+        }
+
+        // Put the vertices in the order the triangles use them. The bone palette split already does this, so this only
+        // changes sub-meshes without bones
+        OptimizeVertexFetch(subMesh);
+
+        if (optimizationStats != nullptr)
+        {
+            SubMeshOptimizationStats& stats = (*optimizationStats)[m];
+            stats.triangles = subMesh.numIndices / 3;
+            stats.vertices  = assimpMesh->mNumVertices;
+            stats.clusters  = clusters;
+            stats.after     = AnalyzeGeometry(subMesh);
+        }
+
+        // Simplified levels of detail, built from the final triangles and vertices so they share the vertices and bone
+        // batches above
+        GenerateLods(subMesh);
+    }
+
+    CalculateBounds();
+
+    // The float vertices and 32-bit indices above are easy to work with, but the GPU and cooked file get them in
+    // compact formats. Done last as the bone splitting and bounds above read the float weights
+    for (auto& subMesh : subMeshes)  PackSubMesh(subMesh, packingStats);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cooked files
+//--------------------------------------------------------------------------------------
+
+// Write the current data to a cooked file, recording the timestamp of the given source file. Returns false on failure
+bool MeshData::SaveCooked(const std::string& cookedFileName, const std::string& sourceFileName, bool requireTangents) const
+{
+    CookedHeader header = {};
+    header.magic = COOKED_MAGIC;
+    header.version = COOKED_VERSION;
+    if (!GetFileInfo(sourceFileName, header.sourceSize, header.sourceTime))  return false;
+    header.requireTangents = requireTangents ? 1 : 0;
+    header.hasBones = hasBones ? 1 : 0;
+    header.numNodes = static_cast<uint32_t>(nodes.size());
+    header.numSubMeshes = static_cast<uint32_t>(subMeshes.size());
+    header.numAnimations = static_cast<uint32_t>(animations.size());
+    WriteBounds(bounds, boundingSphere, header.bounds, header.boundingSphere);
+
+    CookedWriter writer;
+    writer.Write(header);
+
+    // Node table
+    for (auto& node : nodes)
+    {
+        CookedNode cookedNode;
+        std::memcpy(cookedNode.defaultMatrix, &node.defaultMatrix.e00, sizeof(cookedNode.defaultMatrix));
+        std::memcpy(cookedNode.offsetMatrix,  &node.offsetMatrix.e00,  sizeof(cookedNode.offsetMatrix));
+        cookedNode.parentIndex  = node.parentIndex;
+        cookedNode.numChildren  = static_cast<uint32_t>(node.childNodes.size());
+        cookedNode.numSubMeshes = static_cast<uint32_t>(node.subMeshes.size());
+        cookedNode.nameLength   = static_cast<uint32_t>(node.name.size());
+        WriteBounds(node.bounds, node.boundingSphere, cookedNode.bounds, cookedNode.boundingSphere);
+        writer.Write(cookedNode);
+        for (auto child : node.childNodes)      writer.Write(static_cast<uint32_t>(child));
+        for (auto subMesh : node.subMeshes)     writer.Write(static_cast<uint32_t>(subMesh));
+        writer.Write(node.name.data(), node.name.size());
+        writer.Align(4);
+    }
+
+    // Sub-mesh table - data offsets are filled in when the data is written below
+    std::vector<size_t> subMeshPositions;
+    for (auto& subMesh : subMeshes)
+    {
+        CookedSubMesh cookedSubMesh = {};
+        cookedSubMesh.vertexSize     = subMesh.vertexSize;
+        cookedSubMesh.numVertices    = subMesh.numVertices;
+        cookedSubMesh.numIndices     = subMesh.numIndices;
+        cookedSubMesh.numLodIndices  = subMesh.numLodIndices;
+        cookedSubMesh.numElements    = static_cast<uint32_t>(subMesh.layout.size());
+        cookedSubMesh.positionOffset = subMesh.positionOffset;
+        cookedSubMesh.normalOffset   = subMesh.normalOffset;
+        cookedSubMesh.tangentOffset  = subMesh.tangentOffset;
+        cookedSubMesh.uvOffset       = subMesh.uvOffset;
+        cookedSubMesh.bonesOffset    = subMesh.bonesOffset;
+        cookedSubMesh.numBoneBatches  = static_cast<uint32_t>(subMesh.boneBatches.size());
+        cookedSubMesh.numPaletteBones = static_cast<uint32_t>(subMesh.bonePalette.size());
+        cookedSubMesh.numLods         = static_cast<uint32_t>(subMesh.lods.size());
+        cookedSubMesh.numLodBatches   = static_cast<uint32_t>(subMesh.lodBatches.size());
+        cookedSubMesh.indexSize       = subMesh.indexSize;
+        cookedSubMesh.numMeshlets     = static_cast<uint32_t>(subMesh.meshlets.size());
+        subMeshPositions.push_back(writer.Position());
+        writer.Write(cookedSubMesh);
+        writer.Write(subMesh.layout.data(), subMesh.layout.size() * sizeof(VertexElement));
+        writer.Write(subMesh.boneBatches.data(), subMesh.boneBatches.size() * sizeof(BoneBatch));
+        writer.Write(subMesh.bonePalette.data(), subMesh.bonePalette.size() * sizeof(uint32_t));
+        writer.Write(subMesh.lods.data(), subMesh.lods.size() * sizeof(LodLevel));
+        writer.Write(subMesh.lodBatches.data(), subMesh.lodBatches.size() * sizeof(BoneBatch));
+        writer.Write(subMesh.meshlets.data(), subMesh.meshlets.size() * sizeof(Meshlet));
+    }
+
+    // Animation clips
+    for (auto& clip : animations)
+    {
+        CookedAnimation cookedAnimation;
+        cookedAnimation.duration        = clip.duration;
+        cookedAnimation.numTracks       = static_cast<uint32_t>(clip.tracks.size());
+        cookedAnimation.numTranslations = static_cast<uint32_t>(clip.translations.times.size());
+        cookedAnimation.numRotations    = static_cast<uint32_t>(clip.rotations.times.size());
+        cookedAnimation.numScales       = static_cast<uint32_t>(clip.scales.times.size());
+        cookedAnimation.nameLength      = static_cast<uint32_t>(clip.name.size());
+        writer.Write(cookedAnimation);
+        writer.Write(clip.tracks.data(), clip.tracks.size() * sizeof(AnimationTrack));
+        for (const AnimationKeys* keys : { &clip.translations, &clip.rotations, &clip.scales })
+        {
+            int numComponents = (keys == &clip.rotations) ? 4 : 3;
+            writer.Write(keys->times.data(), keys->times.size() * sizeof(float));
+            for (int c = 0; c < numComponents; ++c)  writer.Write(keys->values[c].data(), keys->values[c].size() * sizeof(float));
+        }
+        writer.Write(clip.name.data(), clip.name.size());
+        writer.Align(4);
+    }
+
+    // Vertex and index blobs, aligned so they can be used directly from the memory mapped file
+    for (unsigned int i = 0; i < subMeshes.size(); ++i)
+    {
+        auto& subMesh = subMeshes[i];
+        CookedSubMesh cookedSubMesh;
+        std::memcpy(&cookedSubMesh, writer.At(subMeshPositions[i]), sizeof(cookedSubMesh));
+
+        writer.Align(16);
+        cookedSubMesh.vertexDataOffset = writer.Position();
+        writer.Write(subMesh.vertices, subMesh.numVertices * subMesh.vertexSize);
+
+        writer.Align(16);
+        cookedSubMesh.indexDataOffset = writer.Position();
+        writer.Write(subMesh.indices, subMesh.TotalIndices() * subMesh.indexSize);
+
+        std::memcpy(writer.At(subMeshPositions[i]), &cookedSubMesh, sizeof(cookedSubMesh));
+    }
+
+    // Write to a temporary file then rename, so a partly written file is never picked up as valid
+    std::string tempFileName = cookedFileName + ".tmp";
+    FILE* file = std::fopen(tempFileName.c_str(), "wb");
+    if (file == nullptr)  return false;
+    bool written = std::fwrite(writer.Buffer().data(), 1, writer.Buffer().size(), file) == writer.Buffer().size();
+    written = (std::fclose(file) == 0) && written;
+    if (!written)
+    {
+        std::remove(tempFileName.c_str());
+        return false;
+    }
+    std::remove(cookedFileName.c_str());
+    return std::rename(tempFileName.c_str(), cookedFileName.c_str()) == 0;
+}
+
+
+// Load a cooked mesh file that was created from the given source file. The file is memory mapped and the vertex
+// and index data used in place. Returns false if the cooked file is missing, from an older version of this code,
+// older than the source file (stale) or fails any check on its contents (corrupt), so Load imports the source file
+// instead. The mesh data is left empty in that case
+bool MeshData::LoadCooked(const std::string& cookedFileName, const std::string& sourceFileName, bool requireTangents)
+{
+    Clear();
+
+    MappedFile file;
+    if (!file.Open(cookedFileName))  return false;
+
+    CookedReader reader(file.Data(), file.Size());
+    CookedHeader header;
+    if (!reader.Read(header) || header.magic != COOKED_MAGIC || header.version != COOKED_VERSION ||
+        header.requireTangents != (requireTangents ? 1u : 0u))
+    {
+        return false;
+    }
+
+    // Stale if the source file has changed since cooking. If the source file is missing (e.g. only cooked files are
+    // distributed) then the cooked file is used as-is
+    uint64_t sourceSize, sourceTime;
+    if (GetFileInfo(sourceFileName, sourceSize, sourceTime) &&
+        (sourceSize != header.sourceSize || sourceTime != header.sourceTime))
+    {
+        return false;
+    }
+
+    // Counts are checked against the file size before anything is sized from them. A mesh always has a root node and
+    // at least one sub-mesh
+    if (header.numNodes == 0 || header.numSubMeshes == 0 || !reader.CanHold(header.numNodes, sizeof(CookedNode)))
+    {
+        return false;
+    }
+
+    // Node table. Nodes are in depth-first order, so a node's parent comes before it and its children after it.
+    // The matrix functions rely on this and use the indexes without further checks
+    nodes.resize(header.numNodes);
+    for (unsigned int nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+    {
+        auto& node = nodes[nodeIndex];
+        CookedNode cookedNode;
+        if (!reader.Read(cookedNode))  break;
+        if (nodeIndex == 0 ? cookedNode.parentIndex != 0 : cookedNode.parentIndex >= nodeIndex)
+        {
+            reader.Fail();
+            break;
+        }
+        node.defaultMatrix.SetValues(cookedNode.defaultMatrix);
+        node.offsetMatrix.SetValues(cookedNode.offsetMatrix);
+        node.parentIndex = cookedNode.parentIndex;
+        ReadBounds(cookedNode.bounds, cookedNode.boundingSphere, node.bounds, node.boundingSphere);
+
+        const unsigned char* children  = reader.ReadBytes(cookedNode.numChildren  * sizeof(uint32_t));
+        const unsigned char* subMeshes = reader.ReadBytes(cookedNode.numSubMeshes * sizeof(uint32_t));
+        const unsigned char* name      = reader.ReadBytes(cookedNode.nameLength);
+        reader.Align(4);
+        if (reader.Failed())  break;
+
+        node.childNodes.resize(cookedNode.numChildren);
+        node.subMeshes.resize(cookedNode.numSubMeshes);
+        for (unsigned int i = 0; i < cookedNode.numChildren;  ++i)  node.childNodes[i] = reinterpret_cast<const uint32_t*>(children)[i];
+        for (unsigned int i = 0; i < cookedNode.numSubMeshes; ++i)  node.subMeshes[i]  = reinterpret_cast<const uint32_t*>(subMeshes)[i];
+        node.name.assign(reinterpret_cast<const char*>(name), cookedNode.nameLength);
+
+        for (auto subMesh : node.subMeshes)
+        {
+            if (subMesh >= header.numSubMeshes)  reader.Fail();
+        }
+        if (reader.Failed())  break;
+    }
+
+    // Children must be later nodes that name this one as their parent, which also rules out loops
+    for (unsigned int nodeIndex = 0; nodeIndex < nodes.size() && !reader.Failed(); ++nodeIndex)
+    {
+        for (auto child : nodes[nodeIndex].childNodes)
+        {
+            if (child <= nodeIndex || child >= nodes.size() || nodes[child].parentIndex != nodeIndex)  reader.Fail();
+        }
+    }
+
+    // Sub-meshes - vertex and index data are left in the mapped file
+    if (reader.Failed() || !reader.CanHold(header.numSubMeshes, sizeof(CookedSubMesh)))
+    {
+        Clear();
+        return false;
+    }
+    subMeshes.resize(header.numSubMeshes);
+    for (auto& subMesh : subMeshes)
+    {
+        CookedSubMesh cookedSubMesh;
+        if (!reader.Read(cookedSubMesh))  break;
+        const unsigned char* layout  = reader.ReadBytes(cookedSubMesh.numElements * sizeof(VertexElement));
+        const unsigned char* batches = reader.ReadBytes(cookedSubMesh.numBoneBatches * sizeof(BoneBatch));
+        const unsigned char* palette = reader.ReadBytes(cookedSubMesh.numPaletteBones * sizeof(uint32_t));
+        const unsigned char* lods    = reader.ReadBytes(cookedSubMesh.numLods * sizeof(LodLevel));
+        const unsigned char* lodBatches = reader.ReadBytes(cookedSubMesh.numLodBatches * sizeof(BoneBatch));
+        const unsigned char* meshlets   = reader.ReadBytes(cookedSubMesh.numMeshlets * sizeof(Meshlet));
+        if (reader.Failed())  break;
+
+        uint64_t totalIndices = static_cast<uint64_t>(cookedSubMesh.numIndices) + cookedSubMesh.numLodIndices;
+        uint64_t vertexBytes  = static_cast<uint64_t>(cookedSubMesh.numVertices) * cookedSubMesh.vertexSize;
+        uint64_t indexBytes   = totalIndices * cookedSubMesh.indexSize;
+        if ((cookedSubMesh.indexSize != 2 && cookedSubMesh.indexSize != 4) || totalIndices > 0xffffffffu ||
+            !reader.Contains(cookedSubMesh.vertexDataOffset, vertexBytes) || !reader.Contains(cookedSubMesh.indexDataOffset, indexBytes) ||
+            cookedSubMesh.indexDataOffset % cookedSubMesh.indexSize != 0 ||
+            (cookedSubMesh.bonesOffset != SubMeshData::NO_ELEMENT) != (header.hasBones != 0))
+        {
+            reader.Fail();
+            break;
+        }
+
+        subMesh.vertexSize     = cookedSubMesh.vertexSize;
+        subMesh.numVertices    = cookedSubMesh.numVertices;
+        subMesh.numIndices     = cookedSubMesh.numIndices;
+        subMesh.numLodIndices  = cookedSubMesh.numLodIndices;
+        subMesh.indexSize      = cookedSubMesh.indexSize;
+        subMesh.positionOffset = cookedSubMesh.positionOffset;
+        subMesh.normalOffset   = cookedSubMesh.normalOffset;
+        subMesh.tangentOffset  = cookedSubMesh.tangentOffset;
+        subMesh.uvOffset       = cookedSubMesh.uvOffset;
+        subMesh.bonesOffset    = cookedSubMesh.bonesOffset;
+        subMesh.layout.resize(cookedSubMesh.numElements);
+        std::memcpy(subMesh.layout.data(), layout, cookedSubMesh.numElements * sizeof(VertexElement));
+        for (auto& element : subMesh.layout)  element.semantic[sizeof(element.semantic) - 1] = '\0';
+
+        // Bone batches are used without further checks when rendering, so check they lie within the sub-mesh
+        subMesh.boneBatches.resize(cookedSubMesh.numBoneBatches);
+        subMesh.bonePalette.resize(cookedSubMesh.numPaletteBones);
+        std::memcpy(subMesh.boneBatches.data(), batches, cookedSubMesh.numBoneBatches * sizeof(BoneBatch));
+        std::memcpy(subMesh.bonePalette.data(), palette, cookedSubMesh.numPaletteBones * sizeof(uint32_t));
+        bool validBatches = true;
+        for (auto& batch : subMesh.boneBatches)
+        {
+            validBatches = validBatches && batch.numBones > 0 && batch.numBones <= BONE_PALETTE_SIZE &&
+                           batch.firstIndex  <= subMesh.numIndices  && batch.numIndices  <= subMesh.numIndices  - batch.firstIndex  &&
+                           batch.firstVertex <= subMesh.numVertices && batch.numVertices <= subMesh.numVertices - batch.firstVertex &&
+                           batch.firstBone   <= cookedSubMesh.numPaletteBones && batch.numBones <= cookedSubMesh.numPaletteBones - batch.firstBone;
+        }
+        for (auto node : subMesh.bonePalette)  validBatches = validBatches && node < nodes.size();
+
+        // Levels of detail likewise, each level's indices (and its copy of the bone batches) after the full detail ones
+        subMesh.lods.resize(cookedSubMesh.numLods);
+        subMesh.lodBatches.resize(cookedSubMesh.numLodBatches);
+        std::memcpy(subMesh.lods.data(), lods, cookedSubMesh.numLods * sizeof(LodLevel));
+        std::memcpy(subMesh.lodBatches.data(), lodBatches, cookedSubMesh.numLodBatches * sizeof(BoneBatch));
+        validBatches = validBatches && subMesh.lodBatches.size() == subMesh.lods.size() * subMesh.boneBatches.size();
+        for (auto& lod : subMesh.lods)
+        {
+            validBatches = validBatches && lod.firstIndex >= subMesh.numIndices && lod.firstIndex <= totalIndices &&
+                           lod.numIndices <= totalIndices - lod.firstIndex &&
+                           lod.firstBatch <= subMesh.lodBatches.size() - subMesh.boneBatches.size();
+        }
+        for (unsigned int b = 0; validBatches && b < subMesh.lodBatches.size(); ++b)
+        {
+            // Each level's batches use the same vertices and palette as the full detail batch they copy
+            const BoneBatch& batch = subMesh.lodBatches[b];
+            const BoneBatch& fullDetail = subMesh.boneBatches[b % subMesh.boneBatches.size()];
+            validBatches = batch.firstIndex  <= totalIndices && batch.numIndices <= totalIndices - batch.firstIndex &&
+                           batch.firstVertex == fullDetail.firstVertex && batch.numVertices == fullDetail.numVertices &&
+                           batch.firstBone   == fullDetail.firstBone   && batch.numBones    == fullDetail.numBones;
+        }
+
+        // Meshlets are drawn as ranges of the full detail indices
+        subMesh.meshlets.resize(cookedSubMesh.numMeshlets);
+        std::memcpy(subMesh.meshlets.data(), meshlets, cookedSubMesh.numMeshlets * sizeof(Meshlet));
+        for (auto& meshlet : subMesh.meshlets)
+        {
+            validBatches = validBatches && meshlet.firstIndex <= subMesh.numIndices && meshlet.numIndices <= subMesh.numIndices - meshlet.firstIndex;
+        }
+        if (!validBatches || !ValidCookedLayout(subMesh))
+        {
+            reader.Fail();
+            break;
+        }
+
+        subMesh.vertices = file.Data() + cookedSubMesh.vertexDataOffset;
+        subMesh.indices  = file.Data() + cookedSubMesh.indexDataOffset;
+        if (!ValidCookedIndices(subMesh))
+        {
+            reader.Fail();
+            break;
+        }
+    }
+
+    // Animation clips - copied out of the file as they are small
+    if (!reader.CanHold(header.numAnimations, sizeof(CookedAnimation)))  reader.Fail();
+    animations.resize(reader.Failed() ? 0 : header.numAnimations);
+    for (auto& clip : animations)
+    {
+        CookedAnimation cookedAnimation;
+        if (!reader.Read(cookedAnimation))  break;
+        const unsigned char* tracks = reader.ReadBytes(cookedAnimation.numTracks * sizeof(AnimationTrack));
+        if (tracks == nullptr)  break;
+        clip.duration = cookedAnimation.duration;
+        clip.tracks.resize(cookedAnimation.numTracks);
+        std::memcpy(clip.tracks.data(), tracks, cookedAnimation.numTracks * sizeof(AnimationTrack));
+
+        AnimationKeys* keyArrays[]  = { &clip.translations, &clip.rotations, &clip.scales };
+        uint32_t       numKeys[]    = { cookedAnimation.numTranslations, cookedAnimation.numRotations, cookedAnimation.numScales };
+        for (int i = 0; i < 3; ++i)
+        {
+            int numArrays = (i == 1) ? 5 : 4; // Times then x, y, z (and w for rotations)
+            for (int a = 0; a < numArrays; ++a)
+            {
+                std::vector<float>& values = (a == 0) ? keyArrays[i]->times : keyArrays[i]->values[a - 1];
+                const unsigned char* data = reader.ReadBytes(numKeys[i] * sizeof(float));
+                if (data == nullptr)  break;
+                values.resize(numKeys[i]);
+                std::memcpy(values.data(), data, numKeys[i] * sizeof(float));
+            }
+        }
+
+        const unsigned char* name = reader.ReadBytes(cookedAnimation.nameLength);
+        reader.Align(4);
+        if (reader.Failed())  break;
+        clip.name.assign(reinterpret_cast<const char*>(name), cookedAnimation.nameLength);
+
+        // Key ranges and node indexes are used without further checks when sampling, so check them here
+        for (auto& track : clip.tracks)
+        {
+            if (track.node >= nodes.size() || track.numTranslations == 0 || track.numRotations == 0 || track.numScales == 0 ||
+                track.firstTranslation > numKeys[0] || track.numTranslations > numKeys[0] - track.firstTranslation ||
+                track.firstRotation    > numKeys[1] || track.numRotations    > numKeys[1] - track.firstRotation    ||
+                track.firstScale       > numKeys[2] || track.numScales       > numKeys[2] - track.firstScale)
+            {
+                reader.Fail();
+                break;
+            }
+        }
+        if (reader.Failed())  break;
+    }
+
+    if (reader.Failed())
+    {
+        Clear();
+        return false;
+    }
+
+    hasBones = (header.hasBones != 0);
+    ReadBounds(header.bounds, header.boundingSphere, bounds, boundingSphere);
+    mCookedFile = std::move(file);
+    return true;
+}
+
+
+// Offline cook step: import the given mesh file with assimp and write its cooked file, even if the cooked file
+// is already up to date. Returns false on failure and fills in the error message
+bool CookMesh(const std::string& fileName, bool requireTangents, std::string& error)
+{
+    try
+    {
+        MeshData data;
+        data.Import(fileName, requireTangents);
+        if (!data.SaveCooked(MeshData::CookedFileName(fileName, requireTangents), fileName, requireTangents))
+        {
+            error = "Error writing cooked mesh for " + fileName;
+            return false;
+        }
+    }
+    catch (const std::runtime_error& e)
+    {
+        error = e.what();
+        return false;
+    }
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Benchmark
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    // Check cooked mesh data matches the data it was cooked from: the same nodes, and sub-meshes with the same layout
+    // and identical vertex and index data
+    bool SameMeshData(const MeshData& a, const MeshData& b)
+    {
+        if (a.nodes.size() != b.nodes.size() || a.subMeshes.size() != b.subMeshes.size() || a.hasBones != b.hasBones ||
+            a.animations.size() != b.animations.size())  return false;
+
+        for (unsigned int i = 0; i < a.nodes.size(); ++i)
+        {
+            if (a.nodes[i].parentIndex != b.nodes[i].parentIndex || a.nodes[i].subMeshes != b.nodes[i].subMeshes)  return false;
+        }
+        for (unsigned int i = 0; i < a.subMeshes.size(); ++i)
+        {
+            const SubMeshData& x = a.subMeshes[i];
+            const SubMeshData& y = b.subMeshes[i];
+            if (x.vertexSize != y.vertexSize || x.numVertices != y.numVertices || x.TotalIndices() != y.TotalIndices() ||
+                x.indexSize != y.indexSize || x.layout.size() != y.layout.size() || x.boneBatches.size() != y.boneBatches.size() ||
+                x.lods.size() != y.lods.size() || x.meshlets.size() != y.meshlets.size())  return false;
+            if (std::memcmp(x.vertices, y.vertices, static_cast<std::size_t>(x.numVertices) * x.vertexSize) != 0 ||
+                std::memcmp(x.indices,  y.indices,  static_cast<std::size_t>(x.TotalIndices()) * x.indexSize) != 0)  return false;
+        }
+        return true;
+    }
+}
+
+
+// Time loading each of the given mesh files by importing it with assimp and from its cooked file (the best of several
+// runs of each, the cooked file is written first if needed so it is in the OS file cache). Also checks the cooked data
+// matches the import. Returns the results as a text table
+std::string BenchmarkMeshLoading(const std::vector<std::string>& fileNames, unsigned int iterations /*= 3*/)
+{
+    typedef std::chrono::duration<double, std::milli> Milliseconds;
+    if (iterations == 0)  iterations = 1;
+
+    std::string report = "Mesh loading: assimp import against cooked file, best of " + std::to_string(iterations) + " runs\n";
+    report += "  Assimp ms  Cooked ms  Speed-up  Cooked KB  Matches  File\n";
+    char line[512];
+
+    double importSum = 0, cookedSum = 0;
+    for (auto& fileName : fileNames)
+    {
+        MeshData imported, cooked;
+        double importTime = 0, cookedTime = 0;
+        bool loadedCooked = true;
+        std::string cookedFileName = MeshData::CookedFileName(fileName, false);
+        try
+        {
+            for (unsigned int i = 0; i < iterations; ++i)
+            {
+                auto start = std::chrono::steady_clock::now();
+                imported.Import(fileName);
+                Milliseconds time = std::chrono::steady_clock::now() - start;
+                importTime = (i == 0) ? time.count() : std::min(importTime, time.count());
+            }
+
+            if (!cooked.LoadCooked(cookedFileName, fileName, false))  imported.SaveCooked(cookedFileName, fileName, false);
+            for (unsigned int i = 0; i < iterations && loadedCooked; ++i)
+            {
+                auto start = std::chrono::steady_clock::now();
+                loadedCooked = cooked.LoadCooked(cookedFileName, fileName, false);
+                Milliseconds time = std::chrono::steady_clock::now() - start;
+                cookedTime = (i == 0) ? time.count() : std::min(cookedTime, time.count());
+            }
+        }
+        catch (const std::exception& e)
+        {
+            report += std::string("  ") + e.what() + "\n";
+            continue;
+        }
+        if (!loadedCooked)
+        {
+            report += "  Error writing or reading cooked mesh for " + fileName + "\n";
+            continue;
+        }
+
+        uint64_t cookedSize = 0, cookedModified = 0;
+        GetFileInfo(cookedFileName, cookedSize, cookedModified);
+        std::snprintf(line, sizeof(line), "  %9.2f  %9.3f  %7.0fx  %9.1f  %7s  %s\n", importTime, cookedTime,
+                      (cookedTime > 0) ? importTime / cookedTime : 0.0, cookedSize / 1024.0,
+                      SameMeshData(imported, cooked) ? "yes" : "NO", fileName.c_str());
+        report += line;
+        importSum += importTime;
+        cookedSum += cookedTime;
+    }
+
+    std::snprintf(line, sizeof(line), "  %9.2f  %9.3f  %7.0fx             Total\n", importSum, cookedSum,
+                  (cookedSum > 0) ? importSum / cookedSum : 0.0);
+    report += line;
+    return report;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Count the number of nodes with given assimp node as root - recursive
+unsigned int MeshData::CountNodes(const aiNode* assimpNode)
+{
+    unsigned int count = 1;
+    for (unsigned int child = 0; child < assimpNode->mNumChildren; ++child)
+        count += CountNodes(assimpNode->mChildren[child]);
+    return count;
+}
+
+
+// Help build the array of nodes from the assimp data - recursive
+unsigned int MeshData::ReadNodes(const aiNode* assimpNode, unsigned int nodeIndex, unsigned int parentIndex)
+{
+    auto& node = nodes[nodeIndex];
+    node.parentIndex = parentIndex;
+    unsigned int thisIndex = nodeIndex;
+    ++nodeIndex;
+
+    node.name = assimpNode->mName.C_Str();
+
+    node.defaultMatrix.SetValues(const_cast<float*>(&assimpNode->mTransformation.a1));
+    node.defaultMatrix.Transpose(); // Assimp stores matrices differently to this app
+
+    // Nodes that are used as bones have their offset matrix set when the bones are read
+    node.offsetMatrix = MatrixIdentity();
+
+    node.subMeshes.resize(assimpNode->mNumMeshes);
+    for (unsigned int i = 0; i < assimpNode->mNumMeshes; ++i)
+    {
+        node.subMeshes[i] = assimpNode->mMeshes[i];
+    }
+
+    node.childNodes.resize(assimpNode->mNumChildren);
+    for (unsigned int i = 0; i < assimpNode->mNumChildren; ++i)
+    {
+        node.childNodes[i] = nodeIndex;
+        nodeIndex = ReadNodes(assimpNode->mChildren[i], nodeIndex, thisIndex);
+    }
+
+    return nodeIndex;
+}
+
+
+// Calculate the node and whole-mesh bounds from the vertices, after the geometry has been read
+void MeshData::CalculateBounds()
+{
+    // Call a function for each vertex position in the space of each node that moves it. Rigid sub-meshes are moved by
+    // the nodes that hold them. Skinned vertices are moved by each bone with a non-zero weight, and are put into that
+    // bone's space with its offset matrix
+    auto forEachNodeVertex = [&](const std::function<void(unsigned int, const CVector3&)>& function)
+    {
+        if (!hasBones)
+        {
+            for (unsigned int nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+            {
+                for (auto subMeshIndex : nodes[nodeIndex].subMeshes)
+                {
+                    const auto& subMesh = subMeshes[subMeshIndex];
+                    for (unsigned int v = 0; v < subMesh.numVertices; ++v)
+                    {
+                        const unsigned char* vertex = subMesh.vertices + v * subMesh.vertexSize;
+                        function(nodeIndex, *reinterpret_cast<const CVector3*>(vertex + subMesh.positionOffset));
+                    }
+                }
+            }
+            return;
+        }
+
+        for (const auto& subMesh : subMeshes)
+        {
+            for (const auto& batch : subMesh.boneBatches)
+            {
+                const uint32_t* palette = subMesh.bonePalette.data() + batch.firstBone;
+                for (unsigned int v = batch.firstVertex; v < batch.firstVertex + batch.numVertices; ++v)
+                {
+                    const unsigned char* vertex = subMesh.vertices + v * subMesh.vertexSize;
+                    const CVector3& position = *reinterpret_cast<const CVector3*>(vertex + subMesh.positionOffset);
+                    const unsigned char* bones = vertex + subMesh.bonesOffset;
+                    const float* weights = reinterpret_cast<const float*>(bones + 4);
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        if (weights[i] == 0.0f)  continue;
+                        unsigned int nodeIndex = palette[bones[i]];
+                        function(nodeIndex, TransformPoint(position, nodes[nodeIndex].offsetMatrix));
+                    }
+                }
+            }
+        }
+    };
+
+    // Boxes first, then spheres around the box centres so the spheres are reasonably tight
+    for (auto& node : nodes)
+    {
+        node.bounds = AABB();
+        node.boundingSphere = BoundingSphere();
+    }
+    forEachNodeVertex([&](unsigned int nodeIndex, const CVector3& position) { nodes[nodeIndex].bounds.Add(position); });
+    for (auto& node : nodes)
+    {
+        if (!node.bounds.IsEmpty())  node.boundingSphere = { node.bounds.Centre(), 0 };
+    }
+    forEachNodeVertex([&](unsigned int nodeIndex, const CVector3& position)
+    {
+        auto& sphere = nodes[nodeIndex].boundingSphere;
+        sphere.radius = std::max(sphere.radius, Length(position - sphere.centre));
+    });
+
+    // Whole mesh in the default pose. The sphere is centred on the box and reaches the furthest node sphere, but is
+    // never larger than the sphere through the corners of the box
+    std::vector<CMatrix4x4>   local(nodes.size()), absolute(nodes.size());
+    std::vector<unsigned int> parents(nodes.size());
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+    {
+        local[i]   = nodes[i].defaultMatrix;
+        parents[i] = nodes[i].parentIndex;
+    }
+    local[0] = MatrixIdentity(); // Relative to the root node
+    MatrixMultiplyHierarchy(local.data(), parents.data(), absolute.data(), static_cast<unsigned int>(nodes.size()));
+
+    bounds = AABB();
+    for (unsigned int i = 0; i < nodes.size(); ++i)  bounds.Add(TransformAABB(nodes[i].bounds, absolute[i]));
+
+    boundingSphere = BoundingSphere();
+    if (!bounds.IsEmpty())
+    {
+        boundingSphere.centre = bounds.Centre();
+        boundingSphere.radius = 0;
+        for (unsigned int i = 0; i < nodes.size(); ++i)
+        {
+            BoundingSphere nodeSphere = TransformSphere(nodes[i].boundingSphere, absolute[i]);
+            if (nodeSphere.IsEmpty())  continue;
+            boundingSphere.radius = std::max(boundingSphere.radius, Length(nodeSphere.centre - boundingSphere.centre) + nodeSphere.radius);
+        }
+        boundingSphere.radius = std::min(boundingSphere.radius, Length(bounds.Extents()));
+    }
+}
+
+
+// Read the animation clips from the assimp scene, after the nodes have been read
+void MeshData::ReadAnimations(const aiScene* scene)
+{
+    animations.resize(scene->mNumAnimations);
+    for (unsigned int a = 0; a < scene->mNumAnimations; ++a)
+    {
+        const aiAnimation* assimpAnimation = scene->mAnimations[a];
+        auto& clip = animations[a];
+
+        // Key times are in "ticks", convert them to seconds. Some files don't give a rate, assimp suggests 25 in that case
+        double ticksPerSecond = (assimpAnimation->mTicksPerSecond > 0) ? assimpAnimation->mTicksPerSecond : 25.0;
+        clip.name = assimpAnimation->mName.C_Str();
+        clip.duration = static_cast<float>(assimpAnimation->mDuration / ticksPerSecond);
+
+        // Tracks are stored in node order so sampling writes the node matrices in order. Channels for nodes that
+        // aren't in the hierarchy are ignored
+        std::vector<const aiNodeAnim*> nodeChannels(nodes.size(), nullptr);
+        for (unsigned int c = 0; c < assimpAnimation->mNumChannels; ++c)
+        {
+            const aiNodeAnim* channel = assimpAnimation->mChannels[c];
+            for (unsigned int nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+            {
+                if (nodes[nodeIndex].name == channel->mNodeName.C_Str())
+                {
+                    if (nodeChannels[nodeIndex] == nullptr)  nodeChannels[nodeIndex] = channel;
+                    break;
+                }
+            }
+        }
+
+        for (unsigned int nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+        {
+            const aiNodeAnim* channel = nodeChannels[nodeIndex];
+            if (channel == nullptr)  continue;
+
+            // A channel with no keys of a kind keeps that part of the node's default transform, store it as a single key
+            aiVector3D   defaultScale, defaultPosition;
+            aiQuaternion defaultRotation;
+            scene->mRootNode->FindNode(channel->mNodeName)->mTransformation.Decompose(defaultScale, defaultRotation, defaultPosition);
+
+            AnimationTrack track;
+            track.node = nodeIndex;
+
+            // Add the keys of one kind to the clip's arrays, sorted by time. Returns the number of keys added
+            auto addKeys = [&](AnimationKeys& keys, unsigned int numKeys, int numComponents,
+                               std::function<double(unsigned int)> keyTime, std::function<void(unsigned int, float*)> keyValue)
+            {
+                std::vector<unsigned int> order(numKeys);
+                for (unsigned int k = 0; k < numKeys; ++k)  order[k] = k;
+                std::stable_sort(order.begin(), order.end(), [&](unsigned int i, unsigned int j) { return keyTime(i) < keyTime(j); });
+
+                for (unsigned int k : order)
+                {
+                    float value[4];
+                    keyValue(k, value);
+                    keys.times.push_back(static_cast<float>(keyTime(k) / ticksPerSecond));
+                    for (int c = 0; c < numComponents; ++c)  keys.values[c].push_back(value[c]);
+                }
+                if (numKeys == 0)
+                {
+                    float value[4];
+                    keyValue(~0u, value);
+                    keys.times.push_back(0);
+                    for (int c = 0; c < numComponents; ++c)  keys.values[c].push_back(value[c]);
+                }
+                return std::max(numKeys, 1u);
+            };
+
+            track.firstTranslation = static_cast<uint32_t>(clip.translations.times.size());
+            track.numTranslations = addKeys(clip.translations, channel->mNumPositionKeys, 3,
+                [&](unsigned int k) { return channel->mPositionKeys[k].mTime; },
+                [&](unsigned int k, float* value)
+                {
+                    const aiVector3D& v = (k == ~0u) ? defaultPosition : channel->mPositionKeys[k].mValue;
+                    value[0] = v.x;  value[1] = v.y;  value[2] = v.z;
+                });
+
+            track.firstRotation = static_cast<uint32_t>(clip.rotations.times.size());
+            track.numRotations = addKeys(clip.rotations, channel->mNumRotationKeys, 4,
+                [&](unsigned int k) { return channel->mRotationKeys[k].mTime; },
+                [&](unsigned int k, float* value)
+                {
+                    aiQuaternion q = (k == ~0u) ? defaultRotation : channel->mRotationKeys[k].mValue;
+                    q.Normalize();
+                    value[0] = q.x;  value[1] = q.y;  value[2] = q.z;  value[3] = q.w;
+                });
+
+            track.firstScale = static_cast<uint32_t>(clip.scales.times.size());
+            track.numScales = addKeys(clip.scales, channel->mNumScalingKeys, 3,
+                [&](unsigned int k) { return channel->mScalingKeys[k].mTime; },
+                [&](unsigned int k, float* value)
+                {
+                    const aiVector3D& v = (k == ~0u) ? defaultScale : channel->mScalingKeys[k].mValue;
+                    value[0] = v.x;  value[1] = v.y;  value[2] = v.z;
+                });
+
+            clip.tracks.push_back(track);
+        }
+    }
+}
@@ -0,0 +1,258 @@
+//--------------------------------------------------------------------------------------
+// CPU-side mesh data - geometry and node hierarchy ready to be copied to the GPU
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Mesh data is either imported from a model file using assimp, or loaded from a "cooked" binary file that holds
+// the finished vertex / index data, node table and vertex layout. Cooked files are memory mapped and used in place,
+// which avoids assimp's import and post-processing at startup. The Mesh class creates GPU resources from this data.
+// Imported triangles and vertices are reordered for the GPU's caches (see MeshOptimizer.h), split into meshlets that can
+// be culled separately (see Meshlets.h), given simplified levels of detail (see MeshSimplifier.h) and packed into
+// compact formats before use (see VertexPacking.h).
+// Animation clips in the model file are imported and cooked along with the mesh (see AnimationClip.h).
+
+#ifndef _MESH_DATA_H_INCLUDED_
+#define _MESH_DATA_H_INCLUDED_
+
+#include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+#include "AnimationClip.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct aiNode;
+struct aiScene;
+struct VertexPackingStats;
+struct SubMeshOptimizationStats;
+
+
+// Data formats of vertex elements used by meshes. Mesh.cpp converts these to DirectX formats
+enum class VertexElementFormat : uint32_t
+{
+    Float2,  // Two 32-bit floats
+    Float3,  // Three 32-bit floats
+    Float4,  // Four 32-bit floats
+    UByte4,  // Four 8-bit unsigned integers
+    Short2N, // Two 16-bit signed normalised integers (-1 to 1), used for octahedral normals and tangents
+    Half2,   // Two 16-bit floats
+    UByte4N, // Four 8-bit unsigned normalised integers (0 to 1)
+};
+
+// Maximum number of bones a skinned draw can use, the size of the bone matrix array in the shader constant buffer.
+// Must match MAX_BONES in Common.h and Common.hlsli. Skinned sub-meshes that use more bones than this are split into
+// batches at import time (see BoneBatch)
+const uint32_t BONE_PALETTE_SIZE = 64;
+
+
+// Description of one element (position, normal etc.) in an interleaved vertex
+struct VertexElement
+{
+    char                semantic[16]; // Name used to match the element to vertex shader inputs
+    VertexElementFormat format;
+    uint32_t            offset;       // Offset in bytes from the start of the vertex
+};
+
+
+// Part of a skinned sub-mesh that uses no more than BONE_PALETTE_SIZE bones, rendered with a single draw call. The
+// bone indices in its vertices refer to the batch's palette: entries [firstBone, firstBone + numBones) in the
+// sub-mesh's bonePalette, which hold the node index for each bone. Vertices used by several batches are duplicated
+// so that each batch has its own range of vertices
+struct BoneBatch
+{
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    uint32_t firstVertex;
+    uint32_t numVertices;
+    uint32_t firstBone;
+    uint32_t numBones;
+};
+
+
+// A simplified version of a sub-mesh's triangles (see MeshSimplifier.h), drawn instead of the full detail ones when the
+// model is small on screen. Levels use the sub-mesh's vertices, their indices are stored after the full detail ones.
+// For skinned sub-meshes the level's indices are grouped by bone batch, with a range for each batch in lodBatches
+struct LodLevel
+{
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    float    error;      // Estimated distance of the simplified surface from the original, in the sub-mesh's space
+    uint32_t firstBatch; // Skinned sub-meshes: the level's batches are lodBatches[firstBatch, firstBatch + boneBatches.size())
+};
+
+
+// A cluster of up to MESHLET_MAX_TRIANGLES of a rigid sub-mesh's full detail triangles with bounds for culling it on its
+// own (see Meshlets.h). A sub-mesh's meshlets cover its full detail indices in order
+struct Meshlet
+{
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    float    centre[3];   // Bounding sphere in the sub-mesh's space
+    float    radius;
+    float    coneAxis[3]; // Average facing of the triangles (unit length)...
+    float    coneCutoff;  // ...and the sine of the largest angle between it and any of their normals, 1 if too wide to use
+};
+
+
+// Geometry that uses a single material (texture)
+struct SubMeshData
+{
+    static const uint32_t NO_ELEMENT = 0xffffffff; // Offset value for elements that are not present
+
+    uint32_t vertexSize    = 0; // Size in bytes of a single vertex (depends on what it contains, uvs, tangents etc.)
+    uint32_t numVertices   = 0;
+    uint32_t numIndices    = 0; // Indices of the full detail triangles...
+    uint32_t numLodIndices = 0; // ...and of all the simplified levels, which follow them in the same index data
+    uint32_t indexSize     = 4; // Size in bytes of a single index, 2 for sub-meshes with fewer than 65536 vertices
+
+    std::vector<VertexElement> layout; // Description of the data held in a single vertex
+
+    // For skinned sub-meshes, the ranges of the geometry that each use a palette of up to BONE_PALETTE_SIZE bones, and
+    // the node index of each palette entry. Batches cover all the indices and vertices in order. Empty without bones
+    std::vector<BoneBatch> boneBatches;
+    std::vector<uint32_t>  bonePalette;
+
+    // Simplified levels of detail, each coarser than the last. Empty if the sub-mesh couldn't be simplified usefully.
+    // For skinned sub-meshes, each level's copy of the bone batches with its own index ranges (see LodLevel)
+    std::vector<LodLevel>  lods;
+    std::vector<BoneBatch> lodBatches;
+
+    // Clusters of the full detail triangles that can be culled separately. Empty for skinned or small sub-meshes
+    std::vector<Meshlet> meshlets;
+
+    // Offsets of the standard elements within a vertex, NO_ELEMENT if not present. The bones element holds four
+    // 8-bit indices into the bone palette of the vertex's batch, and is immediately followed by four weights - floats
+    // while importing, four 8-bit normalised values once packed
+    uint32_t positionOffset = NO_ELEMENT;
+    uint32_t normalOffset   = NO_ELEMENT;
+    uint32_t tangentOffset  = NO_ELEMENT;
+    uint32_t uvOffset       = NO_ELEMENT;
+    uint32_t bonesOffset    = NO_ELEMENT;
+
+    // Interleaved vertices and 16 or 32-bit indices (see indexSize, there are TotalIndices of them). These point either
+    // into the storage below (imported data) or directly into a memory mapped cooked file
+    const unsigned char* vertices = nullptr;
+    const void*          indices  = nullptr;
+
+    // Storage for imported data. Note: for large arrays a unique_ptr is better than a vector because vectors
+    // default-initialise all the values which is a waste of time
+    std::unique_ptr<unsigned char[]> vertexStorage;
+    std::unique_ptr<unsigned char[]> indexStorage;
+
+    // Number of indices in the index data, full detail and simplified levels
+    uint32_t TotalIndices() const  { return numIndices + numLodIndices; }
+
+    // The index at the given position, whatever the index size
+    uint32_t Index(uint32_t i) const
+    {
+        return (indexSize == 2) ? static_cast<const uint16_t*>(indices)[i] : static_cast<const uint32_t*>(indices)[i];
+    }
+};
+
+
+// A node represents a seperate animatable part of the mesh. See Mesh.h for more details
+struct MeshNode
+{
+    std::string  name;
+
+    CMatrix4x4   defaultMatrix; // Starting position/rotation/scale for this node. Relative to parent. Used when first creating a model from this mesh
+    CMatrix4x4   offsetMatrix;  // Transform from the skinned mesh root to this node when it is used as a bone
+
+    unsigned int parentIndex;   // Index of the parent node. Root node refers to itself (0)
+
+    std::vector<unsigned int> childNodes; // Child nodes that are controlled by this node
+    std::vector<unsigned int> subMeshes;  // The geometry representing this node (indexes into the subMeshes vector)
+
+    // Bounds of the geometry this node moves, in the node's own space, so they only need transforming by the node's
+    // absolute matrix. For a skinned mesh these are the vertices the node influences as a bone, in bone space
+    // (i.e. after the offset matrix). Empty if the node moves no geometry
+    AABB           bounds;
+    BoundingSphere boundingSphere;
+};
+
+
+class MeshData
+{
+public:
+    //-------------------------------------
+    // Loading
+    //-------------------------------------
+
+    // Load a mesh: uses the cooked version of the file if it exists and is up to date, otherwise imports the file
+    // with assimp and writes a new cooked file for next time (if writeCooked is true).
+    // Optionally request tangents to be calculated (for normal and parallax mapping)
+    // Will throw a std::runtime_error exception on failure
+    void Load(const std::string& fileName, bool requireTangents = false, bool writeCooked = true);
+
+    // Import a mesh file with assimp (http://www.assimp.org/), ignoring any cooked file. The triangles and vertices are
+    // reordered for the GPU (see MeshOptimizer.h), split into meshlets (see Meshlets.h), given simplified levels (see
+    // MeshSimplifier.h), then packed. If packingStats is given the packing sizes and round-trip errors are added to it.
+    // If optimizationStats is given it is filled with the measurements of each sub-mesh before and after reordering
+    // Will throw a std::runtime_error exception on failure
+    void Import(const std::string& fileName, bool requireTangents = false, VertexPackingStats* packingStats = nullptr,
+                std::vector<SubMeshOptimizationStats>* optimizationStats = nullptr);
+
+    // Load a cooked mesh file that was created from the given source file. The file is memory mapped and the vertex
+    // and index data used in place. Returns false if the cooked file is missing, from an older version of this code,
+    // older than the source file (stale) or fails any check on its contents (corrupt), so Load imports the source file
+    // instead. The mesh data is left empty in that case
+    bool LoadCooked(const std::string& cookedFileName, const std::string& sourceFileName, bool requireTangents);
+
+    // Write the current data to a cooked file, recording the timestamp of the given source file. Returns false on failure
+    bool SaveCooked(const std::string& cookedFileName, const std::string& sourceFileName, bool requireTangents) const;
+
+    // The name of the cooked file used for the given source file and import options
+    static std::string CookedFileName(const std::string& fileName, bool requireTangents);
+
+
+    //-------------------------------------
+    // Data
+    //-------------------------------------
+
+    std::vector<SubMeshData> subMeshes; // The mesh geometry. Nodes refer to sub-meshes in this vector
+    std::vector<MeshNode>    nodes;     // The mesh hierarchy. First entry is root. Remainder are stored in depth-first order
+
+    bool hasBones = false; // If any submesh has bones, then all submeshes are given bones - makes rendering easier (one shader for the whole mesh)
+
+    // Bounds of the whole mesh in its default pose, relative to the root node
+    AABB           bounds;
+    BoundingSphere boundingSphere;
+
+    std::vector<AnimationClip> animations; // Animation clips from the file, tracks refer to nodes in the nodes vector
+
+
+private:
+    // Count the number of nodes with given assimp node as root - recursive
+    static unsigned int CountNodes(const aiNode* assimpNode);
+
+    // Help build the array of nodes from the assimp data - recursive
+    unsigned int ReadNodes(const aiNode* assimpNode, unsigned int nodeIndex, unsigned int parentIndex);
+
+    // Read the animation clips from the assimp scene, after the nodes have been read
+    void ReadAnimations(const aiScene* scene);
+
+    // Calculate the node and whole-mesh bounds from the vertices, after the geometry has been read
+    void CalculateBounds();
+
+    // Remove all data
+    void Clear();
+
+    // Keeps a cooked file mapped while its data is in use
+    MappedFile mCookedFile;
+};
+
+
+// Offline cook step: import the given mesh file with assimp and write its cooked file, even if the cooked file
+// is already up to date. Returns false on failure and fills in the error message
+bool CookMesh(const std::string& fileName, bool requireTangents, std::string& error);
+
+
+// Time loading each of the given mesh files by importing it with assimp and from its cooked file (the best of several
+// runs of each, the cooked file is written first if needed so it is in the OS file cache). Also checks the cooked data
+// matches the import. Returns the results as a text table
+std::string BenchmarkMeshLoading(const std::vector<std::string>& fileNames, unsigned int iterations = 3);
+
+
+#endif //_MESH_DATA_H_INCLUDED_
@@ -0,0 +1,528 @@
+//--------------------------------------------------------------------------------------
+// Mesh optimizer - triangle and vertex order for the GPU's caches and reduced overdraw
+//--------------------------------------------------------------------------------------
+
+#include "MeshOptimizer.h"
+#include "CVector3.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+    const uint32_t NO_VERTEX = 0xffffffff;
+
+    // Position of a vertex in a sub-mesh
+    CVector3 Position(const SubMeshData& subMesh, uint32_t v)
+    {
+        float position[3];
+        std::memcpy(position, subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize + subMesh.positionOffset, sizeof(position));
+        return CVector3(position);
+    }
+
+    // Face normal of a triangle scaled by twice its area. Front faces are clockwise in this left-handed system, for
+    // which this cross product points out of the front
+    CVector3 AreaNormal(const CVector3& a, const CVector3& b, const CVector3& c)
+    {
+        return Cross(b - a, c - a);
+    }
+
+    // Simulated FIFO vertex cache. Each miss is given the next timestamp, so a vertex is still in the cache if fewer
+    // than VERTEX_CACHE_SIZE misses have happened since its own. Timestamps start at the cache size so every vertex
+    // begins outside the cache
+    class VertexCache
+    {
+    public:
+        VertexCache(uint32_t numVertices) : mTimestamps(numVertices, 0), mTime(VERTEX_CACHE_SIZE) {}
+
+        // True if the vertex is in the cache
+        bool Contains(uint32_t v) const { return mTime - mTimestamps[v] < VERTEX_CACHE_SIZE; }
+
+        // Use a vertex, returns true if it was a cache miss
+        bool Use(uint32_t v)
+        {
+            if (Contains(v))  return false;
+            mTimestamps[v] = mTime++;
+            return true;
+        }
+
+        // Number of misses since the vertex was added, which must be in the cache
+        uint32_t Age(uint32_t v) const { return mTime - mTimestamps[v]; }
+
+        // Empty the cache
+        void Flush() { mTime += VERTEX_CACHE_SIZE; }
+
+    private:
+        std::vector<uint32_t> mTimestamps;
+        uint32_t              mTime;
+    };
+
+
+    // Tipsify: return the triangles in vertex cache order (see MeshOptimizer.h). Tracks how many triangles still use
+    // each vertex ("live" triangles) and the vertices of recently emitted triangles (the dead-end stack) to continue
+    // from when the current area is finished
+    std::vector<uint32_t> Tipsify(const uint32_t* indices, uint32_t numIndices, uint32_t numVertices)
+    {
+        uint32_t numTriangles = numIndices / 3;
+
+        // Triangles using each vertex: triangles [adjacencyStart[v], adjacencyStart[v + 1]) in adjacency
+        std::vector<uint32_t> liveTriangles(numVertices, 0);
+        for (uint32_t i = 0; i < numTriangles * 3; ++i)  ++liveTriangles[indices[i]];
+
+        std::vector<uint32_t> adjacencyStart(numVertices + 1, 0);
+        for (uint32_t v = 0; v < numVertices; ++v)  adjacencyStart[v + 1] = adjacencyStart[v] + liveTriangles[v];
+
+        std::vector<uint32_t> adjacency(numTriangles * 3);
+        std::vector<uint32_t> adjacencyEnd(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (uint32_t i = 0; i < numTriangles * 3; ++i)  adjacency[adjacencyEnd[indices[i]]++] = i / 3;
+
+        VertexCache cache(numVertices);
+        std::vector<bool>     emitted(numTriangles, false);
+        std::vector<uint32_t> deadEnds;
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> output;
+        output.reserve(numTriangles * 3);
+
+        uint32_t nextUnused = 0; // Vertices before this have no live triangles, used when the dead-end stack runs out
+        auto nextLiveVertex = [&]()
+        {
+            while (!deadEnds.empty())
+            {
+                uint32_t v = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[v] > 0)  return v;
+            }
+            while (nextUnused < numVertices)
+            {
+                if (liveTriangles[nextUnused] > 0)  return nextUnused;
+                ++nextUnused;
+            }
+            return NO_VERTEX;
+        };
+
+        uint32_t fan = nextLiveVertex();
+        while (fan != NO_VERTEX)
+        {
+            // Emit all the remaining triangles around the fanning vertex
+            candidates.clear();
+            for (uint32_t a = adjacencyStart[fan]; a < adjacencyStart[fan + 1]; ++a)
+            {
+                uint32_t triangle = adjacency[a];
+                if (emitted[triangle])  continue;
+                emitted[triangle] = true;
+
+                for (uint32_t corner = 0; corner < 3; ++corner)
+                {
+                    uint32_t v = indices[triangle * 3 + corner];
+                    output.push_back(v);
+                    deadEnds.push_back(v);
+                    candidates.push_back(v);
+                    --liveTriangles[v];
+                    cache.Use(v);
+                }
+            }
+
+            // Next fan around the oldest vertex that will still be in the cache after its remaining triangles are
+            // emitted (each can add up to two new vertices). If there is none, pick any vertex with live triangles
+            fan = NO_VERTEX;
+            int bestPriority = -1;
+            for (uint32_t v : candidates)
+            {
+                if (liveTriangles[v] == 0)  continue;
+                int priority = 0;
+                if (cache.Contains(v) && cache.Age(v) + 2 * liveTriangles[v] <= VERTEX_CACHE_SIZE)
+                {
+                    priority = static_cast<int>(cache.Age(v));
+                }
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    fan = v;
+                }
+            }
+            if (fan == NO_VERTEX)  fan = nextLiveVertex();
+        }
+        return output;
+    }
+
+
+    // Cut triangles in cache order into clusters that can be reordered with little effect on the cache (see
+    // MeshOptimizer.h). Returns the first triangle of each cluster
+    std::vector<uint32_t> FindClusters(const std::vector<uint32_t>& indices, uint32_t numVertices)
+    {
+        uint32_t numTriangles = static_cast<uint32_t>(indices.size() / 3);
+
+        VertexCache cache(numVertices);
+        auto triangleMisses = [&](uint32_t t)
+        {
+            return static_cast<uint32_t>(cache.Use(indices[t * 3]) + cache.Use(indices[t * 3 + 1]) + cache.Use(indices[t * 3 + 2]));
+        };
+
+        // Cache misses of each triangle in order
+        std::vector<uint8_t> misses(numTriangles);
+        for (uint32_t t = 0; t < numTriangles; ++t)  misses[t] = static_cast<uint8_t>(triangleMisses(t));
+
+        // Hard boundaries where the cache order is broken. Within each run between them, soft boundaries where the
+        // cluster so far is cache efficient enough. A cluster's misses are counted as if it was drawn on its own, so
+        // it can't end until it has made up for its first triangle's three misses
+        std::vector<uint32_t> clusters;
+        uint32_t runStart = 0;
+        while (runStart < numTriangles)
+        {
+            uint32_t runEnd = runStart + 1;
+            while (runEnd < numTriangles && misses[runEnd] < 3)  ++runEnd;
+
+            uint32_t runMisses = 0;
+            for (uint32_t t = runStart; t < runEnd; ++t)  runMisses += misses[t];
+            float threshold = OVERDRAW_CLUSTER_THRESHOLD * runMisses / (runEnd - runStart);
+
+            clusters.push_back(runStart);
+            cache.Flush();
+            uint32_t clusterMisses = 0, clusterTriangles = 0;
+            for (uint32_t t = runStart; t < runEnd; ++t)
+            {
+                clusterMisses += triangleMisses(t);
+                ++clusterTriangles;
+                if (t + 1 < runEnd && clusterMisses <= threshold * clusterTriangles)
+                {
+                    clusters.push_back(t + 1);
+                    cache.Flush();
+                    clusterMisses = clusterTriangles = 0;
+                }
+            }
+            runStart = runEnd;
+        }
+        return clusters;
+    }
+}
+
+
+// Reorder the triangles of a sub-mesh for the vertex cache, then sort clusters of them to reduce overdraw (see above).
+// The sub-mesh must have positions, 32-bit indices and hold its indices in its own storage. Vertices are unchanged.
+// Returns the number of clusters sorted
+unsigned int OptimizeTriangleOrder(SubMeshData& subMesh)
+{
+    if (subMesh.indexSize != 4 || !subMesh.indexStorage)
+    {
+        throw std::runtime_error("OptimizeTriangleOrder needs positions and 32-bit indices in the sub-mesh's own storage");
+    }
+    return OptimizeTriangleOrder(subMesh, reinterpret_cast<uint32_t*>(subMesh.indexStorage.get()), subMesh.numIndices);
+}
+
+// As above for a separate list of triangles using the vertices of a sub-mesh, such as a simplified level of detail
+unsigned int OptimizeTriangleOrder(const SubMeshData& subMesh, uint32_t* indices, uint32_t numIndices)
+{
+    if (subMesh.positionOffset == SubMeshData::NO_ELEMENT)
+    {
+        throw std::runtime_error("OptimizeTriangleOrder needs positions and 32-bit indices in the sub-mesh's own storage");
+    }
+    uint32_t numTriangles = numIndices / 3;
+    if (numTriangles == 0)  return 0;
+
+    std::vector<uint32_t> cacheOrder = Tipsify(indices, numTriangles * 3, subMesh.numVertices);
+    std::vector<uint32_t> clusterStarts = FindClusters(cacheOrder, subMesh.numVertices);
+    uint32_t numClusters = static_cast<uint32_t>(clusterStarts.size());
+    clusterStarts.push_back(numTriangles);
+
+    // Area-weighted centre and facing direction of each cluster and the centre of the whole sub-mesh
+    struct Cluster
+    {
+        uint32_t start;
+        uint32_t end;
+        float    sortKey;
+    };
+    std::vector<Cluster> clusters(numClusters);
+    std::vector<CVector3> clusterCentres(numClusters), clusterNormals(numClusters);
+    CVector3 meshCentre = { 0, 0, 0 };
+    float meshArea = 0;
+    for (uint32_t c = 0; c < numClusters; ++c)
+    {
+        CVector3 centre = { 0, 0, 0 }, normal = { 0, 0, 0 };
+        float area = 0;
+        for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+        {
+            CVector3 a = Position(subMesh, cacheOrder[t * 3]);
+            CVector3 b = Position(subMesh, cacheOrder[t * 3 + 1]);
+            CVector3 p = Position(subMesh, cacheOrder[t * 3 + 2]);
+            CVector3 areaNormal = AreaNormal(a, b, p);
+            float triangleArea = Length(areaNormal);
+            centre += (a + b + p) * (triangleArea / 3);
+            normal += areaNormal;
+            area   += triangleArea;
+        }
+        meshCentre += centre;
+        meshArea   += area;
+        clusterCentres[c] = (area > 0) ? centre * (1 / area) : Position(subMesh, cacheOrder[clusterStarts[c] * 3]);
+        float normalLength = Length(normal);
+        clusterNormals[c] = (normalLength > 0) ? normal * (1 / normalLength) : normal;
+        clusters[c] = { clusterStarts[c], clusterStarts[c + 1], 0 };
+    }
+    if (meshArea > 0)  meshCentre *= 1 / meshArea;
+
+    // Clusters that face away from the centre and are further from it tend to be in front of the rest of the mesh
+    // from any view direction that sees them at all. Draw those first. Stable sort so equal keys keep the cache order
+    for (uint32_t c = 0; c < numClusters; ++c)
+    {
+        clusters[c].sortKey = Dot(clusterCentres[c] - meshCentre, clusterNormals[c]);
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    uint32_t* index = indices;
+    for (auto& cluster : clusters)
+    {
+        index = std::copy(cacheOrder.begin() + cluster.start * 3, cacheOrder.begin() + cluster.end * 3, index);
+    }
+    return numClusters;
+}
+
+
+// Reorder the vertices of a sub-mesh into the order its triangles first use them and update the indices to match.
+// Vertices no triangle uses are moved to the end. Each bone batch is reordered within its own range of vertices.
+// The sub-mesh must have 32-bit indices and hold its data in its own storage
+void OptimizeVertexFetch(SubMeshData& subMesh)
+{
+    if (subMesh.indexSize != 4 || !subMesh.vertexStorage || !subMesh.indexStorage)
+    {
+        throw std::runtime_error("OptimizeVertexFetch needs 32-bit indices and vertices in the sub-mesh's own storage");
+    }
+    uint32_t* indices = reinterpret_cast<uint32_t*>(subMesh.indexStorage.get());
+
+    // Treat a sub-mesh without bones as a single batch
+    std::vector<BoneBatch> ranges = subMesh.boneBatches;
+    if (ranges.empty())
+    {
+        BoneBatch whole = {};
+        whole.numIndices  = subMesh.numIndices;
+        whole.numVertices = subMesh.numVertices;
+        ranges.push_back(whole);
+    }
+
+    // New position of each vertex
+    std::vector<uint32_t> remap(subMesh.numVertices, NO_VERTEX);
+    for (auto& range : ranges)
+    {
+        uint32_t next = range.firstVertex;
+        for (uint32_t i = range.firstIndex; i < range.firstIndex + range.numIndices; ++i)
+        {
+            uint32_t& newIndex = remap[indices[i]];
+            if (newIndex == NO_VERTEX)  newIndex = next++;
+            indices[i] = newIndex;
+        }
+        for (uint32_t v = range.firstVertex; v < range.firstVertex + range.numVertices; ++v)
+        {
+            if (remap[v] == NO_VERTEX)  remap[v] = next++;
+        }
+    }
+
+    std::size_t bytes = static_cast<std::size_t>(subMesh.numVertices) * subMesh.vertexSize;
+    auto vertices = std::make_unique<unsigned char[]>(bytes);
+    for (uint32_t v = 0; v < subMesh.numVertices; ++v)
+    {
+        std::memcpy(vertices.get() + static_cast<std::size_t>(remap[v]) * subMesh.vertexSize,
+                    subMesh.vertexStorage.get() + static_cast<std::size_t>(v) * subMesh.vertexSize, subMesh.vertexSize);
+    }
+    subMesh.vertexStorage = std::move(vertices);
+    subMesh.vertices = subMesh.vertexStorage.get();
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Analysis
+-----------------------------------------------------------------------------------------*/
+
+namespace
+{
+    // A vertex projected for the overdraw estimate: x and y in pixels on the depth buffer, z the depth
+    struct ScreenVertex
+    {
+        float x, y, z;
+    };
+
+    // Twice the signed area of triangle a, b, p on the screen. Positive if anticlockwise, or for a point p to the
+    // left of the edge a->b
+    float EdgeFunction(const ScreenVertex& a, const ScreenVertex& b, float px, float py)
+    {
+        return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+    }
+
+    // True if a pixel centre is inside a triangle given its edge function for the edge a->b. Pixel centres exactly
+    // on an edge belong to only one of the two triangles sharing it (which traverse the edge in opposite directions),
+    // so shared edges aren't counted as overdraw
+    bool InsideEdge(float edge, const ScreenVertex& a, const ScreenVertex& b)
+    {
+        return edge > 0 || (edge == 0 && (b.y > a.y || (b.y == a.y && b.x < a.x)));
+    }
+
+    // Estimate overdraw by rasterising the triangles in order with a depth test from each axis direction. Each view
+    // is a rotation of the mesh (so front faces stay clockwise) fitted to the depth buffer, orthographic so the
+    // result doesn't depend on a camera distance
+    float EstimateOverdraw(const SubMeshData& subMesh)
+    {
+        // Fit the bounding box of the used vertices to the depth buffer, keeping proportions
+        CVector3 minimum = { FLT_MAX, FLT_MAX, FLT_MAX }, maximum = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t i = 0; i < subMesh.numIndices; ++i)
+        {
+            CVector3 p = Position(subMesh, subMesh.Index(i));
+            minimum = { std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z) };
+            maximum = { std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z) };
+        }
+        float extent = std::max(std::max(maximum.x - minimum.x, maximum.y - minimum.y), maximum.z - minimum.z);
+        if (!(extent > 0))  return 1;
+        float scale = OVERDRAW_GRID_SIZE / extent;
+
+        std::vector<float> depth(OVERDRAW_GRID_SIZE * OVERDRAW_GRID_SIZE);
+        std::vector<ScreenVertex> screen(subMesh.numVertices);
+        uint64_t shaded = 0, covered = 0;
+        for (unsigned int view = 0; view < 6; ++view)
+        {
+            // Looking along +z, -z, +x, -x, +y and -y, with screen y up (z up when looking along the y axis)
+            for (uint32_t v = 0; v < subMesh.numVertices; ++v)
+            {
+                CVector3 p = (Position(subMesh, v) - minimum) * scale;
+                float e = extent * scale;
+                switch (view)
+                {
+                    case 0: screen[v] = { p.x,     p.y, p.z     }; break;
+                    case 1: screen[v] = { e - p.x, p.y, e - p.z }; break;
+                    case 2: screen[v] = { e - p.z, p.y, p.x     }; break;
+                    case 3: screen[v] = { p.z,     p.y, e - p.x }; break;
+                    case 4: screen[v] = { e - p.x, p.z, p.y     }; break;
+                    default:screen[v] = { p.x,     p.z, e - p.y }; break;
+                }
+            }
+
+            std::fill(depth.begin(), depth.end(), FLT_MAX);
+            for (uint32_t i = 0; i + 2 < subMesh.numIndices; i += 3)
+            {
+                // Front faces are clockwise, skip the rest. Swap two corners to rasterise anticlockwise
+                const ScreenVertex& a = screen[subMesh.Index(i)];
+                const ScreenVertex& b = screen[subMesh.Index(i + 2)];
+                const ScreenVertex& c = screen[subMesh.Index(i + 1)];
+                float area = EdgeFunction(a, b, c.x, c.y);
+                if (!(area > 0))  continue;
+
+                int minX = std::max(static_cast<int>(std::floor(std::min(std::min(a.x, b.x), c.x))), 0);
+                int minY = std::max(static_cast<int>(std::floor(std::min(std::min(a.y, b.y), c.y))), 0);
+                int maxX = std::min(static_cast<int>(std::ceil(std::max(std::max(a.x, b.x), c.x))), static_cast<int>(OVERDRAW_GRID_SIZE) - 1);
+                int maxY = std::min(static_cast<int>(std::ceil(std::max(std::max(a.y, b.y), c.y))), static_cast<int>(OVERDRAW_GRID_SIZE) - 1);
+                for (int y = minY; y <= maxY; ++y)
+                {
+                    float py = y + 0.5f;
+                    for (int x = minX; x <= maxX; ++x)
+                    {
+                        float px = x + 0.5f;
+                        float wa = EdgeFunction(b, c, px, py);
+                        float wb = EdgeFunction(c, a, px, py);
+                        float wc = EdgeFunction(a, b, px, py);
+                        if (!InsideEdge(wa, b, c) || !InsideEdge(wb, c, a) || !InsideEdge(wc, a, b))  continue;
+
+                        float z = (wa * a.z + wb * b.z + wc * c.z) / area;
+                        float& pixel = depth[y * OVERDRAW_GRID_SIZE + x];
+                        if (z < pixel)
+                        {
+                            pixel = z;
+                            ++shaded;
+                        }
+                    }
+                }
+            }
+            covered += std::count_if(depth.begin(), depth.end(), [](float d) { return d != FLT_MAX; });
+        }
+        return (covered > 0) ? static_cast<float>(static_cast<double>(shaded) / covered) : 1;
+    }
+}
+
+
+// Measure the vertex cache, overdraw and vertex fetch efficiency of a sub-mesh in its current order (see above). Works
+// with 16 or 32-bit indices. The overdraw estimate is the slowest part, rasterising every triangle six times
+GeometryAnalysis AnalyzeGeometry(const SubMeshData& subMesh)
+{
+    GeometryAnalysis analysis;
+    uint32_t numTriangles = subMesh.numIndices / 3;
+    if (numTriangles == 0)  return analysis;
+
+    // Vertex cache
+    VertexCache cache(subMesh.numVertices);
+    std::vector<bool> used(subMesh.numVertices, false);
+    uint32_t misses = 0, numUsed = 0;
+    for (uint32_t i = 0; i < numTriangles * 3; ++i)
+    {
+        uint32_t v = subMesh.Index(i);
+        if (cache.Use(v))  ++misses;
+        if (!used[v])
+        {
+            used[v] = true;
+            ++numUsed;
+        }
+    }
+    analysis.acmr = static_cast<float>(misses) / numTriangles;
+    analysis.atvr = static_cast<float>(misses) / numUsed;
+
+    // Vertex fetch, with a direct-mapped cache of 256 lines of 64 bytes. Only cache misses in the vertex cache above
+    // fetch their vertex
+    const uint32_t LINE_SIZE = 64, NUM_LINES = 256;
+    std::vector<uint64_t> lines(NUM_LINES, ~0ull);
+    VertexCache fetchCache(subMesh.numVertices);
+    uint64_t fetched = 0;
+    for (uint32_t i = 0; i < numTriangles * 3; ++i)
+    {
+        uint32_t v = subMesh.Index(i);
+        if (!fetchCache.Use(v))  continue;
+        uint64_t start = static_cast<uint64_t>(v) * subMesh.vertexSize;
+        for (uint64_t line = start / LINE_SIZE; line <= (start + subMesh.vertexSize - 1) / LINE_SIZE; ++line)
+        {
+            if (lines[line % NUM_LINES] == line)  continue;
+            lines[line % NUM_LINES] = line;
+            fetched += LINE_SIZE;
+        }
+    }
+    analysis.overfetch = static_cast<float>(static_cast<double>(fetched) / (static_cast<double>(numUsed) * subMesh.vertexSize));
+
+    analysis.overdraw = EstimateOverdraw(subMesh);
+    return analysis;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Report
+-----------------------------------------------------------------------------------------*/
+
+// Import the given mesh files (ignoring cooked files) and report the measurements above for each sub-mesh in the order
+// from the file and after optimization. Returns the results as a text table
+std::string ReportMeshOptimization(const std::vector<std::string>& fileNames)
+{
+    std::string report = "Mesh optimization (before -> after, cache of " + std::to_string(VERTEX_CACHE_SIZE) + " vertices)\n";
+    report += "  Sub-mesh  Triangles  Vertices  Clusters  ACMR         ATVR         Overdraw     Overfetch    File\n";
+    char line[512];
+
+    for (auto& fileName : fileNames)
+    {
+        MeshData mesh;
+        std::vector<SubMeshOptimizationStats> stats;
+        try
+        {
+            mesh.Import(fileName, false, nullptr, &stats);
+        }
+        catch (const std::runtime_error& e)
+        {
+            report += std::string("  ") + e.what() + "\n";
+            continue;
+        }
+
+        for (unsigned int m = 0; m < stats.size(); ++m)
+        {
+            const SubMeshOptimizationStats& s = stats[m];
+            std::snprintf(line, sizeof(line), "  %8u  %9u  %8u  %8u  %.3f->%.3f  %.3f->%.3f  %.3f->%.3f  %.3f->%.3f  %s\n",
+                          m, s.triangles, s.vertices, s.clusters, s.before.acmr, s.after.acmr, s.before.atvr, s.after.atvr,
+                          s.before.overdraw, s.after.overdraw, s.before.overfetch, s.after.overfetch, fileName.c_str());
+            report += line;
+        }
+    }
+    return report;
+}
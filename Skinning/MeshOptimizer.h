@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// Mesh optimizer - triangle and vertex order for the GPU's caches and reduced overdraw
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Run on each sub-mesh by MeshData::Import, in three passes:
+//   - Triangles are reordered for the post-transform vertex cache with Tipsify (Sander, Nehab &
+//     Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007). It
+//     emits the triangles around one "fanning" vertex at a time, then moves on to a neighbouring
+//     vertex that is still in a simulated FIFO cache, so most vertices are transformed only once
+//   - The result is cut into clusters: where the cache order was broken anyway (a triangle with
+//     three cache misses), and where the cluster so far is already about as cache efficient as
+//     the whole run. The clusters are then sorted so those facing outwards from the mesh centre
+//     are drawn first, as they tend to hide the rest of the mesh. This reduces overdraw from
+//     most view directions while barely changing the cache efficiency
+//   - Vertices are reordered to the order the triangles first use them, so the GPU reads the
+//     vertex buffer nearly sequentially
+// The passes only depend on the triangles and vertex positions, so the output is the same on
+// every run. The measurements below can be used to compare orders, e.g. before and after:
+//   - ACMR (average cache miss ratio): vertices transformed per triangle with a FIFO cache of
+//     VERTEX_CACHE_SIZE entries. 3 at worst, around 0.6 is good for a closed mesh
+//   - ATVR (average transform to vertex ratio): vertices transformed per vertex used, 1 at best
+//   - Overdraw: pixels shaded per pixel covered, found by rasterising the mesh with a depth test
+//     in a small software depth buffer from the six axis directions
+//   - Overfetch: vertex bytes read through a small cache of 64-byte lines, per vertex byte used
+
+#ifndef _MESH_OPTIMIZER_H_INCLUDED_
+#define _MESH_OPTIMIZER_H_INCLUDED_
+
+#include "MeshData.h"
+
+#include <string>
+#include <vector>
+
+
+// Number of entries in the FIFO vertex cache that triangles are ordered for and measured with. Real GPUs vary, and
+// an order made for a small cache also works well with larger ones
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// A cluster for overdraw sorting ends once its own ACMR is within this factor of the ACMR of the whole run of
+// triangles it is cut from. Larger values give smaller clusters, so more freedom to reduce overdraw, but more cache
+// misses where clusters meet
+const float OVERDRAW_CLUSTER_THRESHOLD = 1.05f;
+
+// Width and height in pixels of the software depth buffer used to estimate overdraw
+const unsigned int OVERDRAW_GRID_SIZE = 256;
+
+
+// Measurements of the triangle and vertex order of a sub-mesh (see above)
+struct GeometryAnalysis
+{
+    float acmr      = 0;
+    float atvr      = 0;
+    float overdraw  = 0;
+    float overfetch = 0;
+};
+
+// Results of optimizing a sub-mesh during import
+struct SubMeshOptimizationStats
+{
+    unsigned int     triangles = 0;
+    unsigned int     vertices  = 0; // Vertices in the file, before any are duplicated by bone palette splitting
+    unsigned int     clusters  = 0; // Clusters sorted for overdraw
+    GeometryAnalysis before;        // In the order from the file...
+    GeometryAnalysis after;         // ...and as finally imported (after bone palette splitting as well)
+};
+
+
+// Reorder the triangles of a sub-mesh for the vertex cache, then sort clusters of them to reduce overdraw (see above).
+// The sub-mesh must have positions, 32-bit indices and hold its indices in its own storage. Vertices are unchanged.
+// Returns the number of clusters sorted
+unsigned int OptimizeTriangleOrder(SubMeshData& subMesh);
+
+// As above for a separate list of triangles using the vertices of a sub-mesh, such as a simplified level of detail
+unsigned int OptimizeTriangleOrder(const SubMeshData& subMesh, uint32_t* indices, uint32_t numIndices);
+
+// Reorder the vertices of a sub-mesh into the order its triangles first use them and update the indices to match.
+// Vertices no triangle uses are moved to the end. Each bone batch is reordered within its own range of vertices.
+// The sub-mesh must have 32-bit indices and hold its data in its own storage
+void OptimizeVertexFetch(SubMeshData& subMesh);
+
+// Measure the vertex cache, overdraw and vertex fetch efficiency of a sub-mesh in its current order (see above). Works
+// with 16 or 32-bit indices. The overdraw estimate is the slowest part, rasterising every triangle six times
+GeometryAnalysis AnalyzeGeometry(const SubMeshData& subMesh);
+
+
+// Import the given mesh files (ignoring cooked files) and report the measurements above for each sub-mesh in the order
+// from the file and after optimization. Returns the results as a text table
+std::string ReportMeshOptimization(const std::vector<std::string>& fileNames);
+
+
+#endif //_MESH_OPTIMIZER_H_INCLUDED_
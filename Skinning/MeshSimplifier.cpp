@@ -0,0 +1,504 @@
+//--------------------------------------------------------------------------------------
+// Mesh simplifier - simplified levels of detail for imported meshes
+//--------------------------------------------------------------------------------------
+
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "CVector3.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+    const uint32_t NO_VERTEX = 0xffffffff;
+
+    // A collapse is also rejected if it would turn any remaining triangle's normal so that its dot product with the
+    // old one, or with its vertices' normals, is below this. Catches flipped triangles and slivers folding over their
+    // neighbours. Vertex normals are from the original surface, so small turns can't add up over many collapses
+    const float MIN_FACE_TURN_DOT = 0.25f;
+
+    // Nor may it leave a triangle thinner than this: twice its area over its longest edge squared (0.87 for an
+    // equilateral triangle). A sliver's normal is unreliable, so it could be flipped without the test above noticing
+    const float MIN_TRIANGLE_SHAPE = 0.001f;
+
+
+    // A three float element of a vertex in a sub-mesh with the float layout
+    CVector3 ReadFloat3(const SubMeshData& subMesh, uint32_t v, uint32_t offset)
+    {
+        float values[3];
+        std::memcpy(values, subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize + offset, sizeof(values));
+        return CVector3(values);
+    }
+
+    // Face normal of a triangle scaled by twice its area, pointing out of the (clockwise) front face
+    CVector3 AreaNormal(const CVector3& a, const CVector3& b, const CVector3& c)
+    {
+        return Cross(b - a, c - a);
+    }
+
+    float LengthSquared(const CVector3& v)
+    {
+        return Dot(v, v);
+    }
+
+    // Key for the directed edge a->b of a triangle
+    uint64_t EdgeKey(uint32_t a, uint32_t b)
+    {
+        return (static_cast<uint64_t>(a) << 32) | b;
+    }
+
+
+    // Sum of the squared distances to a set of planes, each scaled by a weight, as a symmetric 4x4 matrix (the upper
+    // triangle is stored), plus the total weight. Doubles as the terms cancel out badly in single precision
+    struct Quadric
+    {
+        double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0;
+        double weight = 0;
+
+        // Add the plane n.p + d = 0 (n unit length)
+        void AddPlane(const CVector3& n, float d, double planeWeight)
+        {
+            double a = n.x, b = n.y, c = n.z, w = d;
+            xx += planeWeight * a * a;  xy += planeWeight * a * b;  xz += planeWeight * a * c;  xw += planeWeight * a * w;
+            yy += planeWeight * b * b;  yz += planeWeight * b * c;  yw += planeWeight * b * w;
+            zz += planeWeight * c * c;  zw += planeWeight * c * w;
+            ww += planeWeight * w * w;
+            weight += planeWeight;
+        }
+
+        void Add(const Quadric& q)
+        {
+            xx += q.xx;  xy += q.xy;  xz += q.xz;  xw += q.xw;
+            yy += q.yy;  yz += q.yz;  yw += q.yw;
+            zz += q.zz;  zw += q.zw;
+            ww += q.ww;
+            weight += q.weight;
+        }
+
+        // Weighted sum of the squared distances from a point to the planes
+        double Evaluate(const CVector3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double result = xx * x * x + yy * y * y + zz * z * z + ww +
+                            2 * (xy * x * y + xz * x * z + yz * y * z + xw * x + yw * y + zw * z);
+            return std::max(result, 0.0);
+        }
+    };
+
+    // Simplification error of moving a vertex with quadric q to position p: the root of the weighted mean squared
+    // distance to the quadric's planes
+    float QuadricError(const Quadric& q, const CVector3& p)
+    {
+        return (q.weight > 0) ? static_cast<float>(std::sqrt(q.Evaluate(p) / q.weight)) : 0.0f;
+    }
+
+
+    // Total difference between two vertices' bone weights, comparing weights for the same palette slot
+    float WeightDifference(const unsigned char* bonesA, const float* weightsA, const unsigned char* bonesB, const float* weightsB)
+    {
+        float difference = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            if (weightsA[i] == 0)  continue;
+            float weightB = 0;
+            for (int j = 0; j < 4; ++j)  if (bonesB[j] == bonesA[i])  weightB += weightsB[j];
+            difference += std::abs(weightsA[i] - weightB);
+        }
+        for (int j = 0; j < 4; ++j)
+        {
+            if (weightsB[j] == 0)  continue;
+            bool inA = false;
+            for (int i = 0; i < 4; ++i)  inA = inA || (bonesA[i] == bonesB[j] && weightsA[i] != 0);
+            if (!inA)  difference += weightsB[j];
+        }
+        return difference;
+    }
+}
+
+
+// Simplify triangles using vertices [firstVertex, firstVertex + numVertices) of a sub-mesh with the float layout built by
+// MeshData::Import (see above), writing the result over the input. Collapses are made until there are no more than
+// targetIndices indices, or until no collapse has an error under maxError. Returns the new number of indices and sets
+// error to the largest error of the collapses made
+uint32_t SimplifyTriangles(const SubMeshData& subMesh, uint32_t* indices, uint32_t numIndices, uint32_t firstVertex,
+                           uint32_t numVertices, uint32_t targetIndices, float maxError, float& error)
+{
+    error = 0;
+    if (subMesh.positionOffset == SubMeshData::NO_ELEMENT)
+    {
+        throw std::runtime_error("SimplifyTriangles needs vertex positions");
+    }
+    numIndices -= numIndices % 3;
+    if (numIndices <= targetIndices)  return numIndices;
+
+    // Work with vertex numbers local to the range, put back at the end
+    for (uint32_t i = 0; i < numIndices; ++i)
+    {
+        if (indices[i] < firstVertex || indices[i] - firstVertex >= numVertices)
+        {
+            throw std::runtime_error("SimplifyTriangles given an index outside its vertex range");
+        }
+        indices[i] -= firstVertex;
+    }
+
+    std::vector<CVector3> positions(numVertices);
+    for (uint32_t v = 0; v < numVertices; ++v)  positions[v] = ReadFloat3(subMesh, firstVertex + v, subMesh.positionOffset);
+
+    //-------------------------------------
+    // Vertices that can't move
+    //-------------------------------------
+
+    // Several vertices at the same position are on a UV or normal seam
+    std::vector<bool> locked(numVertices, false);
+    std::vector<uint32_t> byPosition(numVertices);
+    std::iota(byPosition.begin(), byPosition.end(), 0);
+    auto positionLess = [&](uint32_t a, uint32_t b)
+    {
+        const CVector3& p = positions[a];
+        const CVector3& q = positions[b];
+        if (p.x != q.x)  return p.x < q.x;
+        if (p.y != q.y)  return p.y < q.y;
+        if (p.z != q.z)  return p.z < q.z;
+        return a < b;
+    };
+    std::sort(byPosition.begin(), byPosition.end(), positionLess);
+    for (uint32_t i = 1; i < numVertices; ++i)
+    {
+        const CVector3& p = positions[byPosition[i - 1]];
+        const CVector3& q = positions[byPosition[i]];
+        if (p.x == q.x && p.y == q.y && p.z == q.z)  locked[byPosition[i - 1]] = locked[byPosition[i]] = true;
+    }
+
+    // Edges with no triangle on the other side are on an open border (which includes the edges of a bone batch and
+    // both sides of a seam). Edges used twice in the same direction are non-manifold, and are left alone too
+    std::vector<uint64_t> edges;
+    edges.reserve(numIndices);
+    for (uint32_t i = 0; i < numIndices; i += 3)
+    {
+        edges.push_back(EdgeKey(indices[i],     indices[i + 1]));
+        edges.push_back(EdgeKey(indices[i + 1], indices[i + 2]));
+        edges.push_back(EdgeKey(indices[i + 2], indices[i]));
+    }
+    std::sort(edges.begin(), edges.end());
+    for (std::size_t e = 0; e < edges.size(); ++e)
+    {
+        uint32_t a = static_cast<uint32_t>(edges[e] >> 32), b = static_cast<uint32_t>(edges[e]);
+        bool repeated = (e > 0 && edges[e - 1] == edges[e]) || (e + 1 < edges.size() && edges[e + 1] == edges[e]);
+        if (a == b || repeated || !std::binary_search(edges.begin(), edges.end(), EdgeKey(b, a)))
+        {
+            locked[a] = locked[b] = true;
+        }
+    }
+
+    //-------------------------------------
+    // Quadrics
+    //-------------------------------------
+
+    // Planes of the original triangles around each vertex, weighted by area
+    std::vector<Quadric> quadrics(numVertices);
+    for (uint32_t i = 0; i < numIndices; i += 3)
+    {
+        const CVector3& a = positions[indices[i]];
+        CVector3 normal = AreaNormal(a, positions[indices[i + 1]], positions[indices[i + 2]]);
+        float length = Length(normal);
+        if (!(length > 0))  continue;
+        normal *= 1 / length;
+        float d = -Dot(normal, a);
+        for (uint32_t corner = 0; corner < 3; ++corner)  quadrics[indices[i + corner]].AddPlane(normal, d, length * 0.5);
+    }
+
+    // Whether vertex u can move onto vertex v without changing its shading or skinning too much
+    auto compatible = [&](uint32_t u, uint32_t v)
+    {
+        if (subMesh.normalOffset != SubMeshData::NO_ELEMENT &&
+            Dot(ReadFloat3(subMesh, firstVertex + u, subMesh.normalOffset),
+                ReadFloat3(subMesh, firstVertex + v, subMesh.normalOffset)) < LOD_MIN_NORMAL_DOT)
+        {
+            return false;
+        }
+        if (subMesh.bonesOffset != SubMeshData::NO_ELEMENT)
+        {
+            const unsigned char* bonesU = subMesh.vertices + static_cast<std::size_t>(firstVertex + u) * subMesh.vertexSize + subMesh.bonesOffset;
+            const unsigned char* bonesV = subMesh.vertices + static_cast<std::size_t>(firstVertex + v) * subMesh.vertexSize + subMesh.bonesOffset;
+            float weightsU[4], weightsV[4];
+            std::memcpy(weightsU, bonesU + 4, sizeof(weightsU));
+            std::memcpy(weightsV, bonesV + 4, sizeof(weightsV));
+            if (WeightDifference(bonesU, weightsU, bonesV, weightsV) > LOD_MAX_WEIGHT_CHANGE)  return false;
+        }
+        return true;
+    };
+
+    //-------------------------------------
+    // Collapses
+    //-------------------------------------
+
+    // Each pass finds the cheapest collapse for every free vertex, then makes them cheapest first. A collapse changes
+    // the triangles around the moving vertex, so those vertices aren't touched again until the next pass, when the
+    // triangles and costs are found afresh. Everything is in vertex and triangle order so the result is repeatable
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        float    error;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> collapseTo(numVertices, NO_VERTEX);
+    std::vector<bool>     touched(numVertices);
+    std::vector<uint32_t> adjacencyStart(numVertices + 1), adjacency;
+
+    uint32_t targetTriangles = targetIndices / 3;
+    while (numIndices > targetIndices)
+    {
+        // Triangles using each vertex: triangles [adjacencyStart[v], adjacencyStart[v + 1]) in adjacency
+        uint32_t numTriangles = numIndices / 3;
+        std::fill(adjacencyStart.begin(), adjacencyStart.end(), 0);
+        for (uint32_t i = 0; i < numIndices; ++i)  ++adjacencyStart[indices[i] + 1];
+        for (uint32_t v = 0; v < numVertices; ++v)  adjacencyStart[v + 1] += adjacencyStart[v];
+        adjacency.resize(numIndices);
+        std::vector<uint32_t> adjacencyEnd(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (uint32_t i = 0; i < numIndices; ++i)  adjacency[adjacencyEnd[indices[i]]++] = i / 3;
+
+        // Cheapest collapse of each free vertex onto one of its neighbours
+        collapses.clear();
+        for (uint32_t u = 0; u < numVertices; ++u)
+        {
+            if (locked[u])  continue;
+            Collapse best = { u, NO_VERTEX, FLT_MAX };
+            for (uint32_t a = adjacencyStart[u]; a < adjacencyStart[u + 1]; ++a)
+            {
+                for (uint32_t corner = 0; corner < 3; ++corner)
+                {
+                    uint32_t v = indices[adjacency[a] * 3 + corner];
+                    if (v == u || v == best.to || !compatible(u, v))  continue;
+
+                    Quadric q = quadrics[u];
+                    q.Add(quadrics[v]);
+                    float cost = QuadricError(q, positions[v]);
+                    if (cost < best.error || (cost == best.error && v < best.to))  best = { u, v, cost };
+                }
+            }
+            if (best.to != NO_VERTEX && best.error <= maxError)  collapses.push_back(best);
+        }
+        std::stable_sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        std::fill(touched.begin(), touched.end(), false);
+        bool collapsed = false;
+        for (const Collapse& collapse : collapses)
+        {
+            if (numTriangles <= targetTriangles)  break;
+            if (touched[collapse.from] || touched[collapse.to])  continue;
+
+            // Reject if any triangle that survives the collapse would turn too far
+            bool flips = false;
+            for (uint32_t a = adjacencyStart[collapse.from]; a < adjacencyStart[collapse.from + 1] && !flips; ++a)
+            {
+                const uint32_t* triangle = indices + adjacency[a] * 3;
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)  continue;
+
+                CVector3 corners[3], moved[3], shading = { 0, 0, 0 };
+                for (uint32_t corner = 0; corner < 3; ++corner)
+                {
+                    uint32_t v = (triangle[corner] == collapse.from) ? collapse.to : triangle[corner];
+                    corners[corner] = positions[triangle[corner]];
+                    moved[corner] = positions[v];
+                    if (subMesh.normalOffset != SubMeshData::NO_ELEMENT)  shading += ReadFloat3(subMesh, firstVertex + v, subMesh.normalOffset);
+                }
+                CVector3 before = AreaNormal(corners[0], corners[1], corners[2]);
+                CVector3 after  = AreaNormal(moved[0], moved[1], moved[2]);
+                float lengths = Length(before) * Length(after);
+                float longestEdge = std::max(std::max(LengthSquared(moved[1] - moved[0]), LengthSquared(moved[2] - moved[1])),
+                                             LengthSquared(moved[0] - moved[2]));
+                flips = !(lengths > 0) || Dot(before, after) < MIN_FACE_TURN_DOT * lengths ||
+                        Length(after) < MIN_TRIANGLE_SHAPE * longestEdge ||
+                        Dot(after, shading) < MIN_FACE_TURN_DOT * Length(after) * Length(shading);
+            }
+            if (flips)  continue;
+
+            // Triangles with both vertices disappear
+            for (uint32_t a = adjacencyStart[collapse.from]; a < adjacencyStart[collapse.from + 1]; ++a)
+            {
+                const uint32_t* triangle = indices + adjacency[a] * 3;
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)  --numTriangles;
+                for (uint32_t corner = 0; corner < 3; ++corner)  touched[triangle[corner]] = true;
+            }
+            collapseTo[collapse.from] = collapse.to;
+            quadrics[collapse.to].Add(quadrics[collapse.from]);
+            error = std::max(error, collapse.error);
+            collapsed = true;
+        }
+        if (!collapsed)  break;
+
+        // Move the collapsed vertices in the index list and remove the triangles that have become degenerate
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < numIndices; i += 3)
+        {
+            uint32_t triangle[3];
+            for (uint32_t corner = 0; corner < 3; ++corner)
+            {
+                uint32_t v = indices[i + corner];
+                triangle[corner] = (collapseTo[v] != NO_VERTEX) ? collapseTo[v] : v;
+            }
+            if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0])  continue;
+            indices[kept++] = triangle[0];
+            indices[kept++] = triangle[1];
+            indices[kept++] = triangle[2];
+        }
+        numIndices = kept;
+        for (const Collapse& collapse : collapses)  collapseTo[collapse.from] = NO_VERTEX;
+    }
+
+    for (uint32_t i = 0; i < numIndices; ++i)  indices[i] += firstVertex;
+    return numIndices;
+}
+
+
+// Build the simplified levels of a sub-mesh (see LodLevel in MeshData.h), adding their indices after the full detail
+// ones. The sub-mesh must have the float layout and 32-bit indices built by MeshData::Import, hold its data in its own
+// storage and have no levels yet. Returns the number of levels made, which can be none
+unsigned int GenerateLods(SubMeshData& subMesh)
+{
+    if (subMesh.positionOffset == SubMeshData::NO_ELEMENT || subMesh.indexSize != 4 || !subMesh.indexStorage ||
+        !subMesh.lods.empty() || subMesh.numLodIndices != 0)
+    {
+        throw std::runtime_error("GenerateLods needs positions and 32-bit indices in the sub-mesh's own storage, and no levels yet");
+    }
+    const uint32_t* fullDetail = reinterpret_cast<const uint32_t*>(subMesh.indexStorage.get());
+    if (subMesh.numIndices < 3)  return 0;
+
+    // Treat a sub-mesh without bones as a single batch
+    bool skinned = !subMesh.boneBatches.empty();
+    std::vector<BoneBatch> ranges = subMesh.boneBatches;
+    if (!skinned)
+    {
+        BoneBatch whole = {};
+        whole.numIndices  = subMesh.numIndices;
+        whole.numVertices = subMesh.numVertices;
+        ranges.push_back(whole);
+    }
+
+    // Error limit from the size of the sub-mesh
+    CVector3 minimum = { FLT_MAX, FLT_MAX, FLT_MAX }, maximum = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (uint32_t v = 0; v < subMesh.numVertices; ++v)
+    {
+        CVector3 p = ReadFloat3(subMesh, v, subMesh.positionOffset);
+        minimum = { std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z) };
+        maximum = { std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z) };
+    }
+    float maxError = LOD_MAX_ERROR * 0.5f * Length(maximum - minimum);
+
+    // Each level is simplified from the full detail triangles, range by range
+    std::vector<uint32_t> lodIndices, rangeIndices;
+    uint32_t previousTriangles = subMesh.numIndices / 3;
+    float ratio = 1;
+    for (unsigned int level = 0; level < MAX_LOD_LEVELS; ++level)
+    {
+        ratio *= LOD_TRIANGLE_RATIO;
+        std::size_t levelStart = lodIndices.size(), batchStart = subMesh.lodBatches.size();
+        LodLevel lod = { subMesh.numIndices + static_cast<uint32_t>(levelStart), 0, 0, static_cast<uint32_t>(batchStart) };
+        if (!skinned)  lod.firstBatch = 0;
+
+        for (auto& range : ranges)
+        {
+            rangeIndices.assign(fullDetail + range.firstIndex, fullDetail + range.firstIndex + range.numIndices);
+            uint32_t target = static_cast<uint32_t>(range.numIndices / 3 * ratio) * 3;
+            float rangeError;
+            uint32_t numIndices = SimplifyTriangles(subMesh, rangeIndices.data(), range.numIndices, range.firstVertex,
+                                                    range.numVertices, target, maxError, rangeError);
+            OptimizeTriangleOrder(subMesh, rangeIndices.data(), numIndices);
+            lod.error = std::max(lod.error, rangeError);
+
+            if (skinned)
+            {
+                BoneBatch batch = range;
+                batch.firstIndex = subMesh.numIndices + static_cast<uint32_t>(lodIndices.size());
+                batch.numIndices = numIndices;
+                subMesh.lodBatches.push_back(batch);
+            }
+            lodIndices.insert(lodIndices.end(), rangeIndices.begin(), rangeIndices.begin() + numIndices);
+        }
+        lod.numIndices = static_cast<uint32_t>(lodIndices.size() - levelStart);
+
+        // A level that saves few triangles isn't worth drawing, and the error limit will stop further levels too
+        uint32_t triangles = lod.numIndices / 3;
+        if (triangles == 0 || triangles > previousTriangles * LOD_MIN_REDUCTION)
+        {
+            lodIndices.resize(levelStart);
+            subMesh.lodBatches.resize(batchStart);
+            break;
+        }
+        subMesh.lods.push_back(lod);
+        previousTriangles = triangles;
+    }
+    if (subMesh.lods.empty())  return 0;
+
+    // The levels' indices follow the full detail ones in the same storage
+    subMesh.numLodIndices = static_cast<uint32_t>(lodIndices.size());
+    auto indexStorage = std::make_unique<unsigned char[]>(static_cast<std::size_t>(subMesh.TotalIndices()) * sizeof(uint32_t));
+    std::memcpy(indexStorage.get(), fullDetail, static_cast<std::size_t>(subMesh.numIndices) * sizeof(uint32_t));
+    std::memcpy(indexStorage.get() + static_cast<std::size_t>(subMesh.numIndices) * sizeof(uint32_t), lodIndices.data(),
+                lodIndices.size() * sizeof(uint32_t));
+    subMesh.indexStorage = std::move(indexStorage);
+    subMesh.indices = subMesh.indexStorage.get();
+    return static_cast<unsigned int>(subMesh.lods.size());
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Report
+-----------------------------------------------------------------------------------------*/
+
+// Import the given mesh files (ignoring cooked files) and report the triangles and the largest simplification error of
+// each level of detail, for all the sub-meshes together. Returns the results as a text table
+std::string ReportLods(const std::vector<std::string>& fileNames)
+{
+    std::string report = "Levels of detail (up to " + std::to_string(MAX_LOD_LEVELS) + " simplified levels per sub-mesh)\n";
+    report += "  Level  Triangles  Of full  Error       Of radius  File\n";
+    char line[512];
+
+    for (auto& fileName : fileNames)
+    {
+        MeshData mesh;
+        try
+        {
+            mesh.Import(fileName);
+        }
+        catch (const std::runtime_error& e)
+        {
+            report += std::string("  ") + e.what() + "\n";
+            continue;
+        }
+
+        // Sub-meshes with fewer levels draw their coarsest one at the levels they don't have
+        std::size_t numLevels = 1;
+        for (auto& subMesh : mesh.subMeshes)  numLevels = std::max(numLevels, subMesh.lods.size() + 1);
+
+        unsigned int fullTriangles = 0;
+        for (unsigned int level = 0; level < numLevels; ++level)
+        {
+            unsigned int triangles = 0;
+            float error = 0;
+            for (auto& subMesh : mesh.subMeshes)
+            {
+                unsigned int l = std::min(level, static_cast<unsigned int>(subMesh.lods.size()));
+                triangles += ((l == 0) ? subMesh.numIndices : subMesh.lods[l - 1].numIndices) / 3;
+                if (l > 0)  error = std::max(error, subMesh.lods[l - 1].error);
+            }
+            if (level == 0)  fullTriangles = triangles;
+
+            float radius = mesh.boundingSphere.radius;
+            std::snprintf(line, sizeof(line), "  %5u  %9u  %6.1f%%  %10.5f  %8.3f%%  %s\n", level, triangles,
+                          (fullTriangles > 0) ? 100.0f * triangles / fullTriangles : 0.0f, error,
+                          (radius > 0) ? 100.0f * error / radius : 0.0f, fileName.c_str());
+            report += line;
+        }
+    }
+    return report;
+}
@@ -0,0 +1,75 @@
+//--------------------------------------------------------------------------------------
+// Mesh simplifier - simplified levels of detail for imported meshes
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// MeshData::Import gives each sub-mesh up to MAX_LOD_LEVELS simplified versions of its triangles,
+// each aiming for LOD_TRIANGLE_RATIO of the triangles of the one before. Models far from the
+// camera draw a simplified level (see Model::SelectLod).
+// Simplification collapses edges, moving one vertex onto a neighbour and removing the triangles
+// between them, cheapest first. The cost is the quadric error (Garland & Heckbert, "Surface
+// Simplification Using Quadric Error Metrics", 1997): each vertex keeps the planes of the
+// original triangles around it, summed into a 4x4 matrix, and the cost of moving it is the area
+// weighted mean squared distance from the new position to those planes. Its square root is used as
+// the simplification error, an estimate of how far the surface has moved.
+// Vertices only ever move onto existing vertices, so levels are just new index lists over the
+// sub-mesh's vertices and every attribute of the kept vertices is exact. To keep the appearance:
+//   - Vertices on UV or normal seams (several vertices at the same position) and on open borders
+//     never move, so seams and outlines are kept exactly. Other vertices can move onto them
+//   - A collapse is rejected if the two vertices' normals or bone weights are too different, or if
+//     it would flip any triangle
+//   - Skinned sub-meshes are simplified one bone batch at a time, so every level can use the same
+//     bone palettes. Vertices at the edge of a batch are on its border so they don't move, and
+//     neighbouring batches still meet without cracks
+// Each level is simplified from the full detail triangles, so its error is measured against the
+// original surface, then put in vertex cache order (see MeshOptimizer.h).
+
+#ifndef _MESH_SIMPLIFIER_H_INCLUDED_
+#define _MESH_SIMPLIFIER_H_INCLUDED_
+
+#include "MeshData.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+// Most simplified levels made for a sub-mesh, in addition to the full detail triangles
+const unsigned int MAX_LOD_LEVELS = 3;
+
+// Each level aims for this fraction of the triangles of the level before
+const float LOD_TRIANGLE_RATIO = 0.5f;
+
+// A level is only kept if it has no more than this fraction of the triangles of the level before, otherwise there is
+// little point in drawing it and no further levels are made
+const float LOD_MIN_REDUCTION = 0.8f;
+
+// Largest simplification error allowed in any level, as a fraction of the sub-mesh's bounding radius. Simplification
+// stops short of the triangle target rather than go beyond it
+const float LOD_MAX_ERROR = 0.05f;
+
+// A collapse is rejected if the normals of the two vertices have a smaller dot product than this (60 degrees apart)...
+const float LOD_MIN_NORMAL_DOT = 0.5f;
+
+// ...or if their bone weights differ by more than this in total (the sum of the differences for each bone, 0 to 2)
+const float LOD_MAX_WEIGHT_CHANGE = 0.5f;
+
+
+// Simplify triangles using vertices [firstVertex, firstVertex + numVertices) of a sub-mesh with the float layout built by
+// MeshData::Import (see above), writing the result over the input. Collapses are made until there are no more than
+// targetIndices indices, or until no collapse has an error under maxError. Returns the new number of indices and sets
+// error to the largest error of the collapses made
+uint32_t SimplifyTriangles(const SubMeshData& subMesh, uint32_t* indices, uint32_t numIndices, uint32_t firstVertex,
+                           uint32_t numVertices, uint32_t targetIndices, float maxError, float& error);
+
+// Build the simplified levels of a sub-mesh (see LodLevel in MeshData.h), adding their indices after the full detail
+// ones. The sub-mesh must have the float layout and 32-bit indices built by MeshData::Import, hold its data in its own
+// storage and have no levels yet. Returns the number of levels made, which can be none
+unsigned int GenerateLods(SubMeshData& subMesh);
+
+
+// Import the given mesh files (ignoring cooked files) and report the triangles and the largest simplification error of
+// each level of detail, for all the sub-meshes together. Returns the results as a text table
+std::string ReportLods(const std::vector<std::string>& fileNames);
+
+
+#endif //_MESH_SIMPLIFIER_H_INCLUDED_
@@ -0,0 +1,235 @@
+//--------------------------------------------------------------------------------------
+// Meshlets - small clusters of a sub-mesh's triangles that can be culled one by one
+//--------------------------------------------------------------------------------------
+
+#include "Meshlets.h"
+#include "MathHelpers.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+    const uint32_t NO_MESHLET = 0xffffffff;
+
+    // Meshlets whose triangles turn further than this from the cone axis (the dot product of a normal and the axis is
+    // smaller) are never back-facing from anywhere worth testing, so they get no cone
+    const float MIN_CONE_DOT = 0.1f;
+
+    // Position of a vertex in a sub-mesh
+    CVector3 Position(const SubMeshData& subMesh, uint32_t v)
+    {
+        float position[3];
+        std::memcpy(position, subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize + subMesh.positionOffset, sizeof(position));
+        return CVector3(position);
+    }
+
+    // Face normal of a triangle scaled by twice its area. Front faces are clockwise in this left-handed system, for
+    // which this cross product points out of the front
+    CVector3 AreaNormal(const CVector3& a, const CVector3& b, const CVector3& c)
+    {
+        return Cross(b - a, c - a);
+    }
+
+
+    // Bounding sphere and normal cone of a meshlet's triangles
+    void CalculateMeshletBounds(const SubMeshData& subMesh, const uint32_t* indices, Meshlet& meshlet)
+    {
+        // Sphere centred on the box around the vertices
+        AABB box;
+        for (uint32_t i = 0; i < meshlet.numIndices; ++i)  box.Add(Position(subMesh, indices[meshlet.firstIndex + i]));
+        CVector3 centre = box.Centre();
+        float radius = 0;
+        for (uint32_t i = 0; i < meshlet.numIndices; ++i)
+        {
+            radius = std::max(radius, Length(Position(subMesh, indices[meshlet.firstIndex + i]) - centre));
+        }
+
+        // The cone axis is the average of the unit triangle normals, the cone reaches the normal furthest from it.
+        // Triangles with no area are never drawn so don't count
+        std::vector<CVector3> normals;
+        CVector3 normalSum = { 0, 0, 0 };
+        for (uint32_t i = 0; i < meshlet.numIndices; i += 3)
+        {
+            const uint32_t* triangle = indices + meshlet.firstIndex + i;
+            CVector3 normal = AreaNormal(Position(subMesh, triangle[0]), Position(subMesh, triangle[1]), Position(subMesh, triangle[2]));
+            float length = Length(normal);
+            if (length <= 0)  continue;
+            normals.push_back(normal * (1.0f / length));
+            normalSum = normalSum + normals.back();
+        }
+        float axisLength = Length(normalSum);
+        CVector3 axis = (axisLength > 0) ? normalSum * (1.0f / axisLength) : CVector3{ 0, 0, 0 };
+        float minDot = (axisLength > 0) ? 1.0f : -1.0f;
+        for (auto& normal : normals)  minDot = std::min(minDot, Dot(normal, axis));
+
+        std::memcpy(meshlet.centre, &centre.x, sizeof(meshlet.centre));
+        meshlet.radius = radius;
+        std::memcpy(meshlet.coneAxis, &axis.x, sizeof(meshlet.coneAxis));
+        meshlet.coneCutoff = (minDot <= MIN_CONE_DOT) ? 1.0f : std::sqrt(1 - minDot * minDot);
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Building
+//--------------------------------------------------------------------------------------
+
+// Split the full detail triangles of a sub-mesh into meshlets (see Meshlet in MeshData.h), each a range of the indices
+// in their current order. The sub-mesh must have float positions, 32-bit indices in its own storage, no bone batches
+// and no levels of detail yet (levels are made from the final full detail triangles). Sub-meshes with bones or with few
+// triangles get no meshlets. Returns the number of meshlets made
+unsigned int BuildMeshlets(SubMeshData& subMesh)
+{
+    if (subMesh.positionOffset == SubMeshData::NO_ELEMENT || subMesh.indexSize != 4 || !subMesh.indexStorage ||
+        !subMesh.lods.empty() || subMesh.numLodIndices != 0)
+    {
+        throw std::runtime_error("BuildMeshlets needs positions and 32-bit indices in the sub-mesh's own storage, and no levels yet");
+    }
+    subMesh.meshlets.clear();
+    uint32_t numTriangles = subMesh.numIndices / 3;
+    if (!subMesh.boneBatches.empty() || numTriangles <= MESHLET_MIN_TRIANGLES)  return 0;
+
+    // Take the triangles in order, ending each meshlet when the next triangle doesn't fit or, once the meshlet is half
+    // full, turns too far from the way it faces
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(subMesh.indexStorage.get());
+    std::vector<uint32_t> vertexMeshlet(subMesh.numVertices, NO_MESHLET); // Last meshlet each vertex was added to
+    uint32_t meshletVertices = 0, meshletTriangles = 0, firstTriangle = 0;
+    CVector3 normalSum = { 0, 0, 0 };
+    for (uint32_t t = 0; t <= numTriangles; ++t)
+    {
+        bool split = (t == numTriangles);
+        uint32_t newVertices = 0;
+        CVector3 normal = { 0, 0, 0 };
+        if (!split)
+        {
+            uint32_t meshlet = static_cast<uint32_t>(subMesh.meshlets.size());
+            const uint32_t* triangle = indices + t * 3;
+            newVertices = (vertexMeshlet[triangle[0]] != meshlet) + (vertexMeshlet[triangle[1]] != meshlet) +
+                          (vertexMeshlet[triangle[2]] != meshlet);
+            normal = AreaNormal(Position(subMesh, triangle[0]), Position(subMesh, triangle[1]), Position(subMesh, triangle[2]));
+            float length = Length(normal);
+            if (length > 0)  normal = normal * (1.0f / length);
+
+            float axisLength = Length(normalSum);
+            bool turns = meshletTriangles >= MESHLET_MAX_TRIANGLES / 2 && length > 0 && axisLength > 0 &&
+                         Dot(normal, normalSum) < MESHLET_SPLIT_DOT * axisLength;
+            split = meshletTriangles > 0 &&
+                    (meshletTriangles == MESHLET_MAX_TRIANGLES || meshletVertices + newVertices > MESHLET_MAX_VERTICES || turns);
+        }
+
+        if (split)
+        {
+            Meshlet meshlet;
+            meshlet.firstIndex = firstTriangle * 3;
+            meshlet.numIndices = (t - firstTriangle) * 3;
+            CalculateMeshletBounds(subMesh, indices, meshlet);
+            subMesh.meshlets.push_back(meshlet);
+            if (t == numTriangles)  break;
+
+            // The triangle starts the next meshlet, all its vertices are new to it
+            firstTriangle = t;
+            meshletVertices = meshletTriangles = 0;
+            normalSum = { 0, 0, 0 };
+            newVertices = 3;
+        }
+
+        uint32_t meshlet = static_cast<uint32_t>(subMesh.meshlets.size());
+        for (int corner = 0; corner < 3; ++corner)  vertexMeshlet[indices[t * 3 + corner]] = meshlet;
+        meshletVertices += newVertices;
+        ++meshletTriangles;
+        normalSum = normalSum + normal;
+    }
+    return static_cast<unsigned int>(subMesh.meshlets.size());
+}
+
+
+//--------------------------------------------------------------------------------------
+// Culling
+//--------------------------------------------------------------------------------------
+
+// Get the view for a node drawn with the given absolute world matrix. The cone test relies on angles, so it is turned
+// off for nodes with non-uniform scaling or mirroring
+// A point p in the node's space is at p * world * viewProjection in clip space, so the frustum planes of the combined
+// matrix are the view's planes in the node's space
+MeshletNodeView MakeMeshletNodeView(const MeshletView& view, const CMatrix4x4& worldMatrix)
+{
+    MeshletNodeView nodeView;
+    nodeView.frustum = FrustumFromMatrix(worldMatrix * view.viewProjection);
+    for (auto& plane : nodeView.frustum.planes)
+    {
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0)  for (int i = 0; i < 4; ++i)  plane[i] /= length;
+    }
+    nodeView.cameraPosition = TransformPoint(view.cameraPosition, InverseAffine(worldMatrix));
+
+    // Angles are kept if the axes of the matrix are the same length, at right angles and not mirrored
+    CVector3 x = worldMatrix.GetRow(0), y = worldMatrix.GetRow(1), z = worldMatrix.GetRow(2);
+    float xx = Dot(x, x), yy = Dot(y, y), zz = Dot(z, z);
+    float tolerance = 0.001f * (xx + yy + zz);
+    bool similar = std::abs(xx - yy) <= tolerance && std::abs(xx - zz) <= tolerance && std::abs(Dot(x, y)) <= tolerance &&
+                   std::abs(Dot(x, z)) <= tolerance && std::abs(Dot(y, z)) <= tolerance && Dot(Cross(x, y), z) > 0;
+    nodeView.cullBackFaces = view.cullBackFaces && similar;
+    return nodeView;
+}
+
+
+// Cull meshlets against a node view and write the index ranges to draw for the visible ones into ranges, as pairs of
+// first index and index count. Visible meshlets that follow on from each other share a range, so ranges needs room for
+// 2 * numMeshlets values at most. Adds to the stats and returns the number of ranges
+// A meshlet is back-facing when the camera is behind all of its triangles: when the direction from the camera to the
+// meshlet is within 90 degrees less the cone's half angle of the cone axis. The cutoff is the cosine of that angle, and
+// the sphere's radius is added as a margin for where in the sphere the triangles actually are
+unsigned int CullMeshlets(const Meshlet* meshlets, unsigned int numMeshlets, const MeshletNodeView& view, uint32_t* ranges,
+                          MeshletStats& stats)
+{
+    unsigned int numRanges = 0;
+    for (unsigned int m = 0; m < numMeshlets; ++m)
+    {
+        const Meshlet& meshlet = meshlets[m];
+        CVector3 centre(meshlet.centre);
+
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; ++p)
+        {
+            const float* plane = view.frustum.planes[p];
+            outside = plane[0] * centre.x + plane[1] * centre.y + plane[2] * centre.z + plane[3] < -meshlet.radius;
+        }
+        if (outside)
+        {
+            ++stats.frustumCulled;
+            stats.culledIndices += meshlet.numIndices;
+            continue;
+        }
+
+        if (view.cullBackFaces)
+        {
+            CVector3 toCentre = centre - view.cameraPosition;
+            if (Dot(toCentre, CVector3(meshlet.coneAxis)) >= meshlet.coneCutoff * Length(toCentre) + meshlet.radius)
+            {
+                ++stats.backFacing;
+                stats.culledIndices += meshlet.numIndices;
+                continue;
+            }
+        }
+
+        // Join onto the last range if this meshlet follows straight on from it
+        if (numRanges > 0 && ranges[numRanges * 2 - 2] + ranges[numRanges * 2 - 1] == meshlet.firstIndex)
+        {
+            ranges[numRanges * 2 - 1] += meshlet.numIndices;
+        }
+        else
+        {
+            ranges[numRanges * 2]     = meshlet.firstIndex;
+            ranges[numRanges * 2 + 1] = meshlet.numIndices;
+            ++numRanges;
+        }
+    }
+    stats.tested += numMeshlets;
+    stats.ranges += numRanges;
+    return numRanges;
+}
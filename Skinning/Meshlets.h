@@ -0,0 +1,97 @@
+//--------------------------------------------------------------------------------------
+// Meshlets - small clusters of a sub-mesh's triangles that can be culled one by one
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Models are culled whole (see Culling.h), so a large mesh with only a corner in view is still
+// drawn in full, and the GPU transforms every vertex just to clip or back-face cull most of the
+// triangles. MeshData::Import splits the full detail triangles of each rigid sub-mesh into
+// meshlets of up to MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles, each a
+// range of the sub-mesh's indices.
+// The triangles are not reordered: meshlets are cut from the vertex cache and overdraw order made
+// by MeshOptimizer.h, which every other pass (shadows, instancing, static batches) draws whole.
+// That order works outwards over the surface, so consecutive triangles are mostly neighbours and
+// a meshlet is ended when the next triangle would not fit. Once a meshlet is half full it is also
+// ended by a triangle facing well away from it, keeping its normal cone narrow enough to cull.
+// Each meshlet has a bounding sphere and a normal cone: the average facing of its triangles and
+// how far the furthest of them turns from it. When drawn, a meshlet is skipped if its sphere is
+// outside the view frustum, or if the camera is behind every one of its triangles (cluster cone
+// culling, Wihlidal, "Optimizing the Graphics Pipeline with Compute", GDC 2016). The visible
+// meshlets are drawn as index ranges, and ranges that follow on from each other are joined into
+// one draw call, as with static batches (see StaticBatch.h).
+// Skinned sub-meshes have no meshlets, their vertices move so the bounds and cones wouldn't hold.
+// Only full detail is clustered, simplified levels are drawn whole (see MeshSimplifier.h).
+
+#ifndef _MESHLETS_H_INCLUDED_
+#define _MESHLETS_H_INCLUDED_
+
+#include "MeshData.h"
+#include "BoundingVolumes.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <cstdint>
+
+
+// Largest meshlet. The sizes used by mesh shader hardware, which keep a meshlet's vertices and triangles in a small
+// fixed amount of on-chip memory. Here they decide how finely a sub-mesh is culled
+const unsigned int MESHLET_MAX_VERTICES  = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// Sub-meshes with no more triangles than this are left as one range, culling parts of them saves too little
+const unsigned int MESHLET_MIN_TRIANGLES = 2 * MESHLET_MAX_TRIANGLES;
+
+// A meshlet at least half full is ended by a triangle whose normal is at a smaller dot product than this with the
+// meshlet's average normal. Higher values give tighter normal cones (more back-facing meshlets culled) but more meshlets
+const float MESHLET_SPLIT_DOT = 0.5f;
+
+
+// Split the full detail triangles of a sub-mesh into meshlets (see Meshlet in MeshData.h), each a range of the indices
+// in their current order. The sub-mesh must have float positions, 32-bit indices in its own storage, no bone batches
+// and no levels of detail yet (levels are made from the final full detail triangles). Sub-meshes with bones or with few
+// triangles get no meshlets. Returns the number of meshlets made
+unsigned int BuildMeshlets(SubMeshData& subMesh);
+
+
+// Meshlet counts since the last reset
+struct MeshletStats
+{
+    unsigned int tested         = 0;
+    unsigned int frustumCulled  = 0;
+    unsigned int backFacing     = 0; // Culled by the normal cone
+    unsigned int culledIndices  = 0; // Indices of all the culled meshlets
+    unsigned int ranges         = 0; // Draw calls made for the visible meshlets...
+    unsigned int subMeshDraws   = 0; // ...in place of this many draw calls of whole sub-meshes
+};
+
+// The view meshlets are culled against when drawing a model (see Mesh::Render). Set up once per pass, the counts in
+// stats are added to by each draw
+struct MeshletView
+{
+    CMatrix4x4   viewProjection;
+    CVector3     cameraPosition;
+    bool         cullBackFaces = true; // Only if the pass culls back faces, e.g. not for outlines drawn from the back faces
+    MeshletStats stats;
+};
+
+
+// A MeshletView moved into the space of one node of a model: the frustum planes normalised so plane distances are in
+// that space, and the camera position in that space
+struct MeshletNodeView
+{
+    Frustum  frustum;
+    CVector3 cameraPosition;
+    bool     cullBackFaces;
+};
+
+// Get the view for a node drawn with the given absolute world matrix. The cone test relies on angles, so it is turned
+// off for nodes with non-uniform scaling or mirroring
+MeshletNodeView MakeMeshletNodeView(const MeshletView& view, const CMatrix4x4& worldMatrix);
+
+// Cull meshlets against a node view and write the index ranges to draw for the visible ones into ranges, as pairs of
+// first index and index count. Visible meshlets that follow on from each other share a range, so ranges needs room for
+// 2 * numMeshlets values at most. Adds to the stats and returns the number of ranges
+unsigned int CullMeshlets(const Meshlet* meshlets, unsigned int numMeshlets, const MeshletNodeView& view, uint32_t* ranges,
+                          MeshletStats& stats);
+
+
+#endif //_MESHLETS_H_INCLUDED_
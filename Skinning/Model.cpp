@@ -9,6 +9,11 @@
 #include "Common.h"
 #include "GraphicsHelpers.h"
 #include "Mesh.h"
+#include "StateCache.h"
+#include "OcclusionCulling.h"
+
+#include <algorithm>
+#include <cmath>
 
 
 Model::Model(Mesh* mesh, CVector3 position /*= { 0,0,0 }*/, CVector3 rotation /*= { 0,0,0 }*/, float scale /*= 1*/)
@@ -18,15 +23,66 @@ Model::Model(Mesh* mesh, CVector3 position /*= { 0,0,0 }*/, CVector3 rotation /*
     mWorldMatrices.resize(mesh->NumberNodes());
     for (int i = 0; i < mWorldMatrices.size(); ++i)
         mWorldMatrices[i] = mesh->GetNodeDefaultMatrix(i);
+
+    // The root matrix is the world matrix for the whole model, so place it on top of the mesh's own root transform. The
+    // defaults leave the root as it is in the mesh
+    mWorldMatrices[0] = mWorldMatrices[0] * MatrixScaling(scale) *
+                        MatrixRotationZ(rotation.z) * MatrixRotationX(rotation.x) * MatrixRotationY(rotation.y) *
+                        MatrixTranslation(position);
 }
 
 
 
-// The render function simply passes this model's matrices over to Mesh:Render.
-// All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
-void Model::Render()
+// The render function simply passes this model's matrices over to Mesh:Render, along with the model's colour and its
+// level of detail. All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
+// Pass a meshlet view to cull the parts of the model outside it (see Meshlets.h)
+void Model::Render(MeshletView* meshletView /*= nullptr*/)
+{
+    gPerModelConstants.objectColour = mColour; // Uploaded with the world matrices by the mesh
+    mMesh->Render(mWorldMatrices, SelectLod(), meshletView);
+}
+
+
+// Draw the model into a software occlusion buffer as an occluder, in its current pose. Always full detail, as the
+// simplified levels can stand outside the original surface
+void Model::AddOccluder(OcclusionBuffer& buffer)
 {
-    mMesh->Render(mWorldMatrices);
+    buffer.AddOccluder(mMesh->GetData(), mWorldMatrices.data());
+}
+
+
+// The level of detail to draw the model at this frame (see Mesh::NumLods), chosen the first time it is asked for in
+// each frame: the coarsest level whose simplification error, projected to the screen from gLodView, is within the
+// limit. A model only moves to a coarser level once that level's error is under LOD_HYSTERESIS of the limit
+unsigned int Model::SelectLod()
+{
+    if (mLodFrame == gLodView.frame)  return mLod;
+    mLodFrame = gLodView.frame;
+
+    unsigned int numLods = mMesh->NumLods();
+    const BoundingSphere& sphere = WorldBoundingSphere();
+    if (numLods == 1 || gLodView.maxPixelError <= 0 || sphere.IsEmpty())
+    {
+        mLod = 0;
+        return mLod;
+    }
+    mLod = std::min(mLod, numLods - 1);
+
+    // Errors are in the mesh's space, scaled by the model's largest scale and seen from the nearest point of its bounds.
+    // Full detail once the camera is inside them
+    float distance = Length(sphere.centre - gLodView.position) - sphere.radius;
+    if (distance <= 0)
+    {
+        mLod = 0;
+        return mLod;
+    }
+    CVector3 scale = Scale();
+    float pixelsPerError = std::max(std::max(scale.x, scale.y), scale.z) * gLodView.pixelsPerUnit / distance;
+
+    // Finer while the current level's error is over the limit, coarser while the next level's is comfortably under it
+    while (mLod > 0 && mMesh->LodError(mLod) * pixelsPerError > gLodView.maxPixelError)  --mLod;
+    while (mLod + 1 < numLods && mMesh->LodError(mLod + 1) * pixelsPerError <= gLodView.maxPixelError * LOD_HYSTERESIS)  ++mLod;
+    return mLod;
 }
 
 
@@ -36,6 +92,13 @@ void Model::Control(int node, float frameTime, KeyCode turnUp, KeyCode turnDown,
 {
     auto& matrix = mWorldMatrices[node]; // Use reference to node matrix to make code below more readable
 
+    // Only count as a change if a key is held, so a model that isn't being moved keeps its cached bounds and shadows
+    if (KeyHeld(turnUp) || KeyHeld(turnDown) || KeyHeld(turnLeft) || KeyHeld(turnRight) ||
+        KeyHeld(turnCW) || KeyHeld(turnCCW) || KeyHeld(moveForward) || KeyHeld(moveBackward))
+    {
+        MatricesChanged();
+    }
+
 	if (KeyHeld( turnUp ))
 	{
 		matrix = MatrixRotationX(ROTATION_SPEED * frameTime) * matrix;
@@ -74,40 +137,79 @@ void Model::Control(int node, float frameTime, KeyCode turnUp, KeyCode turnDown,
 	}
 }
 
+// Play an animation clip on the model, e.g. one of its mesh's clips (Mesh::GetAnimation). The clip must be for a mesh
+// with the same node hierarchy. Pass nullptr to stop animating, the nodes are left in their current pose
+void Model::PlayAnimation(const AnimationClip* clip, bool loop /*= true*/)
+{
+    mAnimation = clip;
+    mAnimationTime = 0;
+    mLoopAnimation = loop;
+    mAnimationCursor = AnimationCursor(); // Clips have different tracks, so start with a new cursor
+}
+
+
+// Advance the animation being played by the frame time and update the node matrices from it. The root node is not
+// animated as its matrix is the world matrix for the whole model
+void Model::UpdateAnimation(float frameTime)
+{
+    if (mAnimation == nullptr)  return;
+
+    mAnimationTime += frameTime;
+    if (mAnimation->duration > 0)
+    {
+        if (mLoopAnimation)  mAnimationTime = std::fmod(mAnimationTime, mAnimation->duration);
+        else                 mAnimationTime = std::min(mAnimationTime, mAnimation->duration);
+    }
+
+    CMatrix4x4 rootMatrix = mWorldMatrices[0];
+    mAnimation->Sample(mAnimationTime, mAnimationCursor, mWorldMatrices.data());
+    mWorldMatrices[0] = rootMatrix;
+    MatricesChanged();
+}
+
+
+// Recalculate the world bounds if the matrices have changed
+void Model::UpdateBounds()
+{
+    if (!mBoundsDirty)  return;
+    mMesh->CalculateWorldBounds(mWorldMatrices, mWorldBounds, mWorldBoundingSphere);
+    mBoundsDirty = false;
+}
+
 void Model::SetStates(ID3D11BlendState* BlendState, ID3D11DepthStencilState* DepthStencilState, ID3D11RasterizerState* Rasterizerstate)
 {
-	gD3DContext->OMSetBlendState(BlendState, nullptr, 0xffffff);
-	gD3DContext->OMSetDepthStencilState(DepthStencilState, 0);
-	gD3DContext->RSSetState(Rasterizerstate);
+	gStateCache.SetBlendState(BlendState);
+	gStateCache.SetDepthStencilState(DepthStencilState);
+	gStateCache.SetRasterizerState(Rasterizerstate);
 }
 
 void Model::SetShaderResources(UINT TextureSlot, ID3D11ShaderResourceView* Texture)
 {
-	gD3DContext->PSSetShaderResources(TextureSlot, 1, &Texture);
+	gStateCache.SetPSShaderResource(TextureSlot, Texture);
 }
 
 //Setup the Vertex Shader
 void Model::Setup(ID3D11VertexShader* VertexShader)
 {
-	gD3DContext->VSSetShader(VertexShader, nullptr, 0);
+	gStateCache.SetVertexShader(VertexShader);
 }
 
 //Setup the Pixel Shader
 void Model::Setup(ID3D11PixelShader* PixelShader)
 {
-	gD3DContext->PSSetShader(PixelShader, nullptr, 0);
+	gStateCache.SetPixelShader(PixelShader);
 }
 
 //Setup the vertex and pixel shader
 void Model::Setup(ID3D11VertexShader* VertexShader, ID3D11PixelShader* PixelShader)
 {
-	gD3DContext->VSSetShader(VertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(PixelShader, nullptr, 0);
+	gStateCache.SetVertexShader(VertexShader);
+	gStateCache.SetPixelShader(PixelShader);
 }
 
 //Set resources to be sent over to the pixel shader at  the given texture slots
 void Model::SetShaderResources(UINT TextureSlot, ID3D11ShaderResourceView* Texture, UINT NormalMapSlot, ID3D11ShaderResourceView* NormalMap)
 {
-	gD3DContext->PSSetShaderResources(TextureSlot, 1, &Texture);
-	gD3DContext->PSSetShaderResources(NormalMapSlot, 1, &NormalMap);
+	gStateCache.SetPSShaderResource(TextureSlot, Texture);
+	gStateCache.SetPSShaderResource(NormalMapSlot, NormalMap);
 }
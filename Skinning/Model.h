@@ -7,6 +7,8 @@
 #include "Common.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
+#include "AnimationClip.h"
+#include "BoundingVolumes.h"
 #include "Input.h"
 
 #include <vector>
@@ -15,6 +17,11 @@
 #define _MODEL_H_INCLUDED_
 
 class Mesh;
+class OcclusionBuffer;
+struct MeshletView;
+
+// A model only moves to a coarser level of detail once that level's projected error is under this fraction of the limit
+const float LOD_HYSTERESIS = 0.75f;
 
 class Model
 {
@@ -26,9 +33,22 @@ public:
     Model(Mesh* mesh, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1);
 
 
-    // The render function simply passes this model's matrices over to Mesh:Render.
-    // All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
-    void Render();
+    // The render function simply passes this model's matrices over to Mesh:Render, along with the model's colour and its
+    // level of detail. All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
+    // Pass a meshlet view to cull the parts of the model outside it (see Meshlets.h)
+    void Render(MeshletView* meshletView = nullptr);
+
+    // Draw the model into a software occlusion buffer as an occluder, in its current pose (see OcclusionCulling.h)
+    void AddOccluder(OcclusionBuffer& buffer);
+
+    // The level of detail to draw the model at this frame (see Mesh::NumLods), chosen the first time it is asked for in
+    // each frame: the coarsest level whose simplification error, projected to the screen from gLodView, is within the
+    // limit. To stop a model near a threshold flickering between levels it only moves to a coarser level once that
+    // level's error is under LOD_HYSTERESIS of the limit
+    unsigned int SelectLod();
+
+    // The mesh the model renders, e.g. to group models of the same mesh into instanced draws
+    Mesh* GetMesh()  { return mMesh; }
 
 
 	// Control a given node in the model using keys provided. Amount of motion performed depends on frame time
@@ -36,6 +56,15 @@ public:
 				                            KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward );
 
 
+    // Play an animation clip on the model, e.g. one of its mesh's clips (Mesh::GetAnimation). The clip must be for a mesh
+    // with the same node hierarchy. Pass nullptr to stop animating, the nodes are left in their current pose
+    void PlayAnimation(const AnimationClip* clip, bool loop = true);
+
+    // Advance the animation being played by the frame time and update the node matrices from it. The root node is not
+    // animated as its matrix is the world matrix for the whole model
+    void UpdateAnimation(float frameTime);
+
+
 	//-------------------------------------
 	// Data access
 	//-------------------------------------
@@ -53,7 +82,7 @@ public:
 	CMatrix4x4 WorldMatrix(int node = 0)  { return mWorldMatrices[node]; }
 
     // Setters - model only stores matricies , so if user sets position, rotation or scale, just update those aspects of the matrix
-	void SetPosition(CVector3 position, int node = 0)  { mWorldMatrices[node].SetRow(3, position); }
+	void SetPosition(CVector3 position, int node = 0)  { mWorldMatrices[node].SetRow(3, position); MatricesChanged(); }
 
 	void SetRotation(CVector3 rotation, int node = 0)
     {
@@ -61,6 +90,7 @@ public:
         mWorldMatrices[node] = MatrixScaling(Scale(node)) *
                                MatrixRotationZ(rotation.z) * MatrixRotationX(rotation.x) * MatrixRotationY(rotation.y) *
                                MatrixTranslation(Position(node));
+        MatricesChanged();
     }
 
 	// Two ways to set scale: x,y,z separately, or all to the same value
@@ -70,10 +100,27 @@ public:
         mWorldMatrices[node].SetRow(0, Normalise(mWorldMatrices[node].GetRow(0)) * scale.x); 
         mWorldMatrices[node].SetRow(1, Normalise(mWorldMatrices[node].GetRow(1)) * scale.y); 
         mWorldMatrices[node].SetRow(2, Normalise(mWorldMatrices[node].GetRow(2)) * scale.z); 
+        MatricesChanged();
     }
 	void SetScale(float scale)  { SetScale({ scale, scale, scale });}
 
-    void SetWorldMatrix(CMatrix4x4 matrix, int node = 0)  { mWorldMatrices[node] = matrix; }
+    void SetWorldMatrix(CMatrix4x4 matrix, int node = 0)  { mWorldMatrices[node] = matrix; MatricesChanged(); }
+
+
+    // World space bounds of the whole model in its current pose, used for culling. Recalculated on request if any of
+    // the matrices have changed since the last call
+    const AABB&           WorldBounds()          { UpdateBounds(); return mWorldBounds; }
+    const BoundingSphere& WorldBoundingSphere()  { UpdateBounds(); return mWorldBoundingSphere; }
+
+    // Count of changes to the model's matrices. Compare with an earlier value to see if the model has moved or been
+    // animated since then (e.g. to decide if a cached shadow map is still valid)
+    unsigned int MatrixVersion()  { return mMatrixVersion; }
+
+    // Colour sent to the shaders with the model (the object colour in the per-model constants, or the instance colour
+    // when instanced). Light models are tinted with it to match their light, other shaders ignore it
+    CVector3 Colour()  { return mColour; }
+    void SetColour(CVector3 colour)  { mColour = colour; }
+
 
     void SetStates(ID3D11BlendState* BlendState, ID3D11DepthStencilState* DepthStencilState, ID3D11RasterizerState* Rasterizerstate);
 
@@ -92,12 +139,38 @@ public:
 	// Private data / members
 	//-------------------------------------
 private:
+    // Call whenever any of the matrices are changed
+    void MatricesChanged()  { mBoundsDirty = true; ++mMatrixVersion; }
+
+    // Recalculate the world bounds if the matrices have changed
+    void UpdateBounds();
+
+
     Mesh* mMesh;
 
 	// World matrices for the model
     // Now that meshes have multiple parts, we need multiple matrices. The root matrix (the first one) is the world matrix
     // for the entire model. The remaining matrices are relative to their parent part. The hierarchy is defined in the mesh (nodes)
 	std::vector<CMatrix4x4> mWorldMatrices;
+
+    // Animation being played, nullptr if none, and the playback position in it
+    const AnimationClip* mAnimation     = nullptr;
+    AnimationCursor      mAnimationCursor;
+    float                mAnimationTime = 0;
+    bool                 mLoopAnimation = true;
+
+    // World bounds from the current matrices, only valid when not dirty. Anything that changes the matrices sets dirty
+    AABB           mWorldBounds;
+    BoundingSphere mWorldBoundingSphere;
+    bool           mBoundsDirty = true;
+
+    unsigned int   mMatrixVersion = 0;
+
+    // Level of detail and the gLodView frame it was chosen in
+    unsigned int   mLod      = 0;
+    unsigned int   mLodFrame = ~0u;
+
+    CVector3       mColour = { 1, 1, 1 };
 };
 
 
@@ -1,10 +1,9 @@
 #include "Common.hlsli"
+#include "ClusteredLighting.hlsli" // Point lights, spotlights and the shadow atlas
 
 Texture2D DiffuseSpecularMap : register(t0);
 SamplerState TexSampler : register(s0);
 
-Texture2D ShadowMapLight1 : register(t1);
-SamplerState PointClamp : register(s1);
 Texture2D NormalMap : register(t2);
 
 
@@ -42,60 +41,19 @@ float4 main(NormalMappingPixelShaderInput input) : SV_Target
    // Lighting equations
     float3 cameraDirection = normalize(gCameraPosition - input.worldPosition);
 
-    // Light 1
-    float3 light1Vector = Light1.Position - input.worldPosition;
-    float light1Distance = length(light1Vector);
-    float3 light1Direction = light1Vector / light1Distance; // Quicker than normalising as we have length for attenuation
-    float3 diffuseLight1 = Light1.Colour * max(dot(worldNormal, light1Direction), 0) / light1Distance;
+    // Start with the ambient light, added once here rather than for each light (or we will get too much ambient)
+    float3 diffuseLight = gAmbientColour;
+    float3 specularLight = 0;
 
-    float3 halfway = normalize(light1Direction + cameraDirection);
-    float3 specularLight1 = diffuseLight1 * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
+    // Point lights and spotlights
+    AddClusteredLights(input.projectedPosition, input.worldPosition, worldNormal, cameraDirection, diffuseLight, specularLight);
 
-
-    // Light 2
-    float3 light2Vector = Light2.Position - input.worldPosition;
-    float light2Distance = length(light2Vector);
-    float3 light2Direction = light2Vector / light2Distance;
-    float3 diffuseLight2 = Light2.Colour * max(dot(worldNormal, light2Direction), 0) / light2Distance;
-
-    halfway = normalize(light2Direction + cameraDirection);
-    float3 specularLight2 = diffuseLight2 * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
-
-    
-    float3 light3Direction = normalize(Light3.Position - input.worldPosition);
-    float3 diffuseLight3 = 0;
-    float3 specularLight3 = 0;
-    
-    if (dot(Light3.Direction, -light3Direction) > Light3.CosHalfAngle)
-    {
-        if (dot(Light3.Direction, -light3Direction) > Light3.CosHalfAngle)
-        {
-            float4 light3ViewPosition = mul(Light3.lightViewMatrix, float4(input.worldPosition, 1.0f));
-            float4 light3Projection = mul(Light3.lightProjectionMatrix, light3ViewPosition);
-        
-            float2 ShadowMapUV = 0.5f * light3Projection.xy / light3Projection.w + float2(0.5f, 0.5f);
-            ShadowMapUV.y = 1.0f - ShadowMapUV.y;
-        
-            float depthFromLight3 = light3Projection.z / light3Projection.w - DepthAdjust;
-            if (depthFromLight3 < ShadowMapLight1.Sample(PointClamp, ShadowMapUV).r)
-            {
-                float3 light3Dist = length(Light3.Position - input.worldPosition);
-                diffuseLight3 = Light3.Colour * max(dot(worldNormal, light3Direction), 0) / light3Dist;
-                halfway = normalize(light3Direction + cameraDirection);
-                specularLight3 = diffuseLight3 * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
-            }
-        }
-    }
-
-    
-    float3 light4Vec = -(normalize(Light4.Direction));
-    float3 diffuseLight4 = Light4.Colour * max(dot(light4Vec, worldNormal), 0.0f);
-    halfway = normalize(light4Vec + cameraDirection);
-    float3 specularLight4 = diffuseLight4 * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
-
-	// Sum the effect of the lights - add the ambient at this stage rather than for each light (or we will get too much ambient)
-    float3 diffuseLight = gAmbientColour + diffuseLight1 + diffuseLight2 + diffuseLight3 + diffuseLight4;
-    float3 specularLight = specularLight1 + specularLight2 + specularLight3 + specularLight4;
+    // Directional light
+    float3 directionalLightVec = -(normalize(gDirectionalLight.Direction));
+    float3 diffuseDirectional = gDirectionalLight.Colour * max(dot(directionalLightVec, worldNormal), 0.0f) * ShadowFactor(gDirectionalLight.Shadow, input.worldPosition);
+    float3 halfway = normalize(directionalLightVec + cameraDirection);
+    diffuseLight  += diffuseDirectional;
+    specularLight += diffuseDirectional * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
 
     // Sample diffuse material colour for this pixel from a texture using a given sampler that you set up in the C++ code
     // Ignoring any alpha in the texture, just reading RGB
@@ -17,8 +17,8 @@ NormalMappingPixelShaderInput main(TangentVertex modelVertex)
     output.worldPosition = worldPosition.xyz; // Also pass world position to pixel shader for lighting
 
 	// Unlike the position, send the model's normal and tangent untransformed (in model space). The pixel shader will do the matrix work on normals
-    output.modelNormal = modelVertex.normal;
-    output.modelTangent = modelVertex.tangent;
+    output.modelNormal = DecodeOctahedral(modelVertex.normal);
+    output.modelTangent = DecodeOctahedral(modelVertex.tangent);
 
     // Pass texture coordinates (UVs) on to the pixel shader, the vertex shader doesn't need them
     output.uv = modelVertex.uv;
@@ -0,0 +1,745 @@
+//--------------------------------------------------------------------------------------
+// Occlusion culling - skip models hidden behind others, using a small depth buffer drawn on the CPU
+//--------------------------------------------------------------------------------------
+
+#include "OcclusionCulling.h"
+#include "ThreadPool.h"
+#include "SimdSupport.h"
+#include "Camera.h"
+
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cfloat>
+
+
+namespace
+{
+    // Position of a vertex in a sub-mesh
+    void Position(const SubMeshData& subMesh, uint32_t v, float* position)
+    {
+        std::memcpy(position, subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize + subMesh.positionOffset, sizeof(float) * 3);
+    }
+
+    // Pixel range covered by a span of screen coordinates, clamped to [0, size). Pixels are 1 unit across. If centres is
+    // true only pixels whose centre is in the span count, otherwise any pixel the span touches
+    void PixelRange(float minimum, float maximum, unsigned int size, bool centres, int& first, int& last)
+    {
+        float offset = centres ? 0.5f : 0.0f;
+        minimum = std::min(std::max(minimum - offset, -1.0f), static_cast<float>(size));
+        maximum = std::max(std::min(maximum - offset, static_cast<float>(size)), -1.0f);
+        first = std::max(static_cast<int>(centres ? std::ceil(minimum) : std::floor(minimum)), 0);
+        last  = std::min(static_cast<int>(std::floor(maximum)), static_cast<int>(size) - 1);
+    }
+
+    // Distance in pixels that edges are widened by, so pixels an edge only grazes aren't missed through rounding
+    const float EDGE_MARGIN = 1.0f / 256;
+
+    // Call function(x, y) for each pixel in rows [y0, y1] and columns [0, width) touched by the line from (ax, ay) to
+    // (bx, by), including pixels it only grazes
+    template <typename Function>
+    void LinePixels(float ax, float ay, float bx, float by, int y0, int y1, int width, Function function)
+    {
+        if (ay > by)  { std::swap(ax, bx);  std::swap(ay, by); }
+        float top    = std::max(ay - EDGE_MARGIN, static_cast<float>(y0));
+        float bottom = std::min(by + EDGE_MARGIN, static_cast<float>(y1 + 1));
+        if (top >= bottom)  return;
+
+        bool  flat  = (by - ay < EDGE_MARGIN);
+        float slope = flat ? 0.0f : (bx - ax) / (by - ay);
+        for (int y = static_cast<int>(std::floor(top)); y <= std::min(static_cast<int>(std::floor(bottom)), y1); ++y)
+        {
+            // x where the line enters and leaves the row, a flat line crosses its whole row
+            float enter = ax, leave = bx;
+            if (!flat)
+            {
+                enter = ax + slope * (std::min(std::max(static_cast<float>(y),     ay), by) - ay);
+                leave = ax + slope * (std::min(std::max(static_cast<float>(y + 1), ay), by) - ay);
+            }
+            float left  = std::max(std::min(enter, leave) - EDGE_MARGIN, -1.0f);
+            float right = std::min(std::max(enter, leave) + EDGE_MARGIN, static_cast<float>(width));
+            int first = std::max(static_cast<int>(std::floor(left)), 0);
+            int last  = std::min(static_cast<int>(std::floor(right)), width - 1);
+            for (int x = first; x <= last; ++x)  function(x, y);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------------------
+    // Row kernels
+    //--------------------------------------------------------------------------------------
+    // Draw pixels [x0, x1] of row y of a triangle into the row's depths, keeping the nearer depth where the pixel centre
+    // is inside. The SIMD kernels start at x0 rounded down to a whole group of pixels and carry on past x1 to the end of
+    // the group, which is safe as the buffer is a whole number of tiles across and the edge tests reject those pixels.
+    // Every kernel works out each pixel's values the same way (not stepping from the last pixel), so they agree to within
+    // float rounding (the AVX2 kernel uses fused multiply-add, so depths can differ in the last bit)
+
+    struct RowSetup
+    {
+        float edgeA[3], edgeRow[3]; // Edge functions along the row: edgeA * x + edgeRow
+        float depthA, depthRow;
+    };
+
+    void RasterRowScalar(const RowSetup& row, int x0, int x1, float* depth)
+    {
+        for (int x = x0; x <= x1; ++x)
+        {
+            float px = static_cast<float>(x) + 0.5f;
+            if (row.edgeA[0] * px + row.edgeRow[0] >= 0 && row.edgeA[1] * px + row.edgeRow[1] >= 0 &&
+                row.edgeA[2] * px + row.edgeRow[2] >= 0)
+            {
+                depth[x] = std::min(depth[x], row.depthA * px + row.depthRow);
+            }
+        }
+    }
+
+#if MATH_SIMD_SSE
+    void RasterRowSSE(const RowSetup& row, int x0, int x1, float* depth)
+    {
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 a0 = _mm_set1_ps(row.edgeA[0]), r0 = _mm_set1_ps(row.edgeRow[0]);
+        const __m128 a1 = _mm_set1_ps(row.edgeA[1]), r1 = _mm_set1_ps(row.edgeRow[1]);
+        const __m128 a2 = _mm_set1_ps(row.edgeA[2]), r2 = _mm_set1_ps(row.edgeRow[2]);
+        const __m128 da = _mm_set1_ps(row.depthA),   dr = _mm_set1_ps(row.depthRow);
+        for (int x = x0 & ~3; x <= x1; x += 4)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), r0), zero),
+                                                  _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), r1), zero)),
+                                       _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), r2), zero));
+            if (_mm_movemask_ps(inside) == 0)  continue;
+
+            __m128 current = _mm_loadu_ps(depth + x);
+            __m128 nearer  = _mm_min_ps(current, _mm_add_ps(_mm_mul_ps(da, px), dr));
+            _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+        }
+    }
+
+    SIMD_TARGET_AVX2 void RasterRowAVX2(const RowSetup& row, int x0, int x1, float* depth)
+    {
+        const __m256 offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 a0 = _mm256_set1_ps(row.edgeA[0]), r0 = _mm256_set1_ps(row.edgeRow[0]);
+        const __m256 a1 = _mm256_set1_ps(row.edgeA[1]), r1 = _mm256_set1_ps(row.edgeRow[1]);
+        const __m256 a2 = _mm256_set1_ps(row.edgeA[2]), r2 = _mm256_set1_ps(row.edgeRow[2]);
+        const __m256 da = _mm256_set1_ps(row.depthA),   dr = _mm256_set1_ps(row.depthRow);
+        for (int x = x0 & ~7; x <= x1; x += 8)
+        {
+            __m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), offsets);
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(_mm256_fmadd_ps(a0, px, r0), zero, _CMP_GE_OQ),
+                                                        _mm256_cmp_ps(_mm256_fmadd_ps(a1, px, r1), zero, _CMP_GE_OQ)),
+                                          _mm256_cmp_ps(_mm256_fmadd_ps(a2, px, r2), zero, _CMP_GE_OQ));
+            if (_mm256_movemask_ps(inside) == 0)  continue;
+
+            __m256 current = _mm256_loadu_ps(depth + x);
+            __m256 nearer  = _mm256_min_ps(current, _mm256_fmadd_ps(da, px, dr));
+            _mm256_storeu_ps(depth + x, _mm256_blendv_ps(current, nearer, inside));
+        }
+    }
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------
+// Occlusion buffer
+//--------------------------------------------------------------------------------------
+
+// Create a buffer of the given size in pixels, rounded up to whole tiles. Space for the given number of occluder
+// triangles and vertices is reserved so the buffer doesn't use the heap each frame
+OcclusionBuffer::OcclusionBuffer(unsigned int width /*= 256*/, unsigned int height /*= 192*/, unsigned int maxTriangles /*= 16384*/)
+{
+    mTilesX = std::max((width  + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE, 1u);
+    mTilesY = std::max((height + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE, 1u);
+    mWidth  = mTilesX * OCCLUSION_TILE_SIZE;
+    mHeight = mTilesY * OCCLUSION_TILE_SIZE;
+    mDepth.assign(mWidth * mHeight, 1.0f);
+    mOccluderDepth.assign(mWidth * mHeight, 1.0f);
+    mTileDepth.assign(mTilesX * mTilesY, 1.0f);
+
+    mOccluders.reserve(64);
+    mClipVertices.reserve(maxTriangles * 4); // Meshes have roughly half as many vertices as triangles
+    mTriangles.reserve(maxTriangles * 2);
+    mEdges.reserve(maxTriangles * 3);
+    mNodeMatrices.reserve(64);
+}
+
+
+// Start a new frame: remove all the occluders and set the view-projection matrix the buffer is drawn from
+void OcclusionBuffer::Begin(const CMatrix4x4& viewProjection)
+{
+    mViewProjection = viewProjection;
+    mOccluders.clear();
+    mClipVertices.clear();
+    mTriangles.clear();
+    mEdges.clear();
+}
+
+
+// Add a sub-mesh's full detail triangles, placed in the world by the given matrix. Sub-meshes with bones are ignored.
+// The sub-mesh must stay valid until Render
+void OcclusionBuffer::AddOccluder(const SubMeshData& subMesh, const CMatrix4x4& worldMatrix)
+{
+    if (subMesh.bonesOffset != SubMeshData::NO_ELEMENT || subMesh.positionOffset == SubMeshData::NO_ELEMENT)  return;
+    unsigned int numTriangles = subMesh.numIndices / 3;
+    if (numTriangles == 0)  return;
+
+    Occluder occluder;
+    occluder.subMesh       = &subMesh;
+    occluder.matrix        = worldMatrix * mViewProjection;
+    occluder.firstVertex   = static_cast<unsigned int>(mClipVertices.size() / 4);
+    occluder.firstTriangle = static_cast<unsigned int>(mTriangles.size());
+    occluder.numTriangles  = 0;
+    occluder.firstEdge     = static_cast<unsigned int>(mEdges.size());
+    mOccluders.push_back(occluder);
+
+    mClipVertices.resize(mClipVertices.size() + subMesh.numVertices * 4);
+    mTriangles.resize(mTriangles.size() + numTriangles * 2);
+    mEdges.resize(mEdges.size() + numTriangles * 3);
+
+    ++mStats.occluders;
+    mStats.triangles += numTriangles;
+}
+
+
+// Add all the sub-meshes of a mesh, given a model's matrices for its nodes (relative to their parents, as passed to
+// Mesh::Render). Nodes are in depth-first order so each parent's absolute matrix is ready before its children's
+void OcclusionBuffer::AddOccluder(const MeshData& mesh, const CMatrix4x4* modelMatrices)
+{
+    unsigned int numNodes = static_cast<unsigned int>(mesh.nodes.size());
+    mNodeMatrices.resize(numNodes);
+    for (unsigned int i = 0; i < numNodes; ++i)
+    {
+        mNodeMatrices[i] = (i == 0) ? modelMatrices[0] : modelMatrices[i] * mNodeMatrices[mesh.nodes[i].parentIndex];
+        for (auto subMesh : mesh.nodes[i].subMeshes)  AddOccluder(mesh.subMeshes[subMesh], mNodeMatrices[i]);
+    }
+}
+
+
+// Draw the occluders into the depth buffer and update the tiles. The occluders are transformed in parallel and then each
+// band of tiles is drawn in parallel if a thread pool is given, the result is identical either way
+void OcclusionBuffer::Render(ThreadPool* threadPool /*= nullptr*/)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto setup = [this](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; ++i)  SetupOccluder(mOccluders[i]);
+    };
+    auto bands = [this](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int tileRow = begin; tileRow < end; ++tileRow)  RenderBand(tileRow);
+    };
+
+    unsigned int numOccluders = static_cast<unsigned int>(mOccluders.size());
+    if (threadPool != nullptr)
+    {
+        threadPool->ParallelFor(numOccluders, 1, setup);
+        threadPool->ParallelFor(mTilesY, 1, bands);
+    }
+    else
+    {
+        setup(0, numOccluders);
+        bands(0, mTilesY);
+    }
+
+    for (auto& occluder : mOccluders)  mStats.rasterized += occluder.numTriangles;
+    std::chrono::duration<float, std::milli> time = std::chrono::steady_clock::now() - start;
+    mStats.renderTime += time.count();
+}
+
+
+// Transform an occluder's vertices to clip space, then clip, cull and set up its triangles
+void OcclusionBuffer::SetupOccluder(Occluder& occluder)
+{
+    const SubMeshData& subMesh = *occluder.subMesh;
+    const CMatrix4x4&  m = occluder.matrix;
+
+    // Row vector times matrix, keeping w
+    float* clip = &mClipVertices[static_cast<std::size_t>(occluder.firstVertex) * 4];
+    for (uint32_t v = 0; v < subMesh.numVertices; ++v)
+    {
+        float p[3];
+        Position(subMesh, v, p);
+        float* out = clip + static_cast<std::size_t>(v) * 4;
+        out[0] = p[0] * m.e00 + p[1] * m.e10 + p[2] * m.e20 + m.e30;
+        out[1] = p[0] * m.e01 + p[1] * m.e11 + p[2] * m.e21 + m.e31;
+        out[2] = p[0] * m.e02 + p[1] * m.e12 + p[2] * m.e22 + m.e32;
+        out[3] = p[0] * m.e03 + p[1] * m.e13 + p[2] * m.e23 + m.e33;
+    }
+
+    // Triangles that aren't clipped keep their mesh edges for matching up with their neighbours. A clipped one is split
+    // into pieces that are only matched with each other, its other edges are treated as on the occluder's outline
+    Triangle* triangles = &mTriangles[occluder.firstTriangle];
+    Edge*     edges     = &mEdges[occluder.firstEdge];
+    unsigned int numTriangles = 0, numEdges = 0;
+    for (uint32_t i = 0; i + 2 < subMesh.numIndices; i += 3)
+    {
+        uint32_t v[3] = { subMesh.Index(i), subMesh.Index(i + 1), subMesh.Index(i + 2) };
+        const float* a = clip + static_cast<std::size_t>(v[0]) * 4;
+        const float* b = clip + static_cast<std::size_t>(v[1]) * 4;
+        const float* c = clip + static_cast<std::size_t>(v[2]) * 4;
+        unsigned int added = SetupTriangle(a, b, c, triangles + numTriangles);
+        if (added == 1 && a[2] >= 0 && b[2] >= 0 && c[2] >= 0)
+        {
+            for (uint32_t e = 0; e < 3; ++e)
+            {
+                uint32_t p = v[e], q = v[(e + 1) % 3];
+                uint64_t key = (static_cast<uint64_t>(std::min(p, q)) << 32) | std::max(p, q);
+                edges[numEdges++] = { key, numTriangles, e + (p > q ? 4 : 0) };
+            }
+        }
+        else if (added == 2)
+        {
+            triangles[numTriangles].neighbour[2]     = numTriangles + 1;
+            triangles[numTriangles + 1].neighbour[0] = numTriangles;
+        }
+        numTriangles += added;
+    }
+    occluder.numTriangles = numTriangles;
+
+    // An edge used once in each direction lies between two front faces. Others are on the outline: next to a back face,
+    // culled or clipped triangle, a hole in the mesh, or used by more than two triangles
+    std::sort(edges, edges + numEdges, [](const Edge& l, const Edge& r) { return l.key < r.key; });
+    for (unsigned int first = 0; first < numEdges; )
+    {
+        unsigned int end = first + 1;
+        while (end < numEdges && edges[end].key == edges[first].key)  ++end;
+        if (end == first + 2 && (edges[first].side & 4) != (edges[first + 1].side & 4))
+        {
+            triangles[edges[first].triangle].neighbour[edges[first].side & 3]         = edges[first + 1].triangle;
+            triangles[edges[first + 1].triangle].neighbour[edges[first + 1].side & 3] = edges[first].triangle;
+        }
+        first = end;
+    }
+
+    // Pixels touched by any triangle, widened as the edges are when drawn
+    occluder.minX = occluder.minY = 0;
+    occluder.maxX = occluder.maxY = -1;
+    if (numTriangles == 0)  return;
+    float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+    for (unsigned int i = 0; i < numTriangles; ++i)
+    {
+        const Triangle& t = triangles[i];
+        minX = std::min({ minX, t.cornerX[0], t.cornerX[1], t.cornerX[2] });
+        maxX = std::max({ maxX, t.cornerX[0], t.cornerX[1], t.cornerX[2] });
+        minY = std::min({ minY, t.cornerY[0], t.cornerY[1], t.cornerY[2] });
+        maxY = std::max({ maxY, t.cornerY[0], t.cornerY[1], t.cornerY[2] });
+    }
+    PixelRange(minX - EDGE_MARGIN, maxX + EDGE_MARGIN, mWidth,  false, occluder.minX, occluder.maxX);
+    PixelRange(minY - EDGE_MARGIN, maxY + EDGE_MARGIN, mHeight, false, occluder.minY, occluder.maxY);
+}
+
+
+// Set up a triangle given in clip space (x, y, z, w), clipping it to the near plane first. Adds up to two triangles to
+// the output, returns how many
+unsigned int OcclusionBuffer::SetupTriangle(const float* a, const float* b, const float* c, Triangle* output)
+{
+    // Skip triangles entirely outside one side of the frustum
+    const float* vertices[3] = { a, b, c };
+    unsigned int outside[6] = {};
+    for (auto v : vertices)
+    {
+        outside[0] += (v[0] < -v[3]);  outside[1] += (v[0] > v[3]);
+        outside[2] += (v[1] < -v[3]);  outside[3] += (v[1] > v[3]);
+        outside[4] += (v[2] < 0);      outside[5] += (v[2] > v[3]);
+    }
+    for (auto count : outside)
+    {
+        if (count == 3)  return 0;
+    }
+
+    // Clip to the near plane (z >= 0), which leaves a triangle or a four-sided polygon with w > 0 at every corner
+    float polygon[4][4];
+    unsigned int numCorners = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        const float* p = vertices[i];
+        const float* q = vertices[(i + 1) % 3];
+        if (p[2] >= 0)  std::copy(p, p + 4, polygon[numCorners++]);
+        if ((p[2] >= 0) != (q[2] >= 0))
+        {
+            float t = p[2] / (p[2] - q[2]);
+            for (int k = 0; k < 4; ++k)  polygon[numCorners][k] = p[k] + (q[k] - p[k]) * t;
+            polygon[numCorners++][2] = 0;
+        }
+    }
+    if (numCorners < 3)  return 0;
+
+    // Screen positions in pixels with y down, and depth
+    float screen[4][3];
+    for (unsigned int i = 0; i < numCorners; ++i)
+    {
+        float rw = 1.0f / polygon[i][3];
+        screen[i][0] = (polygon[i][0] * rw * 0.5f + 0.5f) * mWidth;
+        screen[i][1] = (0.5f - polygon[i][1] * rw * 0.5f) * mHeight;
+        screen[i][2] = polygon[i][2] * rw;
+    }
+
+    // Set up each triangle of the polygon as a fan
+    unsigned int numTriangles = 0;
+    for (unsigned int corner = 2; corner < numCorners; ++corner)
+    {
+        const float* s0 = screen[0];
+        const float* s1 = screen[corner - 1];
+        const float* s2 = screen[corner];
+
+        // Clockwise on screen is a positive area with y down. Skips back faces and those with no area
+        float e1x = s1[0] - s0[0], e1y = s1[1] - s0[1];
+        float e2x = s2[0] - s0[0], e2y = s2[1] - s0[1];
+        float area = e1x * e2y - e1y * e2x;
+        if (!(area > 0))  continue;
+
+        // Kept even if no pixel centre is inside, as its edges still count. Edge p->q:
+        // (q.x - p.x) * (y - p.y) - (q.y - p.y) * (x - p.x), positive on the inside of a clockwise triangle
+        Triangle& t = output[numTriangles];
+        PixelRange(std::min({ s0[0], s1[0], s2[0] }), std::max({ s0[0], s1[0], s2[0] }), mWidth,  true, t.minX, t.maxX);
+        PixelRange(std::min({ s0[1], s1[1], s2[1] }), std::max({ s0[1], s1[1], s2[1] }), mHeight, true, t.minY, t.maxY);
+        const float* edge[4] = { s0, s1, s2, s0 };
+        for (int e = 0; e < 3; ++e)
+        {
+            const float* p = edge[e];
+            const float* q = edge[e + 1];
+            t.edgeA[e] = p[1] - q[1];
+            t.edgeB[e] = q[0] - p[0];
+            t.edgeC[e] = (q[1] - p[1]) * p[0] - (q[0] - p[0]) * p[1];
+            t.cornerX[e] = p[0];
+            t.cornerY[e] = p[1];
+            t.neighbour[e] = NO_NEIGHBOUR;
+        }
+
+        // Depth plane through the corners, raised to the furthest depth it reaches anywhere over a pixel, so the
+        // occluder is never nearer in the buffer than it really is
+        float dz1 = s1[2] - s0[2], dz2 = s2[2] - s0[2];
+        t.depthA = (dz1 * e2y - dz2 * e1y) / area;
+        t.depthB = (dz2 * e1x - dz1 * e2x) / area;
+        t.depthC = s0[2] - t.depthA * s0[0] - t.depthB * s0[1] + 0.5f * (std::abs(t.depthA) + std::abs(t.depthB));
+        ++numTriangles;
+    }
+    return numTriangles;
+}
+
+
+// Clear and draw one band of tiles, then work out its tiles' furthest depths
+void OcclusionBuffer::RenderBand(unsigned int tileRow)
+{
+    int y0 = static_cast<int>(tileRow * OCCLUSION_TILE_SIZE);
+    int y1 = y0 + static_cast<int>(OCCLUSION_TILE_SIZE) - 1;
+    float* band = &mDepth[static_cast<std::size_t>(y0) * mWidth];
+    std::fill(band, band + OCCLUSION_TILE_SIZE * mWidth, 1.0f);
+
+    for (auto& occluder : mOccluders)  RenderOccluder(occluder, y0, y1);
+
+    // Furthest depth in each tile of the band
+    for (unsigned int tileX = 0; tileX < mTilesX; ++tileX)
+    {
+        float furthest = 0;
+        for (unsigned int y = 0; y < OCCLUSION_TILE_SIZE; ++y)
+        {
+            const float* row = band + y * mWidth + tileX * OCCLUSION_TILE_SIZE;
+            furthest = std::max(furthest, *std::max_element(row, row + OCCLUSION_TILE_SIZE));
+        }
+        mTileDepth[tileRow * mTilesX + tileX] = furthest;
+    }
+}
+
+
+// Draw an occluder's triangles and edges into its own copy of the rows [y0, y1], then merge it into the buffer
+// A pixel whose centre is covered is entirely covered unless an edge on the outline crosses it, and any other triangle
+// reaching into it has an edge crossing it, so the edges are all that's needed to make the pixel conservative
+void OcclusionBuffer::RenderOccluder(const Occluder& occluder, int y0, int y1)
+{
+    y0 = std::max(y0, occluder.minY);
+    y1 = std::min(y1, occluder.maxY);
+    if (y0 > y1 || occluder.minX > occluder.maxX)  return;
+    for (int y = y0; y <= y1; ++y)
+    {
+        float* row = &mOccluderDepth[static_cast<std::size_t>(y) * mWidth];
+        std::fill(row + occluder.minX, row + occluder.maxX + 1, 1.0f);
+    }
+
+    auto rasterRow = RasterRowScalar;
+#if MATH_SIMD_SSE
+    switch (GetMatrixKernel())
+    {
+    case MatrixKernel::AVX2:  rasterRow = RasterRowAVX2;  break;
+    case MatrixKernel::SSE:   rasterRow = RasterRowSSE;   break;
+    default:  break;
+    }
+#endif
+
+    // Pixels whose centres are inside
+    const Triangle* triangles = &mTriangles[occluder.firstTriangle];
+    for (unsigned int i = 0; i < occluder.numTriangles; ++i)
+    {
+        const Triangle& t = triangles[i];
+        if (t.minX > t.maxX || t.maxY < y0 || t.minY > y1)  continue;
+
+        for (int y = std::max(t.minY, y0); y <= std::min(t.maxY, y1); ++y)
+        {
+            float py = static_cast<float>(y) + 0.5f;
+            RowSetup row;
+            for (int e = 0; e < 3; ++e)
+            {
+                row.edgeA[e]   = t.edgeA[e];
+                row.edgeRow[e] = t.edgeB[e] * py + t.edgeC[e];
+            }
+            row.depthA   = t.depthA;
+            row.depthRow = t.depthB * py + t.depthC;
+            rasterRow(row, t.minX, t.maxX, &mOccluderDepth[static_cast<std::size_t>(y) * mWidth]);
+        }
+    }
+
+    // Pixels touched by edges: uncovered on the outline, otherwise no nearer than either triangle gets over the pixel.
+    // Each edge between two triangles is drawn once, by the triangle with the lower index
+    for (unsigned int i = 0; i < occluder.numTriangles; ++i)
+    {
+        const Triangle& t = triangles[i];
+        for (int e = 0; e < 3; ++e)
+        {
+            uint32_t neighbour = t.neighbour[e];
+            if (neighbour != NO_NEIGHBOUR && neighbour < i)  continue;
+
+            const Triangle* n = (neighbour != NO_NEIGHBOUR) ? &triangles[neighbour] : nullptr;
+            LinePixels(t.cornerX[e], t.cornerY[e], t.cornerX[(e + 1) % 3], t.cornerY[(e + 1) % 3], y0, y1, mWidth,
+                       [&](int x, int y)
+            {
+                float& depth = mOccluderDepth[static_cast<std::size_t>(y) * mWidth + x];
+                if (n == nullptr)  { depth = 1.0f;  return; }
+                float px = static_cast<float>(x) + 0.5f, py = static_cast<float>(y) + 0.5f;
+                depth = std::max({ depth, t.depthA  * px + t.depthB  * py + t.depthC,
+                                          n->depthA * px + n->depthB * py + n->depthC });
+            });
+        }
+    }
+
+    for (int y = y0; y <= y1; ++y)
+    {
+        std::size_t start = static_cast<std::size_t>(y) * mWidth;
+        for (int x = occluder.minX; x <= occluder.maxX; ++x)
+        {
+            mDepth[start + x] = std::min(mDepth[start + x], mOccluderDepth[start + x]);
+        }
+    }
+}
+
+
+// False if a world space box is hidden behind the occluders drawn by the last Render. Boxes that reach in front of the
+// near clip plane are always visible, and only the part of a box on the screen is tested. Only reads the buffer, so can
+// be called from several threads at once
+// The nearest depth of a box is at one of its corners, and the box covers no more of the screen than its corners' bounds
+bool OcclusionBuffer::IsVisible(const AABB& box) const
+{
+    if (box.IsEmpty())  return true;
+
+    const CMatrix4x4& m = mViewProjection;
+    float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        float p[3] = { (corner & 1) ? box.maximum.x : box.minimum.x,
+                       (corner & 2) ? box.maximum.y : box.minimum.y,
+                       (corner & 4) ? box.maximum.z : box.minimum.z };
+        float x = p[0] * m.e00 + p[1] * m.e10 + p[2] * m.e20 + m.e30;
+        float y = p[0] * m.e01 + p[1] * m.e11 + p[2] * m.e21 + m.e31;
+        float z = p[0] * m.e02 + p[1] * m.e12 + p[2] * m.e22 + m.e32;
+        float w = p[0] * m.e03 + p[1] * m.e13 + p[2] * m.e23 + m.e33;
+        if (z < 0)  return true; // In front of the near plane, the box may surround the camera
+
+        float rw = 1.0f / w;
+        float screenX = (x * rw * 0.5f + 0.5f) * mWidth;
+        float screenY = (0.5f - y * rw * 0.5f) * mHeight;
+        minX = std::min(minX, screenX);  maxX = std::max(maxX, screenX);
+        minY = std::min(minY, screenY);  maxY = std::max(maxY, screenY);
+        nearest = std::min(nearest, z * rw);
+    }
+
+    int x0, x1, y0, y1;
+    PixelRange(minX, maxX, mWidth,  false, x0, x1);
+    PixelRange(minY, maxY, mHeight, false, y0, y1);
+    if (x0 > x1 || y0 > y1)  return true; // Off the screen, left to frustum culling
+
+    // Tiles whose furthest depth is in front of the box hide their part of it, otherwise check the pixels
+    for (int tileY = y0 / static_cast<int>(OCCLUSION_TILE_SIZE); tileY <= y1 / static_cast<int>(OCCLUSION_TILE_SIZE); ++tileY)
+    {
+        for (int tileX = x0 / static_cast<int>(OCCLUSION_TILE_SIZE); tileX <= x1 / static_cast<int>(OCCLUSION_TILE_SIZE); ++tileX)
+        {
+            if (mTileDepth[tileY * mTilesX + tileX] < nearest)  continue;
+
+            int pixelX0 = std::max(x0, tileX * static_cast<int>(OCCLUSION_TILE_SIZE));
+            int pixelX1 = std::min(x1, (tileX + 1) * static_cast<int>(OCCLUSION_TILE_SIZE) - 1);
+            int pixelY0 = std::max(y0, tileY * static_cast<int>(OCCLUSION_TILE_SIZE));
+            int pixelY1 = std::min(y1, (tileY + 1) * static_cast<int>(OCCLUSION_TILE_SIZE) - 1);
+            for (int y = pixelY0; y <= pixelY1; ++y)
+            {
+                const float* row = &mDepth[static_cast<std::size_t>(y) * mWidth];
+                for (int x = pixelX0; x <= pixelX1; ++x)
+                {
+                    if (row[x] >= nearest)  return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Benchmark
+//--------------------------------------------------------------------------------------
+
+// Check and time the occlusion buffer without a GPU. Copies of the occluder mesh are scaled into a row of walls in front
+// of a camera, with copies of the occludee mesh scattered behind and between them. Reports the time to draw the walls
+// with each kernel on one thread and across the thread pool (depths must agree to within rounding), the time per box test
+// and the fraction of occludees found hidden. Each wall's own box must be visible, as must boxes behind a wall that reach
+// just past its edge. Returns a report for the debug output
+std::string BenchmarkOcclusion(const std::string& occluderFile, const std::string& occludeeFile, unsigned int numOccludees,
+                               ThreadPool* threadPool, unsigned int iterations /*= 50*/)
+{
+    static const char* kernelNames[] = { "Scalar", "SSE", "AVX2" };
+
+    MeshData occluderMesh, occludeeMesh;
+    try
+    {
+        occluderMesh.Load(occluderFile);
+        occludeeMesh.Load(occludeeFile);
+    }
+    catch (const std::runtime_error& e)
+    {
+        return std::string("Occlusion culling benchmark: ") + e.what() + "\n";
+    }
+    if (occluderMesh.bounds.IsEmpty() || occludeeMesh.bounds.IsEmpty())  return "Occlusion culling benchmark: empty mesh\n";
+
+    // World bounds of a mesh placed by a matrix, from its nodes in their default pose
+    auto worldBounds = [](const MeshData& mesh, const CMatrix4x4& matrix)
+    {
+        std::vector<CMatrix4x4> absolute(mesh.nodes.size());
+        AABB bounds;
+        for (std::size_t i = 0; i < mesh.nodes.size(); ++i)
+        {
+            absolute[i] = (i == 0) ? matrix : mesh.nodes[i].defaultMatrix * absolute[mesh.nodes[i].parentIndex];
+            bounds.Add(TransformAABB(mesh.nodes[i].bounds, absolute[i]));
+        }
+        return bounds;
+    };
+    auto nodeMatrices = [](const MeshData& mesh, const CMatrix4x4& matrix)
+    {
+        std::vector<CMatrix4x4> matrices(mesh.nodes.size());
+        for (std::size_t i = 0; i < mesh.nodes.size(); ++i)  matrices[i] = (i == 0) ? matrix : mesh.nodes[i].defaultMatrix;
+        return matrices;
+    };
+
+    // Camera at the origin looking along z. Walls 24 units wide and 30 high with gaps of 6 between them, 100 units away,
+    // which covers most of the middle of the view
+    Camera camera({ 0, 0, 0 }, { 0, 0, 0 });
+    CMatrix4x4 viewProjection = camera.ViewProjectionMatrix();
+    CVector3 meshSize = occluderMesh.bounds.maximum - occluderMesh.bounds.minimum;
+    CVector3 meshCentre = occluderMesh.bounds.Centre();
+    std::vector<std::vector<CMatrix4x4>> walls;
+    std::vector<AABB> wallBounds;
+    for (int i = 0; i < 5; ++i)
+    {
+        CVector3 scale = { 24 / std::max(meshSize.x, 0.001f), 30 / std::max(meshSize.y, 0.001f), 2 / std::max(meshSize.z, 0.001f) };
+        CVector3 position = { -60.0f + i * 30.0f, 0, 100 };
+        CMatrix4x4 matrix = MatrixTranslation(-meshCentre) * MatrixScaling(scale) * MatrixTranslation(position);
+        walls.push_back(nodeMatrices(occluderMesh, matrix));
+        wallBounds.push_back(worldBounds(occluderMesh, matrix));
+    }
+
+    // Occludees about 6 units across, spread through the view from 20 to 400 units away
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> distance(20.0f, 400.0f);
+    std::uniform_real_distribution<float> across(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> angle(0.0f, 2 * PI);
+    float occludeeScale = 3 / std::max(occludeeMesh.boundingSphere.radius, 0.001f);
+    std::vector<AABB> occludees;
+    for (unsigned int i = 0; i < numOccludees; ++i)
+    {
+        float z = distance(random);
+        CMatrix4x4 matrix = MatrixScaling(occludeeScale) * MatrixRotationY(angle(random)) *
+                            MatrixTranslation({ across(random) * 1.1f * z, across(random) * 0.8f * z, z });
+        occludees.push_back(worldBounds(occludeeMesh, matrix));
+    }
+
+    OcclusionBuffer buffer;
+    auto renderWalls = [&](ThreadPool* pool)
+    {
+        buffer.Begin(viewProjection);
+        for (auto& wall : walls)  buffer.AddOccluder(occluderMesh, wall.data());
+        buffer.Render(pool);
+    };
+
+    std::string report = "Occlusion culling benchmark (" + std::to_string(buffer.Width()) + "x" + std::to_string(buffer.Height()) + " buffer)\n";
+    char line[256];
+
+    // Drawing the walls with each kernel on one thread, then with the usual kernel across the thread pool. Depths must
+    // agree with the first run to within rounding
+    report += "  Kernel  Threads  ms/frame  Mismatches\n";
+    MatrixKernel originalKernel = GetMatrixKernel();
+    std::vector<float> reference;
+    auto timeRender = [&](MatrixKernel kernel, ThreadPool* pool)
+    {
+        SetMatrixKernel(kernel);
+        if (GetMatrixKernel() != kernel)  return; // Not supported on this CPU
+
+        renderWalls(pool); // Warm up caches
+        buffer.ResetStats();
+        for (unsigned int i = 0; i < iterations; ++i)  renderWalls(pool);
+
+        unsigned int mismatches = 0;
+        for (unsigned int y = 0; y < buffer.Height(); ++y)
+        {
+            for (unsigned int x = 0; x < buffer.Width(); ++x)
+            {
+                if (reference.size() < buffer.Width() * buffer.Height())  reference.push_back(buffer.PixelDepth(x, y));
+                mismatches += (std::abs(buffer.PixelDepth(x, y) - reference[y * buffer.Width() + x]) > 1e-6f);
+            }
+        }
+
+        unsigned int numThreads = (pool != nullptr) ? pool->NumThreads() + 1 : 1;
+        std::snprintf(line, sizeof(line), "  %-6s  %7u  %8.3f  %10u\n", kernelNames[static_cast<int>(kernel)], numThreads,
+                      buffer.Stats().renderTime / iterations, mismatches);
+        report += line;
+    };
+    for (int kernel = 0; kernel < 3; ++kernel)  timeRender(static_cast<MatrixKernel>(kernel), nullptr);
+    if (threadPool != nullptr)  timeRender(originalKernel, threadPool);
+    SetMatrixKernel(originalKernel);
+
+    const OcclusionStats& stats = buffer.Stats();
+    std::snprintf(line, sizeof(line), "  Walls: %u triangles, %u drawn per frame\n", stats.triangles / iterations, stats.rasterized / iterations);
+    report += line;
+
+    // Box tests against the last buffer drawn
+    unsigned int numHidden = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i)
+    {
+        numHidden = 0;
+        for (auto& box : occludees)  numHidden += buffer.IsVisible(box) ? 0 : 1;
+    }
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    unsigned int wallsHidden = 0;
+    for (auto& box : wallBounds)  wallsHidden += buffer.IsVisible(box) ? 0 : 1;
+
+    // Thin boxes far behind each wall that reach a fraction of a pixel past its right edge, so are just visible. The
+    // edge as seen from the camera is the largest x / z of the wall's corners
+    unsigned int edgesHidden = 0;
+    for (auto& wall : wallBounds)
+    {
+        float edge = std::max(wall.maximum.x / wall.minimum.z, wall.maximum.x / wall.maximum.z);
+        AABB box;
+        box.Add({ edge * 200 - 1.0f, -1, 200 });
+        box.Add({ edge * 200 + 0.05f, 1, 201 });
+        edgesHidden += buffer.IsVisible(box) ? 0 : 1;
+    }
+
+    double nsPerBox = time.count() * 1e9 / (static_cast<double>(std::max(numOccludees, 1u)) * iterations);
+    std::snprintf(line, sizeof(line), "  Occludees: %u of %u hidden (%.1f%%), %.1f ns/box. Walls hidden by themselves: %u, "
+                  "boxes past their edges hidden: %u (both must be 0)\n", numHidden, numOccludees,
+                  100.0 * numHidden / std::max(numOccludees, 1u), nsPerBox, wallsHidden, edgesHidden);
+    report += line;
+    return report;
+}
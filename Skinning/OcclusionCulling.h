@@ -0,0 +1,173 @@
+//--------------------------------------------------------------------------------------
+// Occlusion culling - skip models hidden behind others, using a small depth buffer drawn on the CPU
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Frustum culling (see Culling.h) keeps everything in view, even models that are completely
+// hidden behind the ground or a large prop, and the GPU then shades them for nothing. Each frame a
+// few large, simple models (occluders) are drawn into a low resolution depth buffer on the CPU
+// from the camera's view-projection. Other models' world bounding boxes are then tested against
+// it before they are submitted: a box is hidden if its nearest point is behind the depth already
+// drawn everywhere the box covers on screen.
+// The buffer is hierarchical: alongside each pixel's depth, each OCCLUSION_TILE_SIZE square tile
+// keeps the furthest depth of its pixels. Most boxes are settled by the tiles alone, pixels are
+// only read for tiles where an occluder edge crosses the box.
+// The rasterizer draws only front faces (clockwise, as the GPU does with back-face culling) and
+// clips triangles to the near plane. Culling is conservative, a box partly visible past an
+// occluder's edge or through a gap is never hidden. Each occluder is drawn into its own copy of
+// the band first, a pixel being covered if its centre is inside one of its triangles. Its edges
+// are then found by sorting: a pixel touched by an edge on the occluder's outline (one with no
+// front face on the other side) is uncovered again, and a pixel touched by an edge between two
+// front faces gets the further of their depths over the pixel. So seams between triangles stay
+// covered, and the copy is merged into the band keeping the nearer depths. Rows of pixels are
+// drawn 4 or 8 at a time using the same kernel selection as the matrix batch functions (see
+// SetMatrixKernel in CMatrix4x4.h), and the screen is split into bands of tiles drawn on
+// different threads.
+// Only full detail triangles of rigid sub-meshes are used, a skinned mesh's bind pose isn't where
+// its triangles are drawn. Occluders should be opaque and closed (or seen only from the front).
+
+#ifndef _OCCLUSION_CULLING_H_INCLUDED_
+#define _OCCLUSION_CULLING_H_INCLUDED_
+
+#include "MeshData.h"
+#include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class ThreadPool;
+
+
+// Width and height of a tile of the depth buffer in pixels, also the height of the bands drawn by each thread
+const unsigned int OCCLUSION_TILE_SIZE = 8;
+
+
+// Counts since the last ResetStats
+struct OcclusionStats
+{
+    unsigned int occluders  = 0; // Sub-meshes drawn into the buffer
+    unsigned int triangles  = 0; // Their triangles...
+    unsigned int rasterized = 0; // ...and how many were front-facing and in view, so were drawn
+    float        renderTime = 0; // Milliseconds spent in Render
+};
+
+
+class OcclusionBuffer
+{
+public:
+    // Create a buffer of the given size in pixels, rounded up to whole tiles. Space for the given number of occluder
+    // triangles and vertices is reserved so the buffer doesn't use the heap each frame
+    explicit OcclusionBuffer(unsigned int width = 256, unsigned int height = 192, unsigned int maxTriangles = 16384);
+
+    // Start a new frame: remove all the occluders and set the view-projection matrix the buffer is drawn from
+    void Begin(const CMatrix4x4& viewProjection);
+
+    // Add a sub-mesh's full detail triangles, placed in the world by the given matrix. Sub-meshes with bones are ignored.
+    // The sub-mesh must stay valid until Render
+    void AddOccluder(const SubMeshData& subMesh, const CMatrix4x4& worldMatrix);
+
+    // Add all the sub-meshes of a mesh, given a model's matrices for its nodes (relative to their parents, as passed to
+    // Mesh::Render)
+    void AddOccluder(const MeshData& mesh, const CMatrix4x4* modelMatrices);
+
+    // Draw the occluders into the depth buffer and update the tiles. The occluders are transformed in parallel and
+    // then each band of tiles is drawn in parallel if a thread pool is given, the result is identical either way
+    void Render(ThreadPool* threadPool = nullptr);
+
+
+    // False if a world space box is hidden behind the occluders drawn by the last Render. Boxes that reach in front of
+    // the near clip plane are always visible, and only the part of a box on the screen is tested. Only reads the
+    // buffer, so can be called from several threads at once
+    bool IsVisible(const AABB& box) const;
+
+
+    unsigned int Width() const   { return mWidth; }
+    unsigned int Height() const  { return mHeight; }
+
+    // Depth of a pixel (0 at the near clip plane to 1 at the far one, 1 where nothing is drawn) and the furthest depth
+    // in a tile, e.g. to check the rasterizer
+    float PixelDepth(unsigned int x, unsigned int y) const  { return mDepth[y * mWidth + x]; }
+    float TileDepth(unsigned int x, unsigned int y) const   { return mTileDepth[y * mTilesX + x]; }
+
+
+    // Counts and times, accumulated over calls to Render until reset
+    const OcclusionStats& Stats() const  { return mStats; }
+    void ResetStats()  { mStats = OcclusionStats(); }
+
+
+private:
+    // A sub-mesh added as an occluder, with where its transformed vertices and set up triangles go
+    struct Occluder
+    {
+        const SubMeshData* subMesh;
+        CMatrix4x4         matrix;        // World matrix combined with the view-projection
+        unsigned int       firstVertex;   // In mClipVertices
+        unsigned int       firstTriangle; // In mTriangles, with room for two per triangle (clipping can split one)
+        unsigned int       numTriangles;  // Set up by Render
+        unsigned int       firstEdge;     // In mEdges, with room for three per triangle
+        int                minX, maxX, minY, maxY; // Inclusive range of pixels its triangles touch, set up by Render
+    };
+
+    // A triangle ready to draw: the pixels it can cover, and its edge and depth functions of the pixel position. A
+    // pixel centre (x, y) is inside if a*x + b*y + c >= 0 for all three edges, and its depth is a*x + b*y + c
+    struct Triangle
+    {
+        int      minX, maxX, minY, maxY; // Inclusive range of pixel centres inside (minX > maxX if there are none)
+        float    edgeA[3], edgeB[3], edgeC[3];
+        float    depthA, depthB, depthC;
+        float    cornerX[3], cornerY[3]; // Screen position of each corner, edge e runs from corner e to corner e + 1
+        uint32_t neighbour[3];           // Triangle across each edge in the same occluder, NO_NEIGHBOUR on its outline
+    };
+    static const uint32_t NO_NEIGHBOUR = ~0u;
+
+    // An edge of a triangle while an occluder's triangles are matched up with their neighbours
+    struct Edge
+    {
+        uint64_t key;      // Vertex indices of its ends, the smaller one in the high bits
+        uint32_t triangle; // Index in the occluder's triangles...
+        uint32_t side;     // ...and which of its edges, plus 4 if the edge runs from the larger vertex index to the smaller
+    };
+
+    // Transform an occluder's vertices to clip space, then clip, cull and set up its triangles
+    void SetupOccluder(Occluder& occluder);
+
+    // Set up a triangle given in clip space (x, y, z, w), clipping it to the near plane first. Adds up to two triangles
+    // to the output, returns how many
+    unsigned int SetupTriangle(const float* a, const float* b, const float* c, Triangle* output);
+
+    // Clear and draw one band of tiles, then work out its tiles' furthest depths
+    void RenderBand(unsigned int tileRow);
+
+    // Draw an occluder's triangles and edges into its own copy of the rows [y0, y1], then merge it into the buffer
+    void RenderOccluder(const Occluder& occluder, int y0, int y1);
+
+
+    unsigned int mWidth, mHeight;
+    unsigned int mTilesX, mTilesY;
+    CMatrix4x4   mViewProjection;
+
+    std::vector<Occluder>   mOccluders;
+    std::vector<float>      mClipVertices; // x, y, z, w of each occluder vertex
+    std::vector<Triangle>   mTriangles;
+    std::vector<Edge>       mEdges;
+    std::vector<CMatrix4x4> mNodeMatrices; // Absolute node matrices while a mesh is added
+
+    std::vector<float> mDepth;         // One per pixel, row by row
+    std::vector<float> mOccluderDepth; // Same layout, where each band draws one occluder at a time
+    std::vector<float> mTileDepth;     // Furthest depth in each tile
+
+    OcclusionStats mStats;
+};
+
+
+// Check and time the occlusion buffer without a GPU. Copies of the occluder mesh are scaled into a row of walls in front
+// of a camera, with copies of the occludee mesh scattered behind and between them. Reports the time to draw the walls
+// with each kernel on one thread and across the thread pool (depths must agree to within rounding), the time per box test
+// and the fraction of occludees found hidden. Each wall's own box must be visible, as must boxes behind a wall that reach
+// just past its edge. Returns a report for the debug output
+std::string BenchmarkOcclusion(const std::string& occluderFile, const std::string& occludeeFile, unsigned int numOccludees,
+                               ThreadPool* threadPool, unsigned int iterations = 50);
+
+
+#endif //_OCCLUSION_CULLING_H_INCLUDED_
@@ -0,0 +1,439 @@
+//--------------------------------------------------------------------------------------
+// Render queue - sorts draws by state so they can be submitted with the fewest binds
+//--------------------------------------------------------------------------------------
+
+#include "RenderQueue.h"
+#include "Model.h"
+#include "Mesh.h"
+#include "Camera.h"
+#include "StateCache.h"
+#include "StaticBatch.h"
+#include "OcclusionCulling.h"
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <chrono>
+
+
+namespace
+{
+    // Sizes of the key fields (see RenderQueue.h)
+    const unsigned int SHADER_BITS  = 10;
+    const unsigned int STATE_BITS   = 8;
+    const unsigned int TEXTURE_BITS = 12;
+    const unsigned int MESH_BITS    = 5;
+    const unsigned int DEPTH_BITS   = 24;
+
+    // Find a combination of pointers in a table of combinations (count pointers each), adding it if it is new.
+    // Returns its index. Tables are small (one entry per distinct material setup) so a linear search is fine
+    unsigned int FindOrAdd(std::vector<const void*>& table, const void* const* values, unsigned int count)
+    {
+        unsigned int numEntries = static_cast<unsigned int>(table.size() / count);
+        for (unsigned int i = 0; i < numEntries; ++i)
+        {
+            if (std::equal(values, values + count, table.begin() + i * count))  return i;
+        }
+        table.insert(table.end(), values, values + count);
+        return numEntries;
+    }
+
+    // Depth as an integer that sorts in the same order. The bits of a positive float compare in the same order as the
+    // float, so no depth range is needed - take the top bits after the sign
+    uint64_t DepthBits(float depth)
+    {
+        depth = std::max(depth, 0.0f);
+        uint32_t bits;
+        std::memcpy(&bits, &depth, sizeof(bits));
+        return (bits & 0x7fffffff) >> (31 - DEPTH_BITS);
+    }
+
+    // True if a material's rasterizer state culls back faces (the default state does), so back-facing meshlets can be
+    // skipped. Materials that draw back faces, e.g. for outlines, would lose the very triangles they are drawn for
+    bool CullsBackFaces(const RenderMaterial& material)
+    {
+        if (material.rasterizerState == nullptr)  return true;
+        D3D11_RASTERIZER_DESC desc;
+        material.rasterizerState->GetDesc(&desc);
+        return desc.CullMode == D3D11_CULL_BACK && !desc.FrontCounterClockwise;
+    }
+}
+
+
+// Reserve space for the given number of draws, so the queue doesn't use the heap each frame
+RenderQueue::RenderQueue(unsigned int maxDraws /*= 256*/)
+    : mCuller(maxDraws)
+{
+    mDraws.reserve(maxDraws);
+    mSortBuffer.reserve(maxDraws);
+    mInstances.resize(MAX_INSTANCES);
+}
+
+
+// Start a new list of draws. The camera position is used to sort by depth, and draws outside the frustum of the
+// view-projection matrix are culled. Pass cull = false if the models have already been culled (e.g. shadow casters).
+// If an occlusion buffer is given, drawn from the same view-projection, culling also drops hidden models
+void RenderQueue::Begin(const CVector3& cameraPosition, const CMatrix4x4& viewProjection, bool cull /*= true*/,
+                        const OcclusionBuffer* occlusion /*= nullptr*/)
+{
+    mDraws.clear();
+    mCameraPosition = cameraPosition;
+    mViewProjection = viewProjection;
+    mCull = cull;
+    mOcclusion = cull ? occlusion : nullptr;
+    mMeshletView.viewProjection = viewProjection;
+    mMeshletView.cameraPosition = cameraPosition;
+}
+
+
+// Add a model to be rendered with the given material. The material must stay valid until Submit. Lower passes are
+// rendered first (e.g. a second pass for an outline effect)
+void RenderQueue::Add(Model* model, const RenderMaterial* material, unsigned int pass /*= 0*/)
+{
+    float depth = Length(model->Position() - mCameraPosition);
+    uint64_t key = SortKey(*material, pass, depth);
+
+    // The mesh goes in the bits below the state when opaque (so runs of a mesh can be instanced), at the bottom when blended
+    uint64_t mesh = MeshId(model->GetMesh()) & ((1u << MESH_BITS) - 1);
+    key |= material->blended ? mesh : mesh << DEPTH_BITS;
+
+    mDraws.push_back({ key, model, material, nullptr, 0 });
+}
+
+
+// Add a group of a static batch, drawn with the group's material. The batch must stay valid until Submit
+// Static geometry is usually large and close (e.g. the ground) so it is put at depth 0, first among its material
+void RenderQueue::Add(StaticBatch* batch, unsigned int group, unsigned int pass /*= 0*/)
+{
+    const RenderMaterial* material = batch->GroupMaterial(group);
+    uint64_t key = SortKey(*material, pass, 0);
+    key |= static_cast<uint64_t>(MeshId(batch->GroupMesh(group)) & ((1u << MESH_BITS) - 1)) << DEPTH_BITS;
+
+    mDraws.push_back({ key, nullptr, material, batch, group });
+}
+
+
+// Build the sort key for a draw
+uint64_t RenderQueue::SortKey(const RenderMaterial& material, unsigned int pass, float depth)
+{
+    uint64_t state = static_cast<uint64_t>(ShaderId(material)  & ((1u << SHADER_BITS)  - 1)) << (STATE_BITS + TEXTURE_BITS) |
+                     static_cast<uint64_t>(StateId(material)   & ((1u << STATE_BITS)   - 1)) << TEXTURE_BITS |
+                     static_cast<uint64_t>(TextureId(material) & ((1u << TEXTURE_BITS) - 1));
+    uint64_t key = static_cast<uint64_t>(pass & 0xf) << 60;
+    if (material.blended)
+    {
+        // Blended: back-to-front comes first so blending is correct, state is only a tie-break
+        uint64_t invertedDepth = ((1ull << DEPTH_BITS) - 1) - DepthBits(depth);
+        key |= 1ull << 59 | invertedDepth << 35 | state << MESH_BITS;
+    }
+    else
+    {
+        // Opaque: grouped by state to save binds, front-to-back within a group so hidden pixels fail the depth test
+        key |= state << (MESH_BITS + DEPTH_BITS) | DepthBits(depth);
+    }
+    return key;
+}
+
+
+// Small ids for the shader / state / texture combinations in the sort key, given out in the order first seen
+unsigned int RenderQueue::ShaderId(const RenderMaterial& material)
+{
+    const void* shaders[] = { material.vertexShader, material.pixelShader };
+    return FindOrAdd(mShaders, shaders, 2);
+}
+
+unsigned int RenderQueue::StateId(const RenderMaterial& material)
+{
+    const void* states[] = { material.blendState, material.depthStencilState, material.rasterizerState };
+    return FindOrAdd(mStates, states, 3);
+}
+
+unsigned int RenderQueue::TextureId(const RenderMaterial& material)
+{
+    const void* textures[MATERIAL_SLOTS * 2];
+    std::copy(material.textures, material.textures + MATERIAL_SLOTS, textures);
+    std::copy(material.samplers, material.samplers + MATERIAL_SLOTS, textures + MATERIAL_SLOTS);
+    return FindOrAdd(mTextures, textures, MATERIAL_SLOTS * 2);
+}
+
+unsigned int RenderQueue::MeshId(const Mesh* mesh)
+{
+    const void* meshes[] = { mesh };
+    return FindOrAdd(mMeshes, meshes, 1);
+}
+
+
+// Remove draws whose model is outside the view frustum or hidden behind the occluders. Keeps the order of the remaining
+// draws. A static batch group is tested by the bounds of all its models here, then by each model when it is drawn.
+// The occlusion test is slower than the frustum test so only draws in the frustum get it
+void RenderQueue::Cull()
+{
+    mCuller.Clear();
+    for (auto& draw : mDraws)  mCuller.Add(draw.batch ? draw.batch->GroupBounds(draw.group) : draw.model->WorldBounds());
+    mCuller.Cull(mViewProjection);
+
+    unsigned int numVisible = 0;
+    for (unsigned int i = 0; i < mDraws.size(); ++i)
+    {
+        const DrawItem& draw = mDraws[i];
+        unsigned int numModels = draw.batch ? draw.batch->GroupModels(draw.group) : 1;
+        if (!mCuller.IsVisible(i))
+        {
+            mStats.culled += numModels;
+        }
+        else if (mOcclusion != nullptr &&
+                 !mOcclusion->IsVisible(draw.batch ? draw.batch->GroupBounds(draw.group) : draw.model->WorldBounds()))
+        {
+            mStats.occluded += numModels;
+        }
+        else
+        {
+            mDraws[numVisible++] = draw;
+        }
+    }
+    mDraws.resize(numVisible);
+}
+
+
+// Radix sort the draws on their keys. Draws with equal keys keep the order they were added
+// Least significant byte first, eight passes of a counting sort. Bytes that are the same in every key are skipped,
+// which is most of them with a small number of draws
+void RenderQueue::Sort()
+{
+    mSortBuffer.resize(mDraws.size());
+    DrawItem* source      = mDraws.data();
+    DrawItem* destination = mSortBuffer.data();
+    std::size_t numDraws  = mDraws.size();
+
+    for (unsigned int shift = 0; shift < 64; shift += 8)
+    {
+        unsigned int counts[256] = {};
+        for (std::size_t i = 0; i < numDraws; ++i)  ++counts[(source[i].key >> shift) & 0xff];
+        if (counts[(source[0].key >> shift) & 0xff] == numDraws)  continue;
+
+        unsigned int offset = 0;
+        for (auto& count : counts)
+        {
+            unsigned int c = count;
+            count = offset;
+            offset += c;
+        }
+        for (std::size_t i = 0; i < numDraws; ++i)  destination[counts[(source[i].key >> shift) & 0xff]++] = source[i];
+        std::swap(source, destination);
+    }
+
+    if (source != mDraws.data())  std::copy(source, source + numDraws, mDraws.data());
+}
+
+
+// Cull (if requested) and sort the draws. Returns false if there is nothing to draw
+bool RenderQueue::Prepare()
+{
+    if (mCull)  Cull();
+    if (mDraws.empty())  return false;
+    Sort();
+    return true;
+}
+
+
+// Number of draws from the given one that can be rendered as one instanced draw, 1 if it is drawn by itself. A group is
+// a run of draws of the same mesh with the same material and level of detail, where the material has an instanced vertex
+// shader and the mesh can be instanced, up to the size of the instance buffer
+unsigned int RenderQueue::GroupSize(std::size_t first)
+{
+    const DrawItem& draw = mDraws[first];
+    if (!mInstancing || draw.batch != nullptr || draw.material->instancedVertexShader == nullptr)  return 1;
+    Mesh* mesh = draw.model->GetMesh();
+    if (!mesh->CanRenderInstanced())  return 1;
+
+    unsigned int lod = draw.model->SelectLod();
+    std::size_t end = first + 1;
+    while (end < mDraws.size() && end - first < MAX_INSTANCES && mDraws[end].material == draw.material &&
+           mDraws[end].batch == nullptr && mDraws[end].model->GetMesh() == mesh && mDraws[end].model->SelectLod() == lod)
+    {
+        ++end;
+    }
+    return static_cast<unsigned int>(end - first);
+}
+
+
+// Count a group of draws from GroupSize in the stats
+void RenderQueue::CountDraws(std::size_t first, unsigned int count)
+{
+    Mesh* mesh = mDraws[first].model->GetMesh();
+    mStats.draws     += count;
+    mStats.triangles += count * mesh->NumTriangles(mDraws[first].model->SelectLod());
+    if (count > 1)  mStats.instanced += count;
+}
+
+
+// Render a model on its own, culling its meshlets if the queue culls, and count what the meshlets saved in the stats.
+// Lists that aren't culled (e.g. shadow casters, already culled against their light) draw whole models, as their
+// passes can need parts outside the view, and may draw back faces
+void RenderQueue::RenderModel(const DrawItem& draw)
+{
+    if (!mCull || !mMeshletCulling)
+    {
+        draw.model->Render();
+        return;
+    }
+
+    mMeshletView.cullBackFaces = CullsBackFaces(*draw.material);
+    mMeshletView.stats = MeshletStats();
+    draw.model->Render(&mMeshletView);
+
+    const MeshletStats& stats = mMeshletView.stats;
+    mStats.meshlets       += stats.tested;
+    mStats.meshletsCulled += stats.frustumCulled + stats.backFacing;
+    mStats.triangles      -= stats.culledIndices / 3;
+}
+
+
+// Cull the models of a static batch group and count them in the stats. Returns the number visible. The batch keeps
+// the index ranges of the visible models for its Render
+unsigned int RenderQueue::CullStatic(const DrawItem& draw)
+{
+    unsigned int numVisible = draw.batch->Cull(draw.group, mViewProjection, mCull, mOcclusion);
+    mStats.draws     += numVisible;
+    mStats.batched   += numVisible;
+    mStats.culled    += draw.batch->GroupModels(draw.group) - numVisible - draw.batch->NumOccluded();
+    mStats.occluded  += draw.batch->NumOccluded();
+    mStats.triangles += draw.batch->NumRangeTriangles();
+    return numVisible;
+}
+
+
+// Set the given material, skipping anything that is already bound. The state cache does the skipping, the queue just
+// counts what it reports. Uses the material's instanced vertex shader if instanced is true
+void RenderQueue::Bind(const RenderMaterial& material, bool instanced)
+{
+    auto count = [this](bool issued)
+    {
+        if (issued)  ++mStats.bindsIssued;
+        else         ++mStats.bindsSkipped;
+    };
+
+    count(gStateCache.SetVertexShader(instanced ? material.instancedVertexShader : material.vertexShader));
+    count(gStateCache.SetPixelShader(material.pixelShader));
+    count(gStateCache.SetBlendState(material.blendState));
+    count(gStateCache.SetDepthStencilState(material.depthStencilState));
+    count(gStateCache.SetRasterizerState(material.rasterizerState));
+
+    for (unsigned int slot = 0; slot < MATERIAL_SLOTS; ++slot)
+    {
+        if (material.textures[slot] != nullptr)  count(gStateCache.SetPSShaderResource(slot, material.textures[slot]));
+        if (material.samplers[slot] != nullptr)  count(gStateCache.SetPSSampler(slot, material.samplers[slot]));
+    }
+}
+
+
+// Cull and sort the draws and render them, only binding what changed from one draw to the next. Per-frame constants
+// and anything materials leave unset must already be set
+void RenderQueue::Submit()
+{
+    if (!Prepare())  return;
+
+    // Draw calls are counted by the state cache as they are made, so meshlet ranges, bone batches, static batch runs
+    // and instanced draws are all counted as the calls they actually take
+    unsigned int firstDrawCall = gStateCache.Stats().draws;
+
+    for (std::size_t i = 0; i < mDraws.size(); )
+    {
+        const DrawItem& draw = mDraws[i];
+        if (draw.batch != nullptr)
+        {
+            // Static batch group, one draw call for each run of visible models
+            if (CullStatic(draw) > 0)
+            {
+                Bind(*draw.material, false);
+                draw.batch->Render(draw.group);
+            }
+            ++i;
+            continue;
+        }
+
+        unsigned int count = GroupSize(i);
+        CountDraws(i, count);
+        if (count > 1)
+        {
+            // Each model's world matrix and colour become its instance's data, then the group is one instanced draw
+            for (unsigned int instance = 0; instance < count; ++instance)
+            {
+                Model* model = mDraws[i + instance].model;
+                mInstances[instance].worldMatrix = model->WorldMatrix();
+                mInstances[instance].colour      = model->Colour();
+            }
+            Bind(*draw.material, true);
+            draw.model->GetMesh()->RenderInstanced(mInstances.data(), count, draw.model->SelectLod());
+        }
+        else
+        {
+            Bind(*draw.material, false);
+            RenderModel(draw);
+        }
+        i += count;
+    }
+    mStats.drawCalls += gStateCache.Stats().draws - firstDrawCall;
+    mDraws.clear();
+}
+
+
+// Measure what instancing saves for a crowd of models scattered around a camera, each using one of the given meshes and
+// one of the given materials. The queue is submitted with and without instancing while the state cache forwards to a
+// sink that drops everything, so nothing reaches the GPU. Returns a report for the debug output
+std::string BenchmarkInstancing(Mesh* const* meshes, unsigned int numMeshes, const RenderMaterial* const* materials,
+                                unsigned int numMaterials, unsigned int numModels, unsigned int iterations /*= 100*/)
+{
+    // Models scattered through a cube around the camera so roughly a sixth are in view, as in BenchmarkCulling
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::vector<std::unique_ptr<Model>> models;
+    models.reserve(numModels);
+    for (unsigned int i = 0; i < numModels; ++i)
+    {
+        models.push_back(std::make_unique<Model>(meshes[i % numMeshes], CVector3{ position(random), position(random), position(random) }));
+    }
+    Camera camera({ 0, 0, 0 }, { 0, 0, 0 });
+
+    std::string report;
+    char line[256];
+    std::snprintf(line, sizeof(line), "Instancing benchmark: %u models, %u meshes, %u materials\n", numModels, numMeshes, numMaterials);
+    report += line;
+    report += "  Instancing  Visible  Draw calls  Instanced  ms/frame\n";
+
+    // The previous sink is put back afterwards, which also makes the cache forget the state the benchmark bound
+    StateSink dropAll;
+    StateSink* previousSink = gStateCache.Sink();
+    gStateCache.SetSink(&dropAll);
+
+    RenderQueue queue(numModels);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        queue.SetInstancing(pass == 1);
+
+        // Each iteration is one frame's worth of queue work: adding, culling, sorting and grouping the draws, then the
+        // models' constant and instance uploads and draw calls, which the sink drops
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            queue.ResetStats();
+            queue.Begin(camera.Position(), camera.ViewProjectionMatrix());
+            for (unsigned int m = 0; m < numModels; ++m)
+            {
+                queue.Add(models[m].get(), materials[(m / numMeshes) % numMaterials]);
+            }
+            queue.Submit();
+        }
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+        const RenderQueueStats& stats = queue.Stats(); // Last iteration only
+        std::snprintf(line, sizeof(line), "  %-10s  %7u  %10u  %9u  %8.3f\n", (pass == 1) ? "On" : "Off",
+                      stats.draws, stats.drawCalls, stats.instanced, time.count() * 1000 / iterations);
+        report += line;
+    }
+
+    gStateCache.SetSink(previousSink);
+    return report;
+}
@@ -0,0 +1,204 @@
+//--------------------------------------------------------------------------------------
+// Render queue - sorts draws by state so they can be submitted with the fewest binds
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Instead of setting shaders, states and textures by hand before each model is rendered, each draw
+// is added to the queue with a RenderMaterial describing everything it needs. When the queue is
+// submitted the draws are sorted by a 64-bit key and rendered in that order. Binds go through the
+// state cache (see Utility/StateCache.h), so only those that differ from what is bound are sent
+// to DirectX.
+// Key layout, most significant first:
+//   Opaque:  pass (4 bits) | 0 | shaders (10) | states (8) | textures (12) | mesh (5) | depth (24)
+//   Blended: pass (4 bits) | 1 | inverted depth (24) | shaders (10) | states (8) | textures (12) | mesh (5)
+// So opaque draws are grouped by shader then state then texture then mesh and are front-to-back
+// within a group, and blended draws come after all opaque draws in back-to-front order (needed for
+// correct blending). Draws whose model is outside the view frustum are culled before sorting.
+// The shader / state / texture / mesh fields are small ids given out by the queue the first
+// time it sees each combination. Keys only decide the order, binds always compare the actual
+// DirectX objects, so an id that wraps around can only cost extra binds, never wrong rendering.
+// After sorting, a run of draws of the same mesh with the same material is rendered as one
+// instanced draw if the material has an instanced vertex shader and the mesh can be instanced
+// (see Mesh::RenderInstanced). Blended runs are already in back-to-front order and instances are
+// drawn in order, so instancing doesn't change the result. Models in an instanced draw must also be at
+// the same level of detail (see Model::SelectLod).
+// Groups of a static batch (see StaticBatch.h) can be added alongside models. They are sorted
+// with their material as if they were one model at depth 0, and cull their own models when drawn.
+// Models drawn on their own in a culled pass also cull their meshlets (see Meshlets.h), so only the
+// visible parts of a large mesh are drawn. Back-facing meshlets are only skipped if the material
+// culls back faces.
+// A culled list can also be given an occlusion buffer drawn from the same view (see
+// OcclusionCulling.h). Draws that pass the frustum test are then dropped if their model is hidden
+// behind the buffer's occluders, and static batch groups test each of their models the same way.
+
+#ifndef _RENDER_QUEUE_H_INCLUDED_
+#define _RENDER_QUEUE_H_INCLUDED_
+
+#include "Common.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "Culling.h"
+#include "Meshlets.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class Model;
+class Mesh;
+class StaticBatch;
+class OcclusionBuffer;
+
+
+// Number of texture / sampler slots a material can set, starting at slot 0
+const unsigned int MATERIAL_SLOTS = 3;
+
+// Everything needed to set up the GPU to render a model. Textures and samplers are by slot, leave a slot as nullptr
+// if the shaders don't use it - it is left unchanged (e.g. slot 1 holds the shadow map for the whole pass)
+struct RenderMaterial
+{
+    ID3D11VertexShader*       vertexShader      = nullptr;
+    ID3D11VertexShader*       instancedVertexShader = nullptr; // If set, used to draw runs of the same mesh instanced
+    ID3D11PixelShader*        pixelShader       = nullptr;
+    ID3D11BlendState*         blendState        = nullptr;
+    ID3D11DepthStencilState*  depthStencilState = nullptr;
+    ID3D11RasterizerState*    rasterizerState   = nullptr;
+    ID3D11ShaderResourceView* textures[MATERIAL_SLOTS] = {};
+    ID3D11SamplerState*       samplers[MATERIAL_SLOTS] = {};
+
+    bool blended = false; // Blended materials are drawn after opaque ones, back to front
+};
+
+
+// Draw and bind counts since the last ResetStats. A bind is one shader, state, texture or sampler set on the context
+struct RenderQueueStats
+{
+    unsigned int draws          = 0; // Models drawn
+    unsigned int drawCalls      = 0; // Draw calls made for them, counted by the state cache as they are made
+    unsigned int instanced      = 0; // Models drawn as part of an instanced draw
+    unsigned int batched        = 0; // Models drawn as part of a static batch
+    unsigned int culled         = 0; // Draws skipped as the model was outside the view
+    unsigned int occluded       = 0; // Draws skipped as the model was hidden behind the occluders
+    unsigned int triangles      = 0; // Triangles submitted in all the draw calls, at each model's level of detail
+    unsigned int meshlets       = 0; // Meshlets tested in the models drawn on their own...
+    unsigned int meshletsCulled = 0; // ...and how many of them were outside the view or back-facing
+    unsigned int bindsIssued    = 0; // Sent to DirectX
+    unsigned int bindsSkipped   = 0; // Already bound by an earlier draw so not sent
+};
+
+
+class RenderQueue
+{
+public:
+    // Reserve space for the given number of draws, so the queue doesn't use the heap each frame
+    explicit RenderQueue(unsigned int maxDraws = 256);
+
+    // Start a new list of draws. The camera position is used to sort by depth, and draws outside the frustum of the
+    // view-projection matrix are culled. Pass cull = false if the models have already been culled (e.g. shadow casters).
+    // If an occlusion buffer is given, drawn from the same view-projection, culling also drops hidden models. It must
+    // stay valid until Submit
+    void Begin(const CVector3& cameraPosition, const CMatrix4x4& viewProjection, bool cull = true,
+               const OcclusionBuffer* occlusion = nullptr);
+
+    // Add a model to be rendered with the given material. The material must stay valid until Submit. Lower passes are
+    // rendered first (e.g. a second pass for an outline effect)
+    void Add(Model* model, const RenderMaterial* material, unsigned int pass = 0);
+
+    // Add a group of a static batch, drawn with the group's material. The batch must stay valid until Submit
+    void Add(StaticBatch* batch, unsigned int group, unsigned int pass = 0);
+
+    // Cull and sort the draws and render them, only binding what changed from one draw to the next. Per-frame constants
+    // and anything materials leave unset must already be set
+    void Submit();
+
+
+    // Combine runs of the same mesh and material into instanced draws (see above), on by default
+    void SetInstancing(bool instancing)  { mInstancing = instancing; }
+    bool Instancing() const  { return mInstancing; }
+
+    // Cull the meshlets of models drawn on their own (see above), on by default
+    void SetMeshletCulling(bool meshletCulling)  { mMeshletCulling = meshletCulling; }
+    bool MeshletCulling() const  { return mMeshletCulling; }
+
+
+    // Bind counts, accumulated over calls to Submit until reset
+    const RenderQueueStats& Stats() const  { return mStats; }
+    void ResetStats()  { mStats = RenderQueueStats(); }
+
+
+private:
+    struct DrawItem
+    {
+        uint64_t              key;
+        Model*                model;    // nullptr for a static batch group
+        const RenderMaterial* material;
+        StaticBatch*          batch;
+        unsigned int          group;
+    };
+
+    // Build the sort key for a draw
+    uint64_t SortKey(const RenderMaterial& material, unsigned int pass, float depth);
+
+    // Small ids for the shader / state / texture combinations in the sort key, given out in the order first seen
+    unsigned int ShaderId(const RenderMaterial& material);
+    unsigned int StateId(const RenderMaterial& material);
+    unsigned int TextureId(const RenderMaterial& material);
+    unsigned int MeshId(const Mesh* mesh);
+
+    // Remove draws whose model is outside the view frustum or hidden behind the occluders
+    void Cull();
+
+    // Radix sort the draws on their keys. Draws with equal keys keep the order they were added
+    void Sort();
+
+    // Cull (if requested) and sort the draws. Returns false if there is nothing to draw
+    bool Prepare();
+
+    // Number of draws from the given one that can be rendered as one instanced draw, 1 if it is drawn by itself
+    unsigned int GroupSize(std::size_t first);
+
+    // Count a group of draws from GroupSize in the stats
+    void CountDraws(std::size_t first, unsigned int count);
+
+    // Render a model on its own, culling its meshlets if the queue culls, and count what the meshlets saved in the stats
+    void RenderModel(const DrawItem& draw);
+
+    // Cull the models of a static batch group and count them in the stats. Returns the number visible
+    unsigned int CullStatic(const DrawItem& draw);
+
+    // Set the given material, skipping anything that is already bound. Uses the material's instanced vertex shader if
+    // instanced is true
+    void Bind(const RenderMaterial& material, bool instanced);
+
+
+    std::vector<DrawItem> mDraws;
+    std::vector<DrawItem> mSortBuffer;
+    CVector3              mCameraPosition;
+    CMatrix4x4            mViewProjection;
+    FrustumCuller         mCuller;
+    bool                  mCull = true;
+    const OcclusionBuffer* mOcclusion = nullptr; // Of the current list of draws, nullptr if none
+    bool                  mInstancing = true;
+    bool                  mMeshletCulling = true;
+    MeshletView           mMeshletView; // The view of the current list of draws
+
+    // Instance data for the group being drawn, reserved for MAX_INSTANCES so drawing doesn't use the heap
+    std::vector<InstanceData> mInstances;
+
+    // Combinations seen so far, their index is their id
+    std::vector<const void*> mShaders;  // Vertex and pixel shader, two entries per id
+    std::vector<const void*> mStates;   // Blend, depth and rasterizer state, three per id
+    std::vector<const void*> mTextures; // Textures then samplers, MATERIAL_SLOTS * 2 per id
+    std::vector<const void*> mMeshes;   // One per id
+
+    RenderQueueStats mStats;
+};
+
+
+// Measure what instancing saves for a crowd of models scattered around a camera, each using one of the given meshes and
+// one of the given materials. The queue is submitted with and without instancing while the state cache forwards to a
+// sink that drops everything, so nothing reaches the GPU. Returns a report for the debug output
+std::string BenchmarkInstancing(Mesh* const* meshes, unsigned int numMeshes, const RenderMaterial* const* materials,
+                                unsigned int numMaterials, unsigned int numModels, unsigned int iterations = 100);
+
+
+#endif //_RENDER_QUEUE_H_INCLUDED_
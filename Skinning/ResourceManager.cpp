@@ -0,0 +1,134 @@
+//--------------------------------------------------------------------------------------
+// Resource manager - cache of loaded meshes and textures shared between users
+//--------------------------------------------------------------------------------------
+
+#include "ResourceManager.h"
+#include "Mesh.h"
+#include "CTexture.h"
+
+#include <algorithm>
+#include <cstdio>
+
+
+//--------------------------------------------------------------------------------------
+// Lookup
+//--------------------------------------------------------------------------------------
+
+// Return a resident mesh loaded from the given file with (at least) the given options, or nullptr if there
+// isn't one. Counts as a cache hit or miss
+std::shared_ptr<Mesh> ResourceManager::FindMesh(const std::string& fileName, bool requireTangents)
+{
+    for (auto& entry : mMeshes)
+    {
+        if (entry.fileName == fileName && (entry.requireTangents || !requireTangents))
+        {
+            auto mesh = entry.mesh.lock();
+            if (mesh)
+            {
+                ++mHits;
+                return mesh;
+            }
+        }
+    }
+    ++mMisses;
+    return nullptr;
+}
+
+
+// Return a resident texture loaded from the given file, or nullptr if there isn't one. Counts as a cache hit or miss
+std::shared_ptr<CTexture> ResourceManager::FindTexture(const std::string& fileName)
+{
+    for (auto& entry : mTextures)
+    {
+        if (entry.fileName == fileName)
+        {
+            auto texture = entry.texture.lock();
+            if (texture)
+            {
+                ++mHits;
+                return texture;
+            }
+        }
+    }
+    ++mMisses;
+    return nullptr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Adding resources
+//--------------------------------------------------------------------------------------
+
+// Add a newly loaded mesh to the cache, taking ownership of it. Pass the approximate GPU memory it uses
+// Returns the shared handle to give to users
+std::shared_ptr<Mesh> ResourceManager::AddMesh(const std::string& fileName, bool requireTangents, std::unique_ptr<Mesh> mesh, std::size_t bytes)
+{
+    RemoveExpired();
+    std::shared_ptr<Mesh> handle(std::move(mesh));
+    mMeshes.push_back({ fileName, requireTangents, handle, bytes });
+    return handle;
+}
+
+
+// Add a newly loaded texture to the cache, taking ownership of it. Pass the approximate GPU memory it uses
+// Returns the shared handle to give to users
+std::shared_ptr<CTexture> ResourceManager::AddTexture(const std::string& fileName, std::unique_ptr<CTexture> texture, std::size_t bytes)
+{
+    RemoveExpired();
+    std::shared_ptr<CTexture> handle(std::move(texture));
+    mTextures.push_back({ fileName, handle, bytes });
+    return handle;
+}
+
+
+// Remove entries for resources that are no longer used by anyone
+void ResourceManager::RemoveExpired()
+{
+    mMeshes.erase(std::remove_if(mMeshes.begin(), mMeshes.end(), [](const MeshEntry& entry) { return entry.mesh.expired(); }), mMeshes.end());
+    mTextures.erase(std::remove_if(mTextures.begin(), mTextures.end(), [](const TextureEntry& entry) { return entry.texture.expired(); }), mTextures.end());
+}
+
+
+//--------------------------------------------------------------------------------------
+// Statistics
+//--------------------------------------------------------------------------------------
+
+// Number of resources and approximate GPU memory of everything still in use
+unsigned int ResourceManager::NumResident()
+{
+    RemoveExpired();
+    return static_cast<unsigned int>(mMeshes.size() + mTextures.size());
+}
+
+std::size_t ResourceManager::ResidentBytes()
+{
+    RemoveExpired();
+    std::size_t bytes = 0;
+    for (auto& entry : mMeshes)    bytes += entry.bytes;
+    for (auto& entry : mTextures)  bytes += entry.bytes;
+    return bytes;
+}
+
+
+// Summary of the above as text, with one line per resident resource
+std::string ResourceManager::StatsReport()
+{
+    char line[512];
+    std::snprintf(line, sizeof(line), "Resources: %u resident, %.2f MB, %u cache hits, %u misses\n",
+                  NumResident(), ResidentBytes() / (1024.0f * 1024.0f), mHits, mMisses);
+    std::string report = line;
+
+    for (auto& entry : mMeshes)
+    {
+        std::snprintf(line, sizeof(line), "  %10.1f KB  %ld users  %s%s\n", entry.bytes / 1024.0f, entry.mesh.use_count(),
+                      entry.fileName.c_str(), entry.requireTangents ? " (tangents)" : "");
+        report += line;
+    }
+    for (auto& entry : mTextures)
+    {
+        std::snprintf(line, sizeof(line), "  %10.1f KB  %ld users  %s\n", entry.bytes / 1024.0f, entry.texture.use_count(),
+                      entry.fileName.c_str());
+        report += line;
+    }
+    return report;
+}
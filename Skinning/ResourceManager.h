@@ -0,0 +1,95 @@
+//--------------------------------------------------------------------------------------
+// Resource manager - cache of loaded meshes and textures shared between users
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Resources are handed out as shared pointers. The cache only keeps weak references, so a
+// resource is freed (including its GPU memory) as soon as the last user releases its handle,
+// and requesting the same file again while it is still in use returns the existing copy.
+// Meshes are keyed by file name plus import options. A mesh imported with tangents can also
+// be used where no tangents were requested, as the extra vertex element is simply ignored.
+// The AssetLoader class (see AssetLoader.h) checks this cache before loading anything.
+// Only use from the thread that owns the D3D context.
+
+#ifndef _RESOURCE_MANAGER_H_INCLUDED_
+#define _RESOURCE_MANAGER_H_INCLUDED_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+class Mesh;
+class CTexture;
+
+class ResourceManager
+{
+public:
+    //-------------------------------------
+    // Lookup
+    //-------------------------------------
+
+    // Return a resident mesh loaded from the given file with (at least) the given options, or nullptr if there
+    // isn't one. Counts as a cache hit or miss
+    std::shared_ptr<Mesh> FindMesh(const std::string& fileName, bool requireTangents);
+
+    // Return a resident texture loaded from the given file, or nullptr if there isn't one. Counts as a cache hit or miss
+    std::shared_ptr<CTexture> FindTexture(const std::string& fileName);
+
+
+    //-------------------------------------
+    // Adding resources
+    //-------------------------------------
+
+    // Add a newly loaded mesh to the cache, taking ownership of it. Pass the approximate GPU memory it uses
+    // Returns the shared handle to give to users
+    std::shared_ptr<Mesh> AddMesh(const std::string& fileName, bool requireTangents, std::unique_ptr<Mesh> mesh, std::size_t bytes);
+
+    // Add a newly loaded texture to the cache, taking ownership of it. Pass the approximate GPU memory it uses
+    // Returns the shared handle to give to users
+    std::shared_ptr<CTexture> AddTexture(const std::string& fileName, std::unique_ptr<CTexture> texture, std::size_t bytes);
+
+
+    //-------------------------------------
+    // Statistics
+    //-------------------------------------
+
+    unsigned int NumHits()    { return mHits; }
+    unsigned int NumMisses()  { return mMisses; }
+
+    // Number of resources and approximate GPU memory of everything still in use
+    unsigned int NumResident();
+    std::size_t  ResidentBytes();
+
+    // Summary of the above as text, with one line per resident resource
+    std::string StatsReport();
+
+
+private:
+    // Remove entries for resources that are no longer used by anyone
+    void RemoveExpired();
+
+    struct MeshEntry
+    {
+        std::string         fileName;
+        bool                requireTangents;
+        std::weak_ptr<Mesh> mesh;
+        std::size_t         bytes;
+    };
+
+    struct TextureEntry
+    {
+        std::string             fileName;
+        std::weak_ptr<CTexture> texture;
+        std::size_t             bytes;
+    };
+
+    // Only a handful of resources in this app so a simple search is fine
+    std::vector<MeshEntry>    mMeshes;
+    std::vector<TextureEntry> mTextures;
+
+    unsigned int mHits   = 0;
+    unsigned int mMisses = 0;
+};
+
+
+#endif //_RESOURCE_MANAGER_H_INCLUDED_
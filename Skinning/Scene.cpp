@@ -13,6 +13,27 @@
 #include "Input.h"
 #include "Common.h"
 #include "CLight.h"
+#include "AssetLoader.h"
+#include "ResourceManager.h"
+#include "ThreadPool.h"
+#include "CpuSkinning.h"
+#include "AnimationClip.h"
+#include "HeapAllocationCheck.h"
+#include "RenderQueue.h"
+#include "Culling.h"
+#include "StateCache.h"
+#include "ShadowMapCache.h"
+#include "ShadowAtlas.h"
+#include "ShadowCascades.h"
+#include "LightClusters.h"
+#include "StaticBatch.h"
+#include "GeometryArena.h"
+#include "RangeAllocator.h"
+#include "VertexPacking.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Meshlets.h"
+#include "OcclusionCulling.h"
 
 #include "CVector2.h" 
 #include "CVector3.h" 
@@ -22,8 +43,14 @@
 
 #include "ColourRGBA.h" 
 
-#include <sstream>
 #include <memory>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <random>
+#include <stdexcept>
 
 
 //--------------------------------------------------------------------------------------
@@ -39,14 +66,18 @@ const float MOVEMENT_SPEED = 50.0f; // 50 units per second for movement (what a
 //Strength of the wiggle effect 
 const int WIGGLESTRENGTH = 2;
 
+// Cache of loaded meshes and textures. Hands out shared handles so each file is only loaded once
+ResourceManager gResourceManager;
+
 // Meshes, models and cameras, same meaning as TL-Engine. Meshes prepared in InitGeometry function, Models & camera in InitScene
-Mesh* gTeapotMesh;
-Mesh* gGroundMesh;
-Mesh* gNormalMappingMesh;
-Mesh* gLightMesh;
-Mesh* gSphereMesh;
-Mesh* gCubeMesh;
-Mesh* gTrollMesh;
+// Meshes are shared handles from the resource manager, freed when the last handle is reset
+std::shared_ptr<Mesh> gTeapotMesh;
+std::shared_ptr<Mesh> gGroundMesh;
+std::shared_ptr<Mesh> gNormalMappingMesh;
+std::shared_ptr<Mesh> gLightMesh;
+std::shared_ptr<Mesh> gSphereMesh;
+std::shared_ptr<Mesh> gCubeMesh;
+std::shared_ptr<Mesh> gTrollMesh;
 
 Model* gTeapot;
 Model* gNormalMappingCube;
@@ -61,6 +92,13 @@ Model* gTrollModel;
 
 Camera* gCamera;
 
+// Worker threads for loading and other parallel work
+ThreadPool* gThreadPool = nullptr;
+
+// Load meshes and textures in parallel on the thread pool. Set to false to load serially, e.g. to compare the
+// startup timings written to the debugger output window by InitGeometry
+bool gParallelAssetLoading = true;
+
 // Store lights in an array in this exercise
 const int NUM_LIGHTS = 4;
 
@@ -85,6 +123,19 @@ CVector3 LightsPosition[NUM_LIGHTS] = { { 30, 10, 0 },
                                         { 60, 20,0},
                                         { 100, 40, 40} };
 
+// How each light casts shadows: point lights render a shadow map for each of the six faces of a cube around them,
+// spotlights render one and directional lights one for each cascade (see ShadowCascades.h)
+enum class ShadowType { None, Point, Spot, Directional };
+ShadowType LightsShadowType[NUM_LIGHTS] = { ShadowType::Point, ShadowType::Point, ShadowType::Spot, ShadowType::Directional };
+
+// Point lights and spotlights are lit through the light clusters (see LightClusters.h), the directional light reaches
+// everywhere so is in the per-frame constants instead. There can only be one directional light
+enum class LightType { Point, Spot, Directional };
+LightType LightsType[NUM_LIGHTS] = { LightType::Point, LightType::Point, LightType::Spot, LightType::Directional };
+
+// Brightness below which a light's effect is ignored, sets how far from each light shadows are needed
+const float gLightCutoff = 0.05f;
+
 // Additional light information
 CVector3 gAmbientColour = { 0.2f, 0.2f, 0.3f }; // Background level of light (slightly bluish to match the far background, which is dark blue)
 float    gSpecularPower = 256; // Specular power controls shininess - same for all models in this app
@@ -105,12 +156,48 @@ const float gParallaxDepth = 0.1f;
 //angle of the spotlights Field of View
 float gSpotlightConeAngle = 90.0f;
 
-//Size of the shadow to use (size of the texture)
-int gShadowMapSize = 1024;
-
-ID3D11Texture2D* gShadowMap1Texture = nullptr;
-ID3D11DepthStencilView* gShadowMap1DepthStencil = nullptr;
-ID3D11ShaderResourceView* gShadowMap1SRV = nullptr;
+// All the lights' shadow maps are tiles in one large depth texture, the shadow atlas (see ShadowAtlas.h). Lights that
+// cover more of the screen get larger tiles, up to a maximum for each kind of light. Point lights need a tile for each
+// cube face so have a smaller maximum. Directional light cascades always use the same size, a change of size would
+// change the size of their texels and make the shadows shimmer
+const unsigned int gShadowAtlasSize        = 4096;
+const unsigned int gMinShadowTileSize      = 128;
+const unsigned int gMaxPointShadowTileSize = 512;
+const unsigned int gMaxSpotShadowTileSize  = 1024;
+const unsigned int gCascadeShadowTileSize  = 1024;
+
+// Directional light shadows reach gShadowDistance from the camera (or the far clip if nearer), split into cascades.
+// gCascadeSplitLambda chooses between evenly spaced splits (0) and logarithmic ones (1), see CalculateCascadeSplits.
+// Cascades move in steps of gCascadeSnapTexels texels, so their shadow maps are only rendered again once the camera
+// has moved that far (or a caster in them has moved)
+const unsigned int NUM_SHADOW_CASCADES = 4;
+const float        gShadowDistance     = 300.0f;
+const float        gCascadeSplitLambda = 0.75f;
+const unsigned int gCascadeSnapTexels  = 4;
+
+ID3D11Texture2D* gShadowAtlasTexture = nullptr;
+ID3D11DepthStencilView* gShadowAtlasDepthStencil = nullptr;
+ID3D11ShaderResourceView* gShadowAtlasSRV = nullptr;
+
+// The light clusters are rebuilt each frame for the camera's view, then the lights, the range of each cluster's
+// list and the lists themselves are copied to structured buffers for the pixel shaders (see ClusteredLighting.hlsli)
+LightClusterBuilder gLightClusters;
+std::vector<ClusterLight> gClusterLights; // Sized for the most lights the clusters can hold, built each frame
+
+ID3D11Buffer* gClusterLightBuffer = nullptr;
+ID3D11Buffer* gClusterRangeBuffer = nullptr;
+ID3D11Buffer* gClusterIndexBuffer = nullptr;
+ID3D11ShaderResourceView* gClusterLightSRV = nullptr;
+ID3D11ShaderResourceView* gClusterRangeSRV = nullptr;
+ID3D11ShaderResourceView* gClusterIndexSRV = nullptr;
+
+// Small unshadowed point lights scattered over the ground to show the clusters handling many lights, on/off with key 2.
+// Their range is where they fall below gLightCutoff, the same as the scene lights
+const unsigned int NUM_FILL_LIGHTS = 512;
+const float gFillLightArea = 150.0f; // Lights are within this distance of the origin in x and z
+const float gFillLightStrength = 0.75f;
+std::vector<ClusterLight> gFillLights;
+bool gShowFillLights = true;
 
 //--------------------------------------------------------------------------------------
 // Constant Buffers
@@ -126,26 +213,158 @@ ID3D11Buffer*     gPerFrameConstantBuffer; // The GPU buffer that will recieve t
 PerModelConstants gPerModelConstants;      // As above, but constant that change per-model (e.g. world matrix)
 ID3D11Buffer*     gPerModelConstantBuffer; // --"--
 
+ID3D11Buffer*     gPerSkeletonConstantBuffer; // Bone palette for each skinned draw, only the bones used are uploaded
+
+ID3D11Buffer*     gInstanceBuffer; // World matrix and colour of each copy in an instanced draw (see Mesh::RenderInstanced)
+
+PerShadowConstants gPerShadowConstants;      // Shadow atlas tiles and matrices for each light (see common.h for structure)
+ID3D11Buffer*      gPerShadowConstantBuffer; // --"--
+
 //--------------------------------------------------------------------------------------
 // Textures
 //--------------------------------------------------------------------------------------
 
 // DirectX objects controlling textures used in this lab
+// Shared handles from the resource manager, the DirectX objects are released when the last handle is reset
+
+std::shared_ptr<CTexture> CStoneTexture;
+std::shared_ptr<CTexture> CSphereTexture;
+std::shared_ptr<CTexture> CBrickTexture;
+std::shared_ptr<CTexture> CGroundTexture;
+std::shared_ptr<CTexture> CLightTexture;
+std::shared_ptr<CTexture> CGlassTexture;
+std::shared_ptr<CTexture> CMoogleTexture;
+std::shared_ptr<CTexture> CWoodNormalTexture;
+std::shared_ptr<CTexture> CPatternTexture;
+std::shared_ptr<CTexture> CPatternNormal;
+std::shared_ptr<CTexture> CWallTexture;
+std::shared_ptr<CTexture> CWallNormalHeight;
+std::shared_ptr<CTexture> CCellMapTexture;
+std::shared_ptr<CTexture> CTrollTexture;
+
+//--------------------------------------------------------------------------------------
+// Materials
+//--------------------------------------------------------------------------------------
+// Shaders, states and textures for each model in the camera pass. Set up in InitMaterials once everything they use
+// has been created. The camera pass adds models to the render queue with these, which sorts them to minimise binds
+
+RenderMaterial gGroundMaterial;
+RenderMaterial gTeapotMaterial;
+RenderMaterial gAdditiveBlendingMaterial;
+RenderMaterial gAlphaBlendingMaterial;
+RenderMaterial gTextureScrollingMaterial;
+RenderMaterial gTextureFadingMaterial;
+RenderMaterial gNormalMappingMaterial;
+RenderMaterial gParallaxMappingMaterial;
+RenderMaterial gCellShadingOutlineMaterial;
+RenderMaterial gCellShadingMaterial;
+RenderMaterial gMultiplicativeBlendingMaterial;
+RenderMaterial gLightModelMaterial;
+RenderMaterial gDepthOnlyMaterial; // Shadow casters
+
+RenderQueue gRenderQueue;
+RenderQueue gShadowQueue; // Shadow casters for one shadow view at a time, already culled
+
+// Models that never move, merged into one mesh per material and drawn in the camera pass in place of the models. Shadow
+// passes still draw the models, so they can be culled and instanced with the other casters
+StaticBatch gStaticBatch;
+bool        gStaticBatching = true;
+
+// Largest simplification error allowed on screen, in pixels, when choosing each model's level of detail (see
+// Model::SelectLod). Key 5 sets it to 0 to draw everything at full detail
+const float LOD_PIXEL_ERROR = 1.0f;
+LodView gLodView = { { 0, 0, 0 }, 1, LOD_PIXEL_ERROR, 0 };
+
+// Software occlusion culling (see OcclusionCulling.h): the large opaque models are drawn into a small depth buffer on
+// the CPU each frame, then the camera pass skips models hidden behind them. The sphere is left out as its vertex shader
+// moves its surface. Key 7 switches occlusion culling on and off. The buffer is drawn by a job started at the beginning
+// of RenderScene, so it runs on the workers while this thread renders the shadows, and the camera pass waits for it
+const unsigned int NUM_OCCLUDERS = 5;
+Model*          gOccluders[NUM_OCCLUDERS];
+OcclusionBuffer gOcclusionBuffer;
+JobCounter      gOcclusionJob;
+bool            gOcclusionCulling = true;
+
+// Culls shadow casters against each light's frustum. The camera pass is culled by the render queue
+FrustumCuller gShadowCuller;
+
+// Models that cast shadows, set up in InitScene
+const unsigned int NUM_SHADOW_CASTERS = 10;
+Model* gShadowCasters[NUM_SHADOW_CASTERS];
+
+// Tiles in the shadow atlas for every shadow view (a spotlight, directional light or point light cube face), and the
+// matrices each view is rendered with this frame
+ShadowAtlas  gShadowAtlas(gShadowAtlasSize, gMinShadowTileSize, MAX_SHADOW_VIEWS);
+unsigned int gNumShadowViews = 0;
+CMatrix4x4   gShadowViewMatrices[MAX_SHADOW_VIEWS];
+CMatrix4x4   gShadowProjectionMatrices[MAX_SHADOW_VIEWS];
+
+// Each view's tile is only rendered again when the view or a caster inside it has changed, or the tile has moved
+ShadowMapCache gShadowViewCaches[MAX_SHADOW_VIEWS];
+
+// Helper to fill in a material - textures go in slots 0 and 2 (slot 1 is the shadow map) with the anisotropic sampler
+RenderMaterial MakeMaterial(ID3D11VertexShader* vertexShader, ID3D11PixelShader* pixelShader,
+                            ID3D11BlendState* blendState, ID3D11DepthStencilState* depthStencilState, ID3D11RasterizerState* rasterizerState,
+                            ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* secondTexture = nullptr)
+{
+    RenderMaterial material;
+    material.vertexShader      = vertexShader;
+    material.pixelShader       = pixelShader;
+    material.blendState        = blendState;
+    material.depthStencilState = depthStencilState;
+    material.rasterizerState   = rasterizerState;
+    material.textures[0]       = texture;
+    material.textures[2]       = secondTexture;
+    material.samplers[0]       = gAnisotropic4xSampler;
+    material.blended           = (blendState != gNoBlendingState);
+    return material;
+}
+
+// Set up the materials above, after the shaders, states and textures have been created
+void InitMaterials()
+{
+    gGroundMaterial = MakeMaterial(gPixelLightingVertexShader, gPixelLightingPixelShader,
+                                   gNoBlendingState, gUseDepthBufferState, gCullBackState, CGroundTexture->SRVMap);
+    gTeapotMaterial = MakeMaterial(gPixelLightingVertexShader, gPixelLightingPixelShader,
+                                   gNoBlendingState, gUseDepthBufferState, gCullBackState, CStoneTexture->SRVMap);
+
+    gAdditiveBlendingMaterial = MakeMaterial(gPixelLightingVertexShader, gBlendingPixelShader,
+                                             gAdditiveBlendingState, gDepthReadOnlyState, gCullBackState, CLightTexture->SRVMap);
+    gAlphaBlendingMaterial    = MakeMaterial(gPixelLightingVertexShader, gBlendingPixelShader,
+                                             gAlphaBlending, gUseDepthBufferState, gCullBackState, CMoogleTexture->SRVMap);
+
+    gTextureScrollingMaterial = MakeMaterial(gWigglingVertexShader, gTextureScrollingPixelShader,
+                                             gNoBlendingState, gUseDepthBufferState, gCullBackState, CSphereTexture->SRVMap);
+    gTextureFadingMaterial    = MakeMaterial(gPixelLightingVertexShader, gTextureFadingPixelShader,
+                                             gNoBlendingState, gUseDepthBufferState, gCullBackState, CBrickTexture->SRVMap, CGroundTexture->SRVMap);
+
+    gNormalMappingMaterial   = MakeMaterial(gNormalMappingVertexShader, gNormalMappingPixelShader,
+                                            gNoBlendingState, gUseDepthBufferState, gCullBackState, CPatternTexture->SRVMap, CPatternNormal->SRVMap);
+    gParallaxMappingMaterial = MakeMaterial(gNormalMappingVertexShader, gParallaxMappingPixelShader,
+                                            gNoBlendingState, gUseDepthBufferState, gCullBackState, CWallTexture->SRVMap, CWallNormalHeight->SRVMap);
+
+    // Cell shading outline is drawn inside-out (front faces culled) and doesn't use textures
+    gCellShadingOutlineMaterial = MakeMaterial(gCellShadingOutlineVertexShader, gCellShadingOutlinePixelShader,
+                                               gNoBlendingState, gUseDepthBufferState, gCullFrontState, nullptr);
+    gCellShadingMaterial        = MakeMaterial(gPixelLightingVertexShader, gCellShadingPixelShader,
+                                               gNoBlendingState, gUseDepthBufferState, gCullBackState, CTrollTexture->SRVMap, CCellMapTexture->SRVMap);
+    gCellShadingMaterial.samplers[1] = gPointSampler; // Cell map lookup is not filtered
+
+    gMultiplicativeBlendingMaterial = MakeMaterial(gPixelLightingVertexShader, gBlendingPixelShader,
+                                                   gMultiplicativeBlend, gDepthReadOnlyState, gCullNoneState, CGlassTexture->SRVMap);
+
+    // Light models and shadow casters have instanced shaders, so models sharing a mesh are drawn together (e.g. the four
+    // lights, or the blending cubes in each shadow view). Light models are tinted with their model colour
+    gLightModelMaterial = MakeMaterial(gBasicTransformVertexShader, gLightModelPixelShader,
+                                       gAdditiveBlendingState, gDepthReadOnlyState, gCullNoneState, CLightTexture->SRVMap);
+    gLightModelMaterial.instancedVertexShader = gBasicTransformInstancedVertexShader;
+
+    gDepthOnlyMaterial = MakeMaterial(gBasicTransformVertexShader, gDepthOnlyPixelShader,
+                                      gNoBlendingState, gUseDepthBufferState, gCullBackState, nullptr);
+    gDepthOnlyMaterial.samplers[0] = nullptr; // No textures
+    gDepthOnlyMaterial.instancedVertexShader = gBasicTransformInstancedVertexShader;
+}
 
-CTexture* CStoneTexture      = new CTexture();
-CTexture* CSphereTexture     = new CTexture();
-CTexture* CBrickTexture      = new CTexture();
-CTexture* CGroundTexture     = new CTexture();
-CTexture* CLightTexture      = new CTexture();
-CTexture* CGlassTexture      = new CTexture();
-CTexture* CMoogleTexture     = new CTexture();
-CTexture* CWoodNormalTexture = new CTexture();
-CTexture* CPatternTexture    = new CTexture();
-CTexture* CPatternNormal     = new CTexture();
-CTexture* CWallTexture       = new CTexture();
-CTexture* CWallNormalHeight  = new CTexture();
-CTexture* CCellMapTexture    = new CTexture();
-CTexture* CTrollTexture      = new CTexture();
 
 // Get "camera-like" view matrix for a spotlight
 CMatrix4x4 CalculateLightViewMatrix(int lightIndex)
@@ -159,6 +378,65 @@ CMatrix4x4 CalculateLightProjectionMatrix(int lightIndex)
     return MakeProjectionMatrix(1.0f, ToRadians(gSpotlightConeAngle)); // Helper function in Utility\GraphicsHelpers.cpp
 }
 
+// Get the sphere outside which a light is too dim to matter. Lights fall off with 1 / distance in the shaders, so this
+// is where the light's brightest colour channel drops below gLightCutoff
+BoundingSphere CalculateLightInfluence(int lightIndex)
+{
+    const CVector3& colour = gLights[lightIndex]->LightColour;
+    BoundingSphere influence;
+    influence.centre = gLights[lightIndex]->LightModel->Position();
+    influence.radius = std::max({ colour.x, colour.y, colour.z, 0.0f }) * gLights[lightIndex]->LightStrength / gLightCutoff;
+    return influence;
+}
+
+// Get "camera-like" view matrix for one face of the cube around a point light: looking down the +x, -x, +y, -y, +z
+// or -z axis for faces 0 to 5
+CMatrix4x4 CalculateCubeFaceViewMatrix(int lightIndex, int face)
+{
+    static const CVector3 forwards[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    static const CVector3 ups[6]      = { { 0, 1, 0 }, {  0, 1, 0 }, { 0, 0,-1 }, { 0,  0, 1 }, { 0, 1, 0 }, { 0,  1, 0 } };
+
+    CMatrix4x4 faceMatrix = MatrixIdentity();
+    faceMatrix.SetRow(0, Cross(ups[face], forwards[face]));
+    faceMatrix.SetRow(1, ups[face]);
+    faceMatrix.SetRow(2, forwards[face]);
+    faceMatrix.SetRow(3, gLights[lightIndex]->LightModel->Position());
+    return InverseAffine(faceMatrix);
+}
+
+// Get "camera-like" view and projection matrices for each cascade of a directional light, for views firstView onwards.
+// Called once the cascades have their tiles, the matrices are snapped to the texels of the tile
+void CalculateCascadeMatrices(int lightIndex, unsigned int firstView)
+{
+    float splits[NUM_SHADOW_CASCADES + 1];
+    CalculateCascadeSplits(gCamera->NearClip(), std::min(gCamera->FarClip(), gShadowDistance), NUM_SHADOW_CASCADES,
+                           gCascadeSplitLambda, splits);
+
+    // The cascades reach back towards the light as far as the casters
+    AABB casterBounds;
+    for (auto model : gShadowCasters)  casterBounds.Add(model->WorldBounds());
+
+    // Light direction matches the one given to the shaders
+    CVector3 lightDirection = -gLights[lightIndex]->LightModel->WorldMatrix().GetXAxis();
+
+    CMatrix4x4 cameraMatrix = InverseAffine(gCamera->ViewMatrix());
+    float tanHalfFOVx = std::tan(gCamera->FOV() * 0.5f);
+    float tanHalfFOVy = tanHalfFOVx / gCamera->AspectRatio();
+    for (unsigned int cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade)
+    {
+        // A cascade that was given a smaller tile than it asked for still needs snapping to that tile's texels
+        unsigned int view = firstView + cascade;
+        unsigned int tileSize = gShadowAtlas.Tile(view).size;
+        if (tileSize == 0)  tileSize = gCascadeShadowTileSize;
+
+        ShadowCascade shadowCascade = CalculateShadowCascade(cameraMatrix, tanHalfFOVx, tanHalfFOVy,
+                                                             splits[cascade], splits[cascade + 1],
+                                                             lightDirection, casterBounds, tileSize, gCascadeSnapTexels);
+        gShadowViewMatrices[view] = shadowCascade.viewMatrix;
+        gShadowProjectionMatrices[view] = shadowCascade.projectionMatrix;
+    }
+}
+
 //--------------------------------------------------------------------------------------
 // Initialise scene geometry, constant buffers and states
 //--------------------------------------------------------------------------------------
@@ -167,20 +445,41 @@ CMatrix4x4 CalculateLightProjectionMatrix(int lightIndex)
 // Returns true on success
 bool InitGeometry()
 {
+    gThreadPool = new ThreadPool();
+
     // Load mesh geometry data, just like TL-Engine this doesn't create anything in the scene. Create a Model for that.
-    try 
-    {
-        gTeapotMesh           = new Mesh("Teapot.x");
-        gNormalMappingMesh   = new Mesh("Cube.x", true);
-        gGroundMesh          = new Mesh("Ground.x");
-        gLightMesh           = new Mesh("Light.x");
-        gSphereMesh          = new Mesh("Sphere.x");
-        gCubeMesh            = new Mesh("Cube.x");
-        gTrollMesh           = new Mesh("Troll.x");
-    }
-    catch (std::runtime_error e)  // Constructors cannot return error messages so use exceptions to catch mesh errors (fairly standard approach this)
+    // Textures are loaded at the same time. Importing meshes and decoding image files is done on the thread pool,
+    // then the GPU resources are created here (see AssetLoader.h). The texture variables are globals found near the top of the file.
+    AssetLoader assetLoader(gResourceManager);
+    assetLoader.AddMesh(&gTeapotMesh,        "Teapot.x");
+    assetLoader.AddMesh(&gNormalMappingMesh, "Cube.x", true);
+    assetLoader.AddMesh(&gGroundMesh,        "Ground.x");
+    assetLoader.AddMesh(&gLightMesh,         "Light.x");
+    assetLoader.AddMesh(&gSphereMesh,        "Sphere.x");
+    assetLoader.AddMesh(&gCubeMesh,          "Cube.x");
+    assetLoader.AddMesh(&gTrollMesh,         "Troll.x");
+
+    assetLoader.AddTexture(&CStoneTexture,      "StoneDiffuseSpecular.dds");
+    assetLoader.AddTexture(&CSphereTexture,     "brick1.jpg");
+    assetLoader.AddTexture(&CBrickTexture,      "brick1.jpg");
+    assetLoader.AddTexture(&CGroundTexture,     "WoodDiffuseSpecular.dds");
+    assetLoader.AddTexture(&CLightTexture,      "Flare.jpg");
+    assetLoader.AddTexture(&CGlassTexture,      "Glass.jpg");
+    assetLoader.AddTexture(&CMoogleTexture,     "Moogle.png");
+    assetLoader.AddTexture(&CWoodNormalTexture, "WoodNormal.dds");
+    assetLoader.AddTexture(&CPatternTexture,    "PatternDiffuseSpecular.dds");
+    assetLoader.AddTexture(&CPatternNormal,     "PatternNormal.dds");
+    assetLoader.AddTexture(&CWallNormalHeight,  "WallNormalHeight.dds");
+    assetLoader.AddTexture(&CWallTexture,       "WallDiffuseSpecular.dds");
+    assetLoader.AddTexture(&CTrollTexture,      "Red.png");
+    assetLoader.AddTexture(&CCellMapTexture,    "CellGradient.png");
+
+    bool assetsLoaded = assetLoader.LoadAll(gParallelAssetLoading ? gThreadPool : nullptr);
+    OutputDebugStringA(assetLoader.TimingReport().c_str());
+    OutputDebugStringA(gResourceManager.StatsReport().c_str());
+    if (!assetsLoaded)
     {
-        gLastError = e.what(); // This picks up the error message put in the exception (see Mesh.cpp)
+        gLastError = assetLoader.GetError(); // The error for the first asset that failed, in the order added above
         return false;
     }
 
@@ -196,36 +495,29 @@ bool InitGeometry()
     // See the comments above where these variable are declared and also the UpdateScene function
     gPerFrameConstantBuffer = CreateConstantBuffer(sizeof(gPerFrameConstants));
     gPerModelConstantBuffer = CreateConstantBuffer(sizeof(gPerModelConstants));
-    if (gPerFrameConstantBuffer == nullptr || gPerModelConstantBuffer == nullptr)
+    gPerSkeletonConstantBuffer = CreateConstantBuffer(sizeof(PerSkeletonConstants));
+    gPerShadowConstantBuffer = CreateConstantBuffer(sizeof(gPerShadowConstants));
+    if (gPerFrameConstantBuffer == nullptr || gPerModelConstantBuffer == nullptr || gPerSkeletonConstantBuffer == nullptr ||
+        gPerShadowConstantBuffer == nullptr)
     {
         gLastError = "Error creating constant buffers";
         return false;
     }
 
-    //// Load / prepare textures on the GPU ////
-
-    // Load textures and create DirectX objects for them
-    // The LoadTexture function requires you to pass a ID3D11Resource* (e.g. &gCubeDiffuseMap), which manages the GPU memory for the
-    // texture and also a ID3D11ShaderResourceView* (e.g. &gCubeDiffuseMapSRV), which allows us to use the texture in shaders
-    // The function will fill in these pointers with usable data. The variables used here are globals found near the top of the file.
-    if (!CStoneTexture->LoadTextureFromHelper("StoneDiffuseSpecular.dds") || !CSphereTexture->LoadTextureFromHelper("brick1.jpg") ||
-        !CBrickTexture->LoadTextureFromHelper("brick1.jpg") || !CGroundTexture->LoadTextureFromHelper("WoodDiffuseSpecular.dds") ||
-        !CLightTexture->LoadTextureFromHelper("Flare.jpg") || !CGlassTexture->LoadTextureFromHelper("Glass.jpg") ||
-        !CMoogleTexture->LoadTextureFromHelper("Moogle.png") || !CWoodNormalTexture->LoadTextureFromHelper("WoodNormal.dds") ||
-        !CPatternTexture->LoadTextureFromHelper("PatternDiffuseSpecular.dds") || !CPatternNormal->LoadTextureFromHelper("PatternNormal.dds") ||
-        !CWallNormalHeight->LoadTextureFromHelper("WallNormalHeight.dds") || !CWallTexture->LoadTextureFromHelper("WallDiffuseSpecular.dds") ||
-        !CTrollTexture->LoadTextureFromHelper("Red.png") || !CCellMapTexture->LoadTextureFromHelper("CellGradient.png"))
-    {
-        gLastError = "Error loading textures";
+    // Instanced draws read each copy's world matrix and colour from this vertex buffer instead of the per-model constants
+    gInstanceBuffer = CreateInstanceBuffer(sizeof(InstanceData), MAX_INSTANCES);
+    if (gInstanceBuffer == nullptr)
+    {
+        gLastError = "Error creating instance buffer";
         return false;
     }
 
-    //**** Create Shadow Map texture ****//
+    //**** Create Shadow Atlas texture ****//
 
-    // We also need a depth buffer to go with our portal
+    // One depth texture holds the shadow maps of every light, each in its own tile (see ShadowAtlas.h)
     D3D11_TEXTURE2D_DESC textureDesc = {};
-    textureDesc.Width = gShadowMapSize; // Size of the shadow map determines quality / resolution of shadows
-    textureDesc.Height = gShadowMapSize;
+    textureDesc.Width = gShadowAtlasSize; // Size of the atlas limits the total resolution of all the shadow maps
+    textureDesc.Height = gShadowAtlasSize;
     textureDesc.MipLevels = 1; // 1 level, means just the main texture, no additional mip-maps. Usually don't use mip-maps when rendering to textures (or we would have to render every level)
     textureDesc.ArraySize = 1;
     textureDesc.Format = DXGI_FORMAT_R32_TYPELESS; // The shadow map contains a single 32-bit value [tech gotcha: have to say typeless because depth buffer and shaders see things slightly differently]
@@ -235,9 +527,9 @@ bool InitGeometry()
     textureDesc.BindFlags = D3D10_BIND_DEPTH_STENCIL | D3D10_BIND_SHADER_RESOURCE; // Indicate we will use texture as a depth buffer and also pass it to shaders
     textureDesc.CPUAccessFlags = 0;
     textureDesc.MiscFlags = 0;
-    if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gShadowMap1Texture)))
+    if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gShadowAtlasTexture)))
     {
-        gLastError = "Error creating shadow map texture";
+        gLastError = "Error creating shadow atlas texture";
         return false;
     }
 
@@ -247,9 +539,9 @@ bool InitGeometry()
     dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
     dsvDesc.Texture2D.MipSlice = 0;
     dsvDesc.Flags = 0;
-    if (FAILED(gD3DDevice->CreateDepthStencilView(gShadowMap1Texture, &dsvDesc, &gShadowMap1DepthStencil)))
+    if (FAILED(gD3DDevice->CreateDepthStencilView(gShadowAtlasTexture, &dsvDesc, &gShadowAtlasDepthStencil)))
     {
-        gLastError = "Error creating shadow map depth stencil view";
+        gLastError = "Error creating shadow atlas depth stencil view";
         return false;
     }
 
@@ -261,13 +553,44 @@ bool InitGeometry()
     srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
     srvDesc.Texture2D.MostDetailedMip = 0;
     srvDesc.Texture2D.MipLevels = 1;
-    if (FAILED(gD3DDevice->CreateShaderResourceView(gShadowMap1Texture, &srvDesc, &gShadowMap1SRV)))
+    if (FAILED(gD3DDevice->CreateShaderResourceView(gShadowAtlasTexture, &srvDesc, &gShadowAtlasSRV)))
     {
-        gLastError = "Error creating shadow map shader resource view";
+        gLastError = "Error creating shadow atlas shader resource view";
         return false;
     }
 
 
+    //**** Create light cluster buffers ****//
+
+    // Fixed size buffers for the most lights and light list entries the clusters can hold, so the lists for any frame fit
+    gClusterLightBuffer = CreateStructuredBuffer(sizeof(ClusterLight), gLightClusters.MaxLights(), &gClusterLightSRV);
+    gClusterRangeBuffer = CreateStructuredBuffer(sizeof(ClusterRange), gLightClusters.NumClusters(), &gClusterRangeSRV);
+    gClusterIndexBuffer = CreateStructuredBuffer(sizeof(unsigned int), gLightClusters.MaxLightIndices(), &gClusterIndexSRV);
+    if (gClusterLightBuffer == nullptr || gClusterRangeBuffer == nullptr || gClusterIndexBuffer == nullptr)
+    {
+        gLastError = "Error creating light cluster buffers";
+        return false;
+    }
+    gClusterLights.resize(gLightClusters.MaxLights());
+
+    // Fill lights in random bright colours, always the same ones
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> across(-gFillLightArea, gFillLightArea);
+    std::uniform_real_distribution<float> height(2.0f, 10.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    gFillLights.resize(NUM_FILL_LIGHTS);
+    for (auto& light : gFillLights)
+    {
+        light.position = { across(random), height(random), across(random) };
+        light.colour = Normalise(CVector3{ unit(random), unit(random), unit(random) } + CVector3{ 0.1f, 0.1f, 0.1f });
+        light.range = std::max({ light.colour.x, light.colour.y, light.colour.z }) * gFillLightStrength / gLightCutoff;
+        light.colour *= gFillLightStrength;
+        light.cosHalfAngle = -2.0f;
+        light.direction = { 0, 0, 1 };
+        light.shadow = -1;
+    }
+
+
     //*****************************//
 
   	// Create all filtering modes, blending modes etc. used by the app (see State.cpp/.h)
@@ -286,16 +609,16 @@ bool InitScene()
 {
     //// Set up scene ////
 
-    gTeapot = new Model(gTeapotMesh);
-    gGround = new Model(gGroundMesh);
-    gNormalMappingCube = new Model(gNormalMappingMesh);
-    gSphere = new Model(gSphereMesh);
-    gLerpCube = new Model(gCubeMesh);
-    gAdditiveBlendingModel = new Model(gCubeMesh);
-    gMultiplicativeBlendingModel = new Model(gCubeMesh);
-    gAlphaBlendingModel = new Model(gCubeMesh);
-    gParallaxMappingCube = new Model(gNormalMappingMesh);
-    gTrollModel = new Model(gTrollMesh);
+    gTeapot = new Model(gTeapotMesh.get());
+    gGround = new Model(gGroundMesh.get());
+    gNormalMappingCube = new Model(gNormalMappingMesh.get());
+    gSphere = new Model(gSphereMesh.get());
+    gLerpCube = new Model(gCubeMesh.get());
+    gAdditiveBlendingModel = new Model(gCubeMesh.get());
+    gMultiplicativeBlendingModel = new Model(gCubeMesh.get());
+    gAlphaBlendingModel = new Model(gCubeMesh.get());
+    gParallaxMappingCube = new Model(gNormalMappingMesh.get());
+    gTrollModel = new Model(gTrollMesh.get());
 
     // Initial positions
     gTeapot->SetPosition({ 60, 0, 25 });
@@ -334,10 +657,13 @@ bool InitScene()
     gTrollModel->SetScale(4.0f);
     gTrollModel->SetRotation({ 0.0f, 0.0f, 0.0f });
 
+    // The troll plays its first animation clip, if its file has any (see UpdateScene)
+    if (gTrollMesh->NumberAnimations() > 0)  gTrollModel->PlayAnimation(gTrollMesh->GetAnimation(0));
+
     // Light set-up - using an array this time
     for (int i = 0; i < NUM_LIGHTS; ++i)
     {
-        gLights[i] = new CLight(gLightMesh, LightsScale[i], LightsColour[i], LightsPosition[i], pow(LightsScale[i], 0.7f));
+        gLights[i] = new CLight(gLightMesh.get(), LightsScale[i], LightsColour[i], LightsPosition[i], pow(LightsScale[i], 0.7f));
     }
     gLights[3]->LightModel->SetScale(pow(10, 0.7));
 
@@ -349,6 +675,31 @@ bool InitScene()
     gCamera->SetPosition({ 25, 20,-20 });
     gCamera->SetRotation({ ToRadians(15.0f), 0, 0.0f });
 
+    Model* shadowCasters[NUM_SHADOW_CASTERS] = { gGround, gTeapot, gAdditiveBlendingModel, gAlphaBlendingModel, gSphere, gLerpCube,
+                                                 gNormalMappingCube, gParallaxMappingCube, gTrollModel, gMultiplicativeBlendingModel };
+    std::copy(std::begin(shadowCasters), std::end(shadowCasters), gShadowCasters);
+    Model* occluders[NUM_OCCLUDERS] = { gGround, gTeapot, gLerpCube, gNormalMappingCube, gParallaxMappingCube };
+    std::copy(std::begin(occluders), std::end(occluders), gOccluders);
+    gShadowAtlas.Reset(); // Every shadow view gets a new tile and is rendered on the first frame
+
+    InitMaterials();
+
+    // The ground and the cubes that don't animate never move after this, so they go in the static batch. The sphere's
+    // vertex shader wiggles it in model space and the teapot can be moved, so they are left as models
+    gStaticBatch.Add(gGround,              &gGroundMaterial);
+    gStaticBatch.Add(gLerpCube,            &gTextureFadingMaterial);
+    gStaticBatch.Add(gNormalMappingCube,   &gNormalMappingMaterial);
+    gStaticBatch.Add(gParallaxMappingCube, &gParallaxMappingMaterial);
+    try
+    {
+        gStaticBatch.Update(gThreadPool);
+    }
+    catch (const std::runtime_error& e)
+    {
+        gLastError = e.what();
+        return false;
+    }
+
     return true;
 }
 
@@ -357,21 +708,22 @@ void ReleaseResources()
 {
     ReleaseStates();
 
-    if (CLightTexture->SRVMap)  CLightTexture->SRVMap->Release();
-    if (CLightTexture->Map)     CLightTexture->Map->Release();
-    if (CGlassTexture->SRVMap)  CGlassTexture->SRVMap->Release();
-    if (CGlassTexture->Map)     CGlassTexture->Map->Release();
-    if (CMoogleTexture->SRVMap) CMoogleTexture->SRVMap->Release();
-    if (CMoogleTexture->Map)    CMoogleTexture->Map->Release();
-    if (CGroundTexture->SRVMap) CGroundTexture->SRVMap->Release();
-    if (CGroundTexture->Map)    CGroundTexture->Map->Release();
-    if (CStoneTexture->SRVMap)  CStoneTexture->SRVMap->Release();
-    if (CStoneTexture->Map)     CStoneTexture->Map->Release();
-    if (CSphereTexture->SRVMap) CSphereTexture->SRVMap->Release();
-    if (CSphereTexture->Map)    CSphereTexture->Map->Release();
-    if (CBrickTexture->SRVMap)  CBrickTexture->SRVMap->Release();
-    if (CBrickTexture->Map)     CBrickTexture->Map->Release();
+    gStaticBatch.Clear();
+
+    if (gClusterIndexSRV)          gClusterIndexSRV->Release();
+    if (gClusterRangeSRV)          gClusterRangeSRV->Release();
+    if (gClusterLightSRV)          gClusterLightSRV->Release();
+    if (gClusterIndexBuffer)       gClusterIndexBuffer->Release();
+    if (gClusterRangeBuffer)       gClusterRangeBuffer->Release();
+    if (gClusterLightBuffer)       gClusterLightBuffer->Release();
 
+    if (gShadowAtlasSRV)           gShadowAtlasSRV->Release();
+    if (gShadowAtlasDepthStencil)  gShadowAtlasDepthStencil->Release();
+    if (gShadowAtlasTexture)       gShadowAtlasTexture->Release();
+
+    if (gInstanceBuffer)           gInstanceBuffer->Release();
+    if (gPerShadowConstantBuffer)  gPerShadowConstantBuffer->Release();
+    if (gPerSkeletonConstantBuffer)  gPerSkeletonConstantBuffer->Release();
     if (gPerModelConstantBuffer)  gPerModelConstantBuffer->Release();
     if (gPerFrameConstantBuffer)  gPerFrameConstantBuffer->Release();
 
@@ -395,13 +747,31 @@ void ReleaseResources()
     delete gParallaxMappingCube;         gParallaxMappingCube         = nullptr;
     delete gTrollModel;                  gTrollModel                  = nullptr;
 
-    delete gLightMesh;         gLightMesh         = nullptr;
-    delete gGroundMesh;        gGroundMesh        = nullptr;
-    delete gTeapotMesh;         gTeapotMesh         = nullptr;
-    delete gNormalMappingMesh; gNormalMappingMesh = nullptr;
-    delete gSphereMesh;        gSphereMesh        = nullptr;
-    delete gCubeMesh;          gCubeMesh          = nullptr;
-    delete gTrollMesh;         gTrollMesh         = nullptr;
+    // Meshes and textures are freed when their last handle is released
+    gLightMesh        .reset();
+    gGroundMesh       .reset();
+    gTeapotMesh       .reset();
+    gNormalMappingMesh.reset();
+    gSphereMesh       .reset();
+    gCubeMesh         .reset();
+    gTrollMesh        .reset();
+
+    CStoneTexture     .reset();
+    CSphereTexture    .reset();
+    CBrickTexture     .reset();
+    CGroundTexture    .reset();
+    CLightTexture     .reset();
+    CGlassTexture     .reset();
+    CMoogleTexture    .reset();
+    CWoodNormalTexture.reset();
+    CPatternTexture   .reset();
+    CPatternNormal    .reset();
+    CWallTexture      .reset();
+    CWallNormalHeight .reset();
+    CCellMapTexture   .reset();
+    CTrollTexture     .reset();
+
+    delete gThreadPool;        gThreadPool        = nullptr;
 }
 
 
@@ -409,42 +779,181 @@ void ReleaseResources()
 // Scene Rendering
 //--------------------------------------------------------------------------------------
 
-// Render the scene from the given light's point of view. Only renders depth buffer
-void RenderDepthBufferFromLight(int lightIndex)
+// Choose the shadow views of each light and give them tiles in the shadow atlas, sized by how much of the screen the
+// light can affect. Fills in the shadow constants for the shaders
+void UpdateShadowViews()
+{
+    // The tile size heuristic needs the camera's vertical field of view, the camera stores the horizontal one
+    float tanHalfFOVy = std::tan(gCamera->FOV() * 0.5f) / gCamera->AspectRatio();
+
+    // At most 6 views per light (point lights), the lights in this scene use 17 of the MAX_SHADOW_VIEWS
+    ShadowAtlasRequest requests[MAX_SHADOW_VIEWS];
+    unsigned int view = 0;
+    for (int i = 0; i < NUM_LIGHTS; ++i)
+    {
+        LightShadow& lightShadow = gPerShadowConstants.lights[i];
+        lightShadow.position  = gLights[i]->LightModel->Position();
+        lightShadow.firstView = view;
+        lightShadow.numViews  = 0;
+        lightShadow.depthBias = 0.0005f;
+        lightShadow.cascaded  = 0;
+
+        BoundingSphere influence = CalculateLightInfluence(i);
+        float importance = ShadowImportance(influence, gCamera->Position(), tanHalfFOVy);
+        switch (LightsShadowType[i])
+        {
+        case ShadowType::Point:
+        {
+            // Six 90 degree views, one down each axis, cover every direction from the light. They reach as far as the
+            // light's influence, rounded up to a power of two so a light that changes brightness doesn't change its
+            // views (and need rendering again) every frame
+            unsigned int size = ShadowTileSize(importance, gMaxPointShadowTileSize, gMinShadowTileSize);
+            float farClip = std::exp2(std::ceil(std::log2(std::max(influence.radius, 1.0f))));
+            CMatrix4x4 projectionMatrix = MakeProjectionMatrix(1.0f, ToRadians(90.0f), 0.5f, farClip);
+            for (int face = 0; face < 6; ++face, ++view)
+            {
+                gShadowViewMatrices[view] = CalculateCubeFaceViewMatrix(i, face);
+                gShadowProjectionMatrices[view] = projectionMatrix;
+                requests[view] = { size, importance };
+            }
+            lightShadow.numViews = 6;
+            break;
+        }
+
+        case ShadowType::Spot:
+            gShadowViewMatrices[view] = CalculateLightViewMatrix(i);
+            gShadowProjectionMatrices[view] = CalculateLightProjectionMatrix(i);
+            requests[view++] = { ShadowTileSize(importance, gMaxSpotShadowTileSize, gMinShadowTileSize), importance };
+            lightShadow.numViews = 1;
+            break;
+
+        case ShadowType::Directional:
+            // A directional light reaches everything on screen so its cascades are always wanted at full size, nearest
+            // (most visible) first. Their matrices depend on the tiles they get so are calculated after allocation.
+            // Depths in an orthographic projection are linear rather than bunched up near 1 so need a larger bias
+            for (unsigned int cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade, ++view)
+            {
+                requests[view] = { gCascadeShadowTileSize, 1.0f - cascade * 0.01f };
+            }
+            lightShadow.numViews = NUM_SHADOW_CASCADES;
+            lightShadow.depthBias = 0.001f;
+            lightShadow.cascaded = 1;
+            break;
+
+        case ShadowType::None:
+            break;
+        }
+    }
+    gNumShadowViews = view;
+
+    gShadowAtlas.Allocate(requests, gNumShadowViews);
+
+    for (int i = 0; i < NUM_LIGHTS; ++i)
+    {
+        if (LightsShadowType[i] == ShadowType::Directional)  CalculateCascadeMatrices(i, gPerShadowConstants.lights[i].firstView);
+    }
+
+    // Tile positions are passed to the shaders as UVs in the atlas
+    float atlasScale = 1.0f / gShadowAtlas.AtlasSize();
+    for (unsigned int i = 0; i < gNumShadowViews; ++i)
+    {
+        const ShadowAtlasTile& tile = gShadowAtlas.Tile(i);
+        ShadowView& shadowView = gPerShadowConstants.views[i];
+        shadowView.viewProjectionMatrix = gShadowViewMatrices[i] * gShadowProjectionMatrices[i];
+        shadowView.atlasRect[0] = tile.x * atlasScale;
+        shadowView.atlasRect[1] = tile.y * atlasScale;
+        shadowView.atlasRect[2] = tile.size * atlasScale;
+        shadowView.atlasRect[3] = tile.size * atlasScale;
+    }
+    UpdateConstantBuffer(gPerShadowConstantBuffer, gPerShadowConstants);
+}
+
+// Clear the current viewport (a tile of the shadow atlas) to the far distance. ClearDepthStencilView would clear the
+// whole atlas, so a triangle covering the viewport is drawn instead (see ShadowClear_vs.hlsl)
+void ClearShadowTile()
 {
-    // Get camera-like matrices from the spotlight, seet in the constant buffer and send over to GPU
-    gPerFrameConstants.viewMatrix = CalculateLightViewMatrix(lightIndex);
-    gPerFrameConstants.projectionMatrix = CalculateLightProjectionMatrix(lightIndex);
-    gPerFrameConstants.viewProjectionMatrix = gPerFrameConstants.viewMatrix * gPerFrameConstants.projectionMatrix;
+    gStateCache.SetInputLayout(nullptr);
+    gStateCache.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    gStateCache.SetVertexShader(gShadowClearVertexShader);
+    gStateCache.SetPixelShader(nullptr);
+    gStateCache.SetDepthStencilState(gOverwriteDepthState);
+    gStateCache.SetRasterizerState(gCullNoneState);
+    gD3DContext->Draw(3, 0);
+}
+
+// Render the given models from a light's point of view into the current viewport. Only renders depth buffer
+void RenderShadowView(const CMatrix4x4& viewMatrix, const CMatrix4x4& projectionMatrix, Model* const* casters, unsigned int numCasters)
+{
+    // Set the light's camera-like matrices in the constant buffer and send over to GPU
+    gPerFrameConstants.viewMatrix = viewMatrix;
+    gPerFrameConstants.projectionMatrix = projectionMatrix;
+    gPerFrameConstants.viewProjectionMatrix = viewMatrix * projectionMatrix;
     UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+    gStateCache.SetVSConstantBuffer(0, gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
+    gStateCache.SetPSConstantBuffer(0, gPerFrameConstantBuffer);
 
 
     //// Only render models that cast shadows ////
 
-    // Use special depth-only rendering shaders
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gDepthOnlyPixelShader, nullptr, 0);
-
-    // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-    gD3DContext->RSSetState(gCullBackState);
-
-    // Render models - no state changes required between each object in this situation (no textures used in this step)
-    gGround->Render();
-    gTeapot->Render();
-    gAdditiveBlendingModel->Render();
-    gAlphaBlendingModel->Render();
-    gSphere->Render();
-    gLerpCube->Render();
-    gNormalMappingCube->Render();
-    gParallaxMappingCube->Render();
-    gTrollModel->Render();
-    gMultiplicativeBlendingModel->Render();
+    // Casters all use the depth-only material, so the queue only groups them by mesh, drawing those that share a mesh
+    // as one instanced draw. They have already been culled against the view. Sorted front to back from the light
+    CVector3 lightPosition = InverseAffine(viewMatrix).GetPosition();
+    gShadowQueue.Begin(lightPosition, gPerFrameConstants.viewProjectionMatrix, false);
+    for (unsigned int i = 0; i < numCasters; ++i)  gShadowQueue.Add(casters[i], &gDepthOnlyMaterial);
+    gShadowQueue.Submit();
+}
+
+// Render the shadow views that need it into their tiles of the shadow atlas. A tile keeps its contents from earlier
+// frames while it hasn't moved and nothing in its view has changed
+void RenderShadowAtlas()
+{
+    gShadowCuller.ResetStats();
+
+    bool atlasSelected = false;
+    for (unsigned int view = 0; view < gNumShadowViews; ++view)
+    {
+        const ShadowAtlasTile& tile = gShadowAtlas.Tile(view);
+        if (tile.size == 0)  continue; // No room in the atlas, the light has no shadows in this view this frame
+
+        // Models outside the view can't cast a shadow into it, so are skipped and don't cause it to be rendered again
+        // when they move (unless they move into the view)
+        const CMatrix4x4& viewProjection = gPerShadowConstants.views[view].viewProjectionMatrix;
+        gShadowCuller.Clear();
+        for (auto model : gShadowCasters)  gShadowCuller.Add(model->WorldBounds());
+        gShadowCuller.Cull(viewProjection);
+
+        Model* casters[NUM_SHADOW_CASTERS];
+        unsigned int numCasters = 0;
+        for (unsigned int i = 0; i < gShadowCuller.NumObjects(); ++i)
+        {
+            if (gShadowCuller.IsVisible(i))  casters[numCasters++] = gShadowCasters[i];
+        }
+
+        if (gShadowAtlas.TileChanged(view))  gShadowViewCaches[view].Invalidate();
+        if (!gShadowViewCaches[view].NeedsRender(viewProjection, casters, numCasters))  continue;
+
+        // Select the shadow atlas as the current depth buffer. We will not be rendering any pixel colours
+        if (!atlasSelected)
+        {
+            gD3DContext->OMSetRenderTargets(0, nullptr, gShadowAtlasDepthStencil);
+            atlasSelected = true;
+        }
+
+        // Setup the viewport to the view's tile, clear it then render the casters into it
+        D3D11_VIEWPORT vp;
+        vp.Width = static_cast<FLOAT>(tile.size);
+        vp.Height = static_cast<FLOAT>(tile.size);
+        vp.MinDepth = 0.0f;
+        vp.MaxDepth = 1.0f;
+        vp.TopLeftX = static_cast<FLOAT>(tile.x);
+        vp.TopLeftY = static_cast<FLOAT>(tile.y);
+        gD3DContext->RSSetViewports(1, &vp);
+
+        ClearShadowTile();
+        RenderShadowView(gShadowViewMatrices[view], gShadowProjectionMatrices[view], casters, numCasters);
+    }
 }
 
 // Render everything in the scene from the given camera
@@ -457,149 +966,156 @@ void RenderSceneFromCamera(Camera* camera)
     UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
-
-    ///////////////////////////////
-    //// Render skinned models ////
-    ///////////////////////////////
-
-    ///////////////////////////////////
-    //// Render non-skinned models ////
-    ///////////////////////////////////
-    
-    // Render lit models, only change textures for each onee
-    // States - no blending, normal depth buffer and culling
-    gGround->Setup(gPixelLightingVertexShader, gPixelLightingPixelShader);
-    gGround->SetStates(gNoBlendingState, gUseDepthBufferState, gCullBackState);
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
-    gGround->SetShaderResources(0, CGroundTexture->SRVMap);
-    gGround->Render();
-
-    gTeapot->SetShaderResources(0, CStoneTexture->SRVMap);
-    gTeapot->Render();
-
-    //-------------------//
-    // Additive Blending //
-    //-------------------//
-
-    gAdditiveBlendingModel->Setup(gBlendingPixelShader);
-    gAdditiveBlendingModel->SetStates(gAdditiveBlendingState, gDepthReadOnlyState, gCullBackState);
-    gAdditiveBlendingModel->SetShaderResources(0, CLightTexture->SRVMap);
-    gAdditiveBlendingModel->Render();
-
-    //----------------//
-    // Alpha Blending //
-    //----------------//
-
-    gAlphaBlendingModel->SetShaderResources(0, CMoogleTexture->SRVMap);
-    gAlphaBlendingModel->SetStates(gAlphaBlending, gUseDepthBufferState, gCullBackState);
-    gAlphaBlendingModel->Render();
-
-    //-------------------//
-    // Texture Scrolling //
-    //-------------------//
-
-    gSphere->Setup(gWigglingVertexShader, gTextureScrollingPixelShader);
-    gSphere->SetShaderResources(0, CSphereTexture->SRVMap);
-    gSphere->SetStates(gNoBlendingState, gUseDepthBufferState, gCullBackState);
-    gSphere->Render();
-
-    //----------------//
-    // Texture Fading //
-    //----------------//
-
-    gLerpCube->Setup(gPixelLightingVertexShader, gTextureFadingPixelShader);
-    gLerpCube->SetShaderResources(0,CBrickTexture->SRVMap , 2, CGroundTexture->SRVMap);
-    gLerpCube->SetStates(gNoBlendingState, gUseDepthBufferState, gCullBackState);
-    gLerpCube->Render();
-
-    //----------------//
-    // Normal Mapping //
-    //----------------//
-
-    gNormalMappingCube->Setup(gNormalMappingVertexShader, gNormalMappingPixelShader);
-    gNormalMappingCube->SetShaderResources(0, CPatternTexture->SRVMap,2, CPatternNormal->SRVMap);
-    gNormalMappingCube->Render();
-
-    gParallaxMappingCube->Setup(gParallaxMappingPixelShader);
-    gParallaxMappingCube->SetShaderResources(0, CWallTexture->SRVMap, 2, CWallNormalHeight->SRVMap);
-    gParallaxMappingCube->Render();
-
-    //-----------------------------------//
-    // Cell Shading - First Pass Through //
-    //-----------------------------------//
-
-    gTrollModel->Setup(gCellShadingOutlineVertexShader, gCellShadingOutlinePixelShader);
-    gTrollModel->SetStates(gNoBlendingState, gUseDepthBufferState, gCullFrontState);
-    gTrollModel->Render();
-
-    //------------------------------------//
-    // Cell Shading - Second Pass Through //
-    //------------------------------------//
-
-    gTrollModel->Setup(gPixelLightingVertexShader, gCellShadingPixelShader);
-    gTrollModel->SetStates(gNoBlendingState, gUseDepthBufferState, gCullBackState);
-    gTrollModel->SetShaderResources(0, CTrollTexture->SRVMap, 2, CCellMapTexture->SRVMap);
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
-    gD3DContext->PSSetSamplers(1, 1, &gPointSampler);
-    gTrollModel->Render();
-
-    //-------------------------//
-    // Multiplicative Blending //
-    //-------------------------//
-
-    gMultiplicativeBlendingModel->Setup(gPixelLightingVertexShader, gBlendingPixelShader);
-    gMultiplicativeBlendingModel->SetStates(gMultiplicativeBlend, gDepthReadOnlyState, gCullNoneState);
-    gMultiplicativeBlendingModel->SetShaderResources(0, CGlassTexture->SRVMap);
-    gMultiplicativeBlendingModel->Render();
-
-    //// Render lights ////
-
-    // Select which shaders to use next
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gLightModelPixelShader,      nullptr, 0);
-
-    // Select the texture and sampler to use in the pixel shader
-    gD3DContext->PSSetShaderResources(0, 1, &CLightTexture->SRVMap); // First parameter must match texture slot number in the shaer
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
-
-    // States - additive blending, read-only depth buffer and no culling (standard set-up for blending
-    gD3DContext->OMSetBlendState(gAdditiveBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-    gD3DContext->RSSetState(gCullNoneState);
-
-    // Render all the lights in the array
+    gStateCache.SetVSConstantBuffer(0, gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
+    gStateCache.SetPSConstantBuffer(0, gPerFrameConstantBuffer);
+
+    //// Render models ////
+
+    // Each model is added to the render queue with its material. The queue sorts them to minimise shader, state and
+    // texture changes (opaque front-to-back, blended back-to-front after everything else), then renders them
+    // The occluders must have finished drawing into the software depth buffer (started in RenderScene), so the queue can
+    // drop the models hidden behind them
+    const OcclusionBuffer* occlusion = nullptr;
+    if (gOcclusionCulling)
+    {
+        gThreadPool->Wait(gOcclusionJob);
+        occlusion = &gOcclusionBuffer;
+    }
+    gRenderQueue.Begin(camera->Position(), gPerFrameConstants.viewProjectionMatrix, true, occlusion);
+
+    gRenderQueue.Add(gTeapot, &gTeapotMaterial);
+    gRenderQueue.Add(gSphere, &gTextureScrollingMaterial);
+
+    // Models that never move are drawn from the static batch, one entry for each of its materials
+    if (gStaticBatching)
+    {
+        for (unsigned int group = 0; group < gStaticBatch.NumGroups(); ++group)  gRenderQueue.Add(&gStaticBatch, group);
+    }
+    else
+    {
+        gRenderQueue.Add(gGround, &gGroundMaterial);
+        gRenderQueue.Add(gLerpCube, &gTextureFadingMaterial);
+        gRenderQueue.Add(gNormalMappingCube, &gNormalMappingMaterial);
+        gRenderQueue.Add(gParallaxMappingCube, &gParallaxMappingMaterial);
+    }
+
+    // Cell shading - outline then the model itself
+    gRenderQueue.Add(gTrollModel, &gCellShadingOutlineMaterial);
+    gRenderQueue.Add(gTrollModel, &gCellShadingMaterial);
+
+    // Blending
+    gRenderQueue.Add(gAdditiveBlendingModel, &gAdditiveBlendingMaterial);
+    gRenderQueue.Add(gAlphaBlendingModel, &gAlphaBlendingMaterial);
+    gRenderQueue.Add(gMultiplicativeBlendingModel, &gMultiplicativeBlendingMaterial);
+
+    // Lights, in a second pass so they are drawn after everything else. They share a mesh and material so are drawn
+    // as one instanced draw, each tinted with its light's colour
     for (int i = 0; i < NUM_LIGHTS; ++i)
     {
-        gPerModelConstants.objectColour = gLights[i]->LightColour; // Set any per-model constants apart from the world matrix just before calling render (light colour here)
-        gLights[i]->RenderLight();
+        gLights[i]->LightModel->SetColour(gLights[i]->LightColour);
+        gRenderQueue.Add(gLights[i]->LightModel, &gLightModelMaterial, 1);
     }
+
+    gRenderQueue.Submit();
 }
 
+// Bin the point lights and spotlights into the clusters of the camera's view, then upload the lights and the cluster lists
+// for the pixel shaders. A light's shadows are at the same index as the light in the shadow constants
+void UpdateLightClusters()
+{
+    unsigned int numLights = 0;
+    for (int i = 0; i < NUM_LIGHTS; ++i)
+    {
+        if (LightsType[i] == LightType::Directional)  continue;
+
+        ClusterLight& light = gClusterLights[numLights++];
+        light.position = gLights[i]->LightModel->Position();
+        light.range = CalculateLightInfluence(i).radius;
+        light.colour = gLights[i]->LightColour * gLights[i]->LightStrength;
+        light.cosHalfAngle = -2.0f;
+        light.direction = { 0, 0, 1 };
+        light.shadow = (LightsShadowType[i] != ShadowType::None) ? i : -1;
+        if (LightsType[i] == LightType::Spot)
+        {
+            light.cosHalfAngle = cos(ToRadians(gSpotlightConeAngle / 4));
+            light.direction = Normalise(gLights[i]->LightModel->WorldMatrix().GetZAxis());
+        }
+    }
+    if (gShowFillLights)
+    {
+        unsigned int numFillLights = std::min(static_cast<unsigned int>(gFillLights.size()), gLightClusters.MaxLights() - numLights);
+        std::copy(gFillLights.begin(), gFillLights.begin() + numFillLights, gClusterLights.begin() + numLights);
+        numLights += numFillLights;
+    }
+
+    ClusterCamera camera;
+    camera.viewMatrix = gCamera->ViewMatrix();
+    camera.tanHalfFOVx = std::tan(gCamera->FOV() * 0.5f);
+    camera.tanHalfFOVy = camera.tanHalfFOVx / gCamera->AspectRatio();
+    camera.nearClip = gCamera->NearClip();
+    camera.farClip = gCamera->FarClip();
+    gLightClusters.Build(gClusterLights.data(), numLights, camera, gThreadPool);
+
+    // Only the part of each buffer in use is uploaded
+    const LightClusterStats& stats = gLightClusters.Stats();
+    UpdateStructuredBuffer(gClusterLightBuffer, gClusterLights.data(), stats.lights * sizeof(ClusterLight));
+    UpdateStructuredBuffer(gClusterRangeBuffer, gLightClusters.Clusters(), gLightClusters.NumClusters() * sizeof(ClusterRange));
+    UpdateStructuredBuffer(gClusterIndexBuffer, gLightClusters.LightIndices(), stats.lightIndices * sizeof(unsigned int));
+
+    // The pixel shaders find their cluster from their pixel position and depth
+    gPerFrameConstants.clusterTileScale[0] = gLightClusters.TilesX() / static_cast<float>(gViewportWidth);
+    gPerFrameConstants.clusterTileScale[1] = gLightClusters.TilesY() / static_cast<float>(gViewportHeight);
+    gPerFrameConstants.clusterDepthScale = gLightClusters.DepthScale();
+    gPerFrameConstants.clusterDepthBias  = gLightClusters.DepthBias();
+    gPerFrameConstants.clusterCounts[0] = gLightClusters.TilesX();
+    gPerFrameConstants.clusterCounts[1] = gLightClusters.TilesY();
+    gPerFrameConstants.clusterCounts[2] = gLightClusters.NumSlices();
+}
+
+
 // Rendering the scene
 void RenderScene()
 {
+    // Count constant buffer uploads from here, UpdateScene shows the total for the last frame in the window title
+    gConstantBufferBytes = 0;
+    gConstantBufferUpdates = 0;
+    gRenderQueue.ResetStats();
+    gShadowQueue.ResetStats();
+    gOcclusionBuffer.ResetStats();
+    gStateCache.ResetStats(); // The cached state itself carries over from the last frame, everything is set through it
+
+    // Models choose their level of detail from the main camera, the shadow passes use the same levels
+    float tanHalfFOVy = std::tan(gCamera->FOV() * 0.5f) / gCamera->AspectRatio();
+    gLodView.position      = gCamera->Position();
+    gLodView.pixelsPerUnit = gViewportHeight * 0.5f / tanHalfFOVy;
+    ++gLodView.frame;
+
+    // Start drawing the occluders for the camera pass. The occluders are added here, as reading the camera and models
+    // isn't safe while the shadow passes use them, then the job only reads the occluders' meshes and writes the buffer.
+    // Its ParallelFor calls spread the drawing over the workers
+    if (gOcclusionCulling)
+    {
+        gOcclusionBuffer.Begin(gCamera->ViewProjectionMatrix());
+        for (auto model : gOccluders)  model->AddOccluder(gOcclusionBuffer);
+        gThreadPool->Run([](void*) { gOcclusionBuffer.Render(gThreadPool); }, nullptr, &gOcclusionJob);
+    }
+
     //// Common settings ////
 
     // Set up the light information in the constant buffer
 
-    gPerFrameConstants.light1.Colour = gLights[0]->LightColour * gLights[0]->LightStrength;
-    gPerFrameConstants.light1.Position = gLights[0]->LightModel->Position();
-
-    gPerFrameConstants.light2.Colour = gLights[1]->LightColour * gLights[1]->LightStrength;
-    gPerFrameConstants.light2.Position = gLights[1]->LightModel->Position();
+    for (int i = 0; i < NUM_LIGHTS; ++i)
+    {
+        if (LightsType[i] != LightType::Directional)  continue;
 
-    gPerFrameConstants.light3.Colour = gLights[2]->LightColour * gLights[2]->LightStrength;
-    gPerFrameConstants.light3.Position = gLights[2]->LightModel->Position();
-    gPerFrameConstants.light3.Direction = Normalise(gLights[2]->LightModel->WorldMatrix().GetZAxis());
-    gPerFrameConstants.light3.CosHalfAngle = cos(ToRadians(gSpotlightConeAngle / 4));
-    gPerFrameConstants.light3.lightViewMatrix = CalculateLightViewMatrix(2);
-    gPerFrameConstants.light3.lightProjectionMatrix = CalculateLightProjectionMatrix(2);
+        gPerFrameConstants.directionalLight.Colour = gLights[i]->LightColour * gLights[i]->LightStrength;
+        gPerFrameConstants.directionalLight.Position = gLights[i]->LightModel->Position();
+        gPerFrameConstants.directionalLight.Direction = Normalise(-gLights[i]->LightModel->WorldMatrix().GetXAxis());
+        gPerFrameConstants.directionalLight.Shadow = (LightsShadowType[i] != ShadowType::None) ? i : -1;
+    }
 
-    gPerFrameConstants.light4.Colour = gLights[3]->LightColour * gLights[3]->LightStrength;
-    gPerFrameConstants.light4.Position = gLights[3]->LightModel->Position();
-    gPerFrameConstants.light4.Direction = Normalise(-gLights[3]->LightModel->WorldMatrix().GetXAxis());
+    // Point lights and spotlights
+    UpdateLightClusters();
 
     gPerFrameConstants.ambientColour  = gAmbientColour;
     gPerFrameConstants.specularPower  = gSpecularPower;
@@ -609,26 +1125,12 @@ void RenderScene()
     gPerFrameConstants.outlineColour = OutlineColour;
     gPerFrameConstants.outlineThickness = OutlineThickness;
 
-    gPerFrameConstants.DepthAdjust = 0.0005f;
 
+    //// Shadows ////
 
-    // Setup the viewport to the size of the shadow map texture
-    D3D11_VIEWPORT vp;
-    vp.Width = static_cast<FLOAT>(gShadowMapSize);
-    vp.Height = static_cast<FLOAT>(gShadowMapSize);
-    vp.MinDepth = 0.0f;
-    vp.MaxDepth = 1.0f;
-    vp.TopLeftX = 0;
-    vp.TopLeftY = 0;
-    gD3DContext->RSSetViewports(1, &vp);
-
-    // Select the shadow map texture as the current depth buffer. We will not be rendering any pixel colours
-    // Also clear the the shadow map depth buffer to the far distance
-    gD3DContext->OMSetRenderTargets(0, nullptr, gShadowMap1DepthStencil);
-    gD3DContext->ClearDepthStencilView(gShadowMap1DepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
-
-    // Render the scene from the point of view of light 1 (only depth values written)
-    RenderDepthBufferFromLight(2);
+    // Give each light's shadow views a tile in the atlas, then render the views whose shadows have changed
+    UpdateShadowViews();
+    RenderShadowAtlas();
 
     //// Main scene rendering ////
 
@@ -641,6 +1143,7 @@ void RenderScene()
     gD3DContext->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
     // Setup the viewport to the size of the main window
+    D3D11_VIEWPORT vp;
     vp.Width  = static_cast<FLOAT>(gViewportWidth);
     vp.Height = static_cast<FLOAT>(gViewportHeight);
     vp.MinDepth = 0.0f;
@@ -649,16 +1152,22 @@ void RenderScene()
     vp.TopLeftY = 0;
     gD3DContext->RSSetViewports(1, &vp);
 
-    gD3DContext->PSSetShaderResources(1, 1, &gShadowMap1SRV);
-    gD3DContext->PSSetSamplers(1, 1, &gPointSampler);
+    // Shadow maps for all lights are in the atlas, the tile for each is in the shadow constants
+    gStateCache.SetPSShaderResource(1, gShadowAtlasSRV);
+    gStateCache.SetPSSampler(1, gPointSampler);
+    gStateCache.SetPSConstantBuffer(3, gPerShadowConstantBuffer);
+
+    // Point lights and spotlights, and the lists of them for each cluster
+    gStateCache.SetPSShaderResource(3, gClusterLightSRV);
+    gStateCache.SetPSShaderResource(4, gClusterRangeSRV);
+    gStateCache.SetPSShaderResource(5, gClusterIndexSRV);
 
     // Render the scene from the main camera
     RenderSceneFromCamera(gCamera);
 
 
     // Unbind shadow maps from shaders - prevents warnings from DirectX when we try to render to the shadow maps again next frame
-    ID3D11ShaderResourceView* nullView = nullptr;
-    gD3DContext->PSSetShaderResources(1, 1, &nullView);
+    gStateCache.SetPSShaderResource(1, nullptr);
 
     //// Scene completion ////
 
@@ -667,6 +1176,136 @@ void RenderScene()
 }
 
 
+#ifdef ENABLE_BENCHMARKS
+//--------------------------------------------------------------------------------------
+// Benchmarks
+//--------------------------------------------------------------------------------------
+// Checks and measurements of the systems above, each run on the render thread when its key is pressed, with results
+// going to the debugger output window. They take up to several seconds and use the heap, so they are only built in
+// when ENABLE_BENCHMARKS is defined. The Debug configuration defines it, define it in Release for representative times
+
+namespace
+{
+    // Check the allocator used for the shared geometry buffers, then report the buffers' usage and compact them
+    std::string CompactGeometryArena()
+    {
+        std::string report = BenchmarkRangeAllocator(200000, 1 << 20);
+
+        GeometryArenaStats before = gGeometryArena.Stats();
+        try
+        {
+            std::size_t bytesCopied = gGeometryArena.Compact();
+            GeometryArenaStats after = gGeometryArena.Stats();
+            char line[256];
+            std::snprintf(line, sizeof(line), "Geometry arena: %u buffers, %u ranges, %.2f of %.2f MB used, fragmentation %.3f. "
+                          "Compacting copied %.2f MB, now %u buffers, fragmentation %.3f\n",
+                          before.pages, before.allocations, before.usedBytes / 1048576.0, before.capacityBytes / 1048576.0,
+                          before.fragmentation, bytesCopied / 1048576.0, after.pages, after.fragmentation);
+            report += line;
+        }
+        catch (const std::runtime_error& e)
+        {
+            // Pages that couldn't be compacted are left as they were, so rendering carries on
+            report += std::string(e.what()) + "\n";
+        }
+        return report;
+    }
+
+    struct Benchmark
+    {
+        KeyCode     key;
+        bool        shift;  // Run with shift + key rather than the key alone
+        std::string (*run)();
+    };
+
+    const Benchmark BENCHMARKS[] =
+    {
+        // Check and time the software occlusion buffer with walls of cubes hiding teapots
+        { Key_F1, false, [] { return BenchmarkOcclusion("Cube.x", "Teapot.x", 10000, gThreadPool); } },
+
+        // Report the triangles and simplification error of each level of detail of the dense meshes
+        { Key_F2, false, [] { return ReportLods({ "Troll.x", "Man.x", "Robot.x", "Hills.x" }); } },
+
+        // Report the vertex cache, overdraw and vertex fetch measurements of the characters' sub-meshes before and after
+        // the import reorders them
+        { Key_F3, false, [] { return ReportMeshOptimization({ "Troll.x", "Man.x", "Robot.x" }); } },
+
+        // Report the memory saved by packing vertices and indices and the round-trip errors, for the characters and for
+        // a mesh with tangents
+        { Key_F4, false, [] { return ReportVertexPacking({ "Troll.x", "Man.x", "Robot.x" }) + ReportVertexPacking({ "Cube.x" }, true); } },
+
+        // Check the geometry arena's allocator, then compact the arena
+        { Key_F5, false, CompactGeometryArena },
+
+        // Check the static batch merge against the models' own vertices and time it
+        { Key_F6, false, []
+          {
+              Mesh* meshes[] = { gCubeMesh.get(), gTeapotMesh.get(), gSphereMesh.get(), gGroundMesh.get() };
+              return BenchmarkStaticBatching(meshes, 4, 2000, gThreadPool);
+          } },
+
+        // Measure the draw calls saved by instancing for a crowd of models
+        { Key_F7, false, []
+          {
+              Mesh* meshes[] = { gCubeMesh.get(), gLightMesh.get(), gTeapotMesh.get() };
+              const RenderMaterial* materials[] = { &gDepthOnlyMaterial, &gLightModelMaterial };
+              return BenchmarkInstancing(meshes, 3, materials, 2, 10000);
+          } },
+
+        // Measure light cluster building for thousands of lights
+        { Key_F8, false, [] { return BenchmarkLightClusters(4096, gThreadPool); } },
+
+        // Measure CPU skinning speed on the animated characters
+        { Key_F9, false, [] { return BenchmarkSkinning({ "Man.x", "Woman.x", "Robot.x" }, gThreadPool); } },
+
+        // Measure animation sampling cost for a crowd of characters
+        { Key_F10, false, [] { return BenchmarkAnimation("Man.x", 1000, 600, gThreadPool); } },
+
+        // Measure bounds update and frustum culling cost for a large number of models
+        { Key_F11, false, [] { return BenchmarkCulling(gTeapotMesh.get(), 10000); } },
+
+        // Measure meshlet culling for crowds of the larger rigid meshes
+        { Key_F12, false, [] { return BenchmarkMeshletCulling({ "Hills.x", "Sphere.x", "Teapot.x", "CargoContainer.x" }, 1000); } },
+
+        // Measure job scheduling overhead and scaling with pools of different sizes
+        { Key_F1, true, [] { return BenchmarkJobs(); } },
+
+        // Time the matrix batch functions with each instruction set and check them against the scalar code
+        { Key_F3, true, [] { return BenchmarkMatrices(); } },
+
+        // Count the constant buffer bytes uploaded for one rigid and one skinned mesh, and what the same draws would
+        // upload with the bone matrices in the per-model constants
+        { Key_F4, true, []
+          {
+              Mesh* meshes[] = { gTeapotMesh.get(), gTrollMesh.get() };
+              const char* names[] = { "Teapot.x", "Troll.x" };
+              return ReportConstantUploads(meshes, names, 2);
+          } },
+
+        // Compare loading every bundled mesh with assimp and from its cooked file
+        { Key_F2, true, []
+          {
+              return BenchmarkMeshLoading({ "Bike.x", "CargoContainer.x", "Cube.x", "Decal.x", "Ground.x", "Hills.x", "Light.x",
+                                            "Man.x", "Portal.x", "Robot.x", "Sphere.x", "Teapot.x", "Troll.x", "Woman.x" });
+          } },
+    };
+}
+
+// Run the benchmark for any key pressed this frame
+void RunBenchmarks()
+{
+    bool shift = KeyHeld(Key_Shift);
+    for (auto& benchmark : BENCHMARKS)
+    {
+        if (benchmark.shift != shift || !KeyHit(benchmark.key))  continue;
+
+        AllowFrameHeapAllocations();
+        OutputDebugStringA(benchmark.run().c_str());
+    }
+}
+#endif // ENABLE_BENCHMARKS
+
+
 //--------------------------------------------------------------------------------------
 // Scene Update
 //--------------------------------------------------------------------------------------
@@ -683,6 +1322,34 @@ void UpdateScene(float frameTime)
     //gLights[0].model->SetPosition( gCrate->Position() + CVector3{ cos(rotate) * gLightOrbit, 10, sin(rotate) * gLightOrbit } );
     if (go)  rotate -= gLightOrbitSpeed * frameTime;
     if (KeyHit(Key_1))  go = !go;
+    if (KeyHit(Key_2))  gShowFillLights = !gShowFillLights;
+
+    // Key 3 switches instancing on and off to compare the draw calls and frame time
+    if (KeyHit(Key_3))
+    {
+        gRenderQueue.SetInstancing(!gRenderQueue.Instancing());
+        gShadowQueue.SetInstancing(gRenderQueue.Instancing());
+    }
+
+    // Key 4 switches static batching on and off
+    if (KeyHit(Key_4))  gStaticBatching = !gStaticBatching;
+
+    // Key 5 switches levels of detail on and off (everything at full detail) to compare the triangles drawn
+    if (KeyHit(Key_5))  gLodView.maxPixelError = (gLodView.maxPixelError > 0) ? 0 : LOD_PIXEL_ERROR;
+
+    // Key 6 switches meshlet culling on and off to compare the triangles drawn
+    if (KeyHit(Key_6))  gRenderQueue.SetMeshletCulling(!gRenderQueue.MeshletCulling());
+
+    // Key 7 switches occlusion culling on and off to compare the models drawn and the frame time
+    if (KeyHit(Key_7))  gOcclusionCulling = !gOcclusionCulling;
+
+    // Static models shouldn't move, but if one does its part of the batch is rebuilt (which uses the heap)
+    if (gStaticBatch.Update(gThreadPool) > 0)  AllowFrameHeapAllocations();
+
+#ifdef ENABLE_BENCHMARKS
+    // Function keys run the checks and measurements in the benchmark table above
+    RunBenchmarks();
+#endif
 
     //Performs a sin and cos calculation and clamps the value between -1 and 1
     float sinBlueColour = sin(((rotate + 3) * PI) + 1);
@@ -700,23 +1367,54 @@ void UpdateScene(float frameTime)
     gTeapot->Control(NULL, frameTime, Key_I, Key_K, Key_J, Key_L, Key_U, Key_O, Key_Period, Key_Comma);
     gLights[2]->LightModel->Control(NULL, frameTime, Key_T, Key_G, Key_F, Key_H, Key_R, Key_Y, Key_B, Key_N);
 
+    // Animated models: the troll, when its mesh has a clip
+    gTrollModel->UpdateAnimation(frameTime);
+
     // Show frame time / FPS in the window title //
     const float fpsUpdateTime = 0.5f; // How long between updates (in seconds)
     static float totalFrameTime = 0;
     static int frameCount = 0;
+    static std::size_t totalConstantBufferBytes = 0;
     totalFrameTime += frameTime;
     ++frameCount;
+    totalConstantBufferBytes += gConstantBufferBytes; // Uploaded by the last RenderScene
     if (totalFrameTime > fpsUpdateTime)
     {
         // Displays FPS rounded to nearest int, and frame time (more useful for developers) in milliseconds to 2 decimal places
+        // Formatted into a fixed buffer rather than strings so the frame doesn't use the heap (see HeapAllocationCheck.h)
         float avgFrameTime = totalFrameTime / frameCount;
-        std::ostringstream frameTimeMs;
-        frameTimeMs.precision(2);
-        frameTimeMs << std::fixed << avgFrameTime * 1000;
-        std::string windowTitle = "CO2409 Week 22: Skinning - Frame Time: " + frameTimeMs.str() +
-                                  "ms, FPS: " + std::to_string(static_cast<int>(1 / avgFrameTime + 0.5f)) + " FFFFF " + std::to_string(static_cast<float>(gLights[1]->LightStrength));
-        SetWindowTextA(gHWnd, windowTitle.c_str());
+        char windowTitle[768];
+        const RenderQueueStats& stats = gRenderQueue.Stats(); // Last frame only
+        const RenderQueueStats& shadowQueueStats = gShadowQueue.Stats(); // All shadow views rendered, last frame only
+        const StateCacheStats& stateStats = gStateCache.Stats();
+        const CullingStats& shadowStats = gShadowCuller.Stats(); // All shadow views, last frame only
+        const OcclusionStats& occlusionStats = gOcclusionBuffer.Stats(); // Last frame only
+        const LightClusterStats& clusterStats = gLightClusters.Stats(); // Last frame only
+        ShadowMapCacheStats shadowViewStats; // Since the last title update
+        for (auto& cache : gShadowViewCaches)
+        {
+            shadowViewStats.rendered += cache.Stats().rendered;
+            shadowViewStats.skipped  += cache.Stats().skipped;
+            cache.ResetStats();
+        }
+        std::snprintf(windowTitle, sizeof(windowTitle), "CO2409 Week 22: Skinning - Frame Time: %.2fms, FPS: %d, Constants: %.1fKB/frame, "
+                      "Binds: %u (%u skipped), State: %u/%u calls sent, Drawn: camera %u (%u culled) shadow %u (%u culled), "
+                      "Draw calls: camera %u shadow %u (%u models instanced%s, %u static batched%s), Triangles: camera %u shadow %u (LOD%s), Meshlets: %u (%u culled%s), Occluded: %u (%u occluder triangles in %.2fms%s), Shadow views: %u rendered %u skipped (atlas %.0f%% used), Lights: %u in %u clusters (%u entries) FFFFF %f",
+                      avgFrameTime * 1000, static_cast<int>(1 / avgFrameTime + 0.5f),
+                      totalConstantBufferBytes / 1024.0f / frameCount, stats.bindsIssued, stats.bindsSkipped,
+                      stateStats.forwarded, stateStats.calls, stats.draws, stats.culled,
+                      shadowStats.tested - shadowStats.culled, shadowStats.culled,
+                      stats.drawCalls, shadowQueueStats.drawCalls, stats.instanced + shadowQueueStats.instanced,
+                      gRenderQueue.Instancing() ? "" : ", off", stats.batched, gStaticBatching ? "" : ", off",
+                      stats.triangles, shadowQueueStats.triangles, (gLodView.maxPixelError > 0) ? "" : " off",
+                      stats.meshlets, stats.meshletsCulled, gRenderQueue.MeshletCulling() ? "" : ", off",
+                      stats.occluded, occlusionStats.rasterized, occlusionStats.renderTime, gOcclusionCulling ? "" : ", off",
+                      shadowViewStats.rendered, shadowViewStats.skipped, gShadowAtlas.Usage() * 100,
+                      clusterStats.lights, clusterStats.litClusters, clusterStats.lightIndices,
+                      static_cast<float>(gLights[1]->LightStrength));
+        SetWindowTextA(gHWnd, windowTitle);
         totalFrameTime = 0;
         frameCount = 0;
+        totalConstantBufferBytes = 0;
     }
 }
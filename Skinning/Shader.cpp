@@ -22,6 +22,7 @@ ID3D11VertexShader* gWigglingVertexShader        = nullptr;
 ID3D11PixelShader*  gTextureScrollingPixelShader = nullptr;
 ID3D11PixelShader*  gPixelLightingPixelShader    = nullptr;
 ID3D11VertexShader* gBasicTransformVertexShader  = nullptr;
+ID3D11VertexShader* gBasicTransformInstancedVertexShader = nullptr;
 ID3D11VertexShader* gSkinningVertexShader        = nullptr; 
 ID3D11PixelShader*  gLightModelPixelShader       = nullptr;
 ID3D11VertexShader* gNormalMappingVertexShader   = nullptr;
@@ -32,6 +33,7 @@ ID3D11PixelShader* gCellShadingOutlinePixelShader = nullptr;
 ID3D11PixelShader* gCellShadingPixelShader = nullptr;
 ID3D11VertexShader* gCellShadingOutlineVertexShader = nullptr;
 ID3D11PixelShader* gDepthOnlyPixelShader = nullptr;
+ID3D11VertexShader* gShadowClearVertexShader = nullptr;
 
 
 //--------------------------------------------------------------------------------------
@@ -51,6 +53,7 @@ bool LoadShaders()
     gTextureScrollingPixelShader  = LoadPixelShader ("TextureScrolling_ps");
     gPixelLightingPixelShader     = LoadPixelShader ("PixelLighting_ps");
     gBasicTransformVertexShader   = LoadVertexShader("BasicTransform_vs");
+    gBasicTransformInstancedVertexShader = LoadVertexShader("BasicTransformInstanced_vs");
     gSkinningVertexShader         = LoadVertexShader("Skinning_vs");
     gLightModelPixelShader        = LoadPixelShader ("LightModel_ps");
     gNormalMappingVertexShader    = LoadVertexShader("NormalMapping_vs");
@@ -60,13 +63,14 @@ bool LoadShaders()
     gCellShadingOutlineVertexShader = LoadVertexShader("CellShadingOutline_vs");
     gCellShadingPixelShader         = LoadPixelShader("CellShading_ps");
     gDepthOnlyPixelShader = LoadPixelShader("DepthOnly_ps");
+    gShadowClearVertexShader = LoadVertexShader("ShadowClear_vs");
 
     if (gPixelLightingVertexShader  == nullptr || gPixelLightingPixelShader     == nullptr || gBlendingPixelShader       == nullptr ||
         gBasicTransformVertexShader == nullptr || gSkinningVertexShader         == nullptr || gLightModelPixelShader     == nullptr ||
         gWigglingVertexShader       == nullptr || gTextureScrollingPixelShader  == nullptr || gTextureFadingPixelShader  == nullptr ||
         gNormalMappingVertexShader  == nullptr || gNormalMappingPixelShader     == nullptr || gParallaxMappingPixelShader == nullptr ||
         gCellShadingOutlinePixelShader == nullptr || gCellShadingOutlineVertexShader == nullptr || gCellShadingPixelShader == nullptr ||
-        gDepthOnlyPixelShader == nullptr)
+        gDepthOnlyPixelShader == nullptr || gShadowClearVertexShader == nullptr || gBasicTransformInstancedVertexShader == nullptr)
     {
         gLastError = "Error loading shaders";
         return false;
@@ -94,6 +98,8 @@ void ReleaseShaders()
     if (gCellShadingOutlineVertexShader) gCellShadingOutlineVertexShader->Release();
     if (gCellShadingPixelShader) gCellShadingPixelShader->Release();
     if (gDepthOnlyPixelShader) gDepthOnlyPixelShader->Release();
+    if (gShadowClearVertexShader) gShadowClearVertexShader->Release();
+    if (gBasicTransformInstancedVertexShader) gBasicTransformInstancedVertexShader->Release();
 }
 
 // Load a vertex shader, include the file in the project and pass the name (without the .hlsl extension)
@@ -180,6 +186,9 @@ ID3DBlob* CreateSignatureForVertexLayout(const D3D11_INPUT_ELEMENT_DESC vertexLa
         else if (format == DXGI_FORMAT_R32G32_FLOAT)       shaderSource += "float2";
         else if (format == DXGI_FORMAT_R32_FLOAT)          shaderSource += "float";
         else if (format == DXGI_FORMAT_R8G8B8A8_UINT)      shaderSource += "uint4";
+        else if (format == DXGI_FORMAT_R16G16_SNORM)       shaderSource += "float2"; // Normalised and half float formats
+        else if (format == DXGI_FORMAT_R16G16_FLOAT)       shaderSource += "float2"; // arrive in the shader as floats
+        else if (format == DXGI_FORMAT_R8G8B8A8_UNORM)     shaderSource += "float4";
         else return nullptr; // Unsupported type in layout
 
         uint8_t index = static_cast<uint8_t>(vertexLayout[elt].SemanticIndex);
@@ -238,3 +247,55 @@ ID3D11Buffer* CreateConstantBuffer(int size)
 }
 
 
+// Create and return a structured buffer holding up to numElements structures of elementSize bytes, and a view of it
+// for the shaders. The returned buffer and view need to be released before quitting. Returns nullptr on failure
+ID3D11Buffer* CreateStructuredBuffer(int elementSize, int numElements, ID3D11ShaderResourceView** srv)
+{
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bufferDesc.ByteWidth = elementSize * numElements;
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;             // Rewritten by the CPU every frame
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bufferDesc.StructureByteStride = elementSize;
+    ID3D11Buffer* structuredBuffer;
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &structuredBuffer)))
+    {
+        return nullptr;
+    }
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format, the shader declares the structure
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    srvDesc.Buffer.NumElements = numElements;
+    if (FAILED(gD3DDevice->CreateShaderResourceView(structuredBuffer, &srvDesc, srv)))
+    {
+        structuredBuffer->Release();
+        return nullptr;
+    }
+
+    return structuredBuffer;
+}
+
+
+// Create and return a vertex buffer for per-instance data, holding up to maxInstances structures of instanceSize bytes
+// The returned pointer needs to be released before quitting. Returns nullptr on failure
+ID3D11Buffer* CreateInstanceBuffer(int instanceSize, int maxInstances)
+{
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;    // Read by the input assembler alongside the mesh's vertices
+    bufferDesc.ByteWidth = instanceSize * maxInstances;
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;             // Rewritten by the CPU for every instanced draw
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = 0;
+    bufferDesc.StructureByteStride = 0;
+    ID3D11Buffer* instanceBuffer;
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &instanceBuffer)))
+    {
+        return nullptr;
+    }
+    return instanceBuffer;
+}
+
+
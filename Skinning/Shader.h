@@ -22,6 +22,7 @@ extern ID3D11VertexShader* gWigglingVertexShader;
 extern ID3D11PixelShader* gTextureScrollingPixelShader;
 extern ID3D11PixelShader*  gPixelLightingPixelShader;
 extern ID3D11VertexShader* gBasicTransformVertexShader;
+extern ID3D11VertexShader* gBasicTransformInstancedVertexShader; // Instanced version of the above, see Mesh::RenderInstanced
 extern ID3D11VertexShader* gSkinningVertexShader; // Skinning is performed in the vertex shader (matrix work), we can use any pixel shader for lighting etc.
 extern ID3D11PixelShader*  gLightModelPixelShader;
 extern ID3D11PixelShader* gNormalMappingPixelShader;
@@ -31,6 +32,7 @@ extern ID3D11PixelShader* gCellShadingOutlinePixelShader;
 extern ID3D11VertexShader* gCellShadingOutlineVertexShader;
 extern ID3D11PixelShader* gCellShadingPixelShader;
 extern ID3D11PixelShader* gDepthOnlyPixelShader;
+extern ID3D11VertexShader* gShadowClearVertexShader; // Clears a tile of the shadow atlas, see ShadowClear_vs.hlsl
 
 
 //--------------------------------------------------------------------------------------
@@ -52,6 +54,17 @@ void ReleaseShaders();
 // The returned pointer needs to be released before quitting. Returns nullptr on failure
 ID3D11Buffer* CreateConstantBuffer(int size);
 
+// Create and return a structured buffer holding up to numElements structures of elementSize bytes, for arrays that are
+// too large for a constant buffer (e.g. the lights for clustered lighting). Shaders read it through the view returned
+// in *srv. Updated by the CPU like a constant buffer (see UpdateStructuredBuffer in GraphicsHelpers.h)
+// The returned buffer and view need to be released before quitting. Returns nullptr on failure
+ID3D11Buffer* CreateStructuredBuffer(int elementSize, int numElements, ID3D11ShaderResourceView** srv);
+
+// Create and return a vertex buffer for per-instance data, holding up to maxInstances structures of instanceSize bytes
+// (see Mesh::RenderInstanced). Updated by the CPU for each instanced draw (see UpdateInstanceBuffer in GraphicsHelpers.h)
+// The returned pointer needs to be released before quitting. Returns nullptr on failure
+ID3D11Buffer* CreateInstanceBuffer(int instanceSize, int maxInstances);
+
 
 //--------------------------------------------------------------------------------------
 // Helper functions
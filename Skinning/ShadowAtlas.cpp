@@ -0,0 +1,265 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas - packs the shadow maps of all lights into one large depth texture
+//--------------------------------------------------------------------------------------
+
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// The atlas is atlasSize texels square and tiles are no smaller than minTileSize (both powers of two). Space is
+// reserved for the given number of views, so the atlas doesn't use the heap each frame
+ShadowAtlas::ShadowAtlas(unsigned int atlasSize /*= 4096*/, unsigned int minTileSize /*= 128*/, unsigned int maxViews /*= 16*/)
+    : mAtlasSize(atlasSize), mMinTileSize(std::min(minTileSize, atlasSize))
+{
+    mNumLevels = Level(mMinTileSize) + 1;
+
+    // Level n can hold at most 4^n blocks
+    mFreeBlocks.resize(mNumLevels);
+    for (unsigned int level = 0; level < mNumLevels; ++level)  mFreeBlocks[level].reserve(std::size_t(1) << (2 * level));
+
+    mTiles.resize(maxViews);
+    mRequested.resize(maxViews);
+    mChanged.resize(maxViews);
+    mOrder.reserve(maxViews);
+    Reset();
+}
+
+
+// Forget all tiles, every view will get a new tile in the next Allocate (e.g. if the atlas texture is recreated)
+void ShadowAtlas::Reset()
+{
+    for (auto& blocks : mFreeBlocks)  blocks.clear();
+    mFreeBlocks[0].push_back({ 0, 0 });
+
+    std::fill(mTiles.begin(), mTiles.end(), ShadowAtlasTile());
+    std::fill(mRequested.begin(), mRequested.end(), 0);
+    std::fill(mChanged.begin(), mChanged.end(), 0);
+}
+
+
+// Assign tiles to views for this frame, requests[i] is for view i. A view keeps its tile from the last frame if
+// it asks for the same size again. New tiles go to the most important views first, if there isn't room a view
+// gets a smaller tile than it asked for, or none. If that happens the whole atlas is packed again, in case tiles
+// kept from earlier frames were in the way
+void ShadowAtlas::Allocate(const ShadowAtlasRequest* requests, unsigned int numViews)
+{
+    if (numViews > mTiles.size())
+    {
+        mTiles.resize(numViews);
+        mRequested.resize(numViews);
+        mChanged.resize(numViews);
+    }
+    std::fill(mChanged.begin(), mChanged.end(), 0);
+
+    // Free the tiles of views that want a different size (or no tile) this frame, these views are then given new
+    // tiles below. Views that asked for the same size keep the tile they have, even if it is smaller than they wanted
+    bool tilesFreed = false;
+    mOrder.clear();
+    for (unsigned int view = 0; view < mTiles.size(); ++view)
+    {
+        unsigned int size = (view < numViews) ? requests[view].size : 0;
+        if (size != 0)  size = std::max(std::min(size, mAtlasSize), mMinTileSize);
+        if (size == mRequested[view])  continue;
+
+        ShadowAtlasTile& tile = mTiles[view];
+        if (tile.size != 0)
+        {
+            FreeBlock(Level(tile.size), { tile.x, tile.y });
+            tile = ShadowAtlasTile();
+            tilesFreed = true;
+        }
+        mRequested[view] = size;
+        if (size != 0)  mOrder.push_back(view);
+    }
+
+    // Most important views first, then the largest (which also packs better)
+    auto moreImportant = [&](unsigned int a, unsigned int b)
+    {
+        if (requests[a].importance != requests[b].importance)  return requests[a].importance > requests[b].importance;
+        if (mRequested[a] != mRequested[b])  return mRequested[a] > mRequested[b];
+        return a < b;
+    };
+    std::sort(mOrder.begin(), mOrder.end(), moreImportant);
+
+    bool shortfall = false;
+    for (auto view : mOrder)
+    {
+        if (!AllocateTile(view, mRequested[view]))  shortfall = true;
+    }
+
+    // Views that were refused a tile on an earlier frame try again if space has been freed. They don't cause the
+    // repack below if there is still no room, or the atlas would be packed again every frame
+    if (tilesFreed && !shortfall)
+    {
+        mOrder.clear();
+        for (unsigned int view = 0; view < numViews; ++view)
+        {
+            if (mRequested[view] != 0 && mTiles[view].size == 0 && !mChanged[view])  mOrder.push_back(view);
+        }
+        std::sort(mOrder.begin(), mOrder.end(), moreImportant);
+        for (auto view : mOrder)  AllocateTile(view, mRequested[view]);
+    }
+
+    // Some view got less than it asked for. Tiles kept from earlier frames may be what is in the way, so pack every
+    // view again into an empty atlas in order of importance. Only the views whose tiles move need rendering again
+    if (shortfall)
+    {
+        ++mStats.repacks;
+
+        for (auto& blocks : mFreeBlocks)  blocks.clear();
+        mFreeBlocks[0].push_back({ 0, 0 });
+
+        mOrder.clear();
+        for (unsigned int view = 0; view < numViews; ++view)
+        {
+            if (mRequested[view] != 0)  mOrder.push_back(view);
+        }
+        std::sort(mOrder.begin(), mOrder.end(), moreImportant);
+
+        for (auto view : mOrder)
+        {
+            ShadowAtlasTile oldTile = mTiles[view];
+            bool wasChanged = mChanged[view] != 0; // Tiles given out above must be rendered whatever happens here
+            AllocateTile(view, mRequested[view]);
+            const ShadowAtlasTile& tile = mTiles[view];
+            mChanged[view] = tile.size != 0 &&
+                             (wasChanged || tile.x != oldTile.x || tile.y != oldTile.y || tile.size != oldTile.size);
+        }
+    }
+
+    for (auto changed : mChanged)  mStats.allocated += changed;
+}
+
+
+// Fraction of the atlas area covered by tiles (0 to 1)
+float ShadowAtlas::Usage() const
+{
+    float area = 0;
+    for (auto& tile : mTiles)  area += static_cast<float>(tile.size) * tile.size;
+    return area / (static_cast<float>(mAtlasSize) * mAtlasSize);
+}
+
+
+// Level in the quadtree of a tile size, level 0 is the whole atlas
+unsigned int ShadowAtlas::Level(unsigned int size) const
+{
+    unsigned int level = 0;
+    while ((mAtlasSize >> level) > size)  ++level;
+    return level;
+}
+
+
+// Take a free block at a level, splitting a larger one if needed. Returns false if the atlas is full
+bool ShadowAtlas::AllocateBlock(unsigned int level, Block* block)
+{
+    auto& freeBlocks = mFreeBlocks[level];
+    if (!freeBlocks.empty())
+    {
+        *block = freeBlocks.back();
+        freeBlocks.pop_back();
+        return true;
+    }
+
+    // Split a block from the level above into four, use the top-left one and keep the other three free
+    Block parent;
+    if (level == 0 || !AllocateBlock(level - 1, &parent))  return false;
+
+    unsigned int size = mAtlasSize >> level;
+    freeBlocks.push_back({ parent.x + size, parent.y + size });
+    freeBlocks.push_back({ parent.x,        parent.y + size });
+    freeBlocks.push_back({ parent.x + size, parent.y        });
+    *block = parent;
+    return true;
+}
+
+
+// Return a block to the free lists, merging it with its three neighbours if they are all free
+void ShadowAtlas::FreeBlock(unsigned int level, Block block)
+{
+    auto& freeBlocks = mFreeBlocks[level];
+    if (level > 0)
+    {
+        // Find the other three quarters of the parent block in the free list
+        unsigned int size = mAtlasSize >> level;
+        unsigned int parentX = block.x - block.x % (size * 2);
+        unsigned int parentY = block.y - block.y % (size * 2);
+
+        unsigned int neighbours[3];
+        unsigned int numNeighbours = 0;
+        for (unsigned int i = 0; i < freeBlocks.size() && numNeighbours < 3; ++i)
+        {
+            const Block& other = freeBlocks[i];
+            if (other.x - other.x % (size * 2) == parentX && other.y - other.y % (size * 2) == parentY)
+            {
+                neighbours[numNeighbours++] = i;
+            }
+        }
+
+        if (numNeighbours == 3)
+        {
+            // Remove the neighbours (highest index first so the others don't move) and free the parent instead
+            for (int i = 2; i >= 0; --i)
+            {
+                freeBlocks[neighbours[i]] = freeBlocks.back();
+                freeBlocks.pop_back();
+            }
+            FreeBlock(level - 1, { parentX, parentY });
+            return;
+        }
+    }
+    freeBlocks.push_back(block);
+}
+
+
+// Try to give a view a tile of the size it asked for, then of smaller sizes. Returns false if it got less than it asked for
+bool ShadowAtlas::AllocateTile(unsigned int view, unsigned int size)
+{
+    for (unsigned int tileSize = size; tileSize >= mMinTileSize; tileSize /= 2)
+    {
+        Block block;
+        if (AllocateBlock(Level(tileSize), &block))
+        {
+            mTiles[view] = { block.x, block.y, tileSize };
+            mChanged[view] = 1;
+            return tileSize == size;
+        }
+    }
+    mTiles[view] = ShadowAtlasTile();
+    return false;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Tile size heuristic
+//--------------------------------------------------------------------------------------
+
+// How important a light's shadows are: roughly the fraction of the screen height covered by the sphere the light can
+// affect, seen from the camera (0 to 1). tanHalfFOVy is the tangent of half the camera's vertical field of view.
+// Returns 1 if the camera is inside the sphere
+float ShadowImportance(const BoundingSphere& influence, const CVector3& cameraPosition, float tanHalfFOVy)
+{
+    if (influence.IsEmpty() || influence.radius == 0)  return 0;
+
+    float distance = Length(influence.centre - cameraPosition);
+    if (distance <= influence.radius)  return 1;
+
+    // The sphere's silhouette has an angular radius with tangent r / sqrt(d^2 - r^2). Comparing that with the tangent
+    // of half the field of view gives the fraction of the screen height covered by the sphere's diameter
+    float tanAngularRadius = influence.radius / std::sqrt(distance * distance - influence.radius * influence.radius);
+    return std::min(tanAngularRadius / tanHalfFOVy, 1.0f);
+}
+
+
+// Tile size for a view of the given importance: maxTileSize scaled by the importance and rounded up to a power of two,
+// no smaller than minTileSize. Returns 0 if the importance is 0 (the light can't be seen)
+unsigned int ShadowTileSize(float importance, unsigned int maxTileSize, unsigned int minTileSize)
+{
+    if (importance <= 0)  return 0;
+
+    float wantedSize = importance * maxTileSize;
+    unsigned int size = minTileSize;
+    while (size < wantedSize && size < maxTileSize)  size *= 2;
+    return size;
+}
@@ -0,0 +1,122 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas - packs the shadow maps of all lights into one large depth texture
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Each shadow "view" (a spotlight, a directional light or one cube face of a point light) gets
+// a square tile of the atlas. Tiles are powers of two in size and are handed out by splitting
+// the atlas into quarters, then quarters of those and so on (a quadtree / buddy allocator), so
+// tiles never overlap and freed tiles merge back into larger ones.
+// Tile sizes come from how much of the screen a light can affect (see ShadowImportance). Views
+// keep their tile from frame to frame while the size they want is unchanged, so their shadow
+// map contents can be reused (see ShadowMapCache). If the atlas is full the least important
+// views get smaller tiles, or none at all.
+// There is no Direct3D code here, the scene creates the texture and renders into the tiles.
+
+#ifndef _SHADOW_ATLAS_H_INCLUDED_
+#define _SHADOW_ATLAS_H_INCLUDED_
+
+#include "CVector3.h"
+#include "BoundingVolumes.h"
+
+#include <vector>
+
+
+// A square region of the atlas, in texels from the top-left. A size of 0 means no tile
+struct ShadowAtlasTile
+{
+    unsigned int x    = 0;
+    unsigned int y    = 0;
+    unsigned int size = 0;
+};
+
+// What one view wants from the atlas this frame. A size of 0 means the view is not needed
+struct ShadowAtlasRequest
+{
+    unsigned int size       = 0; // Power of two, from ShadowTileSize
+    float        importance = 0; // From ShadowImportance, more important views get their tiles first
+};
+
+// Tile counts since the last ResetStats
+struct ShadowAtlasStats
+{
+    unsigned int allocated = 0; // Tiles that were new or moved, their views must be re-rendered
+    unsigned int repacks   = 0; // Times the whole atlas was packed again from scratch
+};
+
+
+class ShadowAtlas
+{
+public:
+    // The atlas is atlasSize texels square and tiles are no smaller than minTileSize (both powers of two). Space is
+    // reserved for the given number of views, so the atlas doesn't use the heap each frame
+    ShadowAtlas(unsigned int atlasSize = 4096, unsigned int minTileSize = 128, unsigned int maxViews = 16);
+
+    // Assign tiles to views for this frame, requests[i] is for view i. A view keeps its tile from the last frame if
+    // it asks for the same size again. New tiles go to the most important views first, if there isn't room a view
+    // gets a smaller tile than it asked for, or none. If that happens the whole atlas is packed again, in case tiles
+    // kept from earlier frames were in the way
+    void Allocate(const ShadowAtlasRequest* requests, unsigned int numViews);
+
+    // Tile for a view after the last Allocate, size 0 if it has none
+    const ShadowAtlasTile& Tile(unsigned int view) const  { return mTiles[view]; }
+
+    // True if the view's tile is new or has moved in the last Allocate - its contents must be rendered again
+    bool TileChanged(unsigned int view) const  { return mChanged[view] != 0; }
+
+    // Forget all tiles, every view will get a new tile in the next Allocate (e.g. if the atlas texture is recreated)
+    void Reset();
+
+    unsigned int AtlasSize() const  { return mAtlasSize; }
+
+    // Fraction of the atlas area covered by tiles (0 to 1)
+    float Usage() const;
+
+
+    // Tile counts, accumulated over calls to Allocate until reset
+    const ShadowAtlasStats& Stats() const  { return mStats; }
+    void ResetStats()  { mStats = ShadowAtlasStats(); }
+
+
+private:
+    struct Block
+    {
+        unsigned int x, y;
+    };
+
+    // Level in the quadtree of a tile size, level 0 is the whole atlas
+    unsigned int Level(unsigned int size) const;
+
+    // Take a free block at a level, splitting a larger one if needed. Returns false if the atlas is full
+    bool AllocateBlock(unsigned int level, Block* block);
+
+    // Return a block to the free lists, merging it with its three neighbours if they are all free
+    void FreeBlock(unsigned int level, Block block);
+
+    // Try to give a view a tile of the size it asked for, then of smaller sizes. Returns false if it got less than it asked for
+    bool AllocateTile(unsigned int view, unsigned int size);
+
+    unsigned int mAtlasSize;
+    unsigned int mMinTileSize;
+    unsigned int mNumLevels;
+
+    std::vector<std::vector<Block>> mFreeBlocks; // Free blocks at each level
+    std::vector<ShadowAtlasTile>    mTiles;      // Current tile of each view
+    std::vector<unsigned int>       mRequested;  // Size each view asked for in the last Allocate (it may have got less)
+    std::vector<unsigned char>      mChanged;
+    std::vector<unsigned int>       mOrder;      // Views sorted by importance, reused each frame
+
+    ShadowAtlasStats mStats;
+};
+
+
+// How important a light's shadows are: roughly the fraction of the screen height covered by the sphere the light can
+// affect, seen from the camera (0 to 1). tanHalfFOVy is the tangent of half the camera's vertical field of view.
+// Returns 1 if the camera is inside the sphere
+float ShadowImportance(const BoundingSphere& influence, const CVector3& cameraPosition, float tanHalfFOVy);
+
+// Tile size for a view of the given importance: maxTileSize scaled by the importance and rounded up to a power of two,
+// no smaller than minTileSize. Returns 0 if the importance is 0 (the light can't be seen)
+unsigned int ShadowTileSize(float importance, unsigned int maxTileSize, unsigned int minTileSize);
+
+
+#endif //_SHADOW_ATLAS_H_INCLUDED_
@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow maps - the shadow views of a directional light
+//--------------------------------------------------------------------------------------
+
+#include "ShadowCascades.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Distances from the camera where each cascade starts and ends (see header)
+void CalculateCascadeSplits(float nearClip, float farClip, unsigned int numCascades, float lambda, float* splits)
+{
+    splits[0] = nearClip;
+    for (unsigned int i = 1; i < numCascades; ++i)
+    {
+        float fraction = static_cast<float>(i) / numCascades;
+        float logSplit  = nearClip * std::pow(farClip / nearClip, fraction);
+        float evenSplit = nearClip + (farClip - nearClip) * fraction;
+        splits[i] = lambda * logSplit + (1 - lambda) * evenSplit;
+    }
+    splits[numCascades] = farClip;
+}
+
+
+// Get the matrices for the cascade covering a slice of the camera's view (see header)
+ShadowCascade CalculateShadowCascade(const CMatrix4x4& cameraMatrix, float tanHalfFOVx, float tanHalfFOVy,
+                                     float nearDistance, float farDistance,
+                                     const CVector3& lightDirection, const AABB& casterBounds,
+                                     unsigned int tileSize, unsigned int snapTexels /*= 1*/)
+{
+    // Smallest sphere around the slice. By symmetry its centre is on the camera's forward axis, at the distance where
+    // the corners of the near and far ends of the slice are equally far away. If that is past the far end, the far end
+    // alone decides the size. Worked out from the camera settings only, not the corners in the world, so the radius
+    // is exactly the same whichever way the camera faces - if it changed slightly the shadow map texels would change
+    // size and shadows would shimmer
+    float cornerSlope = tanHalfFOVx * tanHalfFOVx + tanHalfFOVy * tanHalfFOVy; // Squared distance of a corner from the axis, per unit of depth
+    float centreDistance = (farDistance + nearDistance) * (1 + cornerSlope) * 0.5f;
+    float radius;
+    if (centreDistance >= farDistance)
+    {
+        centreDistance = farDistance;
+        radius = farDistance * std::sqrt(cornerSlope);
+    }
+    else
+    {
+        float toFar = farDistance - centreDistance;
+        radius = std::sqrt(toFar * toFar + farDistance * farDistance * cornerSlope);
+    }
+
+    ShadowCascade cascade;
+    cascade.coverage.centre = cameraMatrix.GetPosition() + Normalise(cameraMatrix.GetZAxis()) * centreDistance;
+    cascade.coverage.radius = radius;
+
+    // Axes of the light's view. The up axis is any that isn't along the light, it only needs to stay the same
+    CVector3 forward = Normalise(lightDirection);
+    CVector3 up = (std::abs(forward.y) < 0.99f) ? CVector3{ 0, 1, 0 } : CVector3{ 0, 0, 1 };
+    CVector3 right = Normalise(Cross(up, forward));
+    up = Cross(forward, right);
+
+    // Snapping the centre moves it by up to half a snap on each axis, so the view is made that much larger than the
+    // sphere. The snap is a number of texels, and a texel is the view width / tileSize, so:
+    //   halfWidth = radius + snapTexels * (2 * halfWidth / tileSize) / 2
+    snapTexels = std::max(snapTexels, 1u);
+    float halfWidth = radius / (1 - static_cast<float>(snapTexels) / tileSize);
+    float snap = snapTexels * 2 * halfWidth / tileSize;
+
+    // Centre of the sphere in the light's view, with x and y snapped to whole texels
+    float centreX = std::round(Dot(cascade.coverage.centre, right) / snap) * snap;
+    float centreY = std::round(Dot(cascade.coverage.centre, up) / snap) * snap;
+    float centreZ = Dot(cascade.coverage.centre, forward);
+
+    // Depths covered: the sphere, and back towards the light as far as any shadow caster. Snapped to a coarse step
+    // so casters moving about don't change the matrices every frame
+    float nearZ = centreZ - radius;
+    float farZ  = centreZ + radius;
+    if (!casterBounds.IsEmpty())
+    {
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            CVector3 point = { (corner & 1) ? casterBounds.maximum.x : casterBounds.minimum.x,
+                               (corner & 2) ? casterBounds.maximum.y : casterBounds.minimum.y,
+                               (corner & 4) ? casterBounds.maximum.z : casterBounds.minimum.z };
+            nearZ = std::min(nearZ, Dot(point, forward));
+        }
+    }
+    float depthStep = halfWidth * 0.25f;
+    nearZ = std::floor(nearZ / depthStep) * depthStep;
+    farZ  = std::ceil (farZ  / depthStep) * depthStep;
+
+    // The view matrix is built directly in the light's space, rather than by inverting a world matrix, so the snapped
+    // values are used exactly
+    cascade.viewMatrix = CMatrix4x4{ right.x,  up.x,     forward.x, 0.0f,
+                                     right.y,  up.y,     forward.y, 0.0f,
+                                     right.z,  up.z,     forward.z, 0.0f,
+                                     -centreX, -centreY, -nearZ,    1.0f };
+
+    // Orthographic projection, as MakeOrthographicMatrix in GraphicsHelpers (not used so this file has no Direct3D)
+    float scaleZ = 1.0f / (farZ - nearZ);
+    cascade.projectionMatrix = CMatrix4x4{ 1.0f / halfWidth, 0.0f,             0.0f,   0.0f,
+                                           0.0f,             1.0f / halfWidth, 0.0f,   0.0f,
+                                           0.0f,             0.0f,             scaleZ, 0.0f,
+                                           0.0f,             0.0f,             0.0f,   1.0f };
+    return cascade;
+}
@@ -0,0 +1,50 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow maps - the shadow views of a directional light
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// One shadow map can't cover a large scene in enough detail, so a directional light uses several
+// (cascades). The part of the camera's view that gets shadows is cut into slices by distance and
+// each slice gets its own orthographic view from the light. Near slices are small so get fine
+// detail, far ones are large and coarse.
+// A cascade covers a sphere around its slice, which is the same size however the camera turns.
+// Its position is snapped to a whole number of shadow map texels, so as the camera moves the
+// shadow map moves in whole texels and shadow edges don't shimmer. Small camera movements give
+// exactly the same matrices, so a cascade's shadow map can be reused (see ShadowMapCache).
+// There is no Direct3D code here, the scene renders the cascades into the shadow atlas.
+
+#ifndef _SHADOW_CASCADES_H_INCLUDED_
+#define _SHADOW_CASCADES_H_INCLUDED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+
+
+// Distances from the camera where each cascade starts and ends. splits must have room for numCascades + 1 values,
+// splits[0] is nearClip and splits[numCascades] is farClip. lambda blends between evenly spaced splits (0) and
+// logarithmic ones (1), which give each cascade the same detail on screen but make the near cascades very small
+void CalculateCascadeSplits(float nearClip, float farClip, unsigned int numCascades, float lambda, float* splits);
+
+
+// The matrices a cascade is rendered with, and the part of the scene they cover
+struct ShadowCascade
+{
+    CMatrix4x4     viewMatrix;
+    CMatrix4x4     projectionMatrix;
+    BoundingSphere coverage; // Sphere around the slice of the camera's view that this cascade covers
+};
+
+// Get the view and projection matrices for the cascade covering the slice of the camera's view from nearDistance to
+// farDistance:
+// - cameraMatrix is the camera's world matrix, tanHalfFOVx/y the tangents of half its fields of view
+// - lightDirection is the direction the light shines in, casterBounds encloses everything that casts shadows (the
+//   view reaches back towards the light far enough to include them)
+// - tileSize is the size of the cascade's shadow map in texels. The view is snapped to multiples of snapTexels texels
+//   (at least 1), larger values mean the camera must move further before the matrices change
+ShadowCascade CalculateShadowCascade(const CMatrix4x4& cameraMatrix, float tanHalfFOVx, float tanHalfFOVy,
+                                     float nearDistance, float farDistance,
+                                     const CVector3& lightDirection, const AABB& casterBounds,
+                                     unsigned int tileSize, unsigned int snapTexels = 1);
+
+
+#endif //_SHADOW_CASCADES_H_INCLUDED_
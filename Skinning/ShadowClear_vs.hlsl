@@ -0,0 +1,16 @@
+//--------------------------------------------------------------------------------------
+// Shadow Atlas Tile Clearing Vertex Shader
+//--------------------------------------------------------------------------------------
+// Direct3D 11 can only clear a whole depth buffer, so a tile of the shadow atlas is cleared by
+// drawing a triangle that covers the viewport (set to the tile) at the far depth. Used with no
+// vertex buffer, input layout or pixel shader: Draw(3, 0) and a depth state that always writes
+
+#include "Common.hlsli"
+
+
+float4 main(uint vertexID : SV_VertexID) : SV_Position
+{
+    // Vertices at (-1, 1), (3, 1) and (-1, -3) - a triangle that covers the whole viewport (-1 to 1)
+    float2 uv = float2((vertexID << 1) & 2, vertexID & 2);
+    return float4(uv.x * 2 - 1, 1 - uv.y * 2, 1.0f, 1.0f);
+}
@@ -0,0 +1,44 @@
+//--------------------------------------------------------------------------------------
+// Shadow map cache - only re-render a shadow map when something that affects it has changed
+//--------------------------------------------------------------------------------------
+
+#include "ShadowMapCache.h"
+#include "Model.h"
+
+#include <cstring>
+
+
+// Reserve space for the given number of casters, so the cache doesn't use the heap each frame
+ShadowMapCache::ShadowMapCache(unsigned int maxCasters /*= 32*/)
+{
+    mCasters.reserve(maxCasters);
+}
+
+
+// Returns true if the shadow map needs rendering for the given light matrix and casters: the first time, after
+// Invalidate, or if the matrix, the list of casters or any caster's matrices or level of detail have changed since it
+// last returned true. Records the new state when it returns true, so the caller must then render the shadow map
+bool ShadowMapCache::NeedsRender(const CMatrix4x4& lightViewProjection, Model* const* casters, unsigned int numCasters)
+{
+    // Matrices are compared exactly - any change at all, however small, moves the shadows
+    bool changed = !mValid || numCasters != mCasters.size() ||
+                   std::memcmp(&lightViewProjection, &mLightViewProjection, sizeof(CMatrix4x4)) != 0;
+    for (unsigned int i = 0; i < numCasters && !changed; ++i)
+    {
+        changed = casters[i] != mCasters[i].model || casters[i]->MatrixVersion() != mCasters[i].matrixVersion ||
+                  casters[i]->SelectLod() != mCasters[i].lod;
+    }
+
+    if (!changed)
+    {
+        ++mStats.skipped;
+        return false;
+    }
+
+    mValid = true;
+    mLightViewProjection = lightViewProjection;
+    mCasters.clear();
+    for (unsigned int i = 0; i < numCasters; ++i)  mCasters.push_back({ casters[i], casters[i]->MatrixVersion(), casters[i]->SelectLod() });
+    ++mStats.rendered;
+    return true;
+}
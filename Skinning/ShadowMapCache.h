@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Shadow map cache - only re-render a shadow map when something that affects it has changed
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// A shadow map depends only on the light's view-projection matrix and on the models that cast
+// shadows into it. The cache records the matrix and each caster's matrix version (see
+// Model::MatrixVersion) and level of detail (see Model::SelectLod) from the last time the shadow
+// map was rendered, and reports whether any of them have changed since. If nothing has, the depth
+// pass is skipped and last frame's shadow map is used again.
+
+#ifndef _SHADOW_MAP_CACHE_H_INCLUDED_
+#define _SHADOW_MAP_CACHE_H_INCLUDED_
+
+#include "CMatrix4x4.h"
+
+#include <vector>
+
+class Model;
+
+
+// Shadow pass counts since the last ResetStats
+struct ShadowMapCacheStats
+{
+    unsigned int rendered = 0;
+    unsigned int skipped  = 0;
+};
+
+
+class ShadowMapCache
+{
+public:
+    // Reserve space for the given number of casters, so the cache doesn't use the heap each frame
+    explicit ShadowMapCache(unsigned int maxCasters = 32);
+
+    // Returns true if the shadow map needs rendering for the given light matrix and casters: the first time, after
+    // Invalidate, or if the matrix, the list of casters or any caster's matrices or level of detail have changed since it
+    // last returned true. Records the new state when it returns true, so the caller must then render the shadow map
+    bool NeedsRender(const CMatrix4x4& lightViewProjection, Model* const* casters, unsigned int numCasters);
+
+    // Make the next NeedsRender return true, e.g. if the shadow map texture has been recreated or something other than
+    // the casters' matrices has changed what they look like
+    void Invalidate()  { mValid = false; }
+
+
+    // Pass counts, accumulated over calls to NeedsRender until reset
+    const ShadowMapCacheStats& Stats() const  { return mStats; }
+    void ResetStats()  { mStats = ShadowMapCacheStats(); }
+
+
+private:
+    struct CasterState
+    {
+        Model*       model;
+        unsigned int matrixVersion;
+        unsigned int lod;
+    };
+
+    bool                     mValid = false;
+    CMatrix4x4               mLightViewProjection;
+    std::vector<CasterState> mCasters;
+
+    ShadowMapCacheStats mStats;
+};
+
+
+#endif //_SHADOW_MAP_CACHE_H_INCLUDED_
@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas lookup, shared by the lighting pixel shaders
+//--------------------------------------------------------------------------------------
+// All shadow maps are tiles in one depth texture, the shadow atlas. The tile used by each light
+// (or by each cube face of a point light) and the matrix it was rendered with are in the
+// PerShadowConstants buffer (see Common.hlsli). Include after Common.hlsli
+
+Texture2D    ShadowAtlas : register(t1);
+SamplerState PointClamp  : register(s1); // No filtering of depths. Cell shading also uses it for its cell map
+
+
+// Shadow test of a world position against one shadow view. Returns 1 if lit, 0 if in shadow, or -1 if the view has no
+// tile this frame or the position is outside the view
+float ShadowViewFactor(int view, float3 worldPosition, float depthBias)
+{
+    ShadowView shadowView = gShadowViews[view];
+    if (shadowView.atlasRect.z == 0)  return -1;
+
+    // Project the position into the view, then map from -1 to 1 in x and y to a UV inside the view's tile
+    float4 projection = mul(shadowView.viewProjectionMatrix, float4(worldPosition, 1.0f));
+    if (projection.w <= 0)  return -1;
+    float3 position = projection.xyz / projection.w;
+    if (abs(position.x) > 1 || abs(position.y) > 1 || position.z < 0 || position.z > 1)  return -1;
+
+    float2 shadowMapUV = float2(0.5f * position.x + 0.5f, 0.5f - 0.5f * position.y);
+    shadowMapUV = shadowView.atlasRect.xy + shadowMapUV * shadowView.atlasRect.zw;
+
+    // Sampling inside a branch, so the mip level must be given
+    return (position.z - depthBias < ShadowAtlas.SampleLevel(PointClamp, shadowMapUV, 0).r) ? 1.0f : 0.0f;
+}
+
+
+// Returns 1 if the world position is lit by the light with the given shadows (0 to 3, or -1 for none), 0 if it is in
+// shadow. Lights without shadows, views without a tile this frame and positions outside every view count as lit
+float ShadowFactor(int light, float3 worldPosition)
+{
+    if (light < 0)  return 1;
+    LightShadow shadow = gLightShadows[light];
+    if (shadow.numViews == 0)  return 1;
+
+    // Directional light cascades, nearest first. Use the first (most detailed) one that covers the position. If a
+    // cascade has no tile this frame the next one is used instead
+    if (shadow.cascaded)
+    {
+        for (int cascade = 0; cascade < shadow.numViews; ++cascade)
+        {
+            float cascadeFactor = ShadowViewFactor(shadow.firstView + cascade, worldPosition, shadow.depthBias);
+            if (cascadeFactor >= 0)  return cascadeFactor;
+        }
+        return 1;
+    }
+
+    // Point lights have a view for each cube face (+x, -x, +y, -y, +z, -z), use the face the position is behind
+    int view = shadow.firstView;
+    if (shadow.numViews == 6)
+    {
+        float3 lightToPosition = worldPosition - shadow.position;
+        float3 distances = abs(lightToPosition);
+        if (distances.x >= distances.y && distances.x >= distances.z)  view += (lightToPosition.x > 0) ? 0 : 1;
+        else if (distances.y >= distances.z)                           view += (lightToPosition.y > 0) ? 2 : 3;
+        else                                                           view += (lightToPosition.z > 0) ? 4 : 5;
+    }
+
+    float factor = ShadowViewFactor(view, worldPosition, shadow.depthBias);
+    return (factor < 0) ? 1.0f : factor;
+}
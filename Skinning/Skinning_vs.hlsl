@@ -20,16 +20,20 @@ LightingPixelShaderInput main(SkinningVertex modelVertex)
 
     // Add 4th element to vertex position and normal (1 for positions, 0 for vectors)
     float4 modelPosition = float4(modelVertex.position, 1); 
-    float4 modelNormal   = float4(modelVertex.normal,   0);
+    float4 modelNormal   = float4(DecodeOctahedral(modelVertex.normal),   0);
 
+    // Blend the vertex by its four bones, the weights add up to 1. CpuSkinning.cpp does the same on the CPU
     float4 worldPosition;
-	worldPosition  = mul( gBoneMatrices[modelVertex.bones[0]], modelPosition ) * modelVertex.weights[0];
-                     //*** MISSING - The above line multiplies the vertex position by the first bone's matrix, using the weight of the first bone
-	                 //***           Now you need to do the same for each bone, adding all the results together to get a weighted average for this vertex (as discussed in lecture)
-	
+    worldPosition  = mul(gBoneMatrices[modelVertex.bones[0]], modelPosition) * modelVertex.weights[0];
+    worldPosition += mul(gBoneMatrices[modelVertex.bones[1]], modelPosition) * modelVertex.weights[1];
+    worldPosition += mul(gBoneMatrices[modelVertex.bones[2]], modelPosition) * modelVertex.weights[2];
+    worldPosition += mul(gBoneMatrices[modelVertex.bones[3]], modelPosition) * modelVertex.weights[3];
+
     float4 worldNormal;
-    worldNormal = mul(gBoneMatrices[modelVertex.bones[0]], modelNormal) * modelVertex.weights[0];
-     //*** ` - Do the same process as above to calculate the world normal using the influencing bones
+    worldNormal  = mul(gBoneMatrices[modelVertex.bones[0]], modelNormal) * modelVertex.weights[0];
+    worldNormal += mul(gBoneMatrices[modelVertex.bones[1]], modelNormal) * modelVertex.weights[1];
+    worldNormal += mul(gBoneMatrices[modelVertex.bones[2]], modelNormal) * modelVertex.weights[2];
+    worldNormal += mul(gBoneMatrices[modelVertex.bones[3]], modelNormal) * modelVertex.weights[3];
 
     // Use the view matrix to transform the final vertex position from world space into view space (camera's point of view)
     // and then use the projection matrix to transform the vertex to 2D projection space (project onto the 2D screen)
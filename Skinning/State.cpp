@@ -37,6 +37,7 @@ ID3D11RasterizerState* gCullNoneState  = nullptr;
 ID3D11DepthStencilState* gUseDepthBufferState = nullptr;
 ID3D11DepthStencilState* gDepthReadOnlyState  = nullptr;
 ID3D11DepthStencilState* gNoDepthBufferState  = nullptr;
+ID3D11DepthStencilState* gOverwriteDepthState  = nullptr;
 
 
 
@@ -295,6 +296,21 @@ bool CreateStates()
         return false;
     }
 
+
+    ////-------- Overwrite depth buffer --------////
+    // Depth test always passes and writes - used to clear part of a depth buffer (a tile of the shadow atlas) by drawing over it
+    depthStencilDesc.DepthEnable      = TRUE;
+    depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ALL;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_ALWAYS;
+    depthStencilDesc.StencilEnable    = FALSE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gOverwriteDepthState)))
+    {
+        gLastError = "Error creating overwrite-depth state";
+        return false;
+    }
+
     return true;
 }
 
@@ -305,6 +321,7 @@ void ReleaseStates()
     if (gUseDepthBufferState)    gUseDepthBufferState->Release();
     if (gDepthReadOnlyState)     gDepthReadOnlyState->Release();
     if (gNoDepthBufferState)     gNoDepthBufferState->Release();
+    if (gOverwriteDepthState)    gOverwriteDepthState->Release();
     if (gCullBackState)          gCullBackState->Release();
     if (gCullFrontState)         gCullFrontState->Release();
     if (gCullNoneState)          gCullNoneState->Release();
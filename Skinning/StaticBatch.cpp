@@ -0,0 +1,505 @@
+//--------------------------------------------------------------------------------------
+// Static batching - merges models that never move into shared vertex / index buffers
+//--------------------------------------------------------------------------------------
+
+#include "StaticBatch.h"
+#include "Common.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "RenderQueue.h"
+#include "GraphicsHelpers.h"
+#include "StateCache.h"
+#include "ThreadPool.h"
+#include "MathHelpers.h"
+#include "VertexPacking.h"
+#include "OcclusionCulling.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <chrono>
+
+
+/*-----------------------------------------------------------------------------------------
+    Merging geometry
+-----------------------------------------------------------------------------------------*/
+
+// True if two sub-meshes have the same vertex size and layout, so their vertices can share a buffer
+bool SameVertexLayout(const SubMeshData& a, const SubMeshData& b)
+{
+    if (a.vertexSize != b.vertexSize || a.layout.size() != b.layout.size())  return false;
+    for (std::size_t i = 0; i < a.layout.size(); ++i)
+    {
+        const VertexElement& elementA = a.layout[i];
+        const VertexElement& elementB = b.layout[i];
+        if (std::strncmp(elementA.semantic, elementB.semantic, sizeof(elementA.semantic)) != 0 ||
+            elementA.format != elementB.format || elementA.offset != elementB.offset)  return false;
+    }
+    return true;
+}
+
+
+// Transform three unaligned floats by a matrix as a row vector, either as a point (w = 1) or a vector (w = 0)
+static inline void TransformFloat3(const unsigned char* input, const CMatrix4x4& m, bool point, unsigned char* output)
+{
+    float v[3];
+    std::memcpy(v, input, sizeof(v));
+
+    float result[3] = { v[0] * m.e00 + v[1] * m.e10 + v[2] * m.e20,
+                        v[0] * m.e01 + v[1] * m.e11 + v[2] * m.e21,
+                        v[0] * m.e02 + v[1] * m.e12 + v[2] * m.e22 };
+    if (point)
+    {
+        result[0] += m.e30;
+        result[1] += m.e31;
+        result[2] += m.e32;
+    }
+    std::memcpy(output, result, sizeof(result));
+}
+
+// Transform a direction packed in octahedral form (see VertexPacking.h) by the upper 3x3 of a matrix, packing the result
+static inline void TransformOctahedral(const unsigned char* input, const CMatrix4x4& m, unsigned char* output)
+{
+    CVector3 v = ReadOctahedral(input);
+    WriteOctahedral({ v.x * m.e00 + v.y * m.e10 + v.z * m.e20,
+                      v.x * m.e01 + v.y * m.e11 + v.z * m.e21,
+                      v.x * m.e02 + v.y * m.e12 + v.z * m.e22 }, output);
+}
+
+// Transform vertices [begin, end) of a sub-mesh by a world matrix, writing whole vertices in the same layout to the
+// output (vertex begin first). Positions are transformed as points, normals and tangents as vectors by the upper 3x3
+// of the matrix - the same as the vertex shaders do with the world matrix. Packing them again normalises them, which
+// the shaders do after the world transform anyway. Other elements are copied unchanged. Skinned sub-meshes should not
+// be transformed this way, their bones do the positioning
+void TransformStaticVertices(const SubMeshData& subMesh, const CMatrix4x4& matrix, unsigned int begin, unsigned int end,
+                             unsigned char* output)
+{
+    const uint32_t NO_ELEMENT = SubMeshData::NO_ELEMENT;
+    for (unsigned int v = begin; v < end; ++v)
+    {
+        const unsigned char* vertex = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+        std::memcpy(output, vertex, subMesh.vertexSize);
+
+        if (subMesh.positionOffset != NO_ELEMENT)  TransformFloat3(vertex + subMesh.positionOffset, matrix, true,  output + subMesh.positionOffset);
+        if (subMesh.normalOffset   != NO_ELEMENT)  TransformOctahedral(vertex + subMesh.normalOffset,  matrix, output + subMesh.normalOffset);
+        if (subMesh.tangentOffset  != NO_ELEMENT)  TransformOctahedral(vertex + subMesh.tangentOffset, matrix, output + subMesh.tangentOffset);
+
+        output += subMesh.vertexSize;
+    }
+}
+
+
+// Transform the pieces into world space and join them into one sub-mesh: the vertices of each piece in turn, and its
+// indices offset to refer to where its vertices now are. firstIndices is filled with the first merged index of each
+// piece, plus a final entry for the total. If a thread pool is given the vertices and indices are split across its
+// threads, the result is identical either way. Returns false (and leaves the output alone) if the pieces don't all
+// have the same vertex layout, or any of them has bones
+bool MergeStaticGeometry(const StaticGeometryPiece* pieces, unsigned int numPieces, SubMeshData& merged,
+                         std::vector<uint32_t>& firstIndices, ThreadPool* threadPool /*= nullptr*/)
+{
+    if (numPieces == 0)  return false;
+    const SubMeshData& layout = *pieces[0].subMesh;
+    for (unsigned int p = 0; p < numPieces; ++p)
+    {
+        const SubMeshData& subMesh = *pieces[p].subMesh;
+        if (subMesh.bonesOffset != SubMeshData::NO_ELEMENT || !SameVertexLayout(subMesh, layout))  return false;
+    }
+
+    // Where each piece starts in the merged vertices and indices, with a final entry for the totals
+    std::vector<uint32_t> firstVertices(numPieces + 1);
+    firstIndices.resize(numPieces + 1);
+    firstVertices[0] = 0;
+    firstIndices[0]  = 0;
+    for (unsigned int p = 0; p < numPieces; ++p)
+    {
+        firstVertices[p + 1] = firstVertices[p] + pieces[p].subMesh->numVertices;
+        firstIndices[p + 1]  = firstIndices[p]  + pieces[p].subMesh->numIndices;
+    }
+    uint32_t numVertices = firstVertices[numPieces];
+    uint32_t numIndices  = firstIndices[numPieces];
+
+    merged = SubMeshData();
+    merged.vertexSize     = layout.vertexSize;
+    merged.layout         = layout.layout;
+    merged.positionOffset = layout.positionOffset;
+    merged.normalOffset   = layout.normalOffset;
+    merged.tangentOffset  = layout.tangentOffset;
+    merged.uvOffset       = layout.uvOffset;
+    merged.numVertices    = numVertices;
+    merged.numIndices     = numIndices;
+    merged.indexSize      = IndexSizeFor(numVertices); // Small groups can still use 16-bit indices
+    merged.vertexStorage.reset(new unsigned char[static_cast<std::size_t>(numVertices) * layout.vertexSize]);
+    merged.indexStorage.reset(new unsigned char[static_cast<std::size_t>(numIndices) * merged.indexSize]);
+    merged.vertices = merged.vertexStorage.get();
+    merged.indices  = merged.indexStorage.get();
+
+    unsigned char* vertices  = merged.vertexStorage.get();
+    uint16_t*      indices16 = reinterpret_cast<uint16_t*>(merged.indexStorage.get());
+    uint32_t*      indices32 = reinterpret_cast<uint32_t*>(merged.indexStorage.get());
+
+    // Vertices and indices are split into batches separately, so a large piece (e.g. the ground) is shared between
+    // threads and a batch can cover several small pieces. Each batch starts from the piece holding its first item
+    auto mergeVertices = [&](unsigned int begin, unsigned int end)
+    {
+        unsigned int p = static_cast<unsigned int>(std::upper_bound(firstVertices.begin(), firstVertices.end(), begin) - firstVertices.begin()) - 1;
+        for (; begin < end; ++p)
+        {
+            unsigned int pieceEnd = std::min(end, firstVertices[p + 1]);
+            TransformStaticVertices(*pieces[p].subMesh, pieces[p].matrix, begin - firstVertices[p], pieceEnd - firstVertices[p],
+                                    vertices + static_cast<std::size_t>(begin) * layout.vertexSize);
+            begin = pieceEnd;
+        }
+    };
+    auto mergeIndices = [&](unsigned int begin, unsigned int end)
+    {
+        unsigned int p = static_cast<unsigned int>(std::upper_bound(firstIndices.begin(), firstIndices.end(), begin) - firstIndices.begin()) - 1;
+        for (; begin < end; ++p)
+        {
+            unsigned int pieceEnd = std::min(end, firstIndices[p + 1]);
+            const SubMeshData& piece = *pieces[p].subMesh;
+            if (merged.indexSize == 2)
+            {
+                for (unsigned int i = begin; i < pieceEnd; ++i)  indices16[i] = static_cast<uint16_t>(piece.Index(i - firstIndices[p]) + firstVertices[p]);
+            }
+            else
+            {
+                for (unsigned int i = begin; i < pieceEnd; ++i)  indices32[i] = piece.Index(i - firstIndices[p]) + firstVertices[p];
+            }
+            begin = pieceEnd;
+        }
+    };
+
+    if (threadPool != nullptr)
+    {
+        threadPool->ParallelFor(numVertices, STATIC_BATCH_SIZE, mergeVertices);
+        threadPool->ParallelFor(numIndices,  STATIC_BATCH_SIZE, mergeIndices);
+    }
+    else
+    {
+        mergeVertices(0, numVertices);
+        mergeIndices(0, numIndices);
+    }
+    return true;
+}
+
+
+// Add a piece for each sub-mesh of each node of a model, with the node's absolute world matrix (as Mesh::Render
+// calculates it)
+static void AddModelPieces(Model* model, std::vector<StaticGeometryPiece>& pieces)
+{
+    const MeshData& data = model->GetMesh()->GetData();
+    unsigned int numNodes = static_cast<unsigned int>(data.nodes.size());
+
+    std::vector<CMatrix4x4>   matrices(numNodes);
+    std::vector<CMatrix4x4>   absoluteMatrices(numNodes);
+    std::vector<unsigned int> parentIndices(numNodes);
+    for (unsigned int node = 0; node < numNodes; ++node)
+    {
+        matrices[node]      = model->WorldMatrix(node);
+        parentIndices[node] = data.nodes[node].parentIndex;
+    }
+    MatrixMultiplyHierarchy(matrices.data(), parentIndices.data(), absoluteMatrices.data(), numNodes);
+
+    for (unsigned int node = 0; node < numNodes; ++node)
+    {
+        for (auto subMesh : data.nodes[node].subMeshes)  pieces.push_back({ &data.subMeshes[subMesh], absoluteMatrices[node] });
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Static batch
+-----------------------------------------------------------------------------------------*/
+
+// Reserve space for culling the given number of models in a group, so drawing doesn't use the heap each frame
+StaticBatch::StaticBatch(unsigned int maxModels /*= 64*/)
+    : mCuller(maxModels)
+{
+    mRanges.reserve(maxModels * 2);
+}
+
+StaticBatch::~StaticBatch() = default;
+
+
+// Add a model that doesn't move, to be drawn with the given material. The model, its mesh and the material must
+// outlive the batch. The batch isn't built until the next Update. Returns false if the model can't be batched
+// (skinned, blended material, or sub-meshes with different vertex layouts), it should be rendered as usual instead
+bool StaticBatch::Add(Model* model, const RenderMaterial* material)
+{
+    const MeshData& data = model->GetMesh()->GetData();
+    if (data.hasBones || material->blended || data.subMeshes.empty())  return false;
+    for (auto& subMesh : data.subMeshes)
+    {
+        if (!SameVertexLayout(subMesh, data.subMeshes[0]))  return false;
+    }
+
+    // Join the group for this material and layout, or start a new one. The group is rebuilt on the next Update
+    auto group = std::find_if(mGroups.begin(), mGroups.end(), [&](const Group& g)
+    {
+        return g.material == material && SameVertexLayout(g.models[0]->GetMesh()->GetData().subMeshes[0], data.subMeshes[0]);
+    });
+    if (group == mGroups.end())
+    {
+        mGroups.emplace_back();
+        group = mGroups.end() - 1;
+        group->material = material;
+    }
+    group->models.push_back(model);
+    group->matrixVersions.push_back(model->MatrixVersion());
+    group->mesh.reset();
+    return true;
+}
+
+
+// Build the groups whose models have changed since they were last built, all of them the first time. The merge is
+// split across the thread pool if one is given. Returns the number of groups built.
+// Will throw a std::runtime_error exception if the GPU buffers can't be created
+unsigned int StaticBatch::Update(ThreadPool* threadPool /*= nullptr*/)
+{
+    unsigned int numBuilt = 0;
+    for (auto& group : mGroups)
+    {
+        if (NeedsBuild(group))
+        {
+            Build(group, threadPool);
+            ++numBuilt;
+        }
+    }
+    return numBuilt;
+}
+
+
+// Remove all the models and release the merged meshes
+void StaticBatch::Clear()
+{
+    mGroups.clear();
+}
+
+
+// True if the group's models have moved since it was built, or it hasn't been built
+bool StaticBatch::NeedsBuild(Group& group)
+{
+    if (group.mesh == nullptr)  return true;
+    for (std::size_t i = 0; i < group.models.size(); ++i)
+    {
+        if (group.models[i]->MatrixVersion() != group.matrixVersions[i])  return true;
+    }
+    return false;
+}
+
+
+// Merge the group's models into a new mesh
+void StaticBatch::Build(Group& group, ThreadPool* threadPool)
+{
+    std::vector<StaticGeometryPiece> pieces;
+    std::vector<unsigned int> firstPieces; // First piece of each model
+    group.bounds = AABB();
+    for (std::size_t i = 0; i < group.models.size(); ++i)
+    {
+        Model* model = group.models[i];
+        firstPieces.push_back(static_cast<unsigned int>(pieces.size()));
+        AddModelPieces(model, pieces);
+        group.bounds.Add(model->WorldBounds());
+        group.matrixVersions[i] = model->MatrixVersion();
+    }
+    firstPieces.push_back(static_cast<unsigned int>(pieces.size()));
+
+    // The merged mesh has a single node at the origin holding a single sub-mesh
+    MeshData data;
+    data.subMeshes.resize(1);
+    std::vector<uint32_t> pieceFirstIndices;
+    if (!MergeStaticGeometry(pieces.data(), static_cast<unsigned int>(pieces.size()), data.subMeshes[0], pieceFirstIndices, threadPool))
+    {
+        throw std::runtime_error("Static batch models have different vertex layouts");
+    }
+
+    group.firstIndices.resize(firstPieces.size());
+    for (std::size_t i = 0; i < firstPieces.size(); ++i)  group.firstIndices[i] = pieceFirstIndices[firstPieces[i]];
+
+    data.nodes.resize(1);
+    MeshNode& root = data.nodes[0];
+    root.name          = "Static batch";
+    root.defaultMatrix = MatrixIdentity();
+    root.offsetMatrix  = MatrixIdentity();
+    root.parentIndex   = 0;
+    root.subMeshes.push_back(0);
+    root.bounds        = group.bounds;
+    data.bounds        = group.bounds;
+
+    group.mesh = std::make_unique<Mesh>(std::move(data), "Static batch");
+}
+
+
+// Cull a group's models against the frustum of the view-projection matrix (or keep them all if cull is false), and
+// against an occlusion buffer drawn from the same view if one is given. Finds the index ranges to draw for the visible
+// ones. Returns the number of models visible. The ranges are kept until the next call
+unsigned int StaticBatch::Cull(unsigned int group, const CMatrix4x4& viewProjection, bool cull /*= true*/,
+                               const OcclusionBuffer* occlusion /*= nullptr*/)
+{
+    Group& g = mGroups[group];
+    mRanges.clear();
+    mNumOccluded = 0;
+    if (g.mesh == nullptr)  return 0;
+
+    unsigned int numModels = static_cast<unsigned int>(g.models.size());
+    if (cull)
+    {
+        mCuller.Clear();
+        for (auto model : g.models)  mCuller.Add(model->WorldBounds());
+        mCuller.Cull(viewProjection);
+    }
+
+    // Models are merged in order, so a visible model whose range starts where the last range ends extends that range
+    unsigned int numVisible = 0;
+    for (unsigned int i = 0; i < numModels; ++i)
+    {
+        if (cull && !mCuller.IsVisible(i))  continue;
+        if (cull && occlusion != nullptr && !occlusion->IsVisible(g.models[i]->WorldBounds()))
+        {
+            ++mNumOccluded;
+            continue;
+        }
+        ++numVisible;
+
+        uint32_t firstIndex = g.firstIndices[i];
+        uint32_t numIndices = g.firstIndices[i + 1] - firstIndex;
+        if (numIndices == 0)  continue;
+
+        std::size_t last = mRanges.size();
+        if (last > 0 && mRanges[last - 2] + mRanges[last - 1] == firstIndex)
+        {
+            mRanges[last - 1] += numIndices;
+        }
+        else
+        {
+            mRanges.push_back(firstIndex);
+            mRanges.push_back(numIndices);
+        }
+    }
+    return numVisible;
+}
+
+
+// Triangles in the ranges the last Cull found
+unsigned int StaticBatch::NumRangeTriangles() const
+{
+    unsigned int numIndices = 0;
+    for (std::size_t i = 1; i < mRanges.size(); i += 2)  numIndices += mRanges[i];
+    return numIndices / 3;
+}
+
+
+// Draw the ranges found by the last Cull of the given group. Sets the per-model constants to an identity world
+// matrix, everything else (shaders, states, textures) must already be set
+void StaticBatch::Render(unsigned int group)
+{
+    // The vertices are already in world space
+    gPerModelConstants.worldMatrix  = MatrixIdentity();
+    gPerModelConstants.objectColour = { 1, 1, 1 };
+    UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants);
+    gStateCache.SetVSConstantBuffer(1, gPerModelConstantBuffer);
+    gStateCache.SetPSConstantBuffer(1, gPerModelConstantBuffer);
+
+    Mesh* mesh = mGroups[group].mesh.get();
+    for (std::size_t i = 0; i < mRanges.size(); i += 2)  mesh->RenderIndexRange(0, mRanges[i], mRanges[i + 1]);
+}
+
+
+// Approximate GPU memory used by the merged vertex and index buffers, in bytes
+std::size_t StaticBatch::GetMemoryUsage()
+{
+    std::size_t bytes = 0;
+    for (auto& group : mGroups)
+    {
+        if (group.mesh != nullptr)  bytes += group.mesh->GetMemoryUsage();
+    }
+    return bytes;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Benchmark
+-----------------------------------------------------------------------------------------*/
+
+// Check and time the merge used by static batches. The given meshes are placed as the given number of models with
+// random positions, rotations and scales, then merged on one thread and across the thread pool. Every index of every
+// model is checked: the merged vertex it refers to must be bit-for-bit the same as the model's own vertex transformed
+// by the model's matrix. Meshes with bones or with a different vertex layout from the first are left out. No GPU is
+// used. Returns a report for the debug output
+std::string BenchmarkStaticBatching(Mesh* const* meshes, unsigned int numMeshes, unsigned int numModels,
+                                    ThreadPool* threadPool, unsigned int iterations /*= 20*/)
+{
+    // Meshes that can be merged with the first suitable one
+    std::vector<Mesh*> usableMeshes;
+    for (unsigned int i = 0; i < numMeshes; ++i)
+    {
+        const MeshData& data = meshes[i]->GetData();
+        if (data.hasBones || data.subMeshes.empty())  continue;
+        const SubMeshData& layout = usableMeshes.empty() ? data.subMeshes[0] : usableMeshes[0]->GetData().subMeshes[0];
+        bool usable = true;
+        for (auto& subMesh : data.subMeshes)  usable = usable && SameVertexLayout(subMesh, layout);
+        if (usable)  usableMeshes.push_back(meshes[i]);
+    }
+    if (usableMeshes.empty())  return "Static batching benchmark: no meshes without bones to merge\n";
+
+    // Models scattered and turned at random as in BenchmarkCulling, also scaled so normals are transformed non-trivially
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2 * PI);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+    std::vector<std::unique_ptr<Model>> models;
+    std::vector<StaticGeometryPiece> pieces;
+    models.reserve(numModels);
+    for (unsigned int i = 0; i < numModels; ++i)
+    {
+        CVector3 rotation = { angle(random), angle(random), angle(random) };
+        models.push_back(std::make_unique<Model>(usableMeshes[i % usableMeshes.size()],
+                                                 CVector3{ position(random), position(random), position(random) }, rotation, scale(random)));
+        AddModelPieces(models.back().get(), pieces);
+    }
+    unsigned int numPieces = static_cast<unsigned int>(pieces.size());
+
+    std::string report;
+    char line[256];
+
+    report += "  Threads  ms/merge  Mverts/s  Mismatches\n";
+    SubMeshData merged;
+    std::vector<uint32_t> firstIndices;
+    std::vector<unsigned char> reference(pieces[0].subMesh->vertexSize);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        ThreadPool* pool = (pass == 1) ? threadPool : nullptr;
+        if (pass == 1 && pool == nullptr)  break;
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)  MergeStaticGeometry(pieces.data(), numPieces, merged, firstIndices, pool);
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+        // Every corner of every triangle, compared with the piece's own vertex transformed by itself
+        unsigned int mismatches = 0;
+        for (unsigned int p = 0; p < numPieces; ++p)
+        {
+            const SubMeshData& subMesh = *pieces[p].subMesh;
+            for (unsigned int i = 0; i < subMesh.numIndices; ++i)
+            {
+                uint32_t index = subMesh.Index(i);
+                TransformStaticVertices(subMesh, pieces[p].matrix, index, index + 1, reference.data());
+                const unsigned char* mergedVertex = merged.vertices + static_cast<std::size_t>(merged.Index(firstIndices[p] + i)) * merged.vertexSize;
+                if (std::memcmp(mergedVertex, reference.data(), merged.vertexSize) != 0)  ++mismatches;
+            }
+        }
+
+        unsigned int numThreads = (pool != nullptr) ? pool->NumThreads() + 1 : 1;
+        double verticesPerSecond = (time.count() > 0) ? merged.numVertices * static_cast<double>(iterations) / time.count() : 0;
+        std::snprintf(line, sizeof(line), "  %7u  %8.2f  %8.2f  %10u\n", numThreads, time.count() * 1000.0 / iterations,
+                      verticesPerSecond / 1000000.0, mismatches);
+        report += line;
+    }
+
+    std::snprintf(line, sizeof(line), "Static batching benchmark: %u models, %u meshes, %u vertices, %u indices\n",
+                  numModels, static_cast<unsigned int>(usableMeshes.size()), merged.numVertices, merged.numIndices);
+    return line + report;
+}
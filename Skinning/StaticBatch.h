@@ -0,0 +1,175 @@
+//--------------------------------------------------------------------------------------
+// Static batching - merges models that never move into shared vertex / index buffers
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Models that stay where InitScene put them (ground, props) each cost a world matrix upload and
+// their own vertex / index buffer binds every frame. A static batch transforms their vertices into
+// world space once and copies them into one buffer per material, so all the static models of a
+// material are drawn with an identity world matrix and a single set of binds.
+// Each model's range of indices in the merged buffer is kept, so models are still culled one by
+// one. The visible ranges are drawn in order, and ranges that follow on from each other are joined
+// into one draw call. A group is rebuilt if any of its models' matrices change (see
+// Model::MatrixVersion), which shouldn't happen for static models but keeps the batch correct.
+// Only rigid models are batched: skinned models are posed by their bones in the vertex shader.
+// Vertex shaders that work in model space (e.g. vertex wiggling) would see world positions, so
+// models drawn with them should not be batched. Static models are drawn with a white object colour,
+// and at full detail as only their full detail triangles are merged (see MeshSimplifier.h).
+// The merge itself (MergeStaticGeometry) has no DirectX code and can be split across a thread pool.
+
+#ifndef _STATIC_BATCH_H_INCLUDED_
+#define _STATIC_BATCH_H_INCLUDED_
+
+#include "MeshData.h"
+#include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+#include "Culling.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+class Model;
+class Mesh;
+class ThreadPool;
+class OcclusionBuffer;
+struct RenderMaterial;
+
+
+//--------------------------------------------------------------------------------------
+// Merging geometry
+//--------------------------------------------------------------------------------------
+
+// One sub-mesh placed in the world, a piece of a merge
+struct StaticGeometryPiece
+{
+    const SubMeshData* subMesh;
+    CMatrix4x4         matrix; // Absolute world matrix of the node the sub-mesh belongs to
+};
+
+// Number of vertices or indices given to each thread at a time when a merge is split across a thread pool
+const unsigned int STATIC_BATCH_SIZE = 4096;
+
+
+// True if two sub-meshes have the same vertex size and layout, so their vertices can share a buffer
+bool SameVertexLayout(const SubMeshData& a, const SubMeshData& b);
+
+// Transform vertices [begin, end) of a sub-mesh by a world matrix, writing whole vertices in the same layout to the
+// output (vertex begin first). Positions are transformed as points, normals and tangents as vectors by the upper 3x3
+// of the matrix - the same as the vertex shaders do with the world matrix. Packing them again normalises them, which
+// the shaders do after the world transform anyway. Other elements are copied unchanged. Skinned sub-meshes should not
+// be transformed this way, their bones do the positioning
+void TransformStaticVertices(const SubMeshData& subMesh, const CMatrix4x4& matrix, unsigned int begin, unsigned int end,
+                             unsigned char* output);
+
+// Transform the pieces into world space and join them into one sub-mesh: the vertices of each piece in turn, and its
+// indices offset to refer to where its vertices now are. firstIndices is filled with the first merged index of each
+// piece, plus a final entry for the total. If a thread pool is given the vertices and indices are split across its
+// threads, the result is identical either way. Returns false (and leaves the output alone) if the pieces don't all
+// have the same vertex layout, or any of them has bones
+bool MergeStaticGeometry(const StaticGeometryPiece* pieces, unsigned int numPieces, SubMeshData& merged,
+                         std::vector<uint32_t>& firstIndices, ThreadPool* threadPool = nullptr);
+
+
+//--------------------------------------------------------------------------------------
+// Static batch
+//--------------------------------------------------------------------------------------
+
+class StaticBatch
+{
+public:
+    // Reserve space for culling the given number of models in a group, so drawing doesn't use the heap each frame
+    explicit StaticBatch(unsigned int maxModels = 64);
+    ~StaticBatch();
+
+    // Batches own GPU resources so cannot be copied
+    StaticBatch(const StaticBatch&) = delete;
+    StaticBatch& operator=(const StaticBatch&) = delete;
+
+
+    // Add a model that doesn't move, to be drawn with the given material. The model, its mesh and the material must
+    // outlive the batch. The batch isn't built until the next Update. Returns false if the model can't be batched
+    // (skinned, blended material, or sub-meshes with different vertex layouts), it should be rendered as usual instead
+    bool Add(Model* model, const RenderMaterial* material);
+
+    // Build the groups whose models have changed since they were last built, all of them the first time. The merge is
+    // split across the thread pool if one is given. Returns the number of groups built.
+    // Will throw a std::runtime_error exception if the GPU buffers can't be created
+    unsigned int Update(ThreadPool* threadPool = nullptr);
+
+    // Remove all the models and release the merged meshes
+    void Clear();
+
+
+    //-------------------------------------
+    // Groups - the models that share a material, merged into one mesh
+    //-------------------------------------
+
+    unsigned int NumGroups() const  { return static_cast<unsigned int>(mGroups.size()); }
+
+    const RenderMaterial* GroupMaterial(unsigned int group) const  { return mGroups[group].material; }
+    const Mesh*           GroupMesh(unsigned int group) const      { return mGroups[group].mesh.get(); }
+    const AABB&           GroupBounds(unsigned int group) const    { return mGroups[group].bounds; }
+    unsigned int          GroupModels(unsigned int group) const    { return static_cast<unsigned int>(mGroups[group].models.size()); }
+
+    // Cull a group's models against the frustum of the view-projection matrix (or keep them all if cull is false), and
+    // against an occlusion buffer drawn from the same view if one is given (see OcclusionCulling.h). Finds the index
+    // ranges to draw for the visible ones. Returns the number of models visible. The ranges are kept until the next call
+    unsigned int Cull(unsigned int group, const CMatrix4x4& viewProjection, bool cull = true,
+                      const OcclusionBuffer* occlusion = nullptr);
+
+    // Draw calls the last Cull found
+    unsigned int NumRanges() const  { return static_cast<unsigned int>(mRanges.size() / 2); }
+
+    // Models in the frustum that the last Cull found hidden behind the occluders
+    unsigned int NumOccluded() const  { return mNumOccluded; }
+
+    // Triangles in the ranges the last Cull found
+    unsigned int NumRangeTriangles() const;
+
+    // Draw the ranges found by the last Cull of the given group. Sets the per-model constants to an identity world
+    // matrix, everything else (shaders, states, textures) must already be set
+    void Render(unsigned int group);
+
+
+    // Approximate GPU memory used by the merged vertex and index buffers, in bytes
+    std::size_t GetMemoryUsage();
+
+
+private:
+    struct Group
+    {
+        const RenderMaterial* material;
+
+        std::vector<Model*>       models;
+        std::vector<unsigned int> matrixVersions; // Of each model when the group was last built
+        std::vector<uint32_t>     firstIndices;   // First index of each model in the merged mesh, plus the total
+
+        std::unique_ptr<Mesh> mesh;   // Merged geometry, nullptr until built
+        AABB                  bounds; // Of all the models
+    };
+
+    // True if the group's models have moved since it was built, or it hasn't been built
+    bool NeedsBuild(Group& group);
+
+    // Merge the group's models into a new mesh
+    void Build(Group& group, ThreadPool* threadPool);
+
+
+    std::vector<Group>    mGroups;
+    FrustumCuller         mCuller;
+    std::vector<uint32_t> mRanges; // First index and index count of each draw from the last Cull
+    unsigned int          mNumOccluded = 0;
+};
+
+
+// Check and time the merge used by static batches. The given meshes are placed as the given number of models with
+// random positions, rotations and scales, then merged on one thread and across the thread pool. Every index of every
+// model is checked: the merged vertex it refers to must be bit-for-bit the same as the model's own vertex transformed
+// by the model's matrix. Meshes with bones or with a different vertex layout from the first are left out. No GPU is
+// used. Returns a report for the debug output
+std::string BenchmarkStaticBatching(Mesh* const* meshes, unsigned int numMeshes, unsigned int numModels,
+                                    ThreadPool* threadPool, unsigned int iterations = 20);
+
+
+#endif //_STATIC_BATCH_H_INCLUDED_
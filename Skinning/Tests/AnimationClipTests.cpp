@@ -0,0 +1,141 @@
+//--------------------------------------------------------------------------------------
+// Animation clip tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "AnimationClip.h"
+#include "MathHelpers.h"
+
+#include <vector>
+#include <initializer_list>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+    struct Key
+    {
+        float time;
+        float value[4];
+    };
+
+    // Append a track's keys of one kind to a clip's key arrays, returns the index of the first
+    uint32_t AddKeys(AnimationKeys& keys, std::initializer_list<Key> trackKeys)
+    {
+        uint32_t first = static_cast<uint32_t>(keys.times.size());
+        for (auto& key : trackKeys)
+        {
+            keys.times.push_back(key.time);
+            for (int c = 0; c < 4; ++c)  keys.values[c].push_back(key.value[c]);
+        }
+        return first;
+    }
+
+    bool SameMatrices(const std::vector<CMatrix4x4>& a, const std::vector<CMatrix4x4>& b)
+    {
+        return std::memcmp(a.data(), b.data(), a.size() * sizeof(CMatrix4x4)) == 0;
+    }
+
+    bool NearlyEqual(const CMatrix4x4& a, const CMatrix4x4& b)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            if (std::abs((&a.e00)[i] - (&b.e00)[i]) > 1e-5f)  return false;
+        }
+        return true;
+    }
+}
+
+
+// A cursor moving forwards finds the same keys as a fresh cursor's binary search, including when looping playback jumps
+// back to the start. Times outside the clip clamp to the end keys, keys are interpolated linearly and rotations take the
+// shortest path. Nodes without tracks are left alone
+void TestAnimationClip()
+{
+    // Two tracks with keys of each kind at their own uneven times. Node 3's second rotation key is a 60 degree turn about
+    // y stored as the negated quaternion, which is the same rotation
+    const float s30 = std::sin(ToRadians(30.0f)), c30 = std::cos(ToRadians(30.0f));
+    AnimationClip clip;
+    clip.name = "Generated";
+    clip.duration = 2.0f;
+
+    AnimationTrack track;
+    track.node = 1;
+    track.numTranslations = 5;
+    track.firstTranslation = AddKeys(clip.translations, { { 0.0f, { 0, 0, 0 } }, { 0.3f, { 1, 2, 3 } }, { 0.5f, { -1, 0, 2 } },
+                                                          { 1.2f, { 4, 4, 4 } }, { 2.0f, { 0, 1, 0 } } });
+    track.numRotations = 3;
+    track.firstRotation = AddKeys(clip.rotations, { { 0.1f, { 0, 0, 0, 1 } }, { 0.7f, { 0, 0, s30, c30 } },
+                                                    { 1.7f, { s30, 0, 0, c30 } } });
+    track.numScales = 2;
+    track.firstScale = AddKeys(clip.scales, { { 0.0f, { 1, 1, 1 } }, { 1.0f, { 3, 3, 3 } } });
+    clip.tracks.push_back(track);
+
+    track.node = 3;
+    track.numTranslations = 1;
+    track.firstTranslation = AddKeys(clip.translations, { { 0.0f, { 5, 6, 7 } } });
+    track.numRotations = 2;
+    track.firstRotation = AddKeys(clip.rotations, { { 0.0f, { 0, 0, 0, 1 } }, { 1.0f, { 0, -s30, 0, -c30 } } });
+    track.numScales = 4;
+    track.firstScale = AddKeys(clip.scales, { { 0.0f, { 1, 1, 1 } }, { 0.25f, { 1, 1, 1 } }, { 1.5f, { 1, 1, 1 } },
+                                              { 1.75f, { 1, 1, 1 } } });
+    clip.tracks.push_back(track);
+
+    const CMatrix4x4 untouched = MatrixTranslation({ 9, 9, 9 });
+    std::vector<CMatrix4x4> nodes(4, untouched), fresh(4, untouched);
+    auto sampleFresh = [&](float time)
+    {
+        AnimationCursor cursor;
+        clip.Sample(time, cursor, fresh.data());
+    };
+
+    // Forwards in small steps past the end, and looping playback as Model::UpdateAnimation does it, which jumps back
+    AnimationCursor cursor;
+    bool forwardsMatches = true;
+    for (int frame = 0; frame <= 150; ++frame)
+    {
+        float time = frame / 60.0f;
+        clip.Sample(time, cursor, nodes.data());
+        sampleFresh(time);
+        forwardsMatches = forwardsMatches && SameMatrices(nodes, fresh);
+    }
+    CHECK(forwardsMatches);
+
+    bool loopMatches = true;
+    float time = 0;
+    for (int frame = 0; frame < 400; ++frame)
+    {
+        time = std::fmod(time + 0.037f, clip.duration);
+        clip.Sample(time, cursor, nodes.data());
+        sampleFresh(time);
+        loopMatches = loopMatches && SameMatrices(nodes, fresh);
+    }
+    for (float jump : { 1.5f, 0.4f, 1.9f, 0.0f, 0.35f })
+    {
+        clip.Sample(jump, cursor, nodes.data());
+        sampleFresh(jump);
+        loopMatches = loopMatches && SameMatrices(nodes, fresh);
+    }
+    CHECK(loopMatches);
+    CHECK(std::memcmp(&nodes[0], &untouched, sizeof(untouched)) == 0);
+    CHECK(std::memcmp(&nodes[2], &untouched, sizeof(untouched)) == 0);
+
+    // Before the first key and after the last, each kind of key clamps separately
+    clip.Sample(-1.0f, cursor, nodes.data());
+    CHECK(NearlyEqual(nodes[1], MatrixIdentity()));
+    CHECK(NearlyEqual(nodes[3], MatrixTranslation({ 5, 6, 7 })));
+    clip.Sample(0.05f, cursor, nodes.data()); // Before the first rotation key, but not the first translation or scale
+    CHECK(NearlyEqual(nodes[1], MatrixScaling(1.1f) * MatrixTranslation({ 1.0f / 6, 1.0f / 3, 0.5f })));
+    clip.Sample(5.0f, cursor, nodes.data());
+    CHECK(NearlyEqual(nodes[1], MatrixScaling(3.0f) * MatrixRotationX(ToRadians(60.0f)) * MatrixTranslation({ 0, 1, 0 })));
+    CHECK(NearlyEqual(nodes[3], MatrixRotationY(ToRadians(60.0f)) * MatrixTranslation({ 5, 6, 7 })));
+
+    // Linear interpolation of translation and scale, and nlerp of rotation between keys
+    sampleFresh(0.4f);
+    CHECK(NearlyEqual(fresh[1], MatrixScaling(1.8f) * MatrixRotationZ(ToRadians(30.0f)) * MatrixTranslation({ 0, 1, 2.5f })));
+
+    // Halfway between node 3's rotation keys is a 30 degree turn, not the long way round to the negated quaternion
+    sampleFresh(0.5f);
+    CHECK(NearlyEqual(fresh[3], MatrixRotationY(ToRadians(30.0f)) * MatrixTranslation({ 5, 6, 7 })));
+}
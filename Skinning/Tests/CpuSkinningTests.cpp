@@ -0,0 +1,166 @@
+//--------------------------------------------------------------------------------------
+// CPU skinning tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "CpuSkinning.h"
+#include "VertexPacking.h"
+#include "BoundingVolumes.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <memory>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+    // A packed skinned sub-mesh of random points as MeshData builds them: float3 position, octahedral normal, four
+    // 8-bit bone indices and four 8-bit weights. Split into two bone batches whose palettes overlap, the first using
+    // all BONE_PALETTE_SIZE entries, so a vertex's bone index means a different node in each batch
+    SubMeshData MakeSkinnedSubMesh(unsigned int numVertices, unsigned int firstBatchVertices)
+    {
+        SubMeshData subMesh;
+        subMesh.positionOffset = 0;
+        subMesh.normalOffset   = 12;
+        subMesh.bonesOffset    = 16;
+        subMesh.vertexSize     = 24;
+        subMesh.layout.push_back({ "position", VertexElementFormat::Float3,  subMesh.positionOffset  });
+        subMesh.layout.push_back({ "normal",   VertexElementFormat::Short2N, subMesh.normalOffset    });
+        subMesh.layout.push_back({ "bones",    VertexElementFormat::UByte4,  subMesh.bonesOffset     });
+        subMesh.layout.push_back({ "weights",  VertexElementFormat::UByte4N, subMesh.bonesOffset + 4 });
+
+        subMesh.bonePalette.resize(BONE_PALETTE_SIZE + 40);
+        for (uint32_t i = 0; i < BONE_PALETTE_SIZE; ++i)  subMesh.bonePalette[i] = i;
+        for (uint32_t i = 0; i < 40; ++i)  subMesh.bonePalette[BONE_PALETTE_SIZE + i] = 40 + i; // Nodes 40-79
+        subMesh.boneBatches.push_back({ 0, 0, 0, firstBatchVertices, 0, BONE_PALETTE_SIZE });
+        subMesh.boneBatches.push_back({ 0, 0, firstBatchVertices, numVertices - firstBatchVertices, BONE_PALETTE_SIZE, 40 });
+
+        std::mt19937 random(5);
+        std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f), unit(-1.0f, 1.0f), weight(0.0f, 1.0f);
+        subMesh.numVertices = numVertices;
+        subMesh.vertexStorage = std::make_unique<unsigned char[]>(numVertices * subMesh.vertexSize);
+        for (unsigned int v = 0; v < numVertices; ++v)
+        {
+            unsigned char* vertex = subMesh.vertexStorage.get() + v * subMesh.vertexSize;
+            float position[3] = { coordinate(random), coordinate(random), coordinate(random) };
+            std::memcpy(vertex + subMesh.positionOffset, position, sizeof(position));
+            WriteOctahedral(Normalise({ unit(random), unit(random), unit(random) + 0.01f }), vertex + subMesh.normalOffset);
+
+            unsigned int numBones = (v < firstBatchVertices) ? BONE_PALETTE_SIZE : 40;
+            float weights[4] = { weight(random), weight(random), weight(random), weight(random) };
+            float total = weights[0] + weights[1] + weights[2] + weights[3];
+            for (int i = 0; i < 4; ++i)
+            {
+                vertex[subMesh.bonesOffset + i] = static_cast<unsigned char>(random() % numBones);
+                weights[i] /= total;
+            }
+            WriteWeights(weights, vertex + subMesh.bonesOffset + 4);
+        }
+        subMesh.vertices = subMesh.vertexStorage.get();
+        return subMesh;
+    }
+
+    // Largest difference between two arrays of floats
+    float MaxDifference(const std::vector<float>& a, const std::vector<float>& b)
+    {
+        float difference = 0;
+        for (std::size_t i = 0; i < a.size(); ++i)  difference = std::max(difference, std::abs(a[i] - b[i]));
+        return difference;
+    }
+}
+
+
+// Every kernel gives the positions and normals of the weighted sum of each vertex's bones, taken from its own batch's
+// palette, and splitting a sub-mesh across a thread pool or into ranges gives the same results as one call
+void TestCpuSkinning()
+{
+    // Two batches, the boundary not on a multiple of SKINNING_BATCH_SIZE so the thread pool's ranges straddle it
+    const unsigned int numVertices = 3 * SKINNING_BATCH_SIZE + 100;
+    SubMeshData subMesh = MakeSkinnedSubMesh(numVertices, SKINNING_BATCH_SIZE + 1000);
+
+    // A pose for 80 nodes: rotation, scaling near 1 and translation
+    std::mt19937 random(9);
+    std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f), scale(0.8f, 1.25f), position(-5.0f, 5.0f);
+    std::vector<CMatrix4x4> bones(80);
+    for (auto& bone : bones)
+    {
+        bone = MatrixScaling(scale(random)) * MatrixRotationZ(angle(random)) * MatrixRotationX(angle(random)) *
+               MatrixTranslation(CVector3{ position(random), position(random), position(random) });
+    }
+
+    // Expected results worked out directly: each bone transforms the vertex and the results are blended
+    std::vector<float> expectedPositions, expectedNormals;
+    for (unsigned int v = 0; v < numVertices; ++v)
+    {
+        const unsigned char* vertex = subMesh.vertices + v * subMesh.vertexSize;
+        const BoneBatch& batch = subMesh.boneBatches[v < subMesh.boneBatches[1].firstVertex ? 0 : 1];
+        CVector3 p = Position(subMesh, v);
+        CVector3 n = ReadOctahedral(vertex + subMesh.normalOffset);
+        CVector3 skinnedP = { 0, 0, 0 }, skinnedN = { 0, 0, 0 };
+        for (int i = 0; i < 4; ++i)
+        {
+            const CMatrix4x4& bone = bones[subMesh.bonePalette[batch.firstBone + vertex[subMesh.bonesOffset + i]]];
+            float w = ReadWeight(vertex[subMesh.bonesOffset + 4 + i]);
+            skinnedP += w * TransformPoint(p, bone);
+            skinnedN += w * CVector3{ n.x * bone.e00 + n.y * bone.e10 + n.z * bone.e20,
+                                      n.x * bone.e01 + n.y * bone.e11 + n.z * bone.e21,
+                                      n.x * bone.e02 + n.y * bone.e12 + n.z * bone.e22 };
+        }
+        expectedPositions.insert(expectedPositions.end(), { skinnedP.x, skinnedP.y, skinnedP.z });
+        expectedNormals  .insert(expectedNormals  .end(), { skinnedN.x, skinnedN.y, skinnedN.z });
+    }
+
+    std::vector<float> positions(numVertices * 3), normals(numVertices * 3);
+    SkinnedVertexStream output;
+    output.positions = positions.data();
+    output.normals   = normals.data();
+
+    // Scalar kernel against the direct calculation, which sums in a different order
+    MatrixKernel originalKernel = GetMatrixKernel();
+    SetMatrixKernel(MatrixKernel::Scalar);
+    CHECK(SkinSubMesh(subMesh, bones.data(), output));
+    CHECK(MaxDifference(positions, expectedPositions) < 1e-4f);
+    CHECK(MaxDifference(normals, expectedNormals) < 1e-5f);
+    std::vector<float> scalarPositions = positions, scalarNormals = normals;
+
+    // SIMD kernels against the scalar one, single-threaded, then each kernel across a thread pool and as separate
+    // ranges must give exactly its single-threaded results
+    ThreadPool threadPool(3);
+    for (MatrixKernel kernel : { MatrixKernel::Scalar, MatrixKernel::SSE, MatrixKernel::AVX2 })
+    {
+        SetMatrixKernel(kernel);
+        if (GetMatrixKernel() != kernel)  continue;
+
+        std::fill(positions.begin(), positions.end(), 0.0f);
+        std::fill(normals.begin(), normals.end(), 0.0f);
+        CHECK(SkinSubMesh(subMesh, bones.data(), output));
+        CHECK(MaxDifference(positions, scalarPositions) < 1e-5f);
+        CHECK(MaxDifference(normals, scalarNormals) < 1e-6f);
+        std::vector<float> singlePositions = positions, singleNormals = normals;
+
+        std::fill(positions.begin(), positions.end(), 0.0f);
+        std::fill(normals.begin(), normals.end(), 0.0f);
+        CHECK(SkinSubMesh(subMesh, bones.data(), output, &threadPool));
+        CHECK(std::memcmp(positions.data(), singlePositions.data(), positions.size() * sizeof(float)) == 0);
+        CHECK(std::memcmp(normals.data(), singleNormals.data(), normals.size() * sizeof(float)) == 0);
+
+        // A range across the batch boundary writes only its own vertices
+        const unsigned int begin = 100, end = 2 * SKINNING_BATCH_SIZE;
+        std::fill(positions.begin(), positions.end(), -1.0f);
+        CHECK(SkinVertices(subMesh, bones.data(), begin, end, output));
+        CHECK(std::all_of(positions.begin(), positions.begin() + begin * 3, [](float x) { return x == -1.0f; }));
+        CHECK(std::all_of(positions.begin() + end * 3, positions.end(), [](float x) { return x == -1.0f; }));
+        CHECK(std::equal(positions.begin() + begin * 3, positions.begin() + end * 3, singlePositions.begin() + begin * 3));
+    }
+    SetMatrixKernel(originalKernel);
+
+    // Normals can be skipped, and sub-meshes without bones are refused
+    output.normals = nullptr;
+    CHECK(SkinSubMesh(subMesh, bones.data(), output));
+    subMesh.bonesOffset = SubMeshData::NO_ELEMENT;
+    CHECK(!SkinSubMesh(subMesh, bones.data(), output));
+}
@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------
+// Frame allocator tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "FrameAllocator.h"
+#include "HeapAllocationCheck.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+
+namespace
+{
+    // Make a frame's allocations, each filled with its own byte. Returns false if one is misaligned or another's bytes
+    // were overwritten
+    bool AllocateFrame(FrameAllocator& allocator, unsigned int numAllocations)
+    {
+        static const std::size_t sizes[]      = { 1, 7, 16, 33, 64, 3, 100, 250 };
+        static const std::size_t alignments[] = { 16, 4, 64, 16, 32, 1, 8, 16 };
+        unsigned char* allocations[64];
+        bool valid = true;
+        for (unsigned int i = 0; i < numAllocations; ++i)
+        {
+            std::size_t size = sizes[i % 8], alignment = alignments[i % 8];
+            allocations[i] = static_cast<unsigned char*>(allocator.Allocate(size, alignment));
+            valid = valid && (reinterpret_cast<std::uintptr_t>(allocations[i]) & (alignment - 1)) == 0;
+            std::memset(allocations[i], static_cast<int>(i), size);
+        }
+        for (unsigned int i = 0; i < numAllocations; ++i)
+        {
+            for (std::size_t b = 0; b < sizes[i % 8]; ++b)  valid = valid && allocations[i][b] == i;
+        }
+        return valid;
+    }
+}
+
+
+// Allocations are aligned and don't overlap, including in a frame that overflows the buffer, and the next Reset grows
+// the buffer so the same frame then fits without using the heap (counted in Debug builds, see HeapAllocationCheck.h)
+void TestFrameAllocator()
+{
+    FrameAllocator allocator(1024);
+    CHECK(AllocateFrame(allocator, 8));
+    CHECK(allocator.Used() <= allocator.Capacity());
+    CHECK(allocator.Capacity() == 1024);
+
+    CMatrix4x4* matrices = allocator.Allocate<CMatrix4x4>(4);
+    CHECK((reinterpret_cast<std::uintptr_t>(matrices) & 15) == 0);
+
+    // A frame four times the size of the buffer
+    allocator.Reset();
+    CHECK(allocator.Used() == 0);
+    CHECK(AllocateFrame(allocator, 64));
+    std::size_t used = allocator.Used();
+    CHECK(used > allocator.Capacity());
+
+    allocator.Reset();
+    CHECK(allocator.PeakUsed() == used);
+    CHECK(allocator.Capacity() >= used);
+
+    // Now the same frame fits, without the heap, and the buffer stays the same size
+    std::size_t capacity = allocator.Capacity();
+    uint64_t heapAllocations = HeapAllocationCount();
+    CHECK(AllocateFrame(allocator, 64));
+    CHECK(allocator.Used() <= allocator.Capacity());
+    allocator.Reset();
+    CHECK(HeapAllocationCount() == heapAllocations);
+    CHECK(allocator.Capacity() == capacity);
+}
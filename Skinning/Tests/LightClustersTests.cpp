@@ -0,0 +1,81 @@
+//--------------------------------------------------------------------------------------
+// Light clusters tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "LightClusters.h"
+#include "ThreadPool.h"
+#include "MathHelpers.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+
+// Every light is listed in the cluster holding its centre, and building across a thread pool gives the same clusters
+void TestLightClusters()
+{
+    ClusterCamera camera;
+    CMatrix4x4 cameraMatrix = MatrixRotationY(ToRadians(30.0f)) * MatrixTranslation({ 5, 2, -10 });
+    camera.viewMatrix  = InverseAffine(cameraMatrix);
+    camera.tanHalfFOVx = std::tan(ToRadians(45.0f));
+    camera.tanHalfFOVy = camera.tanHalfFOVx * 9 / 16;
+    camera.nearClip    = 0.5f;
+    camera.farClip     = 500.0f;
+
+    // Point lights and spotlights in front of the camera, placed in view space
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> across(-0.9f, 0.9f), depth(2.0f, 300.0f), range(1.0f, 20.0f), unit(-1.0f, 1.0f);
+    std::vector<ClusterLight> lights(500);
+    std::vector<CVector3> viewPositions;
+    for (unsigned int i = 0; i < lights.size(); ++i)
+    {
+        float z = depth(random);
+        CVector3 viewPosition = { across(random) * camera.tanHalfFOVx * z, across(random) * camera.tanHalfFOVy * z, z };
+        viewPositions.push_back(viewPosition);
+        ClusterLight& light = lights[i];
+        light.position     = TransformPoint(viewPosition, cameraMatrix);
+        light.range        = range(random);
+        light.colour       = { 1, 1, 1 };
+        light.cosHalfAngle = (i % 2 == 0) ? -2.0f : 0.8f;
+        light.direction    = Normalise({ unit(random), unit(random), unit(random) + 0.01f });
+        light.shadow       = -1;
+    }
+
+    LightClusterBuilder builder;
+    builder.Build(lights.data(), static_cast<unsigned int>(lights.size()), camera);
+    CHECK(builder.Stats().lights == lights.size());
+    CHECK(builder.Stats().droppedIndices == 0);
+
+    bool listed = true;
+    for (unsigned int i = 0; i < lights.size(); ++i)
+    {
+        const CVector3& p = viewPositions[i];
+        float tileX = (p.x / (p.z * camera.tanHalfFOVx) * 0.5f + 0.5f) * builder.TilesX();
+        float tileY = (0.5f - p.y / (p.z * camera.tanHalfFOVy) * 0.5f) * builder.TilesY();
+        float slice = std::floor(std::log(p.z) * builder.DepthScale() + builder.DepthBias());
+        unsigned int x = std::min(static_cast<unsigned int>(tileX), builder.TilesX() - 1);
+        unsigned int y = std::min(static_cast<unsigned int>(tileY), builder.TilesY() - 1);
+        unsigned int s = static_cast<unsigned int>(std::min(std::max(slice, 0.0f), builder.NumSlices() - 1.0f));
+
+        const ClusterRange& cluster = builder.Clusters()[builder.ClusterIndex(x, y, s)];
+        const unsigned int* first = builder.LightIndices() + cluster.offset;
+        listed = listed && std::find(first, first + cluster.count, i) != first + cluster.count;
+    }
+    CHECK(listed);
+
+    std::vector<ClusterRange> clusters(builder.Clusters(), builder.Clusters() + builder.NumClusters());
+    std::vector<unsigned int> indices(builder.LightIndices(), builder.LightIndices() + builder.Stats().lightIndices);
+    ThreadPool threadPool(3);
+    builder.Build(lights.data(), static_cast<unsigned int>(lights.size()), camera, &threadPool);
+    bool sameClusters = builder.Stats().lightIndices == indices.size();
+    for (unsigned int c = 0; c < builder.NumClusters() && sameClusters; ++c)
+    {
+        const ClusterRange& a = clusters[c];
+        const ClusterRange& b = builder.Clusters()[c];
+        sameClusters = a.count == b.count &&
+                       std::equal(indices.begin() + a.offset, indices.begin() + a.offset + a.count, builder.LightIndices() + b.offset);
+    }
+    CHECK(sameClusters);
+}
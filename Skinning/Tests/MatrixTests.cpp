@@ -0,0 +1,133 @@
+//--------------------------------------------------------------------------------------
+// Matrix batch functions tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+    // Largest difference between products result[i] = m1[i] * m2[m2Index[i]] and the reference results, in units in
+    // the last place of the sum of the sizes of the four terms of each element (as BenchmarkMatrices measures them)
+    float ProductUlps(const CMatrix4x4* result, const CMatrix4x4* reference, const CMatrix4x4* m1, const CMatrix4x4* m2,
+                      const unsigned int* m2Index, unsigned int count)
+    {
+        float maxUlps = 0;
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            const float* a = &m1[i].e00;
+            const float* b = &m2[m2Index != nullptr ? m2Index[i] : i].e00;
+            for (int element = 0; element < 16; ++element)
+            {
+                int row = element / 4, col = element % 4;
+                float magnitude = 0;
+                for (int k = 0; k < 4; ++k)  magnitude += std::abs(a[row * 4 + k] * b[k * 4 + col]);
+                int exponent;
+                std::frexp(std::max(magnitude, FLT_MIN), &exponent);
+                float difference = (&result[i].e00)[element] - (&reference[i].e00)[element];
+                maxUlps = std::max(maxUlps, std::abs(difference) / std::ldexp(1.0f, exponent - 24));
+            }
+        }
+        return maxUlps;
+    }
+}
+
+
+// Every kernel the CPU supports agrees with the single-matrix functions to within MAX_BATCH_ULPS: products, each node of
+// a hierarchy given its parent, and inverses. SSE products are identical to scalar ones
+void TestMatrixKernels()
+{
+    // Random affine matrices like those of a scene's nodes, and hierarchies of 64 nodes like skeletons with each node's
+    // parent one of the few nodes before it
+    const unsigned int count = 1024;
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f), scale(0.8f, 1.25f), position(-100.0f, 100.0f);
+    std::vector<CMatrix4x4> m1(count), m2(count);
+    for (auto* matrices : { &m1, &m2 })
+    {
+        for (auto& m : *matrices)
+        {
+            m = MatrixScaling(CVector3{ scale(random), scale(random), scale(random) }) *
+                MatrixRotationZ(angle(random)) * MatrixRotationX(angle(random)) * MatrixRotationY(angle(random)) *
+                MatrixTranslation(CVector3{ position(random), position(random), position(random) });
+        }
+    }
+    std::vector<unsigned int> parents(count);
+    for (unsigned int i = 1; i < count; ++i)
+    {
+        unsigned int indexInSkeleton = i % 64;
+        parents[i] = (indexInSkeleton == 0) ? 0 : i - 1 - random() % std::min(indexInSkeleton, 4u);
+    }
+
+    // References from the single-matrix functions, which are scalar
+    std::vector<CMatrix4x4> expectedMultiply(count), expectedInverse(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        expectedMultiply[i] = m1[i] * m2[i];
+        expectedInverse[i]  = InverseAffine(m1[i]);
+    }
+
+    MatrixKernel originalKernel = GetMatrixKernel();
+    unsigned int kernelsTested = 0;
+    for (MatrixKernel kernel : { MatrixKernel::Scalar, MatrixKernel::SSE, MatrixKernel::AVX2 })
+    {
+        SetMatrixKernel(kernel);
+        if (GetMatrixKernel() != kernel)  continue;
+        ++kernelsTested;
+
+        std::vector<CMatrix4x4> output(count);
+        MatrixMultiplyBatch(m1.data(), m2.data(), output.data(), count);
+        float multiplyUlps = ProductUlps(output.data(), expectedMultiply.data(), m1.data(), m2.data(), nullptr, count);
+        CHECK(multiplyUlps <= MAX_BATCH_ULPS);
+        if (kernel != MatrixKernel::AVX2)  CHECK(multiplyUlps == 0);
+
+        // The output array can be the same as an input
+        std::vector<CMatrix4x4> inPlace = m1;
+        MatrixMultiplyBatch(inPlace.data(), m2.data(), inPlace.data(), count);
+        CHECK(std::equal(inPlace.begin(), inPlace.end(), output.begin(),
+                         [](const CMatrix4x4& a, const CMatrix4x4& b) { return std::memcmp(&a, &b, sizeof(a)) == 0; }));
+
+        // Each node against the scalar product of its local matrix and this kernel's result for its parent, so rounding
+        // that builds up down the hierarchy isn't counted again at every level
+        MatrixMultiplyHierarchy(m1.data(), parents.data(), output.data(), count);
+        std::vector<CMatrix4x4> expectedHierarchy(count);
+        expectedHierarchy[0] = m1[0];
+        for (unsigned int i = 1; i < count; ++i)  expectedHierarchy[i] = m1[i] * output[parents[i]];
+        CHECK(std::memcmp(&output[0], &m1[0], sizeof(CMatrix4x4)) == 0);
+        float hierarchyUlps = ProductUlps(output.data() + 1, expectedHierarchy.data() + 1, m1.data() + 1, output.data(),
+                                          parents.data() + 1, count - 1);
+        CHECK(hierarchyUlps <= MAX_BATCH_ULPS);
+        if (kernel != MatrixKernel::AVX2)  CHECK(hierarchyUlps == 0);
+
+        // Inverses, measured against the largest element in each row of the expected result
+        InverseAffineBatch(m1.data(), output.data(), count);
+        float inverseUlps = 0;
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            const float* r = &output[i].e00;
+            const float* e = &expectedInverse[i].e00;
+            for (int row = 0; row < 4; ++row, r += 4, e += 4)
+            {
+                float magnitude = 0;
+                for (int col = 0; col < 4; ++col)  magnitude = std::max(magnitude, std::abs(e[col]));
+                int exponent;
+                std::frexp(std::max(magnitude, FLT_MIN), &exponent);
+                for (int col = 0; col < 4; ++col)
+                {
+                    inverseUlps = std::max(inverseUlps, std::abs(r[col] - e[col]) / std::ldexp(1.0f, exponent - 24));
+                }
+            }
+        }
+        CHECK(inverseUlps <= MAX_BATCH_ULPS);
+    }
+    SetMatrixKernel(originalKernel);
+    CHECK(kernelsTested > 0);
+}
@@ -0,0 +1,39 @@
+//--------------------------------------------------------------------------------------
+// Mesh optimizer tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "MeshOptimizer.h"
+
+
+// Reordering keeps the same triangles and improves the vertex cache, and vertices end up in the order they are first used
+void TestMeshOptimizer()
+{
+    SubMeshData sphere = MakeSphere(32, 64, 1.0f);
+    auto originalTriangles = SortedTriangles(sphere);
+    GeometryAnalysis before = AnalyzeGeometry(sphere);
+
+    OptimizeTriangleOrder(sphere);
+    GeometryAnalysis after = AnalyzeGeometry(sphere);
+    CHECK(SortedTriangles(sphere) == originalTriangles);
+    CHECK(after.acmr < before.acmr);
+    CHECK(after.acmr < 0.8f);
+
+    // Positions of each triangle's corners, which vertex reordering must keep
+    std::vector<CVector3> corners;
+    for (uint32_t i = 0; i < sphere.numIndices; ++i)  corners.push_back(Position(sphere, sphere.Index(i)));
+
+    OptimizeVertexFetch(sphere);
+    uint32_t nextVertex = 0;
+    bool firstUseOrder = true, samePositions = true;
+    for (uint32_t i = 0; i < sphere.numIndices; ++i)
+    {
+        uint32_t v = sphere.Index(i);
+        if (v > nextVertex)  firstUseOrder = false;
+        if (v == nextVertex)  ++nextVertex;
+        samePositions = samePositions && Length(Position(sphere, v) - corners[i]) == 0;
+    }
+    CHECK(firstUseOrder);
+    CHECK(samePositions);
+    CHECK(AnalyzeGeometry(sphere).acmr == after.acmr);
+}
@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// Mesh simplifier tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+
+
+// Levels follow the full detail indices, each has fewer triangles than the last, stays within the error limit and only
+// uses the sub-mesh's vertices
+void TestMeshSimplifier()
+{
+    const float radius = 2.0f;
+    SubMeshData sphere = MakeSphere(48, 96, radius);
+    OptimizeTriangleOrder(sphere);
+    OptimizeVertexFetch(sphere);
+    uint32_t fullIndices = sphere.numIndices;
+
+    unsigned int numLevels = GenerateLods(sphere);
+    CHECK(numLevels > 0);
+    CHECK(numLevels <= MAX_LOD_LEVELS);
+    CHECK(numLevels == sphere.lods.size());
+    CHECK(sphere.numIndices == fullIndices);
+
+    uint32_t nextIndex = sphere.numIndices;
+    uint32_t lastIndices = sphere.numIndices;
+    float lastError = 0;
+    for (auto& level : sphere.lods)
+    {
+        CHECK(level.firstIndex == nextIndex);
+        CHECK(level.numIndices > 0 && level.numIndices % 3 == 0);
+        CHECK(level.numIndices <= lastIndices * LOD_MIN_REDUCTION);
+        CHECK(level.error >= lastError);
+        CHECK(level.error <= LOD_MAX_ERROR * radius);
+
+        bool validIndices = true;
+        for (uint32_t i = level.firstIndex; i < level.firstIndex + level.numIndices; ++i)  validIndices = validIndices && sphere.Index(i) < sphere.numVertices;
+        CHECK(validIndices);
+
+        nextIndex   = level.firstIndex + level.numIndices;
+        lastIndices = level.numIndices;
+        lastError   = level.error;
+    }
+    CHECK(nextIndex == sphere.TotalIndices());
+}
@@ -0,0 +1,176 @@
+//--------------------------------------------------------------------------------------
+// Mesh tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "Mesh.h"
+#include "Common.h"
+#include "StateCache.h"
+#include "FrameAllocator.h"
+
+#include <vector>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+    // A buffer update: the buffer and a copy of the bytes sent
+    struct Upload
+    {
+        ID3D11Buffer*              buffer;
+        std::vector<unsigned char> data;
+    };
+
+    // A draw: indices and instances drawn, 0 instances for a draw that isn't instanced
+    struct Draw
+    {
+        UINT numIndices;
+        UINT numInstances;
+    };
+
+    // Records the uploads and draws the cache forwards, drops the state changes
+    class UploadSink : public StateSink
+    {
+    public:
+        std::vector<Upload> uploads;
+        std::vector<Draw>   draws;
+
+        void UpdateBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size) override
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            uploads.push_back({ buffer, std::vector<unsigned char>(bytes, bytes + size) });
+        }
+        void DrawIndexed(UINT numIndices, UINT /*firstIndex*/, INT /*baseVertex*/) override
+        {
+            draws.push_back({ numIndices, 0 });
+        }
+        void DrawIndexedInstanced(UINT numIndices, UINT numInstances, UINT /*firstIndex*/, INT /*baseVertex*/,
+                                  UINT /*firstInstance*/) override
+        {
+            draws.push_back({ numIndices, numInstances });
+        }
+
+        void Clear()
+        {
+            uploads.clear();
+            draws.clear();
+        }
+    };
+
+    // The default matrices of a mesh's nodes, as a new model has
+    std::vector<CMatrix4x4> DefaultMatrices(Mesh& mesh)
+    {
+        std::vector<CMatrix4x4> matrices(mesh.NumberNodes());
+        for (unsigned int node = 0; node < matrices.size(); ++node)  matrices[node] = mesh.GetNodeDefaultMatrix(node);
+        return matrices;
+    }
+
+    // True if the matrix is a translation by the given amount along x (the chain meshes' absolute matrices)
+    bool IsTranslationX(const unsigned char* matrixBytes, float x)
+    {
+        CMatrix4x4 m;
+        std::memcpy(&m, matrixBytes, sizeof(m));
+        CMatrix4x4 expected = MatrixTranslation({ x, 0, 0 });
+        for (int i = 0; i < 16; ++i)
+        {
+            if (std::abs((&m.e00)[i] - (&expected.e00)[i]) > 1e-5f)  return false;
+        }
+        return true;
+    }
+}
+
+
+// Meshes made without a device render through the state cache's sink. A rigid mesh uploads the 80 byte per-model
+// constants once per node, a skinned mesh uploads them once then each bone batch's palette, 64 bytes per bone, and
+// instanced copies are uploaded MAX_INSTANCES at a time. With the bone palette in the per-model constants, each
+// per-model or palette upload would be the combined 4176 bytes
+void TestMesh()
+{
+    CHECK(sizeof(PerModelConstants) == 80);
+    CHECK(sizeof(PerModelConstants) + sizeof(PerSkeletonConstants) == 4176);
+
+    UploadSink sink;
+    StateSink* previousSink = gStateCache.Sink();
+    gStateCache.SetSink(&sink);
+
+    // Rigid: one upload and one draw of the whole sphere for each node, each with that node's absolute matrix
+    const unsigned int numRigidNodes = 4;
+    Mesh rigid(MakeRigidMeshData(numRigidNodes));
+    const unsigned int sphereIndices = rigid.GetData().subMeshes[0].numIndices;
+    std::vector<CMatrix4x4> rigidMatrices = DefaultMatrices(rigid);
+    rigid.Render(rigidMatrices);
+
+    CHECK(sink.uploads.size() == numRigidNodes);
+    CHECK(sink.draws.size() == numRigidNodes);
+    std::size_t rigidBytes = 0;
+    for (unsigned int i = 0; i < sink.uploads.size() && i < sink.draws.size(); ++i)
+    {
+        const Upload& upload = sink.uploads[i];
+        CHECK(upload.buffer == gPerModelConstantBuffer);
+        CHECK(upload.data.size() == sizeof(PerModelConstants));
+        CHECK(IsTranslationX(upload.data.data(), static_cast<float>(i)));
+        CHECK(sink.draws[i].numIndices == sphereIndices && sink.draws[i].numInstances == 0);
+        rigidBytes += upload.data.size();
+    }
+    CHECK(rigidBytes == numRigidNodes * 80);
+
+    // Skinned: the per-model constants once, then for each batch its palette followed by its draw. The second batch's
+    // palette starts with the middle node, shared with the first batch
+    sink.Clear();
+    const unsigned int numSkinnedNodes = 7, middle = numSkinnedNodes / 2;
+    Mesh skinned(MakeSkinnedMeshData(numSkinnedNodes));
+    const auto& batches = skinned.GetData().subMeshes[0].boneBatches;
+    std::vector<CMatrix4x4> skinnedMatrices = DefaultMatrices(skinned);
+    skinned.Render(skinnedMatrices);
+
+    CHECK(sink.uploads.size() == 3);
+    CHECK(sink.draws.size() == 2);
+    if (sink.uploads.size() == 3 && sink.draws.size() == 2)
+    {
+        CHECK(sink.uploads[0].buffer == gPerModelConstantBuffer);
+        CHECK(sink.uploads[0].data.size() == sizeof(PerModelConstants));
+        for (unsigned int b = 0; b < 2; ++b)
+        {
+            const Upload& palette = sink.uploads[1 + b];
+            CHECK(palette.buffer == gPerSkeletonConstantBuffer);
+            CHECK(palette.data.size() == batches[b].numBones * sizeof(CMatrix4x4));
+            CHECK(sink.draws[b].numIndices == batches[b].numIndices);
+        }
+        CHECK(sink.uploads[1].data.size() == (middle + 1) * 64);
+        CHECK(sink.uploads[2].data.size() == (numSkinnedNodes - middle) * 64);
+        CHECK(IsTranslationX(sink.uploads[2].data.data(), static_cast<float>(middle)));
+        CHECK(IsTranslationX(sink.uploads[2].data.data() + 64, static_cast<float>(middle + 1)));
+        CHECK(batches[0].numIndices + batches[1].numIndices == sphereIndices);
+    }
+    std::size_t skinnedBytes = 0;
+    for (auto& upload : sink.uploads)  skinnedBytes += upload.data.size();
+    CHECK(skinnedBytes == 80 + (numSkinnedNodes + 1) * 64);
+
+    // Instanced: full instance buffers then the rest, each drawn with one call
+    sink.Clear();
+    Mesh single(MakeRigidMeshData(1));
+    CHECK(single.CanRenderInstanced() && !rigid.CanRenderInstanced() && !skinned.CanRenderInstanced());
+    const unsigned int numInstances = MAX_INSTANCES + 44;
+    std::vector<InstanceData> instances(numInstances);
+    single.RenderInstanced(instances.data(), numInstances);
+    CHECK(sink.uploads.size() == 2 && sink.draws.size() == 2);
+    if (sink.uploads.size() == 2 && sink.draws.size() == 2)
+    {
+        CHECK(sink.uploads[0].buffer == gInstanceBuffer && sink.uploads[0].data.size() == MAX_INSTANCES * sizeof(InstanceData));
+        CHECK(sink.uploads[1].buffer == gInstanceBuffer && sink.uploads[1].data.size() == 44 * sizeof(InstanceData));
+        CHECK(sink.draws[0].numInstances == MAX_INSTANCES && sink.draws[1].numInstances == 44);
+        CHECK(sink.draws[0].numIndices == sphereIndices);
+    }
+
+    // The report swaps in its own sink and puts this one back
+    sink.Clear();
+    Mesh* meshes[] = { &rigid, &skinned };
+    const char* names[] = { "Rigid", "Skinned" };
+    CHECK(!ReportConstantUploads(meshes, names, 2).empty());
+    CHECK(gStateCache.Sink() == &sink);
+    CHECK(sink.uploads.empty() && sink.draws.empty());
+
+    gStateCache.SetSink(previousSink);
+    gFrameAllocator.Reset();
+}
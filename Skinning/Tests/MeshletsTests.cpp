@@ -0,0 +1,110 @@
+//--------------------------------------------------------------------------------------
+// Meshlets tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "Meshlets.h"
+#include "MeshOptimizer.h"
+#include "MathHelpers.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+
+// Meshlets cover the optimized triangles in order without changing them, stay within the size limits and have bounds
+// that hold their triangles. Culling never drops a meshlet with a triangle facing the camera inside the view
+void TestMeshlets()
+{
+    SubMeshData sphere = MakeSphere(32, 64, 1.0f);
+    OptimizeTriangleOrder(sphere);
+    std::vector<uint32_t> optimized(Indices32(sphere), Indices32(sphere) + sphere.numIndices);
+    float acmr = AnalyzeGeometry(sphere).acmr;
+
+    unsigned int numMeshlets = BuildMeshlets(sphere);
+    CHECK(numMeshlets > 1);
+    CHECK(numMeshlets == sphere.meshlets.size());
+    CHECK(std::equal(optimized.begin(), optimized.end(), Indices32(sphere)));
+    CHECK(AnalyzeGeometry(sphere).acmr == acmr);
+
+    uint32_t nextIndex = 0;
+    bool inOrder = true, withinLimits = true, insideSphere = true, insideCone = true;
+    for (auto& meshlet : sphere.meshlets)
+    {
+        inOrder = inOrder && meshlet.firstIndex == nextIndex && meshlet.numIndices > 0 && meshlet.numIndices % 3 == 0;
+        nextIndex = meshlet.firstIndex + meshlet.numIndices;
+
+        std::vector<uint32_t> vertices(Indices32(sphere) + meshlet.firstIndex, Indices32(sphere) + nextIndex);
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+        withinLimits = withinLimits && vertices.size() <= MESHLET_MAX_VERTICES && meshlet.numIndices / 3 <= MESHLET_MAX_TRIANGLES;
+
+        CVector3 centre(meshlet.centre);
+        for (auto v : vertices)  insideSphere = insideSphere && Length(Position(sphere, v) - centre) <= meshlet.radius * 1.0001f;
+
+        // The cone reaches every triangle normal: the sine of its angle from the axis is no more than the cutoff
+        if (meshlet.coneCutoff < 1)
+        {
+            for (uint32_t i = meshlet.firstIndex; i < nextIndex; i += 3)
+            {
+                const uint32_t* t = Indices32(sphere) + i;
+                CVector3 normal = Cross(Position(sphere, t[1]) - Position(sphere, t[0]), Position(sphere, t[2]) - Position(sphere, t[0]));
+                if (Length(normal) == 0)  continue;
+                float dot = Dot(Normalise(normal), CVector3(meshlet.coneAxis));
+                insideCone = insideCone && dot > 0 && std::sqrt(std::max(1 - dot * dot, 0.0f)) <= meshlet.coneCutoff + 0.001f;
+            }
+        }
+    }
+    CHECK(inOrder);
+    CHECK(nextIndex == sphere.numIndices);
+    CHECK(withinLimits);
+    CHECK(insideSphere);
+    CHECK(insideCone);
+
+    // Camera 3 units from the sphere looking at it from a few directions, with a narrow view so some meshlets are also
+    // outside the frustum
+    MeshletStats stats;
+    for (int direction = 0; direction < 4; ++direction)
+    {
+        CMatrix4x4 cameraMatrix = MatrixTranslation({ 0.3f, 0, -3 }) * MatrixRotationY(direction * PI * 0.5f);
+        MeshletView view;
+        view.viewProjection = InverseAffine(cameraMatrix) * ProjectionMatrix(ToRadians(30.0f), 1.0f, 0.1f, 100.0f);
+        view.cameraPosition = cameraMatrix.GetRow(3);
+
+        std::vector<uint32_t> ranges(sphere.meshlets.size() * 2);
+        MeshletNodeView nodeView = MakeMeshletNodeView(view, MatrixIdentity());
+        unsigned int numRanges = CullMeshlets(sphere.meshlets.data(), numMeshlets, nodeView, ranges.data(), view.stats);
+        stats.tested        += view.stats.tested;
+        stats.frustumCulled += view.stats.frustumCulled;
+        stats.backFacing    += view.stats.backFacing;
+
+        bool keptVisible = true;
+        for (auto& meshlet : sphere.meshlets)
+        {
+            bool drawn = false;
+            for (unsigned int r = 0; r < numRanges; ++r)
+            {
+                drawn = drawn || (meshlet.firstIndex >= ranges[r * 2] && meshlet.firstIndex < ranges[r * 2] + ranges[r * 2 + 1]);
+            }
+
+            bool visible = false;
+            for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.numIndices && !visible; i += 3)
+            {
+                const uint32_t* t = Indices32(sphere) + i;
+                CVector3 a = Position(sphere, t[0]), b = Position(sphere, t[1]), c = Position(sphere, t[2]);
+                if (Dot(Cross(b - a, c - a), view.cameraPosition - a) <= 0)  continue; // Back face
+
+                for (auto& corner : { a, b, c })
+                {
+                    CVector3 p = Project(corner, view.viewProjection);
+                    visible = visible || (std::abs(p.x) <= 1 && std::abs(p.y) <= 1 && p.z >= 0 && p.z <= 1);
+                }
+            }
+            keptVisible = keptVisible && (drawn || !visible);
+        }
+        CHECK(keptVisible);
+    }
+    CHECK(stats.tested == numMeshlets * 4);
+    CHECK(stats.backFacing > 0);
+    CHECK(stats.frustumCulled > 0);
+}
@@ -0,0 +1,128 @@
+//--------------------------------------------------------------------------------------
+// Occlusion culling tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "OcclusionCulling.h"
+#include "ThreadPool.h"
+#include "MathHelpers.h"
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cmath>
+
+
+// Camera.cpp, linked in for the occlusion benchmark, uses these from Scene.cpp, which isn't part of the tests
+extern const float ROTATION_SPEED = 2.0f;
+extern const float MOVEMENT_SPEED = 50.0f;
+
+
+namespace
+{
+    // A single quad facing -z (towards a camera at the origin looking along z), centred on the given point
+    SubMeshData MakeWall(const CVector3& centre, float halfWidth, float halfHeight)
+    {
+        SubMeshData subMesh;
+        subMesh.positionOffset = 0;
+        subMesh.vertexSize     = 12;
+        subMesh.layout.push_back({ "position", VertexElementFormat::Float3, subMesh.positionOffset });
+
+        const float corners[4][3] = { { centre.x - halfWidth, centre.y + halfHeight, centre.z },
+                                      { centre.x + halfWidth, centre.y + halfHeight, centre.z },
+                                      { centre.x - halfWidth, centre.y - halfHeight, centre.z },
+                                      { centre.x + halfWidth, centre.y - halfHeight, centre.z } };
+        const uint32_t indices[6] = { 0, 1, 2, 1, 3, 2 };
+        subMesh.numVertices = 4;
+        subMesh.numIndices  = 6;
+        subMesh.vertexStorage = std::make_unique<unsigned char[]>(sizeof(corners));
+        subMesh.indexStorage  = std::make_unique<unsigned char[]>(sizeof(indices));
+        std::memcpy(subMesh.vertexStorage.get(), corners, sizeof(corners));
+        std::memcpy(subMesh.indexStorage.get(), indices, sizeof(indices));
+        subMesh.vertices = subMesh.vertexStorage.get();
+        subMesh.indices  = subMesh.indexStorage.get();
+        return subMesh;
+    }
+}
+
+
+// Boxes fully behind an occluder are hidden, anything that shows past it - even by less than a pixel - is not. Every
+// kernel draws the same depths
+void TestOcclusionCulling()
+{
+    // A wall 40 units across and 50 away, covering about half the view
+    SubMeshData wall = MakeWall({ 0, 0, 50 }, 20, 20);
+    CMatrix4x4 viewProjection = ProjectionMatrix(ToRadians(60.0f), 4.0f / 3.0f, 1.0f, 1000.0f);
+
+    OcclusionBuffer buffer;
+    auto render = [&](ThreadPool* threadPool)
+    {
+        buffer.Begin(viewProjection);
+        buffer.AddOccluder(wall, MatrixIdentity());
+        buffer.Render(threadPool);
+    };
+    auto box = [](const CVector3& minimum, const CVector3& maximum)
+    {
+        AABB result;
+        result.Add(minimum);
+        result.Add(maximum);
+        return result;
+    };
+
+    // Depths drawn by each kernel supported here, and across a thread pool, agree to within rounding
+    MatrixKernel originalKernel = GetMatrixKernel();
+    SetMatrixKernel(MatrixKernel::Scalar);
+    render(nullptr);
+    std::vector<float> reference;
+    for (unsigned int y = 0; y < buffer.Height(); ++y)
+    {
+        for (unsigned int x = 0; x < buffer.Width(); ++x)  reference.push_back(buffer.PixelDepth(x, y));
+    }
+    ThreadPool threadPool(2);
+    for (int kernel = 0; kernel < 4; ++kernel)
+    {
+        SetMatrixKernel(static_cast<MatrixKernel>(std::min(kernel, 2)));
+        if (GetMatrixKernel() != static_cast<MatrixKernel>(std::min(kernel, 2)))  continue;
+        render(kernel == 3 ? &threadPool : nullptr);
+
+        unsigned int mismatches = 0;
+        for (unsigned int y = 0; y < buffer.Height(); ++y)
+        {
+            for (unsigned int x = 0; x < buffer.Width(); ++x)
+            {
+                mismatches += std::abs(buffer.PixelDepth(x, y) - reference[y * buffer.Width() + x]) > 1e-6f;
+            }
+        }
+        CHECK(mismatches == 0);
+    }
+    SetMatrixKernel(originalKernel);
+
+    CHECK(buffer.Stats().rasterized > 0);
+    CHECK(!buffer.IsVisible(box({ -5, -5, 100 }, { 5, 5, 110 })));   // Behind the middle of the wall
+    CHECK(!buffer.IsVisible(box({ -35, -35, 100 }, { 35, 35, 101 }))); // Just inside the wall's outline from here
+    CHECK(buffer.IsVisible(box({ -5, -5, 20 }, { 5, 5, 30 })));      // In front of the wall
+    CHECK(buffer.IsVisible(box({ -5, -5, 45 }, { 5, 5, 55 })));      // Through the wall
+    CHECK(buffer.IsVisible(box({ 50, -5, 100 }, { 60, 5, 110 })));   // Beside the wall
+    CHECK(buffer.IsVisible(box({ -21, -21, 50 }, { 21, 21, 50 })));  // The wall's own bounds
+    CHECK(buffer.IsVisible(box({ -5, -5, -10 }, { 5, 5, 10 })));     // Around the camera
+
+    // Boxes far behind the wall reaching a tiny distance past each edge, much less than a pixel
+    CHECK(buffer.IsVisible(box({ 0, -5, 200 }, { 80.05f, 5, 201 })));
+    CHECK(buffer.IsVisible(box({ -80.05f, -5, 200 }, { 0, 5, 201 })));
+    CHECK(buffer.IsVisible(box({ -5, 0, 200 }, { 5, 80.05f, 201 })));
+    CHECK(buffer.IsVisible(box({ -5, -80.05f, 200 }, { 5, 0, 201 })));
+    CHECK(!buffer.IsVisible(box({ -5, -5, 200 }, { 5, 5, 201 })));
+
+    // The seam between the wall's two triangles runs through the middle of the screen and must still be covered
+    CHECK(buffer.PixelDepth(buffer.Width() / 2, buffer.Height() / 2) < 1);
+
+    // A dense sphere of small triangles hides what is behind its middle, but not what peeks past its outline
+    SubMeshData sphere = MakeSphere(32, 64, 20.0f);
+    buffer.Begin(viewProjection);
+    buffer.AddOccluder(sphere, MatrixTranslation({ 0, 0, 50 }));
+    buffer.Render();
+    CHECK(!buffer.IsVisible(box({ -5, -5, 100 }, { 5, 5, 101 })));
+    CHECK(buffer.IsVisible(box({ -5, 15, 100 }, { 5, 45, 101 })));
+    CHECK(buffer.IsVisible(box({ -5, -5, 20 }, { 5, 5, 25 })));
+}
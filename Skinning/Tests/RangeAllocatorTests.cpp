@@ -0,0 +1,58 @@
+//--------------------------------------------------------------------------------------
+// Range allocator tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "RangeAllocator.h"
+
+#include <vector>
+
+
+// Allocations never overlap, frees merge gaps, and compaction packs everything at the start keeping the order
+void TestRangeAllocator()
+{
+    RangeAllocator allocator(100);
+    CHECK(allocator.Allocate(0) == RangeAllocator::INVALID_OFFSET);
+    CHECK(allocator.Allocate(101) == RangeAllocator::INVALID_OFFSET);
+
+    uint32_t a = allocator.Allocate(10);
+    uint32_t b = allocator.Allocate(20);
+    uint32_t c = allocator.Allocate(30);
+    CHECK(a != RangeAllocator::INVALID_OFFSET && b != RangeAllocator::INVALID_OFFSET && c != RangeAllocator::INVALID_OFFSET);
+    CHECK(a + 10 <= b || b + 20 <= a);
+    CHECK(b + 20 <= c || c + 30 <= b);
+    CHECK(a + 10 <= c || c + 30 <= a);
+    CHECK(allocator.AllocationSize(b) == 20);
+    CHECK(allocator.Stats().used == 60);
+    CHECK(allocator.Stats().allocations == 3);
+
+    CHECK(allocator.Free(b));
+    CHECK(!allocator.Free(b));
+    CHECK(allocator.AllocationSize(b) == 0);
+    CHECK(allocator.Stats().used == 40);
+    CHECK(allocator.Stats().largestFree == 40);
+    CHECK(allocator.Stats().Fragmentation() > 0);
+    CHECK(allocator.Allocate(41) == RangeAllocator::INVALID_OFFSET);
+    CHECK(!allocator.IsCompact());
+
+    std::vector<RangeAllocator::Move> moves;
+    allocator.Compact(moves);
+    CHECK(moves.size() == 2);
+    CHECK(allocator.IsCompact());
+    CHECK(allocator.Stats().freeBlocks == 1);
+    CHECK(allocator.Stats().largestFree == 60);
+    CHECK(allocator.Stats().Fragmentation() == 0);
+    uint32_t offset = 0;
+    for (auto& move : moves)
+    {
+        CHECK(move.to == offset && move.to <= move.from);
+        CHECK(allocator.AllocationSize(move.to) == move.size);
+        offset += move.size;
+    }
+
+    // Freeing everything leaves one block of the whole space
+    for (auto& move : moves)  allocator.Free(move.to);
+    CHECK(allocator.Stats().used == 0);
+    CHECK(allocator.Stats().freeBlocks == 1);
+    CHECK(allocator.Allocate(100) == 0);
+}
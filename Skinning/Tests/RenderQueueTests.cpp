@@ -0,0 +1,142 @@
+//--------------------------------------------------------------------------------------
+// Render queue tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "RenderQueue.h"
+#include "Model.h"
+#include "Mesh.h"
+#include "Meshlets.h"
+#include "MeshOptimizer.h"
+#include "MathHelpers.h"
+#include "StateCache.h"
+#include "FrameAllocator.h"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+
+namespace
+{
+    // Counts the draw calls the cache forwards, drops everything else
+    class DrawCountingSink : public StateSink
+    {
+    public:
+        unsigned int draws = 0;
+        unsigned int instancedDraws = 0;
+        unsigned int instances = 0; // Drawn by all the instanced draws
+
+        void DrawIndexed(UINT, UINT, INT) override  { ++draws; }
+        void DrawIndexedInstanced(UINT, UINT numInstances, UINT, INT, UINT) override
+        {
+            ++draws;
+            ++instancedDraws;
+            instances += numInstances;
+        }
+
+        void Clear()  { draws = instancedDraws = instances = 0; }
+    };
+
+    // Stand-in for a D3D object, only its address is used
+    template <class T>
+    T* Object(uintptr_t id)
+    {
+        return reinterpret_cast<T*>(id * 16);
+    }
+}
+
+
+// Submit headless, with the state cache forwarding to a sink that counts draw calls. The draw calls in the stats are
+// the calls that reached the sink: instanced runs of a single node mesh take one call, or one per model without
+// instancing, multi-node meshes take a call per node, skinned meshes one per bone batch and meshes with meshlets one
+// per range of visible meshlets. Models outside the view make no calls
+void TestRenderQueue()
+{
+    DrawCountingSink sink;
+    StateSink* previousSink = gStateCache.Sink();
+    gStateCache.SetSink(&sink);
+
+    RenderMaterial material;
+    material.vertexShader          = Object<ID3D11VertexShader>(1);
+    material.instancedVertexShader = Object<ID3D11VertexShader>(2);
+    material.pixelShader           = Object<ID3D11PixelShader>(1);
+
+    const unsigned int numChainNodes = 3;
+    Mesh single(MakeRigidMeshData(1)), chain(MakeRigidMeshData(numChainNodes)), skinned(MakeSkinnedMeshData(5));
+
+    // In front of the camera, which is at the origin looking along z: a row of single node models and a few of the
+    // others. Behind it: more single node models, which are culled
+    const unsigned int numSingle = 10, numBehind = 4, numChain = 2, numSkinned = 2;
+    std::vector<std::unique_ptr<Model>> models;
+    for (unsigned int i = 0; i < numSingle; ++i)  models.push_back(std::make_unique<Model>(&single, CVector3{ 0, 0, 10.0f + 2 * i }));
+    for (unsigned int i = 0; i < numBehind; ++i)  models.push_back(std::make_unique<Model>(&single, CVector3{ 0, 0, -10.0f - 2 * i }));
+    for (unsigned int i = 0; i < numChain; ++i)   models.push_back(std::make_unique<Model>(&chain, CVector3{ -2, 1, 15.0f + i }));
+    for (unsigned int i = 0; i < numSkinned; ++i) models.push_back(std::make_unique<Model>(&skinned, CVector3{ -2, -1, 15.0f + i }));
+
+    CMatrix4x4 viewProjection = ProjectionMatrix(ToRadians(60.0f), 4.0f / 3.0f, 1.0f, 1000.0f);
+    RenderQueue queue(64);
+    auto submit = [&]()
+    {
+        sink.Clear();
+        queue.ResetStats();
+        queue.Begin({ 0, 0, 0 }, viewProjection);
+        for (auto& model : models)  queue.Add(model.get(), &material);
+        queue.Submit();
+    };
+
+    // With instancing the single node models are one instanced draw of all of them
+    const unsigned int otherCalls = numChain * numChainNodes + numSkinned * 2;
+    submit();
+    const RenderQueueStats& stats = queue.Stats();
+    CHECK(stats.drawCalls == sink.draws);
+    CHECK(stats.drawCalls == 1 + otherCalls);
+    CHECK(sink.instancedDraws == 1 && sink.instances == numSingle);
+    CHECK(stats.instanced == numSingle);
+    CHECK(stats.draws == numSingle + numChain + numSkinned);
+    CHECK(stats.culled == numBehind);
+
+    // Without, each is a draw call of its own
+    queue.SetInstancing(false);
+    submit();
+    CHECK(stats.drawCalls == sink.draws);
+    CHECK(stats.drawCalls == numSingle + otherCalls);
+    CHECK(sink.instancedDraws == 0 && stats.instanced == 0);
+
+    // The calls accumulate in the stats over several Submits until reset, as the bind counts do
+    queue.Begin({ 0, 0, 0 }, viewProjection);
+    queue.Add(models[0].get(), &material);
+    queue.Submit();
+    CHECK(stats.drawCalls == numSingle + otherCalls + 1);
+
+    // A mesh with meshlets, seen from close by so some of them face away: one call per range of visible meshlets, the
+    // same ranges CullMeshlets finds for the view on its own
+    MeshData meshletData;
+    meshletData.subMeshes.push_back(MakeSphere(32, 64, 1.0f));
+    OptimizeTriangleOrder(meshletData.subMeshes[0]);
+    unsigned int numMeshlets = BuildMeshlets(meshletData.subMeshes[0]);
+    meshletData.nodes = MakeRigidMeshData(1).nodes;
+    Mesh meshletMesh(std::move(meshletData));
+    Model meshletModel(&meshletMesh, { 0, 0, 4 });
+
+    MeshletView view;
+    view.viewProjection = viewProjection;
+    view.cameraPosition = { 0, 0, 0 };
+    std::vector<uint32_t> ranges(numMeshlets * 2);
+    const auto& meshlets = meshletMesh.GetData().subMeshes[0].meshlets;
+    unsigned int numRanges = CullMeshlets(meshlets.data(), numMeshlets, MakeMeshletNodeView(view, meshletModel.WorldMatrix()),
+                                          ranges.data(), view.stats);
+    CHECK(numMeshlets > 1 && view.stats.backFacing > 0);
+
+    queue.ResetStats();
+    sink.Clear();
+    queue.Begin({ 0, 0, 0 }, viewProjection);
+    queue.Add(&meshletModel, &material);
+    queue.Submit();
+    CHECK(stats.drawCalls == sink.draws);
+    CHECK(stats.drawCalls == numRanges);
+    CHECK(stats.meshlets == numMeshlets && stats.meshletsCulled > 0);
+
+    gStateCache.SetSink(previousSink);
+    gFrameAllocator.Reset();
+}
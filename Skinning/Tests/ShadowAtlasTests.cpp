@@ -0,0 +1,74 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "ShadowAtlas.h"
+
+
+// Tiles are inside the atlas and never overlap, are kept while the same size is asked for, and shrink when there is no
+// room, most important views first
+void TestShadowAtlas()
+{
+    ShadowAtlas atlas(1024, 64, 8);
+    auto tilesValid = [&](unsigned int numViews)
+    {
+        bool valid = true;
+        for (unsigned int i = 0; i < numViews; ++i)
+        {
+            const ShadowAtlasTile& a = atlas.Tile(i);
+            if (a.size == 0)  continue;
+            valid = valid && a.x + a.size <= atlas.AtlasSize() && a.y + a.size <= atlas.AtlasSize();
+            for (unsigned int j = i + 1; j < numViews; ++j)
+            {
+                const ShadowAtlasTile& b = atlas.Tile(j);
+                bool apart = b.size == 0 || a.x + a.size <= b.x || b.x + b.size <= a.x || a.y + a.size <= b.y || b.y + b.size <= a.y;
+                valid = valid && apart;
+            }
+        }
+        return valid;
+    };
+
+    ShadowAtlasRequest requests[8];
+    for (unsigned int i = 0; i < 8; ++i)  requests[i] = { (i < 2) ? 512u : 256u, 1.0f - i * 0.1f };
+    atlas.Allocate(requests, 8);
+    CHECK(tilesValid(8));
+    bool allFull = true, allChanged = true;
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+        allFull    = allFull && atlas.Tile(i).size == requests[i].size;
+        allChanged = allChanged && atlas.TileChanged(i);
+    }
+    CHECK(allFull);
+    CHECK(allChanged);
+    CHECK(atlas.Usage() == 0.875f);
+
+    // The same requests again keep every tile
+    atlas.Allocate(requests, 8);
+    bool noneChanged = true;
+    for (unsigned int i = 0; i < 8; ++i)  noneChanged = noneChanged && !atlas.TileChanged(i);
+    CHECK(noneChanged);
+
+    // One view asking for the whole atlas gets it only if it is the most important, the others then get less or nothing
+    requests[7] = { 1024, 2.0f };
+    atlas.Allocate(requests, 8);
+    CHECK(tilesValid(8));
+    CHECK(atlas.Tile(7).size == 1024);
+    CHECK(atlas.Tile(0).size < 512);
+
+    // A view that isn't needed gives up its tile
+    requests[7] = { 0, 0 };
+    atlas.Allocate(requests, 8);
+    CHECK(tilesValid(8));
+    CHECK(atlas.Tile(7).size == 0);
+    CHECK(atlas.Tile(0).size == 512);
+
+    CHECK(ShadowTileSize(0, 1024, 64) == 0);
+    CHECK(ShadowTileSize(1, 1024, 64) == 1024);
+    CHECK(ShadowTileSize(0.3f, 1024, 64) == 512);
+    CHECK(ShadowTileSize(0.001f, 1024, 64) == 64);
+
+    BoundingSphere light = { { 0, 0, 10 }, 2 };
+    CHECK(ShadowImportance(light, { 0, 0, 11 }, 1.0f) == 1);
+    CHECK(ShadowImportance(light, { 0, 0, 0 }, 1.0f) > ShadowImportance(light, { 0, 0, -100 }, 1.0f));
+}
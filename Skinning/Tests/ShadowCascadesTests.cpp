@@ -0,0 +1,50 @@
+//--------------------------------------------------------------------------------------
+// Shadow cascades tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "ShadowCascades.h"
+#include "MathHelpers.h"
+
+#include <cmath>
+
+
+// Splits run from the near to the far clip, and each cascade's matrices hold the whole of its slice of the view
+void TestShadowCascades()
+{
+    const unsigned int numCascades = 4;
+    float splits[numCascades + 1];
+    CalculateCascadeSplits(0.5f, 200.0f, numCascades, 0.7f, splits);
+    CHECK(splits[0] == 0.5f);
+    CHECK(splits[numCascades] == 200.0f);
+    bool increasing = true;
+    for (unsigned int i = 0; i < numCascades; ++i)  increasing = increasing && splits[i] < splits[i + 1];
+    CHECK(increasing);
+
+    // A camera turned and raised, a light shining down at an angle, and shadow casters around the view
+    CMatrix4x4 cameraMatrix = MatrixRotationX(ToRadians(20.0f)) * MatrixRotationY(ToRadians(35.0f)) * MatrixTranslation({ 10, 5, -20 });
+    float tanHalfFOVx = std::tan(ToRadians(45.0f)), tanHalfFOVy = tanHalfFOVx * 9 / 16;
+    CVector3 lightDirection = Normalise({ 0.3f, -1.0f, 0.4f });
+    AABB casterBounds;
+    casterBounds.Add({ -200, -10, -200 });
+    casterBounds.Add({  200,  50,  200 });
+
+    for (unsigned int i = 0; i < numCascades; ++i)
+    {
+        ShadowCascade cascade = CalculateShadowCascade(cameraMatrix, tanHalfFOVx, tanHalfFOVy, splits[i], splits[i + 1],
+                                                       lightDirection, casterBounds, 1024, 2);
+        CMatrix4x4 viewProjection = cascade.viewMatrix * cascade.projectionMatrix;
+        bool cornersInside = true, cornersCovered = true;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            float distance = (corner & 4) ? splits[i + 1] : splits[i];
+            CVector3 local = { ((corner & 1) ? 1 : -1) * tanHalfFOVx * distance, ((corner & 2) ? 1 : -1) * tanHalfFOVy * distance, distance };
+            CVector3 world = TransformPoint(local, cameraMatrix);
+            CVector3 p = Project(world, viewProjection);
+            cornersInside  = cornersInside && std::abs(p.x) <= 1 && std::abs(p.y) <= 1 && p.z >= 0 && p.z <= 1;
+            cornersCovered = cornersCovered && Length(world - cascade.coverage.centre) <= cascade.coverage.radius * 1.0001f;
+        }
+        CHECK(cornersInside);
+        CHECK(cornersCovered);
+    }
+}
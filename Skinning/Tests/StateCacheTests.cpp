@@ -0,0 +1,197 @@
+//--------------------------------------------------------------------------------------
+// State cache tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "StateCache.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+
+namespace
+{
+    // Stand-in for a D3D object, only its address is used
+    template <class T>
+    T* Object(uintptr_t id)
+    {
+        return reinterpret_cast<T*>(id * 16);
+    }
+
+    // A forwarded call: the function, the slot (0 for functions without one), the object and any other arguments
+    struct Call
+    {
+        std::string function;
+        UINT        slot;
+        const void* object;
+        UINT        values[2];
+    };
+
+    // Records the calls the cache forwards instead of passing them to a context
+    class RecordingSink : public StateSink
+    {
+    public:
+        std::vector<Call> calls;
+
+        void VSSetShader(ID3D11VertexShader* shader) override  { Record("VSSetShader", 0, shader); }
+        void PSSetShader(ID3D11PixelShader* shader) override   { Record("PSSetShader", 0, shader); }
+
+        void IASetInputLayout(ID3D11InputLayout* layout) override  { Record("IASetInputLayout", 0, layout); }
+        void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) override
+        {
+            Record("IASetPrimitiveTopology", 0, nullptr, topology);
+        }
+        void IASetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset) override
+        {
+            Record("IASetVertexBuffer", slot, buffer, stride, offset);
+        }
+        void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) override
+        {
+            Record("IASetIndexBuffer", 0, buffer, format, offset);
+        }
+
+        void OMSetBlendState(ID3D11BlendState* state) override  { Record("OMSetBlendState", 0, state); }
+        void OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) override
+        {
+            Record("OMSetDepthStencilState", 0, state, stencilRef);
+        }
+        void RSSetState(ID3D11RasterizerState* state) override  { Record("RSSetState", 0, state); }
+
+        void PSSetShaderResource(UINT slot, ID3D11ShaderResourceView* view) override  { Record("PSSetShaderResource", slot, view); }
+        void PSSetSampler(UINT slot, ID3D11SamplerState* sampler) override            { Record("PSSetSampler", slot, sampler); }
+        void VSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer) override            { Record("VSSetConstantBuffer", slot, buffer); }
+        void PSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer) override            { Record("PSSetConstantBuffer", slot, buffer); }
+
+    private:
+        void Record(const char* function, UINT slot, const void* object, UINT value0 = 0, UINT value1 = 0)
+        {
+            calls.push_back({ function, slot, object, { value0, value1 } });
+        }
+    };
+
+    // True if the last call recorded is the given one
+    bool LastCall(const RecordingSink& sink, const char* function, UINT slot, const void* object, UINT value0 = 0,
+                  UINT value1 = 0)
+    {
+        if (sink.calls.empty())  return false;
+        const Call& call = sink.calls.back();
+        return call.function == function && call.slot == slot && call.object == object &&
+               call.values[0] == value0 && call.values[1] == value1;
+    }
+}
+
+
+// Each kind of state is forwarded the first time it is set and when it changes, including a change of only the
+// stride, offset, format or stencil reference, and repeats are dropped until Invalidate. Slots beyond those tracked
+// are always forwarded. The stats count every call and every call forwarded
+void TestStateCache()
+{
+    RecordingSink sink;
+    StateCache cache;
+    cache.SetSink(&sink);
+    CHECK(cache.Sink() == &sink);
+    unsigned int callsMade = 0;
+
+    // Every function, setting objects made from the given id, in the first slot and the last tracked slot. Returns the
+    // number of calls forwarded
+    auto setAll = [&](uintptr_t id)
+    {
+        D3D11_PRIMITIVE_TOPOLOGY topology = (id % 2 == 0) ? D3D11_PRIMITIVE_TOPOLOGY_LINELIST : D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+        unsigned int forwarded = 0;
+        forwarded += cache.SetVertexShader(Object<ID3D11VertexShader>(id));
+        forwarded += cache.SetPixelShader(Object<ID3D11PixelShader>(id));
+        forwarded += cache.SetInputLayout(Object<ID3D11InputLayout>(id));
+        forwarded += cache.SetPrimitiveTopology(topology);
+        forwarded += cache.SetBlendState(Object<ID3D11BlendState>(id));
+        forwarded += cache.SetDepthStencilState(Object<ID3D11DepthStencilState>(id));
+        forwarded += cache.SetRasterizerState(Object<ID3D11RasterizerState>(id));
+        forwarded += cache.SetIndexBuffer(Object<ID3D11Buffer>(id), DXGI_FORMAT_R16_UINT);
+        callsMade += 8;
+        for (UINT slot : { 0u, STATE_CACHE_VERTEX_SLOTS - 1 })
+        {
+            forwarded += cache.SetVertexBuffer(slot, Object<ID3D11Buffer>(id + slot), 32);
+            ++callsMade;
+        }
+        for (UINT slot : { 0u, STATE_CACHE_SLOTS - 1 })
+        {
+            forwarded += cache.SetPSShaderResource(slot, Object<ID3D11ShaderResourceView>(id + slot));
+            forwarded += cache.SetPSSampler(slot, Object<ID3D11SamplerState>(id + slot));
+            forwarded += cache.SetVSConstantBuffer(slot, Object<ID3D11Buffer>(id + slot));
+            forwarded += cache.SetPSConstantBuffer(slot, Object<ID3D11Buffer>(id + slot));
+            callsMade += 4;
+        }
+        return forwarded;
+    };
+    const unsigned int numSetAll = 18;
+
+    // The first time everything is forwarded, with the arguments given, then repeats are all dropped
+    CHECK(setAll(1) == numSetAll);
+    CHECK(sink.calls.size() == numSetAll);
+    CHECK(LastCall(sink, "PSSetConstantBuffer", STATE_CACHE_SLOTS - 1, Object<ID3D11Buffer>(1 + STATE_CACHE_SLOTS - 1)));
+    CHECK(setAll(1) == 0);
+    CHECK(sink.calls.size() == numSetAll);
+
+    // New objects are all forwarded, and setting them again is dropped
+    CHECK(setAll(2) == numSetAll);
+    CHECK(setAll(2) == 0);
+    CHECK(sink.calls.size() == 2 * numSetAll);
+
+    // After Invalidate everything is forwarded again even though it is unchanged, including nullptr
+    cache.Invalidate();
+    CHECK(setAll(2) == numSetAll);
+    CHECK(sink.calls.size() == 3 * numSetAll);
+    cache.Invalidate();
+    CHECK(cache.SetPixelShader(nullptr));
+    CHECK(LastCall(sink, "PSSetShader", 0, nullptr));
+    CHECK(!cache.SetPixelShader(nullptr));
+    callsMade += 2;
+
+    // The same vertex buffer with a different stride or offset is forwarded, and slots are tracked separately
+    ID3D11Buffer* buffer = Object<ID3D11Buffer>(100);
+    CHECK(cache.SetVertexBuffer(0, buffer, 32));
+    CHECK(!cache.SetVertexBuffer(0, buffer, 32));
+    CHECK(cache.SetVertexBuffer(0, buffer, 24));
+    CHECK(LastCall(sink, "IASetVertexBuffer", 0, buffer, 24, 0));
+    CHECK(cache.SetVertexBuffer(0, buffer, 24, 480));
+    CHECK(LastCall(sink, "IASetVertexBuffer", 0, buffer, 24, 480));
+    CHECK(!cache.SetVertexBuffer(0, buffer, 24, 480));
+    CHECK(cache.SetVertexBuffer(1, buffer, 24, 480));
+    CHECK(LastCall(sink, "IASetVertexBuffer", 1, buffer, 24, 480));
+    callsMade += 6;
+
+    // Likewise the same index buffer with a different format or offset, and the same depth state with a different
+    // stencil reference
+    CHECK(cache.SetIndexBuffer(buffer, DXGI_FORMAT_R16_UINT));
+    CHECK(cache.SetIndexBuffer(buffer, DXGI_FORMAT_R32_UINT));
+    CHECK(LastCall(sink, "IASetIndexBuffer", 0, buffer, DXGI_FORMAT_R32_UINT, 0));
+    CHECK(cache.SetIndexBuffer(buffer, DXGI_FORMAT_R32_UINT, 64));
+    CHECK(LastCall(sink, "IASetIndexBuffer", 0, buffer, DXGI_FORMAT_R32_UINT, 64));
+    CHECK(!cache.SetIndexBuffer(buffer, DXGI_FORMAT_R32_UINT, 64));
+    ID3D11DepthStencilState* depthState = Object<ID3D11DepthStencilState>(100);
+    CHECK(cache.SetDepthStencilState(depthState));
+    CHECK(cache.SetDepthStencilState(depthState, 1));
+    CHECK(LastCall(sink, "OMSetDepthStencilState", 0, depthState, 1));
+    CHECK(!cache.SetDepthStencilState(depthState, 1));
+    callsMade += 7;
+
+    // Slots that are not tracked are always forwarded
+    std::size_t numCalls = sink.calls.size();
+    for (int repeat = 0; repeat < 2; ++repeat)
+    {
+        CHECK(cache.SetVertexBuffer(STATE_CACHE_VERTEX_SLOTS, buffer, 32));
+        CHECK(cache.SetPSShaderResource(STATE_CACHE_SLOTS, Object<ID3D11ShaderResourceView>(100)));
+        CHECK(cache.SetPSSampler(STATE_CACHE_SLOTS, Object<ID3D11SamplerState>(100)));
+        CHECK(cache.SetVSConstantBuffer(STATE_CACHE_SLOTS + 3, buffer));
+        CHECK(cache.SetPSConstantBuffer(STATE_CACHE_SLOTS, buffer));
+        callsMade += 5;
+    }
+    CHECK(sink.calls.size() == numCalls + 10);
+    CHECK(LastCall(sink, "PSSetConstantBuffer", STATE_CACHE_SLOTS, buffer));
+
+    // Every call counted, and every forwarded call sent to the sink
+    CHECK(cache.Stats().calls == callsMade);
+    CHECK(cache.Stats().forwarded == sink.calls.size());
+    cache.ResetStats();
+    CHECK(cache.Stats().calls == 0 && cache.Stats().forwarded == 0);
+}
@@ -0,0 +1,158 @@
+//--------------------------------------------------------------------------------------
+// Static batch tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "StaticBatch.h"
+#include "VertexPacking.h"
+#include "ThreadPool.h"
+#include "BoundingVolumes.h"
+#include "MathHelpers.h"
+
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+    // A sphere packed as meshes are after import, so normals are in octahedral form (see VertexPacking.h)
+    SubMeshData MakePackedSphere(unsigned int rings, unsigned int segments, float radius)
+    {
+        SubMeshData sphere = MakeSphere(rings, segments, radius);
+        PackSubMesh(sphere);
+        return sphere;
+    }
+
+    CVector3 ReadFloat3(const unsigned char* input)
+    {
+        float v[3];
+        std::memcpy(v, input, sizeof(v));
+        return CVector3(v);
+    }
+
+    // True if every vertex of every piece is in the merge, in turn, transformed by the piece's matrix. Positions are
+    // compared with TransformPoint and normals with the upper 3x3 of the matrix, both worked out here rather than by
+    // TransformStaticVertices. The rest of each vertex must be copied byte for byte
+    bool VerticesTransformed(const std::vector<StaticGeometryPiece>& pieces, const SubMeshData& merged)
+    {
+        uint32_t firstVertex = 0;
+        for (auto& piece : pieces)
+        {
+            const SubMeshData& subMesh = *piece.subMesh;
+            CMatrix4x4 upper3x3 = piece.matrix;
+            upper3x3.SetRow(3, { 0, 0, 0 });
+            for (uint32_t v = 0; v < subMesh.numVertices; ++v)
+            {
+                const unsigned char* vertex = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+                const unsigned char* mergedVertex = merged.vertices + static_cast<std::size_t>(firstVertex + v) * merged.vertexSize;
+
+                CVector3 position = TransformPoint(ReadFloat3(vertex + subMesh.positionOffset), piece.matrix);
+                CVector3 mergedPosition = ReadFloat3(mergedVertex + merged.positionOffset);
+                if (Length(mergedPosition - position) > 1e-4f * (1 + Length(position)))  return false;
+
+                CVector3 normal = Normalise(TransformPoint(ReadOctahedral(vertex + subMesh.normalOffset), upper3x3));
+                if (Length(ReadOctahedral(mergedVertex + merged.normalOffset) - normal) > 1e-3f)  return false;
+
+                for (uint32_t b = 0; b < subMesh.vertexSize; ++b)
+                {
+                    bool transformed = (b >= subMesh.positionOffset && b < subMesh.positionOffset + 12) ||
+                                       (b >= subMesh.normalOffset   && b < subMesh.normalOffset + 4);
+                    if (!transformed && mergedVertex[b] != vertex[b])  return false;
+                }
+            }
+            firstVertex += subMesh.numVertices;
+        }
+        return firstVertex == merged.numVertices;
+    }
+
+    // True if firstIndices holds the running total of the pieces' indices, and each piece's indices are in the merge
+    // from there on, offset by the number of vertices of the pieces before it
+    bool IndicesOffset(const std::vector<StaticGeometryPiece>& pieces, const SubMeshData& merged,
+                       const std::vector<uint32_t>& firstIndices)
+    {
+        if (firstIndices.size() != pieces.size() + 1)  return false;
+        uint32_t firstVertex = 0, firstIndex = 0;
+        for (std::size_t p = 0; p < pieces.size(); ++p)
+        {
+            const SubMeshData& subMesh = *pieces[p].subMesh;
+            if (firstIndices[p] != firstIndex)  return false;
+            for (uint32_t i = 0; i < subMesh.numIndices; ++i)
+            {
+                if (merged.Index(firstIndex + i) != subMesh.Index(i) + firstVertex)  return false;
+            }
+            firstVertex += subMesh.numVertices;
+            firstIndex  += subMesh.numIndices;
+        }
+        return firstIndices.back() == firstIndex && merged.numIndices == firstIndex;
+    }
+
+    // True if two merges have the same layout and the same vertex and index bytes
+    bool SameMerge(const SubMeshData& a, const SubMeshData& b)
+    {
+        return a.vertexSize == b.vertexSize && a.indexSize == b.indexSize &&
+               a.numVertices == b.numVertices && a.numIndices == b.numIndices &&
+               std::memcmp(a.vertices, b.vertices, static_cast<std::size_t>(a.numVertices) * a.vertexSize) == 0 &&
+               std::memcmp(a.indices,  b.indices,  static_cast<std::size_t>(a.numIndices)  * a.indexSize)  == 0;
+    }
+}
+
+
+// Merged vertices are each piece's vertices transformed by its matrix and indices are offset to match, checked against
+// transforms worked out independently of the merge. Merges over 65535 vertices use 32-bit indices, and splitting a
+// merge across a thread pool gives exactly the same bytes. Pieces with different vertex layouts aren't merged
+void TestStaticBatch()
+{
+    SubMeshData small = MakePackedSphere(8, 12, 0.5f), large = MakePackedSphere(32, 64, 1.0f);
+    CHECK(SameVertexLayout(small, large));
+    CHECK(small.normalOffset != SubMeshData::NO_ELEMENT && small.tangentOffset == SubMeshData::NO_ELEMENT);
+
+    // Pieces turned, scaled (one of them unevenly, so normals need renormalising) and moved at random
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2 * PI);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+    auto randomMatrix = [&]()
+    {
+        return MatrixScaling(scale(random)) * MatrixRotationZ(angle(random)) * MatrixRotationX(angle(random)) *
+               MatrixRotationY(angle(random)) * MatrixTranslation({ position(random), position(random), position(random) });
+    };
+
+    // A few pieces, small enough for 16-bit indices
+    std::vector<StaticGeometryPiece> pieces = { { &small, randomMatrix() }, { &large, randomMatrix() },
+                                                { &small, MatrixScaling(CVector3{ 1, 3, 0.5f }) * randomMatrix() } };
+    SubMeshData merged;
+    std::vector<uint32_t> firstIndices;
+    CHECK(MergeStaticGeometry(pieces.data(), static_cast<unsigned int>(pieces.size()), merged, firstIndices));
+    CHECK(merged.indexSize == 2);
+    CHECK(VerticesTransformed(pieces, merged));
+    CHECK(IndicesOffset(pieces, merged, firstIndices));
+
+    // Enough pieces for 32-bit indices and for the thread pool to split both the vertices and the indices
+    pieces.clear();
+    for (unsigned int i = 0; pieces.size() < 2 || i < 70000; i += pieces.back().subMesh->numVertices)
+    {
+        pieces.push_back({ (pieces.size() % 3 == 0) ? &small : &large, randomMatrix() });
+    }
+    unsigned int numPieces = static_cast<unsigned int>(pieces.size());
+    CHECK(MergeStaticGeometry(pieces.data(), numPieces, merged, firstIndices));
+    CHECK(merged.indexSize == 4 && merged.numVertices >= 65536);
+    CHECK(merged.numVertices > 4 * STATIC_BATCH_SIZE && merged.numIndices > 4 * STATIC_BATCH_SIZE);
+    CHECK(VerticesTransformed(pieces, merged));
+    CHECK(IndicesOffset(pieces, merged, firstIndices));
+
+    ThreadPool threadPool(3);
+    SubMeshData pooled;
+    std::vector<uint32_t> pooledFirstIndices;
+    CHECK(MergeStaticGeometry(pieces.data(), numPieces, pooled, pooledFirstIndices, &threadPool));
+    CHECK(SameMerge(pooled, merged));
+    CHECK(pooledFirstIndices == firstIndices);
+
+    // An unpacked sphere has a different layout, so nothing is merged and the output is left alone
+    SubMeshData unpacked = MakeSphere(8, 12, 0.5f);
+    std::vector<StaticGeometryPiece> mixed = { { &small, MatrixIdentity() }, { &unpacked, MatrixIdentity() } };
+    CHECK(!MergeStaticGeometry(mixed.data(), 2, pooled, pooledFirstIndices, &threadPool));
+    CHECK(SameMerge(pooled, merged));
+    CHECK(pooledFirstIndices == firstIndices);
+}
@@ -0,0 +1,312 @@
+//--------------------------------------------------------------------------------------
+// Tests - checks of the geometry, culling, shadow and lighting code that runs without a GPU
+//--------------------------------------------------------------------------------------
+// A console program built by Tests.vcxproj from the engine's own source files, so it needs no
+// window, device or model files: the meshes are generated here. Each test prints the checks that
+// fail, and the program returns the number of failures (0 if everything passed) so it can be run
+// from a build script. The tests themselves are in a file per module (see Tests.h).
+// Run with -benchmark to time the benchmarks that need no GPU instead of running the tests, the
+// same reports the windowed program shows on its function keys.
+
+#include "Tests.h"
+#include "Common.h"
+#include "Mesh.h"
+#include "LightClusters.h"
+#include "ThreadPool.h"
+#include "StateCache.h"
+#include "GeometryArena.h"
+#include "FrameAllocator.h"
+#include "MathHelpers.h"
+
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <cmath>
+
+
+//--------------------------------------------------------------------------------------
+// Renderer globals
+//--------------------------------------------------------------------------------------
+// Normally defined by the windowed program. There is no device or context: meshes made without GPU resources (see
+// Mesh.h) render through gStateCache, which the tests give a sink of their own. The constant and instance buffers are
+// distinct addresses that sinks can tell apart, they are never used
+
+ID3D11Device*        gD3DDevice  = nullptr;
+ID3D11DeviceContext* gD3DContext = nullptr;
+std::string          gLastError;
+
+StateCache     gStateCache;
+GeometryArena  gGeometryArena;
+FrameAllocator gFrameAllocator(1024 * 1024);
+
+PerModelConstants gPerModelConstants;
+ID3D11Buffer*     gPerModelConstantBuffer    = reinterpret_cast<ID3D11Buffer*>(0x1000);
+ID3D11Buffer*     gPerSkeletonConstantBuffer = reinterpret_cast<ID3D11Buffer*>(0x2000);
+ID3D11Buffer*     gInstanceBuffer            = reinterpret_cast<ID3D11Buffer*>(0x3000);
+
+// Full detail for every model
+LodView gLodView = { { 0, 0, 0 }, 1, 0, 0 };
+
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    unsigned int gChecks   = 0;
+    unsigned int gFailures = 0;
+}
+
+// Count a check and print it if it failed. Use through CHECK
+void Check(bool passed, const char* condition, const char* file, int line)
+{
+    ++gChecks;
+    if (passed)  return;
+    ++gFailures;
+    std::printf("  %s(%d): failed %s\n", file, line, condition);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Test geometry
+//--------------------------------------------------------------------------------------
+
+// A UV sphere with the float layout built by MeshData::Import (position, normal, uv), 32-bit indices in its own
+// storage and triangles in row order, as they often come from a modelling package. Front faces are clockwise seen
+// from outside, as the renderer expects
+SubMeshData MakeSphere(unsigned int rings, unsigned int segments, float radius)
+{
+    SubMeshData subMesh;
+    subMesh.positionOffset = 0;
+    subMesh.normalOffset   = 12;
+    subMesh.uvOffset       = 24;
+    subMesh.vertexSize     = 32;
+    subMesh.layout.push_back({ "position", VertexElementFormat::Float3, subMesh.positionOffset });
+    subMesh.layout.push_back({ "normal",   VertexElementFormat::Float3, subMesh.normalOffset   });
+    subMesh.layout.push_back({ "uv",       VertexElementFormat::Float2, subMesh.uvOffset       });
+
+    subMesh.numVertices = (rings + 1) * (segments + 1);
+    subMesh.vertexStorage = std::make_unique<unsigned char[]>(subMesh.numVertices * subMesh.vertexSize);
+    float* vertex = reinterpret_cast<float*>(subMesh.vertexStorage.get());
+    for (unsigned int ring = 0; ring <= rings; ++ring)
+    {
+        for (unsigned int segment = 0; segment <= segments; ++segment)
+        {
+            float u = static_cast<float>(segment) / segments;
+            float v = static_cast<float>(ring) / rings;
+            CVector3 normal = { std::sin(v * PI) * std::cos(u * 2 * PI), std::cos(v * PI), std::sin(v * PI) * std::sin(u * 2 * PI) };
+            CVector3 position = normal * radius;
+            float values[8] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, u, v };
+            std::memcpy(vertex, values, sizeof(values));
+            vertex += 8;
+        }
+    }
+
+    // Two triangles per quad, leaving out those with two corners at a pole
+    std::vector<uint32_t> indices;
+    auto addTriangle = [&](uint32_t a, uint32_t b, uint32_t c)
+    {
+        indices.insert(indices.end(), { a, b, c });
+    };
+    for (unsigned int ring = 0; ring < rings; ++ring)
+    {
+        for (unsigned int segment = 0; segment < segments; ++segment)
+        {
+            uint32_t topLeft    = ring * (segments + 1) + segment;
+            uint32_t bottomLeft = topLeft + segments + 1;
+            if (ring > 0)          addTriangle(topLeft, topLeft + 1, bottomLeft);
+            if (ring < rings - 1)  addTriangle(topLeft + 1, bottomLeft + 1, bottomLeft);
+        }
+    }
+    subMesh.numIndices = static_cast<uint32_t>(indices.size());
+    subMesh.indexSize  = 4;
+    subMesh.indexStorage = std::make_unique<unsigned char[]>(indices.size() * 4);
+    std::memcpy(subMesh.indexStorage.get(), indices.data(), indices.size() * 4);
+
+    subMesh.vertices = subMesh.vertexStorage.get();
+    subMesh.indices  = subMesh.indexStorage.get();
+    return subMesh;
+}
+
+// Position of a vertex of a sub-mesh with float positions
+CVector3 Position(const SubMeshData& subMesh, uint32_t v)
+{
+    float position[3];
+    std::memcpy(position, subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize + subMesh.positionOffset, sizeof(position));
+    return CVector3(position);
+}
+
+// The indices of a sub-mesh with 32-bit indices in its own storage
+const uint32_t* Indices32(const SubMeshData& subMesh)
+{
+    return reinterpret_cast<const uint32_t*>(subMesh.indexStorage.get());
+}
+
+// The full detail triangles of a sub-mesh as vertex indices, each rotated to start at its smallest index, sorted.
+// Two sub-meshes with the same triangles in any order (and any rotation) give the same list
+std::vector<std::array<uint32_t, 3>> SortedTriangles(const SubMeshData& subMesh)
+{
+    std::vector<std::array<uint32_t, 3>> triangles;
+    for (uint32_t i = 0; i + 2 < subMesh.numIndices; i += 3)
+    {
+        std::array<uint32_t, 3> t = { subMesh.Index(i), subMesh.Index(i + 1), subMesh.Index(i + 2) };
+        std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+        triangles.push_back(t);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+// Projection matrix for a camera looking along z, the same as Camera::UpdateMatrices
+CMatrix4x4 ProjectionMatrix(float fovX, float aspectRatio, float nearClip, float farClip)
+{
+    float tanFOVx = std::tan(fovX * 0.5f);
+    float scaleZa = farClip / (farClip - nearClip);
+    return { 1.0f / tanFOVx, 0.0f,                  0.0f,                 0.0f,
+             0.0f,           aspectRatio / tanFOVx, 0.0f,                 0.0f,
+             0.0f,           0.0f,                  scaleZa,              1.0f,
+             0.0f,           0.0f,                  -nearClip * scaleZa,  0.0f };
+}
+
+// Transform a point by a view-projection matrix and divide by w
+CVector3 Project(const CVector3& p, const CMatrix4x4& m)
+{
+    float w = p.x * m.e03 + p.y * m.e13 + p.z * m.e23 + m.e33;
+    return { (p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30) / w,
+             (p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31) / w,
+             (p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32) / w };
+}
+
+namespace
+{
+    // Nodes in a chain along x, each drawing sub-mesh 0 if given. Offset matrices are identity
+    void AddChainNodes(MeshData& mesh, unsigned int numNodes, bool drawSubMesh)
+    {
+        mesh.nodes.resize(numNodes);
+        for (unsigned int i = 0; i < numNodes; ++i)
+        {
+            MeshNode& node = mesh.nodes[i];
+            node.name = "Node" + std::to_string(i);
+            node.parentIndex = (i == 0) ? 0 : i - 1;
+            node.defaultMatrix = (i == 0) ? MatrixIdentity() : MatrixTranslation({ 1, 0, 0 });
+            node.offsetMatrix = MatrixIdentity();
+            if (i + 1 < numNodes)  node.childNodes.push_back(i + 1);
+            if (drawSubMesh)  node.subMeshes.push_back(0);
+        }
+    }
+
+    // Bound each node of a chain by the sphere of radius 0.5 around its origin, and the whole mesh by the row of them.
+    // The sphere is what rigid nodes draw. Skinned vertices have no bone weights to find their bounds from
+    void SetChainBounds(MeshData& mesh)
+    {
+        for (auto& node : mesh.nodes)
+        {
+            node.bounds.Add({ -0.5f, -0.5f, -0.5f });
+            node.bounds.Add({  0.5f,  0.5f,  0.5f });
+            node.boundingSphere = { { 0, 0, 0 }, 0.5f };
+        }
+        mesh.bounds.Add({ -0.5f, -0.5f, -0.5f });
+        mesh.bounds.Add({ static_cast<float>(mesh.nodes.size()) - 0.5f, 0.5f, 0.5f });
+        mesh.boundingSphere = { mesh.bounds.Centre(), Length(mesh.bounds.Extents()) };
+    }
+}
+
+// A rigid mesh whose nodes form a chain, each one unit along x from its parent with the root at the origin, all drawing
+// the same sphere sub-mesh, with bounds. A mesh with one node can be instanced
+MeshData MakeRigidMeshData(unsigned int numNodes)
+{
+    MeshData mesh;
+    mesh.subMeshes.push_back(MakeSphere(8, 12, 0.5f));
+    AddChainNodes(mesh, numNodes, true);
+    SetChainBounds(mesh);
+    return mesh;
+}
+
+// A skinned mesh whose nodes (bones) form a chain as above, with one sphere sub-mesh split into two bone batches of half
+// the triangles each. The first batch's palette is the first half of the nodes and the second's the rest, both using
+// the middle node as batches do for vertices at their edge. The vertices have no bone weights, Render doesn't read them.
+// Each bone is bounded by the sphere around its origin
+MeshData MakeSkinnedMeshData(unsigned int numNodes)
+{
+    MeshData mesh;
+    mesh.hasBones = true;
+    mesh.subMeshes.push_back(MakeSphere(8, 12, 0.5f));
+    AddChainNodes(mesh, numNodes, false);
+    mesh.nodes[0].subMeshes.push_back(0);
+
+    SubMeshData& subMesh = mesh.subMeshes[0];
+    uint32_t middle = numNodes / 2;
+    for (uint32_t node = 0; node < numNodes; ++node)
+    {
+        subMesh.bonePalette.push_back(node);
+        if (node == middle)  subMesh.bonePalette.push_back(node);
+    }
+    uint32_t firstHalfIndices = subMesh.numIndices / 6 * 3, firstHalfVertices = subMesh.numVertices / 2;
+    subMesh.boneBatches.push_back({ 0, firstHalfIndices, 0, firstHalfVertices, 0, middle + 1 });
+    subMesh.boneBatches.push_back({ firstHalfIndices, subMesh.numIndices - firstHalfIndices, firstHalfVertices,
+                                    subMesh.numVertices - firstHalfVertices, middle + 1, numNodes - middle });
+    SetChainBounds(mesh);
+    return mesh;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Main
+//--------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    // Benchmarks that need no GPU or model files, with the arguments used by the windowed program
+    if (argc > 1 && std::strcmp(argv[1], "-benchmark") == 0)
+    {
+        ThreadPool threadPool;
+        std::printf("%s\n", BenchmarkMatrices().c_str());
+        std::printf("%s\n", BenchmarkLightClusters(4096, &threadPool).c_str());
+
+        Mesh rigid(MakeRigidMeshData(4)), skinned(MakeSkinnedMeshData(40));
+        Mesh* meshes[] = { &rigid, &skinned };
+        const char* names[] = { "Generated rigid", "Generated skinned" };
+        std::printf("%s\n", ReportConstantUploads(meshes, names, 2).c_str());
+        return 0;
+    }
+
+    struct Test
+    {
+        const char* name;
+        void (*run)();
+    };
+    const Test tests[] =
+    {
+        { "MeshOptimizer",    TestMeshOptimizer    },
+        { "ShadowAtlas",      TestShadowAtlas      },
+        { "ShadowCascades",   TestShadowCascades   },
+        { "LightClusters",    TestLightClusters    },
+        { "RangeAllocator",   TestRangeAllocator   },
+        { "VertexPacking",    TestVertexPacking    },
+        { "MeshSimplifier",   TestMeshSimplifier   },
+        { "Meshlets",         TestMeshlets         },
+        { "OcclusionCulling", TestOcclusionCulling },
+        { "MatrixKernels",    TestMatrixKernels    },
+        { "CpuSkinning",      TestCpuSkinning      },
+        { "AnimationClip",    TestAnimationClip    },
+        { "FrameAllocator",   TestFrameAllocator   },
+        { "ThreadPool",       TestThreadPool       },
+        { "StateCache",       TestStateCache       },
+        { "Mesh",             TestMesh             },
+        { "RenderQueue",      TestRenderQueue      },
+        { "StaticBatch",      TestStaticBatch      },
+    };
+
+    for (auto& test : tests)
+    {
+        unsigned int failures = gFailures;
+        std::printf("%s\n", test.name);
+        test.run();
+        if (gFailures != failures)  std::printf("  %u failed\n", gFailures - failures);
+    }
+    std::printf("%u checks, %u failed\n", gChecks, gFailures);
+    return static_cast<int>(gFailures);
+}
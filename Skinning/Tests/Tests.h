@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// Tests - shared by the test files: checks, generated geometry and the list of tests
+//--------------------------------------------------------------------------------------
+// Code in Tests.cpp
+// Each module's tests are in their own file, e.g. MeshOptimizerTests.cpp, as one function that
+// checks with CHECK and is added to the list in main. The geometry is generated here so the tests
+// need no model files.
+
+#ifndef _TESTS_H_INCLUDED_
+#define _TESTS_H_INCLUDED_
+
+#include "MeshData.h"
+#include "CMatrix4x4.h"
+#include "CVector3.h"
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+
+// Count a check and print it if it failed. Use through CHECK
+void Check(bool passed, const char* condition, const char* file, int line);
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+
+//--------------------------------------------------------------------------------------
+// Test geometry
+//--------------------------------------------------------------------------------------
+
+// A UV sphere with the float layout built by MeshData::Import (position, normal, uv), 32-bit indices in its own
+// storage and triangles in row order, as they often come from a modelling package. Front faces are clockwise seen
+// from outside, as the renderer expects
+SubMeshData MakeSphere(unsigned int rings, unsigned int segments, float radius);
+
+// Position of a vertex of a sub-mesh with float positions
+CVector3 Position(const SubMeshData& subMesh, uint32_t v);
+
+// The indices of a sub-mesh with 32-bit indices in its own storage
+const uint32_t* Indices32(const SubMeshData& subMesh);
+
+// The full detail triangles of a sub-mesh as vertex indices, each rotated to start at its smallest index, sorted.
+// Two sub-meshes with the same triangles in any order (and any rotation) give the same list
+std::vector<std::array<uint32_t, 3>> SortedTriangles(const SubMeshData& subMesh);
+
+// Projection matrix for a camera looking along z, the same as Camera::UpdateMatrices
+CMatrix4x4 ProjectionMatrix(float fovX, float aspectRatio, float nearClip, float farClip);
+
+// Transform a point by a view-projection matrix and divide by w
+CVector3 Project(const CVector3& p, const CMatrix4x4& m);
+
+// A rigid mesh whose nodes form a chain, each one unit along x from its parent with the root at the origin, all drawing
+// the same sphere sub-mesh, with bounds. A mesh with one node can be instanced
+MeshData MakeRigidMeshData(unsigned int numNodes);
+
+// A skinned mesh whose nodes (bones) form a chain as above, with one sphere sub-mesh split into two bone batches of half
+// the triangles each. The first batch's palette is the first half of the nodes and the second's the rest, both using
+// the middle node as batches do for vertices at their edge. The vertices have no bone weights, Render doesn't read them.
+// Each bone is bounded by the sphere around its origin
+MeshData MakeSkinnedMeshData(unsigned int numNodes);
+
+
+//--------------------------------------------------------------------------------------
+// Tests
+//--------------------------------------------------------------------------------------
+
+void TestMeshOptimizer(); // MeshOptimizerTests.cpp
+void TestShadowAtlas(); // ShadowAtlasTests.cpp
+void TestShadowCascades(); // ShadowCascadesTests.cpp
+void TestLightClusters(); // LightClustersTests.cpp
+void TestRangeAllocator(); // RangeAllocatorTests.cpp
+void TestVertexPacking(); // VertexPackingTests.cpp
+void TestMeshSimplifier(); // MeshSimplifierTests.cpp
+void TestMeshlets(); // MeshletsTests.cpp
+void TestOcclusionCulling(); // OcclusionCullingTests.cpp
+void TestMatrixKernels(); // MatrixTests.cpp
+void TestCpuSkinning(); // CpuSkinningTests.cpp
+void TestAnimationClip(); // AnimationClipTests.cpp
+void TestFrameAllocator(); // FrameAllocatorTests.cpp
+void TestThreadPool(); // ThreadPoolTests.cpp
+void TestStateCache(); // StateCacheTests.cpp
+void TestMesh(); // MeshTests.cpp
+void TestRenderQueue(); // RenderQueueTests.cpp
+void TestStaticBatch(); // StaticBatchTests.cpp
+
+
+#endif //_TESTS_H_INCLUDED_
@@ -0,0 +1,166 @@
+//--------------------------------------------------------------------------------------
+// Thread pool tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+
+
+namespace
+{
+    typedef std::unique_ptr<std::atomic<unsigned int>[]> Hits;
+
+    Hits MakeHits(unsigned int count)
+    {
+        Hits hits(new std::atomic<unsigned int>[count]);
+        for (unsigned int i = 0; i < count; ++i)  hits[i] = 0;
+        return hits;
+    }
+
+    // True if every item was hit exactly once
+    bool ExactlyOnce(const Hits& hits, unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            if (hits[i] != 1)  return false;
+        }
+        return true;
+    }
+
+    void CountJob(void* context)
+    {
+        static_cast<std::atomic<unsigned int>*>(context)->fetch_add(1);
+    }
+}
+
+
+// Every job and ParallelFor item runs exactly once, jobs wait for their dependencies, ParallelFor can be nested and run
+// from inside jobs, and jobs added to a full queue are run straight away
+void TestThreadPool()
+{
+    ThreadPool pool(3);
+
+    // Jobs with a counter, added faster than the workers take them
+    const unsigned int numJobs = 4 * JOB_QUEUE_SIZE;
+    Hits hits = MakeHits(numJobs);
+    JobCounter counter;
+    for (unsigned int i = 0; i < numJobs; ++i)  pool.Run(CountJob, &hits[i], &counter);
+    pool.Wait(counter);
+    CHECK(counter.IsDone());
+    CHECK(ExactlyOnce(hits, numJobs));
+
+    // A chain of jobs each depending on the one before runs in order
+    const unsigned int CHAIN_LENGTH = 300;
+    std::unique_ptr<JobCounter[]> chain(new JobCounter[CHAIN_LENGTH]);
+    std::atomic<unsigned int> nextLink(0);
+    std::vector<unsigned int> order(CHAIN_LENGTH);
+    struct Link { std::atomic<unsigned int>* next; unsigned int* order; };
+    std::vector<Link> links(CHAIN_LENGTH);
+    auto runLink = [](void* context)
+    {
+        Link* link = static_cast<Link*>(context);
+        *link->order = link->next->fetch_add(1);
+    };
+    for (unsigned int i = 0; i < CHAIN_LENGTH; ++i)
+    {
+        links[i] = { &nextLink, &order[i] };
+        pool.Run(runLink, &links[i], &chain[i], i > 0 ? &chain[i - 1] : nullptr);
+    }
+    pool.Wait(chain[CHAIN_LENGTH - 1]);
+    bool inOrder = true;
+    for (unsigned int i = 0; i < CHAIN_LENGTH; ++i)  inOrder = inOrder && order[i] == i;
+    CHECK(inOrder);
+
+    // Jobs depending on a group of jobs start after all of the group have finished
+    hits = MakeHits(numJobs);
+    JobCounter group, followers;
+    std::atomic<unsigned int> early(0);
+    auto follower = [&]()
+    {
+        for (unsigned int i = 0; i < JOB_QUEUE_SIZE; ++i)  if (hits[i] != 1)  early.fetch_add(1);
+    };
+    for (unsigned int i = 0; i < JOB_QUEUE_SIZE; ++i)  pool.Run(CountJob, &hits[i], &group);
+    for (unsigned int i = 0; i < 8; ++i)  pool.Run(follower, &followers, &group);
+    pool.Wait(followers);
+    CHECK(early == 0);
+    CHECK(group.IsDone());
+
+    // ParallelFor inside ParallelFor, and ParallelFor inside jobs
+    const unsigned int NESTED_OUTER = 64, innerCount = 100;
+    hits = MakeHits(NESTED_OUTER * innerCount);
+    auto outer = [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int o = begin; o < end; ++o)
+        {
+            auto inner = [&](unsigned int innerBegin, unsigned int innerEnd)
+            {
+                for (unsigned int i = innerBegin; i < innerEnd; ++i)  hits[o * innerCount + i].fetch_add(1);
+            };
+            pool.ParallelFor(innerCount, 7, inner);
+        }
+    };
+    pool.ParallelFor(NESTED_OUTER, 1, outer);
+    CHECK(ExactlyOnce(hits, NESTED_OUTER * innerCount));
+
+    hits = MakeHits(NESTED_OUTER * innerCount);
+    struct ForInJob { ThreadPool* pool; std::atomic<unsigned int>* hits; };
+    std::vector<ForInJob> forInJobs(NESTED_OUTER);
+    JobCounter forJobs;
+    for (unsigned int o = 0; o < NESTED_OUTER; ++o)
+    {
+        forInJobs[o] = { &pool, &hits[o * innerCount] };
+        pool.Run([](void* context)
+        {
+            ForInJob* job = static_cast<ForInJob*>(context);
+            auto range = [job](unsigned int begin, unsigned int end)
+            {
+                for (unsigned int i = begin; i < end; ++i)  job->hits[i].fetch_add(1);
+            };
+            job->pool->ParallelFor(innerCount, 9, range);
+        }, &forInJobs[o], &forJobs);
+    }
+    pool.Wait(forJobs);
+    CHECK(ExactlyOnce(hits, NESTED_OUTER * innerCount));
+
+    // RunParallelFor returns straight away and waits for its dependency before any batch runs
+    const unsigned int rangeCount = 10000;
+    hits = MakeHits(rangeCount);
+    std::atomic<bool> released(false);
+    auto release = [&]() { released = true; };
+    struct RangeContext { std::atomic<unsigned int>* hits; std::atomic<bool>* released; std::atomic<unsigned int>* early; };
+    RangeContext rangeContext = { hits.get(), &released, &early };
+    JobCounter releaseCounter, rangeCounter;
+    pool.RunParallelFor(rangeCount, 64, [](void* context, unsigned int begin, unsigned int end)
+    {
+        RangeContext* range = static_cast<RangeContext*>(context);
+        if (!range->released->load())  range->early->fetch_add(1);
+        for (unsigned int i = begin; i < end; ++i)  range->hits[i].fetch_add(1);
+    }, &rangeContext, &rangeCounter, &releaseCounter);
+    pool.Run(release, &releaseCounter);
+    pool.Wait(rangeCounter);
+    CHECK(early == 0);
+    CHECK(ExactlyOnce(hits, rangeCount));
+
+    // With the only worker busy, jobs added after the calling thread's queue is full run immediately, exactly once
+    ThreadPool parkedPool(1);
+    std::atomic<bool> parked(true);
+    auto park = [&]() { while (parked.load())  std::this_thread::yield(); };
+    JobCounter parkCounter;
+    parkedPool.Run(park, &parkCounter);
+    while (parkedPool.Stats().jobs == 0)  std::this_thread::yield();
+    parkedPool.ResetStats();
+
+    hits = MakeHits(numJobs);
+    JobCounter queuedCounter;
+    for (unsigned int i = 0; i < numJobs; ++i)  parkedPool.Run(CountJob, &hits[i], &queuedCounter);
+    CHECK(parkedPool.Stats().immediate == numJobs - JOB_QUEUE_SIZE);
+    parked = false;
+    parkedPool.Wait(queuedCounter);
+    parkedPool.Wait(parkCounter);
+    CHECK(ExactlyOnce(hits, numJobs));
+}
@@ -0,0 +1,70 @@
+//--------------------------------------------------------------------------------------
+// Vertex packing tests
+//--------------------------------------------------------------------------------------
+
+#include "Tests.h"
+#include "VertexPacking.h"
+#include "MathHelpers.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+
+// Element formats round-trip within their precision, and packing a sub-mesh keeps its positions and triangles
+void TestVertexPacking()
+{
+    // Every half float that isn't a NaN converts to a float and back unchanged
+    bool halvesExact = true;
+    for (uint32_t half = 0; half < 0x10000; ++half)
+    {
+        if ((half & 0x7c00) == 0x7c00 && (half & 0x03ff) != 0)  continue;
+        halvesExact = halvesExact && FloatToHalf(HalfToFloat(static_cast<uint16_t>(half))) == half;
+    }
+    CHECK(halvesExact);
+    CHECK(HalfToFloat(FloatToHalf(1.0f / 3)) == HalfToFloat(0x3555));
+
+    // Directions come back within a hundredth of a degree, and bone weights keep their total
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    float maxAngle = 0;
+    bool weightsAddUp = true;
+    for (int i = 0; i < 10000; ++i)
+    {
+        CVector3 direction = { unit(random), unit(random), unit(random) };
+        if (Length(direction) < 0.01f)  continue;
+        unsigned char encoded[4];
+        WriteOctahedral(direction, encoded);
+        CVector3 decoded = ReadOctahedral(encoded);
+        float angle = std::atan2(Length(Cross(direction, decoded)), Dot(direction, decoded)); // acos is too coarse near 1
+        maxAngle = std::max(maxAngle, ToDegrees(angle));
+
+        float weights[4] = { std::abs(unit(random)), std::abs(unit(random)), std::abs(unit(random)), std::abs(unit(random)) };
+        float total = weights[0] + weights[1] + weights[2] + weights[3];
+        for (auto& weight : weights)  weight /= total;
+        unsigned char packed[4];
+        WriteWeights(weights, packed);
+        weightsAddUp = weightsAddUp && packed[0] + packed[1] + packed[2] + packed[3] == 255;
+    }
+    CHECK(maxAngle < 0.01f);
+    CHECK(weightsAddUp);
+
+    SubMeshData sphere = MakeSphere(16, 32, 1.0f);
+    std::vector<CVector3> positions;
+    for (uint32_t v = 0; v < sphere.numVertices; ++v)  positions.push_back(Position(sphere, v));
+    auto triangles = SortedTriangles(sphere);
+
+    VertexPackingStats stats;
+    PackSubMesh(sphere, &stats);
+    CHECK(sphere.indexSize == 2);
+    CHECK(sphere.vertexSize < 32);
+    CHECK(stats.packedBytes < stats.originalBytes);
+    CHECK(stats.maxNormalError < 0.01f);
+    CHECK(stats.maxUVError <= MAX_HALF_UV_ERROR);
+    CHECK(SortedTriangles(sphere) == triangles);
+
+    bool samePositions = true;
+    for (uint32_t v = 0; v < sphere.numVertices; ++v)  samePositions = samePositions && Length(Position(sphere, v) - positions[v]) == 0;
+    CHECK(samePositions);
+}
@@ -0,0 +1,100 @@
+//--------------------------------------------------------------------------------------
+// CPU-side texture data - image file contents ready to be copied to the GPU
+//--------------------------------------------------------------------------------------
+
+#include "TextureData.h"
+
+#ifndef NOMINMAX
+    #define NOMINMAX
+#endif
+#include <windows.h>
+#include <wincodec.h>
+#include <atlbase.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+
+
+// Read and decode the given image file. Safe to call from any thread
+// Returns false on failure
+bool TextureData::Load(const std::string& fileName)
+{
+    fileData.clear();
+    pixels.clear();
+    width = height = 0;
+
+    // DDS files need different handling from other files
+    std::string dds = ".dds"; // So check the filename extension (case insensitive)
+    isDDS = fileName.size() >= 4 &&
+            std::equal(dds.rbegin(), dds.rend(), fileName.rbegin(), [](unsigned char a, unsigned char b) { return std::tolower(a) == std::tolower(b); });
+
+    if (isDDS)
+    {
+        // DDS data is already in a GPU format, just read the whole file
+        FILE* file = std::fopen(fileName.c_str(), "rb");
+        if (file == nullptr)  return false;
+        std::fseek(file, 0, SEEK_END);
+        long size = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+        if (size > 0)
+        {
+            fileData.resize(static_cast<size_t>(size));
+            if (std::fread(fileData.data(), 1, fileData.size(), file) != fileData.size())  fileData.clear();
+        }
+        std::fclose(file);
+        return !fileData.empty();
+    }
+
+
+    // Other formats are decoded with the Windows Imaging Component (WIC). WIC is a COM library so COM must be
+    // initialised on this thread. Worker threads won't have done so. If the thread already uses COM in another
+    // mode (RPC_E_CHANGED_MODE) then it can still be used, but we mustn't uninitialise it
+    HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+    bool success = false;
+    {
+        CComPtr<IWICImagingFactory>    factory;
+        CComPtr<IWICBitmapDecoder>     decoder;
+        CComPtr<IWICBitmapFrameDecode> frame;
+        CComPtr<IWICFormatConverter>   converter;
+
+        if (SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))) &&
+            SUCCEEDED(factory->CreateDecoderFromFilename(CA2W(fileName.c_str()), nullptr, GENERIC_READ,
+                                                         WICDecodeMetadataCacheOnDemand, &decoder)) &&
+            SUCCEEDED(decoder->GetFrame(0, &frame)) &&
+            SUCCEEDED(frame->GetSize(&width, &height)) && width > 0 && height > 0 &&
+            SUCCEEDED(factory->CreateFormatConverter(&converter)) &&
+            SUCCEEDED(converter->Initialize(frame, GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeErrorDiffusion,
+                                            nullptr, 0.0, WICBitmapPaletteTypeMedianCut)))
+        {
+            UINT rowPitch = width * 4;
+            pixels.resize(static_cast<size_t>(rowPitch) * height);
+            success = SUCCEEDED(converter->CopyPixels(nullptr, rowPitch, static_cast<UINT>(pixels.size()), pixels.data()));
+        }
+    } // COM objects must be released before COM is uninitialised
+
+    if (SUCCEEDED(comResult))  CoUninitialize();
+
+    if (!success)
+    {
+        pixels.clear();
+        width = height = 0;
+    }
+    return success;
+}
+
+
+// Approximate GPU memory the texture will use once created, in bytes
+std::size_t TextureData::GPUSize() const
+{
+    if (isDDS)
+    {
+        // DDS data is used as-is, so the GPU size is the file size less its small header
+        const std::size_t DDS_HEADER_SIZE = 128;
+        return fileData.size() > DDS_HEADER_SIZE ? fileData.size() - DDS_HEADER_SIZE : 0;
+    }
+
+    // Decoded images have a full mip-map chain generated, which adds about a third
+    return pixels.size() + pixels.size() / 3;
+}
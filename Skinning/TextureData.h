@@ -0,0 +1,40 @@
+//--------------------------------------------------------------------------------------
+// CPU-side texture data - image file contents ready to be copied to the GPU
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Loading reads and decodes the image file without using DirectX, so it can be done on a
+// worker thread. The GPU texture is then created from this data on the thread that owns the
+// D3D context (see CreateTextureFromData in GraphicsHelpers.h).
+// DDS files are kept in their original form as they are already in a GPU format. Other image
+// files (jpg, png etc.) are decoded with the Windows Imaging Component to 32-bit RGBA pixels.
+
+#ifndef _TEXTURE_DATA_H_INCLUDED_
+#define _TEXTURE_DATA_H_INCLUDED_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class TextureData
+{
+public:
+    // Read and decode the given image file. Safe to call from any thread
+    // Returns false on failure
+    bool Load(const std::string& fileName);
+
+    // Approximate GPU memory the texture will use once created, in bytes
+    std::size_t GPUSize() const;
+
+
+    bool isDDS = false; // If true the fileData holds a DDS file, otherwise pixels holds the decoded image
+
+    std::vector<uint8_t> fileData; // Complete DDS file
+
+    unsigned int         width  = 0;
+    unsigned int         height = 0;
+    std::vector<uint8_t> pixels; // Decoded image, 4 bytes per pixel (R8G8B8A8), rows are width * 4 bytes apart
+};
+
+
+#endif //_TEXTURE_DATA_H_INCLUDED_
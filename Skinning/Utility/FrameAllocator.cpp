@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// Frame allocator - fast scratch memory for temporaries that only live for one frame
+//--------------------------------------------------------------------------------------
+
+#include "FrameAllocator.h"
+
+#include <algorithm>
+#include <cstdint>
+
+
+// Create the allocator with a buffer of the given size in bytes
+FrameAllocator::FrameAllocator(std::size_t capacity)
+    : mBuffer(new unsigned char[capacity]), mCapacity(capacity)
+{
+}
+
+FrameAllocator::~FrameAllocator()
+{
+    for (auto block : mOverflowBlocks)  delete[] block;
+    delete[] mBuffer;
+}
+
+
+// Allocate uninitialised memory that stays valid until the next Reset. Alignment must be a power of 2
+void* FrameAllocator::Allocate(std::size_t bytes, std::size_t alignment /*= 16*/)
+{
+    // Align the next free position within the buffer
+    std::uintptr_t start   = reinterpret_cast<std::uintptr_t>(mBuffer) + mUsed;
+    std::size_t    padding = static_cast<std::size_t>((alignment - (start & (alignment - 1))) & (alignment - 1));
+    if (padding + bytes <= mCapacity - mUsed)
+    {
+        mUsed += padding + bytes;
+        return mBuffer + mUsed - bytes;
+    }
+
+    // Buffer is full, use a separate heap block for this frame (with room for alignment)
+    unsigned char* block = new unsigned char[bytes + alignment];
+    mOverflowBlocks.push_back(block);
+    mOverflowBytes += bytes + alignment;
+
+    start = reinterpret_cast<std::uintptr_t>(block);
+    padding = static_cast<std::size_t>((alignment - (start & (alignment - 1))) & (alignment - 1));
+    return block + padding;
+}
+
+
+// Free everything allocated since the last reset, call once at the start of each frame. If the last frame needed
+// extra memory the buffer is enlarged here
+void FrameAllocator::Reset()
+{
+    std::size_t used = Used();
+    mPeakUsed = std::max(mPeakUsed, used);
+    mUsed = 0;
+
+    if (!mOverflowBlocks.empty())
+    {
+        for (auto block : mOverflowBlocks)  delete[] block;
+        mOverflowBlocks.clear();
+
+        // Grow with some spare so a frame that needs slightly more doesn't cause another reallocation
+        std::size_t newCapacity = used * 3 / 2;
+        mOverflowBytes = 0;
+        delete[] mBuffer;
+        mBuffer = nullptr; // Leave the allocator empty rather than dangling if the new throws
+        mCapacity = 0;
+        mBuffer = new unsigned char[newCapacity];
+        mCapacity = newCapacity;
+    }
+}
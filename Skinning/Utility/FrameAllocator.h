@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Frame allocator - fast scratch memory for temporaries that only live for one frame
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Allocation just moves a pointer along a pre-allocated buffer, and everything is freed at once
+// when Reset is called at the start of each frame. Use it instead of local std::vectors etc. in
+// code that runs every frame, so steady-state frames don't use the heap at all.
+// If a frame needs more memory than the buffer holds, extra blocks are taken from the heap for
+// that frame only, and the next Reset grows the buffer to fit. So after a few frames of warm-up
+// there are no more heap allocations.
+// Memory is not initialised and no constructors or destructors are run. Not thread-safe - only
+// use it from the main thread.
+
+#ifndef _FRAME_ALLOCATOR_H_INCLUDED_
+#define _FRAME_ALLOCATOR_H_INCLUDED_
+
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+
+class FrameAllocator
+{
+public:
+    // Create the allocator with a buffer of the given size in bytes
+    explicit FrameAllocator(std::size_t capacity);
+
+    ~FrameAllocator();
+
+    FrameAllocator(const FrameAllocator&) = delete;
+    FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+
+    // Allocate uninitialised memory that stays valid until the next Reset. Alignment must be a power of 2
+    void* Allocate(std::size_t bytes, std::size_t alignment = 16);
+
+    // Allocate an uninitialised array of the given type, which must not need a destructor (e.g. matrices, vectors)
+    template <typename T>
+    T* Allocate(std::size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "FrameAllocator doesn't run destructors");
+        return static_cast<T*>(Allocate(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16));
+    }
+
+    // Free everything allocated since the last reset, call once at the start of each frame. If the last frame needed
+    // extra memory the buffer is enlarged here
+    void Reset();
+
+
+    // Bytes allocated since the last reset, the size of the buffer, and the most used in any frame so far
+    std::size_t Used() const      { return mUsed + mOverflowBytes; }
+    std::size_t Capacity() const  { return mCapacity; }
+    std::size_t PeakUsed() const  { return mPeakUsed; }
+
+
+private:
+    unsigned char* mBuffer;
+    std::size_t    mCapacity;
+    std::size_t    mUsed = 0;
+
+    std::vector<unsigned char*> mOverflowBlocks;    // Extra heap blocks used when the buffer filled up this frame
+    std::size_t                 mOverflowBytes = 0; // Total size of the extra blocks
+    std::size_t                 mPeakUsed = 0;
+};
+
+
+#endif //_FRAME_ALLOCATOR_H_INCLUDED_
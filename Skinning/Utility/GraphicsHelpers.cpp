@@ -4,6 +4,7 @@
 
 #include "GraphicsHelpers.h"
 #include "../Shader.h"
+#include "StateCache.h"
 #include <cmath>
 #include <cctype>
 #include <atlbase.h> // C-string to unicode conversion function CA2CT
@@ -32,6 +33,84 @@ bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderRes
 }
 
 
+// Create a texture from image data that has already been read / decoded on the CPU (see TextureData.h). Allows the
+// slow file reading and decoding to be done on other threads with only this final step on the D3D context thread.
+// Fills in the same pointers as LoadTexture above. Returns false on failure
+bool CreateTextureFromData(const TextureData& data, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV)
+{
+    if (data.isDDS)
+    {
+        return SUCCEEDED(DirectX::CreateDDSTextureFromMemory(gD3DDevice, data.fileData.data(), data.fileData.size(), texture, textureSRV));
+    }
+
+    // Decoded images get a full mip-map chain generated on the GPU, matching what LoadTexture does for these files
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width = data.width;
+    textureDesc.Height = data.height;
+    textureDesc.MipLevels = 0; // 0 means a full chain of mip-maps
+    textureDesc.ArraySize = 1;
+    textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.SampleDesc.Quality = 0;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET; // Render target needed to generate mip-maps
+    textureDesc.CPUAccessFlags = 0;
+    textureDesc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS;
+
+    ID3D11Texture2D* newTexture = nullptr;
+    if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &newTexture)))  return false;
+
+    ID3D11ShaderResourceView* newSRV = nullptr;
+    if (FAILED(gD3DDevice->CreateShaderResourceView(newTexture, nullptr, &newSRV)))
+    {
+        newTexture->Release();
+        return false;
+    }
+
+    // Copy the top level over then let the GPU fill in the smaller levels
+    gD3DContext->UpdateSubresource(newTexture, 0, nullptr, data.pixels.data(), data.width * 4, 0);
+    gD3DContext->GenerateMips(newSRV);
+
+    *texture = newTexture;
+    *textureSRV = newSRV;
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+
+// Upload statistics, see header
+std::size_t  gConstantBufferBytes   = 0;
+unsigned int gConstantBufferUpdates = 0;
+
+// Copy the given number of bytes to the start of a constant buffer. The rest of the buffer's contents are undefined
+// afterwards (the old contents are discarded), so shaders must only read the part that was written
+// The copy goes through the state cache's sink, so uploads can be counted without a device (see StateSink)
+void UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size)
+{
+    gStateCache.UpdateBuffer(buffer, data, size);
+
+    gConstantBufferBytes += size;
+    ++gConstantBufferUpdates;
+}
+
+// Copy the given number of bytes to the start of a structured buffer, discarding its old contents. Dynamic structured
+// buffers are mapped in the same way as constant buffers
+void UpdateStructuredBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size)
+{
+    UpdateConstantBuffer(buffer, data, size);
+}
+
+// Copy the given number of bytes to the start of an instance buffer, discarding its old contents. Also mapped the same
+// way as a constant buffer
+void UpdateInstanceBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size)
+{
+    UpdateConstantBuffer(buffer, data, size);
+}
+
+
 //--------------------------------------------------------------------------------------
 // Camera Helpers
 //--------------------------------------------------------------------------------------
@@ -54,3 +133,16 @@ CMatrix4x4 MakeProjectionMatrix(float aspectRatio /*= 4.0f / 3.0f*/, float FOVx
                          0.0f,   0.0f, scaleZa,   1.0f,
                          0.0f,   0.0f, scaleZb,   0.0f };
 }
+
+// An orthographic projection has no perspective, used for directional lights whose rays are parallel
+// - width and height are the size of the area covered in world units, centred on the camera
+CMatrix4x4 MakeOrthographicMatrix(float width, float height, float nearClip, float farClip)
+{
+    float scaleZa = 1.0f / (farClip - nearClip);
+    float scaleZb = -nearClip * scaleZa;
+
+    return CMatrix4x4{ 2.0f / width,          0.0f,    0.0f, 0.0f,
+                               0.0f, 2.0f / height,    0.0f, 0.0f,
+                               0.0f,          0.0f, scaleZa, 0.0f,
+                               0.0f,          0.0f, scaleZb, 1.0f };
+}
@@ -8,27 +8,44 @@
 
 #include <WICTextureLoader.h>
 #include <DDSTextureLoader.h>
+#include <cstddef>
 
 #include "CMatrix4x4.h"
 #include "../Common.h"
+#include "../TextureData.h"
 
 
 //--------------------------------------------------------------------------------------
 // Constant buffers
 //--------------------------------------------------------------------------------------
 
+// Copy the given number of bytes to the start of a constant buffer. The rest of the buffer's contents are undefined
+// afterwards (the old contents are discarded), so shaders must only read the part that was written. Used to upload
+// only the bones a skinned mesh has rather than the whole bone array
+void UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size);
+
 // Template function to update a constant buffer. Pass the DirectX constant buffer object and the C++ data structure
 // you want to update it with. The structure will be copied in full over to the GPU constant buffer, where it will
 // be available to shaders. This is used to update model and camera positions, lighting data etc.
 template <class T>
 void UpdateConstantBuffer(ID3D11Buffer* buffer, const T& bufferData)
 {
-    D3D11_MAPPED_SUBRESOURCE cb;
-    gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
-    memcpy(cb.pData, &bufferData, sizeof(T));
-    gD3DContext->Unmap(buffer, 0);
+    UpdateConstantBuffer(buffer, &bufferData, sizeof(T));
 }
 
+// Copy the given number of bytes to the start of a structured buffer (see CreateStructuredBuffer in Shader.h). As
+// above, the rest of the buffer is undefined afterwards so shaders must only read the part written
+void UpdateStructuredBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size);
+
+// Copy the given number of bytes to the start of an instance buffer (see CreateInstanceBuffer in Shader.h). Again the
+// rest of the buffer is undefined afterwards, so only draw as many instances as were written
+void UpdateInstanceBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size);
+
+// Total bytes copied to constant, structured and instance buffers by the functions above, and the number of updates. The scene
+// resets these each frame to report the upload cost per frame
+extern std::size_t  gConstantBufferBytes;
+extern unsigned int gConstantBufferUpdates;
+
 
 //--------------------------------------------------------------------------------------
 // Texture Loading
@@ -40,6 +57,11 @@ void UpdateConstantBuffer(ID3D11Buffer* buffer, const T& bufferData)
 // The function will fill in these pointers with usable data. Returns false on failure
 bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV);
 
+// Create a texture from image data that has already been read / decoded on the CPU (see TextureData.h). Allows the
+// slow file reading and decoding to be done on other threads with only this final step on the D3D context thread.
+// Fills in the same pointers as LoadTexture above. Returns false on failure
+bool CreateTextureFromData(const TextureData& data, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV);
+
 
 //--------------------------------------------------------------------------------------
 // Camera helpers
@@ -52,5 +74,9 @@ bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderRes
 CMatrix4x4 MakeProjectionMatrix(float aspectRatio = 4.0f / 3.0f, float FOVx = ToRadians(60),
                                 float nearClip = 0.1f, float farClip = 10000.0f);
 
+// An orthographic projection has no perspective, used for directional lights whose rays are parallel
+// - width and height are the size of the area covered in world units, centred on the camera
+CMatrix4x4 MakeOrthographicMatrix(float width, float height, float nearClip, float farClip);
+
 
 #endif //_SCENE_HELPERS_H_INCLUDED_
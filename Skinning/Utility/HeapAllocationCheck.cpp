@@ -0,0 +1,120 @@
+//--------------------------------------------------------------------------------------
+// Heap allocation check - debug counter to catch heap use in steady-state frames
+//--------------------------------------------------------------------------------------
+
+#include "HeapAllocationCheck.h"
+
+#include <new>
+#include <cstdlib>
+#include <cassert>
+#include <atomic>
+
+
+#ifdef _DEBUG
+
+//--------------------------------------------------------------------------------------
+// Counting replacements for the global operator new / delete
+//--------------------------------------------------------------------------------------
+// Replacing these in any one file replaces them for the whole program. Each thread has its own
+// count, and a shared count covers all threads so the frame check includes jobs run on the pool
+
+namespace
+{
+    thread_local uint64_t gThreadHeapAllocations = 0;
+    std::atomic<uint64_t> gTotalHeapAllocations{0};
+
+    void* CountedAllocate(std::size_t size)
+    {
+        ++gThreadHeapAllocations;
+        gTotalHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+        return std::malloc(size > 0 ? size : 1);
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    void* p = CountedAllocate(size);
+    if (p == nullptr)  throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    void* p = CountedAllocate(size);
+    if (p == nullptr)  throw std::bad_alloc();
+    return p;
+}
+
+void* operator new  (std::size_t size, const std::nothrow_t&) noexcept  { return CountedAllocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept  { return CountedAllocate(size); }
+
+void operator delete  (void* p) noexcept  { std::free(p); }
+void operator delete[](void* p) noexcept  { std::free(p); }
+void operator delete  (void* p, const std::nothrow_t&) noexcept  { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept  { std::free(p); }
+void operator delete  (void* p, std::size_t) noexcept  { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept  { std::free(p); }
+
+
+// Number of heap allocations (operator new) made by the calling thread so far. Always 0 in release builds
+uint64_t HeapAllocationCount()
+{
+    return gThreadHeapAllocations;
+}
+
+// Number of heap allocations made by all threads so far. Always 0 in release builds
+uint64_t TotalHeapAllocationCount()
+{
+    return gTotalHeapAllocations.load(std::memory_order_relaxed);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Frame check
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    unsigned int gFrameCount = 0;
+    uint64_t     gFrameStartAllocations = 0;
+    bool         gAllowFrameAllocations = false;
+}
+
+// Call at the start and end of each frame in the main loop. In debug builds EndFrameHeapCheck asserts if the frame
+// made any heap allocations after the warm-up frames
+void BeginFrameHeapCheck()
+{
+    gFrameStartAllocations = TotalHeapAllocationCount();
+    gAllowFrameAllocations = false;
+}
+
+void EndFrameHeapCheck()
+{
+    uint64_t frameAllocations = TotalHeapAllocationCount() - gFrameStartAllocations;
+    if (gFrameCount < HEAP_CHECK_WARM_UP_FRAMES)
+    {
+        ++gFrameCount;
+        return;
+    }
+
+    // If this fires, something in UpdateScene / RenderScene, or a job they run, is using the heap every frame. Use the
+    // frame allocator (gFrameAllocator) for temporaries, or allocate once at startup
+    assert(frameAllocations == 0 || gAllowFrameAllocations);
+    (void)frameAllocations;
+}
+
+// Don't check the current frame, call when a frame is expected to allocate (e.g. running a benchmark)
+void AllowFrameHeapAllocations()
+{
+    gAllowFrameAllocations = true;
+}
+
+#else
+
+uint64_t HeapAllocationCount()      { return 0; }
+uint64_t TotalHeapAllocationCount() { return 0; }
+void BeginFrameHeapCheck()          {}
+void EndFrameHeapCheck()            {}
+void AllowFrameHeapAllocations()    {}
+
+#endif // _DEBUG
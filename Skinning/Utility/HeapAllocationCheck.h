@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------
+// Heap allocation check - debug counter to catch heap use in steady-state frames
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// In debug builds the global operator new is replaced with a version that counts allocations,
+// both for each thread and for the whole program. The main loop wraps each frame in
+// BeginFrameHeapCheck / EndFrameHeapCheck, which asserts that the frame made no heap allocations
+// on any thread once the app has warmed up (loading done, frame allocator grown etc.). This
+// includes frame work run as jobs on the thread pool. Per-frame temporaries should use the
+// frame allocator (see FrameAllocator.h) instead.
+// Frames that are expected to allocate, e.g. when a debug key runs a benchmark, can call
+// AllowFrameHeapAllocations. In release builds nothing is counted and the checks do nothing.
+
+#ifndef _HEAP_ALLOCATION_CHECK_H_INCLUDED_
+#define _HEAP_ALLOCATION_CHECK_H_INCLUDED_
+
+#include <cstdint>
+
+// Number of frames after startup before the check starts, allowing buffers to reach their steady-state sizes
+const unsigned int HEAP_CHECK_WARM_UP_FRAMES = 60;
+
+
+// Number of heap allocations (operator new) made by the calling thread so far. Always 0 in release builds
+uint64_t HeapAllocationCount();
+
+// Number of heap allocations made by all threads so far. Always 0 in release builds
+uint64_t TotalHeapAllocationCount();
+
+// Call at the start and end of each frame in the main loop. In debug builds EndFrameHeapCheck asserts if the frame
+// made any heap allocations after the warm-up frames
+void BeginFrameHeapCheck();
+void EndFrameHeapCheck();
+
+// Don't check the current frame, call when a frame is expected to allocate (e.g. running a benchmark)
+void AllowFrameHeapAllocations();
+
+
+#endif //_HEAP_ALLOCATION_CHECK_H_INCLUDED_
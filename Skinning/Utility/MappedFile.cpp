@@ -0,0 +1,122 @@
+//--------------------------------------------------------------------------------------
+// Read-only memory mapped file
+//--------------------------------------------------------------------------------------
+
+#include "MappedFile.h"
+
+#include <utility>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(mData,          other.mData);
+        std::swap(mSize,          other.mSize);
+        std::swap(mFileHandle,    other.mFileHandle);
+        std::swap(mMappingHandle, other.mMappingHandle);
+    }
+    return *this;
+}
+
+
+// Map the given file for reading. Returns false if the file doesn't exist or can't be mapped
+bool MappedFile::Open(const std::string& fileName)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)  return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mFileHandle    = file;
+    mMappingHandle = mapping;
+    mData = static_cast<const unsigned char*>(view);
+    mSize = static_cast<std::size_t>(size.QuadPart);
+#else
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)  return false;
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        close(file);
+        return false;
+    }
+
+    void* view = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); // The mapping keeps its own reference to the file
+    if (view == MAP_FAILED)  return false;
+
+    mData = static_cast<const unsigned char*>(view);
+    mSize = static_cast<std::size_t>(info.st_size);
+#endif
+
+    return true;
+}
+
+
+// Unmap the file. Any pointers previously returned by Data become invalid
+void MappedFile::Close()
+{
+    if (mData == nullptr)  return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(mData);
+    CloseHandle(mMappingHandle);
+    CloseHandle(mFileHandle);
+#else
+    munmap(const_cast<unsigned char*>(mData), mSize);
+#endif
+
+    mData = nullptr;
+    mSize = 0;
+    mFileHandle    = nullptr;
+    mMappingHandle = nullptr;
+}
@@ -0,0 +1,49 @@
+//--------------------------------------------------------------------------------------
+// Read-only memory mapped file
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// The operating system pages the file contents in as they are read, so large binary files can be used in place
+// without reading them into a separate buffer first
+
+#ifndef _MAPPED_FILE_H_INCLUDED_
+#define _MAPPED_FILE_H_INCLUDED_
+
+#include <string>
+#include <cstddef>
+
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile();
+
+    // Mapped files can be moved but not copied
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+
+    // Map the given file for reading. Returns false if the file doesn't exist or can't be mapped
+    bool Open(const std::string& fileName);
+
+    // Unmap the file. Any pointers previously returned by Data become invalid
+    void Close();
+
+
+    // Access the file contents, nullptr if no file is open
+    const unsigned char* Data() const  { return mData; }
+    std::size_t          Size() const  { return mSize; }
+
+
+private:
+    const unsigned char* mData = nullptr;
+    std::size_t          mSize = 0;
+
+    // Operating system handles for the open file and its mapping
+    void* mFileHandle    = nullptr;
+    void* mMappingHandle = nullptr;
+};
+
+
+#endif //_MAPPED_FILE_H_INCLUDED_
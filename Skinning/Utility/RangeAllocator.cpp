@@ -0,0 +1,292 @@
+//--------------------------------------------------------------------------------------
+// Range allocator - hands out ranges of a fixed size space, e.g. the elements of a buffer
+//--------------------------------------------------------------------------------------
+
+#include "RangeAllocator.h"
+
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdio>
+
+
+// Create an allocator for a space of the given size, all of it free
+RangeAllocator::RangeAllocator(uint32_t capacity /*= 0*/)
+{
+    Reset(capacity);
+}
+
+// Free everything and change the size of the space
+void RangeAllocator::Reset(uint32_t capacity)
+{
+    mBlocks.clear();
+    if (capacity > 0)  mBlocks.push_back({ 0, capacity, true });
+    mCapacity    = capacity;
+    mUsed        = 0;
+    mAllocations = 0;
+}
+
+
+// Block starting at the given offset, or mBlocks.end() if none
+std::vector<RangeAllocator::Block>::iterator RangeAllocator::FindBlock(uint32_t offset)
+{
+    auto block = std::lower_bound(mBlocks.begin(), mBlocks.end(), offset, [](const Block& b, uint32_t o) { return b.offset < o; });
+    return (block != mBlocks.end() && block->offset == offset) ? block : mBlocks.end();
+}
+
+std::vector<RangeAllocator::Block>::const_iterator RangeAllocator::FindBlock(uint32_t offset) const
+{
+    auto block = std::lower_bound(mBlocks.begin(), mBlocks.end(), offset, [](const Block& b, uint32_t o) { return b.offset < o; });
+    return (block != mBlocks.end() && block->offset == offset) ? block : mBlocks.end();
+}
+
+
+// Allocate a range of the given size, returns its offset or INVALID_OFFSET if no gap is large enough. Sizes of 0
+// always fail
+uint32_t RangeAllocator::Allocate(uint32_t size)
+{
+    if (size == 0)  return INVALID_OFFSET;
+
+    // Best fit: the smallest gap that is large enough, the first one found if several are the same size. Leaves the
+    // large gaps for large allocations
+    auto best = mBlocks.end();
+    for (auto block = mBlocks.begin(); block != mBlocks.end(); ++block)
+    {
+        if (block->free && block->size >= size && (best == mBlocks.end() || block->size < best->size))
+        {
+            best = block;
+            if (best->size == size)  break; // Can't do better than an exact fit
+        }
+    }
+    if (best == mBlocks.end())  return INVALID_OFFSET;
+
+    uint32_t offset = best->offset;
+    if (best->size > size)
+    {
+        // Split off the rest of the gap as a new free block after this one
+        Block rest = { offset + size, best->size - size, true };
+        best->size = size;
+        best = mBlocks.insert(best + 1, rest) - 1;
+    }
+    best->free = false;
+
+    mUsed += size;
+    ++mAllocations;
+    return offset;
+}
+
+
+// Free the allocation at the given offset. Returns false if there is no allocation there
+bool RangeAllocator::Free(uint32_t offset)
+{
+    auto block = FindBlock(offset);
+    if (block == mBlocks.end() || block->free)  return false;
+
+    mUsed -= block->size;
+    --mAllocations;
+    block->free = true;
+
+    // Merge with the free blocks either side, so the gap can be used for larger allocations
+    if (block + 1 != mBlocks.end() && (block + 1)->free)
+    {
+        block->size += (block + 1)->size;
+        block = mBlocks.erase(block + 1) - 1;
+    }
+    if (block != mBlocks.begin() && (block - 1)->free)
+    {
+        (block - 1)->size += block->size;
+        mBlocks.erase(block);
+    }
+    return true;
+}
+
+
+// Size of the allocation at the given offset, 0 if there is none
+uint32_t RangeAllocator::AllocationSize(uint32_t offset) const
+{
+    auto block = FindBlock(offset);
+    return (block == mBlocks.end() || block->free) ? 0 : block->size;
+}
+
+
+// True if the allocations are already packed at the start, i.e. compacting would move nothing
+bool RangeAllocator::IsCompact() const
+{
+    // Free blocks never follow each other, so packed means at most one free block and it is the last
+    for (std::size_t i = 0; i + 1 < mBlocks.size(); ++i)
+    {
+        if (mBlocks[i].free)  return false;
+    }
+    return true;
+}
+
+
+// Pack the allocations to the start of the space, keeping their order. Fills moves with every allocation (in order
+// of offset) and where it is now, including those that don't move. Moves never go to a higher offset, so they can
+// be applied in order to data held in place
+void RangeAllocator::Compact(std::vector<Move>& moves)
+{
+    moves.clear();
+    uint32_t offset = 0;
+    for (auto& block : mBlocks)
+    {
+        if (block.free)  continue;
+        moves.push_back({ block.offset, offset, block.size });
+        offset += block.size;
+    }
+
+    mBlocks.clear();
+    for (auto& move : moves)  mBlocks.push_back({ move.to, move.size, false });
+    if (offset < mCapacity)  mBlocks.push_back({ offset, mCapacity - offset, true });
+}
+
+
+// Current usage, calculated on request
+RangeAllocatorStats RangeAllocator::Stats() const
+{
+    RangeAllocatorStats stats;
+    stats.capacity    = mCapacity;
+    stats.used        = mUsed;
+    stats.allocations = mAllocations;
+    for (auto& block : mBlocks)
+    {
+        if (!block.free)  continue;
+        ++stats.freeBlocks;
+        stats.largestFree = std::max(stats.largestFree, block.size);
+    }
+    return stats;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Benchmark
+-----------------------------------------------------------------------------------------*/
+
+// Check and time the allocator with a random mix of allocations and frees in a space of the given size. Every
+// allocation is tracked in a copy of the space to check that none overlap and the stats add up, then the allocator is
+// compacted and the moves applied to the copy to check that every allocation's contents survive and the free space
+// ends up in one block. Returns a report for the debug output
+std::string BenchmarkRangeAllocator(unsigned int numOperations, uint32_t capacity)
+{
+    struct Allocation
+    {
+        uint32_t offset;
+        uint32_t size;
+        uint32_t id;
+    };
+
+    // Sizes vary a lot, like the sub-meshes of different models. Slightly more allocations than frees so the space
+    // fills up and allocations start to fail
+    const uint32_t maxSize = std::max(capacity / 256, 1u);
+    auto runOperations = [&](RangeAllocator& allocator, std::vector<Allocation>& live, std::vector<uint32_t>* owners,
+                             unsigned int& failures, unsigned int& errors)
+    {
+        std::mt19937 random(1);
+        std::uniform_int_distribution<uint32_t> size(1, maxSize);
+        std::uniform_int_distribution<int> choice(0, 99);
+        uint32_t nextId = 1;
+        uint32_t used = 0;
+        for (unsigned int i = 0; i < numOperations; ++i)
+        {
+            if (live.empty() || choice(random) < 55)
+            {
+                uint32_t s = size(random);
+                uint32_t offset = allocator.Allocate(s);
+                if (offset == RangeAllocator::INVALID_OFFSET)
+                {
+                    ++failures;
+                    continue;
+                }
+                live.push_back({ offset, s, nextId++ });
+                used += s;
+                if (owners != nullptr)
+                {
+                    // The range must have been unused, then it is marked as belonging to this allocation
+                    for (uint32_t e = offset; e < offset + s; ++e)
+                    {
+                        if ((*owners)[e] != 0)  ++errors;
+                        (*owners)[e] = live.back().id;
+                    }
+                }
+            }
+            else
+            {
+                std::size_t index = random() % live.size();
+                Allocation allocation = live[index];
+                live[index] = live.back();
+                live.pop_back();
+                if (!allocator.Free(allocation.offset))  ++errors;
+                used -= allocation.size;
+                if (owners != nullptr)  std::fill(owners->begin() + allocation.offset, owners->begin() + allocation.offset + allocation.size, 0u);
+            }
+            if (owners != nullptr && allocator.Stats().used != used)  ++errors;
+        }
+    };
+
+    std::string report;
+    char line[256];
+    std::snprintf(line, sizeof(line), "Range allocator benchmark: %u operations, capacity %u, sizes 1 to %u\n", numOperations, capacity, maxSize);
+    report += line;
+
+    // Timing run without the checks
+    {
+        RangeAllocator allocator(capacity);
+        std::vector<Allocation> live;
+        unsigned int failures = 0, errors = 0;
+        auto start = std::chrono::steady_clock::now();
+        runOperations(allocator, live, nullptr, failures, errors);
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        std::snprintf(line, sizeof(line), "  %.1f ns/operation, %u allocations failed\n", time.count() * 1e9 / numOperations, failures);
+        report += line;
+    }
+
+    // Same operations again, checked against a copy of the space that records which allocation owns each element
+    RangeAllocator allocator(capacity);
+    std::vector<Allocation> live;
+    std::vector<uint32_t> owners(capacity, 0);
+    unsigned int failures = 0, errors = 0;
+    runOperations(allocator, live, &owners, failures, errors);
+
+    RangeAllocatorStats before = allocator.Stats();
+    std::snprintf(line, sizeof(line), "  Before compaction: %u allocations, %.1f%% used, %u gaps, largest %u, fragmentation %.3f\n",
+                  before.allocations, 100.0 * before.used / before.capacity, before.freeBlocks, before.largestFree, before.Fragmentation());
+    report += line;
+
+    // Compact and apply the moves to the copy, in order as the data would be moved in place
+    std::vector<RangeAllocator::Move> moves;
+    auto start = std::chrono::steady_clock::now();
+    allocator.Compact(moves);
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    uint32_t moved = 0;
+    for (auto& move : moves)
+    {
+        if (move.to > move.from)  ++errors;
+        std::copy(owners.begin() + move.from, owners.begin() + move.from + move.size, owners.begin() + move.to);
+        if (move.to != move.from)  moved += move.size;
+    }
+
+    // Every allocation must be found in one piece at its new offset, and nothing else may be marked
+    std::sort(live.begin(), live.end(), [](const Allocation& a, const Allocation& b) { return a.offset < b.offset; });
+    if (moves.size() != live.size())  ++errors;
+    uint32_t end = 0;
+    for (std::size_t i = 0; i < live.size() && i < moves.size(); ++i)
+    {
+        if (moves[i].from != live[i].offset || moves[i].size != live[i].size)  ++errors;
+        for (uint32_t e = moves[i].to; e < moves[i].to + moves[i].size; ++e)
+        {
+            if (owners[e] != live[i].id)  ++errors;
+        }
+        if (allocator.AllocationSize(moves[i].to) != live[i].size)  ++errors;
+        end = moves[i].to + moves[i].size;
+    }
+    RangeAllocatorStats after = allocator.Stats();
+    if (after.freeBlocks > 1 || after.largestFree != after.capacity - after.used || after.used != end ||
+        after.Fragmentation() != 0 || !allocator.IsCompact())  ++errors;
+
+    std::snprintf(line, sizeof(line), "  After compaction:  %u gaps, largest %u, fragmentation %.3f, %u elements moved in %.3f ms\n",
+                  after.freeBlocks, after.largestFree, after.Fragmentation(), moved, time.count() * 1000);
+    report += line;
+    std::snprintf(line, sizeof(line), "  Errors: %u\n", errors);
+    report += line;
+    return report;
+}
@@ -0,0 +1,113 @@
+//--------------------------------------------------------------------------------------
+// Range allocator - hands out ranges of a fixed size space, e.g. the elements of a buffer
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Keeps a list of blocks covering the whole space in order, each one either allocated or free.
+// Allocation takes the smallest free block that fits (best fit) and splits off what is left.
+// Freeing a block merges it with free neighbours, so there are never two free blocks in a row.
+// Frees leave gaps between allocations, which can add up to plenty of free space with no single
+// gap large enough for a new allocation. Compact packs the allocations to the start of the space
+// in their current order, leaving one free block at the end, and returns the moves needed so the
+// owner can move its data to match (e.g. copy a GPU buffer, see GeometryArena.h).
+// Offsets and sizes are in whatever unit the owner chooses (bytes, vertices, indices).
+
+#ifndef _RANGE_ALLOCATOR_H_INCLUDED_
+#define _RANGE_ALLOCATOR_H_INCLUDED_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+
+// Current state of an allocator
+struct RangeAllocatorStats
+{
+    uint32_t capacity    = 0; // Size of the whole space
+    uint32_t used        = 0; // Total size of the allocations
+    uint32_t allocations = 0;
+    uint32_t freeBlocks  = 0; // Number of gaps
+    uint32_t largestFree = 0; // Size of the largest gap, the largest allocation that would succeed
+
+    // How broken up the free space is: 0 if it is all in one block (or there is none), approaching 1 as it is split
+    // into many small gaps. Calculated as 1 - largest gap / total free space
+    float Fragmentation() const
+    {
+        uint32_t free = capacity - used;
+        return (free == 0) ? 0.0f : 1.0f - static_cast<float>(largestFree) / free;
+    }
+};
+
+
+class RangeAllocator
+{
+public:
+    static const uint32_t INVALID_OFFSET = 0xffffffff; // Returned when an allocation fails
+
+    // Where an allocation moved to in a compaction
+    struct Move
+    {
+        uint32_t from;
+        uint32_t to;
+        uint32_t size;
+    };
+
+
+    // Create an allocator for a space of the given size, all of it free
+    explicit RangeAllocator(uint32_t capacity = 0);
+
+    // Free everything and change the size of the space
+    void Reset(uint32_t capacity);
+
+
+    // Allocate a range of the given size, returns its offset or INVALID_OFFSET if no gap is large enough. Sizes of 0
+    // always fail
+    uint32_t Allocate(uint32_t size);
+
+    // Free the allocation at the given offset. Returns false if there is no allocation there
+    bool Free(uint32_t offset);
+
+    // Size of the allocation at the given offset, 0 if there is none
+    uint32_t AllocationSize(uint32_t offset) const;
+
+
+    // True if the allocations are already packed at the start, i.e. compacting would move nothing
+    bool IsCompact() const;
+
+    // Pack the allocations to the start of the space, keeping their order. Fills moves with every allocation (in order
+    // of offset) and where it is now, including those that don't move. Moves never go to a higher offset, so they can
+    // be applied in order to data held in place
+    void Compact(std::vector<Move>& moves);
+
+
+    // Current usage, calculated on request
+    RangeAllocatorStats Stats() const;
+
+
+private:
+    struct Block
+    {
+        uint32_t offset;
+        uint32_t size;
+        bool     free;
+    };
+
+    // Block starting at the given offset, or mBlocks.end() if none
+    std::vector<Block>::iterator       FindBlock(uint32_t offset);
+    std::vector<Block>::const_iterator FindBlock(uint32_t offset) const;
+
+
+    std::vector<Block> mBlocks; // Cover the whole space in order of offset. Never two free blocks in a row
+    uint32_t           mCapacity    = 0;
+    uint32_t           mUsed        = 0;
+    uint32_t           mAllocations = 0;
+};
+
+
+// Check and time the allocator with a random mix of allocations and frees in a space of the given size. Every
+// allocation is tracked in a copy of the space to check that none overlap and the stats add up, then the allocator is
+// compacted and the moves applied to the copy to check that every allocation's contents survive and the free space
+// ends up in one block. Returns a report for the debug output
+std::string BenchmarkRangeAllocator(unsigned int numOperations, uint32_t capacity);
+
+
+#endif //_RANGE_ALLOCATOR_H_INCLUDED_
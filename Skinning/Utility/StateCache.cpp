@@ -0,0 +1,266 @@
+//--------------------------------------------------------------------------------------
+// State cache - filters out redundant pipeline state changes before they reach DirectX
+//--------------------------------------------------------------------------------------
+
+#include "StateCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+StateCache::StateCache(ID3D11DeviceContext* context /*= nullptr*/)
+{
+    SetContext(context);
+}
+
+
+// Select the context to forward calls to. Forgets all tracked state
+void StateCache::SetContext(ID3D11DeviceContext* context)
+{
+    mContextSink.SetContext(context);
+    SetSink(&mContextSink);
+}
+
+
+// Forward calls to the given sink rather than a context, e.g. one that records them. The sink must stay valid
+// until another sink or context is selected. Forgets all tracked state
+void StateCache::SetSink(StateSink* sink)
+{
+    mSink = sink;
+    Invalidate();
+}
+
+
+// Forget all tracked state, call after anything changes state without going through the cache
+void StateCache::Invalidate()
+{
+    mKnownVertexShader = mKnownPixelShader = mKnownInputLayout = mKnownTopology = false;
+    mKnownIndexBuffer = false;
+    std::fill(mKnownVertexBuffers, mKnownVertexBuffers + STATE_CACHE_VERTEX_SLOTS, false);
+    mKnownBlendState = mKnownDepthStencilState = mKnownRasterizerState = false;
+    std::fill(mKnownPSShaderResources, mKnownPSShaderResources + STATE_CACHE_SLOTS, false);
+    std::fill(mKnownPSSamplers,        mKnownPSSamplers        + STATE_CACHE_SLOTS, false);
+    std::fill(mKnownVSConstantBuffers, mKnownVSConstantBuffers + STATE_CACHE_SLOTS, false);
+    std::fill(mKnownPSConstantBuffers, mKnownPSConstantBuffers + STATE_CACHE_SLOTS, false);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shaders
+//--------------------------------------------------------------------------------------
+
+bool StateCache::SetVertexShader(ID3D11VertexShader* shader)
+{
+    if (!Changed(mVertexShader, shader, mKnownVertexShader))  return false;
+    mSink->VSSetShader(shader);
+    return true;
+}
+
+bool StateCache::SetPixelShader(ID3D11PixelShader* shader)
+{
+    if (!Changed(mPixelShader, shader, mKnownPixelShader))  return false;
+    mSink->PSSetShader(shader);
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Input assembler
+//--------------------------------------------------------------------------------------
+
+bool StateCache::SetInputLayout(ID3D11InputLayout* layout)
+{
+    if (!Changed(mInputLayout, layout, mKnownInputLayout))  return false;
+    mSink->IASetInputLayout(layout);
+    return true;
+}
+
+bool StateCache::SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    if (!Changed(mTopology, topology, mKnownTopology))  return false;
+    mSink->IASetPrimitiveTopology(topology);
+    return true;
+}
+
+// Slots from STATE_CACHE_VERTEX_SLOTS up are always forwarded
+bool StateCache::SetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset /*= 0*/)
+{
+    if (slot < STATE_CACHE_VERTEX_SLOTS)
+    {
+        // A different stride or offset with the same buffer still needs a call, so force a change if either differs
+        bool& known = mKnownVertexBuffers[slot];
+        if (known && (stride != mVertexStrides[slot] || offset != mVertexOffsets[slot]))  known = false;
+        if (!Changed(mVertexBuffers[slot], buffer, known))  return false;
+        mVertexStrides[slot] = stride;
+        mVertexOffsets[slot] = offset;
+    }
+    else
+    {
+        ++mStats.calls;
+        ++mStats.forwarded;
+    }
+    mSink->IASetVertexBuffer(slot, buffer, stride, offset);
+    return true;
+}
+
+bool StateCache::SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset /*= 0*/)
+{
+    if (mKnownIndexBuffer && (format != mIndexFormat || offset != mIndexOffset))  mKnownIndexBuffer = false;
+    if (!Changed(mIndexBuffer, buffer, mKnownIndexBuffer))  return false;
+    mIndexFormat = format;
+    mIndexOffset = offset;
+    mSink->IASetIndexBuffer(buffer, format, offset);
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Output merger / rasterizer states
+//--------------------------------------------------------------------------------------
+
+// Default blend factor and sample mask
+bool StateCache::SetBlendState(ID3D11BlendState* state)
+{
+    if (!Changed(mBlendState, state, mKnownBlendState))  return false;
+    mSink->OMSetBlendState(state);
+    return true;
+}
+
+bool StateCache::SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef /*= 0*/)
+{
+    if (mKnownDepthStencilState && stencilRef != mStencilRef)  mKnownDepthStencilState = false;
+    if (!Changed(mDepthStencilState, state, mKnownDepthStencilState))  return false;
+    mStencilRef = stencilRef;
+    mSink->OMSetDepthStencilState(state, stencilRef);
+    return true;
+}
+
+bool StateCache::SetRasterizerState(ID3D11RasterizerState* state)
+{
+    if (!Changed(mRasterizerState, state, mKnownRasterizerState))  return false;
+    mSink->RSSetState(state);
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader slots
+//--------------------------------------------------------------------------------------
+
+bool StateCache::SetPSShaderResource(UINT slot, ID3D11ShaderResourceView* view)
+{
+    if (!SlotChanged(mPSShaderResources, mKnownPSShaderResources, slot, view))  return false;
+    mSink->PSSetShaderResource(slot, view);
+    return true;
+}
+
+bool StateCache::SetPSSampler(UINT slot, ID3D11SamplerState* sampler)
+{
+    if (!SlotChanged(mPSSamplers, mKnownPSSamplers, slot, sampler))  return false;
+    mSink->PSSetSampler(slot, sampler);
+    return true;
+}
+
+bool StateCache::SetVSConstantBuffer(UINT slot, ID3D11Buffer* buffer)
+{
+    if (!SlotChanged(mVSConstantBuffers, mKnownVSConstantBuffers, slot, buffer))  return false;
+    mSink->VSSetConstantBuffer(slot, buffer);
+    return true;
+}
+
+bool StateCache::SetPSConstantBuffer(UINT slot, ID3D11Buffer* buffer)
+{
+    if (!SlotChanged(mPSConstantBuffers, mKnownPSConstantBuffers, slot, buffer))  return false;
+    mSink->PSSetConstantBuffer(slot, buffer);
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Context sink
+//--------------------------------------------------------------------------------------
+
+void ContextStateSink::VSSetShader(ID3D11VertexShader* shader)
+{
+    mContext->VSSetShader(shader, nullptr, 0);
+}
+
+void ContextStateSink::PSSetShader(ID3D11PixelShader* shader)
+{
+    mContext->PSSetShader(shader, nullptr, 0);
+}
+
+void ContextStateSink::IASetInputLayout(ID3D11InputLayout* layout)
+{
+    mContext->IASetInputLayout(layout);
+}
+
+void ContextStateSink::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    mContext->IASetPrimitiveTopology(topology);
+}
+
+void ContextStateSink::IASetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset)
+{
+    mContext->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+}
+
+void ContextStateSink::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+    mContext->IASetIndexBuffer(buffer, format, offset);
+}
+
+// Default blend factor and sample mask
+void ContextStateSink::OMSetBlendState(ID3D11BlendState* state)
+{
+    mContext->OMSetBlendState(state, nullptr, 0xffffff);
+}
+
+void ContextStateSink::OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef)
+{
+    mContext->OMSetDepthStencilState(state, stencilRef);
+}
+
+void ContextStateSink::RSSetState(ID3D11RasterizerState* state)
+{
+    mContext->RSSetState(state);
+}
+
+void ContextStateSink::PSSetShaderResource(UINT slot, ID3D11ShaderResourceView* view)
+{
+    mContext->PSSetShaderResources(slot, 1, &view);
+}
+
+void ContextStateSink::PSSetSampler(UINT slot, ID3D11SamplerState* sampler)
+{
+    mContext->PSSetSamplers(slot, 1, &sampler);
+}
+
+void ContextStateSink::VSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer)
+{
+    mContext->VSSetConstantBuffers(slot, 1, &buffer);
+}
+
+void ContextStateSink::PSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer)
+{
+    mContext->PSSetConstantBuffers(slot, 1, &buffer);
+}
+
+// Copy to the start of a dynamic buffer, discarding its old contents
+void ContextStateSink::UpdateBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size)
+{
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(mContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return;
+    std::memcpy(mapped.pData, data, size);
+    mContext->Unmap(buffer, 0);
+}
+
+void ContextStateSink::DrawIndexed(UINT numIndices, UINT firstIndex, INT baseVertex)
+{
+    mContext->DrawIndexed(numIndices, firstIndex, baseVertex);
+}
+
+void ContextStateSink::DrawIndexedInstanced(UINT numIndices, UINT numInstances, UINT firstIndex, INT baseVertex, UINT firstInstance)
+{
+    mContext->DrawIndexedInstanced(numIndices, numInstances, firstIndex, baseVertex, firstInstance);
+}
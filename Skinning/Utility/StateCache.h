@@ -0,0 +1,237 @@
+//--------------------------------------------------------------------------------------
+// State cache - filters out redundant pipeline state changes before they reach DirectX
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Wraps a D3D context and keeps a copy of the pipeline state it has set: shaders, input layout,
+// topology, vertex / index buffers, blend / depth / rasterizer states and the first few shader
+// resource, sampler and constant buffer slots. A call that would set what is already bound is
+// dropped. Each function returns true if the call was forwarded to the context.
+// All state changes must go through the cache (gStateCache), otherwise its copy will be out of
+// date. Call Invalidate after anything that changes state behind its back (e.g. ClearState), the
+// next call of each kind is then always forwarded.
+// Forwarded calls go to a sink, normally one that passes them on to the context. Another sink can
+// be given instead, e.g. one that records the calls so the cache can be tested without a device.
+// Draws and dynamic buffer updates go to the same sink, always forwarded as they change no tracked
+// state, so everything rendering sends to the GPU can be measured that way.
+
+#ifndef _STATE_CACHE_H_INCLUDED_
+#define _STATE_CACHE_H_INCLUDED_
+
+#include <d3d11.h>
+#include <cstddef>
+
+// Number of shader resource, sampler and constant buffer slots tracked. Calls for higher slots are always forwarded
+const unsigned int STATE_CACHE_SLOTS = 8;
+
+// Number of vertex buffer slots tracked: mesh vertices in slot 0 and instance data in slot 1
+const unsigned int STATE_CACHE_VERTEX_SLOTS = 2;
+
+
+// Receives the calls the cache forwards, one function for each kind of state plus buffer updates and draws. The cache
+// normally uses a ContextStateSink, passing them on to a D3D context. This base class drops every call
+class StateSink
+{
+public:
+    virtual ~StateSink() {}
+
+    virtual void VSSetShader(ID3D11VertexShader* /*shader*/) {}
+    virtual void PSSetShader(ID3D11PixelShader* /*shader*/) {}
+
+    virtual void IASetInputLayout(ID3D11InputLayout* /*layout*/) {}
+    virtual void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY /*topology*/) {}
+    virtual void IASetVertexBuffer(UINT /*slot*/, ID3D11Buffer* /*buffer*/, UINT /*stride*/, UINT /*offset*/) {}
+    virtual void IASetIndexBuffer(ID3D11Buffer* /*buffer*/, DXGI_FORMAT /*format*/, UINT /*offset*/) {}
+
+    virtual void OMSetBlendState(ID3D11BlendState* /*state*/) {}
+    virtual void OMSetDepthStencilState(ID3D11DepthStencilState* /*state*/, UINT /*stencilRef*/) {}
+    virtual void RSSetState(ID3D11RasterizerState* /*state*/) {}
+
+    virtual void PSSetShaderResource(UINT /*slot*/, ID3D11ShaderResourceView* /*view*/) {}
+    virtual void PSSetSampler(UINT /*slot*/, ID3D11SamplerState* /*sampler*/) {}
+    virtual void VSSetConstantBuffer(UINT /*slot*/, ID3D11Buffer* /*buffer*/) {}
+    virtual void PSSetConstantBuffer(UINT /*slot*/, ID3D11Buffer* /*buffer*/) {}
+
+    virtual void UpdateBuffer(ID3D11Buffer* /*buffer*/, const void* /*data*/, std::size_t /*size*/) {}
+    virtual void DrawIndexed(UINT /*numIndices*/, UINT /*firstIndex*/, INT /*baseVertex*/) {}
+    virtual void DrawIndexedInstanced(UINT /*numIndices*/, UINT /*numInstances*/, UINT /*firstIndex*/, INT /*baseVertex*/,
+                                      UINT /*firstInstance*/) {}
+};
+
+
+// Passes each call on to a D3D context, one slot at a time, with the default blend factor and sample mask
+class ContextStateSink : public StateSink
+{
+public:
+    void SetContext(ID3D11DeviceContext* context)  { mContext = context; }
+
+    void VSSetShader(ID3D11VertexShader* shader) override;
+    void PSSetShader(ID3D11PixelShader* shader) override;
+
+    void IASetInputLayout(ID3D11InputLayout* layout) override;
+    void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) override;
+    void IASetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset) override;
+    void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) override;
+
+    void OMSetBlendState(ID3D11BlendState* state) override;
+    void OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) override;
+    void RSSetState(ID3D11RasterizerState* state) override;
+
+    void PSSetShaderResource(UINT slot, ID3D11ShaderResourceView* view) override;
+    void PSSetSampler(UINT slot, ID3D11SamplerState* sampler) override;
+    void VSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer) override;
+    void PSSetConstantBuffer(UINT slot, ID3D11Buffer* buffer) override;
+
+    void UpdateBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size) override; // Maps with WRITE_DISCARD
+    void DrawIndexed(UINT numIndices, UINT firstIndex, INT baseVertex) override;
+    void DrawIndexedInstanced(UINT numIndices, UINT numInstances, UINT firstIndex, INT baseVertex, UINT firstInstance) override;
+
+private:
+    ID3D11DeviceContext* mContext = nullptr;
+};
+
+
+// Call counts since the last ResetStats
+struct StateCacheStats
+{
+    unsigned int calls     = 0; // Calls made to the cache
+    unsigned int forwarded = 0; // Calls that changed state so were sent to the context
+    unsigned int draws     = 0; // Draw calls, which are always sent and not counted above
+};
+
+
+class StateCache
+{
+public:
+    explicit StateCache(ID3D11DeviceContext* context = nullptr);
+
+    // The cache refers to its own context sink so cannot be copied
+    StateCache(const StateCache&) = delete;
+    StateCache& operator=(const StateCache&) = delete;
+
+    // Select the context to forward calls to. Forgets all tracked state
+    void SetContext(ID3D11DeviceContext* context);
+
+    // Forward calls to the given sink rather than a context, e.g. one that records them. The sink must stay valid
+    // until another sink or context is selected. Forgets all tracked state
+    void SetSink(StateSink* sink);
+    StateSink* Sink() const  { return mSink; }
+
+    // Forget all tracked state, call after anything changes state without going through the cache
+    void Invalidate();
+
+
+    //-------------------------------------
+    // State setting - each returns true if the call was forwarded
+    //-------------------------------------
+
+    bool SetVertexShader(ID3D11VertexShader* shader);
+    bool SetPixelShader(ID3D11PixelShader* shader);
+
+    bool SetInputLayout(ID3D11InputLayout* layout);
+    bool SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+    bool SetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset = 0);
+    bool SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset = 0);
+
+    bool SetBlendState(ID3D11BlendState* state);                       // Default blend factor and sample mask
+    bool SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef = 0);
+    bool SetRasterizerState(ID3D11RasterizerState* state);
+
+    // Pixel shader textures and samplers, and vertex / pixel shader constant buffers, one slot at a time
+    bool SetPSShaderResource(UINT slot, ID3D11ShaderResourceView* view);
+    bool SetPSSampler(UINT slot, ID3D11SamplerState* sampler);
+    bool SetVSConstantBuffer(UINT slot, ID3D11Buffer* buffer);
+    bool SetPSConstantBuffer(UINT slot, ID3D11Buffer* buffer);
+
+
+    //-------------------------------------
+    // Buffer updates and draws - always forwarded
+    //-------------------------------------
+
+    // Copy the given number of bytes to the start of a dynamic buffer (constant, structured or instance data),
+    // discarding its old contents
+    void UpdateBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size)  { mSink->UpdateBuffer(buffer, data, size); }
+
+    // Draws are counted in the stats, so callers can measure the draw calls they actually make
+    void DrawIndexed(UINT numIndices, UINT firstIndex, INT baseVertex)
+    {
+        ++mStats.draws;
+        mSink->DrawIndexed(numIndices, firstIndex, baseVertex);
+    }
+    void DrawIndexedInstanced(UINT numIndices, UINT numInstances, UINT firstIndex, INT baseVertex, UINT firstInstance)
+    {
+        ++mStats.draws;
+        mSink->DrawIndexedInstanced(numIndices, numInstances, firstIndex, baseVertex, firstInstance);
+    }
+
+
+    //-------------------------------------
+    // Statistics
+    //-------------------------------------
+
+    const StateCacheStats& Stats() const  { return mStats; }
+    void ResetStats()  { mStats = StateCacheStats(); }
+
+
+private:
+    // Update a tracked value, counting the call. Returns true if it changed (so the call must be forwarded)
+    template <class T>
+    bool Changed(T& bound, T value, bool& known)
+    {
+        ++mStats.calls;
+        if (known && bound == value)  return false;
+        bound = value;
+        known = true;
+        ++mStats.forwarded;
+        return true;
+    }
+
+    // Same for slot arrays, slots that are not tracked are always forwarded
+    template <class T>
+    bool SlotChanged(T* (&bound)[STATE_CACHE_SLOTS], bool (&known)[STATE_CACHE_SLOTS], UINT slot, T* value)
+    {
+        if (slot >= STATE_CACHE_SLOTS)
+        {
+            ++mStats.calls;
+            ++mStats.forwarded;
+            return true;
+        }
+        return Changed(bound[slot], value, known[slot]);
+    }
+
+
+    ContextStateSink mContextSink;
+    StateSink*       mSink; // The context sink unless another was selected
+
+    // Tracked state, only valid where the matching known flag is set
+    ID3D11VertexShader*       mVertexShader;
+    ID3D11PixelShader*        mPixelShader;
+    ID3D11InputLayout*        mInputLayout;
+    D3D11_PRIMITIVE_TOPOLOGY  mTopology;
+    ID3D11Buffer*             mVertexBuffers[STATE_CACHE_VERTEX_SLOTS];
+    UINT                      mVertexStrides[STATE_CACHE_VERTEX_SLOTS];
+    UINT                      mVertexOffsets[STATE_CACHE_VERTEX_SLOTS];
+    ID3D11Buffer*             mIndexBuffer;
+    DXGI_FORMAT               mIndexFormat;
+    UINT                      mIndexOffset;
+    ID3D11BlendState*         mBlendState;
+    ID3D11DepthStencilState*  mDepthStencilState;
+    UINT                      mStencilRef;
+    ID3D11RasterizerState*    mRasterizerState;
+    ID3D11ShaderResourceView* mPSShaderResources[STATE_CACHE_SLOTS];
+    ID3D11SamplerState*       mPSSamplers[STATE_CACHE_SLOTS];
+    ID3D11Buffer*             mVSConstantBuffers[STATE_CACHE_SLOTS];
+    ID3D11Buffer*             mPSConstantBuffers[STATE_CACHE_SLOTS];
+
+    bool mKnownVertexShader, mKnownPixelShader, mKnownInputLayout, mKnownTopology, mKnownIndexBuffer;
+    bool mKnownVertexBuffers[STATE_CACHE_VERTEX_SLOTS];
+    bool mKnownBlendState, mKnownDepthStencilState, mKnownRasterizerState;
+    bool mKnownPSShaderResources[STATE_CACHE_SLOTS];
+    bool mKnownPSSamplers[STATE_CACHE_SLOTS];
+    bool mKnownVSConstantBuffers[STATE_CACHE_SLOTS];
+    bool mKnownPSConstantBuffers[STATE_CACHE_SLOTS];
+
+    StateCacheStats mStats;
+};
+
+
+#endif //_STATE_CACHE_H_INCLUDED_
@@ -0,0 +1,639 @@
+//--------------------------------------------------------------------------------------
+// Thread pool - a fixed set of worker threads that run queued tasks and jobs
+//--------------------------------------------------------------------------------------
+
+#include "ThreadPool.h"
+
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+
+namespace
+{
+    // The pool whose worker is running on this thread and the index of its queue, so jobs added from inside a job go on
+    // the queue of the thread that added them
+    thread_local const ThreadPool* tCurrentPool  = nullptr;
+    thread_local unsigned int      tCurrentQueue = 0;
+
+    // Times a worker looks for a job again before it sleeps. Waking a sleeping thread takes several microseconds, longer
+    // than many jobs, so a worker that has just finished one stays awake briefly in case more are coming
+    const unsigned int WORKER_SPINS = 64;
+
+    // Ready jobs taken from a waiting list at once when a dependency reaches zero
+    const unsigned int RELEASE_BATCH = 16;
+
+    // Waiting job entries allocated at once when the free list runs out
+    const unsigned int WAITING_JOB_BLOCK = 256;
+}
+
+
+// A job held back until its dependency reaches zero, in a list on the dependency
+struct WaitingJob
+{
+    ThreadPool::Job job;
+    WaitingJob*     next;
+};
+
+
+// Create the worker threads. Pass 0 to use one fewer than the number of hardware threads (the
+// thread that calls WaitAll makes up the difference)
+ThreadPool::ThreadPool(unsigned int numThreads /*= 0*/)
+{
+    if (numThreads == 0)
+    {
+        unsigned int hardwareThreads = std::thread::hardware_concurrency(); // May return 0 if unknown
+        numThreads = (hardwareThreads > 1) ? hardwareThreads - 1 : 1;
+    }
+
+    // Queues must exist before the workers start looking in them
+    mNumQueues = numThreads + 1;
+    mQueues.reset(new JobQueue[mNumQueues]);
+    AddWaitingJobBlock();
+
+    mThreads.reserve(numThreads);
+    for (unsigned int i = 0; i < numThreads; ++i)
+    {
+        mThreads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+
+// Finishes any queued tasks and jobs then stops the worker threads
+ThreadPool::~ThreadPool()
+{
+    WaitAll();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mWorkAdded.notify_all();
+
+    for (auto& thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+
+// Add a task to the queue. Tasks may run in any order and on any thread
+void ThreadPool::AddTask(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTasks.push_back(std::move(task));
+        ++mUnfinishedTasks;
+    }
+    mWorkAdded.notify_one();
+}
+
+
+// Wait until all tasks added so far have finished. The calling thread runs queued tasks while it waits
+void ThreadPool::WaitAll()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (mUnfinishedTasks > 0)
+    {
+        if (!mTasks.empty())
+        {
+            RunNextTask(lock);
+        }
+        else
+        {
+            // Remaining tasks are running on workers
+            mTasksFinished.wait(lock, [this] { return mUnfinishedTasks == 0 || !mTasks.empty(); });
+        }
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Jobs
+-----------------------------------------------------------------------------------------*/
+
+// Run function(context) as a job on any thread, including the calling one. If a counter is given it is increased now
+// and decreased when the job finishes. If a dependency is given the job doesn't start until the dependency reaches
+// zero. Can be called from any thread, including from inside a job
+void ThreadPool::Run(JobFunction function, void* context, JobCounter* counter /*= nullptr*/,
+                     const JobCounter* dependency /*= nullptr*/)
+{
+    Job job = { function, nullptr, context, 0, 1, 1, counter };
+    Submit(job, dependency);
+}
+
+
+// Wait until the counter reaches zero. The calling thread runs jobs (any jobs, not just the counter's) while it waits.
+// Can be called from inside a job
+// The remaining jobs may all be running on other threads, so with nothing to run the thread gives up its time slice and
+// looks again. Waits are expected to be short, a thread waiting for long work should use a task and WaitAll
+void ThreadPool::Wait(const JobCounter& counter)
+{
+    unsigned int queue = CurrentQueue();
+    while (!counter.IsDone())
+    {
+        Job job;
+        if (FindJob(queue, job))  Execute(job, queue);
+        else                      std::this_thread::yield();
+    }
+}
+
+
+// Call function(context, begin, end) for batches of batchSize items covering the range [0, count). Batches are run on
+// the workers and the calling thread, and the call returns when all of them are done. Doesn't allocate memory, and can
+// be called from any thread, from inside a job or from inside another ParallelFor
+void ThreadPool::ParallelFor(unsigned int count, unsigned int batchSize, ParallelForFunction function, void* context)
+{
+    if (count == 0)  return;
+    if (batchSize == 0)  batchSize = 1;
+
+    // A single batch isn't worth waking the workers for
+    if (count <= batchSize)
+    {
+        function(context, 0, count);
+        return;
+    }
+
+    // The range goes on this thread's queue and Wait takes it straight back off, splitting it as it goes. Other threads
+    // steal the halves it puts back
+    JobCounter counter;
+    RunParallelFor(count, batchSize, function, context, &counter);
+    Wait(counter);
+}
+
+
+// As ParallelFor, but returns straight away: the range is added as a job using the counter (and dependency) as Run does.
+// The context must stay valid until the counter reaches zero
+void ThreadPool::RunParallelFor(unsigned int count, unsigned int batchSize, ParallelForFunction function, void* context,
+                                JobCounter* counter, const JobCounter* dependency /*= nullptr*/)
+{
+    if (count == 0)  return;
+    if (batchSize == 0)  batchSize = 1;
+
+    Job job = { nullptr, function, context, 0, count, batchSize, counter };
+    Submit(job, dependency);
+}
+
+
+// Job counts, accumulated over all threads until reset. Only exact when no jobs are running
+JobStats ThreadPool::Stats() const
+{
+    JobStats stats;
+    for (unsigned int i = 0; i < mNumQueues; ++i)
+    {
+        stats.jobs      += mQueues[i].jobsRun.load(std::memory_order_relaxed);
+        stats.stolen    += mQueues[i].jobsStolen.load(std::memory_order_relaxed);
+        stats.immediate += mQueues[i].jobsImmediate.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void ThreadPool::ResetStats()
+{
+    for (unsigned int i = 0; i < mNumQueues; ++i)
+    {
+        mQueues[i].jobsRun       = 0;
+        mQueues[i].jobsStolen    = 0;
+        mQueues[i].jobsImmediate = 0;
+    }
+}
+
+
+// Index of the calling thread's queue: its own for a worker of this pool, otherwise the queue shared by other threads
+unsigned int ThreadPool::CurrentQueue() const
+{
+    return (tCurrentPool == this) ? tCurrentQueue : mNumQueues - 1;
+}
+
+
+// Add a job to the calling thread's queue, or to the dependency's waiting list if it hasn't reached zero
+void ThreadPool::Submit(const Job& job, const JobCounter* dependency)
+{
+    if (job.counter != nullptr)  job.counter->mCount.fetch_add(1);
+
+    if (dependency != nullptr)
+    {
+        // Mark the dependency as having waiting jobs unless it has already reached zero. Once marked, the job that takes
+        // the count to zero takes this lock first (see Finish), so it can't miss the job added here
+        std::lock_guard<std::mutex> lock(mWaitingMutex);
+        unsigned int count = dependency->mCount.load();
+        while ((count & ~JobCounter::HAS_WAITING_JOBS) != 0 &&
+               !dependency->mCount.compare_exchange_weak(count, count | JobCounter::HAS_WAITING_JOBS)) {}
+
+        if ((count & ~JobCounter::HAS_WAITING_JOBS) != 0)
+        {
+            if (mFreeWaitingJobs == nullptr)  AddWaitingJobBlock(); // Only uses the heap if more jobs are waiting than ever before
+            WaitingJob* waiting = mFreeWaitingJobs;
+            mFreeWaitingJobs = waiting->next;
+            waiting->job  = job;
+            waiting->next = dependency->mWaitingJobs;
+            dependency->mWaitingJobs = waiting;
+            return;
+        }
+    }
+
+    Push(job, CurrentQueue());
+}
+
+
+// Add a block of entries to the free list of waiting jobs. The waiting lock must be held unless called from the constructor
+void ThreadPool::AddWaitingJobBlock()
+{
+    mWaitingJobBlocks.emplace_back(new WaitingJob[WAITING_JOB_BLOCK]);
+    WaitingJob* block = mWaitingJobBlocks.back().get();
+    for (unsigned int i = 0; i < WAITING_JOB_BLOCK; ++i)
+    {
+        block[i].next = mFreeWaitingJobs;
+        mFreeWaitingJobs = &block[i];
+    }
+}
+
+
+// Add a job to a queue and wake a sleeping worker. Runs the job immediately if the queue is full
+// Queue positions count up and wrap at 2^32, which JOB_QUEUE_SIZE divides, so they are used modulo the size
+void ThreadPool::Push(const Job& job, unsigned int queue)
+{
+    JobQueue& jobQueue = mQueues[queue];
+    {
+        std::unique_lock<std::mutex> lock(jobQueue.mutex);
+        if (jobQueue.back - jobQueue.front == JOB_QUEUE_SIZE)
+        {
+            lock.unlock();
+            jobQueue.jobsImmediate.fetch_add(1, std::memory_order_relaxed);
+            Execute(job, queue);
+            return;
+        }
+        jobQueue.jobs[jobQueue.back % JOB_QUEUE_SIZE] = job;
+        ++jobQueue.back;
+    }
+
+    // A worker about to sleep increases mSleepingWorkers then checks mQueuedJobs, this is the other way round, so either
+    // it sees this job or this sees it sleeping. Taking the lock means it is already waiting when it is notified
+    mQueuedJobs.fetch_add(1);
+    if (mSleepingWorkers.load() > 0)
+    {
+        { std::lock_guard<std::mutex> lock(mMutex); }
+        mWorkAdded.notify_one();
+    }
+}
+
+
+// Take the newest job from a queue, or steal the oldest from another. Returns false if all queues are empty
+bool ThreadPool::FindJob(unsigned int queue, Job& job)
+{
+    if (mQueuedJobs.load(std::memory_order_relaxed) == 0)  return false;
+
+    {
+        JobQueue& own = mQueues[queue];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.back != own.front)
+        {
+            --own.back;
+            job = own.jobs[own.back % JOB_QUEUE_SIZE];
+            mQueuedJobs.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // Start with the next queue along so thieves spread out over the queues
+    for (unsigned int i = 1; i < mNumQueues; ++i)
+    {
+        JobQueue& victim = mQueues[(queue + i) % mNumQueues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.back != victim.front)
+        {
+            job = victim.jobs[victim.front % JOB_QUEUE_SIZE];
+            ++victim.front;
+            mQueuedJobs.fetch_sub(1);
+            mQueues[queue].jobsStolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Run a job on the thread that owns the given queue, splitting ranges larger than a batch, then decrease its counter
+void ThreadPool::Execute(Job job, unsigned int queue)
+{
+    mQueues[queue].jobsRun.fetch_add(1, std::memory_order_relaxed);
+
+    if (job.rangeFunction != nullptr)
+    {
+        // Put the second half of the batches back on the queue for another thread to steal and carry on with the first,
+        // until only one batch is left. The halves put back are the largest pieces, so are the first to be stolen
+        while (job.end - job.begin > job.batchSize)
+        {
+            unsigned int numBatches = (job.end - job.begin + job.batchSize - 1) / job.batchSize;
+            Job secondHalf = job;
+            secondHalf.begin = job.begin + (numBatches / 2) * job.batchSize;
+            job.end = secondHalf.begin;
+
+            if (job.counter != nullptr)  job.counter->mCount.fetch_add(1);
+            Push(secondHalf, queue);
+        }
+        job.rangeFunction(job.context, job.begin, job.end);
+    }
+    else
+    {
+        job.function(job.context);
+    }
+
+    Finish(job.counter);
+}
+
+
+// Decrease a counter, starting any jobs waiting for it if it reaches zero
+// A waiting thread may destroy the counter as soon as it is done, so it isn't used after that
+void ThreadPool::Finish(JobCounter* counter)
+{
+    if (counter == nullptr)  return;
+
+    // Without waiting jobs the count is just decreased. The last job of a counter with waiting jobs takes the waiting
+    // lock, so no more jobs can be added to the list while it is taken
+    const unsigned int LAST_WITH_WAITING = JobCounter::HAS_WAITING_JOBS | 1;
+    unsigned int count = counter->mCount.load();
+    while (count != LAST_WITH_WAITING)
+    {
+        if (counter->mCount.compare_exchange_weak(count, count - 1))  return;
+    }
+
+    WaitingJob* ready = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mWaitingMutex);
+        if (counter->mCount.fetch_sub(1) != LAST_WITH_WAITING)  return; // Another job was added with the counter meanwhile
+
+        // Take the list then clear the mark, which makes the counter done. If a job was added with the counter since
+        // the decrease above then it isn't done after all, and the list is left for that job to release
+        ready = counter->mWaitingJobs;
+        counter->mWaitingJobs = nullptr;
+        unsigned int expected = JobCounter::HAS_WAITING_JOBS;
+        if (!counter->mCount.compare_exchange_strong(expected, 0))
+        {
+            counter->mWaitingJobs = ready;
+            return;
+        }
+    }
+    ReleaseWaitingJobs(ready);
+}
+
+
+// Queue a list of jobs whose dependency has reached zero and reuse their entries
+// They are queued after the lock is released, since a full queue runs a job immediately and that job may add more
+void ThreadPool::ReleaseWaitingJobs(WaitingJob* waitingJobs)
+{
+    unsigned int queue = CurrentQueue();
+    Job ready[RELEASE_BATCH];
+    while (waitingJobs != nullptr)
+    {
+        unsigned int numReady = 0;
+        {
+            std::lock_guard<std::mutex> lock(mWaitingMutex);
+            while (waitingJobs != nullptr && numReady < RELEASE_BATCH)
+            {
+                WaitingJob* entry = waitingJobs;
+                waitingJobs = entry->next;
+                ready[numReady++] = entry->job;
+                entry->next = mFreeWaitingJobs;
+                mFreeWaitingJobs = entry;
+            }
+        }
+        for (unsigned int i = 0; i < numReady; ++i)  Push(ready[i], queue);
+    }
+}
+
+
+// Main function for each worker thread
+void ThreadPool::WorkerLoop(unsigned int queue)
+{
+    tCurrentPool  = this;
+    tCurrentQueue = queue;
+
+    unsigned int idleSpins = 0;
+    std::unique_lock<std::mutex> lock(mMutex, std::defer_lock);
+    while (true)
+    {
+        Job job;
+        if (FindJob(queue, job))
+        {
+            Execute(job, queue);
+            idleSpins = 0;
+            continue;
+        }
+        if (idleSpins < WORKER_SPINS)
+        {
+            ++idleSpins;
+            std::this_thread::yield();
+            continue;
+        }
+
+        lock.lock();
+        if (!mTasks.empty())
+        {
+            RunNextTask(lock);
+        }
+        else if (mShutdown && mQueuedJobs.load() == 0)
+        {
+            return; // Shutting down and nothing left to do
+        }
+        else
+        {
+            ++mSleepingWorkers;
+            mWorkAdded.wait(lock, [this] { return mShutdown || !mTasks.empty() || mQueuedJobs.load() > 0; });
+            --mSleepingWorkers;
+        }
+        lock.unlock();
+        idleSpins = 0;
+    }
+}
+
+
+// Take the next task from the queue and run it. The lock must be held on entry and is held again on exit
+void ThreadPool::RunNextTask(std::unique_lock<std::mutex>& lock)
+{
+    std::function<void()> task = std::move(mTasks.front());
+    mTasks.pop_front();
+
+    lock.unlock();
+    task(); // Tasks must catch their own exceptions (see AssetLoader::LoadCPU) - one escaping here would terminate the app
+    lock.lock();
+
+    --mUnfinishedTasks;
+    if (mUnfinishedTasks == 0)
+    {
+        mTasksFinished.notify_all();
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Benchmark
+-----------------------------------------------------------------------------------------*/
+
+// Measure the job system with pools of 1, 2, 4... threads up to the number of hardware threads: the cost of running
+// empty jobs, of an empty ParallelFor, and of a chain of dependent jobs, then the speed-up of ParallelFor on some real
+// arithmetic. Also checks that every job and batch runs exactly once, in dependency order, including nested ParallelFor
+// calls. Returns a report for the debug output
+// A pool always has at least one worker, so the single thread row runs everything on a pool with one worker that is
+// kept busy, leaving the calling thread to do the work on its own
+std::string BenchmarkJobs(unsigned int numJobs /*= 100000*/, unsigned int iterations /*= 20*/)
+{
+    typedef std::chrono::duration<double> Seconds;
+    if (numJobs < 1024)  numJobs = 1024;
+    if (iterations == 0)  iterations = 1;
+
+    // Jobs are added in groups that fit in a queue, as a parent job would, so none are run immediately by Push
+    const unsigned int GROUP_SIZE     = JOB_QUEUE_SIZE / 2;
+    const unsigned int CHAIN_LENGTH   = 1000;
+    const unsigned int SMALL_FOR      = 64;   // Items in the small ParallelFor, one per batch, like a frame's culling
+    const unsigned int WORK_BATCH     = 256;  // Items per batch of the arithmetic workload
+    const unsigned int WORK_PER_ITEM  = 64;   // Square roots per item
+    const unsigned int NESTED_OUTER   = 64;
+
+    // The arithmetic workload, its results must not depend on the number of threads
+    std::vector<float> results(numJobs), expected(numJobs);
+    auto work = [&](float* output, unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; ++i)
+        {
+            float x = static_cast<float>(i);
+            for (unsigned int j = 0; j < WORK_PER_ITEM; ++j)  x = std::sqrt(x + static_cast<float>(j));
+            output[i] = x;
+        }
+    };
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int iteration = 0; iteration < iterations; ++iteration)  work(expected.data(), 0, numJobs);
+    Seconds serialTime = std::chrono::steady_clock::now() - start;
+
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    if (hardwareThreads == 0)  hardwareThreads = 1;
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < hardwareThreads; threads *= 2)  threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    std::string report;
+    char line[256];
+    std::snprintf(line, sizeof(line), "Job system benchmark: %u jobs, %u hardware threads, serial arithmetic %.3f ms\n",
+                  numJobs, hardwareThreads, serialTime.count() * 1000 / iterations);
+    report += line;
+    report += "  Threads  ns/job  ns/batch  us/small for  ns/link  arithmetic ms  speed-up  stolen  errors\n";
+
+    std::unique_ptr<std::atomic<unsigned int>[]> hits(new std::atomic<unsigned int>[numJobs]);
+    std::unique_ptr<JobCounter[]> chain(new JobCounter[CHAIN_LENGTH]);
+
+    for (unsigned int threads : threadCounts)
+    {
+        // With one thread the pool's only worker is parked on a job that waits for the measurements to finish
+        ThreadPool pool(threads > 1 ? threads - 1 : 1);
+        std::atomic<bool> measuring(true);
+        auto park = [&]() { while (measuring.load())  std::this_thread::yield(); };
+        JobCounter parked;
+        if (threads == 1)
+        {
+            pool.Run(park, &parked);
+            while (pool.Stats().jobs == 0)  std::this_thread::yield();
+        }
+        pool.ResetStats();
+
+        unsigned int errors = 0;
+        for (unsigned int i = 0; i < numJobs; ++i)  hits[i] = 0;
+
+        // Empty jobs: the cost of adding, finding, running and counting a job
+        auto count = [](void* context) { static_cast<std::atomic<unsigned int>*>(context)->fetch_add(1, std::memory_order_relaxed); };
+        start = std::chrono::steady_clock::now();
+        for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+        {
+            JobCounter counter;
+            for (unsigned int i = 0; i < numJobs; i += GROUP_SIZE)
+            {
+                unsigned int groupEnd = std::min(i + GROUP_SIZE, numJobs);
+                for (unsigned int j = i; j < groupEnd; ++j)  pool.Run(count, &hits[j], &counter);
+                pool.Wait(counter);
+            }
+        }
+        Seconds jobTime = std::chrono::steady_clock::now() - start;
+        for (unsigned int i = 0; i < numJobs; ++i)  if (hits[i] != iterations)  ++errors;
+
+        // Empty ParallelFor with one item per batch: the cost of splitting and stealing ranges
+        for (unsigned int i = 0; i < numJobs; ++i)  hits[i] = 0;
+        auto countRange = [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int i = begin; i < end; ++i)  hits[i].fetch_add(1, std::memory_order_relaxed);
+        };
+        start = std::chrono::steady_clock::now();
+        for (unsigned int iteration = 0; iteration < iterations; ++iteration)  pool.ParallelFor(numJobs, 1, countRange);
+        Seconds batchTime = std::chrono::steady_clock::now() - start;
+        for (unsigned int i = 0; i < numJobs; ++i)  if (hits[i] != iterations)  ++errors;
+
+        // A small ParallelFor, the overhead paid by each parallel step of a frame
+        auto nothing = [](unsigned int, unsigned int) {};
+        const unsigned int smallRepeats = iterations * 100;
+        start = std::chrono::steady_clock::now();
+        for (unsigned int repeat = 0; repeat < smallRepeats; ++repeat)  pool.ParallelFor(SMALL_FOR, 1, nothing);
+        Seconds smallTime = std::chrono::steady_clock::now() - start;
+
+        // A chain of jobs, each depending on the one before: the cost of holding back and releasing a job. Each link
+        // records its place in the order the links ran
+        std::atomic<unsigned int> nextLink(0);
+        std::vector<unsigned int> order(CHAIN_LENGTH);
+        struct Link { std::atomic<unsigned int>* next; unsigned int* order; };
+        std::vector<Link> links(CHAIN_LENGTH);
+        auto runLink = [](void* context)
+        {
+            Link* link = static_cast<Link*>(context);
+            *link->order = link->next->fetch_add(1);
+        };
+        start = std::chrono::steady_clock::now();
+        for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+        {
+            nextLink = 0;
+            for (unsigned int i = 0; i < CHAIN_LENGTH; ++i)
+            {
+                links[i] = { &nextLink, &order[i] };
+                pool.Run(runLink, &links[i], &chain[i], i > 0 ? &chain[i - 1] : nullptr);
+            }
+            pool.Wait(chain[CHAIN_LENGTH - 1]);
+            for (unsigned int i = 0; i < CHAIN_LENGTH; ++i)  if (order[i] != i)  ++errors;
+        }
+        Seconds chainTime = std::chrono::steady_clock::now() - start;
+
+        // Real work, checked against the serial results
+        auto workRange = [&](unsigned int begin, unsigned int end) { work(results.data(), begin, end); };
+        start = std::chrono::steady_clock::now();
+        for (unsigned int iteration = 0; iteration < iterations; ++iteration)  pool.ParallelFor(numJobs, WORK_BATCH, workRange);
+        Seconds workTime = std::chrono::steady_clock::now() - start;
+        if (results != expected)  ++errors;
+
+        // ParallelFor inside ParallelFor, every item of every inner range exactly once
+        for (unsigned int i = 0; i < numJobs; ++i)  hits[i] = 0;
+        unsigned int innerCount = numJobs / NESTED_OUTER;
+        auto outer = [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int o = begin; o < end; ++o)
+            {
+                auto inner = [&](unsigned int innerBegin, unsigned int innerEnd)
+                {
+                    for (unsigned int i = innerBegin; i < innerEnd; ++i)  hits[o * innerCount + i].fetch_add(1);
+                };
+                pool.ParallelFor(innerCount, 16, inner);
+            }
+        };
+        pool.ParallelFor(NESTED_OUTER, 1, outer);
+        for (unsigned int i = 0; i < NESTED_OUTER * innerCount; ++i)  if (hits[i] != 1)  ++errors;
+
+        JobStats stats = pool.Stats();
+        measuring = false;
+        pool.Wait(parked);
+
+        std::snprintf(line, sizeof(line), "  %7u  %6.1f  %8.1f  %12.2f  %7.1f  %13.3f  %8.2f  %5.1f%%  %6u\n", threads,
+                      jobTime.count() * 1e9 / (static_cast<double>(numJobs) * iterations),
+                      batchTime.count() * 1e9 / (static_cast<double>(numJobs) * iterations),
+                      smallTime.count() * 1e6 / smallRepeats,
+                      chainTime.count() * 1e9 / (static_cast<double>(CHAIN_LENGTH) * iterations),
+                      workTime.count() * 1000 / iterations, serialTime.count() / workTime.count(),
+                      stats.jobs > 0 ? 100.0 * stats.stolen / stats.jobs : 0.0, errors);
+        report += line;
+    }
+    return report;
+}
@@ -0,0 +1,249 @@
+//--------------------------------------------------------------------------------------
+// Thread pool - a fixed set of worker threads that run queued tasks and jobs
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Tasks are added to a shared queue and picked up by whichever worker is free. The thread
+// that waits for the tasks to finish also runs tasks from the queue rather than sitting idle.
+// Tasks must not touch the D3D context or other shared data without their own synchronisation.
+// Tasks are std::function objects, fine for loading but too heavy for work repeated every frame.
+//
+// Frame work uses jobs instead: a function pointer and a context pointer, stored by value so
+// running a job never uses the heap. Each worker has its own queue (deque) of jobs. A thread
+// adds jobs to the back of its own queue and takes them from the back too, so it works on the
+// newest, smallest pieces while their data is still in its cache. A thread with nothing to do
+// steals the oldest job from the front of another thread's queue, which is usually the largest
+// piece of work left. Threads outside the pool (e.g. the main thread) share one extra queue.
+// Each queue has its own small lock, so threads only contend when stealing from the same queue.
+// Jobs are grouped by a JobCounter: it counts the jobs not yet finished, and can be waited on or
+// given as the dependency of later jobs, which are held back until it reaches zero. A thread that
+// waits on a counter runs jobs while it waits, so jobs may wait on other jobs without deadlock.
+// ParallelFor is built on jobs: the range is added as one job, and a thread that takes a range
+// larger than a batch puts half of it back for others to steal before working on the rest. This
+// spreads the work in a few steps whatever the number of threads, and lets ParallelFor be called
+// from any thread, from inside a job, or inside another ParallelFor.
+
+#ifndef _THREAD_POOL_H_INCLUDED_
+#define _THREAD_POOL_H_INCLUDED_
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+
+// Number of jobs that each queue can hold. A thread whose queue is full runs further jobs it adds immediately instead
+const unsigned int JOB_QUEUE_SIZE = 512;
+
+
+// A job held back until its dependency reaches zero, in a list on the dependency (see ThreadPool.cpp)
+struct WaitingJob;
+
+// Counts the jobs added with it that haven't finished yet. Wait for it with ThreadPool::Wait, or give it as the
+// dependency of other jobs, which are kept in a list on the counter until it reaches zero. Must stay alive until it is
+// done, and can be reused after that
+class JobCounter
+{
+public:
+    JobCounter() : mCount(0), mWaitingJobs(nullptr) {}
+
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    // True when all the jobs added with the counter have finished and any jobs depending on it have been queued. The
+    // pool doesn't use the counter after that
+    bool IsDone() const  { return mCount.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+
+    // Set in mCount while jobs are waiting for the counter, so the job that takes the count to zero knows to queue them
+    // and the counter doesn't read as done until it has
+    static const unsigned int HAS_WAITING_JOBS = 0x80000000u;
+
+    // Dependent jobs change these, which doesn't change what the counter counts
+    mutable std::atomic<unsigned int> mCount;
+    mutable WaitingJob*               mWaitingJobs; // Protected by the pool's mWaitingMutex
+};
+
+
+// Job counts since the last ResetStats
+struct JobStats
+{
+    unsigned int jobs      = 0; // Jobs run (including each piece of a split ParallelFor range)
+    unsigned int stolen    = 0; // ...of which were taken from another thread's queue
+    unsigned int immediate = 0; // ...of which were run as soon as they were added because a queue was full
+};
+
+
+class ThreadPool
+{
+public:
+    // Create the worker threads. Pass 0 to use one fewer than the number of hardware threads (the
+    // thread that calls WaitAll makes up the difference)
+    explicit ThreadPool(unsigned int numThreads = 0);
+
+    // Finishes any queued tasks and jobs then stops the worker threads
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+
+    // Number of worker threads, not including the thread that calls WaitAll
+    unsigned int NumThreads() const  { return static_cast<unsigned int>(mThreads.size()); }
+
+    // Add a task to the queue. Tasks may run in any order and on any thread
+    void AddTask(std::function<void()> task);
+
+    // Wait until all tasks added so far have finished. The calling thread runs queued tasks while it waits
+    void WaitAll();
+
+
+    /*-----------------------------------------------------------------------------------------
+        Jobs
+    -----------------------------------------------------------------------------------------*/
+
+    // Function run by a job, given the job's context pointer
+    typedef void (*JobFunction)(void* context);
+
+    // Run function(context) as a job on any thread, including the calling one. If a counter is given it is increased
+    // now and decreased when the job finishes. If a dependency is given the job doesn't start until the dependency
+    // reaches zero. Can be called from any thread, including from inside a job
+    void Run(JobFunction function, void* context, JobCounter* counter = nullptr, const JobCounter* dependency = nullptr);
+
+    // As above, but calling function() on any callable object, e.g. a lambda. The object is used in place (not copied),
+    // so it must stay alive until the job has finished
+    template <typename Function>
+    void Run(Function& function, JobCounter* counter = nullptr, const JobCounter* dependency = nullptr)
+    {
+        Run([](void* context) { (*static_cast<Function*>(context))(); }, &function, counter, dependency);
+    }
+
+    // Wait until the counter reaches zero. The calling thread runs jobs (any jobs, not just the counter's) while it
+    // waits. Can be called from inside a job
+    void Wait(const JobCounter& counter);
+
+
+    // Function called by ParallelFor for each batch, given the context pointer and a range [begin, end)
+    typedef void (*ParallelForFunction)(void* context, unsigned int begin, unsigned int end);
+
+    // Call function(context, begin, end) for batches of batchSize items covering the range [0, count). Batches are run
+    // on the workers and the calling thread, and the call returns when all of them are done. Doesn't allocate memory,
+    // and can be called from any thread, from inside a job or from inside another ParallelFor
+    void ParallelFor(unsigned int count, unsigned int batchSize, ParallelForFunction function, void* context);
+
+    // As above, but calling function(begin, end) on any callable object, e.g. a lambda. The object is used in place
+    // (not copied), so this doesn't allocate either
+    template <typename Function>
+    void ParallelFor(unsigned int count, unsigned int batchSize, Function& function)
+    {
+        ParallelFor(count, batchSize, [](void* context, unsigned int begin, unsigned int end)
+                                      { (*static_cast<Function*>(context))(begin, end); }, &function);
+    }
+
+    // As ParallelFor, but returns straight away: the range is added as a job using the counter (and dependency) as Run
+    // does. The context must stay valid until the counter reaches zero
+    void RunParallelFor(unsigned int count, unsigned int batchSize, ParallelForFunction function, void* context,
+                        JobCounter* counter, const JobCounter* dependency = nullptr);
+
+
+    // Job counts, accumulated over all threads until reset. Only exact when no jobs are running
+    JobStats Stats() const;
+    void ResetStats();
+
+
+private:
+    // A job as stored in the queues. Plain jobs call function, ranges call rangeFunction and are split into batches
+    struct Job
+    {
+        JobFunction         function;
+        ParallelForFunction rangeFunction;
+        void*               context;
+        unsigned int        begin, end;
+        unsigned int        batchSize;
+        JobCounter*         counter;    // Decreased when the job finishes, may be nullptr
+    };
+
+    // One thread's queue of jobs, a ring buffer: the owner adds and takes at the back, thieves take from the front
+    struct JobQueue
+    {
+        std::mutex   mutex;
+        Job          jobs[JOB_QUEUE_SIZE];
+        unsigned int front = 0; // Index of the oldest job, the number of jobs is back - front
+        unsigned int back  = 0;
+
+        // Counts for Stats, written by the threads using this queue
+        std::atomic<unsigned int> jobsRun{0}, jobsStolen{0}, jobsImmediate{0};
+
+        char padding[64]; // Keep the next queue's lock off this queue's cache lines
+    };
+
+
+    // Index of the calling thread's queue: its own for a worker of this pool, otherwise the queue shared by other threads
+    unsigned int CurrentQueue() const;
+
+    // Add a job to a queue and wake a sleeping worker. Runs the job immediately if the queue is full
+    void Push(const Job& job, unsigned int queue);
+
+    // Add a job to the calling thread's queue, or to the dependency's waiting list if it hasn't reached zero
+    void Submit(const Job& job, const JobCounter* dependency);
+
+    // Add a block of entries to the free list of waiting jobs
+    void AddWaitingJobBlock();
+
+    // Take the newest job from a queue, or steal the oldest from another. Returns false if all queues are empty
+    bool FindJob(unsigned int queue, Job& job);
+
+    // Run a job on the thread that owns the given queue, splitting ranges larger than a batch, then decrease its counter
+    void Execute(Job job, unsigned int queue);
+
+    // Decrease a counter, starting any jobs waiting for it if it reaches zero
+    void Finish(JobCounter* counter);
+
+    // Queue a list of jobs whose dependency has reached zero and reuse their entries
+    void ReleaseWaitingJobs(WaitingJob* waitingJobs);
+
+
+    // Main function for each worker thread
+    void WorkerLoop(unsigned int queue);
+
+    // Take the next task from the queue and run it. The lock must be held on entry and is held again on exit
+    void RunNextTask(std::unique_lock<std::mutex>& lock);
+
+
+    std::vector<std::thread> mThreads;
+
+    std::deque<std::function<void()>> mTasks;
+    unsigned int mUnfinishedTasks = 0; // Tasks queued or running
+    bool         mShutdown = false;
+
+    std::mutex              mMutex;         // Protects the task data above
+    std::condition_variable mWorkAdded;     // Signalled when a task or job is added or the pool is shutting down
+    std::condition_variable mTasksFinished; // Signalled when the number of unfinished tasks reaches zero
+
+    std::unique_ptr<JobQueue[]> mQueues;    // One per worker, then one shared by all other threads
+    unsigned int                mNumQueues;
+    std::atomic<unsigned int>   mQueuedJobs{0};      // Jobs in all the queues, so workers know when to sleep
+    std::atomic<unsigned int>   mSleepingWorkers{0}; // Workers waiting on mWorkAdded, so adding a job only wakes one if needed
+
+    // Entries for jobs waiting for their dependencies, allocated in blocks. Unused entries are kept in a free list
+    friend struct WaitingJob;
+    std::vector<std::unique_ptr<WaitingJob[]>> mWaitingJobBlocks;
+    WaitingJob*                                mFreeWaitingJobs = nullptr;
+    std::mutex                                 mWaitingMutex; // Protects the free list and the counters' waiting lists
+};
+
+
+// Measure the job system with pools of 1, 2, 4... threads up to the number of hardware threads: the cost of running
+// empty jobs, of an empty ParallelFor, and of a chain of dependent jobs, then the speed-up of ParallelFor on some real
+// arithmetic. Also checks that every job and batch runs exactly once, in dependency order, including nested
+// ParallelFor calls. Returns a report for the debug output
+std::string BenchmarkJobs(unsigned int numJobs = 100000, unsigned int iterations = 20);
+
+
+#endif //_THREAD_POOL_H_INCLUDED_
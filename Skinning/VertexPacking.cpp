@@ -0,0 +1,333 @@
+//--------------------------------------------------------------------------------------
+// Vertex packing - compact vertex and index formats for imported meshes
+//--------------------------------------------------------------------------------------
+
+#include "VertexPacking.h"
+
+#include <stdexcept>
+#include <memory>
+#include <cstdio>
+
+
+/*-----------------------------------------------------------------------------------------
+    Element formats
+-----------------------------------------------------------------------------------------*/
+
+// Convert a float to a half float (1 sign bit, 5 exponent bits, 10 mantissa bits), rounding to nearest. Values too
+// large for a half become infinity
+uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude >= 0x7f800000)  return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00); // NaN or infinity
+    if (magnitude >= 0x477ff000)  return sign | 0x7c00; // 65520 and above round to infinity
+
+    if (magnitude < 0x38800000)
+    {
+        // Below the smallest normal half (2^-14): a denormal counting in steps of 2^-24. Scaling by 2^24 is exact and
+        // nearbyint rounds to nearest even. 2^-14 itself rounds up to 0x400, which is the smallest normal half
+        float absolute;
+        std::memcpy(&absolute, &magnitude, sizeof(absolute));
+        return sign | static_cast<uint16_t>(std::nearbyint(absolute * 16777216.0f));
+    }
+
+    // Change the exponent bias from 127 to 15 and keep the top 10 mantissa bits, then round to nearest even using
+    // the 13 bits dropped. A carry out of the mantissa correctly moves up to the next exponent
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t dropped = magnitude & 0x1fff;
+    if (dropped > 0x1000 || (dropped == 0x1000 && (half & 1)))  ++half;
+    return sign | static_cast<uint16_t>(half);
+}
+
+
+// Convert a half float to a float, exactly
+float HalfToFloat(uint16_t half)
+{
+    uint32_t sign     = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0)
+    {
+        // Zero or denormal
+        float value = mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+
+    uint32_t bits = (exponent == 31) ? (sign | 0x7f800000 | (mantissa << 13))             // Infinity or NaN
+                                     : (sign | ((exponent + 112) << 23) | (mantissa << 13)); // Rebias 15 to 127
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+// Write a direction as two 16-bit signed normalised values in octahedral form (see above). The direction needn't be
+// normalised. Of the four nearest encodings, the one that decodes closest to the direction is used
+void WriteOctahedral(const CVector3& direction, unsigned char* output)
+{
+    // Project onto the octahedron, then fold the lower half out over the corners. A zero vector is written as +z
+    float u = 0, v = 0;
+    float sum = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+    if (sum > 0)
+    {
+        u = direction.x / sum;
+        v = direction.y / sum;
+        if (direction.z < 0)
+        {
+            float foldedU = (1.0f - std::abs(v)) * (u >= 0 ? 1.0f : -1.0f);
+            float foldedV = (1.0f - std::abs(u)) * (v >= 0 ? 1.0f : -1.0f);
+            u = foldedU;
+            v = foldedV;
+        }
+    }
+
+    // Rounding each coordinate to the nearest step isn't always the closest direction, as the octahedron isn't flat.
+    // Try rounding each one down and up and keep the best
+    float length = Length(direction);
+    CVector3 target = (length > 0) ? CVector3{ direction.x / length, direction.y / length, direction.z / length } : CVector3{ 0, 0, 1 };
+    float lowU = std::floor(u * 32767.0f), lowV = std::floor(v * 32767.0f);
+    int16_t best[2] = { 0, 0 };
+    float bestDot = -2.0f;
+    for (int i = 0; i < 4; ++i)
+    {
+        int16_t candidate[2] = { static_cast<int16_t>(std::min(std::max(lowU + (i & 1),  -32767.0f), 32767.0f)),
+                                 static_cast<int16_t>(std::min(std::max(lowV + (i >> 1), -32767.0f), 32767.0f)) };
+        unsigned char encoded[4];
+        std::memcpy(encoded, candidate, sizeof(encoded));
+        float dot = Dot(ReadOctahedral(encoded), target);
+        if (dot > bestDot)
+        {
+            bestDot = dot;
+            best[0] = candidate[0];
+            best[1] = candidate[1];
+        }
+    }
+    std::memcpy(output, best, sizeof(best));
+}
+
+
+// Write four bone weights as 8-bit normalised values. Each is rounded to the nearest 1/255, then the largest is
+// adjusted so the packed weights add up to the same total (to the nearest 1/255) as the originals
+void WriteWeights(const float weights[4], unsigned char* output)
+{
+    int packed[4];
+    int packedTotal = 0, largest = 0;
+    float total = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        float weight = std::min(std::max(weights[i], 0.0f), 1.0f);
+        packed[i] = static_cast<int>(std::lround(weight * 255.0f));
+        packedTotal += packed[i];
+        total += weight;
+        if (weights[i] > weights[largest])  largest = i;
+    }
+
+    // Each rounding is out by at most half a step, so the largest weight (at least a quarter of the total) can always
+    // take up the difference without going out of range
+    packed[largest] += static_cast<int>(std::lround(total * 255.0f)) - packedTotal;
+    for (int i = 0; i < 4; ++i)  output[i] = static_cast<unsigned char>(std::min(std::max(packed[i], 0), 255));
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Packing
+-----------------------------------------------------------------------------------------*/
+
+namespace
+{
+    // Angle in degrees between two directions, which needn't be normalised. Using both the sine (from the cross
+    // product) and cosine keeps small angles accurate
+    float AngleBetween(const CVector3& a, const CVector3& b)
+    {
+        return std::atan2(Length(Cross(a, b)), Dot(a, b)) * (180.0f / 3.14159265f);
+    }
+
+    // Read three unaligned floats
+    CVector3 ReadFloat3(const unsigned char* input)
+    {
+        float values[3];
+        std::memcpy(values, input, sizeof(values));
+        return CVector3(values);
+    }
+}
+
+
+// Pack the vertices and indices of a sub-mesh into the compact formats described above, replacing its data and
+// layout. The sub-mesh must have the float layout built by MeshData::Import (with float weights after the bone
+// indices) and hold its data in its own storage. If stats is given the sizes and largest errors are added to it
+void PackSubMesh(SubMeshData& subMesh, VertexPackingStats* stats /*= nullptr*/)
+{
+    const uint32_t NO_ELEMENT = SubMeshData::NO_ELEMENT;
+    VertexPackingStats packing;
+    packing.subMeshes     = 1;
+    packing.originalBytes = static_cast<std::size_t>(subMesh.numVertices) * subMesh.vertexSize +
+                            static_cast<std::size_t>(subMesh.TotalIndices()) * subMesh.indexSize;
+
+    // UVs are only packed if every one of them survives as a half float
+    bool halfUVs = false;
+    float halfUVError = 0;
+    if (subMesh.uvOffset != NO_ELEMENT)
+    {
+        for (unsigned int v = 0; v < subMesh.numVertices; ++v)
+        {
+            float uv[2];
+            std::memcpy(uv, subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize + subMesh.uvOffset, sizeof(uv));
+            for (int c = 0; c < 2; ++c)  halfUVError = std::max(halfUVError, std::abs(HalfToFloat(FloatToHalf(uv[c])) - uv[c]));
+        }
+        halfUVs = (halfUVError <= MAX_HALF_UV_ERROR);
+        packing.halfUVs    = halfUVs ? 1 : 0;
+        packing.maxUVError = halfUVs ? halfUVError : 0;
+    }
+
+    // New layout with the elements in the same order. Every element is a multiple of 4 bytes so all stay aligned
+    std::vector<VertexElement> layout;
+    uint32_t offset = 0;
+    auto addElement = [&](const char* semantic, VertexElementFormat format, uint32_t size)
+    {
+        layout.push_back( { "", format, offset } );
+        std::strncpy(layout.back().semantic, semantic, sizeof(layout.back().semantic) - 1);
+        offset += size;
+        return layout.back().offset;
+    };
+    uint32_t positionOffset = NO_ELEMENT, normalOffset = NO_ELEMENT, tangentOffset = NO_ELEMENT, uvOffset = NO_ELEMENT, bonesOffset = NO_ELEMENT;
+    if (subMesh.positionOffset != NO_ELEMENT)  positionOffset = addElement("position", VertexElementFormat::Float3, 12);
+    if (subMesh.normalOffset   != NO_ELEMENT)  normalOffset   = addElement("normal",   VertexElementFormat::Short2N, 4);
+    if (subMesh.tangentOffset  != NO_ELEMENT)  tangentOffset  = addElement("tangent",  VertexElementFormat::Short2N, 4);
+    if (subMesh.uvOffset       != NO_ELEMENT)  uvOffset       = halfUVs ? addElement("uv", VertexElementFormat::Half2,  4)
+                                                                        : addElement("uv", VertexElementFormat::Float2, 8);
+    if (subMesh.bonesOffset    != NO_ELEMENT)
+    {
+        bonesOffset = addElement("bones", VertexElementFormat::UByte4, 4);
+        addElement("weights", VertexElementFormat::UByte4N, 4); // Immediately after the bone indices, as before
+    }
+    uint32_t vertexSize = offset;
+
+    // Pack each vertex, decoding it again to measure the error
+    auto vertexStorage = std::make_unique<unsigned char[]>(static_cast<std::size_t>(subMesh.numVertices) * vertexSize);
+    for (unsigned int v = 0; v < subMesh.numVertices; ++v)
+    {
+        const unsigned char* vertex = subMesh.vertices + static_cast<std::size_t>(v) * subMesh.vertexSize;
+        unsigned char* packed = vertexStorage.get() + static_cast<std::size_t>(v) * vertexSize;
+
+        if (positionOffset != NO_ELEMENT)  std::memcpy(packed + positionOffset, vertex + subMesh.positionOffset, 12);
+
+        if (normalOffset != NO_ELEMENT)
+        {
+            CVector3 normal = ReadFloat3(vertex + subMesh.normalOffset);
+            WriteOctahedral(normal, packed + normalOffset);
+            if (Length(normal) > 0)  packing.maxNormalError = std::max(packing.maxNormalError, AngleBetween(normal, ReadOctahedral(packed + normalOffset)));
+        }
+        if (tangentOffset != NO_ELEMENT)
+        {
+            CVector3 tangent = ReadFloat3(vertex + subMesh.tangentOffset);
+            WriteOctahedral(tangent, packed + tangentOffset);
+            if (Length(tangent) > 0)  packing.maxTangentError = std::max(packing.maxTangentError, AngleBetween(tangent, ReadOctahedral(packed + tangentOffset)));
+        }
+
+        if (uvOffset != NO_ELEMENT)
+        {
+            if (halfUVs)
+            {
+                float uv[2];
+                std::memcpy(uv, vertex + subMesh.uvOffset, sizeof(uv));
+                uint16_t halves[2] = { FloatToHalf(uv[0]), FloatToHalf(uv[1]) };
+                std::memcpy(packed + uvOffset, halves, sizeof(halves));
+            }
+            else
+            {
+                std::memcpy(packed + uvOffset, vertex + subMesh.uvOffset, 8);
+            }
+        }
+
+        if (bonesOffset != NO_ELEMENT)
+        {
+            float weights[4];
+            std::memcpy(packed + bonesOffset, vertex + subMesh.bonesOffset, 4);
+            std::memcpy(weights, vertex + subMesh.bonesOffset + 4, sizeof(weights));
+            WriteWeights(weights, packed + bonesOffset + 4);
+            for (int i = 0; i < 4; ++i)
+            {
+                packing.maxWeightError = std::max(packing.maxWeightError, std::abs(ReadWeight(packed[bonesOffset + 4 + i]) - weights[i]));
+            }
+        }
+    }
+
+    // 16-bit indices if the vertex count allows
+    if (subMesh.indexSize == 4 && IndexSizeFor(subMesh.numVertices) == 2)
+    {
+        auto indexStorage = std::make_unique<unsigned char[]>(static_cast<std::size_t>(subMesh.TotalIndices()) * 2);
+        uint16_t* indices = reinterpret_cast<uint16_t*>(indexStorage.get());
+        for (unsigned int i = 0; i < subMesh.TotalIndices(); ++i)  indices[i] = static_cast<uint16_t>(subMesh.Index(i));
+        subMesh.indexStorage = std::move(indexStorage);
+        subMesh.indices      = subMesh.indexStorage.get();
+        subMesh.indexSize    = 2;
+    }
+    packing.shortIndices = (subMesh.indexSize == 2) ? 1 : 0;
+
+    subMesh.layout         = std::move(layout);
+    subMesh.vertexSize     = vertexSize;
+    subMesh.positionOffset = positionOffset;
+    subMesh.normalOffset   = normalOffset;
+    subMesh.tangentOffset  = tangentOffset;
+    subMesh.uvOffset       = uvOffset;
+    subMesh.bonesOffset    = bonesOffset;
+    subMesh.vertexStorage  = std::move(vertexStorage);
+    subMesh.vertices       = subMesh.vertexStorage.get();
+
+    if (stats != nullptr)
+    {
+        packing.packedBytes = static_cast<std::size_t>(subMesh.numVertices) * subMesh.vertexSize +
+                              static_cast<std::size_t>(subMesh.TotalIndices()) * subMesh.indexSize;
+        stats->originalBytes  += packing.originalBytes;
+        stats->packedBytes    += packing.packedBytes;
+        stats->subMeshes      += packing.subMeshes;
+        stats->shortIndices   += packing.shortIndices;
+        stats->halfUVs        += packing.halfUVs;
+        stats->maxNormalError  = std::max(stats->maxNormalError,  packing.maxNormalError);
+        stats->maxTangentError = std::max(stats->maxTangentError, packing.maxTangentError);
+        stats->maxUVError      = std::max(stats->maxUVError,      packing.maxUVError);
+        stats->maxWeightError  = std::max(stats->maxWeightError,  packing.maxWeightError);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Report
+-----------------------------------------------------------------------------------------*/
+
+// Import the given mesh files (ignoring cooked files) and report the vertex and index memory saved by packing and
+// the largest round-trip errors of each. Tangents are only imported (and checked) if requested, which needs meshes
+// with UVs. Returns the results as a text table
+std::string ReportVertexPacking(const std::vector<std::string>& fileNames, bool requireTangents /*= false*/)
+{
+    std::string report = requireTangents ? "Vertex packing (with tangents)\n" : "Vertex packing\n";
+    report += "  Float KB  Packed KB  Saved  16-bit  Half UV  Normal deg  Tangent deg  UV error  Weight error  File\n";
+    char line[512];
+
+    for (auto& fileName : fileNames)
+    {
+        MeshData mesh;
+        VertexPackingStats stats;
+        try
+        {
+            mesh.Import(fileName, requireTangents, &stats);
+        }
+        catch (const std::runtime_error& e)
+        {
+            report += std::string("  ") + e.what() + "\n";
+            continue;
+        }
+
+        double saved = (stats.originalBytes > 0) ? 100.0 * (stats.originalBytes - stats.packedBytes) / stats.originalBytes : 0;
+        std::snprintf(line, sizeof(line), "  %8.1f  %9.1f  %4.1f%%  %3u/%-2u  %4u/%-2u  %10.5f  %11.5f  %8.2e  %12.2e  %s\n",
+                      stats.originalBytes / 1024.0, stats.packedBytes / 1024.0, saved, stats.shortIndices, stats.subMeshes,
+                      stats.halfUVs, stats.subMeshes, stats.maxNormalError, stats.maxTangentError, stats.maxUVError,
+                      stats.maxWeightError, fileName.c_str());
+        report += line;
+    }
+    return report;
+}
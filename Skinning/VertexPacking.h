@@ -0,0 +1,126 @@
+//--------------------------------------------------------------------------------------
+// Vertex packing - compact vertex and index formats for imported meshes
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Meshes are imported with float vertices (float3 normals and tangents, float2 UVs and four float
+// bone weights) and 32-bit indices, 32 to 52 bytes per vertex. After import each sub-mesh is
+// packed into smaller formats before it is cooked or copied to the GPU:
+//   - Normals and tangents are stored in octahedral form. The direction is projected onto an
+//     octahedron (|x| + |y| + |z| = 1), whose lower half is folded out over the corners of the
+//     upper half to fill a square. The two coordinates on the square are 16-bit signed normalised
+//     values, 4 bytes rather than 12, with an angular error of a few thousandths of a degree.
+//     Vertex shaders decode them with DecodeOctahedral in Common.hlsli
+//   - UVs become two half floats, unless that would move any UV by more than half a texel of a
+//     2048 texture (e.g. large tiled UVs on the ground), in which case they stay as floats. The
+//     GPU converts either format to float2 so the shaders don't need to know which was used
+//   - Bone weights become four 8-bit normalised values, rounded so they still add up to 1
+//   - Sub-meshes with fewer than 65536 vertices use 16-bit indices
+// Positions stay as floats. Packed vertices are 20 to 28 bytes.
+// The CPU code that reads vertices (CPU skinning, static batching) uses the functions below to
+// decode them.
+
+#ifndef _VERTEX_PACKING_H_INCLUDED_
+#define _VERTEX_PACKING_H_INCLUDED_
+
+#include "MeshData.h"
+#include "CVector3.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+
+// Largest change to a UV allowed when packing it as a half float: half a texel of a 2048 texture
+const float MAX_HALF_UV_ERROR = 0.5f / 2048;
+
+
+// Sizes and largest round-trip errors from packing the sub-meshes of a mesh
+struct VertexPackingStats
+{
+    std::size_t  originalBytes   = 0; // Vertex and index data before packing
+    std::size_t  packedBytes     = 0; // ...and after
+    unsigned int subMeshes       = 0;
+    unsigned int shortIndices    = 0; // Sub-meshes given 16-bit indices
+    unsigned int halfUVs         = 0; // Sub-meshes given half float UVs
+    float        maxNormalError  = 0; // In degrees
+    float        maxTangentError = 0; // In degrees
+    float        maxUVError      = 0; // In the format chosen for each sub-mesh
+    float        maxWeightError  = 0;
+};
+
+
+//-------------------------------------
+// Element formats
+//-------------------------------------
+
+// Convert a float to a half float (1 sign bit, 5 exponent bits, 10 mantissa bits), rounding to nearest. Values too
+// large for a half become infinity
+uint16_t FloatToHalf(float value);
+
+// Convert a half float to a float, exactly
+float HalfToFloat(uint16_t half);
+
+// Write a direction as two 16-bit signed normalised values in octahedral form (see above). The direction needn't be
+// normalised. Of the four nearest encodings, the one that decodes closest to the direction is used
+void WriteOctahedral(const CVector3& direction, unsigned char* output);
+
+// Read a normalised direction written by WriteOctahedral, the same calculation as DecodeOctahedral in Common.hlsli.
+// Inline as CPU skinning reads a normal for every vertex
+inline CVector3 ReadOctahedral(const unsigned char* input)
+{
+    int16_t encoded[2];
+    std::memcpy(encoded, input, sizeof(encoded));
+
+    // Signed normalised values: -32767 to 32767 cover -1 to 1, and -32768 is also -1
+    float u = std::max(encoded[0] / 32767.0f, -1.0f);
+    float v = std::max(encoded[1] / 32767.0f, -1.0f);
+
+    // Points outside the central diamond were folded out from the lower half of the octahedron, fold them back
+    CVector3 direction = { u, v, 1.0f - std::abs(u) - std::abs(v) };
+    float fold = std::max(-direction.z, 0.0f);
+    direction.x += (direction.x >= 0.0f) ? -fold : fold;
+    direction.y += (direction.y >= 0.0f) ? -fold : fold;
+
+    // Never zero length, |x| + |y| + |z| is 1 before normalising
+    float scale = 1.0f / std::sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+    return { direction.x * scale, direction.y * scale, direction.z * scale };
+}
+
+// Write four bone weights as 8-bit normalised values. Each is rounded to the nearest 1/255, then the largest is
+// adjusted so the packed weights add up to the same total (to the nearest 1/255) as the originals
+void WriteWeights(const float weights[4], unsigned char* output);
+
+// Read a bone weight written by WriteWeights, the same as the GPU conversion of the UNORM format
+inline float ReadWeight(unsigned char weight)
+{
+    return weight * (1.0f / 255.0f);
+}
+
+
+//-------------------------------------
+// Packing
+//-------------------------------------
+
+// Index size in bytes to use for a sub-mesh with the given number of vertices: 2 if every vertex can be indexed with
+// 16 bits, otherwise 4. The largest 16-bit index (0xffff) is left unused as it means "cut" in strip topologies
+inline uint32_t IndexSizeFor(uint32_t numVertices)
+{
+    return (numVertices < 65536) ? 2 : 4;
+}
+
+// Pack the vertices and indices of a sub-mesh into the compact formats described above, replacing its data and
+// layout. The sub-mesh must have the float layout built by MeshData::Import (with float weights after the bone
+// indices) and hold its data in its own storage. If stats is given the sizes and largest errors are added to it
+void PackSubMesh(SubMeshData& subMesh, VertexPackingStats* stats = nullptr);
+
+
+// Import the given mesh files (ignoring cooked files) and report the vertex and index memory saved by packing and
+// the largest round-trip errors of each. Tangents are only imported (and checked) if requested, which needs meshes
+// with UVs. Returns the results as a text table
+std::string ReportVertexPacking(const std::vector<std::string>& fileNames, bool requireTangents = false);
+
+
+#endif //_VERTEX_PACKING_H_INCLUDED_
@@ -17,7 +17,7 @@ LightingPixelShaderInput main(BasicVertex modelVertex)
 
     // Also transform model normals into world space using world matrix - lighting will be calculated in world space
     // Pass this normal to the pixel shader as it is needed to calculate per-pixel lighting
-	float4 modelNormal = float4(modelVertex.normal, 0); // For normals add a 0 in the 4th element to indicate it is a vector
+	float4 modelNormal = float4(DecodeOctahedral(modelVertex.normal), 0); // For normals add a 0 in the 4th element to indicate it is a vector
 	float3 worldNormal = mul(gWorldMatrix, modelNormal).xyz; // Only needed the 4th element to do this multiplication by 4x4 matrix...
                
 	worldNormal = normalize(worldNormal);